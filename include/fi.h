@@ -174,6 +174,7 @@ int ofi_ep_bind_valid(const struct fi_provider *prov, struct fid *bfid,
 
 uint64_t fi_gettime_ms(void);
 uint64_t fi_gettime_us(void);
+uint64_t fi_gettime_ns(void);
 
 /*
  * Address utility functions
@@ -203,6 +204,20 @@ static inline size_t ofi_sizeofaddr(const struct sockaddr *address)
 		sizeof(struct sockaddr_in6));
 }
 
+static inline uint16_t ofi_addr_get_port(const struct sockaddr *addr)
+{
+	return ntohs(addr->sa_family == AF_INET ?
+		     ofi_sin_port(addr) : ofi_sin6_port(addr));
+}
+
+static inline void ofi_addr_set_port(struct sockaddr *addr, uint16_t port)
+{
+	if (addr->sa_family == AF_INET)
+		ofi_sin_port(addr) = htons(port);
+	else
+		ofi_sin6_port(addr) = htons(port);
+}
+
 static inline int ofi_equals_ipaddr(const struct sockaddr_in *addr1,
 				    const struct sockaddr_in *addr2)
 {
@@ -37,82 +37,137 @@
 
 #include "config.h"
 
+#include <stdint.h>
 #include <sys/types.h>
 
 /*
- * Indexer - to find a structure given an index.  Synchronization
- * must be provided by the caller.  Caller must initialize the
- * indexer by setting free_list and size to 0.
+ * Indexes are stored in chunks that double in size: chunk n covers
+ * [OFI_IDX_CHUNK_SIZE * (2^n - 1), OFI_IDX_CHUNK_SIZE * (2^(n+1) - 1)).
+ * The chunk table therefore has a fixed size, chunks are allocated only
+ * when first needed, and a published chunk never moves.  That lets readers
+ * look up entries without a lock while a single writer adds entries.
  */
 
-union ofi_idx_entry {
-	void *item;
-	int   next;
-};
+#define OFI_IDX_CHUNK_BITS 10
+#define OFI_IDX_CHUNK_SIZE ((size_t) 1 << OFI_IDX_CHUNK_BITS)
+#define OFI_IDX_MAX_CHUNKS (sizeof(size_t) * 8 - OFI_IDX_CHUNK_BITS)
+#define OFI_IDX_MAX_INDEX  (SIZE_MAX - OFI_IDX_CHUNK_SIZE)
+
+static inline size_t ofi_idx_chunk(size_t index)
+{
+	size_t n = index + OFI_IDX_CHUNK_SIZE;
+	int bit;
+
+#ifdef __GNUC__
+	bit = (int) (sizeof(unsigned long long) * 8 - 1) - __builtin_clzll(n);
+#else
+	for (bit = 0; n >>= 1; bit++)
+		;
+#endif
+	return bit - OFI_IDX_CHUNK_BITS;
+}
+
+#define ofi_idx_chunk_size(chunk)  (OFI_IDX_CHUNK_SIZE << (chunk))
+#define ofi_idx_chunk_start(chunk) (ofi_idx_chunk_size(chunk) - OFI_IDX_CHUNK_SIZE)
+#define ofi_idx_chunk_offset(index, chunk) ((index) - ofi_idx_chunk_start(chunk))
+
+/*
+ * Indexer - to find a structure given an index.  Inserts and removals
+ * must be serialized by the caller; lookups may run concurrently with
+ * them.  Caller must initialize the indexer by setting it to 0.
+ *
+ * Free entries hold the next free index, tagged in the low bit, so a
+ * lookup of a free index returns NULL.  Freed indexes are reused most
+ * recently freed first.  Index 0 is reserved.  Stored items must be
+ * at least 2-byte aligned.
+ */
+
+typedef void * volatile ofi_idx_entry_t;
 
-#define OFI_IDX_INDEX_BITS 16
-#define OFI_IDX_ENTRY_BITS 10
-#define OFI_IDX_ENTRY_SIZE (1 << OFI_IDX_ENTRY_BITS)
-#define OFI_IDX_ARRAY_SIZE (1 << (OFI_IDX_INDEX_BITS - OFI_IDX_ENTRY_BITS))
-#define OFI_IDX_MAX_INDEX  ((1 << OFI_IDX_INDEX_BITS) - 1)
+#define ofi_idx_entry_is_free(entry) ((uintptr_t) (entry) & 1)
+#define ofi_idx_free_entry(next) ((void *) (((uintptr_t) (next) << 1) | 1))
+#define ofi_idx_free_next(entry) ((size_t) ((uintptr_t) (entry) >> 1))
 
 struct indexer
 {
-	union ofi_idx_entry *array[OFI_IDX_ARRAY_SIZE];
-	int		 free_list;
-	int		 size;	/* Array size (used): [0, OFI_IDX_ARRAY_SIZE) */
+	ofi_idx_entry_t * volatile chunk[OFI_IDX_MAX_CHUNKS];
+	size_t		 free_list;
+	size_t		 chunk_cnt;	/* chunks allocated */
 };
 
-#define ofi_idx_array_index(index) (index >> OFI_IDX_ENTRY_BITS)
-#define ofi_idx_entry_index(index) (index & (OFI_IDX_ENTRY_SIZE - 1))
-
-int ofi_idx_insert(struct indexer *idx, void *item);
-void *ofi_idx_remove(struct indexer *idx, int index);
-void ofi_idx_replace(struct indexer *idx, int index, void *item);
+ssize_t ofi_idx_insert(struct indexer *idx, void *item);
+void *ofi_idx_remove(struct indexer *idx, size_t index);
+void ofi_idx_replace(struct indexer *idx, size_t index, void *item);
 void ofi_idx_reset(struct indexer *idx);
 
-static inline int ofi_idx_is_valid(struct indexer *idx, int index)
+static inline int ofi_idx_is_valid(struct indexer *idx, size_t index)
 {
-	return (index > 0) && (index < idx->size * OFI_IDX_ENTRY_SIZE);
+	return (index > 0) && (index <= OFI_IDX_MAX_INDEX) &&
+	       (ofi_idx_chunk(index) < idx->chunk_cnt);
 }
 
-static inline void *ofi_idx_at(struct indexer *idx, int index)
+static inline ofi_idx_entry_t *ofi_idx_entry(struct indexer *idx, size_t index)
 {
-	return (idx->array[ofi_idx_array_index(index)] + ofi_idx_entry_index(index))->item;
+	size_t chunk = ofi_idx_chunk(index);
+	return &idx->chunk[chunk][ofi_idx_chunk_offset(index, chunk)];
 }
 
-static inline void *ofi_idx_lookup(struct indexer *idx, int index)
+static inline void *ofi_idx_at(struct indexer *idx, size_t index)
 {
-	return ofi_idx_is_valid(idx, index) ? ofi_idx_at(idx, index) : NULL;
+	return *ofi_idx_entry(idx, index);
+}
+
+static inline void *ofi_idx_lookup(struct indexer *idx, size_t index)
+{
+	ofi_idx_entry_t *chunk;
+	void *item;
+	size_t n;
+
+	if (index > OFI_IDX_MAX_INDEX)
+		return NULL;
+
+	n = ofi_idx_chunk(index);
+	chunk = idx->chunk[n];
+	if (!chunk)
+		return NULL;
+
+	item = chunk[ofi_idx_chunk_offset(index, n)];
+	return ofi_idx_entry_is_free(item) ? NULL : item;
 }
 
 /*
- * Index map - associates a structure with an index.  Synchronization
- * must be provided by the caller.  Caller must initialize the
- * index map by setting it to 0.
+ * Index map - associates a structure with an index.  Updates must be
+ * serialized by the caller; lookups may run concurrently with them.
+ * Chunks are kept until the map is reset so that lookups never see
+ * freed memory.  Caller must initialize the index map by setting it to 0.
  */
 
 struct index_map
 {
-	void **array[OFI_IDX_ARRAY_SIZE];
-	int count[OFI_IDX_ARRAY_SIZE];
+	ofi_idx_entry_t * volatile chunk[OFI_IDX_MAX_CHUNKS];
 };
 
-int ofi_idm_set(struct index_map *idm, int index, void *item);
-void *ofi_idm_clear(struct index_map *idm, int index);
+ssize_t ofi_idm_set(struct index_map *idm, size_t index, void *item);
+void *ofi_idm_clear(struct index_map *idm, size_t index);
 void ofi_idm_reset(struct index_map *idm);
 
-static inline void *ofi_idm_at(struct index_map *idm, int index)
+static inline void *ofi_idm_at(struct index_map *idm, size_t index)
 {
-	void **entry;
-	entry = idm->array[ofi_idx_array_index(index)];
-	return entry[ofi_idx_entry_index(index)];
+	size_t chunk = ofi_idx_chunk(index);
+	return idm->chunk[chunk][ofi_idx_chunk_offset(index, chunk)];
 }
 
-static inline void *ofi_idm_lookup(struct index_map *idm, int index)
+static inline void *ofi_idm_lookup(struct index_map *idm, size_t index)
 {
-	return ((index <= OFI_IDX_MAX_INDEX) && idm->array[ofi_idx_array_index(index)]) ?
-		ofi_idm_at(idm, index) : NULL;
+	ofi_idx_entry_t *chunk;
+	size_t n;
+
+	if (index > OFI_IDX_MAX_INDEX)
+		return NULL;
+
+	n = ofi_idx_chunk(index);
+	chunk = idm->chunk[n];
+	return chunk ? chunk[ofi_idx_chunk_offset(index, n)] : NULL;
 }
 
 #endif /* INDEXER_H */
@@ -133,6 +133,66 @@ static inline void fastlock_release(fastlock_t *lock)
 #endif
 
 
+/*
+ * Lock that may be elided.  Whether it is taken is fixed when the owning
+ * object is created, based on the threading model negotiated by the
+ * application.  Acquiring an elided lock performs no atomic operations.
+ */
+enum ofi_lock_type {
+	OFI_LOCK_FAST,
+	OFI_LOCK_NONE,
+};
+
+typedef struct {
+	fastlock_t impl;
+	int elided;
+#if ENABLE_DEBUG
+	int held;
+#endif
+} ofi_lock_t;
+
+static inline int ofi_lock_init(ofi_lock_t *lock, enum ofi_lock_type type)
+{
+	lock->elided = (type == OFI_LOCK_NONE);
+#if ENABLE_DEBUG
+	lock->held = 0;
+#endif
+	return fastlock_init(&lock->impl);
+}
+
+static inline void ofi_lock_destroy(ofi_lock_t *lock)
+{
+#if ENABLE_DEBUG
+	assert(!lock->held);
+#endif
+	fastlock_destroy(&lock->impl);
+}
+
+static inline void ofi_lock_acquire(ofi_lock_t *lock)
+{
+	if (lock->elided) {
+#if ENABLE_DEBUG
+		/* The application must serialize all users of an elided lock */
+		assert(!lock->held);
+		lock->held = 1;
+#endif
+		return;
+	}
+	fastlock_acquire(&lock->impl);
+}
+
+static inline void ofi_lock_release(ofi_lock_t *lock)
+{
+	if (lock->elided) {
+#if ENABLE_DEBUG
+		assert(lock->held);
+		lock->held = 0;
+#endif
+		return;
+	}
+	fastlock_release(&lock->impl);
+}
+
 
 #ifdef __cplusplus
 }
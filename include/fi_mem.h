@@ -40,6 +40,7 @@
 #include <string.h>
 #include <fi_list.h>
 #include <fi_osd.h>
+#include <fi_stats.h>
 
 
 #ifdef INCLUDE_VALGRIND
@@ -64,6 +65,68 @@ static inline void *mem_dup(const void *src, size_t size)
 }
 
 
+/*
+ * Memory placement
+ *
+ * Pool regions and rings of at least a page may be backed by anonymous
+ * mappings instead of the heap, so that they can use hugepages and be
+ * bound to a NUMA node (FI_MEM_HUGEPAGES, FI_MEM_NUMA_NODE).  Placement
+ * is best effort: anything that cannot be mapped as requested falls back
+ * to regular pages, then to the heap.  The flags returned by
+ * ofi_mem_alloc describe how the memory was obtained and must be passed
+ * back to ofi_mem_free with the same size.  Mapped memory is zeroed.
+ */
+enum {
+	OFI_MEM_MAPPED		= 1 << 0,
+	OFI_MEM_HUGETLB		= 1 << 1,
+	OFI_MEM_THP		= 1 << 2,
+	OFI_MEM_BOUND		= 1 << 3,
+};
+
+enum ofi_mem_hugepages {
+	OFI_MEM_HUGE_NONE,
+	OFI_MEM_HUGE_THP,
+	OFI_MEM_HUGE_TLB,
+};
+
+#define OFI_MEM_NUMA_NONE	-1
+#define OFI_MEM_NUMA_LOCAL	-2	/* node of the allocating thread */
+
+enum {
+	OFI_MEM_STAT_HUGETLB_BYTES,
+	OFI_MEM_STAT_THP_BYTES,
+	OFI_MEM_STAT_NUMA_BYTES,
+	OFI_MEM_STAT_FALLBACKS,
+	OFI_MEM_STAT_NUMA_ERRORS,
+	OFI_MEM_STAT_MAX,
+};
+
+struct ofi_mem_policy {
+	enum ofi_mem_hugepages	hugepages;
+	int			numa_node;
+	size_t			page_size;
+	size_t			huge_page_size;
+	struct ofi_stats	*stats;
+};
+
+extern struct ofi_mem_policy ofi_mem_policy;
+extern const struct ofi_stat_def ofi_mem_stat_defs[OFI_MEM_STAT_MAX];
+
+void ofi_mem_policy_init(enum ofi_mem_hugepages hugepages, int numa_node);
+int ofi_mem_alloc(void **addr, size_t alignment, size_t size, int *flags);
+void ofi_mem_free(void *addr, size_t size, int flags);
+
+static inline int ofi_mem_calloc(void **addr, size_t size, int *flags)
+{
+	int ret;
+
+	ret = ofi_mem_alloc(addr, sizeof(void *), size, flags);
+	if (!ret && !(*flags & OFI_MEM_MAPPED))
+		memset(*addr, 0, size);
+	return ret;
+}
+
+
 /*
  * Buffer pool (free stack) template
  */
@@ -150,11 +213,15 @@ struct util_buf_pool {
 	util_buf_region_alloc_hndlr alloc_hndlr;
 	util_buf_region_free_hndlr free_hndlr;
 	void *ctx;
+	struct ofi_stats *stats;
+	int stat_id;
 };
 
 struct util_buf_region {
 	struct slist_entry entry;
 	char *mem_region;
+	size_t mem_size;
+	int mem_flags;
 	void *context;
 #if ENABLE_DEBUG
 	size_t num_used;
@@ -194,6 +261,15 @@ static inline int util_buf_avail(struct util_buf_pool *pool)
 
 int util_buf_grow(struct util_buf_pool *pool);
 
+/* account the buffers allocated by the pool in a gauge of the owner */
+static inline void util_buf_pool_set_stats(struct util_buf_pool *pool,
+					   struct ofi_stats *stats, int id)
+{
+	pool->stats = stats;
+	pool->stat_id = id;
+	ofi_stats_add(stats, id, pool->num_allocated);
+}
+
 #if ENABLE_DEBUG
 
 void *util_buf_get(struct util_buf_pool *pool);
@@ -271,4 +347,72 @@ static inline void *util_buf_get_ctx(struct util_buf_pool *pool, void *buf)
 
 void util_buf_pool_destroy(struct util_buf_pool *pool);
 
+
+/*
+ * Buddy allocator
+ *
+ * Hands out power-of-two blocks between min_size and max_size from
+ * regions of region_size bytes, so that variable-size buffers only take
+ * the memory they need.  Regions are added on demand up to max_regions
+ * (0: no limit) and passed to the alloc/free handlers, e.g. to register
+ * them.  Free blocks are kept on per-order lists, with a bitmap per
+ * region recording allocated and split blocks so that freed blocks
+ * coalesce with their buddy.  Not thread safe: callers serialize.
+ */
+struct util_buddy_pool {
+	size_t min_size;
+	size_t max_size;
+	size_t region_size;
+	size_t max_regions;
+	size_t num_regions;
+	int nlists;
+	struct dlist_entry region_list;
+	util_buf_region_alloc_hndlr alloc_hndlr;
+	util_buf_region_free_hndlr free_hndlr;
+	void *ctx;
+	struct ofi_stats *stats;
+	int stat_id;
+};
+
+struct util_buddy_region {
+	struct dlist_entry entry;
+	struct util_buddy_pool *pool;
+	char *base;
+	int mem_flags;
+	void *context;
+	uint64_t *bitmap;
+	struct dlist_entry lists[];
+};
+
+struct util_buddy_pool *
+util_buddy_pool_create(size_t min_size, size_t max_size, size_t region_size,
+		       size_t max_regions,
+		       util_buf_region_alloc_hndlr alloc_hndlr,
+		       util_buf_region_free_hndlr free_hndlr, void *pool_ctx);
+void util_buddy_pool_destroy(struct util_buddy_pool *pool);
+
+void *util_buddy_alloc(struct util_buddy_pool *pool, size_t size,
+		       struct util_buddy_region **region);
+void util_buddy_free(struct util_buddy_region *region, void *buf, size_t size);
+
+/* size of the block backing an allocation of size bytes */
+static inline size_t util_buddy_block_size(struct util_buddy_pool *pool,
+					   size_t size)
+{
+	size_t block_size = pool->min_size;
+
+	while (block_size < size)
+		block_size <<= 1;
+	return block_size;
+}
+
+/* account the bytes held by the pool's regions in a gauge of the owner */
+static inline void util_buddy_pool_set_stats(struct util_buddy_pool *pool,
+					     struct ofi_stats *stats, int id)
+{
+	pool->stats = stats;
+	pool->stat_id = id;
+	ofi_stats_add(stats, id, pool->num_regions * pool->region_size);
+}
+
 #endif /* _FI_MEM_H_ */
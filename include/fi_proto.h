@@ -58,6 +58,9 @@ enum {
 	ofi_ctrl_ack,
 	ofi_ctrl_nack,
 	ofi_ctrl_discard,
+	ofi_ctrl_atomic,
+	ofi_ctrl_atomic_resp,
+	ofi_ctrl_agg_data,
 };
 
 /*
@@ -105,6 +108,22 @@ struct ofi_ctrl_hdr {
 	};
 };
 
+/*
+ * Acknowledgement extension.  An ack for another message may be appended
+ * after the payload of a start, data or ack packet, so that acks ride on
+ * traffic already flowing to the peer.  The fields carry the same values
+ * as those of an ofi_ctrl_hdr of type ofi_ctrl_ack.  The number of acks
+ * present is derived from the length of the received packet, and they
+ * are not necessarily aligned within it.
+ */
+struct ofi_ctrl_ack {
+	uint64_t		msg_id;
+	uint64_t		rx_key;
+	uint32_t		seg_no;
+	uint16_t		seg_size;
+	uint16_t		resv;
+};
+
 
 #define OFI_OP_VERSION	2
 
@@ -120,6 +139,8 @@ enum {
 	ofi_op_read_rsp,
 	ofi_op_write,
 	ofi_op_atomic,
+	ofi_op_atomic_fetch,
+	ofi_op_atomic_compare,
 };
 
 #define OFI_REMOTE_CQ_DATA	(1 << 0)
@@ -57,6 +57,7 @@ struct name {							\
 	size_t		size_mask;				\
 	size_t		rcnt;					\
 	size_t		wcnt;					\
+	int		mem_flags;				\
 	entrytype	buf[];					\
 };								\
 								\
@@ -72,16 +73,21 @@ static inline void name ## _init(struct name *cq, size_t size)	\
 static inline struct name * name ## _create(size_t size)	\
 {								\
 	struct name *cq;					\
-	cq = calloc(1, sizeof(*cq) + sizeof(entrytype) *	\
-		    (roundup_power_of_two(size)));		\
-	if (cq)							\
-		name ##_init(cq, roundup_power_of_two(size));	\
+	int flags;						\
+	if (ofi_mem_calloc((void **) &cq, sizeof(*cq) +		\
+			   sizeof(entrytype) *			\
+			   roundup_power_of_two(size), &flags))	\
+		return NULL;					\
+	name ##_init(cq, roundup_power_of_two(size));		\
+	cq->mem_flags = flags;					\
 	return cq;						\
 }								\
 								\
 static inline void name ## _free(struct name *cq)		\
 {								\
-	free(cq);						\
+	if (cq)							\
+		ofi_mem_free(cq, sizeof(*cq) + sizeof(entrytype) * \
+			     cq->size, cq->mem_flags);		\
 }
 
 #define ofi_cirque_isempty(cq)		((cq)->wcnt == (cq)->rcnt)
@@ -109,6 +115,7 @@ struct ofi_ringbuf {
 	size_t		wcnt;
 	size_t		wpos;
 	void		*buf;
+	int		mem_flags;
 };
 
 static inline int ofi_rbinit(struct ofi_ringbuf *rb, size_t size)
@@ -118,9 +125,10 @@ static inline int ofi_rbinit(struct ofi_ringbuf *rb, size_t size)
 	rb->rcnt = 0;
 	rb->wcnt = 0;
 	rb->wpos = 0;
-	rb->buf = calloc(1, rb->size);
-	if (!rb->buf)
+	if (ofi_mem_calloc(&rb->buf, rb->size, &rb->mem_flags)) {
+		rb->buf = NULL;
 		return -ENOMEM;
+	}
 	return 0;
 }
 
@@ -133,7 +141,8 @@ static inline void ofi_rbreset(struct ofi_ringbuf *rb)
 
 static inline void ofi_rbfree(struct ofi_ringbuf *rb)
 {
-	free(rb->buf);
+	ofi_mem_free(rb->buf, rb->size, rb->mem_flags);
+	rb->buf = NULL;
 }
 
 static inline int ofi_rbfull(struct ofi_ringbuf *rb)
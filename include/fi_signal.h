@@ -43,6 +43,7 @@
 #include <sys/socket.h>
 
 #include <fi_file.h>
+#include <fi_lock.h>
 #include <fi_osd.h>
 #include <rdma/fi_errno.h>
 
@@ -53,6 +54,7 @@ enum {
 };
 
 struct fd_signal {
+	fastlock_t	lock;
 	int		rcnt;
 	int		wcnt;
 	int		fd[2];
@@ -70,6 +72,7 @@ static inline int fd_signal_init(struct fd_signal *signal)
 	if (ret)
 		goto err;
 
+	fastlock_init(&signal->lock);
 	return 0;
 
 err:
@@ -80,6 +83,7 @@ err:
 
 static inline void fd_signal_free(struct fd_signal *signal)
 {
+	fastlock_destroy(&signal->lock);
 	ofi_close_socket(signal->fd[0]);
 	ofi_close_socket(signal->fd[1]);
 }
@@ -87,19 +91,27 @@ static inline void fd_signal_free(struct fd_signal *signal)
 static inline void fd_signal_set(struct fd_signal *signal)
 {
 	char c = 0;
+
+	/* Threads blocked on the same wait object signal and reset it
+	 * concurrently; a lost count would suppress every later signal. */
+	fastlock_acquire(&signal->lock);
 	if (signal->wcnt == signal->rcnt) {
 		if (ofi_write_socket(signal->fd[FI_WRITE_FD], &c, sizeof c) == sizeof c)
 			signal->wcnt++;
 	}
+	fastlock_release(&signal->lock);
 }
 
 static inline void fd_signal_reset(struct fd_signal *signal)
 {
 	char c;
+
+	fastlock_acquire(&signal->lock);
 	if (signal->rcnt != signal->wcnt) {
 		if (ofi_read_socket(signal->fd[FI_READ_FD], &c, sizeof c) == sizeof c)
 			signal->rcnt++;
 	}
+	fastlock_release(&signal->lock);
 }
 
 static inline int fd_signal_poll(struct fd_signal *signal, int timeout)
@@ -118,6 +130,9 @@ static inline int fd_signal_poll(struct fd_signal *signal, int timeout)
 
 typedef int fi_epoll_t;
 
+#define FI_EPOLL_IN  EPOLLIN
+#define FI_EPOLL_OUT EPOLLOUT
+
 static inline int fi_epoll_create(int *ep)
 {
 	*ep = epoll_create(4);
@@ -142,6 +157,15 @@ static inline int fi_epoll_del(int ep, int fd)
 	return epoll_ctl(ep, EPOLL_CTL_DEL, fd, NULL) ? -ofi_syserr() : 0;
 }
 
+static inline int fi_epoll_mod(int ep, int fd, uint32_t events, void *context)
+{
+	struct epoll_event event;
+
+	event.data.ptr = context;
+	event.events = events;
+	return epoll_ctl(ep, EPOLL_CTL_MOD, fd, &event) ? -ofi_syserr() : 0;
+}
+
 static inline int fi_epoll_wait(int ep, void **contexts, int max_contexts,
                                 int timeout)
 {
@@ -166,6 +190,9 @@ static inline void fi_epoll_close(int ep)
 #else
 #include <poll.h>
 
+#define FI_EPOLL_IN  POLLIN
+#define FI_EPOLL_OUT POLLOUT
+
 typedef struct fi_epoll {
 	int		size;
 	int		nfds;
@@ -177,6 +204,7 @@ typedef struct fi_epoll {
 int fi_epoll_create(struct fi_epoll **ep);
 int fi_epoll_add(struct fi_epoll *ep, int fd, void *context);
 int fi_epoll_del(struct fi_epoll *ep, int fd);
+int fi_epoll_mod(struct fi_epoll *ep, int fd, uint32_t events, void *context);
 int fi_epoll_wait(struct fi_epoll *ep, void **contexts, int max_contexts,
                   int timeout);
 void fi_epoll_close(struct fi_epoll *ep);
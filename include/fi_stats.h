@@ -0,0 +1,200 @@
+/*
+ * Copyright (c) 2017 Intel Corporation. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef _FI_STATS_H_
+#define _FI_STATS_H_
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef HAVE_ATOMICS
+#  include <stdatomic.h>
+#endif
+
+#include <rdma/fabric.h>
+#include <rdma/providers/fi_prov.h>
+#include <fi_osd.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Object statistics
+ *
+ * A provider describes the statistics of an object type with a static
+ * array of ofi_stat_def, indexed by a provider enum.  Counters only grow,
+ * gauges move both ways and histograms expand into OFI_STAT_HIST_BUCKETS
+ * log2 buckets.  Bucket i counts values that need i significant bits,
+ * i.e. bucket 0 holds 0, bucket i holds [2^(i-1), 2^i) and the last
+ * bucket absorbs everything larger.
+ *
+ * Updates are relaxed atomic operations on the object's own value array,
+ * so they never take a lock and never order surrounding accesses.  The
+ * values are read back with FI_GET_STATS through fi_control, and may be
+ * published to a shared memory segment (FI_STATS_SHM) so that an
+ * external tool can sample a running job.
+ */
+
+#define OFI_STAT_NAME_MAX	48
+#define OFI_STAT_HIST_BUCKETS	20
+
+#define OFI_STATS_SHM_MAGIC	0x4f464953	/* "OFIS" */
+#define OFI_STATS_SHM_VERSION	1
+
+enum ofi_stat_type {
+	OFI_STAT_COUNTER,
+	OFI_STAT_GAUGE,
+	OFI_STAT_HIST,
+};
+
+struct ofi_stat_def {
+	const char		*name;
+	enum ofi_stat_type	type;
+};
+
+#ifdef HAVE_ATOMICS
+typedef atomic_uint_least64_t ofi_stat_t;
+#define ofi_stat_add_(v, n)	atomic_fetch_add_explicit(v, n, memory_order_relaxed)
+#define ofi_stat_sub_(v, n)	atomic_fetch_sub_explicit(v, n, memory_order_relaxed)
+#define ofi_stat_set_(v, n)	atomic_store_explicit(v, n, memory_order_relaxed)
+#define ofi_stat_get_(v)	atomic_load_explicit(v, memory_order_relaxed)
+#elif defined HAVE_BUILTIN_ATOMICS
+typedef uint64_t ofi_stat_t;
+#define ofi_stat_add_(v, n)	__sync_fetch_and_add(v, n)
+#define ofi_stat_sub_(v, n)	__sync_fetch_and_sub(v, n)
+#define ofi_stat_set_(v, n)	(*(volatile uint64_t *) (v) = (n))
+#define ofi_stat_get_(v)	(*(volatile uint64_t *) (v))
+#else
+/* Statistics are advisory; tolerate lost updates without atomics */
+typedef uint64_t ofi_stat_t;
+#define ofi_stat_add_(v, n)	(*(v) += (n))
+#define ofi_stat_sub_(v, n)	(*(v) -= (n))
+#define ofi_stat_set_(v, n)	(*(volatile uint64_t *) (v) = (n))
+#define ofi_stat_get_(v)	(*(volatile uint64_t *) (v))
+#endif
+
+/*
+ * Layout of a published segment: this header, followed by count
+ * names of name_len bytes each, followed by count 64-bit values
+ * starting at the next 8-byte boundary.
+ */
+struct ofi_stats_shm_hdr {
+	uint32_t		magic;
+	uint32_t		version;
+	uint32_t		count;
+	uint32_t		name_len;
+	uint64_t		pid;
+	char			prov[OFI_STAT_NAME_MAX];
+	char			object[OFI_STAT_NAME_MAX];
+};
+
+struct ofi_stats {
+	const struct fi_provider *prov;
+	size_t			count;
+	size_t			*slot;
+	struct ofi_stats_shm_hdr *hdr;
+	char			(*names)[OFI_STAT_NAME_MAX];
+	ofi_stat_t		*values;
+	struct util_shm		shm;
+	int			published;
+};
+
+int ofi_stats_init(const struct fi_provider *prov, struct ofi_stats *stats,
+		   const struct ofi_stat_def *defs, size_t def_cnt,
+		   const char *object);
+void ofi_stats_close(struct ofi_stats *stats);
+int ofi_stats_query(struct ofi_stats *stats, struct fi_stats *query);
+
+static inline ofi_stat_t *ofi_stats_val(struct ofi_stats *stats, int id)
+{
+	return &stats->values[stats->slot[id]];
+}
+
+static inline void ofi_stats_add(struct ofi_stats *stats, int id, uint64_t n)
+{
+	ofi_stat_add_(ofi_stats_val(stats, id), n);
+}
+
+static inline void ofi_stats_sub(struct ofi_stats *stats, int id, uint64_t n)
+{
+	ofi_stat_sub_(ofi_stats_val(stats, id), n);
+}
+
+static inline void ofi_stats_inc(struct ofi_stats *stats, int id)
+{
+	ofi_stats_add(stats, id, 1);
+}
+
+static inline void ofi_stats_dec(struct ofi_stats *stats, int id)
+{
+	ofi_stats_sub(stats, id, 1);
+}
+
+static inline void ofi_stats_set(struct ofi_stats *stats, int id, uint64_t n)
+{
+	ofi_stat_set_(ofi_stats_val(stats, id), n);
+}
+
+static inline uint64_t ofi_stats_get(struct ofi_stats *stats, int id)
+{
+	return ofi_stat_get_(ofi_stats_val(stats, id));
+}
+
+static inline int ofi_stat_bucket(uint64_t n)
+{
+	int bits;
+
+#ifdef __GNUC__
+	bits = n ? 64 - __builtin_clzll(n) : 0;
+#else
+	for (bits = 0; n; bits++)
+		n >>= 1;
+#endif
+	return bits < OFI_STAT_HIST_BUCKETS ? bits : OFI_STAT_HIST_BUCKETS - 1;
+}
+
+static inline void ofi_stats_hist(struct ofi_stats *stats, int id, uint64_t n)
+{
+	ofi_stat_add_(&stats->values[stats->slot[id] + ofi_stat_bucket(n)], 1);
+}
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _FI_STATS_H_ */
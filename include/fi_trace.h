@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) 2017 Intel Corporation. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef _FI_TRACE_H_
+#define _FI_TRACE_H_
+
+#include "config.h"
+
+#include <stdint.h>
+
+#include <rdma/providers/fi_prov.h>
+#include <rdma/providers/fi_log.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Binary trace ring
+ *
+ * Hot-path alternative to FI_LOG.  Each call site owns a static format
+ * descriptor; recording a message stores a timestamp, the descriptor
+ * address and the raw arguments into a per-thread ring without taking
+ * any lock or formatting anything.  Messages are formatted lazily when
+ * the rings are dumped, either at exit or by the first message recorded
+ * after FI_TRACE_SIGNAL is delivered.
+ *
+ * Tracing is enabled with FI_TRACE_LEVEL.  When it is disabled, or the
+ * message is above the trace level, OFI_TRACE falls back to FI_LOG, so
+ * converting an FI_LOG call site does not change default behavior.
+ *
+ * Only integer, pointer, double and string conversions are recorded.
+ * String arguments are stored by address and must remain valid until
+ * the ring is dumped (e.g. static strings).  Formats that cannot be
+ * recorded are logged immediately through fi_log.
+ */
+
+#define OFI_TRACE_MAX_ARGS	5
+
+enum {
+	OFI_TRACE_UNINIT = -2,
+	OFI_TRACE_DISABLED = -1,
+};
+
+struct ofi_trace_fmt {
+	enum fi_log_level	level;
+	enum fi_log_subsys	subsys;
+	const char		*func;
+	int			line;
+	const char		*fmt;
+
+	/* Filled in on first use */
+	int			parsed;
+	int			nargs;
+	uint8_t			type[OFI_TRACE_MAX_ARGS];
+};
+
+/* Sized to a single cache line */
+struct ofi_trace_rec {
+	uint64_t			ts;
+	const struct ofi_trace_fmt	*fmt;
+	const struct fi_provider	*prov;
+	uint64_t			arg[OFI_TRACE_MAX_ARGS];
+};
+
+extern int ofi_trace_level;
+
+void ofi_trace_init(void);
+void ofi_trace_fini(void);
+void ofi_trace_dump(void);
+void ofi_trace_rec(struct ofi_trace_fmt *fmt, const struct fi_provider *prov,
+		   const char *str, ...)
+		   __attribute__ ((__format__ (__printf__, 3, 4)));
+
+static inline int ofi_trace_enabled(enum fi_log_level level)
+{
+	if (ofi_trace_level == OFI_TRACE_UNINIT)
+		ofi_trace_init();
+	return (int) level <= ofi_trace_level;
+}
+
+#define OFI_TRACE_FMT(...) OFI_TRACE_FMT_(__VA_ARGS__, "")
+#define OFI_TRACE_FMT_(fmt, ...) fmt
+
+#define OFI_TRACE(prov, lvl, subsystem, ...)				\
+	do {								\
+		static struct ofi_trace_fmt ofi_trace_fmt_ = {		\
+			.level = lvl,					\
+			.subsys = subsystem,				\
+			.func = __func__,				\
+			.line = __LINE__,				\
+			.fmt = OFI_TRACE_FMT(__VA_ARGS__),		\
+		};							\
+		if (ofi_trace_enabled(lvl))				\
+			ofi_trace_rec(&ofi_trace_fmt_, prov, __VA_ARGS__);\
+		else							\
+			FI_LOG(prov, lvl, subsystem, __VA_ARGS__);	\
+	} while (0)
+
+#define OFI_TRACE_WARN(prov, subsystem, ...)				\
+	OFI_TRACE(prov, FI_LOG_WARN, subsystem, __VA_ARGS__)
+
+#define OFI_TRACE_INFO(prov, subsystem, ...)				\
+	OFI_TRACE(prov, FI_LOG_INFO, subsystem, __VA_ARGS__)
+
+#if ENABLE_DEBUG
+#define OFI_TRACE_DBG(prov, subsystem, ...)				\
+	OFI_TRACE(prov, FI_LOG_DEBUG, subsystem, __VA_ARGS__)
+#else
+#define OFI_TRACE_DBG(prov, subsystem, ...)				\
+	do {} while (0)
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _FI_TRACE_H_ */
@@ -57,6 +57,7 @@
 #include <fi_enosys.h>
 #include <fi_osd.h>
 #include <fi_indexer.h>
+#include <fi_stats.h>
 
 #include "rbtree.h"
 
@@ -187,8 +188,29 @@ struct util_domain {
 	int			mr_mode;
 	uint32_t		addr_format;
 	enum fi_av_type		av_type;
+	enum fi_threading	threading;
 };
 
+/*
+ * FI_THREAD_DOMAIN serializes every call into the domain, so per-object
+ * locks are unnecessary.  FI_THREAD_COMPLETION additionally lets objects
+ * that share a completion queue or counter drop the locks protecting it.
+ */
+static inline enum ofi_lock_type
+ofi_domain_lock_type(const struct util_domain *domain)
+{
+	return domain->threading == FI_THREAD_DOMAIN ?
+	       OFI_LOCK_NONE : OFI_LOCK_FAST;
+}
+
+static inline enum ofi_lock_type
+ofi_comp_lock_type(const struct util_domain *domain)
+{
+	return (domain->threading == FI_THREAD_DOMAIN ||
+		domain->threading == FI_THREAD_COMPLETION) ?
+	       OFI_LOCK_NONE : OFI_LOCK_FAST;
+}
+
 int ofi_domain_init(struct fid_fabric *fabric_fid, const struct fi_info *info,
 		     struct util_domain *domain, void *context);
 int ofi_domain_bind_eq(struct util_domain *domain, struct util_eq *eq);
@@ -227,7 +249,12 @@ struct util_ep {
 	uint64_t		flags;
 	ofi_ep_progress_func	progress;
 	struct util_cmap	*cmap;
-	fastlock_t		lock;
+	ofi_lock_t		lock;
+	/* Set if this is a tx or rx context of a scalable endpoint */
+	struct util_sep		*sep;
+	/* Last poll set run that progressed this endpoint */
+	struct util_poll	*progress_poll;
+	uint64_t		progress_gen;
 };
 
 int ofi_ep_bind_av(struct util_ep *util_ep, struct util_av *av);
@@ -241,6 +268,79 @@ int ofi_endpoint_init(struct fid_domain *domain, const struct util_prov *util_pr
 
 int ofi_endpoint_close(struct util_ep *util_ep);
 
+/*
+ * Scalable endpoint
+ *
+ * Each tx and rx context of a scalable endpoint is a separate provider
+ * endpoint, with its own queues, lock and CQ bindings, so that threads
+ * driving different contexts share no state on the data path.  Contexts
+ * are addressed as consecutive ports of the scalable endpoint's address:
+ * rx context i at port + i, followed by any ports the provider needs for
+ * its tx contexts.  The ports are reserved when the scalable endpoint is
+ * opened, by sockets that the provider may use directly or release to a
+ * core endpoint when the context is opened.
+ */
+
+struct util_sep;
+typedef int (*ofi_sep_ctx_func)(struct util_sep *sep, int index,
+				struct fi_info *info, struct fid_ep **ctx,
+				void *context);
+
+struct util_sep {
+	struct fid_ep		ep_fid;
+	struct util_domain	*domain;
+	struct util_av		*av;
+	struct util_eq		*eq;
+	struct fi_info		*info;
+	ofi_atomic32_t		ref;
+	fastlock_t		lock;
+
+	size_t			tx_ctx_cnt;
+	size_t			rx_ctx_cnt;
+	struct util_ep		**tx_ctx;
+	struct util_ep		**rx_ctx;
+	ofi_sep_ctx_func	tx_ctx_open;
+	ofi_sep_ctx_func	rx_ctx_open;
+
+	struct sockaddr_storage	addr;
+	size_t			addrlen;
+	SOCKET			*socks;
+	size_t			sock_cnt;
+};
+
+int ofi_scalable_ep(struct fid_domain *domain, const struct util_prov *util_prov,
+		    struct fi_info *info, struct fid_ep **sep_fid, void *context,
+		    ofi_sep_ctx_func tx_ctx_open, ofi_sep_ctx_func rx_ctx_open);
+int ofi_sep_bind_ports(struct util_sep *sep, int type, size_t cnt);
+int ofi_sep_ctx_info(struct util_sep *sep, size_t port, struct fi_info *info);
+void ofi_sep_release_port(struct util_sep *sep, size_t port);
+
+/*
+ * Poll set notification
+ *
+ * CQs, counters and EQs embed a notify object that poll sets attach to.
+ * Code generating an event calls ofi_poll_notify afterwards, which queues
+ * the object on the ready list of each poll set holding it.  fi_poll then
+ * only examines objects that have seen events since the last call.  The
+ * check is a single list test when the object is in no poll set.
+ */
+struct util_poll_notify {
+	struct dlist_entry	entry;
+	struct fid		*fid;
+	struct dlist_entry	poll_list;
+	fastlock_t		lock;
+};
+
+void ofi_poll_notify_init(struct util_poll_notify *notify, struct fid *fid);
+void ofi_poll_notify_cleanup(struct util_poll_notify *notify);
+void ofi_poll_notify_ready(struct util_poll_notify *notify);
+
+static inline void ofi_poll_notify(struct util_poll_notify *notify)
+{
+	if (!dlist_empty(&notify->poll_list))
+		ofi_poll_notify_ready(notify);
+}
+
 /*
  * Completion queue
  *
@@ -269,8 +369,8 @@ struct util_cq {
 	struct util_wait	*wait;
 	ofi_atomic32_t		ref;
 	struct dlist_entry	ep_list;
-	fastlock_t		ep_list_lock;
-	fastlock_t		cq_lock;
+	ofi_lock_t		ep_list_lock;
+	ofi_lock_t		cq_lock;
 
 	struct util_comp_cirq	*cirq;
 	fi_addr_t		*src;
@@ -279,6 +379,7 @@ struct util_cq {
 	fi_cq_read_func		read_entry;
 	int			internal_wait;
 	ofi_cq_progress_func	progress;
+	struct util_poll_notify	poll_notify;
 };
 
 int ofi_cq_init(const struct fi_provider *prov, struct fid_domain *domain,
@@ -319,15 +420,24 @@ struct util_cntr {
 	ofi_atomic64_t		cnt;
 	ofi_atomic64_t		err;
 
-	uint64_t		checkpoint_cnt;
-	uint64_t		checkpoint_err;
+	/* Lowest threshold a waiter is blocked on */
+	ofi_atomic64_t		wake_thresh;
+	int			shared_wait;
+	/* Threads blocked in fi_cntr_wait */
+	struct dlist_entry	waiter_list;
+	ofi_lock_t		waiter_lock;
+	/* Bumped to hand a wake-up on to another waiter */
+	ofi_atomic64_t		wake_gen;
 
 	struct dlist_entry	ep_list;
-	fastlock_t		ep_list_lock;
+	ofi_lock_t		ep_list_lock;
 
 	ofi_cntr_progress_func	progress;
+	struct util_poll_notify	poll_notify;
 };
 
+#define OFI_CNTR_NO_WAITER	INT64_MAX
+
 int ofi_check_bind_cntr_flags(struct util_ep *ep, struct util_cntr *cntr,
 			      uint64_t flags);
 
@@ -336,6 +446,64 @@ int ofi_cntr_init(const struct fi_provider *prov, struct fid_domain *domain,
 		  struct fi_cntr_attr *attr, struct util_cntr *cntr,
 		  ofi_cntr_progress_func progress, void *context);
 int ofi_cntr_cleanup(struct util_cntr *cntr);
+void ofi_cntr_wake(struct util_cntr *cntr);
+
+/*
+ * Completion path for providers: no locks are taken, and the wait object
+ * is only signaled once the count reaches the lowest armed threshold.
+ */
+static inline void ofi_cntr_inc(struct util_cntr *cntr)
+{
+	if (ofi_atomic_inc64(&cntr->cnt) >= ofi_atomic_get64(&cntr->wake_thresh))
+		ofi_cntr_wake(cntr);
+	ofi_poll_notify(&cntr->poll_notify);
+}
+
+static inline void ofi_cntr_inc_err(struct util_cntr *cntr)
+{
+	ofi_atomic_inc64(&cntr->err);
+	ofi_cntr_wake(cntr);
+	ofi_poll_notify(&cntr->poll_notify);
+}
+
+/*
+ * Triggered operations waiting on a counter, kept in a binary min-heap
+ * ordered by threshold.  Operations with equal thresholds run in the
+ * order they were queued.  A counter update only needs to look at the
+ * head of the queue, and only ops whose threshold was crossed are
+ * touched.  The caller provides locking.
+ */
+struct ofi_trigger {
+	uint64_t		threshold;
+	uint64_t		seq;
+};
+
+struct ofi_trigger_queue {
+	struct ofi_trigger	**heap;
+	size_t			count;
+	size_t			size;
+	uint64_t		seq;
+};
+
+void ofi_trigger_queue_init(struct ofi_trigger_queue *queue);
+void ofi_trigger_queue_cleanup(struct ofi_trigger_queue *queue);
+int ofi_trigger_insert(struct ofi_trigger_queue *queue,
+		       struct ofi_trigger *trigger, uint64_t threshold);
+void ofi_trigger_pop(struct ofi_trigger_queue *queue);
+
+static inline struct ofi_trigger *
+ofi_trigger_peek(struct ofi_trigger_queue *queue)
+{
+	return queue->count ? queue->heap[0] : NULL;
+}
+
+/* Returns the next op whose threshold has been reached, leaving it queued */
+static inline struct ofi_trigger *
+ofi_trigger_ready(struct ofi_trigger_queue *queue, uint64_t value)
+{
+	struct ofi_trigger *trigger = ofi_trigger_peek(queue);
+	return (trigger && trigger->threshold <= value) ? trigger : NULL;
+}
 /*
  * AV / addressing
  */
@@ -363,6 +531,7 @@ struct util_av {
 	uint64_t		flags;
 	size_t			count;
 	size_t			addrlen;
+	int			rx_ctx_bits;
 	ssize_t			free_list;
 	struct util_av_hash	hash;
 	void			*data;
@@ -394,6 +563,35 @@ void *ofi_av_get_addr(struct util_av *av, int index);
 #define ip_av_get_addr ofi_av_get_addr
 int ip_av_get_index(struct util_av *av, const void *addr);
 
+/*
+ * Addresses of scalable endpoint contexts, see fi_rx_addr().  The AV
+ * entry holds the address of the scalable endpoint; rx context i of the
+ * peer listens on the same address at port + i.
+ */
+#define OFI_MAX_RX_CTX_BITS	8
+
+static inline int ofi_av_rx_index(struct util_av *av, fi_addr_t fi_addr)
+{
+	return av->rx_ctx_bits ?
+	       (int) (fi_addr >> (64 - av->rx_ctx_bits)) : 0;
+}
+
+static inline fi_addr_t ofi_av_addr_index(struct util_av *av, fi_addr_t fi_addr)
+{
+	return av->rx_ctx_bits ?
+	       fi_addr & (~0ULL >> av->rx_ctx_bits) : fi_addr;
+}
+
+/* Index into tables with an entry per AV entry and rx context */
+static inline size_t ofi_av_ctx_index(struct util_av *av, fi_addr_t fi_addr)
+{
+	return (size_t) (ofi_av_addr_index(av, fi_addr) << av->rx_ctx_bits) |
+	       ofi_av_rx_index(av, fi_addr);
+}
+
+const void *ip_av_get_ctx_addr(struct util_av *av, fi_addr_t fi_addr,
+			       struct sockaddr_storage *buf);
+
 int ofi_get_addr(uint32_t addr_format, uint64_t flags,
 		 const char *node, const char *service,
 		 void **addr, size_t *addrlen);
@@ -503,6 +701,11 @@ struct util_cmap *ofi_cmap_alloc(struct util_ep *ep,
 
 /*
  * Poll set
+ *
+ * Members backed by a util CQ, counter or EQ report readiness through
+ * their poll_notify object and are only examined when on the ready list.
+ * Other members are checked on every call.  Endpoints shared by several
+ * members are progressed once per call.
  */
 struct util_poll {
 	struct fid_poll		poll_fid;
@@ -511,6 +714,10 @@ struct util_poll {
 	fastlock_t		lock;
 	ofi_atomic32_t		ref;
 	const struct fi_provider *prov;
+
+	struct dlist_entry	ready_list;
+	fastlock_t		ready_lock;
+	uint64_t		progress_gen;
 };
 
 int fi_poll_create_(const struct fi_provider *prov, struct fid_domain *domain,
@@ -526,6 +733,25 @@ struct util_wait;
 typedef void (*fi_wait_signal_func)(struct util_wait *wait);
 typedef int (*fi_wait_try_func)(struct util_wait *wait);
 
+/*
+ * Before sleeping, a wait set polls its members, driving their progress,
+ * for up to spin.max_usec.  When spin.adaptive is set, the time spent
+ * polling is instead learned from how long recent waits took to be
+ * satisfied: waits that typically end sooner than max_usec spin for about
+ * twice that time, and waits that typically take longer do not spin.
+ */
+enum {
+	OFI_WAIT_STAT_SPIN_HITS,
+	OFI_WAIT_STAT_SPIN_MISSES,
+	OFI_WAIT_STAT_SLEEPS,
+	OFI_WAIT_STAT_SPIN_NS,
+	OFI_WAIT_STAT_SLEEP_NS,
+	OFI_WAIT_STAT_SPIN_INTERVAL,
+	OFI_WAIT_STAT_MAX,
+};
+
+extern struct fi_wait_spin ofi_wait_spin_default;
+
 struct util_wait {
 	struct fid_wait		wait_fid;
 	struct util_fabric	*fabric;
@@ -536,6 +762,10 @@ struct util_wait {
 	enum fi_wait_obj	wait_obj;
 	fi_wait_signal_func	signal;
 	fi_wait_try_func	try;
+
+	struct fi_wait_spin	spin;
+	uint64_t		wait_avg_ns;
+	struct ofi_stats	stats;
 };
 
 int fi_wait_init(struct util_fabric *fabric, struct fi_wait_attr *attr,
@@ -579,6 +809,7 @@ struct util_eq {
 
 	struct slist		list;
 	int			internal_wait;
+	struct util_poll_notify	poll_notify;
 };
 
 struct util_event {
@@ -609,10 +840,37 @@ int ofi_eq_create(struct fid_fabric *fabric, struct fi_eq_attr *attr,
 	 (!(info->domain_attr->mr_mode & ~(FI_MR_BASIC | FI_MR_SCALABLE)) && \
 	  (info->mode & FI_LOCAL_MR)))
 
+/*
+ * Compact copy of a registration, holding only what target side
+ * verification needs.  An entry whose context is NULL is unused.
+ */
+struct ofi_mr_entry {
+	uint64_t		key;
+	uint64_t		access;
+	uint64_t		offset;
+	uintptr_t		base;
+	size_t			len;
+	void			*context;
+};
+
+/*
+ * Provider assigned keys index directly into the table: the low bits of
+ * the key select the slot, the high bits carry a generation count that is
+ * bumped every time the slot is released, so stale keys fail to match.
+ * Unused slots are chained through their len field.  User selected keys
+ * are placed in an open addressing hash table with linear probing.
+ */
+#define OFI_MR_SLOT_BITS	32
+#define OFI_MR_SLOT_MASK	((UINT64_C(1) << OFI_MR_SLOT_BITS) - 1)
+#define OFI_MR_GEN_MASK		((UINT64_C(1) << (63 - OFI_MR_SLOT_BITS)) - 1)
+
 struct ofi_mr_map {
 	const struct fi_provider *prov;
-	void			*rbtree;
-	uint64_t		key;
+	struct ofi_mr_entry	*table;
+	size_t			size;
+	size_t			used;	/* slots initialized, or live hash entries */
+	size_t			dead;	/* hash tombstones */
+	size_t			free;	/* head of free slot list */
 	enum fi_mr_mode		mode;
 };
 
@@ -711,6 +969,22 @@ int fid_list_insert(struct dlist_entry *fid_list, fastlock_t *lock,
 void fid_list_remove(struct dlist_entry *fid_list, fastlock_t *lock,
 		     struct fid *fid);
 
+/*
+ * Lists guarded by an ofi_lock_t.  Binding and closing are not on the
+ * data path, so the underlying lock is taken even when it is elided.
+ */
+static inline int ofi_fid_list_insert(struct dlist_entry *fid_list,
+				      ofi_lock_t *lock, struct fid *fid)
+{
+	return fid_list_insert(fid_list, &lock->impl, fid);
+}
+
+static inline void ofi_fid_list_remove(struct dlist_entry *fid_list,
+				       ofi_lock_t *lock, struct fid *fid)
+{
+	fid_list_remove(fid_list, &lock->impl, fid);
+}
+
 void ofi_fabric_insert(struct util_fabric *fabric);
 struct util_fabric *ofi_fabric_find(struct util_fabric_info *fabric_info);
 void ofi_fabric_remove(struct util_fabric *fabric);
@@ -768,6 +1042,11 @@ struct util_ns {
 	int			is_initialized;
 	ofi_atomic32_t		ref;
 
+	/* client side: connections to and names resolved from servers */
+	fastlock_t		lock;
+	struct dlist_entry	peer_list;
+	int			peer_conn_cnt;
+
 	ofi_ns_service_cmp_func_t	service_cmp;
 
 	ofi_ns_is_service_wildcard_func_t is_service_wildcard;
@@ -786,11 +1065,17 @@ struct util_ns_attr {
 };
 
 int ofi_ns_init(struct util_ns_attr *attr, struct util_ns *ns);
+void ofi_ns_fini(struct util_ns *ns);
 void ofi_ns_start_server(struct util_ns *ns);
 void ofi_ns_stop_server(struct util_ns *ns);
 int ofi_ns_add_local_name(struct util_ns *ns, void *service, void *name);
+int ofi_ns_add_local_names(struct util_ns *ns, void *services, void *names,
+			   size_t count);
 int ofi_ns_del_local_name(struct util_ns *ns, void *service, void *name);
 void *ofi_ns_resolve_name(struct util_ns *ns, const char *server,
 			  void *service);
+int ofi_ns_resolve_names(struct util_ns *ns, const char *server,
+			 void *services, void *names, int *status,
+			 size_t count);
 
 #endif
@@ -486,6 +486,16 @@ struct fi_mr_map_raw {
 	uint64_t	*key;
 };
 
+struct fi_stat {
+	const char	*name;
+	uint64_t	value;
+};
+
+struct fi_stats {
+	size_t		count;
+	struct fi_stat	*stats;
+};
+
 /* control commands */
 enum {
 	FI_GETFIDFLAG,		/* uint64_t flags */
@@ -503,6 +513,9 @@ enum {
 	FI_CANCEL_WORK,		/* struct fi_deferred_work */
 	FI_FLUSH_WORK,		/* NULL */
 	FI_REFRESH,		/* mr: fi_mr_modify */
+	FI_GET_STATS,		/* struct fi_stats */
+	FI_GET_WAIT_SPIN,	/* struct fi_wait_spin */
+	FI_SET_WAIT_SPIN,	/* struct fi_wait_spin */
 };
 
 static inline int fi_control(struct fid *fid, int command, void *arg)
@@ -66,6 +66,12 @@ struct fi_wait_attr {
 	uint64_t		flags;
 };
 
+/* Use fi_control GET/SET_WAIT_SPIN to query or set a wait set's spinning */
+struct fi_wait_spin {
+	uint64_t		max_usec;
+	int			adaptive;
+};
+
 struct fi_ops_wait {
 	size_t	size;
 	int	(*wait)(struct fid_wait *waitset, int timeout);
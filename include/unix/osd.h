@@ -60,6 +60,7 @@
 #endif
 
 #define FI_DESTRUCTOR(func) static __attribute__((destructor)) void func
+#define OFI_THREAD_LOCAL __thread
 
 #ifndef UNREFERENCED_PARAMETER
 #define OFI_UNUSED(var) (void)var
@@ -206,10 +207,15 @@ OFI_DEF_COMPLEX_OPS(double)
 OFI_DEF_COMPLEX_OPS(long_double)
 
 
+/* Orders earlier stores before later ones, for lock-free readers */
+#define ofi_wmb() __sync_synchronize()
+
 /* atomics primitives */
 #ifdef HAVE_BUILTIN_ATOMICS
 #define ofi_atomic_add_and_fetch(radix, ptr, val) __sync_add_and_fetch((ptr), (val))
 #define ofi_atomic_sub_and_fetch(radix, ptr, val) __sync_sub_and_fetch((ptr), (val))
+#define ofi_atomic_cas_bool(radix, ptr, expected, desired)	\
+	__sync_bool_compare_and_swap((ptr), (expected), (desired))
 #endif /* HAVE_BUILTIN_ATOMICS */
 
 #endif /* _FI_UNIX_OSD_H_ */
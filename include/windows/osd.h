@@ -208,7 +208,12 @@ extern "C" {
 #define _SC_PAGESIZE	0
 #endif
 
+#ifndef _SC_NPROCESSORS_ONLN
+#define _SC_NPROCESSORS_ONLN	1
+#endif
+
 #define FI_DESTRUCTOR(func) void func
+#define OFI_THREAD_LOCAL __declspec(thread)
 
 #define LITTLE_ENDIAN 5678
 #define BIG_ENDIAN 8765
@@ -784,6 +789,8 @@ static inline int ofi_sysconf(int name)
 	switch (name) {
 	case _SC_PAGESIZE:
 		return si.dwPageSize;
+	case _SC_NPROCESSORS_ONLN:
+		return si.dwNumberOfProcessors;
 	default:
 		errno = EINVAL;
 		return -1;
@@ -865,14 +872,22 @@ OFI_DEF_COMPLEX(double)
 OFI_DEF_COMPLEX(long_double)
 
 
+/* Orders earlier stores before later ones, for lock-free readers */
+#define ofi_wmb() MemoryBarrier()
+
 /* atomics primitives */
 #ifdef HAVE_BUILTIN_ATOMICS
 #define InterlockedAdd32 InterlockedAdd
+#define InterlockedCompareExchange32 InterlockedCompareExchange
 typedef LONG ofi_atomic_int_32_t;
 typedef LONGLONG ofi_atomic_int_64_t;
 
 #define ofi_atomic_add_and_fetch(radix, ptr, val) InterlockedAdd##radix((ofi_atomic_int_##radix##_t *)(ptr), (ofi_atomic_int_##radix##_t)(val))
 #define ofi_atomic_sub_and_fetch(radix, ptr, val) InterlockedAdd##radix((ofi_atomic_int_##radix##_t *)(ptr), -(ofi_atomic_int_##radix##_t)(val))
+#define ofi_atomic_cas_bool(radix, ptr, expected, desired)					\
+	(InterlockedCompareExchange##radix((ofi_atomic_int_##radix##_t *)(ptr),			\
+		(ofi_atomic_int_##radix##_t)(desired), (ofi_atomic_int_##radix##_t)(expected)) ==	\
+	 (ofi_atomic_int_##radix##_t)(expected))
 #endif /* HAVE_BUILTIN_ATOMICS */
 
 #ifdef __cplusplus
@@ -15,6 +15,7 @@
 
 #include <WinSock2.h>
 #include <stdint.h>
+#include <time.h>
 
 static inline int gettimeofday(struct timeval* time, struct timezone* zone)
 {
@@ -36,3 +37,20 @@ static inline int gettimeofday(struct timeval* time, struct timezone* zone)
 	return 0;
 }
 
+
+#ifndef CLOCK_MONOTONIC
+#define CLOCK_MONOTONIC 1
+#endif
+
+static inline int clock_gettime(int clk_id, struct timespec *ts)
+{
+	LARGE_INTEGER freq, count;
+
+	(void) clk_id;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&count);
+	ts->tv_sec = (time_t)(count.QuadPart / freq.QuadPart);
+	ts->tv_nsec = (long)((count.QuadPart % freq.QuadPart) * 1000000000LL /
+			     freq.QuadPart);
+	return 0;
+}
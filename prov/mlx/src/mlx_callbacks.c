@@ -54,7 +54,7 @@ void mlx_send_callback( void *request,
 		return;
 	}
 
-	fastlock_acquire(&cq->cq_lock);
+	ofi_lock_acquire(&cq->cq_lock);
 
 	t_entry = ofi_cirque_tail(cq->cirq);
 	*t_entry = (mlx_req->completion.tagged);
@@ -78,7 +78,8 @@ void mlx_send_callback( void *request,
 
 	mlx_req->type = MLX_FI_REQ_UNINITIALIZED;
 
-	fastlock_release(&cq->cq_lock);
+	ofi_lock_release(&cq->cq_lock);
+	ofi_poll_notify(&cq->poll_notify);
 	ucp_request_release(request);
 }
 
@@ -114,7 +115,7 @@ void mlx_recv_callback (
 		mlx_req->completion.error.err = MLX_TRANSLATE_ERRCODE(status);
 	}
 
-	fastlock_acquire(&cq->cq_lock);
+	ofi_lock_acquire(&cq->cq_lock);
 	if (mlx_req->type == MLX_FI_REQ_UNINITIALIZED) {
 		if (status != UCS_OK) {
 			mlx_req->completion.error.olen = info->length;
@@ -160,6 +161,7 @@ void mlx_recv_callback (
 		ofi_cirque_commit(cq->cirq);
 		ucp_request_release(request);
 	}
-	fastlock_release(&cq->cq_lock);
+	ofi_lock_release(&cq->cq_lock);
+	ofi_poll_notify(&cq->poll_notify);
 }
 
@@ -95,7 +95,7 @@ static ssize_t mlx_tagged_recvmsg(
 
 	/*Unexpected path*/
 	struct fi_cq_tagged_entry *t_entry;
-	fastlock_acquire(&cq->cq_lock);
+	ofi_lock_acquire(&cq->cq_lock);
 	t_entry = ofi_cirque_tail(cq->cirq);
 	*t_entry = (req->completion.tagged);
 
@@ -116,7 +116,8 @@ static ssize_t mlx_tagged_recvmsg(
 
 	//ucp_request_release(req);
 	ofi_cirque_commit(cq->cirq);
-	fastlock_release(&cq->cq_lock);
+	ofi_lock_release(&cq->cq_lock);
+	ofi_poll_notify(&cq->poll_notify);
 
 fence:
 	if(flags & FI_FENCE) {
@@ -215,7 +216,7 @@ static ssize_t mlx_tagged_sendmsg(
 		req->completion.tagged.tag = msg->tag;
 	} else {
 		struct fi_cq_tagged_entry *t_entry;
-		fastlock_acquire(&cq->cq_lock);
+		ofi_lock_acquire(&cq->cq_lock);
 		t_entry = ofi_cirque_tail(cq->cirq);
 		t_entry->op_context = msg->context;
 		t_entry->flags = FI_SEND;
@@ -224,7 +225,8 @@ static ssize_t mlx_tagged_sendmsg(
 		t_entry->data = 0;
 		t_entry->tag = msg->tag;
 		ofi_cirque_commit(cq->cirq);
-		fastlock_release(&cq->cq_lock);
+		ofi_lock_release(&cq->cq_lock);
+		ofi_poll_notify(&cq->poll_notify);
 	}
 
 fence:
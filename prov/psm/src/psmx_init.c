@@ -49,6 +49,33 @@ struct psmx_env psmx_env = {
 	.prog_affinity	= NULL,
 };
 
+/*
+ * Name server client used by fi_getinfo to resolve node:service.  It is
+ * kept for the life of the provider, so that connections to remote name
+ * servers and the names resolved from them are reused across calls.  The
+ * port is derived from the uuid set when the provider is loaded.
+ */
+static struct util_ns psmx_ns;
+
+static void psmx_init_ns(void)
+{
+	struct util_ns_attr ns_attr = (const struct util_ns_attr){ 0 };
+	psm_uuid_t uuid;
+	int err;
+
+	fi_param_get_str(&psmx_prov, "uuid", &psmx_env.uuid);
+	psmx_get_uuid(uuid);
+	ns_attr.ns_port = psmx_uuid_to_port(uuid);
+	ns_attr.name_len = sizeof(psm_epid_t);
+	ns_attr.service_len = sizeof(int);
+	ns_attr.service_cmp = psmx_ns_service_cmp;
+	ns_attr.is_service_wildcard = psmx_ns_is_service_wildcard;
+	err = ofi_ns_init(&ns_attr, &psmx_ns);
+	if (err)
+		FI_INFO(&psmx_prov, FI_LOG_CORE,
+			"ofi_ns_init returns %d\n", err);
+}
+
 static void psmx_init_env(void)
 {
 	if (getenv("OMPI_COMM_WORLD_RANK") || getenv("PMI_RANK"))
@@ -225,28 +252,10 @@ static int psmx_getinfo(uint32_t version, const char *node, const char *service,
 			"node '%s' service '%s' converted to <unit=%d, port=%d, service=%d>\n",
 			node, service, src_addr->unit, src_addr->port, src_addr->service);
 	} else if (node) {
-		struct util_ns ns = (const struct util_ns){ 0 };
-		struct util_ns_attr ns_attr = (const struct util_ns_attr){ 0 };
-		psm_uuid_t uuid;
-
-		psmx_get_uuid(uuid);
-		ns_attr.ns_port = psmx_uuid_to_port(uuid);
-		ns_attr.name_len = sizeof(*dest_addr);
-		ns_attr.service_len = sizeof(svc);
-		ns_attr.service_cmp = psmx_ns_service_cmp;
-		ns_attr.is_service_wildcard = psmx_ns_is_service_wildcard;
-		err = ofi_ns_init(&ns_attr, &ns);
-		if (err) {
-			FI_INFO(&psmx_prov, FI_LOG_CORE,
-				"ofi_ns_init returns %d\n", err);
-			err = -FI_ENODATA;
-			goto err_out;
-		}
-
 		if (service)
 			svc = atoi(service);
 		svc0 = svc;
-		dest_addr = (psm_epid_t *)ofi_ns_resolve_name(&ns, node, &svc);
+		dest_addr = (psm_epid_t *)ofi_ns_resolve_name(&psmx_ns, node, &svc);
 		if (dest_addr) {
 			FI_INFO(&psmx_prov, FI_LOG_CORE,
 				"'%s:%u' resolved to <epid=0x%llx>:%u\n",
@@ -627,7 +636,11 @@ static void psmx_fini(void)
 {
 	FI_INFO(&psmx_prov, FI_LOG_CORE, "\n");
 
-	if (! --psmx_init_count && psmx_lib_initialized) {
+	if (--psmx_init_count)
+		return;
+
+	ofi_ns_fini(&psmx_ns);
+	if (psmx_lib_initialized) {
 		/* This function is called from a library destructor, which is called
 		 * automatically when exit() is called. The call to psm_finalize()
 		 * might cause deadlock if the applicaiton is terminated with Ctrl-C
@@ -697,6 +710,7 @@ PROVIDER_INI
 			"(default: affinity not set)");
 
 	pthread_mutex_init(&psmx_lib_mutex, NULL);
+	psmx_init_ns();
 	psmx_init_count++;
 	return (&psmx_prov);
 }
@@ -55,6 +55,33 @@ struct psmx2_env psmx2_env = {
 	.lazy_conn	= 0,
 };
 
+/*
+ * Name server client used by fi_getinfo to resolve node:service.  It is
+ * kept for the life of the provider, so that connections to remote name
+ * servers and the names resolved from them are reused across calls.  The
+ * port is derived from the uuid set when the provider is loaded.
+ */
+static struct util_ns psmx2_ns;
+
+static void psmx2_init_ns(void)
+{
+	struct util_ns_attr ns_attr = (const struct util_ns_attr){ 0 };
+	psm2_uuid_t uuid;
+	int err;
+
+	fi_param_get_str(&psmx2_prov, "uuid", &psmx2_env.uuid);
+	psmx2_get_uuid(uuid);
+	ns_attr.ns_port = psmx2_uuid_to_port(uuid);
+	ns_attr.name_len = sizeof(struct psmx2_ep_name);
+	ns_attr.service_len = sizeof(int);
+	ns_attr.service_cmp = psmx2_ns_service_cmp;
+	ns_attr.is_service_wildcard = psmx2_ns_is_service_wildcard;
+	err = ofi_ns_init(&ns_attr, &psmx2_ns);
+	if (err)
+		FI_INFO(&psmx2_prov, FI_LOG_CORE,
+			"ofi_ns_init returns %d\n", err);
+}
+
 static void psmx2_init_env(void)
 {
 	if (getenv("OMPI_COMM_WORLD_RANK") || getenv("PMI_RANK"))
@@ -286,29 +313,11 @@ static int psmx2_getinfo(uint32_t version, const char *node,
 	}
 
 	if (!dest_addr && node && !(flags & FI_SOURCE)) {
-		struct util_ns ns = (const struct util_ns){ 0 };
-		struct util_ns_attr ns_attr = (const struct util_ns_attr){ 0 };
-		psm2_uuid_t uuid;
-
-		psmx2_get_uuid(uuid);
-		ns_attr.ns_port = psmx2_uuid_to_port(uuid);
-		ns_attr.name_len = sizeof(*dest_addr);
-		ns_attr.service_len = sizeof(svc);
-		ns_attr.service_cmp = psmx2_ns_service_cmp;
-		ns_attr.is_service_wildcard = psmx2_ns_is_service_wildcard;
-		err = ofi_ns_init(&ns_attr, &ns);
-		if (err) {
-			FI_INFO(&psmx2_prov, FI_LOG_CORE,
-				"ofi_ns_init returns %d\n", err);
-			err = -FI_ENODATA;
-			goto err_out;
-		}
-
 		if (service)
 			svc = atoi(service);
 		svc0 = svc;
 		dest_addr = (struct psmx2_ep_name *)
-			ofi_ns_resolve_name(&ns, node, &svc);
+			ofi_ns_resolve_name(&psmx2_ns, node, &svc);
 		if (dest_addr) {
 			FI_INFO(&psmx2_prov, FI_LOG_CORE,
 				"'%s:%u' resolved to <epid=0x%llx, vl=%d>:%d\n",
@@ -711,7 +720,11 @@ static void psmx2_fini(void)
 {
 	FI_INFO(&psmx2_prov, FI_LOG_CORE, "\n");
 
-	if (! --psmx2_init_count && psmx2_lib_initialized) {
+	if (--psmx2_init_count)
+		return;
+
+	ofi_ns_fini(&psmx2_ns);
+	if (psmx2_lib_initialized) {
 		/* This function is called from a library destructor, which is called
 		 * automatically when exit() is called. The call to psm2_finalize()
 		 * might cause deadlock if the applicaiton is terminated with Ctrl-C
@@ -782,6 +795,7 @@ PROVIDER_INI
 			"Whether to use lazy connection or not (default: no).");
 
 	pthread_mutex_init(&psmx2_lib_mutex, NULL);
+	psmx2_init_ns();
 	psmx2_init_count++;
 	return (&psmx2_prov);
 }
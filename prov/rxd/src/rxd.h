@@ -52,6 +52,7 @@
 #include <fi_rbuf.h>
 #include <fi_list.h>
 #include <fi_util.h>
+#include <fi_trace.h>
 
 #ifndef _RXD_H_
 #define _RXD_H_
@@ -78,6 +79,7 @@
 #define RXD_MAX_RX_CREDITS	16
 #define RXD_MAX_PEER_TX		8
 #define RXD_MAX_UNACKED		128
+#define RXD_MAX_PEER_ACKS	RXD_MAX_PEER_TX
 
 #define RXD_EP_MAX_UNEXP_PKT	512
 #define RXD_EP_MAX_UNEXP_MSG	128
@@ -88,6 +90,8 @@
 #define RXD_MAX_PKT_RETRY	50
 
 extern int rxd_progress_spin_count;
+extern int rxd_ack_delay;
+extern int rxd_ack_count;
 extern int rxd_reposted_bufs;
 
 extern struct fi_provider rxd_prov;
@@ -95,6 +99,7 @@ extern struct fi_info rxd_info;
 extern struct fi_fabric_attr rxd_fabric_attr;
 extern struct util_prov rxd_util_prov;
 extern struct fi_ops_rma rxd_ops_rma;
+extern struct fi_ops_atomic rxd_ops_atomic;
 
 enum {
 	RXD_TX_CONN = 0,
@@ -103,6 +108,8 @@ enum {
 	RXD_TX_WRITE,
 	RXD_TX_READ_REQ,
 	RXD_TX_READ_RSP,
+	RXD_TX_ATOMIC,
+	RXD_TX_ATOMIC_FETCH,
 };
 
 struct rxd_fabric {
@@ -125,8 +132,21 @@ struct rxd_av {
 
 	int dg_av_used;
 	size_t dg_addrlen;
+	/* dg addresses of scalable peers' rx contexts, by ofi_av_ctx_index */
+	fi_addr_t *ctx_dg_addr;
 };
 
+/*
+ * A scalable peer may reach us from a port per rx and tx context, each
+ * of which takes a dg AV entry and a peer slot.
+ */
+static inline size_t rxd_av_dg_count(struct rxd_av *av)
+{
+	return av->util_av.rx_ctx_bits ?
+	       av->util_av.count << (av->util_av.rx_ctx_bits + 1) :
+	       av->util_av.count;
+}
+
 struct rxd_cq;
 typedef int (*rxd_cq_write_fn)(struct rxd_cq *cq,
 			       struct fi_cq_tagged_entry *cq_entry);
@@ -135,6 +155,11 @@ struct rxd_cq {
 	rxd_cq_write_fn write_fn;
 };
 
+struct rxd_nack {
+	uint64_t		msg_id;
+	uint16_t		err;
+};
+
 struct rxd_peer {
 	uint64_t		nxt_msg_id;
 	uint64_t		exp_msg_id;
@@ -143,6 +168,39 @@ struct rxd_peer {
 
 	enum util_cmap_state	state;
 	uint16_t		active_tx_cnt;
+
+	/*
+	 * Acks for messages received in full are held back, to be carried
+	 * by the next packet sent to the peer or coalesced into one ack.
+	 */
+	struct ofi_ctrl_ack	acks[RXD_MAX_PEER_ACKS];
+	uint8_t			ack_cnt;
+	uint64_t		ack_time;
+	struct dlist_entry	ack_entry;
+
+	/*
+	 * Rejected requests, by sequence number within the peer's tx window,
+	 * so that a retransmitted request is nacked again.
+	 */
+	struct rxd_nack		nacks[RXD_MAX_PEER_TX];
+};
+
+static inline struct rxd_nack *rxd_peer_nack(struct rxd_peer *peer,
+					     uint64_t msg_id)
+{
+	return &peer->nacks[(msg_id >> RXD_MAX_TX_BITS) % RXD_MAX_PEER_TX];
+}
+
+enum rxd_stat {
+	RXD_STAT_RETRANSMITS,
+	RXD_STAT_ACKS_SENT,
+	RXD_STAT_ACKS_PIGGYBACKED,
+	RXD_STAT_UNEXP_MSGS,
+	RXD_STAT_UNEXP_DEPTH,
+	RXD_STAT_UNEXP_DROPPED,
+	RXD_STAT_TX_PKT_BUFS,
+	RXD_STAT_RX_PKT_BUFS,
+	RXD_STAT_MAX,
 };
 
 struct rxd_ep {
@@ -173,6 +231,8 @@ struct rxd_ep {
 
 	struct rxd_tx_entry_fs *tx_entry_fs;
 	struct dlist_entry tx_entry_list;
+	/* peers holding acks, oldest first */
+	struct dlist_entry ack_list;
 
 	struct rxd_rx_entry_fs *rx_entry_fs;
 	struct dlist_entry rx_entry_list;
@@ -182,7 +242,9 @@ struct rxd_ep {
 
 	struct rxd_trecv_fs *trecv_fs;
 	struct dlist_entry trecv_list;
-	fastlock_t lock;
+	ofi_lock_t lock;
+
+	struct ofi_stats stats;
 };
 
 static inline struct rxd_domain *rxd_ep_domain(struct rxd_ep *ep)
@@ -195,6 +257,13 @@ static inline struct rxd_av *rxd_ep_av(struct rxd_ep *ep)
 	return container_of(ep->util_ep.av, struct rxd_av, util_av);
 }
 
+/* Peers are indexed by the address of the peer in the DGRAM AV */
+static inline fi_addr_t rxd_ep_peer_addr(struct rxd_ep *ep,
+					 struct rxd_peer *peer)
+{
+	return (fi_addr_t) (peer - ep->peer_info);
+}
+
 static inline struct rxd_cq *rxd_ep_tx_cq(struct rxd_ep *ep)
 {
 	return container_of(ep->util_ep.tx_cq, struct rxd_cq, util_cq);
@@ -205,6 +274,16 @@ static inline struct rxd_cq *rxd_ep_rx_cq(struct rxd_ep *ep)
 	return container_of(ep->util_ep.rx_cq, struct rxd_cq, util_cq);
 }
 
+/* Resolve the completion semantics of an operation once, when it is posted */
+static inline uint64_t rxd_ep_op_flags(uint64_t flags, uint64_t op_flags)
+{
+	flags |= (flags & RXD_USE_OP_FLAGS) ? op_flags :
+		 (op_flags & FI_COMPLETION);
+	if (flags & RXD_NO_COMPLETION)
+		flags &= ~FI_COMPLETION;
+	return flags;
+}
+
 struct rxd_rx_buf {
 	struct fi_context context;
 	struct slist_entry entry;
@@ -293,10 +372,37 @@ struct rxd_tx_entry {
 			uint8_t iov_count;
 			struct iovec src_iov[RXD_IOV_LIMIT];
 		} read_rsp;
+
+		struct {
+			struct fi_msg_atomic msg;
+			struct fi_ioc src_iov[RXD_IOV_LIMIT];
+			struct fi_ioc cmp_iov[RXD_IOV_LIMIT];
+			struct fi_rma_ioc dst_iov[RXD_IOV_LIMIT];
+			struct iovec res_iov[RXD_IOV_LIMIT];
+			uint8_t cmp_count;
+			uint8_t res_count;
+		} atomic;
 	};
 };
 DECLARE_FREESTACK(struct rxd_tx_entry, rxd_tx_entry_fs);
 
+/*
+ * Read requests and atomics are carried entirely by their start packet;
+ * only sends, tagged sends, writes and read responses have a data phase.
+ */
+static inline uint64_t rxd_tx_entry_data_size(struct rxd_tx_entry *tx_entry)
+{
+	switch (tx_entry->op_type) {
+	case RXD_TX_CONN:
+	case RXD_TX_READ_REQ:
+	case RXD_TX_ATOMIC:
+	case RXD_TX_ATOMIC_FETCH:
+		return 0;
+	default:
+		return tx_entry->op_hdr.size;
+	}
+}
+
 struct rxd_recv_entry {
 	struct dlist_entry entry;
 	struct fi_msg msg;
@@ -358,6 +464,8 @@ int rxd_av_create(struct fid_domain *domain_fid, struct fi_av_attr *attr,
 		  struct fid_av **av, void *context);
 int rxd_endpoint(struct fid_domain *domain, struct fi_info *info,
 		 struct fid_ep **ep, void *context);
+int rxd_scalable_ep(struct fid_domain *domain, struct fi_info *info,
+		    struct fid_ep **sep, void *context);
 int rxd_cq_open(struct fid_domain *domain, struct fi_cq_attr *attr,
 		struct fid_cq **cq_fid, void *context);
 int rxd_cntr_open(struct fid_domain *domain, struct fi_cntr_attr *attr,
@@ -379,6 +487,10 @@ int rxd_ep_repost_buff(struct rxd_rx_buf *rx_buf);
 int rxd_ep_reply_ack(struct rxd_ep *ep, struct ofi_ctrl_hdr *in_ctrl,
 		     uint8_t type, uint16_t seg_size, uint64_t rx_key,
 		     uint64_t source, fi_addr_t dest);
+void rxd_ep_queue_ack(struct rxd_ep *ep, struct rxd_peer *peer,
+		      uint64_t msg_id, uint32_t seg_no, uint64_t rx_key);
+int rxd_ep_flush_acks(struct rxd_ep *ep, struct rxd_peer *peer);
+void rxd_ep_handle_ack(struct rxd_ep *ep, const struct ofi_ctrl_ack *ack);
 struct rxd_peer *rxd_ep_getpeer_info(struct rxd_ep *rxd_ep, fi_addr_t addr);
 
 void rxd_ep_check_unexp_msg_list(struct rxd_ep *ep,
@@ -397,6 +509,13 @@ ssize_t rxd_ep_start_xfer(struct rxd_ep *ep, struct rxd_peer *peer,
 ssize_t rxd_ep_connect(struct rxd_ep *ep, struct rxd_peer *peer, fi_addr_t addr);
 int rxd_mr_verify(struct rxd_domain *rxd_domain, ssize_t len,
 		  uintptr_t *io_addr, uint64_t key, uint64_t access);
+int rxd_query_atomic(struct fid_domain *domain, enum fi_datatype datatype,
+		     enum fi_op op, struct fi_atomic_attr *attr,
+		     uint64_t flags);
+size_t rxd_atomic_copy_req(struct rxd_tx_entry *tx_entry, char *buf);
+int rxd_atomic_handle_req(struct rxd_ep *ep, struct rxd_rx_entry *rx_entry,
+			  struct rxd_pkt_data_start *pkt_start,
+			  struct iovec *result);
 
 
 /* Tx/Rx entry sub-functions */
@@ -415,6 +534,9 @@ void rxd_rx_entry_free(struct rxd_ep *ep, struct rxd_rx_entry *rx_entry);
 /* CQ sub-functions */
 void rxd_cq_report_error(struct rxd_cq *cq, struct fi_cq_err_entry *err_entry);
 void rxd_cq_report_tx_comp(struct rxd_cq *cq, struct rxd_tx_entry *tx_entry);
+void rxd_tx_entry_report_error(struct rxd_ep *ep, struct rxd_tx_entry *tx_entry,
+			       int err);
 void rxd_cntr_report_tx_comp(struct rxd_ep *ep, struct rxd_tx_entry *tx_entry);
+void rxd_cntr_report_error(struct rxd_ep *ep, struct fi_cq_err_entry *err);
 
 #endif
@@ -0,0 +1,592 @@
+/*
+ * Copyright (c) 2017 Intel Corporation. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <fi_iov.h>
+#include <ofi_atomic.h>
+#include "rxd.h"
+
+/*
+ * Atomics are carried in a single start packet: the target ioc list,
+ * followed by the operand data and, for compare atomics, the compare data.
+ * Fetching atomics return the original target data in a read response.
+ */
+static uint64_t rxd_atomic_valid_flags(uint8_t op)
+{
+	return op == ofi_op_atomic_fetch ? FI_FETCH_ATOMIC :
+	       op == ofi_op_atomic_compare ? FI_COMPARE_ATOMIC : 0;
+}
+
+static size_t rxd_atomic_max_data(struct rxd_domain *domain, size_t ioc_count)
+{
+	return domain->max_mtu_sz - sizeof(struct rxd_pkt_data_start) -
+	       ioc_count * sizeof(struct ofi_rma_ioc);
+}
+
+static ssize_t rxd_atomic_check(struct rxd_ep *ep,
+				const struct fi_msg_atomic *msg,
+				const struct fi_ioc *comparev,
+				size_t compare_count,
+				const struct fi_ioc *resultv,
+				size_t result_count, uint8_t op)
+{
+	size_t i, count = 0, len;
+	ssize_t ret;
+
+	ret = ofi_atomic_valid(&rxd_prov, msg->datatype, msg->op,
+			       rxd_atomic_valid_flags(op));
+	if (ret)
+		return ret;
+
+	if (msg->iov_count > RXD_IOV_LIMIT ||
+	    msg->rma_iov_count > RXD_IOV_LIMIT ||
+	    compare_count > RXD_IOV_LIMIT || result_count > RXD_IOV_LIMIT)
+		return -FI_EINVAL;
+
+	for (i = 0; i < msg->rma_iov_count; i++)
+		count += msg->rma_iov[i].count;
+
+	if (count != ofi_total_ioc_cnt(msg->msg_iov, msg->iov_count) ||
+	    (comparev && count != ofi_total_ioc_cnt(comparev, compare_count)) ||
+	    (resultv && count != ofi_total_ioc_cnt(resultv, result_count)))
+		return -FI_EINVAL;
+
+	len = count * ofi_datatype_size(msg->datatype);
+	if (op == ofi_op_atomic_compare)
+		len *= 2;
+
+	return len > rxd_atomic_max_data(rxd_ep_domain(ep),
+					 msg->rma_iov_count) ?
+	       -FI_EMSGSIZE : 0;
+}
+
+static char *rxd_atomic_copy_ioc(char *data, const struct fi_ioc *ioc,
+				 size_t count, size_t dt_size)
+{
+	size_t i, len;
+
+	for (i = 0; i < count; i++) {
+		len = ioc[i].count * dt_size;
+		memcpy(data, ioc[i].addr, len);
+		data += len;
+	}
+	return data;
+}
+
+size_t rxd_atomic_copy_req(struct rxd_tx_entry *tx_entry, char *buf)
+{
+	struct ofi_rma_ioc *rma_ioc = (struct ofi_rma_ioc *) buf;
+	size_t dt_size, len, i;
+	char *data;
+
+	for (i = 0; i < tx_entry->atomic.msg.rma_iov_count; i++) {
+		rma_ioc[i].addr = tx_entry->atomic.dst_iov[i].addr;
+		rma_ioc[i].count = tx_entry->atomic.dst_iov[i].count;
+		rma_ioc[i].key = tx_entry->atomic.dst_iov[i].key;
+	}
+
+	dt_size = ofi_datatype_size(tx_entry->atomic.msg.datatype);
+	len = ofi_total_ioc_cnt(tx_entry->atomic.src_iov,
+				tx_entry->atomic.msg.iov_count) * dt_size;
+	data = (char *) &rma_ioc[i];
+
+	/* FI_ATOMIC_READ carries no operand and may pass a NULL buffer */
+	if (tx_entry->atomic.msg.op != FI_ATOMIC_READ)
+		rxd_atomic_copy_ioc(data, tx_entry->atomic.src_iov,
+				    tx_entry->atomic.msg.iov_count, dt_size);
+	data += len;
+
+	if (tx_entry->atomic.cmp_count) {
+		rxd_atomic_copy_ioc(data, tx_entry->atomic.cmp_iov,
+				    tx_entry->atomic.cmp_count, dt_size);
+		data += len;
+	}
+	return data - buf;
+}
+
+static ssize_t rxd_ep_atomic_common(struct fid_ep *ep,
+				    const struct fi_msg_atomic *msg,
+				    const struct fi_ioc *comparev,
+				    size_t compare_count,
+				    struct fi_ioc *resultv,
+				    size_t result_count,
+				    uint64_t flags, uint8_t op)
+{
+	struct rxd_ep *rxd_ep;
+	struct rxd_peer *peer;
+	struct rxd_tx_entry *tx_entry;
+	uint64_t peer_addr;
+	size_t dt_size, i;
+	ssize_t ret;
+
+	rxd_ep = container_of(ep, struct rxd_ep, util_ep.ep_fid);
+	ret = rxd_atomic_check(rxd_ep, msg, comparev, compare_count,
+			       resultv, result_count, op);
+	if (ret)
+		return ret;
+
+	peer_addr = rxd_av_dg_addr(rxd_ep_av(rxd_ep), msg->addr);
+	if (peer_addr >= rxd_ep->max_peers)
+		return -FI_EADDRNOTAVAIL;
+	peer = rxd_ep_getpeer_info(rxd_ep, peer_addr);
+
+	ofi_lock_acquire(&rxd_ep->lock);
+	if (peer->state != CMAP_CONNECTED) {
+		ret = rxd_ep_connect(rxd_ep, peer, peer_addr);
+		ofi_lock_release(&rxd_ep->lock);
+		if (ret == -FI_EALREADY) {
+			rxd_ep->util_ep.progress(&rxd_ep->util_ep);
+			ret = -FI_EAGAIN;
+		}
+		return ret ? ret : -FI_EAGAIN;
+	}
+
+	tx_entry = rxd_tx_entry_alloc(rxd_ep, peer, peer_addr, flags,
+				      op == ofi_op_atomic ? RXD_TX_ATOMIC :
+				      RXD_TX_ATOMIC_FETCH);
+	if (!tx_entry) {
+		ret = -FI_EAGAIN;
+		goto out;
+	}
+
+	tx_entry->atomic.msg = *msg;
+	memcpy(&tx_entry->atomic.src_iov[0], msg->msg_iov,
+	       sizeof(*msg->msg_iov) * msg->iov_count);
+	memcpy(&tx_entry->atomic.dst_iov[0], msg->rma_iov,
+	       sizeof(*msg->rma_iov) * msg->rma_iov_count);
+	tx_entry->atomic.cmp_count = comparev ? compare_count : 0;
+	if (comparev)
+		memcpy(&tx_entry->atomic.cmp_iov[0], comparev,
+		       sizeof(*comparev) * compare_count);
+
+	dt_size = ofi_datatype_size(msg->datatype);
+	tx_entry->atomic.res_count = resultv ? result_count : 0;
+	for (i = 0; i < tx_entry->atomic.res_count; i++) {
+		tx_entry->atomic.res_iov[i].iov_base = resultv[i].addr;
+		tx_entry->atomic.res_iov[i].iov_len = resultv[i].count * dt_size;
+	}
+
+	ret = rxd_ep_start_xfer(rxd_ep, peer, op, tx_entry);
+	if (ret)
+		rxd_tx_entry_free(rxd_ep, tx_entry);
+
+out:
+	ofi_lock_release(&rxd_ep->lock);
+	return ret;
+}
+
+static void rxd_atomic_op(uint8_t op, enum fi_datatype datatype,
+			  enum fi_op atomic_op, void *dst, const void *src,
+			  const void *cmp, void *res, size_t count)
+{
+	switch (op) {
+	case ofi_op_atomic:
+		ofi_atomic_write_handlers[atomic_op][datatype]
+			(dst, src, count);
+		break;
+	case ofi_op_atomic_fetch:
+		ofi_atomic_readwrite_handlers[atomic_op][datatype]
+			(dst, src, res, count);
+		break;
+	default:
+		ofi_atomic_swap_handlers[atomic_op - OFI_SWAP_OP_START][datatype]
+			(dst, src, cmp, res, count);
+		break;
+	}
+}
+
+/*
+ * Validates an incoming atomic request against the MR map and applies it.
+ * The original target data of fetching atomics is written to result.
+ * Requests are applied under the domain lock, so that atomics issued through
+ * different endpoints of the domain do not interleave.
+ */
+int rxd_atomic_handle_req(struct rxd_ep *ep, struct rxd_rx_entry *rx_entry,
+			  struct rxd_pkt_data_start *pkt_start,
+			  struct iovec *result)
+{
+	struct rxd_domain *rxd_domain = rxd_ep_domain(ep);
+	struct ofi_op_hdr *op_hdr = &rx_entry->op_hdr;
+	struct ofi_rma_ioc *rma_ioc;
+	const char *src, *cmp;
+	char *res;
+	uint64_t access;
+	size_t dt_size, len, i;
+	int ret;
+
+	ret = ofi_atomic_valid(&rxd_prov, op_hdr->atomic.datatype,
+			       op_hdr->atomic.op,
+			       rxd_atomic_valid_flags(op_hdr->op));
+	if (ret || op_hdr->atomic.ioc_count > RXD_IOV_LIMIT)
+		return -FI_EINVAL;
+
+	rma_ioc = (struct ofi_rma_ioc *) pkt_start->data;
+	len = op_hdr->atomic.ioc_count * sizeof(*rma_ioc) + op_hdr->size *
+	      (op_hdr->op == ofi_op_atomic_compare ? 2 : 1);
+	if (len != pkt_start->ctrl.seg_size)
+		return -FI_EINVAL;
+
+	dt_size = ofi_datatype_size(op_hdr->atomic.datatype);
+	access = (op_hdr->op == ofi_op_atomic) ? FI_REMOTE_WRITE :
+		 (FI_REMOTE_READ | FI_REMOTE_WRITE);
+	for (i = 0, len = 0; i < op_hdr->atomic.ioc_count; i++) {
+		ret = rxd_mr_verify(rxd_domain, rma_ioc[i].count * dt_size,
+				    (uintptr_t *) &rma_ioc[i].addr,
+				    rma_ioc[i].key, access);
+		if (ret) {
+			FI_WARN(&rxd_prov, FI_LOG_EP_CTRL,
+				"invalid key/access permissions\n");
+			return -FI_EACCES;
+		}
+		len += rma_ioc[i].count * dt_size;
+	}
+	if (len != op_hdr->size)
+		return -FI_EINVAL;
+
+	src = (const char *) &rma_ioc[i];
+	cmp = src + op_hdr->size;
+	res = result->iov_base;
+
+	fastlock_acquire(&rxd_domain->util_domain.lock);
+	for (i = 0; i < op_hdr->atomic.ioc_count; i++) {
+		len = rma_ioc[i].count * dt_size;
+		rxd_atomic_op(op_hdr->op, op_hdr->atomic.datatype,
+			      op_hdr->atomic.op,
+			      (void *) (uintptr_t) rma_ioc[i].addr,
+			      src, cmp, res, rma_ioc[i].count);
+		src += len;
+		cmp += len;
+		if (res)
+			res += len;
+	}
+	fastlock_release(&rxd_domain->util_domain.lock);
+
+	result->iov_len = res ? op_hdr->size : 0;
+	return 0;
+}
+
+static ssize_t rxd_ep_atomic_writemsg(struct fid_ep *ep,
+				      const struct fi_msg_atomic *msg,
+				      uint64_t flags)
+{
+	return rxd_ep_atomic_common(ep, msg, NULL, 0, NULL, 0, flags,
+				    ofi_op_atomic);
+}
+
+static ssize_t rxd_ep_atomic_writev(struct fid_ep *ep,
+				    const struct fi_ioc *iov, void **desc,
+				    size_t count, fi_addr_t dest_addr,
+				    uint64_t addr, uint64_t key,
+				    enum fi_datatype datatype, enum fi_op op,
+				    void *context)
+{
+	struct fi_msg_atomic msg;
+	struct fi_rma_ioc rma_iov;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.desc = desc;
+	msg.iov_count = count;
+
+	rma_iov.addr = addr;
+	rma_iov.count = ofi_total_ioc_cnt(iov, count);
+	rma_iov.key = key;
+	msg.rma_iov = &rma_iov;
+	msg.rma_iov_count = 1;
+
+	msg.addr = dest_addr;
+	msg.datatype = datatype;
+	msg.op = op;
+	msg.context = context;
+
+	return rxd_ep_atomic_writemsg(ep, &msg, RXD_USE_OP_FLAGS);
+}
+
+static ssize_t rxd_ep_atomic_write(struct fid_ep *ep, const void *buf,
+				   size_t count, void *desc,
+				   fi_addr_t dest_addr, uint64_t addr,
+				   uint64_t key, enum fi_datatype datatype,
+				   enum fi_op op, void *context)
+{
+	struct fi_ioc iov;
+
+	iov.addr = (void *) buf;
+	iov.count = count;
+
+	return rxd_ep_atomic_writev(ep, &iov, &desc, 1, dest_addr, addr,
+				    key, datatype, op, context);
+}
+
+static ssize_t rxd_ep_atomic_inject(struct fid_ep *ep, const void *buf,
+				    size_t count, fi_addr_t dest_addr,
+				    uint64_t addr, uint64_t key,
+				    enum fi_datatype datatype, enum fi_op op)
+{
+	struct fi_msg_atomic msg;
+	struct fi_ioc iov;
+	struct fi_rma_ioc rma_iov;
+
+	memset(&msg, 0, sizeof(msg));
+	iov.addr = (void *) buf;
+	iov.count = count;
+	msg.msg_iov = &iov;
+	msg.iov_count = 1;
+
+	rma_iov.addr = addr;
+	rma_iov.count = count;
+	rma_iov.key = key;
+	msg.rma_iov = &rma_iov;
+	msg.rma_iov_count = 1;
+
+	msg.addr = dest_addr;
+	msg.datatype = datatype;
+	msg.op = op;
+
+	return rxd_ep_atomic_writemsg(ep, &msg, FI_INJECT |
+				      RXD_NO_COMPLETION | RXD_USE_OP_FLAGS);
+}
+
+static ssize_t rxd_ep_atomic_readwritemsg(struct fid_ep *ep,
+					  const struct fi_msg_atomic *msg,
+					  struct fi_ioc *resultv,
+					  void **result_desc,
+					  size_t result_count, uint64_t flags)
+{
+	return rxd_ep_atomic_common(ep, msg, NULL, 0, resultv, result_count,
+				    flags, ofi_op_atomic_fetch);
+}
+
+static ssize_t rxd_ep_atomic_readwritev(struct fid_ep *ep,
+					const struct fi_ioc *iov, void **desc,
+					size_t count, struct fi_ioc *resultv,
+					void **result_desc, size_t result_count,
+					fi_addr_t dest_addr, uint64_t addr,
+					uint64_t key, enum fi_datatype datatype,
+					enum fi_op op, void *context)
+{
+	struct fi_msg_atomic msg;
+	struct fi_rma_ioc rma_iov;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.desc = desc;
+	msg.iov_count = count;
+
+	rma_iov.addr = addr;
+	rma_iov.count = ofi_total_ioc_cnt(iov, count);
+	rma_iov.key = key;
+	msg.rma_iov = &rma_iov;
+	msg.rma_iov_count = 1;
+
+	msg.addr = dest_addr;
+	msg.datatype = datatype;
+	msg.op = op;
+	msg.context = context;
+
+	return rxd_ep_atomic_readwritemsg(ep, &msg, resultv, result_desc,
+					  result_count, RXD_USE_OP_FLAGS);
+}
+
+static ssize_t rxd_ep_atomic_readwrite(struct fid_ep *ep, const void *buf,
+				       size_t count, void *desc, void *result,
+				       void *result_desc, fi_addr_t dest_addr,
+				       uint64_t addr, uint64_t key,
+				       enum fi_datatype datatype, enum fi_op op,
+				       void *context)
+{
+	struct fi_ioc iov, resultv;
+
+	iov.addr = (void *) buf;
+	iov.count = count;
+	resultv.addr = result;
+	resultv.count = count;
+
+	return rxd_ep_atomic_readwritev(ep, &iov, &desc, 1, &resultv,
+					&result_desc, 1, dest_addr, addr, key,
+					datatype, op, context);
+}
+
+static ssize_t rxd_ep_atomic_compwritemsg(struct fid_ep *ep,
+					  const struct fi_msg_atomic *msg,
+					  const struct fi_ioc *comparev,
+					  void **compare_desc,
+					  size_t compare_count,
+					  struct fi_ioc *resultv,
+					  void **result_desc,
+					  size_t result_count, uint64_t flags)
+{
+	return rxd_ep_atomic_common(ep, msg, comparev, compare_count,
+				    resultv, result_count, flags,
+				    ofi_op_atomic_compare);
+}
+
+static ssize_t rxd_ep_atomic_compwritev(struct fid_ep *ep,
+					const struct fi_ioc *iov, void **desc,
+					size_t count,
+					const struct fi_ioc *comparev,
+					void **compare_desc,
+					size_t compare_count,
+					struct fi_ioc *resultv,
+					void **result_desc, size_t result_count,
+					fi_addr_t dest_addr, uint64_t addr,
+					uint64_t key, enum fi_datatype datatype,
+					enum fi_op op, void *context)
+{
+	struct fi_msg_atomic msg;
+	struct fi_rma_ioc rma_iov;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.desc = desc;
+	msg.iov_count = count;
+
+	rma_iov.addr = addr;
+	rma_iov.count = ofi_total_ioc_cnt(iov, count);
+	rma_iov.key = key;
+	msg.rma_iov = &rma_iov;
+	msg.rma_iov_count = 1;
+
+	msg.addr = dest_addr;
+	msg.datatype = datatype;
+	msg.op = op;
+	msg.context = context;
+
+	return rxd_ep_atomic_compwritemsg(ep, &msg, comparev, compare_desc,
+					  compare_count, resultv, result_desc,
+					  result_count, RXD_USE_OP_FLAGS);
+}
+
+static ssize_t rxd_ep_atomic_compwrite(struct fid_ep *ep, const void *buf,
+				       size_t count, void *desc,
+				       const void *compare, void *compare_desc,
+				       void *result, void *result_desc,
+				       fi_addr_t dest_addr, uint64_t addr,
+				       uint64_t key, enum fi_datatype datatype,
+				       enum fi_op op, void *context)
+{
+	struct fi_ioc iov, comparev, resultv;
+
+	iov.addr = (void *) buf;
+	iov.count = count;
+	comparev.addr = (void *) compare;
+	comparev.count = count;
+	resultv.addr = result;
+	resultv.count = count;
+
+	return rxd_ep_atomic_compwritev(ep, &iov, &desc, 1,
+					&comparev, &compare_desc, 1,
+					&resultv, &result_desc, 1,
+					dest_addr, addr, key,
+					datatype, op, context);
+}
+
+int rxd_query_atomic(struct fid_domain *domain, enum fi_datatype datatype,
+		     enum fi_op op, struct fi_atomic_attr *attr,
+		     uint64_t flags)
+{
+	struct rxd_domain *rxd_domain;
+	size_t max_data;
+	int ret;
+
+	ret = ofi_atomic_valid(&rxd_prov, datatype, op, flags);
+	if (ret)
+		return ret;
+
+	attr->size = ofi_datatype_size(datatype);
+	if (attr->size == 0)
+		return -FI_EINVAL;
+
+	rxd_domain = container_of(domain, struct rxd_domain,
+				  util_domain.domain_fid);
+	max_data = rxd_atomic_max_data(rxd_domain, 1);
+	if (flags & FI_COMPARE_ATOMIC)
+		max_data /= 2;
+	attr->count = max_data / attr->size;
+	return 0;
+}
+
+static int rxd_ep_atomic_valid_common(struct fid_ep *ep,
+				      enum fi_datatype datatype,
+				      enum fi_op op, size_t *count,
+				      uint64_t flags)
+{
+	struct rxd_ep *rxd_ep;
+	struct fi_atomic_attr attr;
+	int ret;
+
+	rxd_ep = container_of(ep, struct rxd_ep, util_ep.ep_fid);
+	ret = rxd_query_atomic(&rxd_ep->util_ep.domain->domain_fid, datatype,
+			       op, &attr, flags);
+	if (!ret)
+		*count = attr.count;
+	return ret;
+}
+
+static int rxd_ep_atomic_valid(struct fid_ep *ep, enum fi_datatype datatype,
+			       enum fi_op op, size_t *count)
+{
+	return rxd_ep_atomic_valid_common(ep, datatype, op, count, 0);
+}
+
+static int rxd_ep_atomic_fetch_valid(struct fid_ep *ep,
+				     enum fi_datatype datatype, enum fi_op op,
+				     size_t *count)
+{
+	return rxd_ep_atomic_valid_common(ep, datatype, op, count,
+					  FI_FETCH_ATOMIC);
+}
+
+static int rxd_ep_atomic_cswap_valid(struct fid_ep *ep,
+				     enum fi_datatype datatype, enum fi_op op,
+				     size_t *count)
+{
+	return rxd_ep_atomic_valid_common(ep, datatype, op, count,
+					  FI_COMPARE_ATOMIC);
+}
+
+struct fi_ops_atomic rxd_ops_atomic = {
+	.size = sizeof(struct fi_ops_atomic),
+	.write = rxd_ep_atomic_write,
+	.writev = rxd_ep_atomic_writev,
+	.writemsg = rxd_ep_atomic_writemsg,
+	.inject = rxd_ep_atomic_inject,
+	.readwrite = rxd_ep_atomic_readwrite,
+	.readwritev = rxd_ep_atomic_readwritev,
+	.readwritemsg = rxd_ep_atomic_readwritemsg,
+	.compwrite = rxd_ep_atomic_compwrite,
+	.compwritev = rxd_ep_atomic_compwritev,
+	.compwritemsg = rxd_ep_atomic_compwritemsg,
+	.writevalid = rxd_ep_atomic_valid,
+	.readwritevalid = rxd_ep_atomic_fetch_valid,
+	.compwritevalid = rxd_ep_atomic_cswap_valid,
+};
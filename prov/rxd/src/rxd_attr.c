@@ -32,8 +32,9 @@
 
 #include "rxd.h"
 
-#define RXD_EP_CAPS (FI_MSG | FI_TAGGED | FI_DIRECTED_RECV |	\
-		     FI_RECV | FI_SEND | FI_SOURCE)
+#define RXD_EP_CAPS (FI_MSG | FI_TAGGED | FI_RMA | FI_ATOMIC |	\
+		     FI_DIRECTED_RECV | FI_RECV | FI_SEND | FI_READ |	\
+		     FI_WRITE | FI_REMOTE_READ | FI_REMOTE_WRITE | FI_SOURCE)
 
 struct fi_tx_attr rxd_tx_attr = {
 	.caps = RXD_EP_CAPS,
@@ -41,7 +42,7 @@ struct fi_tx_attr rxd_tx_attr = {
 	.inject_size = 0,
 	.size = (1ULL << RXD_MAX_TX_BITS),
 	.iov_limit = RXD_IOV_LIMIT,
-	.rma_iov_limit = 0,
+	.rma_iov_limit = RXD_IOV_LIMIT,
 };
 
 struct fi_rx_attr rxd_rx_attr = {
@@ -72,8 +73,8 @@ struct fi_domain_attr rxd_domain_attr = {
 	.ep_cnt = 128,
 	.tx_ctx_cnt = 1,
 	.rx_ctx_cnt = 1,
-	.max_ep_tx_ctx = 1,
-	.max_ep_rx_ctx = 1,
+	.max_ep_tx_ctx = 64,
+	.max_ep_rx_ctx = 64,
 	.mr_iov_limit = 1,
 };
 
@@ -85,10 +85,48 @@ close:
 	return ret;
 }
 
+/*
+ * Rx context i of a scalable peer listens on the port of its AV entry
+ * plus i.  The dg address of each context is inserted on first use.
+ */
+static fi_addr_t rxd_av_ctx_dg_addr(struct rxd_av *av, fi_addr_t fi_addr)
+{
+	struct sockaddr_storage addr;
+	fi_addr_t *ctx_dg_addr, dg_fiaddr;
+	uint64_t *dg_idx;
+	size_t len;
+
+	ctx_dg_addr = &av->ctx_dg_addr[ofi_av_ctx_index(&av->util_av, fi_addr)];
+	if (*ctx_dg_addr != FI_ADDR_NOTAVAIL)
+		return *ctx_dg_addr;
+
+	dg_idx = ofi_av_get_addr(&av->util_av,
+				 (int) ofi_av_addr_index(&av->util_av, fi_addr));
+	len = sizeof addr;
+	if (fi_av_lookup(av->dg_av, *dg_idx, &addr, &len) ||
+	    (addr.ss_family != AF_INET && addr.ss_family != AF_INET6)) {
+		FI_WARN(&rxd_prov, FI_LOG_AV,
+			"rx contexts require IP addressing\n");
+		return FI_ADDR_NOTAVAIL;
+	}
+
+	ofi_addr_set_port((struct sockaddr *) &addr,
+			  ofi_addr_get_port((struct sockaddr *) &addr) +
+			  ofi_av_rx_index(&av->util_av, fi_addr));
+	if (rxd_av_insert_dg_addr(av, 0, &addr, &dg_fiaddr))
+		return FI_ADDR_NOTAVAIL;
+
+	*ctx_dg_addr = dg_fiaddr;
+	return dg_fiaddr;
+}
+
 fi_addr_t rxd_av_dg_addr(struct rxd_av *av, fi_addr_t fi_addr)
 {
 	uint64_t *dg_idx;
 
+	if (ofi_av_rx_index(&av->util_av, fi_addr))
+		return rxd_av_ctx_dg_addr(av, fi_addr);
+
 	dg_idx = ofi_av_get_addr(&av->util_av, (int) fi_addr);
 	return *dg_idx;
 }
@@ -112,7 +150,8 @@ int rxd_av_dg_reverse_lookup(struct rxd_av *av, uint64_t start_idx,
 		len = sizeof curr_addr;
 		ret = fi_av_lookup(av->dg_av, (i + start_idx) % av->dg_av_used,
 				   curr_addr, &len);
-		if (!ret) {
+		if (!ret && len == av->dg_addrlen &&
+		    !memcmp(curr_addr, addr, len)) {
 			*dg_fiaddr = (i + start_idx) % av->dg_av_used;
 			FI_DBG(&rxd_prov, FI_LOG_AV, "found: %" PRIu64 "\n",
 				*dg_fiaddr);
@@ -233,18 +272,34 @@ static int rxd_av_remove(struct fid_av *av_fid, fi_addr_t *fi_addr, size_t count
 			uint64_t flags)
 {
 	int ret = 0;
-	size_t i;
+	size_t i, j, index;
 	fi_addr_t dg_fiaddr;
 	struct rxd_av *av;
 
 	av = container_of(av_fid, struct rxd_av, util_av.av_fid);
 	fastlock_acquire(&av->util_av.lock);
 	for (i = 0; i < count; i++) {
-		dg_fiaddr = rxd_av_dg_addr(av, fi_addr[i]);
+		index = ofi_av_addr_index(&av->util_av, fi_addr[i]);
+		dg_fiaddr = rxd_av_dg_addr(av, index);
 		ret = fi_av_remove(av->dg_av, &dg_fiaddr, 1, flags);
 		if (ret)
 			break;
 		av->dg_av_used--;
+
+		if (!av->ctx_dg_addr)
+			continue;
+
+		/* Also drop the dg addresses of the peer's rx contexts */
+		index <<= av->util_av.rx_ctx_bits;
+		for (j = 0; j < (1 << av->util_av.rx_ctx_bits); j++) {
+			dg_fiaddr = av->ctx_dg_addr[index + j];
+			if (dg_fiaddr == FI_ADDR_NOTAVAIL)
+				continue;
+
+			av->ctx_dg_addr[index + j] = FI_ADDR_NOTAVAIL;
+			if (!fi_av_remove(av->dg_av, &dg_fiaddr, 1, flags))
+				av->dg_av_used--;
+		}
 	}
 	fastlock_release(&av->util_av.lock);
 	return ret;
@@ -293,6 +348,7 @@ static int rxd_av_close(struct fid *fid)
 	if (ret)
 		return ret;
 
+	free(av->ctx_dg_addr);
 	free(av);
 	return 0;
 }
@@ -318,6 +374,7 @@ int rxd_av_create(struct fid_domain *domain_fid, struct fi_av_attr *attr,
 	struct rxd_domain *domain;
 	struct util_av_attr util_attr;
 	struct fi_av_attr av_attr;
+	size_t i, count;
 
 	if (!attr)
 		return -FI_EINVAL;
@@ -341,19 +398,33 @@ int rxd_av_create(struct fid_domain *domain_fid, struct fi_av_attr *attr,
 	if (ret)
 		goto err1;
 
+	if (av->util_av.rx_ctx_bits) {
+		count = av->util_av.count << av->util_av.rx_ctx_bits;
+		av->ctx_dg_addr = malloc(count * sizeof(*av->ctx_dg_addr));
+		if (!av->ctx_dg_addr) {
+			ret = -FI_ENOMEM;
+			goto err2;
+		}
+		for (i = 0; i < count; i++)
+			av->ctx_dg_addr[i] = FI_ADDR_NOTAVAIL;
+	}
+
 	av_attr = *attr;
 	av_attr.type = FI_AV_TABLE;
-	av_attr.count = 0;
+	av_attr.count = rxd_av_dg_count(av);
+	av_attr.rx_ctx_bits = 0;
 	av_attr.flags = 0;
 	ret = fi_av_open(domain->dg_domain, &av_attr, &av->dg_av, context);
 	if (ret)
-		goto err2;
+		goto err3;
 
 	av->util_av.av_fid.fid.ops = &rxd_av_fi_ops;
 	av->util_av.av_fid.ops = &rxd_av_ops;
 	*av_fid = &av->util_av.av_fid;
 	return 0;
 
+err3:
+	free(av->ctx_dg_addr);
 err2:
 	ofi_av_close(&av->util_av);
 err1:
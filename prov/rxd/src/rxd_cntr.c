@@ -68,10 +68,12 @@ void rxd_cntr_report_tx_comp(struct rxd_ep *ep, struct rxd_tx_entry *tx_entry)
 		cntr = ep->util_ep.tx_cntr;
 		break;
 	case RXD_TX_WRITE:
+	case RXD_TX_ATOMIC:
 		cntr = ep->util_ep.wr_cntr;
 		break;
 	case RXD_TX_READ_REQ:
-		cntr = ep->util_ep.rem_rd_cntr;
+	case RXD_TX_ATOMIC_FETCH:
+		cntr = ep->util_ep.rd_cntr;
 		break;
 	case RXD_TX_READ_RSP:
 		return;
@@ -81,14 +83,15 @@ void rxd_cntr_report_tx_comp(struct rxd_ep *ep, struct rxd_tx_entry *tx_entry)
 	}
 
 	if (cntr)
-		cntr->cntr_fid.ops->add(&cntr->cntr_fid, 1);
+		ofi_cntr_inc(cntr);
 }
 
 void rxd_cntr_report_error(struct rxd_ep *ep, struct fi_cq_err_entry *err)
 {
         struct util_cntr *cntr;
 
-	cntr = RXD_FLAG(err->flags, (FI_WRITE)) ? ep->util_ep.wr_cntr :
+	cntr = RXD_FLAG(err->flags, (FI_ATOMIC | FI_READ)) ? ep->util_ep.rd_cntr :
+	       RXD_FLAG(err->flags, (FI_WRITE)) ? ep->util_ep.wr_cntr :
 	       RXD_FLAG(err->flags, (FI_ATOMIC)) ? ep->util_ep.wr_cntr :
 	       RXD_FLAG(err->flags, (FI_READ)) ? ep->util_ep.rd_cntr :
 	       RXD_FLAG(err->flags, (FI_SEND)) ? ep->util_ep.tx_cntr :
@@ -96,7 +99,7 @@ void rxd_cntr_report_error(struct rxd_ep *ep, struct fi_cq_err_entry *err)
 	       NULL;
 
 	if (cntr)
-		cntr->cntr_fid.ops->adderr(&cntr->cntr_fid, 1);
+		ofi_cntr_inc_err(cntr);
 }
 
 
@@ -52,7 +52,7 @@ static const char *rxd_cq_strerror(struct fid_cq *cq_fid, int prov_errno,
 
 	cq = container_of(cq_fid, struct rxd_cq, util_cq.cq_fid);
 
-	fastlock_acquire(&cq->util_cq.ep_list_lock);
+	ofi_lock_acquire(&cq->util_cq.ep_list_lock);
 	assert(!dlist_empty(&cq->util_cq.ep_list));
 	fid_entry = container_of(cq->util_cq.ep_list.next,
 				struct fid_list_entry, entry);
@@ -60,7 +60,7 @@ static const char *rxd_cq_strerror(struct fid_cq *cq_fid, int prov_errno,
 	ep = container_of(util_ep, struct rxd_ep, util_ep);
 
 	str = fi_cq_strerror(ep->dg_cq, prov_errno, err_data, buf, len);
-	fastlock_release(&cq->util_cq.ep_list_lock);
+	ofi_lock_release(&cq->util_cq.ep_list_lock);
 	return str;
 }
 
@@ -74,6 +74,7 @@ static int rxd_cq_write_ctx(struct rxd_cq *cq,
 	comp = ofi_cirque_tail(cq->util_cq.cirq);
 	comp->op_context = cq_entry->op_context;
 	ofi_cirque_commit(cq->util_cq.cirq);
+	ofi_poll_notify(&cq->util_cq.poll_notify);
 	return 0;
 }
 
@@ -97,6 +98,7 @@ static int rxd_cq_write_msg(struct rxd_cq *cq,
 	comp->flags = cq_entry->flags;
 	comp->len = cq_entry->len;
 	ofi_cirque_commit(cq->util_cq.cirq);
+	ofi_poll_notify(&cq->util_cq.poll_notify);
 	return 0;
 }
 
@@ -122,6 +124,7 @@ static int rxd_cq_write_data(struct rxd_cq *cq,
 	comp->buf = cq_entry->buf;
 	comp->data = cq_entry->data;
 	ofi_cirque_commit(cq->util_cq.cirq);
+	ofi_poll_notify(&cq->util_cq.poll_notify);
 	return 0;
 }
 
@@ -140,12 +143,13 @@ static int rxd_cq_write_tagged(struct rxd_cq *cq,
 	if (ofi_cirque_isfull(cq->util_cq.cirq))
 		return -FI_ENOSPC;
 
-	FI_DBG(&rxd_prov, FI_LOG_EP_CTRL,
-	       "report completion: %" PRIx64 "\n", cq_entry->tag);
+	OFI_TRACE_DBG(&rxd_prov, FI_LOG_EP_CTRL,
+		      "report completion: %" PRIx64 "\n", cq_entry->tag);
 
 	comp = ofi_cirque_tail(cq->util_cq.cirq);
 	*comp = *cq_entry;
 	ofi_cirque_commit(cq->util_cq.cirq);
+	ofi_poll_notify(&cq->util_cq.poll_notify);
 	return 0;
 }
 
@@ -186,11 +190,21 @@ static void rxd_handle_dup_datastart(struct rxd_ep *ep, struct ofi_ctrl_hdr *ctr
 	struct dlist_entry *item;
 	struct rxd_rx_entry *rx_entry;
 	struct rxd_peer *peer;
+	struct rxd_nack *nack;
 
 	peer = rxd_ep_getpeer_info(ep, ctrl->conn_id);
 	item = dlist_find_first_match(&ep->rx_entry_list,
 				      rxd_rx_entry_match, ctrl);
 	if (!item) {
+	      /* a rejected request whose nack was lost is rejected again */
+	      nack = rxd_peer_nack(peer, ctrl->msg_id);
+	      if (nack->msg_id == ctrl->msg_id) {
+		      rxd_ep_reply_ack(ep, ctrl, ofi_ctrl_nack, nack->err,
+				       UINT64_MAX, peer->conn_data,
+				       ctrl->conn_id);
+		      return;
+	      }
+
 	      /* for small (1-packet) messages we may have situation
 	       * when receiver completed operation and destroyed
 	       * rx_entry, but ack is lost (not delivered to sender).
@@ -237,6 +251,11 @@ static void rxd_handle_conn_req(struct rxd_ep *ep, struct ofi_ctrl_hdr *ctrl,
 		goto repost;
 	}
 
+	if (dg_fiaddr >= ep->max_peers) {
+		FI_WARN(&rxd_prov, FI_LOG_EP_DATA, "too many peers\n");
+		goto repost;
+	}
+
 	peer_info = rxd_ep_getpeer_info(ep, dg_fiaddr);
 	if (peer_info->state != CMAP_CONNECTED) {
 		peer_info->state = CMAP_CONNECTED;
@@ -260,43 +279,89 @@ int rxd_tx_pkt_match(struct dlist_entry *item, const void *arg)
 	return (ack_ctrl->seg_no == pkt_ctrl->seg_no) ? 1 : 0;
 }
 
-static void rxd_handle_ack(struct rxd_ep *ep, struct ofi_ctrl_hdr *ctrl,
-			   struct rxd_rx_buf *rx_buf)
+void rxd_ep_handle_ack(struct rxd_ep *ep, const struct ofi_ctrl_ack *ack)
 {
 	struct rxd_tx_entry *tx_entry;
 	uint64_t idx;
 
-	FI_DBG(&rxd_prov, FI_LOG_EP_CTRL,
-	       "ack- msg_id: %" PRIu64 ", segno: %d, segsz: %d, buf: %p\n",
-	       ctrl->msg_id, ctrl->seg_no, ctrl->seg_size, rx_buf);
+	OFI_TRACE_DBG(&rxd_prov, FI_LOG_EP_CTRL,
+		      "ack- msg_id: %" PRIu64 ", segno: %d, segsz: %d\n",
+		      ack->msg_id, ack->seg_no, ack->seg_size);
 
-	idx = ctrl->msg_id & RXD_TX_IDX_BITS;
+	idx = ack->msg_id & RXD_TX_IDX_BITS;
 	tx_entry = &ep->tx_entry_fs->buf[idx];
-	if (tx_entry->msg_id != ctrl->msg_id)
-		goto out;
+	if (tx_entry->msg_id != ack->msg_id)
+		return;
 
-	rxd_ep_free_acked_pkts(ep, tx_entry, ctrl->seg_no);
-	if ((tx_entry->bytes_sent == tx_entry->op_hdr.size) &&
+	rxd_ep_free_acked_pkts(ep, tx_entry, ack->seg_no);
+	if ((tx_entry->bytes_sent == rxd_tx_entry_data_size(tx_entry)) &&
 	    dlist_empty(&tx_entry->pkt_list)) {
-		FI_DBG(&rxd_prov, FI_LOG_EP_CTRL,
-			"reporting TX completion : %p\n", tx_entry);
-		if (tx_entry->op_type != RXD_TX_READ_REQ) {
+		OFI_TRACE_DBG(&rxd_prov, FI_LOG_EP_CTRL,
+			       "reporting TX completion : %p\n", tx_entry);
+		/* reads and fetching atomics complete with their response */
+		if (tx_entry->op_type != RXD_TX_READ_REQ &&
+		    tx_entry->op_type != RXD_TX_ATOMIC_FETCH) {
 			rxd_cq_report_tx_comp(rxd_ep_tx_cq(ep), tx_entry);
 			rxd_cntr_report_tx_comp(ep, tx_entry);
 			rxd_tx_entry_free(ep, tx_entry);
 		}
 	} else {
-		tx_entry->rx_key = ctrl->rx_key;
+		tx_entry->rx_key = ack->rx_key;
 		/* do not allow reduce window size (on duplicate acks) */
-		tx_entry->window = MAX(tx_entry->window, ctrl->seg_no + ctrl->seg_size);
-		FI_DBG(&rxd_prov, FI_LOG_EP_CTRL,
-		       "ack- msg_id: %" PRIu64 ", window: %d\n",
-		       ctrl->msg_id, tx_entry->window);
+		tx_entry->window = MAX(tx_entry->window, ack->seg_no + ack->seg_size);
+		tx_entry->retry_cnt = 0;
+		rxd_set_timeout(tx_entry);
+		OFI_TRACE_DBG(&rxd_prov, FI_LOG_EP_CTRL,
+			      "ack- msg_id: %" PRIu64 ", window: %d\n",
+			      ack->msg_id, tx_entry->window);
 	}
-out:
+}
+
+static void rxd_handle_ack(struct rxd_ep *ep, struct ofi_ctrl_hdr *ctrl,
+			   struct rxd_rx_buf *rx_buf)
+{
+	struct ofi_ctrl_ack ack = {
+		.msg_id = ctrl->msg_id,
+		.rx_key = ctrl->rx_key,
+		.seg_no = ctrl->seg_no,
+		.seg_size = ctrl->seg_size,
+	};
+
+	rxd_ep_handle_ack(ep, &ack);
 	rxd_ep_repost_buff(rx_buf);
 }
 
+/*
+ * Acks for other messages may follow the payload of start, data and ack
+ * packets.  They are processed before the packet itself, which may hand
+ * its buffer back to the DGRAM endpoint.
+ */
+static void rxd_handle_appended_acks(struct rxd_ep *ep,
+				     struct ofi_ctrl_hdr *ctrl, size_t len)
+{
+	struct ofi_ctrl_ack ack;
+	size_t offset;
+
+	switch (ctrl->type) {
+	case ofi_ctrl_start_data:
+		offset = sizeof(struct rxd_pkt_data_start) + ctrl->seg_size;
+		break;
+	case ofi_ctrl_data:
+		offset = sizeof(struct rxd_pkt_data) + ctrl->seg_size;
+		break;
+	case ofi_ctrl_ack:
+		offset = sizeof(struct rxd_pkt_data);
+		break;
+	default:
+		return;
+	}
+
+	for (; offset + sizeof(ack) <= len; offset += sizeof(ack)) {
+		memcpy(&ack, (char *) ctrl + offset, sizeof(ack));
+		rxd_ep_handle_ack(ep, &ack);
+	}
+}
+
 /*
  * Discarded transfers were discarded by the receiving side, so we abort
  * transferring the rest of the data.  However, the completion is still
@@ -311,9 +376,9 @@ static void rxd_handle_discard(struct rxd_ep *ep, struct ofi_ctrl_hdr *ctrl,
 	struct rxd_tx_entry *tx_entry;
 	uint64_t idx;
 
-	FI_DBG(&rxd_prov, FI_LOG_EP_CTRL,
-	       "discard- msg_id: %" PRIu64 ", segno: %d\n",
-	       ctrl->msg_id, ctrl->seg_no);
+	OFI_TRACE_DBG(&rxd_prov, FI_LOG_EP_CTRL,
+		      "discard- msg_id: %" PRIu64 ", segno: %d\n",
+		      ctrl->msg_id, ctrl->seg_no);
 
 	idx = ctrl->msg_id & RXD_TX_IDX_BITS;
 	tx_entry = &ep->tx_entry_fs->buf[idx];
@@ -326,6 +391,31 @@ static void rxd_handle_discard(struct rxd_ep *ep, struct ofi_ctrl_hdr *ctrl,
 	rxd_ep_repost_buff(rx_buf);
 }
 
+/*
+ * A nack is returned when the target rejected an RMA or atomic request,
+ * typically because of an invalid key or missing access permissions.  The
+ * error code is carried in the seg_size field.
+ */
+static void rxd_handle_nack(struct rxd_ep *ep, struct ofi_ctrl_hdr *ctrl,
+			    struct rxd_rx_buf *rx_buf)
+{
+	struct rxd_tx_entry *tx_entry;
+	uint64_t idx;
+
+	FI_WARN(&rxd_prov, FI_LOG_EP_CTRL,
+		"nack- msg_id: %" PRIu64 ", err: %d\n",
+		ctrl->msg_id, ctrl->seg_size);
+
+	idx = ctrl->msg_id & RXD_TX_IDX_BITS;
+	tx_entry = &ep->tx_entry_fs->buf[idx];
+	if (tx_entry->msg_id == ctrl->msg_id) {
+		rxd_tx_entry_report_error(ep, tx_entry, ctrl->seg_size);
+		rxd_tx_entry_done(ep, tx_entry);
+	}
+
+	rxd_ep_repost_buff(rx_buf);
+}
+
 void rxd_tx_pkt_free(struct rxd_pkt_meta *pkt_meta)
 {
 	util_buf_release(pkt_meta->ep->tx_pkt_pool, pkt_meta);
@@ -426,9 +516,9 @@ static void rxd_progress_wait_rx(struct rxd_ep *ep,
 	ctrl.seg_no = rx_entry->exp_seg_no - 1;
 	ctrl.conn_id = rx_entry->peer;
 
-	FI_DBG(&rxd_prov, FI_LOG_EP_CTRL,
-	       "rx-entry wait over [%" PRIx64 "], credits: %d\n",
-	       rx_entry->msg_id, rx_entry->credits);
+	OFI_TRACE_DBG(&rxd_prov, FI_LOG_EP_CTRL,
+		      "rx-entry wait over [%" PRIx64 "], credits: %d\n",
+		      rx_entry->msg_id, rx_entry->credits);
 	rxd_ep_reply_ack(ep, &ctrl, ofi_ctrl_ack, rx_entry->credits,
 		       rx_entry->key, rx_entry->peer_info->conn_data,
 		       ctrl.conn_id);
@@ -479,7 +569,7 @@ struct rxd_recv_entry *rxd_get_recv_entry(struct rxd_ep *ep,
 	match = dlist_find_first_match(&ep->recv_list, &rxd_match_recv_entry,
 				       (void *) rx_entry);
 	if (!match) {
-		FI_DBG(&rxd_prov, FI_LOG_EP_CTRL, "no matching recv entry\n");
+		OFI_TRACE_DBG(&rxd_prov, FI_LOG_EP_CTRL, "no matching recv entry\n");
 		return NULL;
 	}
 
@@ -511,14 +601,14 @@ struct rxd_trecv_entry *rxd_get_trecv_entry(struct rxd_ep *ep,
 	match = dlist_find_first_match(&ep->trecv_list, &rxd_match_trecv_entry,
 				       (void *)rx_entry);
 	if (!match) {
-		FI_DBG(&rxd_prov, FI_LOG_EP_CTRL,
-		       "no matching trecv entry, tag: %" PRIx64 "\n",
-		       rx_entry->op_hdr.tag);
+		OFI_TRACE_DBG(&rxd_prov, FI_LOG_EP_CTRL,
+			      "no matching trecv entry, tag: %" PRIx64 "\n",
+			      rx_entry->op_hdr.tag);
 		return NULL;
 	}
 
-	FI_DBG(&rxd_prov, FI_LOG_EP_CTRL, "matched - tag: %" PRIx64 "\n",
-	       rx_entry->op_hdr.tag);
+	OFI_TRACE_DBG(&rxd_prov, FI_LOG_EP_CTRL, "matched - tag: %" PRIx64 "\n",
+		      rx_entry->op_hdr.tag);
 
 	dlist_remove(match);
 	trecv_entry = container_of(match, struct rxd_trecv_entry, entry);
@@ -542,49 +632,87 @@ void rxd_cq_report_error(struct rxd_cq *cq, struct fi_cq_err_entry *err_entry)
 	cq->write_fn(cq, &cq_entry);
 }
 
-void rxd_cq_report_tx_comp(struct rxd_cq *cq, struct rxd_tx_entry *tx_entry)
+static int rxd_tx_entry_comp(struct rxd_tx_entry *tx_entry,
+			     struct fi_cq_tagged_entry *cq_entry)
 {
-	struct fi_cq_tagged_entry cq_entry = {0};
-
-	/* todo: handle FI_COMPLETION */
 	switch(tx_entry->op_type) {
 	case RXD_TX_MSG:
-		cq_entry.flags = (FI_TRANSMIT | FI_MSG);
-		cq_entry.op_context = tx_entry->msg.msg.context;
-		cq_entry.len = tx_entry->op_hdr.size;
-		cq_entry.buf = tx_entry->msg.msg_iov[0].iov_base;
-		cq_entry.data = tx_entry->op_hdr.data;
+		cq_entry->flags = (FI_TRANSMIT | FI_MSG);
+		cq_entry->op_context = tx_entry->msg.msg.context;
+		cq_entry->len = tx_entry->op_hdr.size;
+		cq_entry->buf = tx_entry->msg.msg_iov[0].iov_base;
+		cq_entry->data = tx_entry->op_hdr.data;
 		break;
 	case RXD_TX_TAG:
-		cq_entry.flags = (FI_TRANSMIT | FI_TAGGED);
-		cq_entry.op_context = tx_entry->tmsg.tmsg.context;
-		cq_entry.len = tx_entry->op_hdr.size;
-		cq_entry.buf = tx_entry->tmsg.msg_iov[0].iov_base;
-		cq_entry.data = tx_entry->op_hdr.data;
-		cq_entry.tag = tx_entry->tmsg.tmsg.tag;
+		cq_entry->flags = (FI_TRANSMIT | FI_TAGGED);
+		cq_entry->op_context = tx_entry->tmsg.tmsg.context;
+		cq_entry->len = tx_entry->op_hdr.size;
+		cq_entry->buf = tx_entry->tmsg.msg_iov[0].iov_base;
+		cq_entry->data = tx_entry->op_hdr.data;
+		cq_entry->tag = tx_entry->tmsg.tmsg.tag;
 		break;
 	case RXD_TX_WRITE:
-		cq_entry.flags = (FI_TRANSMIT | FI_RMA | FI_WRITE);
-		cq_entry.op_context = tx_entry->write.msg.context;
-		cq_entry.len = tx_entry->op_hdr.size;
-		cq_entry.buf = tx_entry->write.msg.msg_iov[0].iov_base;
-		cq_entry.data = tx_entry->op_hdr.data;
+		cq_entry->flags = (FI_TRANSMIT | FI_RMA | FI_WRITE);
+		cq_entry->op_context = tx_entry->write.msg.context;
+		cq_entry->len = tx_entry->op_hdr.size;
+		cq_entry->buf = tx_entry->write.msg.msg_iov[0].iov_base;
+		cq_entry->data = tx_entry->op_hdr.data;
 		break;
 	case RXD_TX_READ_REQ:
-		cq_entry.flags = (FI_TRANSMIT | FI_RMA | FI_READ);
-		cq_entry.op_context = tx_entry->read_req.msg.context;
-		cq_entry.len = tx_entry->op_hdr.size;
-		cq_entry.buf = tx_entry->read_req.msg.msg_iov[0].iov_base;
-		cq_entry.data = tx_entry->op_hdr.data;
+		cq_entry->flags = (FI_TRANSMIT | FI_RMA | FI_READ);
+		cq_entry->op_context = tx_entry->read_req.msg.context;
+		cq_entry->len = tx_entry->op_hdr.size;
+		cq_entry->buf = tx_entry->read_req.msg.msg_iov[0].iov_base;
+		cq_entry->data = tx_entry->op_hdr.data;
+		break;
+	case RXD_TX_ATOMIC:
+		cq_entry->flags = (FI_TRANSMIT | FI_ATOMIC | FI_WRITE);
+		cq_entry->op_context = tx_entry->atomic.msg.context;
+		cq_entry->data = tx_entry->op_hdr.data;
+		break;
+	case RXD_TX_ATOMIC_FETCH:
+		cq_entry->flags = (FI_TRANSMIT | FI_ATOMIC | FI_READ);
+		cq_entry->op_context = tx_entry->atomic.msg.context;
+		cq_entry->data = tx_entry->op_hdr.data;
 		break;
 	case RXD_TX_READ_RSP:
-		return;
+		return -FI_ENOENT;
 	default:
 		FI_WARN(&rxd_prov, FI_LOG_EP_CTRL, "invalid op type\n");
-		return;
+		return -FI_EINVAL;
 	}
+	return 0;
+}
 
-	cq->write_fn(cq, &cq_entry);
+void rxd_cq_report_tx_comp(struct rxd_cq *cq, struct rxd_tx_entry *tx_entry)
+{
+	struct fi_cq_tagged_entry cq_entry = {0};
+
+	if (!cq || !(tx_entry->flags & FI_COMPLETION))
+		return;
+
+	if (!rxd_tx_entry_comp(tx_entry, &cq_entry))
+		cq->write_fn(cq, &cq_entry);
+}
+
+void rxd_tx_entry_report_error(struct rxd_ep *ep, struct rxd_tx_entry *tx_entry,
+			       int err)
+{
+	struct fi_cq_tagged_entry cq_entry = {0};
+	struct fi_cq_err_entry err_entry = {0};
+	struct rxd_cq *cq = rxd_ep_tx_cq(ep);
+
+	if (rxd_tx_entry_comp(tx_entry, &cq_entry))
+		return;
+
+	err_entry.op_context = cq_entry.op_context;
+	err_entry.flags = cq_entry.flags;
+	err_entry.err = err;
+	err_entry.prov_errno = -err;
+
+	rxd_cntr_report_error(ep, &err_entry);
+	if (cq)
+		rxd_cq_report_error(cq, &err_entry);
 }
 
 void rxd_ep_handle_data_msg(struct rxd_ep *ep, struct rxd_peer *peer,
@@ -614,35 +742,42 @@ void rxd_ep_handle_data_msg(struct rxd_ep *ep, struct rxd_peer *peer,
 	if (rx_entry->credits == 0) {
 		rxd_set_rx_credits(ep, rx_entry);
 
-		FI_DBG(&rxd_prov, FI_LOG_EP_CTRL, "replying ack [%" PRIx64 "] - %d\n",
-		       ctrl->msg_id, ctrl->seg_no);
+		OFI_TRACE_DBG(&rxd_prov, FI_LOG_EP_CTRL, "replying ack [%" PRIx64 "] - %d\n",
+			      ctrl->msg_id, ctrl->seg_no);
 
-		rxd_ep_reply_ack(ep, ctrl, ofi_ctrl_ack, rx_entry->credits,
-			       rx_entry->key, peer->conn_data, ctrl->conn_id);
+		/* the sender only waits on the final ack to complete */
+		if (rx_entry->op_hdr.size == rx_entry->done)
+			rxd_ep_queue_ack(ep, peer, ctrl->msg_id,
+					 rx_entry->exp_seg_no, rx_entry->key);
+		else
+			rxd_ep_reply_ack(ep, ctrl, ofi_ctrl_ack,
+					 rx_entry->credits, rx_entry->key,
+					 peer->conn_data, ctrl->conn_id);
 	}
 
 	if (rx_entry->op_hdr.size != rx_entry->done) {
 		if (rx_entry->credits == 0) {
 			dlist_init(&rx_entry->wait_entry);
 			dlist_insert_tail(&rx_entry->wait_entry, &ep->wait_rx_list);
-			FI_WARN(&rxd_prov, FI_LOG_EP_CTRL, "rx-entry %" PRIx64 " - %d enqueued\n",
-				ctrl->msg_id, ctrl->seg_no);
+			OFI_TRACE_WARN(&rxd_prov, FI_LOG_EP_CTRL, "rx-entry %" PRIx64 " - %d enqueued\n",
+				       ctrl->msg_id, ctrl->seg_no);
 		} else {
-			FI_DBG(&rxd_prov, FI_LOG_EP_CTRL,
-			       "rx_entry->op_hdr.size: %" PRIu64 ", rx_entry->done: %" PRId64 "\n",
-			       rx_entry->op_hdr.size,
-			       rx_entry->done);
+			OFI_TRACE_DBG(&rxd_prov, FI_LOG_EP_CTRL,
+				      "rx_entry->op_hdr.size: %" PRIu64 ", rx_entry->done: %" PRId64 "\n",
+				      rx_entry->op_hdr.size,
+				      rx_entry->done);
 		}
 		return;
 	}
 
-	/* todo: handle FI_COMPLETION for RX CQ comp */
 	switch(rx_entry->op_hdr.op) {
 	case ofi_op_msg:
 		freestack_push(ep->recv_fs, rx_entry->recv);
 		/* Handle cntr */
 		cntr = ep->util_ep.rx_cntr;
 		/* Handle CQ comp */
+		if (!rxd_rx_cq || !(rx_entry->recv->flags & FI_COMPLETION))
+			break;
 		cq_entry.flags |= FI_RECV;
 		cq_entry.op_context = rx_entry->recv->msg.context;
 		cq_entry.len = rx_entry->done;
@@ -655,6 +790,8 @@ void rxd_ep_handle_data_msg(struct rxd_ep *ep, struct rxd_peer *peer,
 		/* Handle cntr */
 		cntr = ep->util_ep.rx_cntr;
 		/* Handle CQ comp */
+		if (!rxd_rx_cq || !(rx_entry->trecv->flags & FI_COMPLETION))
+			break;
 		cq_entry.flags |= (FI_RECV | FI_TAGGED);
 		cq_entry.op_context = rx_entry->trecv->msg.context;
 		cq_entry.len = rx_entry->done;
@@ -663,20 +800,12 @@ void rxd_ep_handle_data_msg(struct rxd_ep *ep, struct rxd_peer *peer,
 		cq_entry.tag = rx_entry->trecv->msg.tag;\
 		rxd_rx_cq->write_fn(rxd_rx_cq, &cq_entry);
 		break;
-	case ofi_op_atomic:
-		/* Handle cntr */
-		cntr = ep->util_ep.rem_wr_cntr;
-		/* Handle CQ comp */
-		cq_entry.flags |= FI_ATOMIC;
-		rxd_rx_cq->write_fn(rxd_rx_cq, &cq_entry);
-		break;
 	case ofi_op_write:
 		/* Handle cntr */
 		cntr = ep->util_ep.rem_wr_cntr;
 		/* Handle CQ comp */
-		if (rx_entry->op_hdr.flags & OFI_REMOTE_CQ_DATA) {
+		if (rxd_rx_cq && (rx_entry->op_hdr.flags & OFI_REMOTE_CQ_DATA)) {
 			cq_entry.flags |= (FI_RMA | FI_REMOTE_WRITE);
-			cq_entry.op_context = rx_entry->trecv->msg.context;
 			cq_entry.len = rx_entry->done;
 			cq_entry.buf = rx_entry->write.iov[0].iov_base;
 			cq_entry.data = rx_entry->op_hdr.data;
@@ -695,7 +824,7 @@ void rxd_ep_handle_data_msg(struct rxd_ep *ep, struct rxd_peer *peer,
 	}
 
 	if (cntr)
-		cntr->cntr_fid.ops->add(&cntr->cntr_fid, 1);
+		ofi_cntr_inc(cntr);
 
 	rxd_rx_entry_free(ep, rx_entry);
 }
@@ -733,13 +862,14 @@ void rxd_ep_check_unexp_msg_list(struct rxd_ep *ep, struct rxd_recv_entry *recv_
 	struct rxd_rx_entry *rx_entry;
 	struct rxd_pkt_data_start *pkt_start;
 
-	FI_DBG(&rxd_prov, FI_LOG_EP_CTRL, "ep->num_unexp_msg: %d\n", ep->num_unexp_msg);
+	OFI_TRACE_DBG(&rxd_prov, FI_LOG_EP_CTRL, "ep->num_unexp_msg: %d\n", ep->num_unexp_msg);
 	match = dlist_remove_first_match(&ep->unexp_msg_list, &rxd_match_unexp_msg,
 					 (void *) recv_entry);
 	if (match) {
-		FI_DBG(&rxd_prov, FI_LOG_EP_CTRL, "progressing unexp msg entry\n");
+		OFI_TRACE_DBG(&rxd_prov, FI_LOG_EP_CTRL, "progressing unexp msg entry\n");
 		dlist_remove(&recv_entry->entry);
 		ep->num_unexp_msg--;
+		ofi_stats_dec(&ep->stats, RXD_STAT_UNEXP_DEPTH);
 
 		rx_entry = container_of(match, struct rxd_rx_entry, unexp_entry);
 		rx_entry->recv = recv_entry;
@@ -771,19 +901,20 @@ void rxd_ep_check_unexp_tag_list(struct rxd_ep *ep, struct rxd_trecv_entry *trec
 	struct rxd_rx_entry *rx_entry;
 	struct rxd_pkt_data_start *pkt_start;
 
-	FI_DBG(&rxd_prov, FI_LOG_EP_CTRL, "ep->num_unexp_msg: %d\n", ep->num_unexp_msg);
-	FI_DBG(&rxd_prov, FI_LOG_EP_CTRL, "ep->num_unexp_pkt: %d\n", ep->num_unexp_pkt);
+	OFI_TRACE_DBG(&rxd_prov, FI_LOG_EP_CTRL, "ep->num_unexp_msg: %d\n", ep->num_unexp_msg);
+	OFI_TRACE_DBG(&rxd_prov, FI_LOG_EP_CTRL, "ep->num_unexp_pkt: %d\n", ep->num_unexp_pkt);
 	match = dlist_find_first_match(&ep->unexp_tag_list, &rxd_match_unexp_tag,
 				       (void *) trecv_entry);
 	if (match) {
 		dlist_remove(match);
 		dlist_remove(&trecv_entry->entry);
 		ep->num_unexp_msg--;
+		ofi_stats_dec(&ep->stats, RXD_STAT_UNEXP_DEPTH);
 
 		rx_entry = container_of(match, struct rxd_rx_entry, unexp_entry);
 		rx_entry->trecv = trecv_entry;
-		FI_DBG(&rxd_prov, FI_LOG_EP_CTRL, "progressing unexp tagged recv [%" PRIx64 "]\n",
-		       rx_entry->msg_id);
+		OFI_TRACE_DBG(&rxd_prov, FI_LOG_EP_CTRL, "progressing unexp tagged recv [%" PRIx64 "]\n",
+			      rx_entry->msg_id);
 
 		pkt_start = (struct rxd_pkt_data_start *) rx_entry->unexp_buf->buf;
 		rxd_ep_handle_data_msg(ep, rx_entry->peer_info, rx_entry, rx_entry->trecv->iov,
@@ -793,6 +924,19 @@ void rxd_ep_check_unexp_tag_list(struct rxd_ep *ep, struct rxd_trecv_entry *trec
 	}
 }
 
+/* Read responses land in the read buffers, or the fetch atomic results */
+static void rxd_tx_entry_rsp_iov(struct rxd_tx_entry *tx_entry,
+				 struct iovec **iov, size_t *iov_count)
+{
+	if (tx_entry->op_type == RXD_TX_ATOMIC_FETCH) {
+		*iov = tx_entry->atomic.res_iov;
+		*iov_count = tx_entry->atomic.res_count;
+	} else {
+		*iov = tx_entry->read_req.dst_iov;
+		*iov_count = tx_entry->read_req.msg.iov_count;
+	}
+}
+
 static void rxd_handle_data(struct rxd_ep *ep, struct rxd_peer *peer,
 			    struct ofi_ctrl_hdr *ctrl, struct fi_cq_msg_entry *comp,
 			    struct rxd_rx_buf *rx_buf)
@@ -800,23 +944,25 @@ static void rxd_handle_data(struct rxd_ep *ep, struct rxd_peer *peer,
 	struct rxd_rx_entry *rx_entry;
 	struct rxd_tx_entry *tx_entry;
 	struct rxd_pkt_data *pkt_data = (struct rxd_pkt_data *) ctrl;
+	struct iovec *iov;
+	size_t iov_count;
 	uint16_t credits;
 	int ret;
 
-	FI_DBG(&rxd_prov, FI_LOG_EP_CTRL,
-	       "data pkt- msg_id: %" PRIu64 ", segno: %d, buf: %p\n",
-	       ctrl->msg_id, ctrl->seg_no, rx_buf);
+	OFI_TRACE_DBG(&rxd_prov, FI_LOG_EP_CTRL,
+		      "data pkt- msg_id: %" PRIu64 ", segno: %d, buf: %p\n",
+		      ctrl->msg_id, ctrl->seg_no, rx_buf);
 
 	rx_entry = &ep->rx_entry_fs->buf[ctrl->rx_key];
 
 	ret = rxd_check_data_pkt_order(ep, peer, ctrl, rx_entry);
 	if (ret) {
 		if (ret == -FI_EALREADY) {
-			FI_DBG(&rxd_prov, FI_LOG_EP_CTRL, "duplicate pkt: %d "
-			       "expected:%d, rx-key:%" PRId64 ", ctrl_msg_id: %" PRIx64 "\n",
-			       ctrl->seg_no, rx_entry->exp_seg_no,
-			       ctrl->rx_key,
-			       ctrl->msg_id);
+			OFI_TRACE_DBG(&rxd_prov, FI_LOG_EP_CTRL, "duplicate pkt: %d "
+				      "expected:%d, rx-key:%" PRId64 ", ctrl_msg_id: %" PRIx64 "\n",
+				      ctrl->seg_no, rx_entry->exp_seg_no,
+				      ctrl->rx_key,
+				      ctrl->msg_id);
 
 			credits = ((rx_entry->msg_id == ctrl->msg_id) &&
 				  (rx_entry->last_win_seg == ctrl->seg_no)) ?
@@ -826,15 +972,15 @@ static void rxd_handle_data(struct rxd_ep *ep, struct rxd_peer *peer,
 				       ctrl->conn_id);
 			goto repost;
 		} else {
-			FI_DBG(&rxd_prov, FI_LOG_EP_CTRL, "invalid pkt: segno: %d "
-			       "expected:%d, rx-key:%" PRId64 ", ctrl_msg_id: %ld, "
-			       "rx_entry_msg_id: %" PRIx64 "\n",
-			       ctrl->seg_no, rx_entry->exp_seg_no,
-			       ctrl->rx_key,
-			       ctrl->msg_id, rx_entry->msg_id);
-			FI_DBG(&rxd_prov, FI_LOG_EP_CTRL, "invalid pkt: "
-			       "credits: %d, last win: %d\n",
-			       rx_entry->credits, rx_entry->last_win_seg);
+			OFI_TRACE_DBG(&rxd_prov, FI_LOG_EP_CTRL, "invalid pkt: segno: %d "
+				      "expected:%d, rx-key:%" PRId64 ", ctrl_msg_id: %ld, "
+				      "rx_entry_msg_id: %" PRIx64 "\n",
+				      ctrl->seg_no, rx_entry->exp_seg_no,
+				      ctrl->rx_key,
+				      ctrl->msg_id, rx_entry->msg_id);
+			OFI_TRACE_DBG(&rxd_prov, FI_LOG_EP_CTRL, "invalid pkt: "
+				      "credits: %d, last win: %d\n",
+				      rx_entry->credits, rx_entry->last_win_seg);
 			credits = (rx_entry->msg_id == ctrl->msg_id) ?
 				  rx_entry->last_win_seg - rx_entry->exp_seg_no : 0;
 			rxd_ep_reply_ack(ep, ctrl, ofi_ctrl_ack, credits,
@@ -845,7 +991,7 @@ static void rxd_handle_data(struct rxd_ep *ep, struct rxd_peer *peer,
 	}
 
 	rx_entry->nack_stamp = 0;
-	FI_DBG(&rxd_prov, FI_LOG_EP_CTRL, "expected pkt: %d\n", ctrl->seg_no);
+	OFI_TRACE_DBG(&rxd_prov, FI_LOG_EP_CTRL, "expected pkt: %d\n", ctrl->seg_no);
 	switch (rx_entry->op_hdr.op) {
 	case ofi_op_msg:
 		rxd_ep_handle_data_msg(ep, peer, rx_entry, rx_entry->recv->iov,
@@ -864,8 +1010,8 @@ static void rxd_handle_data(struct rxd_ep *ep, struct rxd_peer *peer,
 		break;
 	case ofi_op_read_rsp:
 		tx_entry = rx_entry->read_rsp.tx_entry;
-		rxd_ep_handle_data_msg(ep, peer, rx_entry, tx_entry->read_req.dst_iov,
-				       tx_entry->read_req.msg.iov_count, ctrl,
+		rxd_tx_entry_rsp_iov(tx_entry, &iov, &iov_count);
+		rxd_ep_handle_data_msg(ep, peer, rx_entry, iov, iov_count, ctrl,
 				       pkt_data->data, rx_buf);
 		break;
 	case ofi_op_atomic:
@@ -877,14 +1023,126 @@ repost:
 	rxd_ep_repost_buff(rx_buf);
 }
 
+/*
+ * Read requests and atomics are fully described by their start packet.
+ * They are acked once they have been processed, or nacked right away with
+ * the error code, and their rx_entry is released.  The nack is remembered
+ * in case the request is retransmitted.
+ */
+static void rxd_ep_complete_req(struct rxd_ep *ep, struct rxd_peer *peer,
+				struct rxd_rx_entry *rx_entry,
+				struct ofi_ctrl_hdr *ctrl, int err)
+{
+	struct rxd_nack *nack;
+
+	ep->credits++;
+	rx_entry->exp_seg_no = 1;
+	if (err) {
+		nack = rxd_peer_nack(peer, ctrl->msg_id);
+		nack->msg_id = ctrl->msg_id;
+		nack->err = (uint16_t) -err;
+		rxd_ep_reply_ack(ep, ctrl, ofi_ctrl_nack, nack->err,
+				 rx_entry->key, peer->conn_data, ctrl->conn_id);
+	} else
+		rxd_ep_queue_ack(ep, peer, ctrl->msg_id, rx_entry->exp_seg_no,
+				 rx_entry->key);
+	rxd_rx_entry_free(ep, rx_entry);
+}
+
+static int rxd_ep_verify_rma_iov(struct rxd_ep *ep, struct ofi_rma_iov *rma_iov,
+				 size_t count, uint64_t access,
+				 struct iovec *iov)
+{
+	size_t i;
+	int ret;
+
+	if (count > RXD_IOV_LIMIT)
+		return -FI_EINVAL;
+
+	for (i = 0; i < count; i++) {
+		ret = rxd_mr_verify(rxd_ep_domain(ep), rma_iov[i].len,
+				    (uintptr_t *) &rma_iov[i].addr,
+				    rma_iov[i].key, access);
+		if (ret) {
+			FI_WARN(&rxd_prov, FI_LOG_EP_CTRL,
+				"invalid key/access permissions\n");
+			return -FI_EACCES;
+		}
+
+		iov[i].iov_base = (void *) (uintptr_t) rma_iov[i].addr;
+		iov[i].iov_len = rma_iov[i].len;
+	}
+	return 0;
+}
+
+/*
+ * Fetching atomics return the original target data through a read
+ * response.  The results are staged in a spare tx packet, which is
+ * allocated up front so that an applied atomic is never retried.
+ */
+static int rxd_ep_handle_atomic(struct rxd_ep *ep, struct rxd_peer *peer,
+				struct rxd_rx_entry *rx_entry,
+				struct ofi_ctrl_hdr *ctrl)
+{
+	struct rxd_pkt_data_start *pkt_start;
+	struct rxd_tx_entry *tx_entry = NULL;
+	struct rxd_pkt_meta *res_buf = NULL;
+	struct fi_cq_tagged_entry cq_entry = {0};
+	struct rxd_cq *rx_cq = rxd_ep_rx_cq(ep);
+	struct iovec result = {0};
+	int ret;
+
+	pkt_start = (struct rxd_pkt_data_start *) ctrl;
+	if (rx_entry->op_hdr.op != ofi_op_atomic) {
+		tx_entry = rxd_tx_entry_alloc(ep, peer, rx_entry->peer, 0,
+					      RXD_TX_READ_RSP);
+		if (!tx_entry)
+			return -FI_ENOMEM;
+
+		res_buf = util_buf_alloc(ep->tx_pkt_pool);
+		if (!res_buf) {
+			rxd_tx_entry_free(ep, tx_entry);
+			return -FI_ENOMEM;
+		}
+		result.iov_base = res_buf->pkt_data;
+	}
+
+	ret = rxd_atomic_handle_req(ep, rx_entry, pkt_start, &result);
+	if (!ret && tx_entry) {
+		tx_entry->read_rsp.iov_count = 1;
+		tx_entry->read_rsp.src_iov[0] = result;
+		tx_entry->read_rsp.peer_msg_id = ctrl->msg_id;
+		ret = rxd_ep_start_xfer(ep, peer, ofi_op_read_rsp, tx_entry);
+	}
+
+	if (res_buf)
+		util_buf_release(ep->tx_pkt_pool, res_buf);
+	if (ret && tx_entry)
+		rxd_tx_entry_free(ep, tx_entry);
+
+	if (!ret) {
+		if (ep->util_ep.rem_wr_cntr)
+			ofi_cntr_inc(ep->util_ep.rem_wr_cntr);
+		if (rx_cq && (rx_entry->op_hdr.flags & OFI_REMOTE_CQ_DATA)) {
+			cq_entry.flags = (FI_ATOMIC | FI_REMOTE_WRITE);
+			cq_entry.data = rx_entry->op_hdr.data;
+			rx_cq->write_fn(rx_cq, &cq_entry);
+		}
+	}
+
+	rxd_ep_complete_req(ep, peer, rx_entry, ctrl, ret);
+	return 0;
+}
+
 int rxd_process_start_data(struct rxd_ep *ep, struct rxd_rx_entry *rx_entry,
 			   struct rxd_peer *peer, struct ofi_ctrl_hdr *ctrl,
 			   struct fi_cq_msg_entry *comp,
 			   struct rxd_rx_buf *rx_buf)
 {
 	uint64_t idx;
-	int i, offset, ret;
-	struct ofi_rma_iov *rma_iov;
+	int offset, ret;
+	struct iovec *iov;
+	size_t iov_count;
 	struct rxd_pkt_data_start *pkt_start;
 	struct rxd_tx_entry *tx_entry;
 	pkt_start = (struct rxd_pkt_data_start *) ctrl;
@@ -897,9 +1155,12 @@ int rxd_process_start_data(struct rxd_ep *ep, struct rxd_rx_entry *rx_entry,
 				dlist_insert_tail(&rx_entry->unexp_entry, &ep->unexp_msg_list);
 				rx_entry->unexp_buf = rx_buf;
 				ep->num_unexp_msg++;
+				ofi_stats_inc(&ep->stats, RXD_STAT_UNEXP_MSGS);
+				ofi_stats_inc(&ep->stats, RXD_STAT_UNEXP_DEPTH);
 				return -FI_ENOENT;
 			} else {
 				FI_WARN(&rxd_prov, FI_LOG_EP_CTRL, "dropping msg\n");
+				ofi_stats_inc(&ep->stats, RXD_STAT_UNEXP_DROPPED);
 				return -FI_ENOMEM;
 			}
 		}
@@ -915,9 +1176,12 @@ int rxd_process_start_data(struct rxd_ep *ep, struct rxd_rx_entry *rx_entry,
 				dlist_insert_tail(&rx_entry->unexp_entry, &ep->unexp_tag_list);
 				rx_entry->unexp_buf = rx_buf;
 				ep->num_unexp_msg++;
+				ofi_stats_inc(&ep->stats, RXD_STAT_UNEXP_MSGS);
+				ofi_stats_inc(&ep->stats, RXD_STAT_UNEXP_DEPTH);
 				return -FI_ENOENT;
 			} else {
 				FI_WARN(&rxd_prov, FI_LOG_EP_CTRL, "dropping msg\n");
+				ofi_stats_inc(&ep->stats, RXD_STAT_UNEXP_DROPPED);
 				return -FI_ENOMEM;
 			}
 		}
@@ -927,20 +1191,12 @@ int rxd_process_start_data(struct rxd_ep *ep, struct rxd_rx_entry *rx_entry,
 				     pkt_start->data, rx_buf);
 		break;
 	case ofi_op_write:
-		rma_iov = (struct ofi_rma_iov *) pkt_start->data;
-		for (i = 0; i < rx_entry->op_hdr.iov_count; i++) {
-			ret = rxd_mr_verify(rxd_ep_domain(ep),
-					    rma_iov[i].len,
-					    (uintptr_t *) &rma_iov[i].addr,
-					    rma_iov[i].key, FI_REMOTE_WRITE);
-			if (ret) {
-				/* todo: handle invalid key case */
-				FI_WARN(&rxd_prov, FI_LOG_EP_CTRL, "invalid key/access permissions\n");
-				return -FI_EACCES;
-			}
-
-			rx_entry->write.iov[i].iov_base = (void *) (uintptr_t) rma_iov[i].addr;
-			rx_entry->write.iov[i].iov_len = rma_iov[i].len;
+		ret = rxd_ep_verify_rma_iov(ep, (struct ofi_rma_iov *) pkt_start->data,
+					    rx_entry->op_hdr.iov_count,
+					    FI_REMOTE_WRITE, rx_entry->write.iov);
+		if (ret) {
+			rxd_ep_complete_req(ep, peer, rx_entry, ctrl, ret);
+			break;
 		}
 
 		offset = sizeof(struct ofi_rma_iov) * rx_entry->op_hdr.iov_count;
@@ -950,7 +1206,6 @@ int rxd_process_start_data(struct rxd_ep *ep, struct rxd_rx_entry *rx_entry,
 				       pkt_start->data + offset, rx_buf);
 		break;
 	case ofi_op_read_req:
-		rma_iov = (struct ofi_rma_iov *) pkt_start->data;
 		tx_entry = rxd_tx_entry_alloc(ep, peer, rx_entry->peer, 0,
 						RXD_TX_READ_RSP);
 		if (!tx_entry) {
@@ -958,28 +1213,22 @@ int rxd_process_start_data(struct rxd_ep *ep, struct rxd_rx_entry *rx_entry,
 			return -FI_ENOMEM;
 		}
 
-		tx_entry->peer = rx_entry->peer;
-		tx_entry->read_rsp.iov_count = rx_entry->op_hdr.iov_count;
-		for (i = 0; i < rx_entry->op_hdr.iov_count; i++) {
-			ret = rxd_mr_verify(rxd_ep_domain(ep),
-					    rma_iov[i].len,
-					    (uintptr_t *) &rma_iov[i].addr,
-					    rma_iov[i].key, FI_REMOTE_READ);
-			if (ret) {
-				/* todo: handle invalid key case */
-				FI_WARN(&rxd_prov, FI_LOG_EP_CTRL, "invalid key/access permissions\n");
-				return -FI_EACCES;
-			}
-
-			tx_entry->read_rsp.src_iov[i].iov_base = (void *) (uintptr_t)
-								rma_iov[i].addr;
-			tx_entry->read_rsp.src_iov[i].iov_len = rma_iov[i].len;
+		ret = rxd_ep_verify_rma_iov(ep, (struct ofi_rma_iov *) pkt_start->data,
+					    rx_entry->op_hdr.iov_count,
+					    FI_REMOTE_READ, tx_entry->read_rsp.src_iov);
+		if (!ret) {
+			tx_entry->read_rsp.iov_count = rx_entry->op_hdr.iov_count;
+			tx_entry->read_rsp.peer_msg_id = ctrl->msg_id;
+			ret = rxd_ep_start_xfer(ep, peer, ofi_op_read_rsp, tx_entry);
 		}
-		tx_entry->read_rsp.peer_msg_id = ctrl->msg_id;
-		ret = rxd_ep_start_xfer(ep, peer, ofi_op_read_rsp, tx_entry);
-		if (ret)
+		if (ret) {
 			rxd_tx_entry_free(ep, tx_entry);
-		rxd_rx_entry_free(ep, rx_entry);
+			if (ret == -FI_ENOMEM)
+				return ret;
+		} else if (ep->util_ep.rem_rd_cntr) {
+			ofi_cntr_inc(ep->util_ep.rem_rd_cntr);
+		}
+		rxd_ep_complete_req(ep, peer, rx_entry, ctrl, ret);
 		break;
 	case ofi_op_read_rsp:
 		idx = rx_entry->op_hdr.remote_idx & RXD_TX_IDX_BITS;
@@ -988,11 +1237,14 @@ int rxd_process_start_data(struct rxd_ep *ep, struct rxd_rx_entry *rx_entry,
 			return -FI_ENOMEM;
 
 		rx_entry->read_rsp.tx_entry = tx_entry;
-		rxd_ep_handle_data_msg(ep, peer, rx_entry, tx_entry->read_req.dst_iov,
-				       tx_entry->read_req.msg.iov_count, ctrl,
+		rxd_tx_entry_rsp_iov(tx_entry, &iov, &iov_count);
+		rxd_ep_handle_data_msg(ep, peer, rx_entry, iov, iov_count, ctrl,
 				       pkt_start->data, rx_buf);
 		break;
 	case ofi_op_atomic:
+	case ofi_op_atomic_fetch:
+	case ofi_op_atomic_compare:
+		return rxd_ep_handle_atomic(ep, peer, rx_entry, ctrl);
 	default:
 		FI_WARN(&rxd_prov, FI_LOG_EP_CTRL, "invalid op type\n");
 		return -FI_EINVAL;
@@ -1009,9 +1261,9 @@ static void rxd_handle_start_data(struct rxd_ep *ep, struct rxd_peer *peer,
 	struct rxd_pkt_data_start *pkt_start;
 	int ret;
 
-	FI_DBG(&rxd_prov, FI_LOG_EP_CTRL,
-	       "start data- msg_id: %" PRIu64 ", segno: %d, buf: %p\n",
-	       ctrl->msg_id, ctrl->seg_no, rx_buf);
+	OFI_TRACE_DBG(&rxd_prov, FI_LOG_EP_CTRL,
+		      "start data- msg_id: %" PRIu64 ", segno: %d, buf: %p\n",
+		      ctrl->msg_id, ctrl->seg_no, rx_buf);
 
 	pkt_start = (struct rxd_pkt_data_start *) ctrl;
 	if (pkt_start->op.version != OFI_OP_VERSION) {
@@ -1022,13 +1274,13 @@ static void rxd_handle_start_data(struct rxd_ep *ep, struct rxd_peer *peer,
 	ret = rxd_check_start_pkt_order(ep, peer, ctrl, comp);
 	if (ret) {
 		if (ret == -FI_EALREADY) {
-			FI_DBG(&rxd_prov, FI_LOG_EP_CTRL, "duplicate pkt: %d\n",
-				ctrl->seg_no);
+			OFI_TRACE_DBG(&rxd_prov, FI_LOG_EP_CTRL, "duplicate pkt: %d\n",
+				       ctrl->seg_no);
 			rxd_handle_dup_datastart(ep, ctrl, rx_buf);
 			goto repost;
 		} else {
-			FI_DBG(&rxd_prov, FI_LOG_EP_CTRL, "unexpected pkt: %d\n",
-				ctrl->seg_no);
+			OFI_TRACE_DBG(&rxd_prov, FI_LOG_EP_CTRL, "unexpected pkt: %d\n",
+				       ctrl->seg_no);
 			goto repost;
 		}
 	}
@@ -1048,19 +1300,21 @@ static void rxd_handle_start_data(struct rxd_ep *ep, struct rxd_peer *peer,
 	rx_entry->credits = 1;
 	rx_entry->last_win_seg = 1;
 
-	FI_DBG(&rxd_prov, FI_LOG_EP_CTRL, "Assign rx_entry :%" PRId64 " for %" PRIx64 "\n",
-	       rx_entry->key, rx_entry->msg_id);
+	OFI_TRACE_DBG(&rxd_prov, FI_LOG_EP_CTRL, "Assign rx_entry :%" PRId64 " for %" PRIx64 "\n",
+		      rx_entry->key, rx_entry->msg_id);
 
 	ep->credits--;
 	ret = rxd_process_start_data(ep, rx_entry, peer, ctrl, comp, rx_buf);
-	if (ret == -FI_ENOMEM)
+	if (ret == -FI_ENOMEM) {
+		ep->credits++;
 		rxd_rx_entry_free(ep, rx_entry);
+	}
 	else if (ret == -FI_ENOENT) {
 		peer->exp_msg_id++;
 
 		/* reply ack, with no window = 0 */
-		FI_DBG(&rxd_prov, FI_LOG_EP_CTRL, "Sending wait-ACK [%" PRIx64 "] - %d\n",
-		       ctrl->msg_id, ctrl->seg_no);
+		OFI_TRACE_DBG(&rxd_prov, FI_LOG_EP_CTRL, "Sending wait-ACK [%" PRIx64 "] - %d\n",
+			      ctrl->msg_id, ctrl->seg_no);
 		goto out;
 	} else {
 		peer->exp_msg_id++;
@@ -1079,7 +1333,7 @@ void rxd_handle_recv_comp(struct rxd_ep *ep, struct fi_cq_msg_entry *comp)
 	struct rxd_rx_buf *rx_buf;
 	struct rxd_peer *peer;
 
-	FI_DBG(&rxd_prov, FI_LOG_EP_CTRL, "got recv completion\n");
+	OFI_TRACE_DBG(&rxd_prov, FI_LOG_EP_CTRL, "got recv completion\n");
 
 	assert(rxd_reposted_bufs);
 	rxd_reposted_bufs--;
@@ -1093,6 +1347,8 @@ void rxd_handle_recv_comp(struct rxd_ep *ep, struct fi_cq_msg_entry *comp)
 		return;
 	}
 
+	rxd_handle_appended_acks(ep, ctrl, comp->len);
+
 	switch (ctrl->type) {
 	case ofi_ctrl_connreq:
 		rxd_handle_conn_req(ep, ctrl, comp, rx_buf);
@@ -1100,6 +1356,9 @@ void rxd_handle_recv_comp(struct rxd_ep *ep, struct fi_cq_msg_entry *comp)
 	case ofi_ctrl_ack:
 		rxd_handle_ack(ep, ctrl, rx_buf);
 		break;
+	case ofi_ctrl_nack:
+		rxd_handle_nack(ep, ctrl, rx_buf);
+		break;
 	case ofi_ctrl_discard:
 		rxd_handle_discard(ep, ctrl, rx_buf);
 		break;
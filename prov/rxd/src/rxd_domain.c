@@ -42,11 +42,12 @@ static struct fi_ops_domain rxd_domain_ops = {
 	.av_open = rxd_av_create,
 	.cq_open = rxd_cq_open,
 	.endpoint = rxd_endpoint,
-	.scalable_ep = fi_no_scalable_ep,
+	.scalable_ep = rxd_scalable_ep,
 	.cntr_open = rxd_cntr_open,
 	.poll_open = fi_poll_create,
 	.stx_ctx = fi_no_stx_context,
 	.srx_ctx = fi_no_srx_context,
+	.query_atomic = rxd_query_atomic,
 };
 
 static int rxd_domain_close(fid_t fid)
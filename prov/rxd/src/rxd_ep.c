@@ -34,11 +34,25 @@
 #include <string.h>
 #include <fi_mem.h>
 #include <fi_iov.h>
+#include <ofi_atomic.h>
 #include "rxd.h"
 
 int rxd_progress_spin_count = 1000;
+int rxd_ack_delay = 100;
+int rxd_ack_count = RXD_MAX_PEER_ACKS / 2;
 int rxd_reposted_bufs = 0;
 
+static const struct ofi_stat_def rxd_ep_stat_defs[RXD_STAT_MAX] = {
+	[RXD_STAT_RETRANSMITS]	= { "retransmits", OFI_STAT_COUNTER },
+	[RXD_STAT_ACKS_SENT]	= { "acks_sent", OFI_STAT_COUNTER },
+	[RXD_STAT_ACKS_PIGGYBACKED] = { "acks_piggybacked", OFI_STAT_COUNTER },
+	[RXD_STAT_UNEXP_MSGS]	= { "unexp_msgs", OFI_STAT_COUNTER },
+	[RXD_STAT_UNEXP_DEPTH]	= { "unexp_depth", OFI_STAT_GAUGE },
+	[RXD_STAT_UNEXP_DROPPED] = { "unexp_dropped", OFI_STAT_COUNTER },
+	[RXD_STAT_TX_PKT_BUFS]	= { "tx_pkt_bufs", OFI_STAT_GAUGE },
+	[RXD_STAT_RX_PKT_BUFS]	= { "rx_pkt_bufs", OFI_STAT_GAUGE },
+};
+
 static ssize_t rxd_ep_cancel(fid_t fid, void *context)
 {
 	struct rxd_ep *ep;
@@ -48,7 +62,7 @@ static ssize_t rxd_ep_cancel(fid_t fid, void *context)
 	struct fi_cq_err_entry err_entry = {0};
 
 	ep = container_of(fid, struct rxd_ep, util_ep.ep_fid.fid);
-	fastlock_acquire(&ep->lock);
+	ofi_lock_acquire(&ep->lock);
 	for (entry = ep->recv_list.next; entry != &ep->recv_list; entry = next) {
 		next = entry->next;
 		recv_entry = container_of(entry, struct rxd_recv_entry, entry);
@@ -81,7 +95,7 @@ static ssize_t rxd_ep_cancel(fid_t fid, void *context)
 	}
 
 out:
-	fastlock_release(&ep->lock);
+	ofi_lock_release(&ep->lock);
 	return 0;
 }
 
@@ -118,7 +132,7 @@ static ssize_t rxd_ep_recvmsg(struct fid_ep *ep, const struct fi_msg *msg,
 
 	rxd_ep = container_of(ep, struct rxd_ep, util_ep.ep_fid.fid);
 
-	fastlock_acquire(&rxd_ep->lock);
+	ofi_lock_acquire(&rxd_ep->lock);
 	if (freestack_isempty(rxd_ep->recv_fs)) {
 		ret = -FI_EAGAIN;
 		goto out;
@@ -126,7 +140,8 @@ static ssize_t rxd_ep_recvmsg(struct fid_ep *ep, const struct fi_msg *msg,
 
 	recv_entry = freestack_pop(rxd_ep->recv_fs);
 	recv_entry->msg = *msg;
-	recv_entry->flags = flags;
+	recv_entry->flags = rxd_ep_op_flags(flags,
+					    rxd_ep->util_ep.rx_op_flags);
 	recv_entry->msg.addr = (rxd_ep->util_ep.caps & FI_DIRECTED_RECV) ?
 		recv_entry->msg.addr : FI_ADDR_UNSPEC;
 	for (i = 0; i < msg->iov_count; i++) {
@@ -143,7 +158,7 @@ static ssize_t rxd_ep_recvmsg(struct fid_ep *ep, const struct fi_msg *msg,
 		rxd_ep_check_unexp_msg_list(rxd_ep, recv_entry);
 	}
 out:
-	fastlock_release(&rxd_ep->lock);
+	ofi_lock_release(&rxd_ep->lock);
 	return ret;
 }
 
@@ -232,7 +247,7 @@ static int rxd_ep_enable(struct rxd_ep *ep)
 	if (ret)
 		return ret;
 
-	fastlock_acquire(&ep->lock);
+	ofi_lock_acquire(&ep->lock);
 	ep->credits = ep->rx_size;
 	for (i = 0; i < ep->rx_size; i++) {
 		rx_buf = ep->do_local_mr ?
@@ -252,7 +267,7 @@ static int rxd_ep_enable(struct rxd_ep *ep)
 		slist_insert_tail(&rx_buf->entry, &ep->rx_pkt_list);
 	}
 out:
-	fastlock_release(&ep->lock);
+	ofi_lock_release(&ep->lock);
 	return ret;
 }
 
@@ -266,8 +281,8 @@ struct rxd_peer *rxd_ep_getpeer_info(struct rxd_ep *ep, fi_addr_t addr)
  */
 void rxd_set_timeout(struct rxd_tx_entry *tx_entry)
 {
-	tx_entry->retry_time = fi_gettime_ms() +
-				MIN(1 << tx_entry->retry_cnt, 4000);
+	tx_entry->retry_time = fi_gettime_us() +
+				MIN(1 << tx_entry->retry_cnt, 4000) * 1000;
 }
 
 static void rxd_init_ctrl_hdr(struct ofi_ctrl_hdr *ctrl,
@@ -355,12 +370,13 @@ struct rxd_tx_entry *rxd_tx_entry_alloc(struct rxd_ep *ep,
 
 	tx_entry = freestack_pop(ep->tx_entry_fs);
 	tx_entry->peer = addr;
-	tx_entry->flags = flags;
+	tx_entry->flags = rxd_ep_op_flags(flags, ep->util_ep.tx_op_flags);
 	tx_entry->bytes_sent = 0;
 	tx_entry->seg_no = 0;
 	tx_entry->window = 1;
 	tx_entry->retry_cnt = 0;
 	tx_entry->op_type = op;
+	dlist_init(&tx_entry->entry);
 	dlist_init(&tx_entry->pkt_list);
 	return tx_entry;
 }
@@ -383,9 +399,9 @@ static size_t rxd_copy_rma_iov(struct ofi_rma_iov *dst,
 	int i;
 
 	for (i = 0; i < count; i++) {
-		dst->addr = src->addr;
-		dst->len = src->len;
-		dst->key = src->key;
+		dst[i].addr = src[i].addr;
+		dst[i].len = src[i].len;
+		dst[i].key = src[i].key;
 	}
 	return sizeof(*dst) * count;
 }
@@ -420,6 +436,36 @@ static uint64_t rxd_ep_copy_data(struct rxd_tx_entry *tx_entry,
 	return ofi_copy_from_iov(buf, size, iov, iov_count, tx_entry->bytes_sent);
 }
 
+static void rxd_peer_clear_acks(struct rxd_peer *peer)
+{
+	peer->ack_cnt = 0;
+	dlist_remove(&peer->ack_entry);
+}
+
+/*
+ * Append the acks held for the peer to a packet about to be sent to it,
+ * if they fit.  The acks are only released once the send succeeds.
+ * Retransmissions are sized from the header and never carry them.
+ */
+static size_t rxd_ep_append_acks(struct rxd_ep *ep, struct rxd_peer *peer,
+				 void *pkt, size_t len)
+{
+	size_t ack_len;
+
+	ack_len = peer->ack_cnt * sizeof(struct ofi_ctrl_ack);
+	if (!ack_len || len + ack_len > rxd_ep_domain(ep)->max_mtu_sz)
+		return 0;
+
+	memcpy((char *) pkt + len, peer->acks, ack_len);
+	return ack_len;
+}
+
+static void rxd_ep_acks_appended(struct rxd_ep *ep, struct rxd_peer *peer)
+{
+	ofi_stats_add(&ep->stats, RXD_STAT_ACKS_PIGGYBACKED, peer->ack_cnt);
+	rxd_peer_clear_acks(peer);
+}
+
 static void rxd_ep_init_data_pkt(struct rxd_ep *ep, struct rxd_peer *peer,
 				 struct rxd_tx_entry *tx_entry,
 				 struct rxd_pkt_data *pkt)
@@ -441,6 +487,7 @@ static ssize_t rxd_ep_post_data_msg(struct rxd_ep *ep,
 	struct rxd_pkt_meta *pkt_meta;
 	struct rxd_pkt_data *pkt;
 	struct rxd_peer *peer;
+	size_t len, ack_len;
 	int ret;
 
 	peer = rxd_ep_getpeer_info(ep, tx_entry->peer);
@@ -453,15 +500,19 @@ static ssize_t rxd_ep_post_data_msg(struct rxd_ep *ep,
 	pkt = (struct rxd_pkt_data *) pkt_meta->pkt_data;
 	rxd_ep_init_data_pkt(ep, peer, tx_entry, pkt);
 
-	if (tx_entry->op_hdr.size == pkt->ctrl.seg_size)
+	if (tx_entry->bytes_sent == tx_entry->op_hdr.size)
 		pkt_meta->flags |= RXD_PKT_LAST;
 
-	ret = fi_send(ep->dg_ep, pkt, sizeof(*pkt) + pkt->ctrl.seg_size,
+	len = sizeof(*pkt) + pkt->ctrl.seg_size;
+	ack_len = rxd_ep_append_acks(ep, peer, pkt, len);
+	ret = fi_send(ep->dg_ep, pkt, len + ack_len,
 		      rxd_mr_desc(pkt_meta->mr, ep), tx_entry->peer,
 		      &pkt_meta->context);
 	if (ret) {
 		FI_DBG(&rxd_prov, FI_LOG_EP_CTRL, "send %d failed\n",
 		       pkt->ctrl.seg_no);
+	} else if (ack_len) {
+		rxd_ep_acks_appended(ep, peer);
 	}
 
 	FI_DBG(&rxd_prov, FI_LOG_EP_CTRL, "msg data %" PRIx64 ", seg %d\n",
@@ -530,6 +581,8 @@ static int rxd_ep_retry_pkt(struct rxd_ep *ep, struct rxd_tx_entry *tx_entry,
 		FI_DBG(&rxd_prov, FI_LOG_EP_CTRL, "Pkt sent failed seg: %d, ret: %d\n",
 			ctrl->seg_no, ret);
 	}
+	if (!ret)
+		ofi_stats_inc(&ep->stats, RXD_STAT_RETRANSMITS);
 
 	return ret;
 }
@@ -557,7 +610,7 @@ void rxd_tx_entry_progress(struct rxd_ep *ep, struct rxd_tx_entry *tx_entry)
 		tx_entry, tx_entry->msg_id);
 
 	while ((tx_entry->seg_no < tx_entry->window) &&
-	       (tx_entry->bytes_sent != tx_entry->op_hdr.size)) {
+	       (tx_entry->bytes_sent != rxd_tx_entry_data_size(tx_entry))) {
 		if (rxd_ep_post_data_msg(ep, tx_entry))
 			break;
 	}
@@ -579,9 +632,10 @@ int rxd_ep_reply_ack(struct rxd_ep *ep, struct ofi_ctrl_hdr *in_ctrl,
 
 	rx_entry = (rx_key != UINT64_MAX) ? &ep->rx_entry_fs->buf[rx_key] : NULL;
 
+	/* without an rx_entry, acknowledge the segment being replied to */
 	pkt = (struct rxd_pkt_data *)pkt_meta->pkt_data;
 	rxd_init_ctrl_hdr(&pkt->ctrl, type, seg_size,
-			  rx_entry ? rx_entry->exp_seg_no : 0,
+			  rx_entry ? rx_entry->exp_seg_no : in_ctrl->seg_no + 1,
 			  in_ctrl->msg_id, rx_key, source);
 
 	FI_DBG(&rxd_prov, FI_LOG_EP_CTRL, "sending ack [%" PRIx64 "] - segno: %d, window: %d\n",
@@ -593,17 +647,102 @@ int rxd_ep_reply_ack(struct rxd_ep *ep, struct ofi_ctrl_hdr *in_ctrl,
 		      dest, &pkt_meta->context);
 	if (ret)
 		util_buf_release(ep->tx_pkt_pool, pkt_meta);
+	else if (type == ofi_ctrl_ack)
+		ofi_stats_inc(&ep->stats, RXD_STAT_ACKS_SENT);
 
 	return ret;
 }
 
+/*
+ * Send the acks held for the peer as a single ack packet.  The first ack
+ * is carried by the header, and the rest follow it.
+ */
+int rxd_ep_flush_acks(struct rxd_ep *ep, struct rxd_peer *peer)
+{
+	struct rxd_pkt_meta *pkt_meta;
+	struct rxd_pkt_data *pkt;
+	struct ofi_ctrl_ack *ack = &peer->acks[0];
+	size_t ack_len;
+	ssize_t ret;
+
+	pkt_meta = rxd_tx_pkt_alloc(ep);
+	if (!pkt_meta)
+		return -FI_ENOMEM;
+
+	pkt = (struct rxd_pkt_data *) pkt_meta->pkt_data;
+	rxd_init_ctrl_hdr(&pkt->ctrl, ofi_ctrl_ack, ack->seg_size, ack->seg_no,
+			  ack->msg_id, ack->rx_key, peer->conn_data);
+	ack_len = (peer->ack_cnt - 1) * sizeof(*ack);
+	memcpy(pkt->data, &peer->acks[1], ack_len);
+
+	FI_DBG(&rxd_prov, FI_LOG_EP_CTRL, "sending %d acks [%" PRIx64 "]\n",
+	       peer->ack_cnt, pkt->ctrl.msg_id);
+
+	pkt_meta->flags = RXD_NOT_ACKED;
+	ret = fi_send(ep->dg_ep, pkt, sizeof(*pkt) + ack_len,
+		      rxd_mr_desc(pkt_meta->mr, ep),
+		      rxd_ep_peer_addr(ep, peer), &pkt_meta->context);
+	if (ret) {
+		util_buf_release(ep->tx_pkt_pool, pkt_meta);
+		return ret;
+	}
+
+	ofi_stats_inc(&ep->stats, RXD_STAT_ACKS_SENT);
+	rxd_peer_clear_acks(peer);
+	return 0;
+}
+
+/*
+ * Acks that only report a message as received in full are delayed.  They
+ * are flushed once ack_count of them are held for the peer, or after the
+ * oldest has waited ack_delay microseconds, unless a packet sent to the
+ * peer carries them first.  If the ack cannot be held, it is dropped, and
+ * the retransmitted packet is acked as a duplicate.
+ */
+void rxd_ep_queue_ack(struct rxd_ep *ep, struct rxd_peer *peer,
+		      uint64_t msg_id, uint32_t seg_no, uint64_t rx_key)
+{
+	struct ofi_ctrl_ack *ack;
+
+	if (peer->ack_cnt == RXD_MAX_PEER_ACKS &&
+	    rxd_ep_flush_acks(ep, peer))
+		return;
+
+	ack = &peer->acks[peer->ack_cnt];
+	ack->msg_id = msg_id;
+	ack->rx_key = rx_key;
+	ack->seg_no = seg_no;
+	ack->seg_size = 0;
+	ack->resv = 0;
+
+	if (!peer->ack_cnt++) {
+		peer->ack_time = fi_gettime_us() + rxd_ack_delay;
+		dlist_insert_tail(&peer->ack_entry, &ep->ack_list);
+	}
+
+	if (!rxd_ack_delay || peer->ack_cnt >= rxd_ack_count)
+		rxd_ep_flush_acks(ep, peer);
+}
+
+static void rxd_ep_progress_acks(struct rxd_ep *ep, uint64_t cur_time)
+{
+	struct rxd_peer *peer;
+
+	while (!dlist_empty(&ep->ack_list)) {
+		peer = container_of(ep->ack_list.next, struct rxd_peer,
+				    ack_entry);
+		if (peer->ack_time > cur_time || rxd_ep_flush_acks(ep, peer))
+			break;
+	}
+}
+
 #define RXD_TX_ENTRY_ID(ep, tx_entry) (tx_entry - &ep->tx_entry_fs->buf[0])
 
 static void rxd_ep_init_start_pkt(struct rxd_ep *ep, struct rxd_peer *peer,
 				  uint8_t op, struct rxd_tx_entry *tx_entry,
 				  struct rxd_pkt_data_start *pkt, uint32_t flags)
 {
-	uint64_t msg_size, iov_size;
+	uint64_t msg_size, iov_size = 0;
 	uint16_t seg_size;
 
 	switch (op) {
@@ -627,8 +766,8 @@ static void rxd_ep_init_start_pkt(struct rxd_ep *ep, struct rxd_peer *peer,
 		iov_size = rxd_copy_rma_iov((struct ofi_rma_iov *) pkt->data,
 					    tx_entry->write.dst_iov,
 					    tx_entry->write.msg.rma_iov_count);
-		seg_size = MIN(rxd_ep_domain(ep)->max_mtu_sz -
-			       sizeof(struct rxd_pkt_data_start) - iov_size, msg_size);
+		seg_size = rxd_ep_start_seg_size(ep, msg_size + iov_size) -
+			   iov_size;
 		rxd_init_op_hdr(&pkt->op, tx_entry->write.msg.data, msg_size, 0,
 				op, 0, flags);
 		pkt->op.iov_count = tx_entry->write.msg.rma_iov_count;
@@ -644,6 +783,21 @@ static void rxd_ep_init_start_pkt(struct rxd_ep *ep, struct rxd_peer *peer,
 				0, op, 0, flags);
 		pkt->op.iov_count = tx_entry->read_req.msg.rma_iov_count;
 		break;
+	case ofi_op_atomic:
+	case ofi_op_atomic_fetch:
+	case ofi_op_atomic_compare:
+		msg_size = ofi_total_ioc_cnt(tx_entry->atomic.src_iov,
+					     tx_entry->atomic.msg.iov_count) *
+			   ofi_datatype_size(tx_entry->atomic.msg.datatype);
+		/* the ioc list and operands all travel in the start packet */
+		iov_size = rxd_atomic_copy_req(tx_entry, pkt->data);
+		seg_size = 0;
+		rxd_init_op_hdr(&pkt->op, tx_entry->atomic.msg.data, msg_size,
+				0, op, 0, flags);
+		pkt->op.atomic.datatype = tx_entry->atomic.msg.datatype;
+		pkt->op.atomic.op = tx_entry->atomic.msg.op;
+		pkt->op.atomic.ioc_count = tx_entry->atomic.msg.rma_iov_count;
+		break;
 	case ofi_op_read_rsp:
 		msg_size = ofi_total_iov_len(tx_entry->read_rsp.src_iov,
 					     tx_entry->read_rsp.iov_count);
@@ -656,22 +810,51 @@ static void rxd_ep_init_start_pkt(struct rxd_ep *ep, struct rxd_peer *peer,
 		assert(0);
 	}
 
-	rxd_init_ctrl_hdr(&pkt->ctrl, ofi_ctrl_start_data, seg_size, 0,
-			   tx_entry->msg_id, peer->conn_data,
+	rxd_init_ctrl_hdr(&pkt->ctrl, ofi_ctrl_start_data, iov_size + seg_size,
+			   0, tx_entry->msg_id, peer->conn_data,
 			   peer->conn_data);
 	/* copy op header here because it is used in ep_copy_data call */
 	tx_entry->op_hdr = pkt->op;
-	tx_entry->bytes_sent = rxd_ep_copy_data(tx_entry, pkt->data,
+	tx_entry->bytes_sent = rxd_ep_copy_data(tx_entry, pkt->data + iov_size,
 						seg_size);
 	tx_entry->seg_no++;
 	assert(tx_entry->bytes_sent == seg_size);
 }
 
+/*
+ * Start packets of operations posted with FI_MORE are passed down with the
+ * flag, so that the datagram provider can hand a run of them to the kernel
+ * at once.  The run ends with the first operation posted without FI_MORE,
+ * or when the datagram endpoint is progressed.
+ */
+static ssize_t rxd_ep_send_start_pkt(struct rxd_ep *ep,
+				     struct rxd_tx_entry *tx_entry, void *pkt,
+				     size_t len, void *desc, void *context)
+{
+	struct fi_msg msg;
+	struct iovec iov;
+
+	if (!(tx_entry->flags & FI_MORE))
+		return fi_send(ep->dg_ep, pkt, len, desc, tx_entry->peer,
+			       context);
+
+	iov.iov_base = pkt;
+	iov.iov_len = len;
+	msg.msg_iov = &iov;
+	msg.desc = &desc;
+	msg.iov_count = 1;
+	msg.addr = tx_entry->peer;
+	msg.context = context;
+	msg.data = 0;
+	return fi_sendmsg(ep->dg_ep, &msg, FI_MORE | FI_COMPLETION);
+}
+
 ssize_t rxd_ep_start_xfer(struct rxd_ep *ep, struct rxd_peer *peer,
 			  uint8_t op, struct rxd_tx_entry *tx_entry)
 {
 	struct rxd_pkt_meta *pkt_meta;
 	struct rxd_pkt_data_start *pkt;
+	size_t len, ack_len;
 	uint32_t flags;
 	ssize_t ret;
 
@@ -687,15 +870,19 @@ ssize_t rxd_ep_start_xfer(struct rxd_ep *ep, struct rxd_peer *peer,
 
 	rxd_ep_init_start_pkt(ep, peer, op, tx_entry, pkt, flags);
 
-	if (tx_entry->op_hdr.size == pkt->ctrl.seg_size)
+	if (tx_entry->bytes_sent == rxd_tx_entry_data_size(tx_entry))
 		pkt_meta->flags |= RXD_PKT_LAST;
 
-	ret = fi_send(ep->dg_ep, pkt, sizeof(*pkt) + pkt->ctrl.seg_size,
-		      rxd_mr_desc(pkt_meta->mr, ep),
-		      tx_entry->peer, &pkt_meta->context);
+	len = sizeof(*pkt) + pkt->ctrl.seg_size;
+	ack_len = rxd_ep_append_acks(ep, peer, pkt, len);
+	ret = rxd_ep_send_start_pkt(ep, tx_entry, pkt, len + ack_len,
+				    rxd_mr_desc(pkt_meta->mr, ep),
+				    &pkt_meta->context);
 	if (ret) {
 		FI_DBG(&rxd_prov, FI_LOG_EP_CTRL, "send %d failed\n",
 		       pkt->ctrl.seg_no);
+	} else if (ack_len) {
+		rxd_ep_acks_appended(ep, peer);
 	}
 
 	FI_DBG(&rxd_prov, FI_LOG_EP_CTRL, "start msg %" PRIx64 ", size: %ld\n",
@@ -772,12 +959,14 @@ static ssize_t rxd_ep_sendmsg(struct fid_ep *ep, const struct fi_msg *msg,
 	rxd_ep = container_of(ep, struct rxd_ep, util_ep.ep_fid.fid);
 
 	peer_addr = rxd_av_dg_addr(rxd_ep_av(rxd_ep), msg->addr);
+	if (peer_addr >= rxd_ep->max_peers)
+		return -FI_EADDRNOTAVAIL;
 	peer = rxd_ep_getpeer_info(rxd_ep, peer_addr);
 
-	fastlock_acquire(&rxd_ep->lock);
+	ofi_lock_acquire(&rxd_ep->lock);
 	if (peer->state != CMAP_CONNECTED) {
 		ret = rxd_ep_connect(rxd_ep, peer, peer_addr);
-		fastlock_release(&rxd_ep->lock);
+		ofi_lock_release(&rxd_ep->lock);
 		if (ret == -FI_EALREADY) {
 			rxd_ep->util_ep.progress(&rxd_ep->util_ep);
 			ret = -FI_EAGAIN;
@@ -800,7 +989,7 @@ static ssize_t rxd_ep_sendmsg(struct fid_ep *ep, const struct fi_msg *msg,
 		rxd_tx_entry_free(rxd_ep, tx_entry);
 
 out:
-	fastlock_release(&rxd_ep->lock);
+	ofi_lock_release(&rxd_ep->lock);
 	return ret;
 }
 
@@ -927,6 +1116,7 @@ static void rxd_trx_discard_recv(struct rxd_ep *ep,
 
 	dlist_remove(&rx_entry->unexp_entry);
 	ep->num_unexp_msg--;
+	ofi_stats_dec(&ep->stats, RXD_STAT_UNEXP_DEPTH);
 
 	pkt_meta = rxd_tx_pkt_alloc(ep);
 	if (!pkt_meta)
@@ -1008,7 +1198,7 @@ static ssize_t rxd_trx_claim_recv(struct rxd_ep *ep,
 	trecv_entry->msg = *msg;
 	trecv_entry->msg.addr = (ep->util_ep.caps & FI_DIRECTED_RECV) ?
 		msg->addr : FI_ADDR_UNSPEC;
-	trecv_entry->flags = flags;
+	trecv_entry->flags = rxd_ep_op_flags(flags, ep->util_ep.rx_op_flags);
 	for (i = 0; i < msg->iov_count; i++) {
 		trecv_entry->iov[i].iov_base = msg->msg_iov[i].iov_base;
 		trecv_entry->iov[i].iov_len = msg->msg_iov[i].iov_len;
@@ -1040,7 +1230,7 @@ static ssize_t rxd_ep_trecvmsg(struct fid_ep *ep, const struct fi_msg_tagged *ms
 	struct rxd_trecv_entry *trecv_entry;
 
 	rxd_ep = container_of(ep, struct rxd_ep, util_ep.ep_fid.fid);
-	fastlock_acquire(&rxd_ep->lock);
+	ofi_lock_acquire(&rxd_ep->lock);
 
 	if (flags & FI_PEEK) {
 		ret = rxd_trx_peek_recv(rxd_ep, msg, flags);
@@ -1059,7 +1249,8 @@ static ssize_t rxd_ep_trecvmsg(struct fid_ep *ep, const struct fi_msg_tagged *ms
 	trecv_entry->msg = *msg;
 	trecv_entry->msg.addr = (rxd_ep->util_ep.caps & FI_DIRECTED_RECV) ?
 		msg->addr : FI_ADDR_UNSPEC;
-	trecv_entry->flags = flags;
+	trecv_entry->flags = rxd_ep_op_flags(flags,
+					     rxd_ep->util_ep.rx_op_flags);
 	for (i = 0; i < msg->iov_count; i++) {
 		trecv_entry->iov[i].iov_base = msg->msg_iov[i].iov_base;
 		trecv_entry->iov[i].iov_len = msg->msg_iov[i].iov_len;
@@ -1073,7 +1264,7 @@ static ssize_t rxd_ep_trecvmsg(struct fid_ep *ep, const struct fi_msg_tagged *ms
 		rxd_ep_check_unexp_tag_list(rxd_ep, trecv_entry);
 	}
 out:
-	fastlock_release(&rxd_ep->lock);
+	ofi_lock_release(&rxd_ep->lock);
 	return ret;
 }
 
@@ -1131,12 +1322,14 @@ static ssize_t rxd_ep_tsendmsg(struct fid_ep *ep, const struct fi_msg_tagged *ms
 	rxd_ep = container_of(ep, struct rxd_ep, util_ep.ep_fid.fid);
 
 	peer_addr = rxd_av_dg_addr(rxd_ep_av(rxd_ep), msg->addr);
+	if (peer_addr >= rxd_ep->max_peers)
+		return -FI_EADDRNOTAVAIL;
 	peer = rxd_ep_getpeer_info(rxd_ep, peer_addr);
 
-	fastlock_acquire(&rxd_ep->lock);
+	ofi_lock_acquire(&rxd_ep->lock);
 	if (peer->state != CMAP_CONNECTED) {
 		ret = rxd_ep_connect(rxd_ep, peer, peer_addr);
-		fastlock_release(&rxd_ep->lock);
+		ofi_lock_release(&rxd_ep->lock);
 		if (ret == -FI_EALREADY) {
 			rxd_ep->util_ep.progress(&rxd_ep->util_ep);
 			ret = -FI_EAGAIN;
@@ -1159,7 +1352,7 @@ static ssize_t rxd_ep_tsendmsg(struct fid_ep *ep, const struct fi_msg_tagged *ms
 		rxd_tx_entry_free(rxd_ep, tx_entry);
 
 out:
-	fastlock_release(&rxd_ep->lock);
+	ofi_lock_release(&rxd_ep->lock);
 	return ret;
 }
 
@@ -1294,8 +1487,22 @@ static int rxd_ep_close(struct fid *fid)
 	struct rxd_ep *ep;
 	struct slist_entry *entry;
 	struct rxd_rx_buf *buf;
+	struct rxd_tx_entry *tx_entry;
+	struct fi_cq_msg_entry cq_entry;
 
 	ep = container_of(fid, struct rxd_ep, util_ep.ep_fid.fid);
+
+	/* Transfers may still wait on acks, which are never coming */
+	while (fi_cq_read(ep->dg_cq, &cq_entry, 1) > 0) {
+		if (cq_entry.flags & FI_SEND)
+			rxd_handle_send_comp(&cq_entry);
+	}
+	while (!dlist_empty(&ep->tx_entry_list)) {
+		tx_entry = container_of(ep->tx_entry_list.next,
+					struct rxd_tx_entry, entry);
+		rxd_tx_entry_done(ep, tx_entry);
+	}
+
 	ret = fi_close(&ep->dg_ep->fid);
 	if (ret)
 		return ret;
@@ -1312,22 +1519,23 @@ static int rxd_ep_close(struct fid *fid)
 
 	if (ep->util_ep.tx_cq) {
 		/* TODO: wait handling */
-		fid_list_remove(&ep->util_ep.tx_cq->ep_list,
-				&ep->util_ep.tx_cq->ep_list_lock,
-				&ep->util_ep.ep_fid.fid);
+		ofi_fid_list_remove(&ep->util_ep.tx_cq->ep_list,
+				    &ep->util_ep.tx_cq->ep_list_lock,
+				    &ep->util_ep.ep_fid.fid);
 	}
 
 	if (ep->util_ep.rx_cq) {
 		if (ep->util_ep.rx_cq != ep->util_ep.tx_cq) {
 			/* TODO: wait handling */
-			fid_list_remove(&ep->util_ep.rx_cq->ep_list,
-					&ep->util_ep.rx_cq->ep_list_lock,
-					&ep->util_ep.ep_fid.fid);
+			ofi_fid_list_remove(&ep->util_ep.rx_cq->ep_list,
+					    &ep->util_ep.rx_cq->ep_list_lock,
+					    &ep->util_ep.ep_fid.fid);
 		}
 	}
 
-	fastlock_destroy(&ep->lock);
+	ofi_lock_destroy(&ep->lock);
 	rxd_ep_free_buf_pools(ep);
+	ofi_stats_close(&ep->stats);
 	free(ep->peer_info);
 	ofi_endpoint_close(&ep->util_ep);
 	free(ep);
@@ -1338,7 +1546,7 @@ static int rxd_ep_bind_cq(struct rxd_ep *ep, struct rxd_cq *cq, uint64_t flags)
 {
 	int ret;
 
-	if (flags & ~(FI_TRANSMIT | FI_RECV)) {
+	if (flags & ~(FI_TRANSMIT | FI_RECV | FI_SELECTIVE_COMPLETION)) {
 		FI_WARN(&rxd_prov, FI_LOG_EP_CTRL, "unsupported flags\n");
 		return -FI_EBADFLAGS;
 	}
@@ -1349,20 +1557,24 @@ static int rxd_ep_bind_cq(struct rxd_ep *ep, struct rxd_cq *cq, uint64_t flags)
 		return -FI_EINVAL;
 	}
 
-	ret = fid_list_insert(&cq->util_cq.ep_list,
-			      &cq->util_cq.ep_list_lock,
-			      &ep->util_ep.ep_fid.fid);
+	ret = ofi_fid_list_insert(&cq->util_cq.ep_list,
+				  &cq->util_cq.ep_list_lock,
+				  &ep->util_ep.ep_fid.fid);
 	if (ret)
 		return ret;
 
 	if (flags & FI_TRANSMIT) {
 		ep->util_ep.tx_cq = &cq->util_cq;
+		if (!(flags & FI_SELECTIVE_COMPLETION))
+			ep->util_ep.tx_op_flags |= FI_COMPLETION;
 		ofi_atomic_inc32(&cq->util_cq.ref);
 		/* TODO: wait handling */
 	}
 
 	if (flags & FI_RECV) {
 		ep->util_ep.rx_cq = &cq->util_cq;
+		if (!(flags & FI_SELECTIVE_COMPLETION))
+			ep->util_ep.rx_op_flags |= FI_COMPLETION;
 		ofi_atomic_inc32(&cq->util_cq.ref);
 		/* TODO: wait handling */
 	}
@@ -1388,8 +1600,8 @@ static int rxd_ep_bind(struct fid *ep_fid, struct fid *bfid, uint64_t flags)
 		if (ret)
 			return ret;
 
-		ep->peer_info = calloc(av->util_av.count, sizeof(struct rxd_peer));
-		ep->max_peers = av->util_av.count;
+		ep->max_peers = rxd_av_dg_count(av);
+		ep->peer_info = calloc(ep->max_peers, sizeof(struct rxd_peer));
 		if (!ep->peer_info)
 			return -FI_ENOMEM;
 		break;
@@ -1415,11 +1627,14 @@ static int rxd_ep_control(struct fid *fid, int command, void *arg)
 	int ret;
 	struct rxd_ep *ep;
 
+	ep = container_of(fid, struct rxd_ep, util_ep.ep_fid.fid);
 	switch (command) {
 	case FI_ENABLE:
-		ep = container_of(fid, struct rxd_ep, util_ep.ep_fid.fid);
 		ret = rxd_ep_enable(ep);
 		break;
+	case FI_GET_STATS:
+		ret = ofi_stats_query(&ep->stats, arg);
+		break;
 	default:
 		ret = -FI_ENOSYS;
 		break;
@@ -1478,7 +1693,7 @@ static void rxd_ep_progress(struct util_ep *util_ep)
 
 	ep = container_of(util_ep, struct rxd_ep, util_ep);
 
-	fastlock_acquire(&ep->lock);
+	ofi_lock_acquire(&ep->lock);
 	for(ret = 1, i = 0;
 	    ret > 0 && (!rxd_progress_spin_count || i < rxd_progress_spin_count);
 	    i++) {
@@ -1495,37 +1710,35 @@ static void rxd_ep_progress(struct util_ep *util_ep)
 	}
 
 	cur_time = fi_gettime_us();
+	rxd_ep_progress_acks(ep, cur_time);
+
 	dlist_foreach(&ep->tx_entry_list, tx_item) {
 		tx_entry = container_of(tx_item, struct rxd_tx_entry, entry);
 
-		if (tx_entry->seg_no < tx_entry->window) {
+		if ((tx_entry->seg_no < tx_entry->window) &&
+		    (tx_entry->bytes_sent != rxd_tx_entry_data_size(tx_entry))) {
 			rxd_tx_entry_progress(ep, tx_entry);
-		} else if ((tx_entry->retry_time > cur_time) /* &&
-			 dlist_empty(&tx_entry->pkt_list)*/ ) {
+			continue;
+		}
 
-			FI_WARN(&rxd_prov, FI_LOG_EP_CTRL, "Progressing waiting entry [%" PRIx64 "]\n",
-				tx_entry->msg_id);
+		/* Unacked packets are resent once the entry times out */
+		if (tx_entry->retry_time > cur_time ||
+		    dlist_empty(&tx_entry->pkt_list))
+			continue;
 
-			rxd_tx_entry_progress(ep, tx_entry);
-//			rxd_set_timeout(tx_entry);
-		}
+		OFI_TRACE_WARN(&rxd_prov, FI_LOG_EP_CTRL,
+			       "Retrying timed out entry [%" PRIx64 "]\n",
+			       tx_entry->msg_id);
 
 		dlist_foreach(&tx_entry->pkt_list, pkt_item) {
 			pkt = container_of(pkt_item, struct rxd_pkt_meta, entry);
-//			/* TODO: This if check is repeated.  Create a function
-//			 * to perform this check, and figure out what the check
-//			 * is actually doing with the bit-shift, multiply operation.
-//			 */
-//			if (curr_stamp > pkt->us_stamp &&
-//			    curr_stamp - pkt->us_stamp >
-//			    (((uint64_t) 1) << ((uint64_t) pkt->retries + 1)) *
-//			     RXD_RETRY_TIMEOUT) {
-//				pkt->us_stamp = curr_stamp;
-				rxd_ep_retry_pkt(ep, tx_entry, pkt);
-//			}
+			rxd_ep_retry_pkt(ep, tx_entry, pkt);
 		}
+		if ((1 << tx_entry->retry_cnt) < 4000)
+			tx_entry->retry_cnt++;
+		rxd_set_timeout(tx_entry);
 	}
-	fastlock_release(&ep->lock);
+	ofi_lock_release(&ep->lock);
 }
 
 static int rxd_buf_region_alloc_hndlr(void *pool_ctx, void *addr, size_t len,
@@ -1556,6 +1769,8 @@ int rxd_ep_create_buf_pools(struct rxd_ep *ep, struct fi_info *fi_info)
 		rxd_ep_domain(ep));
 	if (!ep->tx_pkt_pool)
 		return -FI_ENOMEM;
+	util_buf_pool_set_stats(ep->tx_pkt_pool, &ep->stats,
+				RXD_STAT_TX_PKT_BUFS);
 
 	ep->rx_pkt_pool = util_buf_pool_create_ex(
 		rxd_ep_domain(ep)->max_mtu_sz + sizeof (struct rxd_rx_buf),
@@ -1565,6 +1780,8 @@ int rxd_ep_create_buf_pools(struct rxd_ep *ep, struct fi_info *fi_info)
 		rxd_ep_domain(ep));
 	if (!ep->rx_pkt_pool)
 		goto err;
+	util_buf_pool_set_stats(ep->rx_pkt_pool, &ep->stats,
+				RXD_STAT_RX_PKT_BUFS);
 
 	ep->tx_entry_fs = rxd_tx_entry_fs_create(1ULL << RXD_MAX_TX_BITS);
 	if (!ep->tx_entry_fs)
@@ -1658,10 +1875,15 @@ int rxd_endpoint(struct fid_domain *domain, struct fi_info *info,
 	if (ret)
 		goto err4;
 
+	ret = ofi_stats_init(&rxd_prov, &rxd_ep->stats, rxd_ep_stat_defs,
+			     RXD_STAT_MAX, "ep");
+	if (ret)
+		goto err4;
+
 	rxd_ep->rx_size = info->rx_attr->size;
 	ret = rxd_ep_create_buf_pools(rxd_ep, info);
 	if (ret)
-		goto err4;
+		goto err5;
 
 	rxd_ep->util_ep.ep_fid.fid.ops = &rxd_ep_fi_ops;
 	rxd_ep->util_ep.ep_fid.cm = &rxd_ep_cm;
@@ -1669,18 +1891,23 @@ int rxd_endpoint(struct fid_domain *domain, struct fi_info *info,
 	rxd_ep->util_ep.ep_fid.msg = &rxd_ops_msg;
 	rxd_ep->util_ep.ep_fid.tagged = &rxd_ops_tagged;
 	rxd_ep->util_ep.ep_fid.rma = &rxd_ops_rma;
+	rxd_ep->util_ep.ep_fid.atomic = &rxd_ops_atomic;
 
 	dlist_init(&rxd_ep->tx_entry_list);
+	dlist_init(&rxd_ep->ack_list);
 	dlist_init(&rxd_ep->rx_entry_list);
 	dlist_init(&rxd_ep->wait_rx_list);
 	dlist_init(&rxd_ep->unexp_msg_list);
 	dlist_init(&rxd_ep->unexp_tag_list);
 	slist_init(&rxd_ep->rx_pkt_list);
-	fastlock_init(&rxd_ep->lock);
+	ofi_lock_init(&rxd_ep->lock,
+		      ofi_domain_lock_type(&rxd_domain->util_domain));
 
 	*ep = &rxd_ep->util_ep.ep_fid;
 	return 0;
 
+err5:
+	ofi_stats_close(&rxd_ep->stats);
 err4:
 	fi_close(&rxd_ep->dg_cq->fid);
 err3:
@@ -1691,3 +1918,56 @@ err1:
 	free(rxd_ep);
 	return ret;
 }
+
+/*
+ * Each context is an endpoint over its own dg endpoint, bound to the
+ * scalable endpoint's address at port + index for rx contexts, and at
+ * the ports following the rx contexts for tx contexts.
+ */
+static int rxd_sep_ctx_open(struct util_sep *sep, size_t port,
+			    struct fi_info *info, struct fid_ep **ctx,
+			    void *context)
+{
+	int ret;
+
+	ret = ofi_sep_ctx_info(sep, port, info);
+	if (ret)
+		return ret;
+
+	ofi_sep_release_port(sep, port);
+	return rxd_endpoint(&sep->domain->domain_fid, info, ctx, context);
+}
+
+static int rxd_sep_tx_ctx(struct util_sep *sep, int index,
+			  struct fi_info *info, struct fid_ep **ctx,
+			  void *context)
+{
+	return rxd_sep_ctx_open(sep, sep->rx_ctx_cnt + index, info,
+				ctx, context);
+}
+
+static int rxd_sep_rx_ctx(struct util_sep *sep, int index,
+			  struct fi_info *info, struct fid_ep **ctx,
+			  void *context)
+{
+	return rxd_sep_ctx_open(sep, index, info, ctx, context);
+}
+
+int rxd_scalable_ep(struct fid_domain *domain, struct fi_info *info,
+		    struct fid_ep **sep_fid, void *context)
+{
+	struct util_sep *sep;
+	int ret;
+
+	ret = ofi_scalable_ep(domain, &rxd_util_prov, info, sep_fid, context,
+			      rxd_sep_tx_ctx, rxd_sep_rx_ctx);
+	if (ret)
+		return ret;
+
+	sep = container_of(*sep_fid, struct util_sep, ep_fid);
+	ret = ofi_sep_bind_ports(sep, SOCK_DGRAM,
+				 sep->rx_ctx_cnt + sep->tx_ctx_cnt);
+	if (ret)
+		fi_close(&(*sep_fid)->fid);
+	return ret;
+}
@@ -92,6 +92,7 @@ int rxd_fabric(struct fi_fabric_attr *attr, struct fid_fabric **fabric,
 		goto err2;
 	}
 	hints.fabric_attr->name = attr->name;
+	hints.fabric_attr->prov_name = attr->prov_name;
 
 	ret = ofi_get_core_info(attr->api_version, NULL, NULL, 0, &rxd_util_prov,
 				&hints, rxd_info_to_core, &dg_info);
@@ -113,6 +114,10 @@ int rxd_fabric(struct fi_fabric_attr *attr, struct fid_fabric **fabric,
 	fi_freeinfo(dg_info);
 
 	fi_param_get_int(&rxd_prov, "spin_count", &rxd_progress_spin_count);
+	fi_param_get_int(&rxd_prov, "ack_delay", &rxd_ack_delay);
+	fi_param_get_int(&rxd_prov, "ack_count", &rxd_ack_count);
+	rxd_ack_delay = MAX(rxd_ack_delay, 0);
+	rxd_ack_count = MIN(MAX(rxd_ack_count, 1), RXD_MAX_PEER_ACKS);
 
 	return 0;
 err4:
@@ -41,6 +41,10 @@ int rxd_info_to_core(uint32_t version, const struct fi_info *rxd_info,
 	core_info->caps = FI_MSG;
 	core_info->mode = FI_LOCAL_MR;
 	core_info->ep_attr->type = FI_EP_DGRAM;
+	/* Calls into the core are serialized by the app if ours are */
+	if (rxd_info && rxd_info->domain_attr &&
+	    rxd_info->domain_attr->threading == FI_THREAD_DOMAIN)
+		core_info->domain_attr->threading = FI_THREAD_DOMAIN;
 	return 0;
 }
 
@@ -83,6 +87,13 @@ RXD_INI
 {
 	fi_param_define(&rxd_prov, "spin_count", FI_PARAM_INT,
 			"Number of iterations to receive packets (0 - infinite)");
+	fi_param_define(&rxd_prov, "ack_delay", FI_PARAM_INT,
+			"Time in microseconds that acks for received messages "
+			"may be held, waiting for a packet to the same peer "
+			"to carry them (0 - ack immediately, default: 100)");
+	fi_param_define(&rxd_prov, "ack_count", FI_PARAM_INT,
+			"Number of held acks per peer that are sent together "
+			"in one ack packet (default: 4, max: 8)");
 
 	return &rxd_prov;
 }
@@ -47,12 +47,14 @@ ssize_t	rxd_ep_readmsg(struct fid_ep *ep, const struct fi_msg_rma *msg,
 	rxd_ep = container_of(ep, struct rxd_ep, util_ep.ep_fid);
 
 	peer_addr = rxd_av_dg_addr(rxd_ep_av(rxd_ep), msg->addr);
+	if (peer_addr >= rxd_ep->max_peers)
+		return -FI_EADDRNOTAVAIL;
 	peer = rxd_ep_getpeer_info(rxd_ep, peer_addr);
 
-	fastlock_acquire(&rxd_ep->lock);
+	ofi_lock_acquire(&rxd_ep->lock);
 	if (peer->state != CMAP_CONNECTED) {
 		ret = rxd_ep_connect(rxd_ep, peer, peer_addr);
-		fastlock_release(&rxd_ep->lock);
+		ofi_lock_release(&rxd_ep->lock);
 		if (ret == -FI_EALREADY) {
 			rxd_ep->util_ep.progress(&rxd_ep->util_ep);
 			ret = -FI_EAGAIN;
@@ -77,7 +79,7 @@ ssize_t	rxd_ep_readmsg(struct fid_ep *ep, const struct fi_msg_rma *msg,
 		rxd_tx_entry_free(rxd_ep, tx_entry);
 
 out:
-	fastlock_release(&rxd_ep->lock);
+	ofi_lock_release(&rxd_ep->lock);
 	return ret;
 }
 
@@ -149,12 +151,14 @@ ssize_t	rxd_ep_writemsg(struct fid_ep *ep, const struct fi_msg_rma *msg,
 
 	rxd_ep = container_of(ep, struct rxd_ep, util_ep.ep_fid);
 	peer_addr = rxd_av_dg_addr(rxd_ep_av(rxd_ep), msg->addr);
+	if (peer_addr >= rxd_ep->max_peers)
+		return -FI_EADDRNOTAVAIL;
 	peer = rxd_ep_getpeer_info(rxd_ep, peer_addr);
 
-	fastlock_acquire(&rxd_ep->lock);
+	ofi_lock_acquire(&rxd_ep->lock);
 	if (peer->state != CMAP_CONNECTED) {
 		ret = rxd_ep_connect(rxd_ep, peer, peer_addr);
-		fastlock_release(&rxd_ep->lock);
+		ofi_lock_release(&rxd_ep->lock);
 		if (ret == -FI_EALREADY) {
 			rxd_ep->util_ep.progress(&rxd_ep->util_ep);
 			ret = -FI_EAGAIN;
@@ -179,7 +183,7 @@ ssize_t	rxd_ep_writemsg(struct fid_ep *ep, const struct fi_msg_rma *msg,
 		rxd_tx_entry_free(rxd_ep, tx_entry);
 
 out:
-	fastlock_release(&rxd_ep->lock);
+	ofi_lock_release(&rxd_ep->lock);
 	return ret;
 }
 
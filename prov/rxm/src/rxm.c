@@ -34,17 +34,17 @@
 
 #define rxm_entry_pop(queue, entry)			\
 	do {						\
-		fastlock_acquire(&queue->lock);		\
+		ofi_lock_acquire(&queue->lock);		\
 		entry = freestack_isempty(queue->fs) ?	\
 			NULL : freestack_pop(queue->fs);\
-		fastlock_release(&queue->lock);		\
+		ofi_lock_release(&queue->lock);		\
 	} while (0)
 
 #define rxm_entry_push(queue, entry)			\
 	do {						\
-		fastlock_acquire(&queue->lock);		\
+		ofi_lock_acquire(&queue->lock);		\
 		freestack_push(queue->fs, entry);	\
-		fastlock_release(&queue->lock);		\
+		ofi_lock_release(&queue->lock);		\
 	} while (0)
 
 char *rxm_proto_state_str[] = {
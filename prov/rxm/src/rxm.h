@@ -50,6 +50,7 @@
 #include <fi_util.h>
 #include <fi_list.h>
 #include <fi_proto.h>
+#include <fi_trace.h>
 
 #ifndef _RXM_H_
 #define _RXM_H_
@@ -60,7 +61,16 @@
 #define RXM_MINOR_VERSION 0
 
 #define RXM_BUF_SIZE 16384
+/* Smallest tx/rx buffer block handed out by the buddy pools */
+#define RXM_BUF_MIN_SIZE 256
 #define RXM_IOV_LIMIT 4
+#define RXM_INJECT_BUF_SIZE 512
+#define RXM_CNTR_MAX 6
+
+/* Payload of an atomic request or batch, and of a fetch response.  It is
+ * capped to the eager size, which must leave room for the minimum. */
+#define RXM_ATOMIC_BUF_SIZE 4096
+#define RXM_ATOMIC_MIN_BUF_SIZE 256
 
 #define RXM_MR_VIRT_ADDR(info) ((info->domain_attr->mr_mode == FI_MR_BASIC) ||\
 				info->domain_attr->mr_mode & FI_MR_VIRT_ADDR)
@@ -69,9 +79,10 @@
 			       info->domain_attr->mr_mode & FI_MR_PROV_KEY)
 
 #define RXM_LOG_STATE(subsystem, pkt, prev_state, next_state) 			\
-	FI_DBG(&rxm_prov, subsystem, "[LMT] msg_id: 0x%" PRIx64 " %s -> %s\n",	\
-	       pkt.ctrl_hdr.msg_id, rxm_proto_state_str[prev_state],		\
-	       rxm_proto_state_str[next_state])
+	OFI_TRACE_DBG(&rxm_prov, subsystem,					\
+		      "[LMT] msg_id: 0x%" PRIx64 " %s -> %s\n",		\
+		      pkt.ctrl_hdr.msg_id, rxm_proto_state_str[prev_state],	\
+		      rxm_proto_state_str[next_state])
 
 #define RXM_LOG_STATE_TX(subsystem, tx_entry, next_state)		\
 	RXM_LOG_STATE(subsystem, tx_entry->tx_buf->pkt, tx_entry->state,\
@@ -82,9 +93,9 @@
 		      next_state)
 
 #define RXM_DBG_ADDR_TAG(subsystem, log_str, addr, tag) 	\
-	FI_DBG(&rxm_prov, subsystem, log_str 			\
-	       " (fi_addr: 0x%" PRIx64 " tag: 0x%" PRIx64 ")\n",\
-	       addr, tag)
+	OFI_TRACE_DBG(&rxm_prov, subsystem, log_str 		\
+		      " (fi_addr: 0x%" PRIx64 " tag: 0x%" PRIx64 ")\n",\
+		      addr, tag)
 
 #define RXM_GET_PROTO_STATE(comp)			\
 	(*(enum rxm_proto_state *)			\
@@ -101,26 +112,31 @@ do {									\
 extern struct fi_provider rxm_prov;
 extern struct util_prov rxm_util_prov;
 extern struct fi_ops_rma rxm_ops_rma;
+extern struct fi_ops_atomic rxm_ops_atomic;
+extern int rxm_send_agg_size;
+extern size_t rxm_buffer_size;
+extern size_t rxm_atomic_buf_size;
 
 struct rxm_fabric {
 	struct util_fabric util_fabric;
 	struct fid_fabric *msg_fabric;
 };
 
-struct rxm_conn {
-	struct fid_ep *msg_ep;
-	struct util_cmap_handle handle;
-};
 
 struct rxm_domain {
 	struct util_domain util_domain;
 	struct fid_domain *msg_domain;
 	uint8_t mr_local;
+	/* Target regions of software atomics, keyed by msg MR key */
+	struct ofi_mr_map mr_map;
 };
 
 struct rxm_mr {
 	struct fid_mr mr_fid;
 	struct fid_mr *msg_mr;
+	struct rxm_domain *domain;
+	/* Serializes atomics applied to this region */
+	ofi_lock_t amo_lock;
 };
 
 struct rxm_cm_data {
@@ -162,7 +178,13 @@ struct rxm_rma_iov {
 	FUNC(RXM_LMT_READ),	\
 	FUNC(RXM_LMT_ACK_SENT), \
 	FUNC(RXM_LMT_ACK_RECVD),\
-	FUNC(RXM_LMT_FINISH),
+	FUNC(RXM_LMT_FINISH),	\
+	FUNC(RXM_ATOMIC_TX),	\
+	FUNC(RXM_ATOMIC_RESP_WAIT),\
+	FUNC(RXM_ATOMIC_RESP_RECVD),\
+	FUNC(RXM_ATOMIC_BATCH_TX),\
+	FUNC(RXM_ATOMIC_BATCH_RESP_WAIT),\
+	FUNC(RXM_ATOMIC_BATCH_RESP_RECVD),
 
 enum rxm_proto_state {
 	RXM_PROTO_STATES(OFI_ENUM_VAL)
@@ -176,6 +198,64 @@ struct rxm_pkt {
 	char data[];
 };
 
+/*
+ * Atomic requests carry op_data records, each a header followed by the
+ * target iocs, the operand data and, for compare ops, the compare data.
+ * Records are padded to 8 bytes.
+ */
+struct rxm_atomic_hdr {
+	uint8_t datatype;
+	uint8_t op;
+	uint8_t ioc_count;
+	uint8_t resv[5];
+	struct ofi_rma_ioc rma_ioc[];
+};
+
+/*
+ * Every atomic request is answered.  fail_count records of the request
+ * failed with status, which is the first error seen.
+ */
+struct rxm_atomic_resp_hdr {
+	int32_t status;
+	uint32_t result_len;
+	uint32_t fail_count;
+	uint32_t resv;
+	char data[];
+};
+
+/*
+ * Aggregated sends carry one record per message: this header, the remote
+ * CQ data if flags has OFI_REMOTE_CQ_DATA, then the payload.  Records are
+ * padded to 8 bytes.
+ */
+struct rxm_agg_hdr {
+	uint8_t op;
+	uint8_t flags;
+	uint16_t resv;
+	uint32_t size;
+	uint64_t tag;
+	char data[];
+};
+
+struct rxm_conn {
+	struct fid_ep *msg_ep;
+	struct util_cmap_handle handle;
+	/* Completion-less atomics and small sends staged for this peer,
+	 * protected by the EP batch_lock.  At most one is set at a time. */
+	struct rxm_tx_buf *atomic_batch;
+	struct dlist_entry atomic_batch_entry;
+	struct rxm_tx_buf *send_agg;
+	struct dlist_entry send_agg_entry;
+	/* Set while a connection torn down with staged sends waits on the EP
+	 * conn_close_list for the application's progress to drop them */
+	struct dlist_entry close_entry;
+	int closing;
+	int free_pending;
+	/* Pre-built header for small injects; only op, size, tag and
+	 * data are patched per send.  Must stay at the bottom. */
+	struct rxm_pkt inject_pkt;
+};
+
 struct rxm_recv_match_attr {
 	fi_addr_t addr;
 	uint64_t tag;
@@ -204,6 +284,8 @@ struct rxm_buf {
 	void *desc;
 	/* MSG EP / shared context to which bufs would be posted to */
 	struct fid_ep *msg_ep;
+	struct util_buddy_region *region;
+	size_t size;
 };
 
 struct rxm_rx_buf {
@@ -223,6 +305,14 @@ struct rxm_rx_buf {
 	size_t index;
 	struct fid_mr *mr[RXM_IOV_LIMIT];
 
+	/* An aggregate that ran out of rx buffers, and packets from the same
+	 * MSG EP received after it, wait on the EP rx_stall_list */
+	struct dlist_entry stall_entry;
+	int stalled;
+	/* Next aggregated record to unpack */
+	size_t agg_rec;
+	size_t agg_offset;
+
 	struct rxm_pkt pkt;
 };
 
@@ -246,9 +336,18 @@ struct rxm_tx_entry {
 	uint64_t comp_flags;
 	struct rxm_tx_buf *tx_buf;
 
+	/* Sends posted with FI_MORE, queued on the EP deferred_list */
+	struct dlist_entry deferred_entry;
+	size_t pkt_size;
+
 	/* Used for large messages */
 	struct fid_mr *mr[RXM_IOV_LIMIT];
 	struct rxm_rx_buf *rx_buf;
+
+	/* Used for atomics */
+	struct rxm_iov result_iov;
+	int atomic_status;
+	uint8_t atomic_fail_count;
 };
 DECLARE_FREESTACK(struct rxm_tx_entry, rxm_txe_fs);
 
@@ -269,7 +368,7 @@ DECLARE_FREESTACK(struct rxm_recv_entry, rxm_recv_fs);
 struct rxm_send_queue {
 	struct rxm_txe_fs *fs;
 	struct ofi_key_idx tx_key_idx;
-	fastlock_t lock;
+	ofi_lock_t lock;
 };
 
 enum rxm_recv_queue_type {
@@ -284,14 +383,38 @@ struct rxm_recv_queue {
 	struct dlist_entry unexp_msg_list;
 	dlist_func_t *match_recv;
 	dlist_func_t *match_unexp;
-	fastlock_t lock;
+	ofi_lock_t lock;
 };
 
+/*
+ * Buffers are carved from registered regions by a buddy allocator, so
+ * that each takes the power-of-two block fitting its header and payload.
+ * Receive buffers posted to MSG endpoints take a block of
+ * rxm_buffer_size, the largest eager message; buffers that hold a
+ * message past its completion use the smaller classes.
+ */
 struct rxm_buf_pool {
-	struct util_buf_pool *pool;
+	struct util_buddy_pool *pool;
 	struct dlist_entry buf_list;
 	uint8_t local_mr;
-	fastlock_t lock;
+	ofi_lock_t lock;
+};
+
+enum rxm_stat {
+	RXM_STAT_TX_MSGS,
+	RXM_STAT_TX_INJECT,
+	RXM_STAT_TX_LMT,
+	RXM_STAT_TX_SIZE,
+	RXM_STAT_RX_MSGS,
+	RXM_STAT_UNEXP_MSGS,
+	RXM_STAT_UNEXP_DEPTH,
+	RXM_STAT_TX_BUF_BYTES,
+	RXM_STAT_RX_BUF_BYTES,
+	RXM_STAT_TX_ATOMICS,
+	RXM_STAT_ATOMIC_BATCH,
+	RXM_STAT_RX_ATOMICS,
+	RXM_STAT_SEND_AGG,
+	RXM_STAT_MAX,
 };
 
 struct rxm_ep {
@@ -304,13 +427,33 @@ struct rxm_ep {
 	int			msg_cq_fd;
 	struct fid_ep 		*srx_ctx;
 	size_t 			comp_per_progress;
+	size_t			inject_limit;
+	size_t			send_agg_size;
+
+	/* Connected peers indexed by fi_addr, read without the cmap lock */
+	struct rxm_conn * volatile *conn_cache;
+	size_t			conn_cache_size;
 
 	struct rxm_buf_pool 	tx_pool;
 	struct rxm_buf_pool 	rx_pool;
+	struct dlist_entry	rx_stall_list;
 
 	struct rxm_send_queue 	send_queue;
 	struct rxm_recv_queue 	recv_queue;
 	struct rxm_recv_queue 	trecv_queue;
+
+	/* Connections with staged atomics or aggregated sends */
+	struct dlist_entry	atomic_batch_list;
+	struct dlist_entry	send_agg_list;
+	/* Sends posted with FI_MORE, in posting order.  deferred_cnt lets the
+	 * data path check for them without taking batch_lock. */
+	struct dlist_entry	deferred_list;
+	ofi_atomic32_t		deferred_cnt;
+	/* Shut down connections whose staged sends are still to be dropped */
+	struct dlist_entry	conn_close_list;
+	fastlock_t		batch_lock;
+
+	struct ofi_stats	stats;
 };
 
 extern struct fi_provider rxm_prov;
@@ -352,17 +495,93 @@ int rxm_info_to_rxm(uint32_t version, const struct fi_info *core_info,
 		    struct fi_info *info);
 int rxm_domain_open(struct fid_fabric *fabric, struct fi_info *info,
 			     struct fid_domain **dom, void *context);
+int rxm_cntr_open(struct fid_domain *domain, struct fi_cntr_attr *attr,
+		  struct fid_cntr **cntr_fid, void *context);
 int rxm_cq_open(struct fid_domain *domain, struct fi_cq_attr *attr,
 			 struct fid_cq **cq_fid, void *context);
 void rxm_cq_progress(struct rxm_ep *rxm_ep);
 int rxm_cq_handle_data(struct rxm_rx_buf *rx_buf);
+struct rxm_conn *rxm_key2conn(struct rxm_ep *rxm_ep, uint64_t key);
+int rxm_finish_send(struct rxm_tx_entry *tx_entry);
+
+int rxm_query_atomic(struct fid_domain *domain, enum fi_datatype datatype,
+		     enum fi_op op, struct fi_atomic_attr *attr,
+		     uint64_t flags);
+int rxm_atomic_handle_req(struct rxm_rx_buf *rx_buf);
+int rxm_atomic_handle_resp(struct rxm_rx_buf *rx_buf);
+int rxm_atomic_send_comp(struct rxm_tx_entry *tx_entry);
+int rxm_atomic_batch_comp(struct rxm_tx_entry *tx_entry);
+void rxm_atomic_batch_fail(struct rxm_ep *rxm_ep, uint8_t count, int err);
+int rxm_atomic_flush(struct rxm_ep *rxm_ep, struct rxm_conn *rxm_conn);
+void rxm_atomic_flush_all(struct rxm_ep *rxm_ep);
+void rxm_atomic_conn_close(struct rxm_ep *rxm_ep, struct rxm_conn *rxm_conn);
+
+int rxm_send_agg_flush(struct rxm_ep *rxm_ep, struct rxm_conn *rxm_conn);
+void rxm_send_agg_flush_all(struct rxm_ep *rxm_ep);
+void rxm_send_agg_conn_close(struct rxm_ep *rxm_ep, struct rxm_conn *rxm_conn);
+int rxm_deferred_flush(struct rxm_ep *rxm_ep);
+void rxm_deferred_conn_close(struct rxm_ep *rxm_ep, struct rxm_conn *rxm_conn);
+
+static inline int rxm_conn_atomic_flush(struct rxm_ep *rxm_ep,
+					struct rxm_conn *rxm_conn)
+{
+	return rxm_conn->atomic_batch ? rxm_atomic_flush(rxm_ep, rxm_conn) : 0;
+}
+
+static inline int rxm_conn_send_agg_flush(struct rxm_ep *rxm_ep,
+					  struct rxm_conn *rxm_conn)
+{
+	return rxm_conn->send_agg ? rxm_send_agg_flush(rxm_ep, rxm_conn) : 0;
+}
+
+static inline int rxm_ep_deferred_flush(struct rxm_ep *rxm_ep)
+{
+	return ofi_atomic_get32(&rxm_ep->deferred_cnt) ?
+	       rxm_deferred_flush(rxm_ep) : 0;
+}
+
+/* Deferred sends, then staged atomics and sends go out before any other
+ * operation to the same peer */
+static inline int rxm_conn_flush(struct rxm_ep *rxm_ep,
+				 struct rxm_conn *rxm_conn)
+{
+	int ret;
+
+	ret = rxm_ep_deferred_flush(rxm_ep);
+	if (ret)
+		return ret;
+	ret = rxm_conn_atomic_flush(rxm_ep, rxm_conn);
+	return ret ? ret : rxm_conn_send_agg_flush(rxm_ep, rxm_conn);
+}
 
 int rxm_endpoint(struct fid_domain *domain, struct fi_info *info,
 			  struct fid_ep **ep, void *context);
+int rxm_scalable_ep(struct fid_domain *domain, struct fi_info *info,
+		    struct fid_ep **sep, void *context);
 
 struct util_cmap *rxm_conn_cmap_alloc(struct rxm_ep *rxm_ep);
+int rxm_conn_get_slow(struct rxm_ep *rxm_ep, fi_addr_t fi_addr,
+		      struct rxm_conn **rxm_conn);
+void rxm_conn_close_all(struct rxm_ep *rxm_ep);
+
+/* A cached entry is only published once the connection is established and
+ * its inject header has been built, and is cleared before the msg EP is
+ * closed, so the lookup needs no lock.  The cache has an entry per rx
+ * context of each peer. */
+static inline int rxm_ep_get_conn(struct rxm_ep *rxm_ep, fi_addr_t fi_addr,
+				  struct rxm_conn **rxm_conn)
+{
+	size_t index = ofi_av_ctx_index(rxm_ep->util_ep.av, fi_addr);
+
+	if (index < rxm_ep->conn_cache_size &&
+	    (*rxm_conn = rxm_ep->conn_cache[index]))
+		return 0;
+	return rxm_conn_get_slow(rxm_ep, fi_addr, rxm_conn);
+}
 
 int rxm_ep_repost_buf(struct rxm_rx_buf *buf);
+int rxm_ep_send_ctrl(struct rxm_ep *rxm_ep, struct fid_ep *msg_ep,
+		     struct rxm_tx_buf *tx_buf);
 int rxm_ep_prepost_buf(struct rxm_ep *rxm_ep, struct fid_ep *msg_ep);
 
 int ofi_match_addr(fi_addr_t addr, fi_addr_t match_addr);
@@ -371,9 +590,17 @@ void rxm_pkt_init(struct rxm_pkt *pkt);
 int rxm_ep_msg_mr_regv(struct rxm_ep *rxm_ep, const struct iovec *iov,
 		       size_t count, uint64_t access, struct fid_mr **mr);
 void rxm_ep_msg_mr_closev(struct fid_mr **mr, size_t count);
-struct rxm_buf *rxm_buf_get(struct rxm_buf_pool *pool);
+struct rxm_buf *rxm_buf_get(struct rxm_buf_pool *pool, size_t size);
 void rxm_buf_release(struct rxm_buf_pool *pool, struct rxm_buf *buf);
 
+/* tx buffer with room for len bytes of packet payload */
+static inline struct rxm_tx_buf *rxm_tx_buf_get(struct rxm_ep *rxm_ep,
+						size_t len)
+{
+	return (struct rxm_tx_buf *)
+		rxm_buf_get(&rxm_ep->tx_pool, sizeof(struct rxm_tx_buf) + len);
+}
+
 struct rxm_tx_entry *rxm_tx_entry_get(struct rxm_send_queue *queue);
 struct rxm_recv_entry *rxm_recv_entry_get(struct rxm_recv_queue *queue);
 
@@ -0,0 +1,998 @@
+/*
+ * Copyright (c) 2017 Intel Corporation. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <fi_iov.h>
+#include <ofi_atomic.h>
+#include "rxm.h"
+
+#define RXM_ATOMIC_MAX_DATA ((rxm_atomic_buf_size -			\
+			      sizeof(struct rxm_atomic_hdr) -		\
+			      RXM_IOV_LIMIT * sizeof(struct ofi_rma_ioc)) / 2)
+
+static uint64_t rxm_atomic_valid_flags(int op)
+{
+	return op == ofi_op_atomic_fetch ? FI_FETCH_ATOMIC :
+	       op == ofi_op_atomic_compare ? FI_COMPARE_ATOMIC : 0;
+}
+
+static size_t rxm_atomic_rec_len(size_t ioc_count, size_t data_len, int op)
+{
+	if (op == ofi_op_atomic_compare)
+		data_len *= 2;
+	return fi_get_aligned_sz(sizeof(struct rxm_atomic_hdr) +
+				 ioc_count * sizeof(struct ofi_rma_ioc) +
+				 data_len, 8);
+}
+
+static size_t rxm_atomic_data_len(const struct rxm_atomic_hdr *hdr)
+{
+	size_t i, count = 0;
+
+	for (i = 0; i < hdr->ioc_count; i++)
+		count += hdr->rma_ioc[i].count;
+	return count * ofi_datatype_size(hdr->datatype);
+}
+
+static ssize_t
+rxm_atomic_check(const struct fi_msg_atomic *msg, const struct fi_ioc *comparev,
+		 size_t compare_count, const struct fi_ioc *resultv,
+		 size_t result_count, int op, size_t *data_len)
+{
+	size_t i, count = 0;
+	ssize_t ret;
+
+	ret = ofi_atomic_valid(&rxm_prov, msg->datatype, msg->op,
+			       rxm_atomic_valid_flags(op));
+	if (ret)
+		return ret;
+
+	if (msg->iov_count > RXM_IOV_LIMIT ||
+	    msg->rma_iov_count > RXM_IOV_LIMIT ||
+	    compare_count > RXM_IOV_LIMIT || result_count > RXM_IOV_LIMIT)
+		return -FI_EINVAL;
+
+	for (i = 0; i < msg->rma_iov_count; i++)
+		count += msg->rma_iov[i].count;
+
+	if (count != ofi_total_ioc_cnt(msg->msg_iov, msg->iov_count) ||
+	    (comparev && count != ofi_total_ioc_cnt(comparev, compare_count)) ||
+	    (resultv && count != ofi_total_ioc_cnt(resultv, result_count)))
+		return -FI_EINVAL;
+
+	*data_len = count * ofi_datatype_size(msg->datatype);
+	return *data_len > RXM_ATOMIC_MAX_DATA ? -FI_EMSGSIZE : 0;
+}
+
+static char *rxm_atomic_copy_ioc(char *data, const struct fi_ioc *ioc,
+				 size_t count, size_t dt_size)
+{
+	size_t i, len;
+
+	for (i = 0; i < count; i++) {
+		len = ioc[i].count * dt_size;
+		memcpy(data, ioc[i].addr, len);
+		data += len;
+	}
+	return data;
+}
+
+static size_t rxm_atomic_rec_init(struct rxm_atomic_hdr *hdr,
+				  const struct fi_msg_atomic *msg,
+				  const struct fi_ioc *comparev,
+				  size_t compare_count, size_t data_len, int op)
+{
+	size_t dt_size = ofi_datatype_size(msg->datatype);
+	char *data;
+	size_t i;
+
+	hdr->datatype = msg->datatype;
+	hdr->op = msg->op;
+	hdr->ioc_count = msg->rma_iov_count;
+	for (i = 0; i < msg->rma_iov_count; i++) {
+		hdr->rma_ioc[i].addr = msg->rma_iov[i].addr;
+		hdr->rma_ioc[i].count = msg->rma_iov[i].count;
+		hdr->rma_ioc[i].key = msg->rma_iov[i].key;
+	}
+
+	/* FI_ATOMIC_READ carries no operand and may pass a NULL buffer */
+	data = (char *) &hdr->rma_ioc[i];
+	if (msg->op != FI_ATOMIC_READ)
+		rxm_atomic_copy_ioc(data, msg->msg_iov, msg->iov_count, dt_size);
+	if (op == ofi_op_atomic_compare)
+		rxm_atomic_copy_ioc(data + data_len, comparev, compare_count,
+				    dt_size);
+
+	return rxm_atomic_rec_len(msg->rma_iov_count, data_len, op);
+}
+
+static void rxm_atomic_pkt_init(struct rxm_tx_buf *tx_buf,
+				struct rxm_conn *rxm_conn, int op)
+{
+	rxm_pkt_init(&tx_buf->pkt);
+	tx_buf->pkt.ctrl_hdr.type = ofi_ctrl_atomic;
+	tx_buf->pkt.ctrl_hdr.conn_id = rxm_conn->handle.remote_key;
+	tx_buf->pkt.hdr.op = op;
+	tx_buf->hdr.msg_ep = rxm_conn->msg_ep;
+}
+
+static uint64_t rxm_atomic_msg_id(struct rxm_ep *rxm_ep,
+				  struct rxm_tx_entry *tx_entry)
+{
+	uint64_t msg_id;
+
+	ofi_lock_acquire(&rxm_ep->send_queue.lock);
+	msg_id = ofi_idx2key(&rxm_ep->send_queue.tx_key_idx,
+			     rxm_txe_fs_index(rxm_ep->send_queue.fs, tx_entry));
+	ofi_lock_release(&rxm_ep->send_queue.lock);
+	return msg_id;
+}
+
+/* Staged ops are only counted once the target has applied the batch */
+static int rxm_atomic_batch_finish(struct rxm_tx_entry *tx_entry)
+{
+	struct rxm_ep *rxm_ep = tx_entry->ep;
+	uint8_t done = tx_entry->count - tx_entry->atomic_fail_count;
+
+	if (tx_entry->atomic_fail_count)
+		rxm_atomic_batch_fail(rxm_ep, tx_entry->atomic_fail_count,
+				      tx_entry->atomic_status);
+	if (done && rxm_ep->util_ep.wr_cntr)
+		fi_cntr_add(&rxm_ep->util_ep.wr_cntr->cntr_fid, done);
+	rxm_buf_release(&rxm_ep->tx_pool, (struct rxm_buf *) tx_entry->tx_buf);
+	rxm_tx_entry_release(&rxm_ep->send_queue, tx_entry);
+	return 0;
+}
+
+int rxm_atomic_batch_comp(struct rxm_tx_entry *tx_entry)
+{
+	if (tx_entry->state == RXM_ATOMIC_BATCH_RESP_RECVD)
+		return rxm_atomic_batch_finish(tx_entry);
+
+	RXM_LOG_STATE_TX(FI_LOG_CQ, tx_entry, RXM_ATOMIC_BATCH_RESP_WAIT);
+	tx_entry->state = RXM_ATOMIC_BATCH_RESP_WAIT;
+	return 0;
+}
+
+void rxm_atomic_batch_fail(struct rxm_ep *rxm_ep, uint8_t count, int err)
+{
+	struct fi_cq_err_entry err_entry = {0};
+
+	FI_WARN(&rxm_prov, FI_LOG_EP_DATA, "%d staged atomics failed: %s\n",
+		count, fi_strerror(-err));
+	err_entry.flags = FI_ATOMIC | FI_WRITE;
+	err_entry.err = -err;
+	err_entry.prov_errno = err;
+	for (; count; count--) {
+		if (rxm_ep->util_ep.wr_cntr)
+			ofi_cntr_inc_err(rxm_ep->util_ep.wr_cntr);
+		if (rxm_ep->util_ep.tx_cq &&
+		    ofi_cq_write_error(rxm_ep->util_ep.tx_cq, &err_entry))
+			FI_WARN(&rxm_prov, FI_LOG_CQ,
+				"Unable to report completion\n");
+	}
+}
+
+static void rxm_atomic_batch_drop(struct rxm_ep *rxm_ep,
+				  struct rxm_conn *rxm_conn, int err)
+{
+	struct rxm_tx_buf *tx_buf = rxm_conn->atomic_batch;
+
+	rxm_atomic_batch_fail(rxm_ep, tx_buf->pkt.hdr.op_data, err);
+	rxm_buf_release(&rxm_ep->tx_pool, (struct rxm_buf *) tx_buf);
+	rxm_conn->atomic_batch = NULL;
+	dlist_remove(&rxm_conn->atomic_batch_entry);
+}
+
+/* A batch that cannot be sent for any reason but a full queue is failed */
+static int rxm_atomic_flush_locked(struct rxm_ep *rxm_ep,
+				   struct rxm_conn *rxm_conn)
+{
+	struct rxm_tx_buf *tx_buf = rxm_conn->atomic_batch;
+	struct rxm_tx_entry *tx_entry;
+	uint8_t count = tx_buf->pkt.hdr.op_data;
+	int ret;
+
+	tx_entry = rxm_tx_entry_get(&rxm_ep->send_queue);
+	if (!tx_entry)
+		return -FI_EAGAIN;
+
+	memset(tx_entry, 0, sizeof(*tx_entry));
+	tx_entry->state = RXM_ATOMIC_BATCH_TX;
+	tx_entry->ep = rxm_ep;
+	tx_entry->count = count;
+	tx_entry->tx_buf = tx_buf;
+	tx_buf->pkt.ctrl_hdr.msg_id = rxm_atomic_msg_id(rxm_ep, tx_entry);
+
+	ret = fi_send(rxm_conn->msg_ep, &tx_buf->pkt,
+		      sizeof(tx_buf->pkt) + tx_buf->pkt.hdr.size,
+		      tx_buf->hdr.desc, 0, tx_entry);
+	if (ret) {
+		rxm_tx_entry_release(&rxm_ep->send_queue, tx_entry);
+		if (ret != -FI_EAGAIN)
+			rxm_atomic_batch_drop(rxm_ep, rxm_conn, ret);
+		return ret;
+	}
+
+	ofi_stats_hist(&rxm_ep->stats, RXM_STAT_ATOMIC_BATCH, count);
+	rxm_conn->atomic_batch = NULL;
+	dlist_remove(&rxm_conn->atomic_batch_entry);
+	return 0;
+}
+
+int rxm_atomic_flush(struct rxm_ep *rxm_ep, struct rxm_conn *rxm_conn)
+{
+	int ret = 0;
+
+	fastlock_acquire(&rxm_ep->batch_lock);
+	if (rxm_conn->atomic_batch)
+		ret = rxm_atomic_flush_locked(rxm_ep, rxm_conn);
+	fastlock_release(&rxm_ep->batch_lock);
+	if (ret == -FI_EAGAIN)
+		rxm_cq_progress(rxm_ep);
+	return ret;
+}
+
+void rxm_atomic_flush_all(struct rxm_ep *rxm_ep)
+{
+	struct rxm_conn *rxm_conn;
+	struct dlist_entry *tmp;
+
+	fastlock_acquire(&rxm_ep->batch_lock);
+	dlist_foreach_container_safe(&rxm_ep->atomic_batch_list,
+				     struct rxm_conn, rxm_conn,
+				     atomic_batch_entry, tmp) {
+		if (rxm_atomic_flush_locked(rxm_ep, rxm_conn))
+			break;
+	}
+	fastlock_release(&rxm_ep->batch_lock);
+}
+
+void rxm_atomic_conn_close(struct rxm_ep *rxm_ep, struct rxm_conn *rxm_conn)
+{
+	fastlock_acquire(&rxm_ep->batch_lock);
+	if (rxm_conn->atomic_batch &&
+	    rxm_atomic_flush_locked(rxm_ep, rxm_conn) &&
+	    rxm_conn->atomic_batch)
+		rxm_atomic_batch_drop(rxm_ep, rxm_conn, -FI_ECANCELED);
+	fastlock_release(&rxm_ep->batch_lock);
+}
+
+/*
+ * Atomic writes that don't request a completion are appended to a
+ * per-peer packet, and are reported to the write counter when the target's
+ * response to the packet arrives.  The target applies the records in order,
+ * so the batch preserves ordering per target region.
+ */
+static ssize_t rxm_ep_atomic_batch(struct rxm_ep *rxm_ep,
+				   struct rxm_conn *rxm_conn,
+				   const struct fi_msg_atomic *msg,
+				   size_t data_len)
+{
+	struct rxm_tx_buf *tx_buf;
+	struct rxm_pkt *pkt;
+	size_t len;
+	ssize_t ret = 0;
+
+	len = rxm_atomic_rec_len(msg->rma_iov_count, data_len, ofi_op_atomic);
+
+	fastlock_acquire(&rxm_ep->batch_lock);
+	tx_buf = rxm_conn->atomic_batch;
+	if (tx_buf && (tx_buf->pkt.hdr.op_data == UINT8_MAX ||
+		       tx_buf->pkt.hdr.size + len > rxm_atomic_buf_size)) {
+		ret = rxm_atomic_flush_locked(rxm_ep, rxm_conn);
+		if (ret)
+			goto unlock;
+		tx_buf = NULL;
+	}
+
+	if (!tx_buf) {
+		tx_buf = rxm_tx_buf_get(rxm_ep, rxm_atomic_buf_size);
+		if (!tx_buf) {
+			ret = -FI_EAGAIN;
+			goto unlock;
+		}
+		rxm_atomic_pkt_init(tx_buf, rxm_conn, ofi_op_atomic);
+		rxm_conn->atomic_batch = tx_buf;
+		dlist_insert_tail(&rxm_conn->atomic_batch_entry,
+				  &rxm_ep->atomic_batch_list);
+	}
+
+	pkt = &tx_buf->pkt;
+	rxm_atomic_rec_init((struct rxm_atomic_hdr *) (pkt->data + pkt->hdr.size),
+			    msg, NULL, 0, data_len, ofi_op_atomic);
+	pkt->hdr.size += len;
+	pkt->hdr.op_data++;
+	ofi_stats_inc(&rxm_ep->stats, RXM_STAT_TX_ATOMICS);
+unlock:
+	fastlock_release(&rxm_ep->batch_lock);
+	if (ret == -FI_EAGAIN)
+		rxm_cq_progress(rxm_ep);
+	return ret;
+}
+
+static ssize_t
+rxm_ep_atomic_common(struct rxm_ep *rxm_ep, const struct fi_msg_atomic *msg,
+		     const struct fi_ioc *comparev, size_t compare_count,
+		     const struct fi_ioc *resultv, size_t result_count,
+		     uint64_t flags, int op)
+{
+	struct rxm_tx_entry *tx_entry;
+	struct rxm_tx_buf *tx_buf;
+	struct rxm_conn *rxm_conn;
+	size_t data_len, dt_size, i;
+	ssize_t ret;
+
+	ret = rxm_atomic_check(msg, comparev, compare_count, resultv,
+			       result_count, op, &data_len);
+	if (ret)
+		return ret;
+
+	ret = rxm_ep_get_conn(rxm_ep, msg->addr, &rxm_conn);
+	if (ret)
+		return ret;
+
+	if (op == ofi_op_atomic && !(flags & FI_COMPLETION)) {
+		ret = rxm_conn_send_agg_flush(rxm_ep, rxm_conn);
+		return ret ? ret : rxm_ep_atomic_batch(rxm_ep, rxm_conn, msg,
+						       data_len);
+	}
+
+	ret = rxm_conn_flush(rxm_ep, rxm_conn);
+	if (ret)
+		return ret;
+
+	tx_buf = rxm_tx_buf_get(rxm_ep, rxm_atomic_rec_len(msg->rma_iov_count,
+							   data_len, op));
+	if (!tx_buf) {
+		FI_WARN(&rxm_prov, FI_LOG_EP_DATA, "TX queue full!\n");
+		rxm_cq_progress(rxm_ep);
+		return -FI_EAGAIN;
+	}
+
+	if (!(tx_entry = rxm_tx_entry_get(&rxm_ep->send_queue))) {
+		rxm_cq_progress(rxm_ep);
+		ret = -FI_EAGAIN;
+		goto err1;
+	}
+
+	memset(tx_entry, 0, sizeof(*tx_entry));
+	tx_entry->ep = rxm_ep;
+	tx_entry->context = msg->context;
+	tx_entry->flags = flags;
+	tx_entry->tx_buf = tx_buf;
+
+	rxm_atomic_pkt_init(tx_buf, rxm_conn, op);
+	tx_buf->pkt.hdr.op_data = 1;
+	tx_buf->pkt.hdr.size =
+		rxm_atomic_rec_init((struct rxm_atomic_hdr *) tx_buf->pkt.data,
+				    msg, comparev, compare_count, data_len, op);
+
+	/* Atomics complete once the target's response arrives */
+	tx_entry->state = RXM_ATOMIC_TX;
+	tx_buf->pkt.ctrl_hdr.msg_id = rxm_atomic_msg_id(rxm_ep, tx_entry);
+	if (op == ofi_op_atomic) {
+		tx_entry->comp_flags = FI_ATOMIC | FI_WRITE;
+	} else {
+		tx_entry->comp_flags = FI_ATOMIC | FI_READ;
+
+		dt_size = ofi_datatype_size(msg->datatype);
+		for (i = 0; i < result_count; i++) {
+			tx_entry->result_iov.iov[i].iov_base = resultv[i].addr;
+			tx_entry->result_iov.iov[i].iov_len =
+				resultv[i].count * dt_size;
+		}
+		tx_entry->result_iov.count = result_count;
+	}
+
+	ret = fi_send(rxm_conn->msg_ep, &tx_buf->pkt,
+		      sizeof(tx_buf->pkt) + tx_buf->pkt.hdr.size,
+		      tx_buf->hdr.desc, 0, tx_entry);
+	if (ret) {
+		if (ret == -FI_EAGAIN)
+			rxm_cq_progress(rxm_ep);
+		goto err2;
+	}
+	ofi_stats_inc(&rxm_ep->stats, RXM_STAT_TX_ATOMICS);
+	return 0;
+err2:
+	rxm_tx_entry_release(&rxm_ep->send_queue, tx_entry);
+err1:
+	rxm_buf_release(&rxm_ep->tx_pool, (struct rxm_buf *) tx_buf);
+	return ret;
+}
+
+static void rxm_atomic_op(int op, enum fi_datatype datatype,
+			  enum fi_op atomic_op, void *dst, const void *src,
+			  const void *cmp, void *res, size_t count)
+{
+	switch (op) {
+	case ofi_op_atomic:
+		ofi_atomic_write_handlers[atomic_op][datatype]
+			(dst, src, count);
+		break;
+	case ofi_op_atomic_fetch:
+		ofi_atomic_readwrite_handlers[atomic_op][datatype]
+			(dst, src, res, count);
+		break;
+	default:
+		ofi_atomic_swap_handlers[atomic_op - OFI_SWAP_OP_START][datatype]
+			(dst, src, cmp, res, count);
+		break;
+	}
+}
+
+static int rxm_atomic_apply(struct rxm_ep *rxm_ep,
+			    const struct rxm_atomic_hdr *hdr, int op,
+			    size_t data_len, char *result)
+{
+	struct rxm_domain *rxm_domain;
+	struct rxm_mr *rxm_mr;
+	const char *src, *cmp;
+	uint64_t access;
+	uintptr_t addr;
+	size_t dt_size, len, i;
+	int ret;
+
+	ret = ofi_atomic_valid(&rxm_prov, hdr->datatype, hdr->op,
+			       rxm_atomic_valid_flags(op));
+	if (ret)
+		return ret;
+
+	rxm_domain = container_of(rxm_ep->util_ep.domain, struct rxm_domain,
+				  util_domain);
+	access = (op == ofi_op_atomic) ? FI_REMOTE_WRITE :
+		 (hdr->op == FI_ATOMIC_READ) ? FI_REMOTE_READ :
+		 FI_REMOTE_WRITE | FI_REMOTE_READ;
+	dt_size = ofi_datatype_size(hdr->datatype);
+	src = (const char *) &hdr->rma_ioc[hdr->ioc_count];
+	cmp = src + data_len;
+
+	for (i = 0; i < hdr->ioc_count; i++) {
+		addr = hdr->rma_ioc[i].addr;
+		len = hdr->rma_ioc[i].count * dt_size;
+
+		fastlock_acquire(&rxm_domain->util_domain.lock);
+		ret = ofi_mr_verify(&rxm_domain->mr_map, &addr, len,
+				    hdr->rma_ioc[i].key, access,
+				    (void **) &rxm_mr);
+		fastlock_release(&rxm_domain->util_domain.lock);
+		if (ret)
+			return ret;
+
+		ofi_lock_acquire(&rxm_mr->amo_lock);
+		rxm_atomic_op(op, hdr->datatype, hdr->op, (void *) addr,
+			      src, cmp, result, hdr->rma_ioc[i].count);
+		ofi_lock_release(&rxm_mr->amo_lock);
+
+		src += len;
+		cmp += len;
+		if (result)
+			result += len;
+	}
+	return 0;
+}
+
+static int rxm_atomic_send_resp(struct rxm_rx_buf *rx_buf,
+				struct rxm_tx_buf *resp_buf, int status,
+				uint32_t fail_count, size_t result_len)
+{
+	struct rxm_atomic_resp_hdr *resp;
+	int ret;
+
+	resp = (struct rxm_atomic_resp_hdr *) resp_buf->pkt.data;
+	resp->status = status;
+	resp->result_len = status ? 0 : result_len;
+	resp->fail_count = fail_count;
+	resp->resv = 0;
+
+	resp_buf->pkt.ctrl_hdr.type = ofi_ctrl_atomic_resp;
+	resp_buf->pkt.ctrl_hdr.msg_id = rx_buf->pkt.ctrl_hdr.msg_id;
+	resp_buf->pkt.hdr.size = sizeof(*resp) + resp->result_len;
+
+	ret = rxm_ep_send_ctrl(rx_buf->ep, rx_buf->conn->msg_ep, resp_buf);
+	if (ret) {
+		FI_WARN(&rxm_prov, FI_LOG_CQ,
+			"Unable to send atomic response\n");
+		rxm_buf_release(&rx_buf->ep->tx_pool,
+				(struct rxm_buf *) resp_buf);
+	}
+	return ret;
+}
+
+/*
+ * A request waits on the rx_stall_list while no response buffer is
+ * available, holding back later packets from the same peer.
+ */
+int rxm_atomic_handle_req(struct rxm_rx_buf *rx_buf)
+{
+	struct rxm_ep *rxm_ep = rx_buf->ep;
+	struct rxm_pkt *pkt = &rx_buf->pkt;
+	struct rxm_tx_buf *resp_buf;
+	struct rxm_atomic_hdr *hdr;
+	struct util_cntr *cntr;
+	size_t offset, data_len = 0, result_len = 0;
+	uint32_t fail_count = 0;
+	char *result = NULL;
+	int i, ret, status = 0;
+
+	if (!rx_buf->conn)
+		rx_buf->conn = rxm_key2conn(rxm_ep, pkt->ctrl_hdr.conn_id);
+	resp_buf = rx_buf->conn ?
+		   rxm_tx_buf_get(rxm_ep, rxm_atomic_buf_size) : NULL;
+	if (rx_buf->conn && !resp_buf) {
+		FI_WARN(&rxm_prov, FI_LOG_CQ, "TX queue full!\n");
+		if (!rx_buf->stalled) {
+			rx_buf->stalled = 1;
+			dlist_insert_tail(&rx_buf->stall_entry,
+					  &rxm_ep->rx_stall_list);
+		}
+		return 0;
+	}
+	if (rx_buf->stalled) {
+		rx_buf->stalled = 0;
+		dlist_remove(&rx_buf->stall_entry);
+	}
+	if (!rx_buf->conn)
+		return -FI_EOTHER;
+	rxm_atomic_pkt_init(resp_buf, rx_buf->conn, pkt->hdr.op);
+	if (pkt->hdr.op != ofi_op_atomic)
+		result = ((struct rxm_atomic_resp_hdr *) resp_buf->pkt.data)->data;
+
+	cntr = (pkt->hdr.op == ofi_op_atomic_fetch) ?
+	       rxm_ep->util_ep.rem_rd_cntr : rxm_ep->util_ep.rem_wr_cntr;
+
+	for (i = 0, offset = 0; i < pkt->hdr.op_data; i++) {
+		hdr = (struct rxm_atomic_hdr *) (pkt->data + offset);
+		if (offset + sizeof(*hdr) > pkt->hdr.size ||
+		    hdr->ioc_count > RXM_IOV_LIMIT)
+			goto malformed;
+		data_len = rxm_atomic_data_len(hdr);
+		offset += rxm_atomic_rec_len(hdr->ioc_count, data_len,
+					     pkt->hdr.op);
+		if (offset > pkt->hdr.size || data_len > RXM_ATOMIC_MAX_DATA)
+			goto malformed;
+
+		ret = rxm_atomic_apply(rxm_ep, hdr, pkt->hdr.op, data_len,
+				       result);
+		if (ret) {
+			FI_WARN(&rxm_prov, FI_LOG_CQ,
+				"Unable to apply atomic: %s\n",
+				fi_strerror(-ret));
+			if (!status)
+				status = ret;
+			fail_count++;
+			continue;
+		}
+		result_len += data_len;
+		if (cntr)
+			ofi_cntr_inc(cntr);
+	}
+	ofi_stats_add(&rxm_ep->stats, RXM_STAT_RX_ATOMICS, i);
+	goto respond;
+malformed:
+	FI_WARN(&rxm_prov, FI_LOG_CQ, "Malformed atomic request\n");
+	if (!status)
+		status = -FI_EINVAL;
+	fail_count += pkt->hdr.op_data - i;
+respond:
+	ret = rxm_atomic_send_resp(rx_buf, resp_buf, status, fail_count,
+				   result_len);
+	if (ret)
+		return ret;
+	return rxm_ep_repost_buf(rx_buf);
+}
+
+static int rxm_atomic_finish(struct rxm_tx_entry *tx_entry)
+{
+	struct fi_cq_err_entry err_entry;
+	struct rxm_ep *rxm_ep = tx_entry->ep;
+	struct util_cntr *cntr;
+
+	if (!tx_entry->atomic_status)
+		return rxm_finish_send(tx_entry);
+
+	memset(&err_entry, 0, sizeof(err_entry));
+	err_entry.op_context = tx_entry->context;
+	err_entry.flags = tx_entry->comp_flags;
+	err_entry.err = -tx_entry->atomic_status;
+	err_entry.prov_errno = tx_entry->atomic_status;
+
+	cntr = (tx_entry->comp_flags & FI_WRITE) ? rxm_ep->util_ep.wr_cntr :
+	       rxm_ep->util_ep.rd_cntr;
+
+	rxm_buf_release(&rxm_ep->tx_pool, (struct rxm_buf *) tx_entry->tx_buf);
+	rxm_tx_entry_release(&rxm_ep->send_queue, tx_entry);
+
+	if (cntr)
+		ofi_cntr_inc_err(cntr);
+	return rxm_ep->util_ep.tx_cq ?
+	       ofi_cq_write_error(rxm_ep->util_ep.tx_cq, &err_entry) : 0;
+}
+
+int rxm_atomic_send_comp(struct rxm_tx_entry *tx_entry)
+{
+	if (tx_entry->state == RXM_ATOMIC_RESP_RECVD)
+		return rxm_atomic_finish(tx_entry);
+
+	RXM_LOG_STATE_TX(FI_LOG_CQ, tx_entry, RXM_ATOMIC_RESP_WAIT);
+	tx_entry->state = RXM_ATOMIC_RESP_WAIT;
+	return 0;
+}
+
+int rxm_atomic_handle_resp(struct rxm_rx_buf *rx_buf)
+{
+	struct rxm_atomic_resp_hdr *resp;
+	struct rxm_tx_entry *tx_entry;
+	int index, ret;
+
+	ofi_lock_acquire(&rx_buf->ep->send_queue.lock);
+	index = ofi_key2idx(&rx_buf->ep->send_queue.tx_key_idx,
+			    rx_buf->pkt.ctrl_hdr.msg_id);
+	tx_entry = &rx_buf->ep->send_queue.fs->buf[index];
+	ofi_lock_release(&rx_buf->ep->send_queue.lock);
+
+	resp = (struct rxm_atomic_resp_hdr *) rx_buf->pkt.data;
+	tx_entry->atomic_status = resp->status;
+	tx_entry->atomic_fail_count = (uint8_t) resp->fail_count;
+	if (!resp->status)
+		ofi_copy_to_iov(tx_entry->result_iov.iov,
+				tx_entry->result_iov.count, 0, resp->data,
+				resp->result_len);
+
+	ret = rxm_ep_repost_buf(rx_buf);
+	if (ret)
+		return ret;
+
+	switch (tx_entry->state) {
+	case RXM_ATOMIC_RESP_WAIT:
+		return rxm_atomic_finish(tx_entry);
+	case RXM_ATOMIC_BATCH_RESP_WAIT:
+		return rxm_atomic_batch_finish(tx_entry);
+	case RXM_ATOMIC_BATCH_TX:
+		RXM_LOG_STATE_TX(FI_LOG_CQ, tx_entry,
+				 RXM_ATOMIC_BATCH_RESP_RECVD);
+		tx_entry->state = RXM_ATOMIC_BATCH_RESP_RECVD;
+		return 0;
+	default:
+		assert(tx_entry->state == RXM_ATOMIC_TX);
+		RXM_LOG_STATE_TX(FI_LOG_CQ, tx_entry, RXM_ATOMIC_RESP_RECVD);
+		tx_entry->state = RXM_ATOMIC_RESP_RECVD;
+		return 0;
+	}
+}
+
+static ssize_t rxm_ep_atomic_writemsg(struct fid_ep *ep_fid,
+				      const struct fi_msg_atomic *msg,
+				      uint64_t flags)
+{
+	struct rxm_ep *rxm_ep =
+		container_of(ep_fid, struct rxm_ep, util_ep.ep_fid.fid);
+
+	return rxm_ep_atomic_common(rxm_ep, msg, NULL, 0, NULL, 0, flags,
+				    ofi_op_atomic);
+}
+
+static ssize_t rxm_ep_atomic_writev(struct fid_ep *ep_fid,
+				    const struct fi_ioc *iov, void **desc,
+				    size_t count, fi_addr_t dest_addr,
+				    uint64_t addr, uint64_t key,
+				    enum fi_datatype datatype, enum fi_op op,
+				    void *context)
+{
+	struct fi_rma_ioc rma_iov = {
+		.addr = addr,
+		.count = ofi_total_ioc_cnt(iov, count),
+		.key = key,
+	};
+	struct fi_msg_atomic msg = {
+		.msg_iov = iov,
+		.desc = desc,
+		.iov_count = count,
+		.addr = dest_addr,
+		.rma_iov = &rma_iov,
+		.rma_iov_count = 1,
+		.datatype = datatype,
+		.op = op,
+		.context = context,
+		.data = 0,
+	};
+
+	return rxm_ep_atomic_writemsg(ep_fid, &msg, rxm_ep_tx_flags(ep_fid));
+}
+
+static ssize_t rxm_ep_atomic_write(struct fid_ep *ep_fid, const void *buf,
+				   size_t count, void *desc,
+				   fi_addr_t dest_addr, uint64_t addr,
+				   uint64_t key, enum fi_datatype datatype,
+				   enum fi_op op, void *context)
+{
+	const struct fi_ioc iov = {
+		.addr = (void *) buf,
+		.count = count,
+	};
+
+	return rxm_ep_atomic_writev(ep_fid, &iov, &desc, 1, dest_addr, addr,
+				    key, datatype, op, context);
+}
+
+static ssize_t rxm_ep_atomic_inject(struct fid_ep *ep_fid, const void *buf,
+				    size_t count, fi_addr_t dest_addr,
+				    uint64_t addr, uint64_t key,
+				    enum fi_datatype datatype, enum fi_op op)
+{
+	struct fi_ioc iov = {
+		.addr = (void *) buf,
+		.count = count,
+	};
+	struct fi_rma_ioc rma_iov = {
+		.addr = addr,
+		.count = count,
+		.key = key,
+	};
+	struct fi_msg_atomic msg = {
+		.msg_iov = &iov,
+		.desc = NULL,
+		.iov_count = 1,
+		.addr = dest_addr,
+		.rma_iov = &rma_iov,
+		.rma_iov_count = 1,
+		.datatype = datatype,
+		.op = op,
+		.context = NULL,
+		.data = 0,
+	};
+
+	return rxm_ep_atomic_writemsg(ep_fid, &msg,
+				      (rxm_ep_tx_flags(ep_fid) & ~FI_COMPLETION) |
+				      FI_INJECT);
+}
+
+static ssize_t rxm_ep_atomic_readwritemsg(struct fid_ep *ep_fid,
+					  const struct fi_msg_atomic *msg,
+					  struct fi_ioc *resultv,
+					  void **result_desc,
+					  size_t result_count, uint64_t flags)
+{
+	struct rxm_ep *rxm_ep =
+		container_of(ep_fid, struct rxm_ep, util_ep.ep_fid.fid);
+
+	return rxm_ep_atomic_common(rxm_ep, msg, NULL, 0, resultv,
+				    result_count, flags, ofi_op_atomic_fetch);
+}
+
+static ssize_t rxm_ep_atomic_readwritev(struct fid_ep *ep_fid,
+					const struct fi_ioc *iov, void **desc,
+					size_t count, struct fi_ioc *resultv,
+					void **result_desc, size_t result_count,
+					fi_addr_t dest_addr, uint64_t addr,
+					uint64_t key, enum fi_datatype datatype,
+					enum fi_op op, void *context)
+{
+	struct fi_rma_ioc rma_iov = {
+		.addr = addr,
+		.count = ofi_total_ioc_cnt(iov, count),
+		.key = key,
+	};
+	struct fi_msg_atomic msg = {
+		.msg_iov = iov,
+		.desc = desc,
+		.iov_count = count,
+		.addr = dest_addr,
+		.rma_iov = &rma_iov,
+		.rma_iov_count = 1,
+		.datatype = datatype,
+		.op = op,
+		.context = context,
+		.data = 0,
+	};
+
+	return rxm_ep_atomic_readwritemsg(ep_fid, &msg, resultv, result_desc,
+					  result_count,
+					  rxm_ep_tx_flags(ep_fid));
+}
+
+static ssize_t rxm_ep_atomic_readwrite(struct fid_ep *ep_fid, const void *buf,
+				       size_t count, void *desc, void *result,
+				       void *result_desc, fi_addr_t dest_addr,
+				       uint64_t addr, uint64_t key,
+				       enum fi_datatype datatype, enum fi_op op,
+				       void *context)
+{
+	struct fi_ioc iov = {
+		.addr = (void *) buf,
+		.count = count,
+	};
+	struct fi_ioc resultv = {
+		.addr = result,
+		.count = count,
+	};
+
+	return rxm_ep_atomic_readwritev(ep_fid, &iov, &desc, 1, &resultv,
+					&result_desc, 1, dest_addr, addr, key,
+					datatype, op, context);
+}
+
+static ssize_t rxm_ep_atomic_compwritemsg(struct fid_ep *ep_fid,
+					  const struct fi_msg_atomic *msg,
+					  const struct fi_ioc *comparev,
+					  void **compare_desc,
+					  size_t compare_count,
+					  struct fi_ioc *resultv,
+					  void **result_desc,
+					  size_t result_count, uint64_t flags)
+{
+	struct rxm_ep *rxm_ep =
+		container_of(ep_fid, struct rxm_ep, util_ep.ep_fid.fid);
+
+	return rxm_ep_atomic_common(rxm_ep, msg, comparev, compare_count,
+				    resultv, result_count, flags,
+				    ofi_op_atomic_compare);
+}
+
+static ssize_t rxm_ep_atomic_compwritev(struct fid_ep *ep_fid,
+					const struct fi_ioc *iov, void **desc,
+					size_t count,
+					const struct fi_ioc *comparev,
+					void **compare_desc,
+					size_t compare_count,
+					struct fi_ioc *resultv,
+					void **result_desc, size_t result_count,
+					fi_addr_t dest_addr, uint64_t addr,
+					uint64_t key, enum fi_datatype datatype,
+					enum fi_op op, void *context)
+{
+	struct fi_rma_ioc rma_iov = {
+		.addr = addr,
+		.count = ofi_total_ioc_cnt(iov, count),
+		.key = key,
+	};
+	struct fi_msg_atomic msg = {
+		.msg_iov = iov,
+		.desc = desc,
+		.iov_count = count,
+		.addr = dest_addr,
+		.rma_iov = &rma_iov,
+		.rma_iov_count = 1,
+		.datatype = datatype,
+		.op = op,
+		.context = context,
+		.data = 0,
+	};
+
+	return rxm_ep_atomic_compwritemsg(ep_fid, &msg, comparev, compare_desc,
+					  compare_count, resultv, result_desc,
+					  result_count,
+					  rxm_ep_tx_flags(ep_fid));
+}
+
+static ssize_t rxm_ep_atomic_compwrite(struct fid_ep *ep_fid, const void *buf,
+				       size_t count, void *desc,
+				       const void *compare, void *compare_desc,
+				       void *result, void *result_desc,
+				       fi_addr_t dest_addr, uint64_t addr,
+				       uint64_t key, enum fi_datatype datatype,
+				       enum fi_op op, void *context)
+{
+	struct fi_ioc iov = {
+		.addr = (void *) buf,
+		.count = count,
+	};
+	struct fi_ioc comparev = {
+		.addr = (void *) compare,
+		.count = count,
+	};
+	struct fi_ioc resultv = {
+		.addr = result,
+		.count = count,
+	};
+
+	return rxm_ep_atomic_compwritev(ep_fid, &iov, &desc, 1,
+					&comparev, &compare_desc, 1,
+					&resultv, &result_desc, 1,
+					dest_addr, addr, key,
+					datatype, op, context);
+}
+
+int rxm_query_atomic(struct fid_domain *domain, enum fi_datatype datatype,
+		     enum fi_op op, struct fi_atomic_attr *attr,
+		     uint64_t flags)
+{
+	int ret;
+
+	ret = ofi_atomic_valid(&rxm_prov, datatype, op, flags);
+	if (ret)
+		return ret;
+
+	attr->size = ofi_datatype_size(datatype);
+	if (attr->size == 0)
+		return -FI_EINVAL;
+
+	attr->count = RXM_ATOMIC_MAX_DATA / attr->size;
+	return 0;
+}
+
+static int rxm_ep_atomic_valid(struct fid_ep *ep_fid,
+			       enum fi_datatype datatype, enum fi_op op,
+			       size_t *count)
+{
+	struct fi_atomic_attr attr;
+	int ret;
+
+	ret = rxm_query_atomic(NULL, datatype, op, &attr, 0);
+	if (!ret)
+		*count = attr.count;
+	return ret;
+}
+
+static int rxm_ep_atomic_fetch_valid(struct fid_ep *ep_fid,
+				     enum fi_datatype datatype, enum fi_op op,
+				     size_t *count)
+{
+	struct fi_atomic_attr attr;
+	int ret;
+
+	ret = rxm_query_atomic(NULL, datatype, op, &attr, FI_FETCH_ATOMIC);
+	if (!ret)
+		*count = attr.count;
+	return ret;
+}
+
+static int rxm_ep_atomic_cswap_valid(struct fid_ep *ep_fid,
+				     enum fi_datatype datatype, enum fi_op op,
+				     size_t *count)
+{
+	struct fi_atomic_attr attr;
+	int ret;
+
+	ret = rxm_query_atomic(NULL, datatype, op, &attr, FI_COMPARE_ATOMIC);
+	if (!ret)
+		*count = attr.count;
+	return ret;
+}
+
+struct fi_ops_atomic rxm_ops_atomic = {
+	.size = sizeof(struct fi_ops_atomic),
+	.write = rxm_ep_atomic_write,
+	.writev = rxm_ep_atomic_writev,
+	.writemsg = rxm_ep_atomic_writemsg,
+	.inject = rxm_ep_atomic_inject,
+	.readwrite = rxm_ep_atomic_readwrite,
+	.readwritev = rxm_ep_atomic_readwritev,
+	.readwritemsg = rxm_ep_atomic_readwritemsg,
+	.compwrite = rxm_ep_atomic_compwrite,
+	.compwritev = rxm_ep_atomic_compwritev,
+	.compwritemsg = rxm_ep_atomic_compwritemsg,
+	.writevalid = rxm_ep_atomic_valid,
+	.readwritevalid = rxm_ep_atomic_fetch_valid,
+	.compwritevalid = rxm_ep_atomic_cswap_valid,
+};
@@ -32,9 +32,9 @@
 
 #include "rxm.h"
 
-#define RXM_EP_CAPS (FI_MSG | FI_RMA | FI_TAGGED | FI_DIRECTED_RECV |	\
-		     FI_READ | FI_WRITE | FI_RECV | FI_SEND |		\
-		     FI_REMOTE_READ | FI_REMOTE_WRITE | FI_SOURCE)
+#define RXM_EP_CAPS (FI_MSG | FI_RMA | FI_TAGGED | FI_ATOMIC |		\
+		     FI_DIRECTED_RECV | FI_READ | FI_WRITE | FI_RECV |	\
+		     FI_SEND | FI_REMOTE_READ | FI_REMOTE_WRITE | FI_SOURCE)
 
 /* Since we are a layering provider, the attributes for which we rely on the
  * core provider are set to full capability. This ensures that ofix_getinfo
@@ -81,8 +81,8 @@ struct fi_domain_attr rxm_domain_attr = {
 	.ep_cnt = (1 << 15),
 	.tx_ctx_cnt = 1,
 	.rx_ctx_cnt = 1,
-	.max_ep_tx_ctx = 1,
-	.max_ep_rx_ctx = 1,
+	.max_ep_tx_ctx = 64,
+	.max_ep_rx_ctx = 64,
 	.mr_iov_limit = 1,
 };
 
@@ -94,12 +94,24 @@ err:
 	return ret;
 }
 
-void rxm_conn_close(struct util_cmap_handle *handle)
+static void rxm_conn_uncache(struct util_cmap_handle *handle)
 {
-	struct rxm_conn *rxm_conn = container_of(handle, struct rxm_conn, handle);
-	if (!rxm_conn->msg_ep)
+	struct rxm_ep *rxm_ep;
+	size_t index;
+
+	if (!handle->cmap || handle->fi_addr == FI_ADDR_UNSPEC)
 		return;
 
+	rxm_ep = container_of(handle->cmap->ep, struct rxm_ep, util_ep);
+	index = ofi_av_ctx_index(handle->cmap->av, handle->fi_addr);
+	if (index < rxm_ep->conn_cache_size &&
+	    rxm_ep->conn_cache[index] ==
+	    container_of(handle, struct rxm_conn, handle))
+		rxm_ep->conn_cache[index] = NULL;
+}
+
+static void rxm_conn_close_msg_ep(struct rxm_conn *rxm_conn)
+{
 	/* Assuming fi_close also shuts down the connection gracefully if the
 	 * endpoint is in connected state */
 	if (fi_close(&rxm_conn->msg_ep->fid))
@@ -108,10 +120,95 @@ void rxm_conn_close(struct util_cmap_handle *handle)
 	rxm_conn->msg_ep = NULL;
 }
 
+/* Caller must hold batch_lock */
+static int rxm_conn_has_staged(struct rxm_ep *rxm_ep, struct rxm_conn *rxm_conn)
+{
+	struct rxm_tx_entry *tx_entry;
+
+	if (rxm_conn->atomic_batch || rxm_conn->send_agg)
+		return 1;
+	dlist_foreach_container(&rxm_ep->deferred_list, struct rxm_tx_entry,
+				tx_entry, deferred_entry) {
+		if (tx_entry->tx_buf->hdr.msg_ep == rxm_conn->msg_ep)
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * Dropping staged sends releases tx buffers and reports errors to the
+ * CQ and counters, whose locks may be elided for the application thread.
+ * A connection shut down from the event thread with sends still staged
+ * is therefore queued, and closed by the next progress call instead.
+ */
+void rxm_conn_close(struct util_cmap_handle *handle)
+{
+	struct rxm_conn *rxm_conn = container_of(handle, struct rxm_conn, handle);
+	struct rxm_ep *rxm_ep;
+	int closing;
+
+	rxm_conn_uncache(handle);
+	if (!rxm_conn->msg_ep)
+		return;
+
+	rxm_ep = container_of(handle->cmap->ep, struct rxm_ep, util_ep);
+	fastlock_acquire(&rxm_ep->batch_lock);
+	if (!rxm_conn->closing && rxm_conn_has_staged(rxm_ep, rxm_conn)) {
+		rxm_conn->closing = 1;
+		dlist_insert_tail(&rxm_conn->close_entry,
+				  &rxm_ep->conn_close_list);
+	}
+	closing = rxm_conn->closing;
+	fastlock_release(&rxm_ep->batch_lock);
+
+	if (!closing)
+		rxm_conn_close_msg_ep(rxm_conn);
+}
+
 static void rxm_conn_free(struct util_cmap_handle *handle)
 {
+	struct rxm_conn *rxm_conn = container_of(handle, struct rxm_conn, handle);
+	struct rxm_ep *rxm_ep;
+	int closing;
+
+	/* A queued connection is freed once progress has closed it */
+	if (handle->cmap) {
+		rxm_ep = container_of(handle->cmap->ep, struct rxm_ep, util_ep);
+		fastlock_acquire(&rxm_ep->batch_lock);
+		closing = rxm_conn->closing;
+		rxm_conn->free_pending = closing;
+		fastlock_release(&rxm_ep->batch_lock);
+		if (closing)
+			return;
+	}
 	rxm_conn_close(handle);
-	free(container_of(handle, struct rxm_conn, handle));
+	free(rxm_conn);
+}
+
+void rxm_conn_close_all(struct rxm_ep *rxm_ep)
+{
+	struct rxm_conn *rxm_conn;
+
+	fastlock_acquire(&rxm_ep->batch_lock);
+	while (!dlist_empty(&rxm_ep->conn_close_list)) {
+		dlist_pop_front(&rxm_ep->conn_close_list, struct rxm_conn,
+				rxm_conn, close_entry);
+		fastlock_release(&rxm_ep->batch_lock);
+
+		if (ofi_atomic_get32(&rxm_ep->deferred_cnt))
+			rxm_deferred_conn_close(rxm_ep, rxm_conn);
+		if (rxm_conn->atomic_batch)
+			rxm_atomic_conn_close(rxm_ep, rxm_conn);
+		if (rxm_conn->send_agg)
+			rxm_send_agg_conn_close(rxm_ep, rxm_conn);
+		rxm_conn_close_msg_ep(rxm_conn);
+
+		fastlock_acquire(&rxm_ep->batch_lock);
+		rxm_conn->closing = 0;
+		if (rxm_conn->free_pending)
+			free(rxm_conn);
+	}
+	fastlock_release(&rxm_ep->batch_lock);
 }
 
 static struct util_cmap_handle *rxm_conn_alloc(void)
@@ -120,6 +217,39 @@ static struct util_cmap_handle *rxm_conn_alloc(void)
 	return rxm_conn ? &rxm_conn->handle : NULL;
 }
 
+static void rxm_conn_init_inject_pkt(struct rxm_conn *rxm_conn,
+				     uint64_t remote_key)
+{
+	rxm_pkt_init(&rxm_conn->inject_pkt);
+	rxm_conn->inject_pkt.ctrl_hdr.type = ofi_ctrl_data;
+	rxm_conn->inject_pkt.ctrl_hdr.conn_id = remote_key;
+}
+
+int rxm_conn_get_slow(struct rxm_ep *rxm_ep, fi_addr_t fi_addr,
+		      struct rxm_conn **rxm_conn)
+{
+	struct util_cmap_handle *handle;
+	size_t index;
+	int ret;
+
+	ret = ofi_cmap_get_handle(rxm_ep->util_ep.cmap, fi_addr, &handle);
+	if (ret)
+		return ret;
+
+	*rxm_conn = container_of(handle, struct rxm_conn, handle);
+	index = ofi_av_ctx_index(rxm_ep->util_ep.av, fi_addr);
+	if (index >= rxm_ep->conn_cache_size)
+		return 0;
+
+	/* Publish under the cmap lock so that a concurrent shutdown either
+	 * sees the entry and clears it, or the state check fails here. */
+	fastlock_acquire(&rxm_ep->util_ep.cmap->lock);
+	if (handle->state == CMAP_CONNECTED)
+		rxm_ep->conn_cache[index] = *rxm_conn;
+	fastlock_release(&rxm_ep->util_ep.cmap->lock);
+	return 0;
+}
+
 static int
 rxm_msg_process_connreq(struct rxm_ep *rxm_ep, struct fi_info *msg_info,
 			void *data)
@@ -202,6 +332,7 @@ static void *rxm_conn_event_handler(void *arg)
 	size_t len = sizeof(*entry) + datalen;
 	struct rxm_ep *rxm_ep = container_of(arg, struct rxm_ep, util_ep);
 	struct rxm_cm_data *cm_data;
+	struct util_cmap_handle *handle;
 	uint32_t event;
 	ssize_t rd;
 
@@ -240,8 +371,14 @@ static void *rxm_conn_event_handler(void *arg)
 			FI_DBG(&rxm_prov, FI_LOG_FABRIC,
 			       "Connection successful\n");
 			cm_data = (void *)entry->data;
-			ofi_cmap_process_connect(rxm_ep->util_ep.cmap,
-						 entry->fid->context,
+			handle = entry->fid->context;
+			rxm_conn_init_inject_pkt(container_of(handle,
+							      struct rxm_conn,
+							      handle),
+						 (rd - sizeof(*entry)) ?
+						 cm_data->conn_id :
+						 handle->remote_key);
+			ofi_cmap_process_connect(rxm_ep->util_ep.cmap, handle,
 						 (rd - sizeof(*entry)) ?
 						 &cm_data->conn_id : NULL);
 			break;
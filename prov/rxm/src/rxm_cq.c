@@ -39,7 +39,7 @@
 
 #include "rxm.h"
 
-static struct rxm_conn *rxm_key2conn(struct rxm_ep *rxm_ep, uint64_t key)
+struct rxm_conn *rxm_key2conn(struct rxm_ep *rxm_ep, uint64_t key)
 {
 	struct util_cmap_handle *handle;
 	handle = ofi_cmap_key2handle(rxm_ep->util_ep.cmap, key);
@@ -103,11 +103,21 @@ static void rxm_cq_log_comp(uint64_t flags)
 }
 #endif
 
+/* Internal protocol sends carry no comp_flags and are not counted */
+static struct util_cntr *rxm_tx_cntr(struct rxm_ep *rxm_ep, uint64_t comp_flags)
+{
+	return !comp_flags ? NULL :
+	       (comp_flags & FI_WRITE) ? rxm_ep->util_ep.wr_cntr :
+	       (comp_flags & FI_READ) ? rxm_ep->util_ep.rd_cntr :
+	       rxm_ep->util_ep.tx_cntr;
+}
+
 int rxm_finish_recv(struct rxm_rx_buf *rx_buf)
 {
 	int ret;
 
-	if (rx_buf->recv_entry->flags & FI_COMPLETION) {
+	if ((rx_buf->recv_entry->flags & FI_COMPLETION) &&
+	    rx_buf->ep->util_ep.rx_cq) {
 		FI_DBG(&rxm_prov, FI_LOG_CQ, "writing recv completion\n");
 		ret = ofi_cq_write(rx_buf->ep->util_ep.rx_cq,
 				   rx_buf->recv_entry->context,
@@ -120,6 +130,8 @@ int rxm_finish_recv(struct rxm_rx_buf *rx_buf)
 			return ret;
 		}
 	}
+	if (rx_buf->ep->util_ep.rx_cntr)
+		ofi_cntr_inc(rx_buf->ep->util_ep.rx_cntr);
 
 	rxm_recv_entry_release(rx_buf->recv_queue, rx_buf->recv_entry);
 	return rxm_ep_repost_buf(rx_buf);
@@ -127,9 +139,10 @@ int rxm_finish_recv(struct rxm_rx_buf *rx_buf)
 
 static int rxm_finish_send_nobuf(struct rxm_tx_entry *tx_entry)
 {
+	struct util_cntr *cntr;
 	int ret;
 
-	if (tx_entry->flags & FI_COMPLETION) {
+	if ((tx_entry->flags & FI_COMPLETION) && tx_entry->ep->util_ep.tx_cq) {
 		ret = ofi_cq_write(tx_entry->ep->util_ep.tx_cq,
 				   tx_entry->context, tx_entry->comp_flags, 0,
 				   NULL, 0, 0);
@@ -140,6 +153,9 @@ static int rxm_finish_send_nobuf(struct rxm_tx_entry *tx_entry)
 		}
 		rxm_cq_log_comp(tx_entry->comp_flags);
 	}
+	cntr = rxm_tx_cntr(tx_entry->ep, tx_entry->comp_flags);
+	if (cntr)
+		ofi_cntr_inc(cntr);
 	rxm_tx_entry_release(&tx_entry->ep->send_queue, tx_entry);
 	return 0;
 }
@@ -251,11 +267,11 @@ static int rxm_lmt_handle_ack(struct rxm_rx_buf *rx_buf)
 	FI_DBG(&rxm_prov, FI_LOG_CQ, "Got ACK for msg_id: 0x%" PRIx64 "\n",
 			rx_buf->pkt.ctrl_hdr.msg_id);
 
-	fastlock_acquire(&rx_buf->ep->send_queue.lock);
+	ofi_lock_acquire(&rx_buf->ep->send_queue.lock);
 	index = ofi_key2idx(&rx_buf->ep->send_queue.tx_key_idx,
 			    rx_buf->pkt.ctrl_hdr.msg_id);
 	tx_entry = &rx_buf->ep->send_queue.fs->buf[index];
-	fastlock_release(&rx_buf->ep->send_queue.lock);
+	ofi_lock_release(&rx_buf->ep->send_queue.lock);
 
 	assert(tx_entry->tx_buf->pkt.ctrl_hdr.msg_id == rx_buf->pkt.ctrl_hdr.msg_id);
 
@@ -339,6 +355,46 @@ int rxm_cq_handle_data(struct rxm_rx_buf *rx_buf)
 	}
 }
 
+/*
+ * An unexpected message holds its buffer until a receive matches it.
+ * Messages that fit a smaller size class are moved to a buffer of their
+ * own, so that the buffer sized for the largest eager message is posted
+ * back to the MSG endpoint right away.
+ */
+static struct rxm_rx_buf *rxm_rx_buf_unexp(struct rxm_rx_buf *rx_buf)
+{
+	struct rxm_rx_buf *unexp_buf;
+	struct rxm_rma_iov *rma_iov;
+	struct rxm_buf hdr;
+	size_t size;
+
+	if (!rx_buf->hdr.msg_ep)
+		return rx_buf;
+
+	if (rx_buf->pkt.ctrl_hdr.type == ofi_ctrl_large_data) {
+		rma_iov = (struct rxm_rma_iov *) rx_buf->pkt.data;
+		size = sizeof(*rma_iov) + sizeof(*rma_iov->iov) * rma_iov->count;
+	} else {
+		size = rx_buf->pkt.hdr.size;
+	}
+	size += sizeof(*rx_buf);
+	if (size > rxm_buffer_size / 2)
+		return rx_buf;
+
+	unexp_buf = (struct rxm_rx_buf *)
+		    rxm_buf_get(&rx_buf->ep->rx_pool, size);
+	if (!unexp_buf)
+		return rx_buf;
+
+	hdr = unexp_buf->hdr;
+	memcpy(unexp_buf, rx_buf, size);
+	hdr.state = rx_buf->hdr.state;
+	unexp_buf->hdr = hdr;
+
+	rxm_ep_repost_buf(rx_buf);
+	return unexp_buf;
+}
+
 int rxm_handle_recv_comp(struct rxm_rx_buf *rx_buf)
 {
 	struct rxm_recv_match_attr match_attr;
@@ -358,7 +414,7 @@ int rxm_handle_recv_comp(struct rxm_rx_buf *rx_buf)
 		match_attr.addr = FI_ADDR_UNSPEC;
 	}
 
-	if (rx_buf->ep->rxm_info->caps & FI_SOURCE)
+	if ((rx_buf->ep->rxm_info->caps & FI_SOURCE) && util_cq)
 		util_cq->src[ofi_cirque_windex(util_cq->cirq)] = rx_buf->conn->handle.fi_addr;
 
 	switch(rx_buf->pkt.hdr.op) {
@@ -378,8 +434,9 @@ int rxm_handle_recv_comp(struct rxm_rx_buf *rx_buf)
 	}
 
 	rx_buf->recv_queue = recv_queue;
+	ofi_stats_inc(&rx_buf->ep->stats, RXM_STAT_RX_MSGS);
 
-	fastlock_acquire(&recv_queue->lock);
+	ofi_lock_acquire(&recv_queue->lock);
 	entry = dlist_remove_first_match(&recv_queue->recv_list,
 					 recv_queue->match_recv, &match_attr);
 	if (!entry) {
@@ -388,18 +445,163 @@ int rxm_handle_recv_comp(struct rxm_rx_buf *rx_buf)
 				 match_attr.tag);
 		FI_DBG(&rxm_prov, FI_LOG_CQ, "Enqueueing msg to unexpected msg"
 		       "queue\n");
+		rx_buf = rxm_rx_buf_unexp(rx_buf);
 		rx_buf->unexp_msg.addr = match_attr.addr;
 		rx_buf->unexp_msg.tag = match_attr.tag;
 		dlist_insert_tail(&rx_buf->unexp_msg.entry, &recv_queue->unexp_msg_list);
-		fastlock_release(&recv_queue->lock);
+		ofi_stats_inc(&rx_buf->ep->stats, RXM_STAT_UNEXP_MSGS);
+		ofi_stats_inc(&rx_buf->ep->stats, RXM_STAT_UNEXP_DEPTH);
+		ofi_lock_release(&recv_queue->lock);
 		return 0;
 	}
-	fastlock_release(&recv_queue->lock);
+	ofi_lock_release(&recv_queue->lock);
 
 	rx_buf->recv_entry = container_of(entry, struct rxm_recv_entry, entry);
 	return rxm_cq_handle_data(rx_buf);
 }
 
+/*
+ * Each record of an aggregate is copied into an rx buffer of its own, so it
+ * can be matched or queued as unexpected like any other message.  Those
+ * buffers go back to the pool once consumed.
+ */
+/*
+ * When no rx buffer can be had partway through an aggregate, the position
+ * of the next record is kept and the packet waits on the rx_stall_list
+ * until the next progress call resumes it.
+ */
+static int rxm_handle_agg_data(struct rxm_rx_buf *rx_buf)
+{
+	struct rxm_ep *rxm_ep = rx_buf->ep;
+	struct rxm_pkt *pkt = &rx_buf->pkt;
+	struct rxm_rx_buf *msg_buf;
+	struct rxm_agg_hdr *rec;
+	struct rxm_buf hdr;
+	size_t hdr_len, rec_len;
+	int err, ret = 0;
+
+	if ((rxm_ep->rxm_info->caps & (FI_SOURCE | FI_DIRECTED_RECV)) &&
+	    !rx_buf->conn) {
+		rx_buf->conn = rxm_key2conn(rxm_ep, pkt->ctrl_hdr.conn_id);
+		if (!rx_buf->conn)
+			return -FI_EOTHER;
+	}
+
+	for (; rx_buf->agg_rec < pkt->hdr.op_data;
+	     rx_buf->agg_rec++, rx_buf->agg_offset += rec_len) {
+		rec = (struct rxm_agg_hdr *) (pkt->data + rx_buf->agg_offset);
+		if (rx_buf->agg_offset + sizeof(*rec) > pkt->hdr.size)
+			goto malformed;
+		hdr_len = sizeof(*rec) + ((rec->flags & OFI_REMOTE_CQ_DATA) ?
+					  sizeof(uint64_t) : 0);
+		rec_len = fi_get_aligned_sz(hdr_len + rec->size, 8);
+		if (rx_buf->agg_offset + rec_len > pkt->hdr.size)
+			goto malformed;
+
+		msg_buf = (struct rxm_rx_buf *)
+			  rxm_buf_get(&rxm_ep->rx_pool,
+				      sizeof(*msg_buf) + rec->size);
+		if (!msg_buf) {
+			FI_DBG(&rxm_prov, FI_LOG_CQ,
+			       "Out of rx buffers, deferring aggregated "
+			       "message\n");
+			if (!rx_buf->stalled) {
+				rx_buf->stalled = 1;
+				dlist_insert_tail(&rx_buf->stall_entry,
+						  &rxm_ep->rx_stall_list);
+			}
+			return 0;
+		}
+		hdr = msg_buf->hdr;
+		memset(msg_buf, 0, sizeof(*msg_buf));
+		msg_buf->hdr = hdr;
+		msg_buf->hdr.state = RXM_RX;
+		msg_buf->ep = rxm_ep;
+		msg_buf->conn = rx_buf->conn;
+
+		msg_buf->pkt.ctrl_hdr = pkt->ctrl_hdr;
+		msg_buf->pkt.ctrl_hdr.type = ofi_ctrl_data;
+		msg_buf->pkt.hdr.version = OFI_OP_VERSION;
+		msg_buf->pkt.hdr.op = rec->op;
+		msg_buf->pkt.hdr.flags = rec->flags;
+		msg_buf->pkt.hdr.size = rec->size;
+		msg_buf->pkt.hdr.tag = rec->tag;
+		if (rec->flags & OFI_REMOTE_CQ_DATA)
+			memcpy(&msg_buf->pkt.hdr.data, rec->data,
+			       sizeof(msg_buf->pkt.hdr.data));
+		memcpy(msg_buf->pkt.data, (char *) rec + hdr_len, rec->size);
+
+		ret = rxm_handle_recv_comp(msg_buf);
+		if (ret)
+			break;
+	}
+	goto repost;
+malformed:
+	FI_WARN(&rxm_prov, FI_LOG_CQ, "Malformed aggregated message\n");
+	ret = -FI_EINVAL;
+repost:
+	if (rx_buf->stalled)
+		dlist_remove(&rx_buf->stall_entry);
+	err = rxm_ep_repost_buf(rx_buf);
+	return ret ? ret : err;
+}
+
+static int rxm_handle_rx_buf(struct rxm_rx_buf *rx_buf)
+{
+	switch (rx_buf->pkt.ctrl_hdr.type) {
+	case ofi_ctrl_ack:
+		return rxm_lmt_handle_ack(rx_buf);
+	case ofi_ctrl_atomic:
+		return rxm_atomic_handle_req(rx_buf);
+	case ofi_ctrl_atomic_resp:
+		return rxm_atomic_handle_resp(rx_buf);
+	case ofi_ctrl_agg_data:
+		return rxm_handle_agg_data(rx_buf);
+	default:
+		return rxm_handle_recv_comp(rx_buf);
+	}
+}
+
+/* Whether a packet on the stall list ahead of pos came over msg_ep */
+static int rxm_rx_stalled(struct rxm_ep *rxm_ep, struct dlist_entry *pos,
+			  struct fid_ep *msg_ep)
+{
+	struct rxm_rx_buf *rx_buf;
+
+	dlist_foreach_container(&rxm_ep->rx_stall_list, struct rxm_rx_buf,
+				rx_buf, stall_entry) {
+		if (&rx_buf->stall_entry == pos)
+			break;
+		if (rx_buf->hdr.msg_ep == msg_ep)
+			return 1;
+	}
+	return 0;
+}
+
+/* Packets behind a stalled aggregate or atomic request are handled in
+ * arrival order per MSG EP; the stalled packet stays at its place until
+ * it is fully handled and removes itself. */
+static void rxm_rx_stall_progress(struct rxm_ep *rxm_ep)
+{
+	struct rxm_rx_buf *rx_buf;
+	struct dlist_entry *tmp;
+
+	dlist_foreach_container_safe(&rxm_ep->rx_stall_list, struct rxm_rx_buf,
+				     rx_buf, stall_entry, tmp) {
+		if (rxm_rx_stalled(rxm_ep, &rx_buf->stall_entry,
+				   rx_buf->hdr.msg_ep))
+			continue;
+		if (rx_buf->pkt.ctrl_hdr.type != ofi_ctrl_agg_data &&
+		    rx_buf->pkt.ctrl_hdr.type != ofi_ctrl_atomic) {
+			dlist_remove(&rx_buf->stall_entry);
+			rx_buf->stalled = 0;
+		}
+		if (rxm_handle_rx_buf(rx_buf))
+			FI_WARN(&rxm_prov, FI_LOG_CQ,
+				"Unable to handle deferred packet\n");
+	}
+}
+
 static int rxm_lmt_send_ack(struct rxm_rx_buf *rx_buf)
 {
 	struct rxm_tx_entry *tx_entry;
@@ -408,7 +610,7 @@ static int rxm_lmt_send_ack(struct rxm_rx_buf *rx_buf)
 
 	assert(rx_buf->conn);
 
-	tx_buf = (struct rxm_tx_buf *)rxm_buf_get(&rx_buf->ep->tx_pool);
+	tx_buf = rxm_tx_buf_get(rx_buf->ep, 0);
 	if (!tx_buf) {
 		FI_WARN(&rxm_prov, FI_LOG_CQ, "TX queue full!\n");
 		return -FI_EAGAIN;
@@ -453,14 +655,18 @@ static int rxm_handle_remote_write(struct rxm_ep *rxm_ep,
 {
 	int ret;
 
-	FI_DBG(&rxm_prov, FI_LOG_CQ, "writing remote write completion\n");
-	ret = ofi_cq_write(rxm_ep->util_ep.rx_cq, NULL, comp->flags, 0, NULL,
-			   comp->data, 0);
-	if (ret) {
-		FI_WARN(&rxm_prov, FI_LOG_CQ,
+	if (rxm_ep->util_ep.rx_cq) {
+		FI_DBG(&rxm_prov, FI_LOG_CQ, "writing remote write completion\n");
+		ret = ofi_cq_write(rxm_ep->util_ep.rx_cq, NULL, comp->flags, 0,
+				   NULL, comp->data, 0);
+		if (ret) {
+			FI_WARN(&rxm_prov, FI_LOG_CQ,
 				"Unable to write remote write completion\n");
-		return ret;
+			return ret;
+		}
 	}
+	if (rxm_ep->util_ep.rem_wr_cntr)
+		ofi_cntr_inc(rxm_ep->util_ep.rem_wr_cntr);
 	if (comp->op_context)
 		return rxm_ep_repost_buf((struct rxm_rx_buf *)comp->op_context);
 	return 0;
@@ -488,10 +694,15 @@ static int rxm_cq_handle_comp(struct rxm_ep *rxm_ep,
 	case RXM_RX:
 		assert(!(comp->flags & FI_REMOTE_READ));
 
-		if (rx_buf->pkt.ctrl_hdr.type == ofi_ctrl_ack)
-			return rxm_lmt_handle_ack(rx_buf);
-		else
-			return rxm_handle_recv_comp(comp->op_context);
+		if (!dlist_empty(&rxm_ep->rx_stall_list) &&
+		    rxm_rx_stalled(rxm_ep, &rxm_ep->rx_stall_list,
+				   rx_buf->hdr.msg_ep)) {
+			rx_buf->stalled = 1;
+			dlist_insert_tail(&rx_buf->stall_entry,
+					  &rxm_ep->rx_stall_list);
+			return 0;
+		}
+		return rxm_handle_rx_buf(rx_buf);
 	case RXM_LMT_TX:
 		assert(comp->flags & FI_SEND);
 		RXM_LOG_STATE_TX(FI_LOG_CQ, tx_entry, RXM_LMT_ACK_WAIT);
@@ -506,6 +717,14 @@ static int rxm_cq_handle_comp(struct rxm_ep *rxm_ep,
 			return rxm_lmt_rma_read(rx_buf);
 		else
 			return rxm_lmt_send_ack(rx_buf);
+	case RXM_ATOMIC_TX:
+	case RXM_ATOMIC_RESP_RECVD:
+		assert(comp->flags & FI_SEND);
+		return rxm_atomic_send_comp(tx_entry);
+	case RXM_ATOMIC_BATCH_TX:
+	case RXM_ATOMIC_BATCH_RESP_RECVD:
+		assert(comp->flags & FI_SEND);
+		return rxm_atomic_batch_comp(tx_entry);
 	case RXM_LMT_ACK_SENT:
 		assert(comp->flags & FI_SEND);
 		rx_buf = tx_entry->context;
@@ -530,6 +749,7 @@ static ssize_t rxm_cq_read(struct fid_cq *msg_cq, struct fi_cq_tagged_entry *com
 	struct rxm_rx_buf *rx_buf;
 	struct fi_cq_err_entry err_entry;
 	struct util_cq *util_cq;
+	struct util_cntr *util_cntr;
 	void *op_context;
 	ssize_t ret;
 
@@ -547,23 +767,46 @@ static ssize_t rxm_cq_read(struct fid_cq *msg_cq, struct fi_cq_tagged_entry *com
 			FI_WARN(&rxm_prov, FI_LOG_CQ,
 					"Unable to fi_cq_readerr on msg cq\n");
 		else
-			op_context = err_entry.op_context;
+			op_context = comp->op_context = err_entry.op_context;
+	}
+
+	/* A message cut short by a disconnecting peer fails without a
+	 * buffer of ours attached to it */
+	if (!op_context) {
+		FI_WARN(&rxm_prov, FI_LOG_CQ, "Dropping msg cq error: %s\n",
+			fi_strerror(err_entry.err));
+		return 0;
 	}
 
 	switch (RXM_GET_PROTO_STATE(comp)) {
+	case RXM_ATOMIC_BATCH_TX:
+	case RXM_ATOMIC_BATCH_RESP_RECVD:
+		/* The staged ops have no context of their own */
+		tx_entry = (struct rxm_tx_entry *)op_context;
+		rxm_atomic_batch_fail(tx_entry->ep, tx_entry->count,
+				      err_entry.err ? -err_entry.err : -FI_EIO);
+		rxm_buf_release(&tx_entry->ep->tx_pool,
+				(struct rxm_buf *) tx_entry->tx_buf);
+		rxm_tx_entry_release(&tx_entry->ep->send_queue, tx_entry);
+		return 0;
 	case RXM_TX:
 	case RXM_LMT_TX:
+	case RXM_ATOMIC_TX:
+	case RXM_ATOMIC_RESP_RECVD:
 		tx_entry = (struct rxm_tx_entry *)op_context;
-		util_cq = tx_entry->ep->util_ep.tx_cq;
+		util_cq = tx_entry->comp_flags ? tx_entry->ep->util_ep.tx_cq : NULL;
+		util_cntr = rxm_tx_cntr(tx_entry->ep, tx_entry->comp_flags);
 		break;
 	case RXM_LMT_ACK_SENT:
 		tx_entry = (struct rxm_tx_entry *)op_context;
 		util_cq = tx_entry->ep->util_ep.rx_cq;
+		util_cntr = tx_entry->ep->util_ep.rx_cntr;
 		break;
 	case RXM_RX:
 	case RXM_LMT_READ:
 		rx_buf = (struct rxm_rx_buf *)op_context;
 		util_cq = rx_buf->ep->util_ep.rx_cq;
+		util_cntr = rx_buf->ep->util_ep.rx_cntr;
 		break;
 	default:
 		FI_WARN(&rxm_prov, FI_LOG_CQ, "Invalid state!\n");
@@ -573,7 +816,9 @@ static ssize_t rxm_cq_read(struct fid_cq *msg_cq, struct fi_cq_tagged_entry *com
 		assert(0);
 		return err_entry.err;
 	}
-	return ofi_cq_write_error(util_cq, &err_entry);
+	if (util_cntr)
+		ofi_cntr_inc_err(util_cntr);
+	return util_cq ? ofi_cq_write_error(util_cq, &err_entry) : 0;
 }
 
 void rxm_cq_progress(struct rxm_ep *rxm_ep)
@@ -581,6 +826,9 @@ void rxm_cq_progress(struct rxm_ep *rxm_ep)
 	struct fi_cq_tagged_entry comp;
 	ssize_t ret, comp_read = 0;
 
+	if (!dlist_empty(&rxm_ep->rx_stall_list))
+		rxm_rx_stall_progress(rxm_ep);
+
 	do {
 		ret = rxm_cq_read(rxm_ep->msg_cq, &comp);
 		if (ret == -FI_EAGAIN)
@@ -660,3 +908,49 @@ err1:
 	free(util_cq);
 	return ret;
 }
+
+static int rxm_cntr_close(struct fid *fid)
+{
+	struct util_cntr *util_cntr;
+	int ret;
+
+	util_cntr = container_of(fid, struct util_cntr, cntr_fid.fid);
+	ret = ofi_cntr_cleanup(util_cntr);
+	if (ret)
+		return ret;
+
+	free(util_cntr);
+	return 0;
+}
+
+static struct fi_ops rxm_cntr_fi_ops = {
+	.size = sizeof(struct fi_ops),
+	.close = rxm_cntr_close,
+	.bind = fi_no_bind,
+	.control = fi_no_control,
+	.ops_open = fi_no_ops_open,
+};
+
+int rxm_cntr_open(struct fid_domain *domain, struct fi_cntr_attr *attr,
+		  struct fid_cntr **cntr_fid, void *context)
+{
+	struct util_cntr *util_cntr;
+	int ret;
+
+	util_cntr = calloc(1, sizeof(*util_cntr));
+	if (!util_cntr)
+		return -FI_ENOMEM;
+
+	ret = ofi_cntr_init(&rxm_prov, domain, attr, util_cntr,
+			    &ofi_cntr_progress, context);
+	if (ret)
+		goto err1;
+
+	*cntr_fid = &util_cntr->cntr_fid;
+	/* Override util_cntr_fi_ops */
+	(*cntr_fid)->fid.ops = &rxm_cntr_fi_ops;
+	return 0;
+err1:
+	free(util_cntr);
+	return ret;
+}
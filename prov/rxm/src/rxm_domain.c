@@ -42,12 +42,12 @@ static struct fi_ops_domain rxm_domain_ops = {
 	.av_open = ip_av_create,
 	.cq_open = rxm_cq_open,
 	.endpoint = rxm_endpoint,
-	.scalable_ep = fi_no_scalable_ep,
-	.cntr_open = fi_no_cntr_open,
+	.scalable_ep = rxm_scalable_ep,
+	.cntr_open = rxm_cntr_open,
 	.poll_open = fi_poll_create,
 	.stx_ctx = fi_no_stx_context,
 	.srx_ctx = fi_no_srx_context,
-	.query_atomic = fi_no_query_atomic,
+	.query_atomic = rxm_query_atomic,
 };
 
 static int rxm_domain_close(fid_t fid)
@@ -65,6 +65,7 @@ static int rxm_domain_close(fid_t fid)
 	if (ret)
 		return ret;
 
+	ofi_mr_map_close(&rxm_domain->mr_map);
 	free(rxm_domain);
 	return 0;
 }
@@ -83,6 +84,13 @@ static int rxm_mr_close(fid_t fid)
 	int ret;
 
 	rxm_mr = container_of(fid, struct rxm_mr, mr_fid.fid);
+	if (rxm_mr->domain) {
+		fastlock_acquire(&rxm_mr->domain->util_domain.lock);
+		ofi_mr_remove(&rxm_mr->domain->mr_map, rxm_mr->mr_fid.key);
+		fastlock_release(&rxm_mr->domain->util_domain.lock);
+		ofi_lock_destroy(&rxm_mr->amo_lock);
+	}
+
 	ret = fi_close(&rxm_mr->msg_mr->fid);
 	if (ret)
 		FI_WARN(&rxm_prov, FI_LOG_DOMAIN, "Unable to close MSG MR\n");
@@ -98,10 +106,42 @@ static struct fi_ops rxm_mr_ops = {
 	.ops_open = fi_no_ops_open,
 };
 
+/* Software atomics are applied by the target, which looks up the region
+ * by the key the initiator was given */
+static int rxm_mr_atomic_insert(struct rxm_domain *rxm_domain,
+				struct rxm_mr *rxm_mr, const void *buf,
+				size_t len, uint64_t access)
+{
+	struct iovec iov = {
+		.iov_base = (void *) buf,
+		.iov_len = len,
+	};
+	struct fi_mr_attr attr = {
+		.mr_iov = &iov,
+		.iov_count = 1,
+		.access = access,
+		.requested_key = rxm_mr->mr_fid.key,
+	};
+	uint64_t key;
+	int ret;
+
+	fastlock_acquire(&rxm_domain->util_domain.lock);
+	ret = ofi_mr_insert(&rxm_domain->mr_map, &attr, &key, rxm_mr);
+	fastlock_release(&rxm_domain->util_domain.lock);
+	if (ret)
+		return ret;
+
+	ofi_lock_init(&rxm_mr->amo_lock,
+		      ofi_domain_lock_type(&rxm_domain->util_domain));
+	rxm_mr->domain = rxm_domain;
+	return 0;
+}
+
 static int rxm_mr_reg(struct fid *domain_fid, const void *buf, size_t len,
 	   uint64_t access, uint64_t offset, uint64_t requested_key,
 	   uint64_t flags, struct fid_mr **mr, void *context)
 {
+	uint64_t app_access = access;
 	struct rxm_domain *rxm_domain;
 	struct rxm_mr *rxm_mr;
 	int ret;
@@ -133,6 +173,17 @@ static int rxm_mr_reg(struct fid *domain_fid, const void *buf, size_t len,
 	 * The key would be used in large message transfer protocol. */
 	rxm_mr->mr_fid.mem_desc = rxm_mr->msg_mr;
 	rxm_mr->mr_fid.key = fi_mr_key(rxm_mr->msg_mr);
+
+	if (rxm_domain->util_domain.info_domain_caps & FI_ATOMIC) {
+		ret = rxm_mr_atomic_insert(rxm_domain, rxm_mr, buf, len,
+					   app_access);
+		if (ret) {
+			FI_WARN(&rxm_prov, FI_LOG_DOMAIN,
+				"Unable to track MR for atomics\n");
+			fi_close(&rxm_mr->msg_mr->fid);
+			goto err;
+		}
+	}
 	*mr = &rxm_mr->mr_fid;
 
 	return 0;
@@ -183,6 +234,11 @@ int rxm_domain_open(struct fid_fabric *fabric, struct fi_info *info,
 		goto err3;
 	}
 
+	ret = ofi_mr_map_init(&rxm_prov, RXM_MR_VIRT_ADDR(info) ?
+			      FI_MR_VIRT_ADDR : 0, &rxm_domain->mr_map);
+	if (ret)
+		goto err4;
+
 	*domain = &rxm_domain->util_domain.domain_fid;
 	(*domain)->fid.ops = &rxm_domain_fi_ops;
 	/* Replace MR ops set by ofi_domain_init() */
@@ -194,6 +250,8 @@ int rxm_domain_open(struct fid_fabric *fabric, struct fi_info *info,
 
 	fi_freeinfo(msg_info);
 	return 0;
+err4:
+	ofi_domain_close(&rxm_domain->util_domain);
 err3:
 	fi_close(&rxm_domain->msg_domain->fid);
 err2:
@@ -65,6 +65,22 @@ static int rxm_match_recv_entry_context(struct dlist_entry *item, const void *co
 	return recv_entry->context == context;
 }
 
+static const struct ofi_stat_def rxm_ep_stat_defs[RXM_STAT_MAX] = {
+	[RXM_STAT_TX_MSGS]	= { "tx_msgs", OFI_STAT_COUNTER },
+	[RXM_STAT_TX_INJECT]	= { "tx_inject", OFI_STAT_COUNTER },
+	[RXM_STAT_TX_LMT]	= { "tx_lmt", OFI_STAT_COUNTER },
+	[RXM_STAT_TX_SIZE]	= { "tx_size", OFI_STAT_HIST },
+	[RXM_STAT_RX_MSGS]	= { "rx_msgs", OFI_STAT_COUNTER },
+	[RXM_STAT_UNEXP_MSGS]	= { "unexp_msgs", OFI_STAT_COUNTER },
+	[RXM_STAT_UNEXP_DEPTH]	= { "unexp_depth", OFI_STAT_GAUGE },
+	[RXM_STAT_TX_BUF_BYTES]	= { "tx_buf_bytes", OFI_STAT_GAUGE },
+	[RXM_STAT_RX_BUF_BYTES]	= { "rx_buf_bytes", OFI_STAT_GAUGE },
+	[RXM_STAT_TX_ATOMICS]	= { "tx_atomics", OFI_STAT_COUNTER },
+	[RXM_STAT_ATOMIC_BATCH]	= { "atomic_batch", OFI_STAT_HIST },
+	[RXM_STAT_RX_ATOMICS]	= { "rx_atomics", OFI_STAT_COUNTER },
+	[RXM_STAT_SEND_AGG]	= { "send_agg", OFI_STAT_HIST },
+};
+
 static int rxm_match_unexp_msg(struct dlist_entry *item, const void *arg)
 {
 	struct rxm_recv_match_attr *attr = (struct rxm_recv_match_attr *)arg;
@@ -104,33 +120,32 @@ static int rxm_mr_buf_reg(void *pool_ctx, void *addr, size_t len, void **context
 
 void rxm_buf_release(struct rxm_buf_pool *pool, struct rxm_buf *buf)
 {
-	fastlock_acquire(&pool->lock);
+	ofi_lock_acquire(&pool->lock);
 	dlist_remove(&buf->entry);
-	util_buf_release(pool->pool, buf);
-	fastlock_release(&pool->lock);
+	util_buddy_free(buf->region, buf, buf->size);
+	ofi_lock_release(&pool->lock);
 }
 
-struct rxm_buf *rxm_buf_get(struct rxm_buf_pool *pool)
+struct rxm_buf *rxm_buf_get(struct rxm_buf_pool *pool, size_t size)
 {
+	struct util_buddy_region *region;
 	struct rxm_buf *buf;
-	void *mr = NULL;
 
-	fastlock_acquire(&pool->lock);
-	if (pool->local_mr)
-		buf = util_buf_alloc_ex(pool->pool, (void **)&mr);
-	else
-		buf = util_buf_alloc(pool->pool);
+	ofi_lock_acquire(&pool->lock);
+	buf = util_buddy_alloc(pool->pool, size, &region);
 	if (!buf) {
-		fastlock_release(&pool->lock);
+		ofi_lock_release(&pool->lock);
 		return NULL;
 	}
 	memset(buf, 0, sizeof(*buf));
+	buf->region = region;
+	buf->size = size;
 
 	dlist_insert_tail(&buf->entry, &pool->buf_list);
-	fastlock_release(&pool->lock);
+	ofi_lock_release(&pool->lock);
 
-	if (pool->local_mr && mr)
-		buf->desc = fi_mr_desc((struct fid_mr *)mr);
+	if (pool->local_mr)
+		buf->desc = fi_mr_desc((struct fid_mr *) region->context);
 	return buf;
 }
 
@@ -144,41 +159,49 @@ static void rxm_buf_pool_destroy(struct rxm_buf_pool *pool)
 		buf = container_of(entry, struct rxm_buf, entry);
 		rxm_buf_release(pool, buf);
 	}
-	fastlock_destroy(&pool->lock);
-	util_buf_pool_destroy(pool->pool);
+	ofi_lock_destroy(&pool->lock);
+	util_buddy_pool_destroy(pool->pool);
 }
 
-static int rxm_buf_pool_create(int local_mr, size_t chunk_count, size_t size,
-		struct rxm_buf_pool *pool, void *pool_ctx)
+/* Regions are registered as a whole when the MSG provider needs local
+ * MRs.  region_size is rounded up to a multiple of the largest block. */
+static int rxm_buf_pool_create(int local_mr, size_t region_size,
+		struct rxm_buf_pool *pool, void *pool_ctx,
+		enum ofi_lock_type lock_type)
 {
+	region_size = fi_get_aligned_sz(MAX(region_size, rxm_buffer_size),
+					rxm_buffer_size);
 	pool->pool = local_mr ?
-		util_buf_pool_create_ex(RXM_BUF_SIZE + size, 16, 0, chunk_count,
-					rxm_mr_buf_reg, rxm_mr_buf_close,
-					pool_ctx) :
-		util_buf_pool_create(RXM_BUF_SIZE, 16, 0, chunk_count);
+		util_buddy_pool_create(RXM_BUF_MIN_SIZE, rxm_buffer_size,
+				       region_size, 0, rxm_mr_buf_reg,
+				       rxm_mr_buf_close, pool_ctx) :
+		util_buddy_pool_create(RXM_BUF_MIN_SIZE, rxm_buffer_size,
+				       region_size, 0, NULL, NULL, NULL);
 	if (!pool->pool) {
 		FI_WARN(&rxm_prov, FI_LOG_EP_CTRL, "Unable to create buf pool\n");
 		return -FI_ENOMEM;
 	}
 	dlist_init(&pool->buf_list);
 	pool->local_mr = local_mr;
-	fastlock_init(&pool->lock);
+	ofi_lock_init(&pool->lock, lock_type);
 	return 0;
 }
 
-static int rxm_send_queue_init(struct rxm_send_queue *send_queue, size_t size)
+static int rxm_send_queue_init(struct rxm_send_queue *send_queue, size_t size,
+			       enum ofi_lock_type lock_type)
 {
 	send_queue->fs = rxm_txe_fs_create(size);
 	if (!send_queue->fs)
 		return -FI_ENOMEM;
 
 	ofi_key_idx_init(&send_queue->tx_key_idx, fi_size_bits(size));
-	fastlock_init(&send_queue->lock);
+	ofi_lock_init(&send_queue->lock, lock_type);
 	return 0;
 }
 
 static int rxm_recv_queue_init(struct rxm_recv_queue *recv_queue, size_t size,
-			       enum rxm_recv_queue_type type)
+			       enum rxm_recv_queue_type type,
+			       enum ofi_lock_type lock_type)
 {
 	recv_queue->type = type;
 	recv_queue->fs = rxm_recv_fs_create(size);
@@ -194,7 +217,7 @@ static int rxm_recv_queue_init(struct rxm_recv_queue *recv_queue, size_t size,
 		recv_queue->match_recv = rxm_match_recv_entry_tagged;
 		recv_queue->match_unexp = rxm_match_unexp_msg_tagged;
 	}
-	fastlock_init(&recv_queue->lock);
+	ofi_lock_init(&recv_queue->lock, lock_type);
 	return 0;
 }
 
@@ -202,55 +225,75 @@ static void rxm_send_queue_close(struct rxm_send_queue *send_queue)
 {
 	if (send_queue->fs)
 		rxm_txe_fs_free(send_queue->fs);
-	fastlock_destroy(&send_queue->lock);
+	ofi_lock_destroy(&send_queue->lock);
 }
 
 static void rxm_recv_queue_close(struct rxm_recv_queue *recv_queue)
 {
 	if (recv_queue->fs)
 		rxm_recv_fs_free(recv_queue->fs);
-	fastlock_destroy(&recv_queue->lock);
+	ofi_lock_destroy(&recv_queue->lock);
 	// TODO cleanup recv_list and unexp msg list
 }
 
 static int rxm_ep_txrx_res_open(struct rxm_ep *rxm_ep)
 {
 	struct rxm_domain *rxm_domain;
+	enum ofi_lock_type lock_type;
 	int ret;
 
 	rxm_domain = container_of(rxm_ep->util_ep.domain, struct rxm_domain, util_domain);
 
+	/* The connection event thread preposts receive buffers, so only the
+	 * rx pool keeps its lock regardless of the threading model. */
+	lock_type = ofi_domain_lock_type(&rxm_domain->util_domain);
+
 	FI_DBG(&rxm_prov, FI_LOG_EP_CTRL, "MSG provider mr_mode & FI_MR_LOCAL: %d\n",
 			OFI_CHECK_MR_LOCAL(rxm_ep->msg_info));
 
+	/* Most sends are small: size the tx regions for a queue of minimum
+	 * blocks, and the rx regions for the buffers posted to a MSG EP */
 	ret = rxm_buf_pool_create(OFI_CHECK_MR_LOCAL(rxm_ep->msg_info),
-				  rxm_ep->msg_info->tx_attr->size,
-				  sizeof(struct rxm_tx_buf), &rxm_ep->tx_pool,
-				  rxm_domain->msg_domain);
+				  roundup_power_of_two(
+					rxm_ep->msg_info->tx_attr->size) *
+				  RXM_BUF_MIN_SIZE, &rxm_ep->tx_pool,
+				  rxm_domain->msg_domain, lock_type);
 	if (ret)
 	        return ret;
+	util_buddy_pool_set_stats(rxm_ep->tx_pool.pool, &rxm_ep->stats,
+				  RXM_STAT_TX_BUF_BYTES);
 
 	ret = rxm_buf_pool_create(OFI_CHECK_MR_LOCAL(rxm_ep->msg_info),
-				  rxm_ep->msg_info->rx_attr->size,
-				  sizeof(struct rxm_rx_buf), &rxm_ep->rx_pool,
-				  rxm_domain->msg_domain);
+				  rxm_ep->msg_info->rx_attr->size *
+				  rxm_buffer_size, &rxm_ep->rx_pool,
+				  rxm_domain->msg_domain, OFI_LOCK_FAST);
 	if (ret)
 		goto err1;
+	util_buddy_pool_set_stats(rxm_ep->rx_pool.pool, &rxm_ep->stats,
+				  RXM_STAT_RX_BUF_BYTES);
 
-	ret = rxm_send_queue_init(&rxm_ep->send_queue, rxm_ep->rxm_info->tx_attr->size);
+	ret = rxm_send_queue_init(&rxm_ep->send_queue,
+				  rxm_ep->rxm_info->tx_attr->size, lock_type);
 	if (ret)
 		goto err2;
 
 	ret = rxm_recv_queue_init(&rxm_ep->recv_queue, rxm_ep->rxm_info->rx_attr->size,
-				  RXM_RECV_QUEUE_MSG);
+				  RXM_RECV_QUEUE_MSG, lock_type);
 	if (ret)
 		goto err3;
 
 	ret = rxm_recv_queue_init(&rxm_ep->trecv_queue, rxm_ep->rxm_info->rx_attr->size,
-				  RXM_RECV_QUEUE_TAGGED);
+				  RXM_RECV_QUEUE_TAGGED, lock_type);
 	if (ret)
 		goto err4;
 
+	dlist_init(&rxm_ep->rx_stall_list);
+	dlist_init(&rxm_ep->atomic_batch_list);
+	dlist_init(&rxm_ep->send_agg_list);
+	dlist_init(&rxm_ep->deferred_list);
+	ofi_atomic_initialize32(&rxm_ep->deferred_cnt, 0);
+	dlist_init(&rxm_ep->conn_close_list);
+	fastlock_init(&rxm_ep->batch_lock);
 	return 0;
 err4:
 	rxm_recv_queue_close(&rxm_ep->recv_queue);
@@ -265,6 +308,7 @@ err1:
 
 static void rxm_ep_txrx_res_close(struct rxm_ep *rxm_ep)
 {
+	fastlock_destroy(&rxm_ep->batch_lock);
 
 	rxm_recv_queue_close(&rxm_ep->trecv_queue);
 	rxm_recv_queue_close(&rxm_ep->recv_queue);
@@ -280,12 +324,19 @@ int rxm_ep_repost_buf(struct rxm_rx_buf *rx_buf)
 	struct rxm_ep *rxm_ep = rx_buf->ep;
 	int ret;
 
+	/* Messages unpacked from an aggregate were never posted */
+	if (!hdr.msg_ep) {
+		rxm_buf_release(&rxm_ep->rx_pool, (struct rxm_buf *)rx_buf);
+		return 0;
+	}
+
 	memset(rx_buf, 0, sizeof(*rx_buf));
 	rx_buf->hdr = hdr;
 	rx_buf->hdr.state = RXM_RX;
 	rx_buf->ep = rxm_ep;
 
-	ret = fi_recv(rx_buf->hdr.msg_ep, &rx_buf->pkt, RXM_BUF_SIZE,
+	ret = fi_recv(rx_buf->hdr.msg_ep, &rx_buf->pkt,
+		      rxm_buffer_size - offsetof(struct rxm_rx_buf, pkt),
 		      rx_buf->hdr.desc, FI_ADDR_UNSPEC, rx_buf);
 	if (ret)
 		FI_WARN(&rxm_prov, FI_LOG_EP_CTRL, "Unable to repost buf\n");
@@ -299,7 +350,10 @@ int rxm_ep_prepost_buf(struct rxm_ep *rxm_ep, struct fid_ep *msg_ep)
 	size_t i;
 
 	for (i = 0; i < rxm_ep->msg_info->rx_attr->size; i++) {
-		rx_buf = (struct rxm_rx_buf *)rxm_buf_get(&rxm_ep->rx_pool);
+		rx_buf = (struct rxm_rx_buf *)rxm_buf_get(&rxm_ep->rx_pool,
+							  rxm_buffer_size);
+		if (!rx_buf)
+			return -FI_ENOMEM;
 		rx_buf->hdr.state = RXM_RX;
 		rx_buf->hdr.msg_ep = msg_ep;
 		rx_buf->ep = rxm_ep;
@@ -348,11 +402,11 @@ static int rxm_ep_cancel_recv(struct rxm_ep *rxm_ep,
 	struct rxm_recv_entry *recv_entry;
 	struct dlist_entry *entry;
 
-	fastlock_acquire(&recv_queue->lock);
+	ofi_lock_acquire(&recv_queue->lock);
 	entry = dlist_remove_first_match(&recv_queue->recv_list,
 					 rxm_match_recv_entry_context,
 					 context);
-	fastlock_release(&recv_queue->lock);
+	ofi_lock_release(&recv_queue->lock);
 	if (entry) {
 		recv_entry = container_of(entry, struct rxm_recv_entry, entry);
 		memset(&err_entry, 0, sizeof(err_entry));
@@ -449,11 +503,11 @@ static int rxm_ep_peek_recv(struct rxm_ep *rxm_ep, fi_addr_t addr, uint64_t tag,
 
 	rxm_cq_progress(rxm_ep);
 
-	fastlock_acquire(&recv_queue->lock);
+	ofi_lock_acquire(&recv_queue->lock);
 
 	rx_buf = rxm_check_unexp_msg_list(recv_queue, addr, tag, ignore);
 	if (!rx_buf) {
-		fastlock_release(&recv_queue->lock);
+		ofi_lock_release(&recv_queue->lock);
 		FI_DBG(&rxm_prov, FI_LOG_EP_DATA, "Message not found\n");
 		return ofi_cq_write_error_peek(rxm_ep->util_ep.rx_cq, tag,
 					       context);
@@ -463,7 +517,8 @@ static int rxm_ep_peek_recv(struct rxm_ep *rxm_ep, fi_addr_t addr, uint64_t tag,
 
 	if (flags & FI_DISCARD) {
 		dlist_remove(&rx_buf->unexp_msg.entry);
-		fastlock_release(&recv_queue->lock);
+		ofi_stats_dec(&rxm_ep->stats, RXM_STAT_UNEXP_DEPTH);
+		ofi_lock_release(&recv_queue->lock);
 		return rxm_ep_discard_recv(rxm_ep, rx_buf, context);
 	}
 
@@ -471,8 +526,9 @@ static int rxm_ep_peek_recv(struct rxm_ep *rxm_ep, fi_addr_t addr, uint64_t tag,
 		FI_DBG(&rxm_prov, FI_LOG_EP_DATA, "Marking message for Claim\n");
 		((struct fi_context *)context)->internal[0] = rx_buf;
 		dlist_remove(&rx_buf->unexp_msg.entry);
+		ofi_stats_dec(&rxm_ep->stats, RXM_STAT_UNEXP_DEPTH);
 	}
-	fastlock_release(&recv_queue->lock);
+	ofi_lock_release(&recv_queue->lock);
 
 	return ofi_cq_write(rxm_ep->util_ep.rx_cq, context, FI_TAGGED | FI_RECV,
 			    0, NULL, rx_buf->pkt.hdr.data, rx_buf->pkt.hdr.tag);
@@ -506,12 +562,14 @@ static int rxm_ep_recv_common(struct rxm_ep *rxm_ep, const struct iovec *iov,
 		if (flags & FI_DISCARD)
 			return rxm_ep_discard_recv(rxm_ep, rx_buf, context);
 	} else {
-		fastlock_acquire(&recv_queue->lock);
+		ofi_lock_acquire(&recv_queue->lock);
 		rx_buf = rxm_check_unexp_msg_list(recv_queue, src_addr, tag,
 						  ignore);
-		if (rx_buf)
+		if (rx_buf) {
 			dlist_remove(&rx_buf->unexp_msg.entry);
-		fastlock_release(&recv_queue->lock);
+			ofi_stats_dec(&rxm_ep->stats, RXM_STAT_UNEXP_DEPTH);
+		}
+		ofi_lock_release(&recv_queue->lock);
 	}
 
 	recv_entry = rxm_recv_entry_get(recv_queue);
@@ -548,9 +606,9 @@ static int rxm_ep_recv_common(struct rxm_ep *rxm_ep, const struct iovec *iov,
 	RXM_DBG_ADDR_TAG(FI_LOG_EP_DATA, "Enqueuing recv", recv_entry->addr,
 			 recv_entry->tag);
 
-	fastlock_acquire(&recv_queue->lock);
+	ofi_lock_acquire(&recv_queue->lock);
 	dlist_insert_tail(&recv_entry->entry, &recv_queue->recv_list);
-	fastlock_release(&recv_queue->lock);
+	ofi_lock_release(&recv_queue->lock);
 	return 0;
 }
 
@@ -667,6 +725,366 @@ static ssize_t rxm_rma_iov_init(struct rxm_ep *rxm_ep, void *buf,
 	return sizeof(*rma_iov) + sizeof(*rma_iov->iov) * count;
 }
 
+static inline void rxm_ep_tx_stats(struct rxm_ep *rxm_ep, struct rxm_pkt *pkt)
+{
+	ofi_stats_inc(&rxm_ep->stats, RXM_STAT_TX_MSGS);
+	ofi_stats_hist(&rxm_ep->stats, RXM_STAT_TX_SIZE, pkt->hdr.size);
+	if (pkt->ctrl_hdr.type == ofi_ctrl_large_data)
+		ofi_stats_inc(&rxm_ep->stats, RXM_STAT_TX_LMT);
+}
+
+/* Sends a protocol packet that generates no user completion */
+int rxm_ep_send_ctrl(struct rxm_ep *rxm_ep, struct fid_ep *msg_ep,
+		     struct rxm_tx_buf *tx_buf)
+{
+	struct rxm_tx_entry *tx_entry;
+	size_t len = sizeof(tx_buf->pkt) + tx_buf->pkt.hdr.size;
+	int ret;
+
+	if (len <= rxm_ep->msg_info->tx_attr->inject_size) {
+		ret = fi_inject(msg_ep, &tx_buf->pkt, len, 0);
+		if (!ret)
+			rxm_buf_release(&rxm_ep->tx_pool,
+					(struct rxm_buf *) tx_buf);
+		return ret;
+	}
+
+	tx_entry = rxm_tx_entry_get(&rxm_ep->send_queue);
+	if (!tx_entry)
+		return -FI_EAGAIN;
+
+	memset(tx_entry, 0, sizeof(*tx_entry));
+	tx_entry->state = RXM_TX;
+	tx_entry->ep = rxm_ep;
+	tx_entry->tx_buf = tx_buf;
+
+	ret = fi_send(msg_ep, &tx_buf->pkt, len, tx_buf->hdr.desc, 0, tx_entry);
+	if (ret)
+		rxm_tx_entry_release(&rxm_ep->send_queue, tx_entry);
+	return ret;
+}
+
+static size_t rxm_send_agg_rec_len(size_t len, uint64_t flags)
+{
+	return fi_get_aligned_sz(sizeof(struct rxm_agg_hdr) + len +
+				 ((flags & FI_REMOTE_CQ_DATA) ?
+				  sizeof(uint64_t) : 0), 8);
+}
+
+static int rxm_send_agg_flush_locked(struct rxm_ep *rxm_ep,
+				     struct rxm_conn *rxm_conn)
+{
+	struct rxm_tx_buf *tx_buf = rxm_conn->send_agg;
+	uint8_t count = tx_buf->pkt.hdr.op_data;
+	int ret;
+
+	ret = rxm_ep_send_ctrl(rxm_ep, rxm_conn->msg_ep, tx_buf);
+	if (ret)
+		return ret;
+
+	ofi_stats_hist(&rxm_ep->stats, RXM_STAT_SEND_AGG, count);
+	rxm_conn->send_agg = NULL;
+	dlist_remove(&rxm_conn->send_agg_entry);
+	return 0;
+}
+
+int rxm_send_agg_flush(struct rxm_ep *rxm_ep, struct rxm_conn *rxm_conn)
+{
+	int ret = 0;
+
+	fastlock_acquire(&rxm_ep->batch_lock);
+	if (rxm_conn->send_agg)
+		ret = rxm_send_agg_flush_locked(rxm_ep, rxm_conn);
+	fastlock_release(&rxm_ep->batch_lock);
+	if (ret == -FI_EAGAIN)
+		rxm_cq_progress(rxm_ep);
+	return ret;
+}
+
+void rxm_send_agg_flush_all(struct rxm_ep *rxm_ep)
+{
+	struct rxm_conn *rxm_conn;
+	struct dlist_entry *tmp;
+
+	fastlock_acquire(&rxm_ep->batch_lock);
+	dlist_foreach_container_safe(&rxm_ep->send_agg_list,
+				     struct rxm_conn, rxm_conn,
+				     send_agg_entry, tmp) {
+		if (rxm_send_agg_flush_locked(rxm_ep, rxm_conn))
+			break;
+	}
+	fastlock_release(&rxm_ep->batch_lock);
+}
+
+void rxm_send_agg_conn_close(struct rxm_ep *rxm_ep, struct rxm_conn *rxm_conn)
+{
+	fastlock_acquire(&rxm_ep->batch_lock);
+	if (rxm_conn->send_agg &&
+	    rxm_send_agg_flush_locked(rxm_ep, rxm_conn)) {
+		FI_WARN(&rxm_prov, FI_LOG_EP_DATA,
+			"Dropping %d aggregated sends\n",
+			rxm_conn->send_agg->pkt.hdr.op_data);
+		rxm_buf_release(&rxm_ep->tx_pool,
+				(struct rxm_buf *) rxm_conn->send_agg);
+		rxm_conn->send_agg = NULL;
+		dlist_remove(&rxm_conn->send_agg_entry);
+	}
+	fastlock_release(&rxm_ep->batch_lock);
+}
+
+/*
+ * Sends posted with FI_MORE are fully built and queued on the endpoint.
+ * They are posted to the MSG provider with the next operation posted
+ * without FI_MORE, or when the endpoint is progressed.  Consecutive sends
+ * to the same peer are posted with FI_MORE on all but the last one, so
+ * that the MSG provider can hand them to the device at once.
+ */
+static void rxm_deferred_fail(struct rxm_ep *rxm_ep,
+			      struct rxm_tx_entry *tx_entry, int err)
+{
+	struct fi_cq_err_entry err_entry = {0};
+
+	FI_WARN(&rxm_prov, FI_LOG_EP_DATA,
+		"deferred send failed: %s\n", fi_strerror(-err));
+	if (tx_entry->state == RXM_LMT_TX &&
+	    !OFI_CHECK_MR_LOCAL(rxm_ep->rxm_info))
+		rxm_ep_msg_mr_closev(tx_entry->mr, tx_entry->count);
+
+	if (rxm_ep->util_ep.tx_cntr)
+		ofi_cntr_inc_err(rxm_ep->util_ep.tx_cntr);
+	if ((tx_entry->flags & FI_COMPLETION) && rxm_ep->util_ep.tx_cq) {
+		err_entry.op_context = tx_entry->context;
+		err_entry.flags = tx_entry->comp_flags;
+		err_entry.err = -err;
+		err_entry.prov_errno = err;
+		if (ofi_cq_write_error(rxm_ep->util_ep.tx_cq, &err_entry))
+			FI_WARN(&rxm_prov, FI_LOG_CQ,
+				"Unable to report completion\n");
+	}
+
+	dlist_remove(&tx_entry->deferred_entry);
+	ofi_atomic_dec32(&rxm_ep->deferred_cnt);
+	rxm_buf_release(&rxm_ep->tx_pool, (struct rxm_buf *) tx_entry->tx_buf);
+	rxm_tx_entry_release(&rxm_ep->send_queue, tx_entry);
+}
+
+static int rxm_deferred_flush_locked(struct rxm_ep *rxm_ep)
+{
+	struct rxm_tx_entry *tx_entry, *next;
+	struct fid_ep *msg_ep;
+	struct fi_msg msg;
+	struct iovec iov;
+	uint64_t flags;
+	int ret;
+
+	msg.iov_count = 1;
+	msg.addr = 0;
+	msg.data = 0;
+	while (!dlist_empty(&rxm_ep->deferred_list)) {
+		tx_entry = container_of(rxm_ep->deferred_list.next,
+					struct rxm_tx_entry, deferred_entry);
+		msg_ep = tx_entry->tx_buf->hdr.msg_ep;
+
+		flags = FI_COMPLETION;
+		if (tx_entry->deferred_entry.next != &rxm_ep->deferred_list) {
+			next = container_of(tx_entry->deferred_entry.next,
+					    struct rxm_tx_entry, deferred_entry);
+			if (next->tx_buf->hdr.msg_ep == msg_ep)
+				flags |= FI_MORE;
+		}
+
+		iov.iov_base = &tx_entry->tx_buf->pkt;
+		iov.iov_len = tx_entry->pkt_size;
+		msg.msg_iov = &iov;
+		msg.desc = &tx_entry->tx_buf->hdr.desc;
+		msg.context = tx_entry;
+		ret = fi_sendmsg(msg_ep, &msg, flags);
+		if (ret == -FI_EAGAIN)
+			return ret;
+		if (ret) {
+			rxm_deferred_fail(rxm_ep, tx_entry, ret);
+			continue;
+		}
+		dlist_remove(&tx_entry->deferred_entry);
+		ofi_atomic_dec32(&rxm_ep->deferred_cnt);
+	}
+	return 0;
+}
+
+int rxm_deferred_flush(struct rxm_ep *rxm_ep)
+{
+	int ret;
+
+	fastlock_acquire(&rxm_ep->batch_lock);
+	ret = rxm_deferred_flush_locked(rxm_ep);
+	fastlock_release(&rxm_ep->batch_lock);
+	if (ret == -FI_EAGAIN)
+		rxm_cq_progress(rxm_ep);
+	return ret;
+}
+
+void rxm_deferred_conn_close(struct rxm_ep *rxm_ep, struct rxm_conn *rxm_conn)
+{
+	struct rxm_tx_entry *tx_entry;
+	struct dlist_entry *tmp;
+
+	fastlock_acquire(&rxm_ep->batch_lock);
+	if (rxm_deferred_flush_locked(rxm_ep)) {
+		dlist_foreach_container_safe(&rxm_ep->deferred_list,
+					     struct rxm_tx_entry, tx_entry,
+					     deferred_entry, tmp) {
+			if (tx_entry->tx_buf->hdr.msg_ep == rxm_conn->msg_ep)
+				rxm_deferred_fail(rxm_ep, tx_entry,
+						  -FI_ECONNABORTED);
+		}
+	}
+	fastlock_release(&rxm_ep->batch_lock);
+}
+
+/*
+ * Each staged send takes the tx_pool and send_queue locks for its
+ * buffers, then batch_lock to queue itself.  The first two are elided
+ * under FI_THREAD_DOMAIN.  batch_lock is not held across the calls of a
+ * batch, as the CM thread may need it to queue a connection for closing
+ * while the application is between calls.
+ */
+static void rxm_deferred_queue(struct rxm_ep *rxm_ep,
+			       struct rxm_tx_entry *tx_entry)
+{
+	fastlock_acquire(&rxm_ep->batch_lock);
+	dlist_insert_tail(&tx_entry->deferred_entry, &rxm_ep->deferred_list);
+	ofi_atomic_inc32(&rxm_ep->deferred_cnt);
+	fastlock_release(&rxm_ep->batch_lock);
+}
+
+/*
+ * Small sends that don't request a completion are appended to a per-peer
+ * packet and counted right away.  The packet is sent once the next record
+ * would exceed the aggregation budget, before any other operation to the
+ * same peer, or when the endpoint is progressed.  The target unpacks the
+ * records in order.
+ */
+static ssize_t
+rxm_ep_send_agg(struct rxm_ep *rxm_ep, struct rxm_conn *rxm_conn,
+		const struct iovec *iov, size_t count, size_t len,
+		uint64_t data, uint64_t flags, uint64_t tag, int op)
+{
+	struct rxm_agg_hdr *rec;
+	struct rxm_tx_buf *tx_buf;
+	struct rxm_pkt *pkt;
+	char *payload;
+	size_t rec_len;
+	ssize_t ret = 0;
+
+	rec_len = rxm_send_agg_rec_len(len, flags);
+
+	fastlock_acquire(&rxm_ep->batch_lock);
+	tx_buf = rxm_conn->send_agg;
+	if (tx_buf && (tx_buf->pkt.hdr.op_data == UINT8_MAX ||
+		       tx_buf->pkt.hdr.size + rec_len > rxm_ep->send_agg_size)) {
+		ret = rxm_send_agg_flush_locked(rxm_ep, rxm_conn);
+		if (ret)
+			goto unlock;
+		tx_buf = NULL;
+	}
+
+	if (!tx_buf) {
+		tx_buf = rxm_tx_buf_get(rxm_ep, rxm_ep->send_agg_size);
+		if (!tx_buf) {
+			ret = -FI_EAGAIN;
+			goto unlock;
+		}
+		rxm_pkt_init(&tx_buf->pkt);
+		tx_buf->pkt.ctrl_hdr.type = ofi_ctrl_agg_data;
+		tx_buf->pkt.ctrl_hdr.conn_id = rxm_conn->handle.remote_key;
+		tx_buf->hdr.msg_ep = rxm_conn->msg_ep;
+		rxm_conn->send_agg = tx_buf;
+		dlist_insert_tail(&rxm_conn->send_agg_entry,
+				  &rxm_ep->send_agg_list);
+	}
+
+	pkt = &tx_buf->pkt;
+	rec = (struct rxm_agg_hdr *) (pkt->data + pkt->hdr.size);
+	rec->op = op;
+	rec->flags = 0;
+	rec->resv = 0;
+	rec->size = len;
+	rec->tag = tag;
+	payload = rec->data;
+	if (flags & FI_REMOTE_CQ_DATA) {
+		rec->flags = OFI_REMOTE_CQ_DATA;
+		memcpy(payload, &data, sizeof(data));
+		payload += sizeof(data);
+	}
+	ofi_copy_from_iov(payload, len, iov, count, 0);
+	pkt->hdr.size += rec_len;
+	pkt->hdr.op_data++;
+
+	ofi_stats_inc(&rxm_ep->stats, RXM_STAT_TX_MSGS);
+	ofi_stats_hist(&rxm_ep->stats, RXM_STAT_TX_SIZE, len);
+	if (rxm_ep->util_ep.tx_cntr)
+		ofi_cntr_inc(rxm_ep->util_ep.tx_cntr);
+unlock:
+	fastlock_release(&rxm_ep->batch_lock);
+	if (ret == -FI_EAGAIN)
+		rxm_cq_progress(rxm_ep);
+	return ret;
+}
+
+static ssize_t
+rxm_ep_inject_fast(struct rxm_ep *rxm_ep, const struct iovec *iov, size_t count,
+		   size_t len, fi_addr_t dest_addr, uint64_t data,
+		   uint64_t flags, uint64_t tag, int op)
+{
+	struct rxm_conn *rxm_conn;
+	struct rxm_pkt *pkt;
+	uint64_t inject_buf[RXM_INJECT_BUF_SIZE / sizeof(uint64_t)];
+	int ret;
+
+	ret = rxm_ep_get_conn(rxm_ep, dest_addr, &rxm_conn);
+	if (ret)
+		return ret;
+
+	ret = rxm_ep_deferred_flush(rxm_ep);
+	if (ret)
+		return ret;
+
+	ret = rxm_conn_atomic_flush(rxm_ep, rxm_conn);
+	if (ret)
+		return ret;
+
+	if (rxm_send_agg_rec_len(len, flags) <= rxm_ep->send_agg_size)
+		return rxm_ep_send_agg(rxm_ep, rxm_conn, iov, count, len,
+				       data, flags, tag, op);
+
+	ret = rxm_conn_send_agg_flush(rxm_ep, rxm_conn);
+	if (ret)
+		return ret;
+
+	pkt = (struct rxm_pkt *)inject_buf;
+	*pkt = rxm_conn->inject_pkt;
+	pkt->hdr.op = op;
+	pkt->hdr.size = len;
+	pkt->hdr.tag = tag;
+	if (flags & FI_REMOTE_CQ_DATA) {
+		pkt->hdr.flags = OFI_REMOTE_CQ_DATA;
+		pkt->hdr.data = data;
+	}
+	ofi_copy_from_iov(pkt->data, len, iov, count, 0);
+
+	ret = fi_inject(rxm_conn->msg_ep, pkt, sizeof(*pkt) + len, 0);
+	if (ret) {
+		FI_DBG(&rxm_prov, FI_LOG_EP_DATA,
+		       "fi_inject for MSG provider failed\n");
+		return ret;
+	}
+	ofi_stats_inc(&rxm_ep->stats, RXM_STAT_TX_INJECT);
+	rxm_ep_tx_stats(rxm_ep, pkt);
+	if (rxm_ep->util_ep.tx_cntr)
+		ofi_cntr_inc(rxm_ep->util_ep.tx_cntr);
+	return 0;
+}
+
 // TODO handle all flags
 static ssize_t
 rxm_ep_send_common(struct fid_ep *ep_fid, const struct iovec *iov, void **desc,
@@ -674,33 +1092,58 @@ rxm_ep_send_common(struct fid_ep *ep_fid, const struct iovec *iov, void **desc,
 		   uint64_t data, uint64_t flags, uint64_t tag, int op,
 		   uint64_t comp_flags)
 {
-	struct util_cmap_handle *handle;
 	struct rxm_ep *rxm_ep;
 	struct rxm_conn *rxm_conn;
 	struct rxm_tx_entry *tx_entry;
 	struct rxm_tx_buf *tx_buf;
 	struct rxm_pkt *pkt;
 	struct fid_mr **mr_iov;
-	size_t pkt_size = 0;
+	size_t pkt_size = 0, len;
 	ssize_t size;
 	uint8_t progress = 0;
 	int ret;
 
 	rxm_ep = container_of(ep_fid, struct rxm_ep, util_ep.ep_fid.fid);
 
-	ret = ofi_cmap_get_handle(rxm_ep->util_ep.cmap, dest_addr, &handle);
+	/* Completion-less small sends are copied into a pre-built header
+	 * and injected without taking a tx_buf or tx_entry */
+	if ((flags & FI_INJECT) && !(flags & FI_COMPLETION)) {
+		len = ofi_total_iov_len(iov, count);
+		if (len <= rxm_ep->inject_limit)
+			return rxm_ep_inject_fast(rxm_ep, iov, count, len,
+						  dest_addr, data, flags,
+						  tag, op);
+	}
+
+	ret = rxm_ep_get_conn(rxm_ep, dest_addr, &rxm_conn);
 	if (ret)
 		return ret;
-	rxm_conn = container_of(handle, struct rxm_conn, handle);
 
-	tx_buf = (struct rxm_tx_buf *)rxm_buf_get(&rxm_ep->tx_pool);
+	/* Earlier deferred sends stay ahead of this one in the queue */
+	if (flags & FI_MORE) {
+		ret = rxm_conn_atomic_flush(rxm_ep, rxm_conn);
+		if (!ret)
+			ret = rxm_conn_send_agg_flush(rxm_ep, rxm_conn);
+	} else {
+		ret = rxm_conn_flush(rxm_ep, rxm_conn);
+	}
+	if (ret)
+		return ret;
+
+	len = ofi_total_iov_len(iov, count);
+	tx_buf = rxm_tx_buf_get(rxm_ep,
+			len > rxm_ep->rxm_info->tx_attr->inject_size ?
+			sizeof(struct rxm_rma_iov) +
+			sizeof(struct ofi_rma_iov) * count : len);
 	if (!tx_buf) {
 		FI_WARN(&rxm_prov, FI_LOG_EP_DATA, "TX queue full!\n");
 		return -FI_EAGAIN;
 	}
 
-	if (!(tx_entry = rxm_tx_entry_get(&rxm_ep->send_queue)))
+	if (!(tx_entry = rxm_tx_entry_get(&rxm_ep->send_queue))) {
+		rxm_buf_release(&rxm_ep->tx_pool, (struct rxm_buf *)tx_buf);
 		return -FI_EAGAIN;
+	}
 
 	tx_entry->ep = rxm_ep;
 	tx_entry->count = count;
@@ -715,11 +1158,11 @@ rxm_ep_send_common(struct fid_ep *ep_fid, const struct iovec *iov, void **desc,
 	rxm_pkt_init(pkt);
 	pkt->ctrl_hdr.conn_id = rxm_conn->handle.remote_key;
 	pkt->hdr.op = op;
-	pkt->hdr.size = ofi_total_iov_len(iov, count);
+	pkt->hdr.size = len;
 	rxm_op_hdr_process_flags(&pkt->hdr, flags, data);
 
 	pkt->hdr.tag = tag;
-	tx_entry->comp_flags |= comp_flags | FI_SEND;
+	tx_entry->comp_flags = comp_flags | FI_SEND;
 
 	if (pkt->hdr.size > rxm_ep->rxm_info->tx_attr->inject_size) {
 		if (flags & FI_INJECT) {
@@ -729,11 +1172,11 @@ rxm_ep_send_common(struct fid_ep *ep_fid, const struct iovec *iov, void **desc,
 			ret = -FI_EMSGSIZE;
 			goto done;
 		}
-		fastlock_acquire(&rxm_ep->send_queue.lock);
+		ofi_lock_acquire(&rxm_ep->send_queue.lock);
 		pkt->ctrl_hdr.msg_id = ofi_idx2key(&rxm_ep->send_queue.tx_key_idx,
 						   rxm_txe_fs_index(rxm_ep->send_queue.fs,
 								    tx_entry));
-		fastlock_release(&rxm_ep->send_queue.lock);
+		ofi_lock_release(&rxm_ep->send_queue.lock);
 		pkt->ctrl_hdr.type = ofi_ctrl_large_data;
 
 		if (!OFI_CHECK_MR_LOCAL(rxm_ep->rxm_info)) {
@@ -763,6 +1206,13 @@ rxm_ep_send_common(struct fid_ep *ep_fid, const struct iovec *iov, void **desc,
 		tx_entry->state = RXM_TX;
 	}
 
+	if (flags & FI_MORE) {
+		tx_entry->pkt_size = pkt_size;
+		rxm_deferred_queue(rxm_ep, tx_entry);
+		rxm_ep_tx_stats(rxm_ep, pkt);
+		return 0;
+	}
+
 	if ((flags & FI_INJECT) && !(flags & FI_COMPLETION)) {
 		if (pkt_size <= rxm_ep->msg_info->tx_attr->inject_size) {
 			if (tx_entry->state == RXM_LMT_TX) {
@@ -771,9 +1221,15 @@ rxm_ep_send_common(struct fid_ep *ep_fid, const struct iovec *iov, void **desc,
 				tx_entry->state = RXM_LMT_ACK_WAIT;
 			}
 			ret = fi_inject(rxm_conn->msg_ep, pkt, pkt_size, 0);
-			if (ret)
+			if (ret) {
 				FI_DBG(&rxm_prov, FI_LOG_EP_DATA,
 				       "fi_inject for MSG provider failed\n");
+			} else {
+				ofi_stats_inc(&rxm_ep->stats, RXM_STAT_TX_INJECT);
+				rxm_ep_tx_stats(rxm_ep, pkt);
+				if (rxm_ep->util_ep.tx_cntr)
+					ofi_cntr_inc(rxm_ep->util_ep.tx_cntr);
+			}
 			/* release allocated buffer for further reuse */
 			goto done;
 		} else {
@@ -795,6 +1251,7 @@ rxm_ep_send_common(struct fid_ep *ep_fid, const struct iovec *iov, void **desc,
 		}
 		goto done;
 	}
+	rxm_ep_tx_stats(rxm_ep, pkt);
 	return 0;
 done:
 	rxm_buf_release(&rxm_ep->tx_pool, (struct rxm_buf *)tx_buf);
@@ -1056,6 +1513,50 @@ static int rxm_listener_close(struct rxm_ep *rxm_ep)
 	return retv;
 }
 
+static void rxm_ep_get_cntrs(struct rxm_ep *rxm_ep,
+			     struct util_cntr *cntrs[RXM_CNTR_MAX])
+{
+	cntrs[0] = rxm_ep->util_ep.tx_cntr;
+	cntrs[1] = rxm_ep->util_ep.rx_cntr;
+	cntrs[2] = rxm_ep->util_ep.rd_cntr;
+	cntrs[3] = rxm_ep->util_ep.wr_cntr;
+	cntrs[4] = rxm_ep->util_ep.rem_rd_cntr;
+	cntrs[5] = rxm_ep->util_ep.rem_wr_cntr;
+}
+
+static int rxm_ep_cntr_bound(struct rxm_ep *rxm_ep, struct util_cntr *cntr)
+{
+	struct util_cntr *cntrs[RXM_CNTR_MAX];
+	int i;
+
+	rxm_ep_get_cntrs(rxm_ep, cntrs);
+	for (i = 0; i < RXM_CNTR_MAX; i++) {
+		if (cntrs[i] == cntr)
+			return 1;
+	}
+	return 0;
+}
+
+static int rxm_ep_cntr_wait_del(struct rxm_ep *rxm_ep)
+{
+	struct util_cntr *cntrs[RXM_CNTR_MAX];
+	int i, j, ret, retv = 0;
+
+	rxm_ep_get_cntrs(rxm_ep, cntrs);
+	for (i = 0; i < RXM_CNTR_MAX; i++) {
+		if (!cntrs[i] || !cntrs[i]->wait)
+			continue;
+		for (j = 0; j < i && cntrs[j] != cntrs[i]; j++)
+			;
+		if (j < i)
+			continue;
+		ret = ofi_wait_fd_del(cntrs[i]->wait, rxm_ep->msg_cq_fd);
+		if (ret)
+			retv = ret;
+	}
+	return retv;
+}
+
 static int rxm_ep_close(struct fid *fid)
 {
 	struct rxm_ep *rxm_ep;
@@ -1063,28 +1564,36 @@ static int rxm_ep_close(struct fid *fid)
 
 	rxm_ep = container_of(fid, struct rxm_ep, util_ep.ep_fid.fid);
 
-	if (rxm_ep->util_ep.tx_cq->wait) {
+	if (rxm_ep->util_ep.tx_cq && rxm_ep->util_ep.tx_cq->wait) {
 		ret = ofi_wait_fd_del(rxm_ep->util_ep.tx_cq->wait,
 				      rxm_ep->msg_cq_fd);
 		if (ret)
 			retv = ret;
 	}
 
-	if (rxm_ep->util_ep.rx_cq->wait) {
+	if (rxm_ep->util_ep.rx_cq && rxm_ep->util_ep.rx_cq->wait) {
 		ret = ofi_wait_fd_del(rxm_ep->util_ep.rx_cq->wait,
 				      rxm_ep->msg_cq_fd);
 		if (ret)
 			retv = ret;
 	}
 
-	if (rxm_ep->util_ep.cmap)
+	ret = rxm_ep_cntr_wait_del(rxm_ep);
+	if (ret)
+		retv = ret;
+
+	if (rxm_ep->util_ep.cmap) {
 		ofi_cmap_free(rxm_ep->util_ep.cmap);
+		rxm_conn_close_all(rxm_ep);
+	}
+	free((void *)rxm_ep->conn_cache);
 
 	ret = rxm_listener_close(rxm_ep);
 	if (ret)
 		retv = ret;
 
 	rxm_ep_txrx_res_close(rxm_ep);
+	ofi_stats_close(&rxm_ep->stats);
 	ret = rxm_ep_msg_res_close(rxm_ep);
 	if (ret)
 		retv = ret;
@@ -1107,6 +1616,7 @@ static int rxm_ep_trywait(void *arg)
 
 static int rxm_ep_bind(struct fid *ep_fid, struct fid *bfid, uint64_t flags)
 {
+	struct util_cntr *cntr;
 	struct util_cq *cq;
 	struct rxm_ep *rxm_ep;
 	struct util_av *util_av;
@@ -1120,6 +1630,12 @@ static int rxm_ep_bind(struct fid *ep_fid, struct fid *bfid, uint64_t flags)
 		if (ret)
 			return ret;
 
+		rxm_ep->conn_cache_size = util_av->count << util_av->rx_ctx_bits;
+		rxm_ep->conn_cache = calloc(rxm_ep->conn_cache_size,
+					    sizeof(*rxm_ep->conn_cache));
+		if (!rxm_ep->conn_cache)
+			return -FI_ENOMEM;
+
 		if (!(rxm_ep->util_ep.cmap = rxm_conn_cmap_alloc(rxm_ep)))
 			return -FI_ENOMEM;
 		break;
@@ -1137,6 +1653,22 @@ static int rxm_ep_bind(struct fid *ep_fid, struct fid *bfid, uint64_t flags)
 				return ret;
 		}
 		break;
+	case FI_CLASS_CNTR:
+		cntr = container_of(bfid, struct util_cntr, cntr_fid.fid);
+		/* The msg CQ fd is added to a counter's wait set only once */
+		if (!cntr->wait || rxm_ep_cntr_bound(rxm_ep, cntr))
+			return ofi_ep_bind_cntr(&rxm_ep->util_ep, cntr, flags);
+
+		ret = ofi_wait_fd_add(cntr->wait, rxm_ep->msg_cq_fd,
+				      rxm_ep_trywait, rxm_ep,
+				      &rxm_ep->util_ep.ep_fid.fid);
+		if (ret)
+			return ret;
+
+		ret = ofi_ep_bind_cntr(&rxm_ep->util_ep, cntr, flags);
+		if (ret)
+			ofi_wait_fd_del(cntr->wait, rxm_ep->msg_cq_fd);
+		break;
 	case FI_CLASS_EQ:
 		break;
 	default:
@@ -1156,18 +1688,14 @@ static int rxm_ep_ctrl(struct fid *fid, int command, void *arg)
 
 	switch (command) {
 	case FI_ENABLE:
-		if (!rxm_ep->util_ep.rx_cq || !rxm_ep->util_ep.tx_cq)
+		if ((fid->fclass != FI_CLASS_TX_CTX &&
+		     !rxm_ep->util_ep.rx_cq && !rxm_ep->util_ep.rx_cntr) ||
+		    (fid->fclass != FI_CLASS_RX_CTX &&
+		     !rxm_ep->util_ep.tx_cq && !rxm_ep->util_ep.tx_cntr))
 			return -FI_ENOCQ;
 		if (!rxm_ep->util_ep.av)
 			return -FI_EOPBADSTATE;
 
-		ret = fi_listen(rxm_ep->msg_pep);
-		if (ret) {
-			FI_WARN(&rxm_prov, FI_LOG_EP_CTRL,
-				"Unable to set msg PEP to listen state\n");
-			return ret;
-		}
-
 		if (rxm_ep->srx_ctx) {
 			ret = rxm_ep_prepost_buf(rxm_ep, rxm_ep->srx_ctx);
 			if (ret) {
@@ -1177,6 +1705,8 @@ static int rxm_ep_ctrl(struct fid *fid, int command, void *arg)
 			}
 		}
 		break;
+	case FI_GET_STATS:
+		return ofi_stats_query(&rxm_ep->stats, arg);
 	default:
 		return -FI_ENOSYS;
 	}
@@ -1222,6 +1752,15 @@ static int rxm_listener_open(struct rxm_ep *rxm_ep)
 		goto err;
 	}
 
+	/* The connection map queries the PEP name when the AV is bound,
+	 * which some msg providers only assign once listening. */
+	ret = fi_listen(rxm_ep->msg_pep);
+	if (ret) {
+		FI_WARN(&rxm_prov, FI_LOG_EP_CTRL,
+			"Unable to set msg PEP to listen state\n");
+		goto err;
+	}
+
 	return 0;
 err:
 	rxm_listener_close(rxm_ep);
@@ -1271,6 +1810,13 @@ static int rxm_ep_msg_res_open(struct fi_info *rxm_fi_info,
 
 	rxm_ep->comp_per_progress = MIN(rxm_ep->msg_info->tx_attr->size,
 					rxm_ep->msg_info->rx_attr->size) / 2;
+	rxm_ep->inject_limit = MIN(rxm_ep->msg_info->tx_attr->inject_size,
+				   RXM_INJECT_BUF_SIZE);
+	rxm_ep->inject_limit = (rxm_ep->inject_limit > sizeof(struct rxm_pkt)) ?
+		MIN(rxm_ep->inject_limit - sizeof(struct rxm_pkt),
+		    rxm_fi_info->tx_attr->inject_size) : 0;
+	rxm_ep->send_agg_size = MIN((size_t) rxm_send_agg_size,
+				    rxm_info.tx_attr->inject_size);
 
 	rxm_domain = container_of(util_domain, struct rxm_domain, util_domain);
 
@@ -1329,6 +1875,13 @@ static void rxm_ep_progress(struct util_ep *util_ep)
 
 	rxm_ep = container_of(util_ep, struct rxm_ep, util_ep);
 	rxm_cq_progress(rxm_ep);
+	rxm_ep_deferred_flush(rxm_ep);
+	if (!dlist_empty(&rxm_ep->conn_close_list))
+		rxm_conn_close_all(rxm_ep);
+	if (!dlist_empty(&rxm_ep->atomic_batch_list))
+		rxm_atomic_flush_all(rxm_ep);
+	if (!dlist_empty(&rxm_ep->send_agg_list))
+		rxm_send_agg_flush_all(rxm_ep);
 }
 
 int rxm_endpoint(struct fid_domain *domain, struct fi_info *info,
@@ -1358,10 +1911,15 @@ int rxm_endpoint(struct fid_domain *domain, struct fi_info *info,
 	if (ret)
 		goto err2;
 
-	ret = rxm_ep_txrx_res_open(rxm_ep);
+	ret = ofi_stats_init(&rxm_prov, &rxm_ep->stats, rxm_ep_stat_defs,
+			     RXM_STAT_MAX, "ep");
 	if (ret)
 		goto err3;
 
+	ret = rxm_ep_txrx_res_open(rxm_ep);
+	if (ret)
+		goto err4;
+
 	*ep_fid = &rxm_ep->util_ep.ep_fid;
 	(*ep_fid)->fid.ops = &rxm_ep_fi_ops;
 	(*ep_fid)->ops = &rxm_ops_ep;
@@ -1369,8 +1927,11 @@ int rxm_endpoint(struct fid_domain *domain, struct fi_info *info,
 	(*ep_fid)->msg = &rxm_ops_msg;
 	(*ep_fid)->tagged = &rxm_ops_tagged;
 	(*ep_fid)->rma = &rxm_ops_rma;
+	(*ep_fid)->atomic = &rxm_ops_atomic;
 
 	return 0;
+err4:
+	ofi_stats_close(&rxm_ep->stats);
 err3:
 	rxm_ep_msg_res_close(rxm_ep);
 err2:
@@ -1381,3 +1942,56 @@ err1:
 	free(rxm_ep);
 	return ret;
 }
+
+/*
+ * Each context is an endpoint with its own listener, bound to the
+ * scalable endpoint's address at port + index for rx contexts, and at
+ * the ports following the rx contexts for tx contexts.
+ */
+static int rxm_sep_ctx_open(struct util_sep *sep, size_t port,
+			    struct fi_info *info, struct fid_ep **ctx,
+			    void *context)
+{
+	int ret;
+
+	ret = ofi_sep_ctx_info(sep, port, info);
+	if (ret)
+		return ret;
+
+	ofi_sep_release_port(sep, port);
+	return rxm_endpoint(&sep->domain->domain_fid, info, ctx, context);
+}
+
+static int rxm_sep_tx_ctx(struct util_sep *sep, int index,
+			  struct fi_info *info, struct fid_ep **ctx,
+			  void *context)
+{
+	return rxm_sep_ctx_open(sep, sep->rx_ctx_cnt + index, info,
+				ctx, context);
+}
+
+static int rxm_sep_rx_ctx(struct util_sep *sep, int index,
+			  struct fi_info *info, struct fid_ep **ctx,
+			  void *context)
+{
+	return rxm_sep_ctx_open(sep, index, info, ctx, context);
+}
+
+int rxm_scalable_ep(struct fid_domain *domain, struct fi_info *info,
+		    struct fid_ep **sep_fid, void *context)
+{
+	struct util_sep *sep;
+	int ret;
+
+	ret = ofi_scalable_ep(domain, &rxm_util_prov, info, sep_fid, context,
+			      rxm_sep_tx_ctx, rxm_sep_rx_ctx);
+	if (ret)
+		return ret;
+
+	sep = container_of(*sep_fid, struct util_sep, ep_fid);
+	ret = ofi_sep_bind_ports(sep, SOCK_STREAM,
+				 sep->rx_ctx_cnt + sep->tx_ctx_cnt);
+	if (ret)
+		fi_close(&(*sep_fid)->fid);
+	return ret;
+}
@@ -35,6 +35,10 @@
 #include <prov.h>
 #include "rxm.h"
 
+int rxm_send_agg_size;
+size_t rxm_buffer_size = RXM_BUF_SIZE;
+size_t rxm_atomic_buf_size = RXM_ATOMIC_BUF_SIZE;
+
 int rxm_info_to_core(uint32_t version, const struct fi_info *hints,
 		     struct fi_info *core_info)
 {
@@ -131,17 +135,29 @@ static int rxm_init_info(void)
 	int param;
 
 	if (!fi_param_get_int(&rxm_prov, "buffer_size", &param)) {
-		if (param > sizeof(struct rxm_pkt)) {
-			rxm_info.tx_attr->inject_size = param;
+		if (param > (int) sizeof(struct rxm_rx_buf)) {
+			rxm_buffer_size = roundup_power_of_two(param);
 		} else {
 			FI_WARN(&rxm_prov, FI_LOG_CORE,
 				"Requested buffer size too small\n");
 			return -FI_EINVAL;
 		}
-	} else {
-		rxm_info.tx_attr->inject_size = RXM_BUF_SIZE;
 	}
-	rxm_info.tx_attr->inject_size -= sizeof(struct rxm_pkt);
+	/* An eager message and the rx buffer header fill one buffer block */
+	rxm_info.tx_attr->inject_size = rxm_buffer_size -
+					sizeof(struct rxm_rx_buf);
+
+	rxm_atomic_buf_size = MIN(RXM_ATOMIC_BUF_SIZE,
+				  rxm_info.tx_attr->inject_size);
+	if (rxm_atomic_buf_size < RXM_ATOMIC_MIN_BUF_SIZE) {
+		FI_WARN(&rxm_prov, FI_LOG_CORE,
+			"Requested buffer size too small for atomics\n");
+		return -FI_EINVAL;
+	}
+
+	if (!fi_param_get_int(&rxm_prov, "send_agg_size", &param))
+		rxm_send_agg_size = MAX(param, 0);
+
 	rxm_util_prov.info = &rxm_info;
 	return 0;
 }
@@ -206,9 +222,17 @@ struct fi_provider rxm_prov = {
 RXM_INI
 {
 	fi_param_define(&rxm_prov, "buffer_size", FI_PARAM_INT,
-			"Defines the transmit buffer size. Transmit data would "
-			"be copied upto this size (default: ~16k). This would "
-			"also affect the supported inject size");
+			"Defines the size of the largest transmit and receive "
+			"buffer, rounded up to a power of two. Messages that "
+			"fit one along with its header are copied, larger ones "
+			"are read by the target (default: 16k). This also "
+			"sets the supported inject size. All peers must use "
+			"the same value");
+	fi_param_define(&rxm_prov, "send_agg_size", FI_PARAM_INT,
+			"Payload budget of a packet that aggregates small "
+			"sends posted without a completion to one peer. "
+			"Aggregated sends go out when the endpoint is "
+			"progressed. 0 disables aggregation (default: 0)");
 
 	if (rxm_init_info()) {
 		FI_WARN(&rxm_prov, FI_LOG_CORE, "Unable to initialize rxm_info\n");
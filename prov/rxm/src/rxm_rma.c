@@ -81,17 +81,19 @@ err:
 static ssize_t rxm_ep_readmsg(struct fid_ep *ep_fid, const struct fi_msg_rma *msg,
 			      uint64_t flags)
 {
-	struct util_cmap_handle *handle;
 	struct rxm_conn *rxm_conn;
 	struct rxm_ep *rxm_ep;
 	int ret;
 
 	rxm_ep = container_of(ep_fid, struct rxm_ep, util_ep.ep_fid.fid);
 
-	ret = ofi_cmap_get_handle(rxm_ep->util_ep.cmap, msg->addr, &handle);
+	ret = rxm_ep_get_conn(rxm_ep, msg->addr, &rxm_conn);
+	if (ret)
+		return ret;
+
+	ret = rxm_conn_flush(rxm_ep, rxm_conn);
 	if (ret)
 		return ret;
-	rxm_conn = container_of(handle, struct rxm_conn, handle);
 
 	return rxm_ep_rma_common(rxm_conn->msg_ep, rxm_ep, msg, flags,
 				 fi_readmsg, FI_READ);
@@ -178,7 +180,7 @@ static int rxm_ep_rma_inject(struct fid_ep *msg_ep, struct rxm_ep *rxm_ep,
 					       msg->rma_iov->key);
 	}
 
-	tx_buf = (struct rxm_tx_buf *)rxm_buf_get(&rxm_ep->tx_pool);
+	tx_buf = rxm_tx_buf_get(rxm_ep, size);
 	if (!tx_buf) {
 		FI_WARN(&rxm_prov, FI_LOG_CQ, "TX queue full!\n");
 		rxm_cq_progress(rxm_ep);
@@ -232,17 +234,19 @@ err1:
 static ssize_t rxm_ep_writemsg(struct fid_ep *ep_fid, const struct fi_msg_rma *msg,
 			       uint64_t flags)
 {
-	struct util_cmap_handle *handle;
 	struct rxm_conn *rxm_conn;
 	struct rxm_ep *rxm_ep;
 	int ret;
 
 	rxm_ep = container_of(ep_fid, struct rxm_ep, util_ep.ep_fid.fid);
 
-	ret = ofi_cmap_get_handle(rxm_ep->util_ep.cmap, msg->addr, &handle);
+	ret = rxm_ep_get_conn(rxm_ep, msg->addr, &rxm_conn);
+	if (ret)
+		return ret;
+
+	ret = rxm_conn_flush(rxm_ep, rxm_conn);
 	if (ret)
 		return ret;
-	rxm_conn = container_of(handle, struct rxm_conn, handle);
 
 	if (flags & FI_INJECT)
 		return rxm_ep_rma_inject(rxm_conn->msg_ep, rxm_ep, msg, flags);
@@ -77,6 +77,9 @@
 #define SOCK_EP_TX_SZ (256)
 #define SOCK_EP_RX_SZ (256)
 #define SOCK_EP_MIN_MULTI_RECV (64)
+#define SOCK_RX_BUF_CLASS_MIN (64)
+#define SOCK_RX_BUF_CLASS_CNT (5)
+#define SOCK_RX_BUF_CHUNK_CNT (16)
 #define SOCK_EP_MAX_ATOMIC_SZ (4096)
 #define SOCK_EP_MAX_CTX_BITS (16)
 #define SOCK_EP_MSG_PREFIX_SZ (0)
@@ -91,6 +94,9 @@
 #define SOCK_AV_DEF_SZ (1<<8)
 #define SOCK_CMAP_DEF_SZ (1<<10)
 #define SOCK_EPOLL_WAIT_EVENTS 32
+#define SOCK_DGRAM_BATCH (16)
+#define SOCK_DGRAM_MTU (8192)
+#define SOCK_DGRAM_MAX_MSG_SZ (SOCK_DGRAM_MTU - sizeof(struct sock_dgram_hdr))
 
 #define SOCK_CQ_DATA_SIZE (sizeof(uint64_t))
 #define SOCK_TAG_SIZE (sizeof(uint64_t))
@@ -167,12 +173,34 @@ enum {
 #define SOCK_MINOR_VERSION 0
 
 #define SOCK_WIRE_PROTO_VERSION (1)
+#define SOCK_GET_RX_ID(_addr, _bits) (((_bits) == 0) ? 0 : \
+		(((uint64_t)_addr) >> (64 - _bits)))
 
 struct sock_service_entry {
 	int service;
 	struct dlist_entry entry;
 };
 
+/*
+ * Connection manager shared by all MSG endpoints of a fabric.  A single
+ * thread drives every pending connect, accept, reject and shutdown over
+ * non-blocking sockets.  Application threads hand work to it through
+ * msg_list.
+ */
+struct sock_ep_cm_head {
+	fi_epoll_t		epollfd;
+	struct fd_signal	signal;
+	pthread_mutex_t		lock;
+	pthread_t		listener_thread;
+	int			do_listen;
+	struct dlist_entry	msg_list;
+	struct dlist_entry	handle_list;
+
+	size_t			conn_cnt;
+	uint64_t		start_ms;
+	uint64_t		end_ms;
+};
+
 struct sock_fabric {
 	struct fid_fabric fab_fid;
 	ofi_atomic32_t ref;
@@ -182,12 +210,14 @@ struct sock_fabric {
 	struct dlist_entry service_list;
 	struct dlist_entry fab_list_entry;
 	fastlock_t lock;
+	struct sock_ep_cm_head cm_head;
 };
 
 struct sock_conn {
 	int sock_fd;
 	int connected;
 	int address_published;
+	int is_local;
 	struct sockaddr_in addr;
 	struct sock_pe_entry *rx_pe_entry;
 	struct sock_pe_entry *tx_pe_entry;
@@ -246,8 +276,7 @@ struct sock_triggered_context {
 
 struct sock_trigger {
 	enum fi_op_type op_type;
-	size_t threshold;
-	struct dlist_entry entry;
+	struct ofi_trigger trigger;
 
 	struct sock_triggered_context *context;
 	struct fid_ep *ep;
@@ -282,6 +311,16 @@ struct sock_trigger {
 	} op;
 };
 
+/*
+ * Counter values are int, and a trigger fires once the value reaches
+ * (int) threshold.  Both sides are offset into the unsigned order of the
+ * trigger queue, so negative values compare as signed ints.
+ */
+static inline uint64_t sock_trigger_key(int value)
+{
+	return (uint64_t) ((int64_t) value - INT32_MIN);
+}
+
 struct sock_cntr {
 	struct fid_cntr		cntr_fid;
 	struct sock_domain	*domain;
@@ -298,7 +337,7 @@ struct sock_cntr {
 	fastlock_t		list_lock;
 
 	fastlock_t		trigger_lock;
-	struct dlist_entry	trigger_list;
+	struct ofi_trigger_queue trigger_queue;
 
 	struct fid_wait		*waitset;
 	int			signal;
@@ -338,6 +377,9 @@ struct sock_av {
 	struct sock_av_table_hdr *table_hdr;
 	struct sock_av_addr *table;
 	uint64_t *idx_arr;
+	uint32_t *addr_hash;
+	size_t hash_size;
+	size_t hash_used;
 	struct util_shm shm;
 	int    shared;
 	struct dlist_entry ep_list;
@@ -493,16 +535,14 @@ struct sock_comp {
 struct sock_cm_entry {
 	int sock;
 	int do_listen;
-	int signal_fds[2];
-	uint64_t next_msg_id;
 	fastlock_t lock;
 	int is_connected;
-	pthread_t listener_thread;
-	struct dlist_entry msg_list;
+	struct sock_conn_req_handle *handle;
 };
 
 struct sock_conn_listener {
 	int sock;
+	int local_sock;
 	int do_listen;
 	int is_ready;
 	int signal_fds[2];
@@ -552,6 +592,7 @@ struct sock_ep_attr {
 
 	struct index_map av_idm;
 	struct sock_conn_map cmap;
+	struct sock_dgram *dgram;
 };
 
 struct sock_ep {
@@ -598,6 +639,7 @@ struct sock_rx_entry {
 	struct dlist_entry entry;
 	struct slist_entry pool_entry;
 	struct sock_rx_ctx *rx_ctx;
+	struct util_buf_pool *buf_pool;
 };
 
 struct sock_rx_ctx {
@@ -634,6 +676,15 @@ struct sock_rx_ctx {
 	struct fi_rx_attr attr;
 	struct sock_rx_entry *rx_entry_pool;
 	struct slist pool_list;
+
+	/*
+	 * Unexpected messages are buffered in size classes growing by 4x
+	 * from SOCK_RX_BUF_CLASS_MIN; larger ones are allocated directly.
+	 * Buffered messages are matched against posted receives only after
+	 * a receive is posted or freed up, or a buffered message completes.
+	 */
+	struct util_buf_pool *buf_pools[SOCK_RX_BUF_CLASS_CNT];
+	int match_buffered;
 };
 
 struct sock_tx_ctx {
@@ -683,6 +734,50 @@ struct sock_msg_hdr {
 	uint64_t msg_len;
 };
 
+/*
+ * Datagram endpoints send each message as a single UDP datagram made of
+ * this header followed by the user data.
+ */
+struct sock_dgram_hdr {
+	uint8_t version;
+	uint8_t op_type;
+	uint16_t rx_id;
+	uint8_t reserved[4];
+
+	uint64_t flags;
+	uint64_t tag;
+	uint64_t data;
+};
+
+struct sock_dgram_tx_entry {
+	struct sock_dgram_hdr hdr;
+	struct sockaddr_in addr;
+	struct iovec iov[SOCK_EP_MAX_IOV_LIMIT + 1];
+	size_t iov_cnt;
+
+	struct sock_comp *comp;
+	uint64_t flags;
+	uint64_t context;
+	uint64_t buf;
+	uint64_t len;
+	uint64_t tag;
+	uint64_t data;
+	fi_addr_t fi_addr;
+	char inject[SOCK_EP_MAX_INJECT_SZ];
+};
+
+/* Sends posted with FI_MORE are queued and go out in one sendmmsg call */
+struct sock_dgram {
+	int fd;
+	fastlock_t lock;
+	size_t tx_cnt;
+	struct sock_dgram_tx_entry tx[SOCK_DGRAM_BATCH];
+
+	struct sock_dgram_hdr rx_hdr[SOCK_DGRAM_BATCH];
+	struct sockaddr_in rx_addr[SOCK_DGRAM_BATCH];
+	char *rx_buf;
+};
+
 struct sock_msg_send {
 	struct sock_msg_hdr msg_hdr;
 	/* user data */
@@ -816,6 +911,14 @@ struct sock_pe_entry {
 	size_t cache_sz;
 };
 
+enum sock_pe_stat {
+	SOCK_PE_STAT_BUSY,
+	SOCK_PE_STAT_POOL_BUSY,
+	SOCK_PE_STAT_TABLE_FULL,
+	SOCK_PE_STAT_POOL_BUFS,
+	SOCK_PE_STAT_MAX,
+};
+
 struct sock_pe {
 	struct sock_domain *domain;
 	int num_free_entries;
@@ -840,6 +943,7 @@ struct sock_pe {
 	volatile int do_progress;
 	struct sock_pe_entry *pe_atomic;
 	fi_epoll_t epoll_set;
+	struct ofi_stats stats;
 };
 
 typedef int (*sock_cq_report_fn) (struct sock_cq *cq, fi_addr_t addr,
@@ -852,6 +956,12 @@ struct sock_cq_overflow_entry_t {
 	char cq_entry[0];
 };
 
+enum sock_cq_stat {
+	SOCK_CQ_STAT_OVERFLOWS,
+	SOCK_CQ_STAT_OVERFLOW_DEPTH,
+	SOCK_CQ_STAT_MAX,
+};
+
 struct sock_cq {
 	struct fid_cq cq_fid;
 	struct sock_domain *domain;
@@ -874,6 +984,7 @@ struct sock_cq {
 	struct dlist_entry tx_list;
 
 	sock_cq_report_fn report_completion;
+	struct ofi_stats stats;
 };
 
 struct sock_conn_hdr {
@@ -898,18 +1009,47 @@ enum {
 	SOCK_CONN_SHUTDOWN,
 };
 
+enum sock_cm_state {
+	/* set by application threads, acted upon by the CM thread */
+	SOCK_CM_NEW_LISTEN,
+	SOCK_CM_NEW_CONNECT,
+	SOCK_CM_ACCEPT,
+	SOCK_CM_REJECT,
+	SOCK_CM_SHUTDOWN,
+	SOCK_CM_CLOSE,
+	/* waiting on socket events */
+	SOCK_CM_LISTEN,
+	SOCK_CM_SENDING,
+	SOCK_CM_CONNECTING,
+	SOCK_CM_RESPONSE,
+	SOCK_CM_CONNREQ,
+	SOCK_CM_CONNECTED,
+	/* waiting for fi_accept or fi_reject */
+	SOCK_CM_PENDING,
+};
+
 struct sock_conn_req_handle {
 	struct fid handle;
 	struct sock_conn_req *req;
 	int sock_fd;
 	int is_accepted;
+	enum sock_cm_state state;
+	int is_registered;
+	int is_queued;
+	size_t done;
+	struct sock_conn_hdr response;
 	struct sock_pep *pep;
 	struct sock_ep *ep;
 	size_t paramlen;
-	pthread_t req_handler;
 	struct sockaddr_in dest_addr;
 	struct dlist_entry entry;
+	struct dlist_entry list_entry;
 	char cm_data[SOCK_EP_MAX_CM_DATA_SZ];
+	/* outgoing CM message, sent as the socket becomes writable */
+	char *send_buf;
+	size_t send_len;
+	size_t send_done;
+	enum sock_cm_state send_state;
 };
 
 struct sock_host_list_entry {
@@ -1021,6 +1161,10 @@ int sock_msg_sep(struct fid_domain *domain, struct fi_info *info,
 		 struct fid_ep **sep, void *context);
 int sock_msg_passive_ep(struct fid_fabric *fabric, struct fi_info *info,
 			struct fid_pep **pep, void *context);
+int sock_ep_cm_start_thread(struct sock_ep_cm_head *cm_head);
+void sock_ep_cm_stop_thread(struct sock_ep_cm_head *cm_head);
+void sock_ep_cm_release(struct sock_ep_attr *ep_attr);
+void sock_ep_cm_eq_close(struct sock_eq *eq);
 int sock_ep_enable(struct fid_ep *ep);
 int sock_ep_disable(struct fid_ep *ep);
 
@@ -1076,7 +1220,7 @@ struct sock_tx_ctx *sock_stx_ctx_alloc(const struct fi_tx_attr *attr, void *cont
 void sock_tx_ctx_free(struct sock_tx_ctx *tx_ctx);
 void sock_tx_ctx_start(struct sock_tx_ctx *tx_ctx);
 void sock_tx_ctx_write(struct sock_tx_ctx *tx_ctx, const void *buf, size_t len);
-void sock_tx_ctx_commit(struct sock_tx_ctx *tx_ctx);
+void sock_tx_ctx_commit(struct sock_tx_ctx *tx_ctx, uint64_t flags);
 void sock_tx_ctx_abort(struct sock_tx_ctx *tx_ctx);
 void sock_tx_ctx_write_op_send(struct sock_tx_ctx *tx_ctx,
 		struct sock_op *op, uint64_t flags, uint64_t context,
@@ -1115,6 +1259,13 @@ int sock_ep_connect(struct sock_ep_attr *attr, fi_addr_t index,
 ssize_t sock_conn_send_src_addr(struct sock_ep_attr *ep_attr, struct sock_tx_ctx *tx_ctx,
 				struct sock_conn *conn);
 int sock_conn_listen(struct sock_ep_attr *ep_attr);
+int sock_dgram_open(struct sock_ep_attr *ep_attr);
+void sock_dgram_close(struct sock_ep_attr *ep_attr);
+ssize_t sock_dgram_send(struct sock_ep_attr *ep_attr, struct sock_tx_ctx *tx_ctx,
+			const struct iovec *iov, size_t count, fi_addr_t addr,
+			void *context, uint64_t data, uint8_t op_type,
+			uint64_t tag, uint64_t flags);
+void sock_dgram_progress(struct sock_ep_attr *ep_attr);
 void sock_conn_map_destroy(struct sock_ep_attr *ep_attr);
 void sock_conn_release_entry(struct sock_conn_map *map, struct sock_conn *conn);
 void sock_set_sockopts(int sock);
@@ -1134,6 +1285,9 @@ int sock_pe_progress_tx_ctx(struct sock_pe *pe, struct sock_tx_ctx *tx_ctx);
 void sock_pe_remove_tx_ctx(struct sock_tx_ctx *tx_ctx);
 void sock_pe_remove_rx_ctx(struct sock_rx_ctx *rx_ctx);
 void sock_pe_finalize(struct sock_pe *pe);
+void sock_pe_report_dgram_send(struct sock_dgram_tx_entry *tx, int err);
+void sock_pe_recv_dgram(struct sock_ep_attr *ep_attr, struct sock_dgram_hdr *hdr,
+			struct sockaddr_in *addr, char *buf, size_t len);
 
 
 struct sock_rx_entry *sock_rx_new_entry(struct sock_rx_ctx *rx_ctx);
@@ -1153,6 +1307,7 @@ ssize_t sock_rx_claim_recv(struct sock_rx_ctx *rx_ctx, void *context,
 			   uint8_t is_tagged, const struct iovec *msg_iov,
 			   size_t iov_count);
 void sock_rx_release_entry(struct sock_rx_entry *rx_entry);
+void sock_rx_release_buffered(struct sock_rx_ctx *rx_ctx);
 
 ssize_t sock_comm_send(struct sock_pe_entry *pe_entry, const void *buf, size_t len);
 ssize_t sock_comm_recv(struct sock_pe_entry *pe_entry, void *buf, size_t len);
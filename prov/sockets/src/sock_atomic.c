@@ -241,7 +241,7 @@ ssize_t sock_ep_tx_atomic(struct fid_ep *ep,
 	}
 #endif
 
-	sock_tx_ctx_commit(tx_ctx);
+	sock_tx_ctx_commit(tx_ctx, flags);
 	return 0;
 
 err:
@@ -52,6 +52,7 @@
 
 #include "fi_osd.h"
 #include "fi_util.h"
+#include "fasthash.h"
 
 #define SOCK_LOG_DBG(...) _SOCK_LOG_DBG(FI_LOG_AV, __VA_ARGS__)
 #define SOCK_LOG_ERROR(...) _SOCK_LOG_ERROR(FI_LOG_AV, __VA_ARGS__)
@@ -61,11 +62,85 @@
 				count * sizeof(struct sock_av_addr))
 #define SOCK_IS_SHARED_AV(av_name) ((av_name) ? 1 : 0)
 
+/*
+ * Addresses are also indexed by a hash table, which lets incoming datagrams
+ * be mapped to their source without scanning the AV.  Slots hold the AV
+ * index plus one, with zero marking an empty slot.  Removed entries are left
+ * in place and skipped on lookup until the table is next rebuilt.
+ */
+static size_t sock_av_hash_slot(struct sock_av *av, struct sockaddr_in *addr)
+{
+	return fasthash64(&addr->sin_addr, sizeof(addr->sin_addr),
+			  addr->sin_port) & (av->hash_size - 1);
+}
+
+static void sock_av_hash_add(struct sock_av *av, uint64_t index)
+{
+	size_t slot;
+
+	slot = sock_av_hash_slot(av, (struct sockaddr_in *) &av->table[index].addr);
+	while (av->addr_hash[slot])
+		slot = (slot + 1) & (av->hash_size - 1);
+	av->addr_hash[slot] = (uint32_t) index + 1;
+	av->hash_used++;
+}
+
+static int sock_av_hash_rebuild(struct sock_av *av)
+{
+	uint32_t *old_hash = av->addr_hash;
+	uint64_t i;
+
+	av->hash_size = roundup_power_of_two(MAX(av->table_hdr->size * 2,
+						 SOCK_AV_DEF_SZ));
+	av->addr_hash = calloc(av->hash_size, sizeof(*av->addr_hash));
+	if (!av->addr_hash) {
+		av->addr_hash = old_hash;
+		return -FI_ENOMEM;
+	}
+	free(old_hash);
+
+	av->hash_used = 0;
+	for (i = 0; i < av->table_hdr->size; i++) {
+		if (av->table[i].valid)
+			sock_av_hash_add(av, i);
+	}
+	return 0;
+}
+
+static void sock_av_hash_insert(struct sock_av *av, uint64_t index)
+{
+	/* Keep the table at most half full, rebuilding picks up the new entry */
+	if ((av->hash_used + 1) * 2 > av->hash_size) {
+		if (sock_av_hash_rebuild(av))
+			SOCK_LOG_ERROR("failed to grow address hash\n");
+		return;
+	}
+	sock_av_hash_add(av, index);
+}
+
 int sock_av_get_addr_index(struct sock_av *av, struct sockaddr_in *addr)
 {
 	int i;
+	size_t slot;
 	struct sock_av_addr *av_addr;
 
+	if (av->addr_hash) {
+		for (slot = sock_av_hash_slot(av, addr); av->addr_hash[slot];
+		     slot = (slot + 1) & (av->hash_size - 1)) {
+			i = av->addr_hash[slot] - 1;
+			av_addr = &av->table[i];
+			if (i < (int)av->table_hdr->size && av_addr->valid &&
+			    ofi_equals_sockaddr(addr, (struct sockaddr_in *)&av_addr->addr))
+				return i;
+		}
+	}
+
+	/* Shared AVs may be updated by other processes */
+	if (!av->shared) {
+		SOCK_LOG_DBG("failed to get index in AV\n");
+		return -1;
+	}
+
 	for (i = 0; i < (int)av->table_hdr->size; i++) {
 		av_addr = &av->table[i];
 		if (!av_addr->valid)
@@ -250,6 +325,7 @@ static int sock_check_table_in(struct sock_av *_av, struct sockaddr_in *addr,
 			fi_addr[i] = (fi_addr_t)index;
 
 		av_addr->valid = 1;
+		sock_av_hash_insert(_av, index);
 		ret++;
 	}
 	sock_av_report_success(_av, context, ret, flags);
@@ -456,6 +532,7 @@ static int sock_av_close(struct fid *fid)
 	if (ofi_atomic_get32(&av->ref))
 		return -FI_EBUSY;
 
+	free(av->addr_hash);
 	if (!av->shared) {
 		free(av->table_hdr);
 	} else {
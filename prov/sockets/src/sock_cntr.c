@@ -129,18 +129,13 @@ void sock_cntr_check_trigger_list(struct sock_cntr *cntr)
 {
 	struct fi_deferred_work *work;
 	struct sock_trigger *trigger;
-	struct dlist_entry *entry;
+	struct ofi_trigger *ready;
 	int ret = 0;
 
 	fastlock_acquire(&cntr->trigger_lock);
-	for (entry = cntr->trigger_list.next;
-	     entry != &cntr->trigger_list;) {
-
-		trigger = container_of(entry, struct sock_trigger, entry);
-		entry = entry->next;
-
-		if (ofi_atomic_get32(&cntr->value) < (int) trigger->threshold)
-			continue;
+	while ((ready = ofi_trigger_ready(&cntr->trigger_queue,
+			sock_trigger_key(ofi_atomic_get32(&cntr->value))))) {
+		trigger = container_of(ready, struct sock_trigger, trigger);
 
 		switch (trigger->op_type) {
 		case FI_OP_SEND:
@@ -200,12 +195,11 @@ void sock_cntr_check_trigger_list(struct sock_cntr *cntr)
 			break;
 		}
 
-		if (ret != -FI_EAGAIN) {
-			dlist_remove(&trigger->entry);
-			free(trigger);
-		} else {
+		if (ret == -FI_EAGAIN)
 			break;
-		}
+
+		ofi_trigger_pop(&cntr->trigger_queue);
+		free(trigger);
 	}
 	fastlock_release(&cntr->trigger_lock);
 }
@@ -416,6 +410,7 @@ static int sock_cntr_control(struct fid *fid, int command, void *arg)
 
 static int sock_cntr_close(struct fid *fid)
 {
+	struct ofi_trigger *ready;
 	struct sock_cntr *cntr;
 
 	cntr = container_of(fid, struct sock_cntr, cntr_fid.fid);
@@ -427,6 +422,11 @@ static int sock_cntr_close(struct fid *fid)
 
 	pthread_mutex_destroy(&cntr->mut);
 	fastlock_destroy(&cntr->list_lock);
+	while ((ready = ofi_trigger_peek(&cntr->trigger_queue))) {
+		ofi_trigger_pop(&cntr->trigger_queue);
+		free(container_of(ready, struct sock_trigger, trigger));
+	}
+	ofi_trigger_queue_cleanup(&cntr->trigger_queue);
 	fastlock_destroy(&cntr->trigger_lock);
 
 	pthread_cond_destroy(&cntr->cond);
@@ -572,7 +572,7 @@ int sock_cntr_open(struct fid_domain *domain, struct fi_cntr_attr *attr,
 	dlist_init(&_cntr->tx_list);
 	dlist_init(&_cntr->rx_list);
 
-	dlist_init(&_cntr->trigger_list);
+	ofi_trigger_queue_init(&_cntr->trigger_queue);
 	fastlock_init(&_cntr->trigger_lock);
 
 	_cntr->cntr_fid.fid.fclass = FI_CLASS_CNTR;
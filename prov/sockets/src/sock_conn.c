@@ -49,6 +49,9 @@
 #include <ifaddrs.h>
 #include <poll.h>
 #include <limits.h>
+#ifdef __linux__
+#include <sys/un.h>
+#endif
 
 #include "sock.h"
 #include "sock_util.h"
@@ -80,7 +83,7 @@ ssize_t sock_conn_send_src_addr(struct sock_ep_attr *ep_attr, struct sock_tx_ctx
 	sock_tx_ctx_write_op_send(tx_ctx, &tx_op, 0, (uintptr_t) NULL, 0, 0,
 				   ep_attr, conn);
 	sock_tx_ctx_write(tx_ctx, ep_attr->src_addr, sizeof(struct sockaddr_in));
-	sock_tx_ctx_commit(tx_ctx);
+	sock_tx_ctx_commit(tx_ctx, 0);
 	conn->address_published = 1;
 	return 0;
 
@@ -167,7 +170,7 @@ static int sock_conn_get_next_index(struct sock_conn_map *map)
 
 static struct sock_conn *sock_conn_map_insert(struct sock_ep_attr *ep_attr,
 				struct sockaddr_in *addr, int conn_fd,
-				int addr_published)
+				int addr_published, int is_local)
 {
 	int index;
 	struct sock_conn_map *map = &ep_attr->cmap;
@@ -190,7 +193,11 @@ static struct sock_conn *sock_conn_map_insert(struct sock_ep_attr *ep_attr,
 	map->table[index].addr = *addr;
 	map->table[index].sock_fd = conn_fd;
 	map->table[index].ep_attr = ep_attr;
-	sock_set_sockopts(conn_fd);
+	map->table[index].is_local = is_local;
+	if (is_local)
+		fd_set_nonblock(conn_fd);
+	else
+		sock_set_sockopts(conn_fd);
 
 	if (fi_epoll_add(map->epoll_set, conn_fd, &map->table[index]))
 		SOCK_LOG_ERROR("failed to add to epoll set: %d\n", conn_fd);
@@ -241,25 +248,202 @@ void sock_set_sockopts(int sock)
 	fd_set_nonblock(sock);
 }
 
+/*
+ * Peers on the same host connect over a UNIX domain socket that listens
+ * alongside the TCP listener, bypassing the TCP/IP stack.  The socket is
+ * named after the address and port of the TCP listener in the abstract
+ * namespace, which is scoped per network namespace like the port itself
+ * and goes away with the socket.  The same data flows over either socket.
+ *
+ * Unlike a TCP port, any local user may bind the name first.  Both sides
+ * check with SO_PEERCRED that the peer runs as the same user: connections
+ * to other users' listeners go over TCP instead, and local connections
+ * from other users are refused.
+ */
+#ifdef __linux__
+static socklen_t sock_conn_local_name(struct sockaddr_un *sun,
+				      struct in_addr ip, uint16_t port)
+{
+	char ipaddr[INET_ADDRSTRLEN];
+	int len;
+
+	memset(sun, 0, sizeof(*sun));
+	sun->sun_family = AF_UNIX;
+	inet_ntop(AF_INET, &ip, ipaddr, sizeof(ipaddr));
+	len = snprintf(sun->sun_path + 1, sizeof(sun->sun_path) - 1,
+		       "ofi-sockets-%s:%u", ipaddr, port);
+	return offsetof(struct sockaddr_un, sun_path) + 1 + len;
+}
+
+static int sock_conn_is_local_addr(struct sockaddr_in *addr)
+{
+	struct ifaddrs *ifaddrs, *ifa;
+	int ret = 0;
+
+	if ((ntohl(addr->sin_addr.s_addr) >> IN_CLASSA_NSHIFT) ==
+	    IN_LOOPBACKNET)
+		return 1;
+
+	if (getifaddrs(&ifaddrs))
+		return 0;
+
+	for (ifa = ifaddrs; ifa != NULL; ifa = ifa->ifa_next) {
+		if (ifa->ifa_addr && ifa->ifa_addr->sa_family == AF_INET &&
+		    ofi_equals_ipaddr((struct sockaddr_in *) ifa->ifa_addr,
+				      addr)) {
+			ret = 1;
+			break;
+		}
+	}
+	freeifaddrs(ifaddrs);
+	return ret;
+}
+
+static int sock_conn_local_peer_ok(int fd)
+{
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len)) {
+		SOCK_LOG_ERROR("failed to get local peer credentials: %s\n",
+			       strerror(ofi_sockerr()));
+		return 0;
+	}
+
+	if (cred.uid != geteuid()) {
+		SOCK_LOG_ERROR("local peer pid %d runs as uid %u, not %u\n",
+			       (int) cred.pid, (unsigned) cred.uid,
+			       (unsigned) geteuid());
+		return 0;
+	}
+	return 1;
+}
+
+static int sock_conn_listen_local(struct in_addr ip, uint16_t port)
+{
+	struct sockaddr_un sun;
+	socklen_t len;
+	int fd;
+
+	if (!sock_local_conn)
+		return -1;
+
+	fd = ofi_socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -1;
+
+	len = sock_conn_local_name(&sun, ip, port);
+	if (bind(fd, (struct sockaddr *) &sun, len) ||
+	    listen(fd, sock_cm_def_map_sz)) {
+		SOCK_LOG_ERROR("no local listener %s: %s\n", sun.sun_path + 1,
+			       strerror(ofi_sockerr()));
+		ofi_close_socket(fd);
+		return -1;
+	}
+
+	fd_set_nonblock(fd);
+	return fd;
+}
+
+static int sock_conn_connect_local(struct sockaddr_in *addr)
+{
+	/* As with TCP, a listener bound to the address beats a wildcard one */
+	struct in_addr ip[2] = {
+		addr->sin_addr,
+		{ .s_addr = htonl(INADDR_ANY) },
+	};
+	struct sockaddr_un sun;
+	socklen_t len;
+	int fd, i;
+
+	if (!sock_local_conn || !sock_conn_is_local_addr(addr))
+		return -1;
+
+	for (i = 0; i < 2; i++) {
+		fd = ofi_socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd < 0)
+			return -1;
+
+		len = sock_conn_local_name(&sun, ip[i], ntohs(addr->sin_port));
+		if (!connect(fd, (struct sockaddr *) &sun, len) &&
+		    sock_conn_local_peer_ok(fd))
+			return fd;
+		ofi_close_socket(fd);
+	}
+	return -1;
+}
+#else
+static int sock_conn_local_peer_ok(int fd)
+{
+	return 0;
+}
+
+static int sock_conn_listen_local(struct in_addr ip, uint16_t port)
+{
+	return -1;
+}
+
+static int sock_conn_connect_local(struct sockaddr_in *addr)
+{
+	return -1;
+}
+#endif
+
+static int sock_conn_accept(struct sock_ep_attr *ep_attr, int listen_fd,
+			    int is_local)
+{
+	int conn_fd;
+	socklen_t addr_size;
+	struct sockaddr_in remote = { 0 };
+	struct sock_conn_map *map = &ep_attr->cmap;
+
+	/* Local peers are identified by the address they send once connected */
+	addr_size = sizeof(remote);
+	conn_fd = accept(listen_fd, is_local ? NULL : (struct sockaddr *) &remote,
+			 is_local ? NULL : &addr_size);
+	SOCK_LOG_DBG("CONN: accepted conn-req: %d\n", conn_fd);
+	if (conn_fd < 0) {
+		/* The listeners are non-blocking */
+		if (OFI_SOCK_TRY_SND_RCV_AGAIN(ofi_sockerr()) ||
+		    ofi_sockerr() == ECONNABORTED || ofi_sockerr() == EINTR)
+			return 0;
+		SOCK_LOG_ERROR("failed to accept: %s\n",
+			       strerror(ofi_sockerr()));
+		return -1;
+	}
+
+	if (is_local && !sock_conn_local_peer_ok(conn_fd)) {
+		ofi_close_socket(conn_fd);
+		return 0;
+	}
+
+	SOCK_LOG_DBG("ACCEPT: %s, %d%s\n", inet_ntoa(remote.sin_addr),
+		     ntohs(remote.sin_port), is_local ? " (local)" : "");
+
+	fastlock_acquire(&map->lock);
+	sock_conn_map_insert(ep_attr, &remote, conn_fd, 1, is_local);
+	fastlock_release(&map->lock);
+	sock_pe_signal(ep_attr->domain->pe);
+	return 0;
+}
+
 static void *_sock_conn_listen(void *arg)
 {
-	int conn_fd, ret;
+	int ret;
 	char tmp;
-	socklen_t addr_size;
-	struct sockaddr_in remote;
-	struct pollfd poll_fds[2];
+	struct pollfd poll_fds[3];
 
 	struct sock_ep_attr *ep_attr = (struct sock_ep_attr *)arg;
 	struct sock_conn_listener *listener = &ep_attr->listener;
-	struct sock_conn_map *map = &ep_attr->cmap;
 
 	poll_fds[0].fd = listener->sock;
 	poll_fds[1].fd = listener->signal_fds[1];
-	poll_fds[0].events = poll_fds[1].events = POLLIN;
+	poll_fds[2].fd = listener->local_sock;
+	poll_fds[0].events = poll_fds[1].events = poll_fds[2].events = POLLIN;
 	listener->is_ready = 1;
 
 	while (listener->do_listen) {
-		if (poll(poll_fds, 2, -1) > 0) {
+		if (poll(poll_fds, 3, -1) > 0) {
 			if (poll_fds[1].revents & POLLIN) {
 				ret = ofi_read_socket(listener->signal_fds[1],
 						      &tmp, 1);
@@ -273,27 +457,19 @@ static void *_sock_conn_listen(void *arg)
 			goto err;
 		}
 
-		addr_size = sizeof(remote);
-		conn_fd = accept(listener->sock, (struct sockaddr *) &remote,
-					&addr_size);
-		SOCK_LOG_DBG("CONN: accepted conn-req: %d\n", conn_fd);
-		if (conn_fd < 0) {
-			SOCK_LOG_ERROR("failed to accept: %s\n",
-				       strerror(ofi_sockerr()));
+		if ((poll_fds[0].revents & POLLIN) &&
+		    sock_conn_accept(ep_attr, listener->sock, 0))
 			goto err;
-		}
 
-		SOCK_LOG_DBG("ACCEPT: %s, %d\n", inet_ntoa(remote.sin_addr),
-				ntohs(remote.sin_port));
-
-		fastlock_acquire(&map->lock);
-		sock_conn_map_insert(ep_attr, &remote, conn_fd, 1);
-		fastlock_release(&map->lock);
-		sock_pe_signal(ep_attr->domain->pe);
+		if ((poll_fds[2].revents & POLLIN) &&
+		    sock_conn_accept(ep_attr, listener->local_sock, 1))
+			goto err;
 	}
 
 err:
 	ofi_close_socket(listener->sock);
+	if (listener->local_sock >= 0)
+		ofi_close_socket(listener->local_sock);
 	SOCK_LOG_DBG("Listener thread exited\n");
 	return NULL;
 }
@@ -313,6 +489,7 @@ int sock_conn_listen(struct sock_ep_attr *ep_attr)
 	hints.ai_family = AF_INET;
 	hints.ai_socktype = SOCK_STREAM;
 	hints.ai_flags = AI_PASSIVE;
+	listener->local_sock = -1;
 
 	memcpy(&addr, ep_attr->src_addr, sizeof(addr));
 	if (getnameinfo((void *)ep_attr->src_addr, sizeof(*ep_attr->src_addr),
@@ -387,6 +564,8 @@ int sock_conn_listen(struct sock_ep_attr *ep_attr)
 			htons(atoi(listener->service));
 	}
 
+	listener->local_sock = sock_conn_listen_local(addr.sin_addr,
+						      atoi(listener->service));
 	listener->sock = listen_fd;
 	if (socketpair(AF_UNIX, SOCK_STREAM, 0, listener->signal_fds) < 0)
 		goto err;
@@ -403,13 +582,17 @@ int sock_conn_listen(struct sock_ep_attr *ep_attr)
 err:
 	if (listen_fd >= 0)
 		ofi_close_socket(listen_fd);
+	if (listener->local_sock >= 0) {
+		ofi_close_socket(listener->local_sock);
+		listener->local_sock = -1;
+	}
 	return -FI_EINVAL;
 }
 
 int sock_ep_connect(struct sock_ep_attr *ep_attr, fi_addr_t index,
 		    struct sock_conn **conn)
 {
-	int conn_fd = -1, ret;
+	int conn_fd = -1, ret, is_local = 0;
 	int do_retry = sock_conn_retry;
 	struct sock_conn *new_conn;
 	struct sockaddr_in addr;
@@ -435,6 +618,14 @@ do_connect:
 	if (*conn != SOCK_CM_CONN_IN_PROGRESS)
 		return FI_SUCCESS;
 
+	conn_fd = sock_conn_connect_local(&addr);
+	if (conn_fd >= 0) {
+		SOCK_LOG_DBG("Connected to: %s:%d over local socket\n",
+			     inet_ntoa(addr.sin_addr), ntohs(addr.sin_port));
+		is_local = 1;
+		goto out;
+	}
+
 	conn_fd = ofi_socket(AF_INET, SOCK_STREAM, 0);
 	if (conn_fd == -1) {
 		SOCK_LOG_ERROR("failed to create conn_fd, errno: %d\n",
@@ -524,7 +715,7 @@ retry:
 
 out:
 	fastlock_acquire(&ep_attr->cmap.lock);
-	new_conn = sock_conn_map_insert(ep_attr, &addr, conn_fd, 0);
+	new_conn = sock_conn_map_insert(ep_attr, &addr, conn_fd, 0, is_local);
 	if (!new_conn) {
 		fastlock_release(&ep_attr->cmap.lock);
 		goto err;
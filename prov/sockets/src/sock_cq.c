@@ -50,6 +50,11 @@
 #define SOCK_LOG_DBG(...) _SOCK_LOG_DBG(FI_LOG_CQ, __VA_ARGS__)
 #define SOCK_LOG_ERROR(...) _SOCK_LOG_ERROR(FI_LOG_CQ, __VA_ARGS__)
 
+static const struct ofi_stat_def sock_cq_stat_defs[SOCK_CQ_STAT_MAX] = {
+	[SOCK_CQ_STAT_OVERFLOWS]	= { "overflows", OFI_STAT_COUNTER },
+	[SOCK_CQ_STAT_OVERFLOW_DEPTH]	= { "overflow_depth", OFI_STAT_GAUGE },
+};
+
 void sock_cq_add_tx_ctx(struct sock_cq *cq, struct sock_tx_ctx *tx_ctx)
 {
 	struct dlist_entry *entry;
@@ -188,6 +193,8 @@ static ssize_t _sock_cq_write(struct sock_cq *cq, fi_addr_t addr,
 		overflow_entry->len = len;
 		overflow_entry->addr = addr;
 		dlist_insert_tail(&overflow_entry->entry, &cq->overflow_list);
+		ofi_stats_inc(&cq->stats, SOCK_CQ_STAT_OVERFLOWS);
+		ofi_stats_inc(&cq->stats, SOCK_CQ_STAT_OVERFLOW_DEPTH);
 		ret = len;
 		goto out;
 	}
@@ -309,6 +316,7 @@ static inline void sock_cq_copy_overflow_list(struct sock_cq *cq, size_t count)
 
 		dlist_remove(&overflow_entry->entry);
 		free(overflow_entry);
+		ofi_stats_dec(&cq->stats, SOCK_CQ_STAT_OVERFLOW_DEPTH);
 	}
 }
 
@@ -480,6 +488,7 @@ static int sock_cq_close(struct fid *fid)
 	fastlock_destroy(&cq->list_lock);
 	ofi_atomic_dec32(&cq->domain->ref);
 
+	ofi_stats_close(&cq->stats);
 	free(cq);
 	return 0;
 }
@@ -535,6 +544,10 @@ static int sock_cq_control(struct fid *fid, int command, void *arg)
 		}
 		break;
 
+	case FI_GET_STATS:
+		ret = ofi_stats_query(&cq->stats, arg);
+		break;
+
 	default:
 		ret =  -FI_EINVAL;
 		break;
@@ -652,6 +665,11 @@ int sock_cq_open(struct fid_domain *domain, struct fi_cq_attr *attr,
 	if (ret)
 		goto err3;
 
+	ret = ofi_stats_init(&sock_prov, &sock_cq->stats, sock_cq_stat_defs,
+			     SOCK_CQ_STAT_MAX, "cq");
+	if (ret)
+		goto err4;
+
 	fastlock_init(&sock_cq->lock);
 
 	switch (sock_cq->attr.wait_obj) {
@@ -667,7 +685,7 @@ int sock_cq_open(struct fid_domain *domain, struct fi_cq_attr *attr,
 				     &sock_cq->waitset);
 		if (ret) {
 			ret = -FI_EINVAL;
-			goto err4;
+			goto err5;
 		}
 		sock_cq->signal = 1;
 		break;
@@ -675,7 +693,7 @@ int sock_cq_open(struct fid_domain *domain, struct fi_cq_attr *attr,
 	case FI_WAIT_SET:
 		if (!attr) {
 			ret = -FI_EINVAL;
-			goto err4;
+			goto err5;
 		}
 
 		sock_cq->waitset = attr->wait_set;
@@ -684,7 +702,7 @@ int sock_cq_open(struct fid_domain *domain, struct fi_cq_attr *attr,
 		list_entry = calloc(1, sizeof(*list_entry));
 		if (!list_entry) {
                         ret = -FI_ENOMEM;
-                        goto err4;
+                        goto err5;
                 }
 		dlist_init(&list_entry->entry);
 		list_entry->fid = &sock_cq->cq_fid.fid;
@@ -701,6 +719,8 @@ int sock_cq_open(struct fid_domain *domain, struct fi_cq_attr *attr,
 
 	return 0;
 
+err5:
+	ofi_stats_close(&sock_cq->stats);
 err4:
 	ofi_rbfree(&sock_cq->cqerr_rb);
 err3:
@@ -69,6 +69,7 @@ struct sock_rx_ctx *sock_rx_ctx_alloc(const struct fi_rx_attr *attr,
 
 void sock_rx_ctx_free(struct sock_rx_ctx *rx_ctx)
 {
+	sock_rx_release_buffered(rx_ctx);
 	fastlock_destroy(&rx_ctx->lock);
 	free(rx_ctx->rx_entry_pool);
 	free(rx_ctx);
@@ -165,16 +166,23 @@ void sock_tx_ctx_write(struct sock_tx_ctx *tx_ctx, const void *buf, size_t len)
 	ofi_rbwrite(&tx_ctx->rb, buf, len);
 }
 
-void sock_tx_ctx_commit(struct sock_tx_ctx *tx_ctx)
+/*
+ * Operations posted with FI_MORE are made visible to the progress engine,
+ * but it is only woken up by the next operation posted without the flag.
+ */
+void sock_tx_ctx_commit(struct sock_tx_ctx *tx_ctx, uint64_t flags)
 {
 	ofi_rbcommit(&tx_ctx->rb);
-	sock_pe_signal(tx_ctx->domain->pe);
+	if (!(flags & FI_MORE))
+		sock_pe_signal(tx_ctx->domain->pe);
 	fastlock_release(&tx_ctx->rb_lock);
 }
 
 void sock_tx_ctx_abort(struct sock_tx_ctx *tx_ctx)
 {
 	ofi_rbabort(&tx_ctx->rb);
+	/* The ring may be full of operations still waiting on FI_MORE */
+	sock_pe_signal(tx_ctx->domain->pe);
 	fastlock_release(&tx_ctx->rb_lock);
 }
 
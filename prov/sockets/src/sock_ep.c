@@ -279,6 +279,19 @@ static int sock_ctx_bind(struct fid *fid, struct fid *bfid, uint64_t flags)
 
 }
 
+/* Datagram endpoints take their traffic on a UDP socket instead */
+static int sock_ep_listen(struct sock_ep_attr *ep_attr)
+{
+	if (ep_attr->ep_type == FI_EP_DGRAM && !sock_dgram_open(ep_attr) &&
+	    ep_attr->dgram)
+		return 0;
+
+	if (ep_attr->listener.listener_thread)
+		return 0;
+
+	return sock_conn_listen(ep_attr);
+}
+
 static int sock_ctx_enable(struct fid_ep *ep)
 {
 	struct sock_tx_ctx *tx_ctx;
@@ -289,8 +302,7 @@ static int sock_ctx_enable(struct fid_ep *ep)
 		rx_ctx = container_of(ep, struct sock_rx_ctx, ctx.fid);
 		sock_pe_add_rx_ctx(rx_ctx->domain->pe, rx_ctx);
 
-		if (!rx_ctx->ep_attr->listener.listener_thread &&
-		    sock_conn_listen(rx_ctx->ep_attr)) {
+		if (sock_ep_listen(rx_ctx->ep_attr)) {
 			SOCK_LOG_ERROR("failed to create listener\n");
 		}
 		rx_ctx->enabled = 1;
@@ -300,8 +312,7 @@ static int sock_ctx_enable(struct fid_ep *ep)
 		tx_ctx = container_of(ep, struct sock_tx_ctx, fid.ctx.fid);
 		sock_pe_add_tx_ctx(tx_ctx->domain->pe, tx_ctx);
 
-		if (!tx_ctx->ep_attr->listener.listener_thread &&
-		    sock_conn_listen(tx_ctx->ep_attr)) {
+		if (sock_ep_listen(tx_ctx->ep_attr)) {
 			SOCK_LOG_ERROR("failed to create listener\n");
 		}
 		tx_ctx->enabled = 1;
@@ -669,17 +680,7 @@ static int sock_ep_close(struct fid *fid)
 		return -FI_EBUSY;
 
 	if (sock_ep->attr->ep_type == FI_EP_MSG) {
-		sock_ep->attr->cm.do_listen = 0;
-		if (ofi_write_socket(sock_ep->attr->cm.signal_fds[0], &c, 1) != 1)
-			SOCK_LOG_DBG("Failed to signal\n");
-
-		if (sock_ep->attr->cm.listener_thread &&
-			pthread_join(sock_ep->attr->cm.listener_thread, NULL)) {
-			SOCK_LOG_ERROR("pthread join failed (%d)\n",
-				       ofi_syserr());
-		}
-		ofi_close_socket(sock_ep->attr->cm.signal_fds[0]);
-		ofi_close_socket(sock_ep->attr->cm.signal_fds[1]);
+		sock_ep_cm_release(sock_ep->attr);
 	} else {
 		if (sock_ep->attr->av)
 			ofi_atomic_dec32(&sock_ep->attr->av->ref);
@@ -759,6 +760,7 @@ static int sock_ep_close(struct fid *fid)
 	fastlock_acquire(&sock_ep->attr->domain->pe->lock);
 	ofi_idm_reset(&sock_ep->attr->av_idm);
 	sock_conn_map_destroy(sock_ep->attr);
+	sock_dgram_close(sock_ep->attr);
 	fastlock_release(&sock_ep->attr->domain->pe->lock);
 
 	ofi_atomic_dec32(&sock_ep->attr->domain->ref);
@@ -989,6 +991,8 @@ static int sock_ep_control(struct fid *fid, int command, void *arg)
 	case FI_ENABLE:
 		ep_fid = container_of(fid, struct fid_ep, fid);
 		return sock_ep_enable(ep_fid);
+	case FI_GET_STATS:
+		return ofi_stats_query(&sock_ep->attr->domain->pe->stats, arg);
 
 	default:
 		return -FI_EINVAL;
@@ -1043,8 +1047,7 @@ int sock_ep_enable(struct fid_ep *ep)
 		}
 	}
 
-	if (sock_ep->attr->ep_type != FI_EP_MSG &&
-	    !sock_ep->attr->listener.listener_thread && sock_conn_listen(sock_ep->attr))
+	if (sock_ep->attr->ep_type != FI_EP_MSG && sock_ep_listen(sock_ep->attr))
 		SOCK_LOG_ERROR("cannot start connection thread\n");
 	sock_ep->attr->is_enabled = 1;
 	return 0;
@@ -1781,18 +1784,6 @@ int sock_alloc_endpoint(struct fid_domain *domain, struct fi_info *info,
 
 	sock_ep->attr->domain = sock_dom;
 	fastlock_init(&sock_ep->attr->cm.lock);
-	if (sock_ep->attr->ep_type == FI_EP_MSG) {
-		dlist_init(&sock_ep->attr->cm.msg_list);
-		if (socketpair(AF_UNIX, SOCK_STREAM, 0,
-			       sock_ep->attr->cm.signal_fds) < 0) {
-			ret = -FI_EINVAL;
-			goto err2;
-		}
-
-		if (fi_fd_nonblock(sock_ep->attr->cm.signal_fds[1]))
-			SOCK_LOG_ERROR("fi_fd_nonblock failed");
-	}
-
 	if (sock_conn_map_init(sock_ep, sock_cm_def_map_sz)) {
 		SOCK_LOG_ERROR("failed to init connection map\n");
 		ret = -FI_EINVAL;
@@ -52,15 +52,21 @@
 
 #include "sock_util.h"
 #include "sock.h"
+#include "fi_iov.h"
 
 #define SOCK_LOG_DBG(...) _SOCK_LOG_DBG(FI_LOG_EP_CTRL, __VA_ARGS__)
 #define SOCK_LOG_ERROR(...) _SOCK_LOG_ERROR(FI_LOG_EP_CTRL, __VA_ARGS__)
 
 const struct fi_ep_attr sock_dgram_ep_attr = {
 	.type = FI_EP_DGRAM,
+#ifdef __linux__
+	.protocol = FI_PROTO_UDP,
+	.max_msg_size = SOCK_DGRAM_MAX_MSG_SZ,
+#else
 	.protocol = FI_PROTO_SOCK_TCP,
-	.protocol_version = SOCK_WIRE_PROTO_VERSION,
 	.max_msg_size = SOCK_EP_MAX_MSG_SZ,
+#endif
+	.protocol_version = SOCK_WIRE_PROTO_VERSION,
 	.msg_prefix_size = SOCK_EP_MSG_PREFIX_SZ,
 	.max_order_raw_size = SOCK_EP_MAX_ORDER_RAW_SZ,
 	.max_order_war_size = SOCK_EP_MAX_ORDER_WAR_SZ,
@@ -153,6 +159,9 @@ int sock_dgram_verify_ep_attr(const struct fi_ep_attr *ep_attr,
 	if (ep_attr) {
 		switch (ep_attr->protocol) {
 		case FI_PROTO_UNSPEC:
+#ifdef __linux__
+		case FI_PROTO_UDP:
+#endif
 		case FI_PROTO_SOCK_TCP:
 			break;
 		default:
@@ -313,3 +322,280 @@ int sock_dgram_sep(struct fid_domain *domain, struct fi_info *info,
 	*sep = &endpoint->ep;
 	return 0;
 }
+
+/*
+ * Datagram endpoints send and receive over a single UDP socket bound to the
+ * endpoint address, so no connections are set up between peers.  Sends are
+ * issued from the calling thread and complete once handed to the kernel.
+ * Receives are drained by the progress engine in batches with recvmmsg.
+ */
+#ifdef __linux__
+int sock_dgram_open(struct sock_ep_attr *ep_attr)
+{
+	struct sock_dgram *dgram;
+	struct sockaddr_in addr;
+	socklen_t addr_size;
+	char service[NI_MAXSERV];
+
+	if (ep_attr->dgram)
+		return 0;
+
+	dgram = calloc(1, sizeof(*dgram));
+	if (!dgram)
+		return -FI_ENOMEM;
+
+	dgram->rx_buf = malloc(SOCK_DGRAM_BATCH * SOCK_DGRAM_MAX_MSG_SZ);
+	if (!dgram->rx_buf)
+		goto err1;
+
+	dgram->fd = ofi_socket(AF_INET, SOCK_DGRAM, 0);
+	if (dgram->fd < 0) {
+		SOCK_LOG_ERROR("failed to create socket: %s\n",
+			       strerror(ofi_sockerr()));
+		goto err2;
+	}
+
+	memcpy(&addr, ep_attr->src_addr, sizeof(addr));
+	if (bind(dgram->fd, (struct sockaddr *) &addr, sizeof(addr))) {
+		SOCK_LOG_ERROR("failed to bind to port %d: %s\n",
+			       ntohs(addr.sin_port), strerror(ofi_sockerr()));
+		goto err3;
+	}
+
+	addr_size = sizeof(addr);
+	if (getsockname(dgram->fd, (struct sockaddr *) &addr, &addr_size))
+		goto err3;
+	ep_attr->src_addr->sin_port = addr.sin_port;
+
+	if (ep_attr->src_addr->sin_addr.s_addr == 0) {
+		snprintf(service, sizeof service, "%d", ntohs(addr.sin_port));
+		if (sock_get_src_addr_from_hostname(ep_attr->src_addr, service))
+			goto err3;
+	}
+
+	fastlock_init(&dgram->lock);
+	ep_attr->dgram = dgram;
+	sock_pe_poll_add(ep_attr->domain->pe, dgram->fd);
+	return 0;
+
+err3:
+	ofi_close_socket(dgram->fd);
+err2:
+	free(dgram->rx_buf);
+err1:
+	free(dgram);
+	return -FI_EINVAL;
+}
+
+void sock_dgram_close(struct sock_ep_attr *ep_attr)
+{
+	struct sock_dgram *dgram = ep_attr->dgram;
+
+	if (!dgram)
+		return;
+
+	sock_pe_poll_del(ep_attr->domain->pe, dgram->fd);
+	ofi_close_socket(dgram->fd);
+	fastlock_destroy(&dgram->lock);
+	free(dgram->rx_buf);
+	free(dgram);
+	ep_attr->dgram = NULL;
+}
+
+/* Called with the dgram lock held */
+static ssize_t sock_dgram_flush(struct sock_dgram *dgram)
+{
+	struct mmsghdr msgs[SOCK_DGRAM_BATCH];
+	struct sock_dgram_tx_entry *tx;
+	size_t i, done;
+	int ret, err;
+
+	while (dgram->tx_cnt) {
+		for (i = 0; i < dgram->tx_cnt; i++) {
+			tx = &dgram->tx[i];
+			tx->iov[0].iov_base = &tx->hdr;
+			if (tx->flags & FI_INJECT)
+				tx->iov[1].iov_base = tx->inject;
+
+			memset(&msgs[i], 0, sizeof(msgs[i]));
+			msgs[i].msg_hdr.msg_name = &tx->addr;
+			msgs[i].msg_hdr.msg_namelen = sizeof(tx->addr);
+			msgs[i].msg_hdr.msg_iov = tx->iov;
+			msgs[i].msg_hdr.msg_iovlen = tx->iov_cnt;
+		}
+
+		ret = sendmmsg(dgram->fd, msgs, dgram->tx_cnt, MSG_DONTWAIT);
+		if (ret < 0) {
+			err = ofi_sockerr();
+			if (OFI_SOCK_TRY_SND_RCV_AGAIN(err))
+				return -FI_EAGAIN;
+			if (err == EINTR)
+				continue;
+
+			/* the first datagram could not be sent, fail it alone */
+			SOCK_LOG_ERROR("sendmmsg failed: %s\n", strerror(err));
+			sock_pe_report_dgram_send(&dgram->tx[0], err);
+			done = 1;
+		} else {
+			for (i = 0; i < (size_t) ret; i++)
+				sock_pe_report_dgram_send(&dgram->tx[i], 0);
+			done = ret;
+		}
+
+		dgram->tx_cnt -= done;
+		memmove(&dgram->tx[0], &dgram->tx[done],
+			dgram->tx_cnt * sizeof(dgram->tx[0]));
+	}
+	return 0;
+}
+
+ssize_t sock_dgram_send(struct sock_ep_attr *ep_attr, struct sock_tx_ctx *tx_ctx,
+			const struct iovec *iov, size_t count, fi_addr_t addr,
+			void *context, uint64_t data, uint8_t op_type,
+			uint64_t tag, uint64_t flags)
+{
+	struct sock_dgram *dgram = ep_attr->dgram;
+	struct sock_dgram_tx_entry *tx;
+	struct sock_av *av = ep_attr->av;
+	uint64_t index, len;
+	ssize_t ret = 0;
+	size_t i;
+
+	if (!av)
+		return -FI_EINVAL;
+
+	index = addr & av->mask;
+	if (index >= av->table_hdr->size || !av->table[index].valid) {
+		SOCK_LOG_ERROR("requested address not inserted\n");
+		return -FI_EINVAL;
+	}
+
+	len = ofi_total_iov_len(iov, count);
+	if (len > SOCK_DGRAM_MAX_MSG_SZ ||
+	    ((flags & FI_INJECT) && len > SOCK_EP_MAX_INJECT_SZ))
+		return -FI_EINVAL;
+
+	fastlock_acquire(&dgram->lock);
+	if (dgram->tx_cnt == SOCK_DGRAM_BATCH && sock_dgram_flush(dgram)) {
+		fastlock_release(&dgram->lock);
+		return -FI_EAGAIN;
+	}
+
+	tx = &dgram->tx[dgram->tx_cnt];
+	tx->hdr.version = SOCK_WIRE_PROTO_VERSION;
+	tx->hdr.op_type = op_type;
+	tx->hdr.rx_id = htons((uint16_t) SOCK_GET_RX_ID(addr,
+							 av->rx_ctx_bits));
+	tx->hdr.flags = htonll(flags & FI_REMOTE_CQ_DATA);
+	tx->hdr.tag = htonll(tag);
+	tx->hdr.data = htonll(data);
+	memcpy(&tx->addr, &av->table[index].addr, sizeof(tx->addr));
+
+	tx->iov[0].iov_len = sizeof(tx->hdr);
+	if (flags & FI_INJECT) {
+		ofi_copy_from_iov(tx->inject, len, iov,
+				  count, 0);
+		tx->iov[1].iov_len = len;
+		tx->iov_cnt = 2;
+	} else {
+		for (i = 0; i < count; i++)
+			tx->iov[i + 1] = iov[i];
+		tx->iov_cnt = count + 1;
+	}
+
+	if (tx_ctx->fclass == FI_CLASS_STX_CTX)
+		tx->comp = &ep_attr->tx_ctx->comp;
+	else
+		tx->comp = &tx_ctx->comp;
+	tx->flags = flags;
+	if (op_type == SOCK_OP_TSEND)
+		tx->flags |= FI_TAGGED;
+	tx->context = (uintptr_t) context;
+	tx->buf = count ? (uintptr_t) iov[0].iov_base : 0;
+	tx->len = len;
+	tx->fi_addr = addr;
+	dgram->tx_cnt++;
+
+	if (!(flags & FI_MORE) || dgram->tx_cnt == SOCK_DGRAM_BATCH) {
+		ret = sock_dgram_flush(dgram);
+		/* the new send is still last in the queue, hand it back */
+		if (ret)
+			dgram->tx_cnt--;
+	}
+	fastlock_release(&dgram->lock);
+	return ret;
+}
+
+void sock_dgram_progress(struct sock_ep_attr *ep_attr)
+{
+	struct sock_dgram *dgram = ep_attr->dgram;
+	struct mmsghdr msgs[SOCK_DGRAM_BATCH];
+	struct iovec iov[SOCK_DGRAM_BATCH][2];
+	int i, ret;
+
+	fastlock_acquire(&dgram->lock);
+	if (dgram->tx_cnt)
+		sock_dgram_flush(dgram);
+	fastlock_release(&dgram->lock);
+
+	for (i = 0; i < SOCK_DGRAM_BATCH; i++) {
+		iov[i][0].iov_base = &dgram->rx_hdr[i];
+		iov[i][0].iov_len = sizeof(dgram->rx_hdr[i]);
+		iov[i][1].iov_base = dgram->rx_buf + i * SOCK_DGRAM_MAX_MSG_SZ;
+		iov[i][1].iov_len = SOCK_DGRAM_MAX_MSG_SZ;
+	}
+
+	do {
+		for (i = 0; i < SOCK_DGRAM_BATCH; i++) {
+			memset(&msgs[i], 0, sizeof(msgs[i]));
+			msgs[i].msg_hdr.msg_name = &dgram->rx_addr[i];
+			msgs[i].msg_hdr.msg_namelen = sizeof(dgram->rx_addr[i]);
+			msgs[i].msg_hdr.msg_iov = iov[i];
+			msgs[i].msg_hdr.msg_iovlen = 2;
+		}
+
+		ret = recvmmsg(dgram->fd, msgs, SOCK_DGRAM_BATCH,
+			       MSG_DONTWAIT, NULL);
+		if (ret < 0) {
+			if (!OFI_SOCK_TRY_SND_RCV_AGAIN(ofi_sockerr()) &&
+			    ofi_sockerr() != EINTR)
+				SOCK_LOG_ERROR("recvmmsg failed: %s\n",
+					       strerror(ofi_sockerr()));
+			return;
+		}
+
+		for (i = 0; i < ret; i++) {
+			if (msgs[i].msg_len < sizeof(struct sock_dgram_hdr) ||
+			    (msgs[i].msg_hdr.msg_flags & MSG_TRUNC)) {
+				SOCK_LOG_DBG("Dropping malformed datagram\n");
+				continue;
+			}
+			sock_pe_recv_dgram(ep_attr, &dgram->rx_hdr[i],
+					   &dgram->rx_addr[i], iov[i][1].iov_base,
+					   msgs[i].msg_len -
+					   sizeof(struct sock_dgram_hdr));
+		}
+	} while (ret == SOCK_DGRAM_BATCH);
+}
+#else
+int sock_dgram_open(struct sock_ep_attr *ep_attr)
+{
+	return 0;
+}
+
+void sock_dgram_close(struct sock_ep_attr *ep_attr)
+{
+}
+
+ssize_t sock_dgram_send(struct sock_ep_attr *ep_attr, struct sock_tx_ctx *tx_ctx,
+			const struct iovec *iov, size_t count, fi_addr_t addr,
+			void *context, uint64_t data, uint8_t op_type,
+			uint64_t tag, uint64_t flags)
+{
+	return -FI_ENOSYS;
+}
+
+void sock_dgram_progress(struct sock_ep_attr *ep_attr)
+{
+}
+#endif
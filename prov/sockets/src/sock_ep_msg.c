@@ -35,6 +35,7 @@
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <inttypes.h>
 #include <netdb.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
@@ -373,7 +374,7 @@ static int sock_ep_cm_setname(fid_t fid, void *addr, size_t addrlen)
 		return sock_conn_listen(sock_ep->attr);
 	case FI_CLASS_PEP:
 		sock_pep = container_of(fid, struct sock_pep, pep.fid);
-		if (sock_pep->cm.listener_thread)
+		if (sock_pep->cm.handle)
 			return -FI_EINVAL;
 		memcpy(&sock_pep->src_addr, addr, addrlen);
 		return sock_pep_create_listener(sock_pep);
@@ -395,75 +396,96 @@ static int sock_ep_cm_getpeer(struct fid_ep *ep, void *addr, size_t *addrlen)
 	return (len == sizeof(struct sockaddr_in)) ? 0 : -FI_ETOOSMALL;
 }
 
-static int sock_cm_send(int fd, const void *buf, int len)
+/*
+ * Non-blocking send of the remainder of a message.  Returns 1 once all
+ * len bytes are sent, 0 if the socket buffer filled up first.
+ */
+static int sock_cm_send(int fd, const void *buf, size_t len, size_t *done)
 {
-	int ret, done = 0;
+	ssize_t ret;
 
-	while (done != len) {
-		ret = ofi_send_socket(fd, (const char*) buf + done,
-				      len - done, MSG_NOSIGNAL);
-		if (ret < 0) {
-			if (OFI_SOCK_TRY_SND_RCV_AGAIN(ofi_sockerr()))
-				continue;
-			SOCK_LOG_ERROR("failed to write to fd: %s\n",
-				       strerror(ofi_sockerr()));
-			return -FI_EIO;
+	while (*done < len) {
+		ret = ofi_send_socket(fd, (const char *) buf + *done,
+				      len - *done, MSG_NOSIGNAL);
+		if (ret >= 0) {
+			*done += ret;
+			continue;
 		}
-		done += ret;
+		if (OFI_SOCK_TRY_SND_RCV_AGAIN(ofi_sockerr()))
+			return 0;
+		SOCK_LOG_ERROR("failed to write to fd: %s\n",
+			       strerror(ofi_sockerr()));
+		return -FI_EIO;
 	}
-	return 0;
+	return 1;
 }
 
-static int sock_cm_recv(int fd, void *buf, int len)
+/*
+ * Non-blocking receive of the remainder of a message.  Returns 1 once all
+ * len bytes have arrived, 0 if the socket ran dry first.
+ */
+static int sock_cm_recv(int fd, void *buf, size_t len, size_t *done)
 {
-	int ret, done = 0;
-	while (done != len) {
-		ret = ofi_recv_socket(fd, (char*) buf + done, len - done, 0);
-		if (ret <= 0) {
-			if (errno == EAGAIN || errno == EWOULDBLOCK)
-				continue;
+	ssize_t ret;
+
+	while (*done < len) {
+		ret = ofi_recv_socket(fd, (char *) buf + *done, len - *done, 0);
+		if (ret > 0) {
+			*done += ret;
+			continue;
+		}
+		if (ret < 0 && OFI_SOCK_TRY_SND_RCV_AGAIN(ofi_sockerr()))
+			return 0;
+		if (ret < 0)
 			SOCK_LOG_ERROR("failed to read from fd: %s\n",
 				       strerror(ofi_sockerr()));
-			return -FI_EIO;
-		}
-		done += ret;
+		return -FI_EIO;
 	}
-	return 0;
+	return 1;
 }
 
-static void sock_ep_wait_shutdown(struct sock_ep *ep)
+static void sock_ep_cm_report_connect_fail(struct sock_ep *ep,
+					   void *param, size_t paramlen)
 {
-	int ret, do_report = 0;
-	char tmp = 0;
-	struct pollfd poll_fds[2];
-	struct sock_conn_hdr msg;
-	struct fi_eq_cm_entry cm_entry = {0};
+	SOCK_LOG_DBG("reporting FI_REJECT\n");
+	if (sock_eq_report_error(ep->attr->eq, &ep->ep.fid, NULL, 0,
+				 FI_ECONNREFUSED, -FI_ECONNREFUSED,
+				 param, paramlen))
+		SOCK_LOG_ERROR("Error in writing to EQ\n");
+}
 
-	poll_fds[0].fd = ep->attr->cm.sock;
-	poll_fds[1].fd = ep->attr->cm.signal_fds[1];
-	poll_fds[0].events = poll_fds[1].events = POLLIN;
+static void sock_ep_cm_report_connected(struct sock_ep_cm_head *cm_head,
+					struct sock_ep *ep,
+					void *param, size_t paramlen)
+{
+	struct fi_eq_cm_entry *cm_entry;
 
-	while (*((volatile int*) &ep->attr->cm.do_listen)) {
-		ret = poll(poll_fds, 2, -1);
-		if (ret > 0) {
-			if (poll_fds[1].revents & POLLIN) {
-				ret = ofi_read_socket(ep->attr->cm.signal_fds[1], &tmp, 1);
-				if (ret != 1) {
-					SOCK_LOG_DBG("Invalid signal\n");
-					break;
-				}
-				continue;
-			}
-		} else {
-			break;
-		}
+	cm_entry = calloc(1, sizeof(*cm_entry) + paramlen);
+	if (!cm_entry) {
+		SOCK_LOG_ERROR("cannot allocate memory\n");
+		return;
+	}
 
-		if (sock_cm_recv(ep->attr->cm.sock, &msg, sizeof(msg)))
-			break;
+	fastlock_acquire(&ep->attr->cm.lock);
+	ep->attr->cm.is_connected = 1;
+	fastlock_release(&ep->attr->cm.lock);
 
-		if (msg.type == SOCK_CONN_SHUTDOWN)
-			break;
-	}
+	cm_head->conn_cnt++;
+	cm_head->end_ms = fi_gettime_ms();
+
+	cm_entry->fid = &ep->ep.fid;
+	memcpy(&cm_entry->data, param, paramlen);
+	SOCK_LOG_DBG("reporting FI_CONNECTED\n");
+	if (sock_eq_report_event(ep->attr->eq, FI_CONNECTED, cm_entry,
+				 sizeof(*cm_entry) + paramlen, 0))
+		SOCK_LOG_ERROR("Error in writing to EQ\n");
+	free(cm_entry);
+}
+
+static void sock_ep_cm_report_shutdown(struct sock_ep *ep)
+{
+	struct fi_eq_cm_entry cm_entry = {0};
+	int do_report = 0;
 
 	fastlock_acquire(&ep->attr->cm.lock);
 	if (ep->attr->cm.is_connected) {
@@ -479,113 +501,312 @@ static void sock_ep_wait_shutdown(struct sock_ep *ep)
 					 &cm_entry, sizeof(cm_entry), 0))
 			SOCK_LOG_ERROR("Error in writing to EQ\n");
 	}
-	ofi_close_socket(ep->attr->cm.sock);
 }
 
-static void sock_ep_cm_report_connect_fail(struct sock_ep *ep,
-					   void *param, size_t paramlen)
+/* All handle manipulation below is done with cm_head->lock held */
+static struct sock_conn_req_handle *
+sock_ep_cm_alloc_handle(struct sock_ep_cm_head *cm_head, int sock_fd)
 {
-	SOCK_LOG_DBG("reporting FI_REJECT\n");
-	if (sock_eq_report_error(ep->attr->eq, &ep->ep.fid, NULL, 0,
-				 FI_ECONNREFUSED, -FI_ECONNREFUSED,
-				 param, paramlen))
-		SOCK_LOG_ERROR("Error in writing to EQ\n");
+	struct sock_conn_req_handle *handle;
+
+	handle = calloc(1, sizeof(*handle));
+	if (!handle)
+		return NULL;
+
+	handle->sock_fd = sock_fd;
+	dlist_insert_tail(&handle->list_entry, &cm_head->handle_list);
+	if (!cm_head->start_ms)
+		cm_head->start_ms = fi_gettime_ms();
+	return handle;
 }
 
-static void *sock_ep_cm_connect_handler(void *data)
+static void sock_ep_cm_free_handle(struct sock_ep_cm_head *cm_head,
+				   struct sock_conn_req_handle *handle)
 {
-	int sock_fd, ret;
-	struct sock_conn_req_handle *handle = data;
-	struct sock_conn_req *req = handle->req;
-	struct sock_conn_hdr response;
-	struct sock_ep *ep = handle->ep;
-	void *param = NULL;
-	struct fi_eq_cm_entry *cm_entry = NULL;
-	int cm_data_sz, response_port;
+	if (handle->is_registered &&
+	    fi_epoll_del(cm_head->epollfd, handle->sock_fd))
+		SOCK_LOG_DBG("failed to remove cm fd from epoll set\n");
+	if (handle->is_queued)
+		dlist_remove(&handle->entry);
+	if (handle->ep && handle->ep->attr->cm.handle == handle)
+		handle->ep->attr->cm.handle = NULL;
+	if (handle->pep && handle->pep->cm.handle == handle)
+		handle->pep->cm.handle = NULL;
+
+	dlist_remove(&handle->list_entry);
+	ofi_close_socket(handle->sock_fd);
+	free(handle->send_buf);
+	free(handle->req);
+	free(handle);
+}
 
-	sock_fd = ofi_socket(AF_INET, SOCK_STREAM, 0);
-	if (sock_fd < 0) {
-		SOCK_LOG_ERROR("no socket\n");
-		sock_ep_cm_report_connect_fail(handle->ep, NULL, 0);
-		goto out;
+static void sock_ep_cm_queue(struct sock_ep_cm_head *cm_head,
+			     struct sock_conn_req_handle *handle,
+			     enum sock_cm_state state)
+{
+	handle->state = state;
+	if (!handle->is_queued) {
+		dlist_insert_tail(&handle->entry, &cm_head->msg_list);
+		handle->is_queued = 1;
 	}
+	fd_signal_set(&cm_head->signal);
+}
 
-	ofi_straddr_dbg(&sock_prov, FI_LOG_EP_CTRL, "Connecting to address",
-			&handle->dest_addr);
-	sock_set_sockopts_conn(sock_fd);
-	ret = connect(sock_fd, (struct sockaddr *)&handle->dest_addr,
-		      sizeof(handle->dest_addr));
-	if (ret < 0) {
-		SOCK_LOG_ERROR("connect failed : %s\n",
-			       strerror(ofi_sockerr()));
-		goto err;
+static int sock_ep_cm_register(struct sock_ep_cm_head *cm_head,
+			       struct sock_conn_req_handle *handle,
+			       uint32_t events)
+{
+	int ret;
+
+	ret = fi_epoll_add(cm_head->epollfd, handle->sock_fd, handle);
+	if (ret)
+		return ret;
+
+	handle->is_registered = 1;
+	if (events != FI_EPOLL_IN)
+		return fi_epoll_mod(cm_head->epollfd, handle->sock_fd,
+				    events, handle);
+	return 0;
+}
+
+static int sock_ep_cm_watch(struct sock_ep_cm_head *cm_head,
+			    struct sock_conn_req_handle *handle,
+			    uint32_t events)
+{
+	if (!handle->is_registered)
+		return sock_ep_cm_register(cm_head, handle, events);
+	return fi_epoll_mod(cm_head->epollfd, handle->sock_fd, events, handle);
+}
+
+/* Called once the message sent for send_state is out, or failed */
+static void sock_ep_cm_sent(struct sock_ep_cm_head *cm_head,
+			    struct sock_conn_req_handle *handle, int ret)
+{
+	switch (handle->send_state) {
+	case SOCK_CM_CONNECTING:
+		if (ret || sock_ep_cm_watch(cm_head, handle, FI_EPOLL_IN)) {
+			sock_ep_cm_report_connect_fail(handle->ep, NULL, 0);
+			break;
+		}
+		handle->state = SOCK_CM_RESPONSE;
+		handle->done = 0;
+		return;
+	case SOCK_CM_ACCEPT:
+		if (ret || sock_ep_cm_watch(cm_head, handle, FI_EPOLL_IN)) {
+			SOCK_LOG_ERROR("failed to reply\n");
+			break;
+		}
+		handle->ep->attr->cm.sock = handle->sock_fd;
+		handle->state = SOCK_CM_CONNECTED;
+		handle->done = 0;
+		sock_ep_cm_report_connected(cm_head, handle->ep, NULL, 0);
+		return;
+	default:
+		/* reject and shutdown messages end the connection */
+		if (ret)
+			SOCK_LOG_DBG("failed to send CM message\n");
+		break;
 	}
+	sock_ep_cm_free_handle(cm_head, handle);
+}
 
-	if (sock_cm_send(sock_fd, req, sizeof(*req)))
-		goto err;
-	if (handle->paramlen && sock_cm_send(sock_fd, handle->cm_data, handle->paramlen))
-		goto err;
+static void sock_ep_cm_send_progress(struct sock_ep_cm_head *cm_head,
+				     struct sock_conn_req_handle *handle)
+{
+	int ret;
 
-	if (sock_cm_recv(sock_fd, &response, sizeof(response)))
-		goto err;
+	ret = sock_cm_send(handle->sock_fd, handle->send_buf,
+			   handle->send_len, &handle->send_done);
+	if (!ret) {
+		if (sock_ep_cm_watch(cm_head, handle, FI_EPOLL_OUT))
+			sock_ep_cm_sent(cm_head, handle, -FI_EIO);
+		return;
+	}
 
-	cm_data_sz = ntohs(response.cm_data_sz);
-	response_port = ntohs(response.port);
-	if (cm_data_sz) {
-		param = calloc(1, cm_data_sz);
-		if (!param)
-			goto err;
+	free(handle->send_buf);
+	handle->send_buf = NULL;
+	sock_ep_cm_sent(cm_head, handle, ret < 0 ? ret : 0);
+}
 
-		if (sock_cm_recv(sock_fd, param, cm_data_sz))
-			goto err;
+/*
+ * The CM thread never blocks on a send: what does not fit in the socket
+ * buffer is sent from the event loop once the socket becomes writable.
+ */
+static void sock_ep_cm_send(struct sock_ep_cm_head *cm_head,
+			    struct sock_conn_req_handle *handle,
+			    enum sock_cm_state send_state,
+			    const void *hdr, size_t hdr_len,
+			    const void *data, size_t data_len)
+{
+	handle->send_state = send_state;
+	handle->send_buf = malloc(hdr_len + data_len);
+	if (!handle->send_buf) {
+		sock_ep_cm_sent(cm_head, handle, -FI_ENOMEM);
+		return;
 	}
 
-	if (response.type == SOCK_CONN_REJECT) {
-		sock_ep_cm_report_connect_fail(handle->ep, param, cm_data_sz);
-		ofi_close_socket(sock_fd);
-	} else {
-		cm_entry = calloc(1, sizeof(*cm_entry) + SOCK_EP_MAX_CM_DATA_SZ);
-		if (!cm_entry)
-			goto err;
+	memcpy(handle->send_buf, hdr, hdr_len);
+	memcpy(handle->send_buf + hdr_len, data, data_len);
+	handle->send_len = hdr_len + data_len;
+	handle->send_done = 0;
+	handle->state = SOCK_CM_SENDING;
+	sock_ep_cm_send_progress(cm_head, handle);
+}
 
-		cm_entry->fid = &ep->ep.fid;
-		memcpy(&cm_entry->data, param, cm_data_sz);
-		ep->attr->cm.is_connected = 1;
-		ep->attr->cm.do_listen = 1;
-		ep->attr->cm.sock = sock_fd;
-		ep->attr->msg_dest_port = response_port;
-		SOCK_LOG_DBG("got accept - port: %d\n", response_port);
-
-		SOCK_LOG_DBG("Reporting FI_CONNECTED\n");
-		if (sock_eq_report_event(ep->attr->eq, FI_CONNECTED, cm_entry,
-					 sizeof(*cm_entry) + cm_data_sz, 0))
-			SOCK_LOG_ERROR("Error in writing to EQ\n");
-		sock_ep_wait_shutdown(ep);
+void sock_ep_cm_release(struct sock_ep_attr *ep_attr)
+{
+	struct sock_ep_cm_head *cm_head = &ep_attr->domain->fab->cm_head;
+	struct sock_conn_req_handle *handle;
+
+	pthread_mutex_lock(&cm_head->lock);
+	handle = ep_attr->cm.handle;
+	if (handle) {
+		ep_attr->cm.handle = NULL;
+		handle->ep = NULL;
+		sock_ep_cm_queue(cm_head, handle, SOCK_CM_CLOSE);
+	}
+	pthread_mutex_unlock(&cm_head->lock);
+}
+
+static void sock_ep_cm_connect_done(struct sock_ep_cm_head *cm_head,
+				    struct sock_conn_req_handle *handle)
+{
+	socklen_t len = sizeof(int);
+	int err = 0;
+
+	if (getsockopt(handle->sock_fd, SOL_SOCKET, SO_ERROR,
+		       (void *) &err, &len) || err) {
+		SOCK_LOG_ERROR("connect failed : %s\n",
+			       strerror(err ? err : ofi_sockerr()));
+		goto err;
 	}
-	goto out;
+
+	sock_ep_cm_send(cm_head, handle, SOCK_CM_CONNECTING, handle->req,
+			sizeof(*handle->req), handle->cm_data, handle->paramlen);
+	return;
 err:
-	SOCK_LOG_ERROR("io failed : %s\n", strerror(ofi_sockerr()));
 	sock_ep_cm_report_connect_fail(handle->ep, NULL, 0);
-	ofi_close_socket(sock_fd);
-out:
-	free(param);
-	free(cm_entry);
-	free(handle->req);
-	free(handle);
-	return NULL;
+	sock_ep_cm_free_handle(cm_head, handle);
+}
+
+static void sock_ep_cm_read_response(struct sock_ep_cm_head *cm_head,
+				     struct sock_conn_req_handle *handle)
+{
+	struct sock_ep *ep = handle->ep;
+	size_t hdr_len = sizeof(handle->response);
+	size_t cm_data_sz = 0, cm_data_done;
+	int ret;
+
+	if (handle->done < hdr_len) {
+		ret = sock_cm_recv(handle->sock_fd, &handle->response,
+				   hdr_len, &handle->done);
+		if (ret <= 0)
+			goto check;
+	}
+
+	cm_data_sz = ntohs(handle->response.cm_data_sz);
+	if (cm_data_sz > SOCK_EP_MAX_CM_DATA_SZ) {
+		ret = -FI_EINVAL;
+		goto check;
+	}
+
+	cm_data_done = handle->done - hdr_len;
+	ret = sock_cm_recv(handle->sock_fd, handle->cm_data, cm_data_sz,
+			   &cm_data_done);
+	handle->done = hdr_len + cm_data_done;
+check:
+	if (!ret)
+		return;
+	if (ret < 0) {
+		sock_ep_cm_report_connect_fail(ep, NULL, 0);
+		sock_ep_cm_free_handle(cm_head, handle);
+		return;
+	}
+
+	if (handle->response.type == SOCK_CONN_REJECT) {
+		sock_ep_cm_report_connect_fail(ep, handle->cm_data, cm_data_sz);
+		sock_ep_cm_free_handle(cm_head, handle);
+		return;
+	}
+
+	ep->attr->cm.sock = handle->sock_fd;
+	ep->attr->msg_dest_port = ntohs(handle->response.port);
+	SOCK_LOG_DBG("got accept - port: %d\n", ep->attr->msg_dest_port);
+
+	handle->state = SOCK_CM_CONNECTED;
+	handle->done = 0;
+	sock_ep_cm_report_connected(cm_head, ep, handle->cm_data, cm_data_sz);
+}
+
+static void sock_ep_cm_read_shutdown(struct sock_ep_cm_head *cm_head,
+				     struct sock_conn_req_handle *handle)
+{
+	int ret;
+
+	ret = sock_cm_recv(handle->sock_fd, &handle->response,
+			   sizeof(handle->response), &handle->done);
+	if (!ret)
+		return;
+
+	if (ret > 0 && handle->response.type != SOCK_CONN_SHUTDOWN) {
+		handle->done = 0;
+		return;
+	}
+
+	sock_ep_cm_report_shutdown(handle->ep);
+	sock_ep_cm_free_handle(cm_head, handle);
+}
+
+static void sock_ep_cm_send_accept(struct sock_ep_cm_head *cm_head,
+				   struct sock_conn_req_handle *handle)
+{
+	struct sock_ep_attr *ep_attr = handle->ep->attr;
+	struct sock_conn_hdr reply;
+
+	ep_attr->msg_dest_port = ntohs(handle->req->hdr.port);
+
+	reply.type = SOCK_CONN_ACCEPT;
+	reply.port = htons(ep_attr->msg_src_port);
+	reply.cm_data_sz = htons(handle->paramlen);
+	sock_ep_cm_send(cm_head, handle, SOCK_CM_ACCEPT, &reply, sizeof(reply),
+			handle->cm_data, handle->paramlen);
+}
+
+static void sock_ep_cm_send_reject(struct sock_ep_cm_head *cm_head,
+				   struct sock_conn_req_handle *handle)
+{
+	struct sock_conn_hdr reply;
+
+	reply.type = SOCK_CONN_REJECT;
+	reply.cm_data_sz = htons(handle->paramlen);
+
+	SOCK_LOG_DBG("sending reject message\n");
+	sock_ep_cm_send(cm_head, handle, SOCK_CM_REJECT, &reply, sizeof(reply),
+			handle->cm_data, handle->paramlen);
+}
+
+static void sock_ep_cm_send_shutdown(struct sock_ep_cm_head *cm_head,
+				     struct sock_conn_req_handle *handle)
+{
+	struct sock_conn_hdr msg = {0};
+
+	msg.type = SOCK_CONN_SHUTDOWN;
+	SOCK_LOG_DBG("sending shutdown message\n");
+	sock_ep_cm_send(cm_head, handle, SOCK_CM_SHUTDOWN, &msg, sizeof(msg),
+			NULL, 0);
 }
 
 static int sock_ep_cm_connect(struct fid_ep *ep, const void *addr,
 			      const void *param, size_t paramlen)
 {
-	struct sock_conn_req *req = NULL;
-	struct sock_conn_req_handle *handle = NULL;
+	struct sock_conn_req_handle *handle;
+	struct sock_ep_cm_head *cm_head;
+	struct sock_conn_req *req;
 	struct sock_ep *_ep;
-	struct sock_eq *_eq;
+	int sock_fd, ret;
 
 	_ep = container_of(ep, struct sock_ep, ep);
-	_eq = _ep->attr->eq;
-	if (!_eq || !addr || (paramlen > SOCK_EP_MAX_CM_DATA_SZ))
+	if (!_ep->attr->eq || !addr || (paramlen > SOCK_EP_MAX_CM_DATA_SZ))
 		return -FI_EINVAL;
 
 	if (!_ep->attr->listener.listener_thread && sock_conn_listen(_ep->attr))
@@ -602,17 +823,45 @@ static int sock_ep_cm_connect(struct fid_ep *ep, const void *addr,
 	if (!req)
 		return -FI_ENOMEM;
 
-	handle = calloc(1, sizeof(*handle));
-	if (!handle)
-		goto out;
-
 	req->hdr.type = SOCK_CONN_REQ;
 	req->hdr.port = htons(_ep->attr->msg_src_port);
 	req->hdr.cm_data_sz = htons(paramlen);
 	req->caps = _ep->attr->info.caps;
 	memcpy(&req->src_addr, _ep->attr->src_addr, sizeof(req->src_addr));
-	memcpy(&handle->dest_addr, addr, sizeof(handle->dest_addr));
 
+	sock_fd = ofi_socket(AF_INET, SOCK_STREAM, 0);
+	if (sock_fd < 0) {
+		SOCK_LOG_ERROR("no socket\n");
+		free(req);
+		return -ofi_sockerr();
+	}
+
+	sock_set_sockopts_conn(sock_fd);
+	fd_set_nonblock(sock_fd);
+	ofi_straddr_dbg(&sock_prov, FI_LOG_EP_CTRL, "Connecting to address",
+			addr);
+	ret = connect(sock_fd, (struct sockaddr *) addr,
+		      sizeof(struct sockaddr_in));
+	if (ret < 0 && !OFI_SOCK_TRY_CONN_AGAIN(ofi_sockerr())) {
+		SOCK_LOG_ERROR("connect failed : %s\n",
+			       strerror(ofi_sockerr()));
+		sock_ep_cm_report_connect_fail(_ep, NULL, 0);
+		ofi_close_socket(sock_fd);
+		free(req);
+		return 0;
+	}
+
+	cm_head = &_ep->attr->domain->fab->cm_head;
+	pthread_mutex_lock(&cm_head->lock);
+	handle = sock_ep_cm_alloc_handle(cm_head, sock_fd);
+	if (!handle) {
+		pthread_mutex_unlock(&cm_head->lock);
+		ofi_close_socket(sock_fd);
+		free(req);
+		return -FI_ENOMEM;
+	}
+
+	memcpy(&handle->dest_addr, addr, sizeof(handle->dest_addr));
 	handle->ep = _ep;
 	handle->req = req;
 	if (paramlen) {
@@ -620,67 +869,20 @@ static int sock_ep_cm_connect(struct fid_ep *ep, const void *addr,
 		memcpy(handle->cm_data, param, paramlen);
 	}
 
-	if (_ep->attr->cm.listener_thread &&
-	    pthread_join(_ep->attr->cm.listener_thread, NULL))
-		SOCK_LOG_DBG("failed to join cm listener\n");
-
-	if (pthread_create(&_ep->attr->cm.listener_thread, NULL,
-			   sock_ep_cm_connect_handler, handle)) {
-		SOCK_LOG_ERROR("failed to create cm thread\n");
-		goto out;
+	if (_ep->attr->cm.handle) {
+		_ep->attr->cm.handle->ep = NULL;
+		sock_ep_cm_queue(cm_head, _ep->attr->cm.handle, SOCK_CM_CLOSE);
 	}
+	_ep->attr->cm.handle = handle;
+	sock_ep_cm_queue(cm_head, handle, SOCK_CM_NEW_CONNECT);
+	pthread_mutex_unlock(&cm_head->lock);
 	return 0;
-out:
-	free(req);
-	free(handle);
-	return -FI_ENOMEM;
-}
-
-static void *sock_cm_accept_handler(void *data)
-{
-	int ret;
-	struct sock_conn_hdr reply;
-	struct sock_conn_req_handle *hreq = data;
-	struct sock_ep_attr *ep_attr;
-	struct fi_eq_cm_entry cm_entry;
-
-	ep_attr = hreq->ep->attr;
-	ep_attr->msg_dest_port = ntohs(hreq->req->hdr.port);
-
-	reply.type = SOCK_CONN_ACCEPT;
-	reply.port = htons(ep_attr->msg_src_port);
-	reply.cm_data_sz = htons(hreq->paramlen);
-	ret = sock_cm_send(hreq->sock_fd, &reply, sizeof(reply));
-	if (ret) {
-		SOCK_LOG_ERROR("failed to reply\n");
-		return NULL;
-	}
-
-	if (hreq->paramlen && sock_cm_send(hreq->sock_fd, hreq->cm_data, hreq->paramlen)) {
-		SOCK_LOG_ERROR("failed to send userdata\n");
-		return NULL;
-	}
-
-	cm_entry.fid = &hreq->ep->ep.fid;
-	SOCK_LOG_DBG("reporting FI_CONNECTED\n");
-	if (sock_eq_report_event(ep_attr->eq, FI_CONNECTED, &cm_entry,
-				 sizeof(cm_entry), 0))
-		SOCK_LOG_ERROR("Error in writing to EQ\n");
-	ep_attr->cm.is_connected = 1;
-	ep_attr->cm.do_listen = 1;
-	ep_attr->cm.sock = hreq->sock_fd;
-	sock_ep_wait_shutdown(hreq->ep);
-
-	if (pthread_join(hreq->req_handler, NULL))
-		SOCK_LOG_DBG("failed to join req-handler\n");
-	free(hreq->req);
-	free(hreq);
-	return NULL;
 }
 
 static int sock_ep_cm_accept(struct fid_ep *ep, const void *param, size_t paramlen)
 {
 	struct sock_conn_req_handle *handle;
+	struct sock_ep_cm_head *cm_head;
 	struct sock_ep *_ep;
 
 	_ep = container_of(ep, struct sock_ep, ep);
@@ -692,11 +894,14 @@ static int sock_ep_cm_accept(struct fid_ep *ep, const void *param, size_t paraml
 
 	handle = container_of(_ep->attr->info.handle,
 			      struct sock_conn_req_handle, handle);
-	if (!handle || handle->handle.fclass != FI_CLASS_CONNREQ) {
+	if (!handle || handle->handle.fclass != FI_CLASS_CONNREQ ||
+	    handle->is_accepted) {
 		SOCK_LOG_ERROR("invalid handle for cm_accept\n");
 		return -FI_EINVAL;
 	}
 
+	cm_head = &_ep->attr->domain->fab->cm_head;
+	pthread_mutex_lock(&cm_head->lock);
 	handle->ep = _ep;
 	handle->paramlen = 0;
 	handle->is_accepted = 1;
@@ -705,43 +910,45 @@ static int sock_ep_cm_accept(struct fid_ep *ep, const void *param, size_t paraml
 		memcpy(handle->cm_data, param, paramlen);
 	}
 
-	if (_ep->attr->cm.listener_thread &&
-	    pthread_join(_ep->attr->cm.listener_thread, NULL))
-		SOCK_LOG_DBG("failed to join cm listener\n");
-
-	if (pthread_create(&_ep->attr->cm.listener_thread, NULL,
-			   sock_cm_accept_handler, handle)) {
-		SOCK_LOG_ERROR("Couldnt create accept handler\n");
-		return -FI_ENOMEM;
-	}
+	_ep->attr->cm.handle = handle;
+	sock_ep_cm_queue(cm_head, handle, SOCK_CM_ACCEPT);
+	pthread_mutex_unlock(&cm_head->lock);
 	return 0;
 }
 
 static int sock_ep_cm_shutdown(struct fid_ep *ep, uint64_t flags)
 {
+	struct sock_conn_req_handle *handle;
+	struct sock_ep_cm_head *cm_head;
 	struct sock_ep *_ep;
 	struct fi_eq_cm_entry cm_entry = {0};
-	struct sock_conn_hdr msg = {0};
-	char c = 0;
+	int connected;
 
 	_ep = container_of(ep, struct sock_ep, ep);
 	fastlock_acquire(&_ep->attr->cm.lock);
-	if (_ep->attr->cm.is_connected) {
-		msg.type = SOCK_CONN_SHUTDOWN;
-		if (sock_cm_send(_ep->attr->cm.sock, &msg, sizeof(msg)))
-			SOCK_LOG_DBG("failed to send shutdown msg\n");
-		_ep->attr->cm.is_connected = 0;
-		_ep->attr->cm.do_listen = 0;
-		if (ofi_write_socket(_ep->attr->cm.signal_fds[0], &c, 1) != 1)
-			SOCK_LOG_DBG("Failed to signal\n");
+	connected = _ep->attr->cm.is_connected;
+	_ep->attr->cm.is_connected = 0;
+	fastlock_release(&_ep->attr->cm.lock);
 
+	/* The CM thread sends the shutdown message, then closes the socket */
+	cm_head = &_ep->attr->domain->fab->cm_head;
+	pthread_mutex_lock(&cm_head->lock);
+	handle = _ep->attr->cm.handle;
+	if (handle) {
+		_ep->attr->cm.handle = NULL;
+		handle->ep = NULL;
+		sock_ep_cm_queue(cm_head, handle, connected ?
+				 SOCK_CM_SHUTDOWN : SOCK_CM_CLOSE);
+	}
+	pthread_mutex_unlock(&cm_head->lock);
+
+	if (connected) {
 		cm_entry.fid = &_ep->ep.fid;
 		SOCK_LOG_DBG("reporting FI_SHUTDOWN\n");
 		if (sock_eq_report_event(_ep->attr->eq, FI_SHUTDOWN,
 					 &cm_entry, sizeof(cm_entry), 0))
 			SOCK_LOG_ERROR("Error in writing to EQ\n");
 	}
-	fastlock_release(&_ep->attr->cm.lock);
 	sock_ep_disable(ep);
 	return 0;
 }
@@ -841,25 +1048,61 @@ static int sock_pep_fi_bind(fid_t fid, struct fid *bfid, uint64_t flags)
 	return 0;
 }
 
+/*
+ * Connection requests the application never accepted or rejected are
+ * rejected once their listener or its EQ is closed.
+ */
+static void sock_ep_cm_reject_pending(struct sock_ep_cm_head *cm_head,
+				      struct sock_conn_req_handle *handle)
+{
+	if (handle->state != SOCK_CM_PENDING || handle->is_accepted)
+		return;
+
+	handle->handle.fclass = FI_CLASS_UNSPEC;
+	handle->paramlen = 0;
+	sock_ep_cm_queue(cm_head, handle, SOCK_CM_REJECT);
+}
+
+void sock_ep_cm_eq_close(struct sock_eq *eq)
+{
+	struct sock_ep_cm_head *cm_head = &eq->sock_fab->cm_head;
+	struct sock_conn_req_handle *handle;
+
+	pthread_mutex_lock(&cm_head->lock);
+	dlist_foreach_container(&cm_head->handle_list,
+				struct sock_conn_req_handle, handle, list_entry) {
+		if (handle->pep && handle->pep->eq == eq)
+			sock_ep_cm_reject_pending(cm_head, handle);
+	}
+	pthread_mutex_unlock(&cm_head->lock);
+}
+
 static int sock_pep_fi_close(fid_t fid)
 {
-	int ret;
-	char c = 0;
+	struct sock_conn_req_handle *handle;
+	struct sock_ep_cm_head *cm_head;
 	struct sock_pep *pep;
 
 	pep = container_of(fid, struct sock_pep, pep.fid);
-	pep->cm.do_listen = 0;
-	ret = ofi_write_socket(pep->cm.signal_fds[0], &c, 1);
-	if (ret != 1)
-		SOCK_LOG_DBG("Failed to signal\n");
-
-	if (pep->cm.listener_thread &&
-	    pthread_join(pep->cm.listener_thread, NULL)) {
-		SOCK_LOG_DBG("pthread join failed\n");
+	cm_head = &pep->sock_fab->cm_head;
+
+	pthread_mutex_lock(&cm_head->lock);
+	dlist_foreach_container(&cm_head->handle_list,
+				struct sock_conn_req_handle, handle, list_entry) {
+		if (handle->pep != pep)
+			continue;
+		if (handle->state == SOCK_CM_NEW_LISTEN ||
+		    handle->state == SOCK_CM_LISTEN ||
+		    handle->state == SOCK_CM_CONNREQ)
+			sock_ep_cm_queue(cm_head, handle, SOCK_CM_CLOSE);
+		else
+			sock_ep_cm_reject_pending(cm_head, handle);
+		handle->pep = NULL;
 	}
+	pthread_mutex_unlock(&cm_head->lock);
 
-	ofi_close_socket(pep->cm.signal_fds[0]);
-	ofi_close_socket(pep->cm.signal_fds[1]);
+	if (pep->cm.do_listen && !pep->cm.handle)
+		ofi_close_socket(pep->cm.sock);
 	fastlock_destroy(&pep->cm.lock);
 
 	free(pep);
@@ -893,224 +1136,328 @@ static struct fi_info *sock_ep_msg_get_info(struct sock_pep *pep,
 			    &hints, &pep->src_addr, &req->src_addr);
 }
 
-static void *sock_pep_req_handler(void *data)
+static void sock_ep_cm_read_req(struct sock_ep_cm_head *cm_head,
+				struct sock_conn_req_handle *handle)
 {
-	int ret, entry_sz;
+	struct fi_eq_cm_entry *cm_entry;
+	struct sock_conn_req *req = handle->req;
 	struct fi_info *info;
-	struct sock_conn_req *conn_req = NULL;
-	struct fi_eq_cm_entry *cm_entry = NULL;
-	struct sock_conn_req_handle *handle = data;
-	int req_cm_data_sz;
-	char c = 0;
-
-	conn_req = calloc(1, sizeof(*conn_req) + SOCK_EP_MAX_CM_DATA_SZ);
-	if (!conn_req) {
-		SOCK_LOG_ERROR("cannot allocate memory\n");
-		goto err;
-	}
+	size_t len, cm_data_sz;
+	int ret;
 
-	ret = sock_cm_recv(handle->sock_fd, conn_req, sizeof(*conn_req));
-	if (ret) {
-		SOCK_LOG_ERROR("IO failed\n");
-		goto err;
-	}
+	do {
+		len = sizeof(*req);
+		cm_data_sz = 0;
+		if (handle->done >= len) {
+			cm_data_sz = ntohs(req->hdr.cm_data_sz);
+			if (cm_data_sz > SOCK_EP_MAX_CM_DATA_SZ) {
+				SOCK_LOG_ERROR("invalid cm-data size\n");
+				goto err;
+			}
+			len += cm_data_sz;
+		}
 
-	req_cm_data_sz = ntohs(conn_req->hdr.cm_data_sz);
-	if (req_cm_data_sz) {
-		ret = sock_cm_recv(handle->sock_fd, conn_req->cm_data,
-				   req_cm_data_sz);
-		if (ret) {
-			SOCK_LOG_ERROR("IO failed for cm-data\n");
+		ret = sock_cm_recv(handle->sock_fd, req, len, &handle->done);
+		if (ret < 0) {
+			SOCK_LOG_ERROR("IO failed\n");
 			goto err;
+		} else if (!ret) {
+			return;
 		}
-	}
+	} while (handle->done == sizeof(*req) && req->hdr.cm_data_sz);
 
-	info = sock_ep_msg_get_info(handle->pep, conn_req);
-	if (info == NULL) {
-		handle->paramlen = 0;
-		fastlock_acquire(&handle->pep->cm.lock);
-		dlist_insert_tail(&handle->entry, &handle->pep->cm.msg_list);
-		fastlock_release(&handle->pep->cm.lock);
+	/* The request stays parked until the application accepts or rejects */
+	if (fi_epoll_del(cm_head->epollfd, handle->sock_fd))
+		SOCK_LOG_DBG("failed to remove cm fd from epoll set\n");
+	handle->is_registered = 0;
 
-		if (ofi_write_socket(handle->pep->cm.signal_fds[0], &c, 1) != 1)
-			SOCK_LOG_DBG("Failed to signal\n");
-		free(conn_req);
-		return NULL;
+	info = sock_ep_msg_get_info(handle->pep, req);
+	if (!info) {
+		handle->paramlen = 0;
+		sock_ep_cm_send_reject(cm_head, handle);
+		return;
 	}
 
-	cm_entry = calloc(1, sizeof(*cm_entry) + req_cm_data_sz);
+	cm_entry = calloc(1, sizeof(*cm_entry) + cm_data_sz);
 	if (!cm_entry) {
 		SOCK_LOG_ERROR("cannot allocate memory\n");
+		fi_freeinfo(info);
 		goto err;
 	}
 
 	handle->handle.fclass = FI_CLASS_CONNREQ;
-	handle->req = conn_req;
+	handle->state = SOCK_CM_PENDING;
 
-	entry_sz = sizeof(*cm_entry) + req_cm_data_sz;
 	cm_entry->fid = &handle->pep->pep.fid;
 	cm_entry->info = info;
 	cm_entry->info->handle = &handle->handle;
-	memcpy(cm_entry->data, conn_req->cm_data, req_cm_data_sz);
+	memcpy(cm_entry->data, req->cm_data, cm_data_sz);
 
 	SOCK_LOG_DBG("reporting conn-req to EQ\n");
-	if (sock_eq_report_event(handle->pep->eq, FI_CONNREQ, cm_entry, entry_sz, 0))
+	if (sock_eq_report_event(handle->pep->eq, FI_CONNREQ, cm_entry,
+				 sizeof(*cm_entry) + cm_data_sz, 0))
 		SOCK_LOG_ERROR("Error in writing to EQ\n");
-
 	free(cm_entry);
-	return NULL;
+	return;
 err:
-	ofi_close_socket(handle->sock_fd);
-	free(cm_entry);
-	free(conn_req);
-	free(handle);
-	return NULL;
+	sock_ep_cm_free_handle(cm_head, handle);
 }
 
-static void sock_pep_check_msg_list(struct sock_pep *pep)
+static void sock_ep_cm_accept_conns(struct sock_ep_cm_head *cm_head,
+				    struct sock_conn_req_handle *listener)
 {
-	struct dlist_entry *entry;
-	struct sock_conn_req_handle *hreq;
-	struct sock_conn_hdr reply;
-
-	fastlock_acquire(&pep->cm.lock);
-	while (!dlist_empty(&pep->cm.msg_list)) {
-		entry = pep->cm.msg_list.next;
-		dlist_remove(entry);
-		hreq = container_of(entry, struct sock_conn_req_handle, entry);
+	struct sock_conn_req_handle *handle;
+	int conn_fd;
 
-		reply.type = SOCK_CONN_REJECT;
-		reply.cm_data_sz = htons(hreq->paramlen);
+	while ((conn_fd = accept(listener->sock_fd, NULL, 0)) >= 0) {
+		sock_set_sockopts_conn(conn_fd);
+		fd_set_nonblock(conn_fd);
 
-		SOCK_LOG_DBG("sending reject message\n");
-		if (sock_cm_send(hreq->sock_fd, &reply, sizeof(reply))) {
-			SOCK_LOG_ERROR("failed to reply\n");
-			break;
+		handle = sock_ep_cm_alloc_handle(cm_head, conn_fd);
+		if (!handle) {
+			SOCK_LOG_ERROR("cannot allocate memory\n");
+			ofi_close_socket(conn_fd);
+			continue;
 		}
 
-		if (hreq->paramlen && sock_cm_send(hreq->sock_fd, hreq->cm_data,
-						   hreq->paramlen)) {
-			SOCK_LOG_ERROR("failed to send userdata\n");
-			break;
+		handle->pep = listener->pep;
+		handle->state = SOCK_CM_CONNREQ;
+		handle->req = calloc(1, sizeof(*handle->req) +
+				     SOCK_EP_MAX_CM_DATA_SZ);
+		if (!handle->req ||
+		    sock_ep_cm_register(cm_head, handle, FI_EPOLL_IN)) {
+			SOCK_LOG_ERROR("failed to track connection request\n");
+			sock_ep_cm_free_handle(cm_head, handle);
 		}
+	}
 
-		if (pthread_join(hreq->req_handler, NULL))
-			SOCK_LOG_DBG("failed to join req-handler\n");
-		ofi_close_socket(hreq->sock_fd);
-		free(hreq->req);
-		free(hreq);
+	if (!OFI_SOCK_TRY_SND_RCV_AGAIN(ofi_sockerr()))
+		SOCK_LOG_ERROR("failed to accept: %d\n", ofi_sockerr());
+}
+
+static void sock_ep_cm_handle_event(struct sock_ep_cm_head *cm_head,
+				    struct sock_conn_req_handle *handle)
+{
+	switch (handle->state) {
+	case SOCK_CM_LISTEN:
+		sock_ep_cm_accept_conns(cm_head, handle);
+		break;
+	case SOCK_CM_CONNECTING:
+		sock_ep_cm_connect_done(cm_head, handle);
+		break;
+	case SOCK_CM_RESPONSE:
+		sock_ep_cm_read_response(cm_head, handle);
+		break;
+	case SOCK_CM_CONNREQ:
+		sock_ep_cm_read_req(cm_head, handle);
+		break;
+	case SOCK_CM_CONNECTED:
+		sock_ep_cm_read_shutdown(cm_head, handle);
+		break;
+	case SOCK_CM_SENDING:
+		sock_ep_cm_send_progress(cm_head, handle);
+		break;
+	default:
+		/* stale event for a handle with queued work */
+		break;
 	}
-	fastlock_release(&pep->cm.lock);
 }
 
-static void *sock_pep_listener_thread(void *data)
+static void sock_ep_cm_process_msg_list(struct sock_ep_cm_head *cm_head)
 {
-	struct sock_pep *pep = (struct sock_pep *) data;
-	struct sock_conn_req_handle *handle = NULL;
-	struct pollfd poll_fds[2];
-
-	int ret = 0, conn_fd;
-	char tmp = 0;
-
-	SOCK_LOG_DBG("Starting listener thread for PEP: %p\n", pep);
-	poll_fds[0].fd = pep->cm.sock;
-	poll_fds[1].fd = pep->cm.signal_fds[1];
-	poll_fds[0].events = poll_fds[1].events = POLLIN;
-	while (*((volatile int *) &pep->cm.do_listen)) {
-		ret = poll(poll_fds, 2, -1);
-		if (ret > 0) {
-			if (poll_fds[1].revents & POLLIN) {
-				ret = ofi_read_socket(pep->cm.signal_fds[1], &tmp, 1);
-				if (ret != 1)
-					SOCK_LOG_DBG("Invalid signal\n");
-				sock_pep_check_msg_list(pep);
-				continue;
+	struct sock_conn_req_handle *handle;
+
+	while (!dlist_empty(&cm_head->msg_list)) {
+		dlist_pop_front(&cm_head->msg_list, struct sock_conn_req_handle,
+				handle, entry);
+		handle->is_queued = 0;
+
+		switch (handle->state) {
+		case SOCK_CM_NEW_LISTEN:
+			handle->state = SOCK_CM_LISTEN;
+			if (sock_ep_cm_register(cm_head, handle, FI_EPOLL_IN)) {
+				SOCK_LOG_ERROR("failed to add listener\n");
+				sock_ep_cm_free_handle(cm_head, handle);
 			}
-		} else {
+			break;
+		case SOCK_CM_NEW_CONNECT:
+			handle->state = SOCK_CM_CONNECTING;
+			if (sock_ep_cm_register(cm_head, handle, FI_EPOLL_OUT)) {
+				sock_ep_cm_report_connect_fail(handle->ep, NULL, 0);
+				sock_ep_cm_free_handle(cm_head, handle);
+			}
+			break;
+		case SOCK_CM_ACCEPT:
+			sock_ep_cm_send_accept(cm_head, handle);
+			break;
+		case SOCK_CM_REJECT:
+			sock_ep_cm_send_reject(cm_head, handle);
+			break;
+		case SOCK_CM_SHUTDOWN:
+			sock_ep_cm_send_shutdown(cm_head, handle);
+			break;
+		case SOCK_CM_CLOSE:
+			sock_ep_cm_free_handle(cm_head, handle);
+			break;
+		default:
 			break;
 		}
+	}
+}
 
-		conn_fd = accept(pep->cm.sock, NULL, 0);
-		if (conn_fd < 0) {
-			SOCK_LOG_ERROR("failed to accept: %d\n", ofi_sockerr());
+static void *sock_ep_cm_thread(void *arg)
+{
+	struct sock_ep_cm_head *cm_head = arg;
+	void *ep_contexts[SOCK_EPOLL_WAIT_EVENTS];
+	int num_fds, i;
+
+	SOCK_LOG_DBG("Starting CM thread\n");
+	while (*((volatile int *) &cm_head->do_listen)) {
+		num_fds = fi_epoll_wait(cm_head->epollfd, ep_contexts,
+					SOCK_EPOLL_WAIT_EVENTS, -1);
+		if (num_fds < 0) {
+			if (num_fds != -EINTR)
+				SOCK_LOG_ERROR("poll failed: %d\n", num_fds);
 			continue;
 		}
 
-		sock_set_sockopts_conn(conn_fd);
-		handle = calloc(1, sizeof(*handle));
-		if (!handle) {
-			SOCK_LOG_ERROR("cannot allocate memory\n");
-			ofi_close_socket(conn_fd);
-			break;
-		}
-
-		handle->sock_fd = conn_fd;
-		handle->pep = pep;
-
-		if (pthread_create(&handle->req_handler, NULL,
-				   sock_pep_req_handler, handle)) {
-			SOCK_LOG_ERROR("failed to create req handler\n");
-			ofi_close_socket(conn_fd);
-			free(handle);
+		pthread_mutex_lock(&cm_head->lock);
+		for (i = 0; i < num_fds; i++) {
+			if (ep_contexts[i] == cm_head)
+				fd_signal_reset(&cm_head->signal);
+			else
+				sock_ep_cm_handle_event(cm_head, ep_contexts[i]);
 		}
+		sock_ep_cm_process_msg_list(cm_head);
+		pthread_mutex_unlock(&cm_head->lock);
 	}
-
-	SOCK_LOG_DBG("PEP listener thread exiting\n");
-	ofi_close_socket(pep->cm.sock);
+	SOCK_LOG_DBG("CM thread exiting\n");
 	return NULL;
 }
 
-static int sock_pep_start_listener_thread(struct sock_pep *pep)
+int sock_ep_cm_start_thread(struct sock_ep_cm_head *cm_head)
 {
-	if (pthread_create(&pep->cm.listener_thread, NULL,
-			   sock_pep_listener_thread, (void *)pep)) {
-		SOCK_LOG_ERROR("Couldn't create listener thread\n");
-		return -FI_EINVAL;
+	int ret;
+
+	ret = fi_epoll_create(&cm_head->epollfd);
+	if (ret)
+		return ret;
+
+	ret = fd_signal_init(&cm_head->signal);
+	if (ret)
+		goto err1;
+
+	ret = fi_epoll_add(cm_head->epollfd,
+			   cm_head->signal.fd[FI_READ_FD], cm_head);
+	if (ret)
+		goto err2;
+
+	pthread_mutex_init(&cm_head->lock, NULL);
+	dlist_init(&cm_head->msg_list);
+	dlist_init(&cm_head->handle_list);
+	cm_head->do_listen = 1;
+	if (pthread_create(&cm_head->listener_thread, NULL,
+			   sock_ep_cm_thread, cm_head)) {
+		SOCK_LOG_ERROR("Couldn't create CM thread\n");
+		ret = -FI_EINVAL;
+		goto err3;
 	}
 	return 0;
+err3:
+	pthread_mutex_destroy(&cm_head->lock);
+err2:
+	fd_signal_free(&cm_head->signal);
+err1:
+	fi_epoll_close(cm_head->epollfd);
+	return ret;
+}
+
+void sock_ep_cm_stop_thread(struct sock_ep_cm_head *cm_head)
+{
+	struct sock_conn_req_handle *handle;
+	uint64_t elapsed_ms;
+
+	pthread_mutex_lock(&cm_head->lock);
+	cm_head->do_listen = 0;
+	fd_signal_set(&cm_head->signal);
+	pthread_mutex_unlock(&cm_head->lock);
+
+	if (pthread_join(cm_head->listener_thread, NULL))
+		SOCK_LOG_DBG("failed to join CM thread\n");
+
+	while (!dlist_empty(&cm_head->handle_list)) {
+		handle = container_of(cm_head->handle_list.next,
+				      struct sock_conn_req_handle, list_entry);
+		sock_ep_cm_free_handle(cm_head, handle);
+	}
+
+	if (cm_head->conn_cnt) {
+		elapsed_ms = cm_head->end_ms - cm_head->start_ms;
+		FI_INFO(&sock_prov, FI_LOG_EP_CTRL,
+			"%zu connections established in %" PRIu64 " ms "
+			"(%.1f connections/sec)\n", cm_head->conn_cnt,
+			elapsed_ms, elapsed_ms ? cm_head->conn_cnt * 1000.0 /
+			elapsed_ms : (double) cm_head->conn_cnt);
+	}
+
+	fi_epoll_close(cm_head->epollfd);
+	fd_signal_free(&cm_head->signal);
+	pthread_mutex_destroy(&cm_head->lock);
 }
 
 static int sock_pep_listen(struct fid_pep *pep)
 {
+	struct sock_conn_req_handle *handle;
+	struct sock_ep_cm_head *cm_head;
 	struct sock_pep *_pep;
+
 	_pep = container_of(pep, struct sock_pep, pep);
-	if (_pep->cm.listener_thread)
+	if (_pep->cm.handle)
 		return 0;
 
 	if (!_pep->cm.do_listen && sock_pep_create_listener(_pep)) {
-		SOCK_LOG_ERROR("Failed to create pep thread\n");
+		SOCK_LOG_ERROR("Failed to create pep listener\n");
 		return -FI_EINVAL;
 	}
 
-	return sock_pep_start_listener_thread(_pep);
+	fd_set_nonblock(_pep->cm.sock);
+	cm_head = &_pep->sock_fab->cm_head;
+	pthread_mutex_lock(&cm_head->lock);
+	handle = sock_ep_cm_alloc_handle(cm_head, _pep->cm.sock);
+	if (!handle) {
+		pthread_mutex_unlock(&cm_head->lock);
+		return -FI_ENOMEM;
+	}
+
+	handle->pep = _pep;
+	_pep->cm.handle = handle;
+	sock_ep_cm_queue(cm_head, handle, SOCK_CM_NEW_LISTEN);
+	pthread_mutex_unlock(&cm_head->lock);
+	return 0;
 }
 
 static int sock_pep_reject(struct fid_pep *pep, fid_t handle,
 		const void *param, size_t paramlen)
 {
 	struct sock_conn_req_handle *hreq;
-	struct sock_conn_req *req;
+	struct sock_ep_cm_head *cm_head;
 	struct sock_pep *_pep;
-	char c = 0;
 
 	_pep = container_of(pep, struct sock_pep, pep);
 	hreq = container_of(handle, struct sock_conn_req_handle, handle);
-	req = hreq->req;
-	if (!req || hreq->handle.fclass != FI_CLASS_CONNREQ || hreq->is_accepted)
+	if (!hreq->req || hreq->handle.fclass != FI_CLASS_CONNREQ ||
+	    hreq->is_accepted || paramlen > SOCK_EP_MAX_CM_DATA_SZ)
 		return -FI_EINVAL;
 
+	cm_head = &_pep->sock_fab->cm_head;
+	pthread_mutex_lock(&cm_head->lock);
 	hreq->paramlen = 0;
 	if (paramlen) {
 		memcpy(hreq->cm_data, param, paramlen);
 		hreq->paramlen = paramlen;
 	}
-
-	fastlock_acquire(&_pep->cm.lock);
-	dlist_insert_tail(&hreq->entry, &_pep->cm.msg_list);
-	fastlock_release(&_pep->cm.lock);
-
-	if (ofi_write_socket(_pep->cm.signal_fds[0], &c, 1) != 1)
-		SOCK_LOG_DBG("Failed to signal\n");
+	sock_ep_cm_queue(cm_head, hreq, SOCK_CM_REJECT);
+	pthread_mutex_unlock(&cm_head->lock);
 	return 0;
 }
 
@@ -1211,15 +1558,6 @@ int sock_msg_passive_ep(struct fid_fabric *fabric, struct fi_info *info,
 		goto err;
 	}
 
-	ret = socketpair(AF_UNIX, SOCK_STREAM, 0, _pep->cm.signal_fds);
-	if (ret) {
-		ret = -ofi_sockerr();
-		goto err;
-	}
-
-	fd_set_nonblock(_pep->cm.signal_fds[1]);
-	dlist_init(&_pep->cm.msg_list);
-
 	_pep->pep.fid.fclass = FI_CLASS_PEP;
 	_pep->pep.fid.context = context;
 	_pep->pep.fid.ops = &sock_pep_fi_ops;
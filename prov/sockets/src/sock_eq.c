@@ -287,6 +287,7 @@ static int sock_eq_fi_close(struct fid *fid)
 	struct sock_eq *sock_eq;
 
 	sock_eq = container_of(fid, struct sock_eq, eq);
+	sock_ep_cm_eq_close(sock_eq);
 	sock_eq_clean_err_data_list(sock_eq, 1);
 
 	dlistfd_head_free(&sock_eq->list);
@@ -64,6 +64,7 @@ int sock_cm_def_map_sz = SOCK_CMAP_DEF_SZ;
 int sock_av_def_sz = SOCK_AV_DEF_SZ;
 int sock_cq_def_sz = SOCK_CQ_DEF_SZ;
 int sock_eq_def_sz = SOCK_EQ_DEF_SZ;
+int sock_local_conn = 1;
 #if ENABLE_DEBUG
 int sock_dgram_drop_rate = 0;
 #endif
@@ -318,6 +319,7 @@ static int sock_fabric_close(fid_t fid)
 		return -FI_EBUSY;
 
 	sock_fab_remove_from_list(fab);
+	sock_ep_cm_stop_thread(&fab->cm_head);
 	fastlock_destroy(&fab->lock);
 	free(fab);
 	return 0;
@@ -340,6 +342,7 @@ static void sock_read_default_params()
 		fi_param_get_int(&sock_prov, "def_av_sz", &sock_av_def_sz);
 		fi_param_get_int(&sock_prov, "def_cq_sz", &sock_cq_def_sz);
 		fi_param_get_int(&sock_prov, "def_eq_sz", &sock_eq_def_sz);
+		fi_param_get_bool(&sock_prov, "local_conn", &sock_local_conn);
 #if ENABLE_DEBUG
 		fi_param_get_int(&sock_prov, "dgram_drop_rate", &sock_dgram_drop_rate);
 #endif
@@ -351,6 +354,7 @@ static int sock_fabric(struct fi_fabric_attr *attr,
 		       struct fid_fabric **fabric, void *context)
 {
 	struct sock_fabric *fab;
+	int ret;
 
 	fab = calloc(1, sizeof(*fab));
 	if (!fab)
@@ -358,6 +362,12 @@ static int sock_fabric(struct fi_fabric_attr *attr,
 
 	sock_read_default_params();
 
+	ret = sock_ep_cm_start_thread(&fab->cm_head);
+	if (ret) {
+		free(fab);
+		return ret;
+	}
+
 	fastlock_init(&fab->lock);
 	dlist_init(&fab->service_list);
 
@@ -764,6 +774,10 @@ SOCKETS_INI
 	fi_param_define(&sock_prov, "def_eq_sz", FI_PARAM_INT,
 			"Default event queue size");
 
+	fi_param_define(&sock_prov, "local_conn", FI_PARAM_BOOL,
+			"Connect to peers on the same host over UNIX domain "
+			"sockets instead of TCP (default: yes, Linux only)");
+
 	fi_param_define(&sock_prov, "pe_affinity", FI_PARAM_STRING,
 			"If specified, bind the progress thread to the indicated range(s) of Linux virtual processor ID(s). "
 			"This option is currently not supported on OS X. Usage: id_start[-id_end[:stride]][,]");
@@ -135,6 +135,7 @@ ssize_t sock_ep_recvmsg(struct fid_ep *ep, const struct fi_msg *msg,
 	SOCK_LOG_DBG("New rx_entry: %p (ctx: %p)\n", rx_entry, rx_ctx);
 	fastlock_acquire(&rx_ctx->lock);
 	dlist_insert_tail(&rx_entry->entry, &rx_ctx->rx_entry_list);
+	rx_ctx->match_buffered = 1;
 	fastlock_release(&rx_ctx->lock);
 	return 0;
 }
@@ -216,9 +217,12 @@ ssize_t sock_ep_sendmsg(struct fid_ep *ep, const struct fi_msg *msg,
 	if (sock_drop_packet(ep_attr))
 		return 0;
 
-	ret = sock_ep_get_conn(ep_attr, tx_ctx, msg->addr, &conn);
-	if (ret)
-		return ret;
+	/* Datagram endpoints send directly over their UDP socket */
+	if (!ep_attr->dgram) {
+		ret = sock_ep_get_conn(ep_attr, tx_ctx, msg->addr, &conn);
+		if (ret)
+			return ret;
+	}
 
 	SOCK_LOG_DBG("New sendmsg on TX: %p using conn: %p\n",
 		      tx_ctx, conn);
@@ -233,6 +237,11 @@ ssize_t sock_ep_sendmsg(struct fid_ep *ep, const struct fi_msg *msg,
 			return ret;
 	}
 
+	if (ep_attr->dgram)
+		return sock_dgram_send(ep_attr, tx_ctx, msg->msg_iov,
+				       msg->iov_count, msg->addr, msg->context,
+				       msg->data, SOCK_OP_SEND, 0, flags);
+
 	memset(&tx_op, 0, sizeof(struct sock_op));
 	tx_op.op = SOCK_OP_SEND;
 
@@ -281,7 +290,7 @@ ssize_t sock_ep_sendmsg(struct fid_ep *ep, const struct fi_msg *msg,
 		}
 	}
 
-	sock_tx_ctx_commit(tx_ctx);
+	sock_tx_ctx_commit(tx_ctx, flags);
 	return 0;
 
 err:
@@ -478,6 +487,7 @@ ssize_t sock_ep_trecvmsg(struct fid_ep *ep,
 	fastlock_acquire(&rx_ctx->lock);
 	SOCK_LOG_DBG("New rx_entry: %p (ctx: %p)\n", rx_entry, rx_ctx);
 	dlist_insert_tail(&rx_entry->entry, &rx_ctx->rx_entry_list);
+	rx_ctx->match_buffered = 1;
 	fastlock_release(&rx_ctx->lock);
 	return 0;
 }
@@ -564,9 +574,12 @@ ssize_t sock_ep_tsendmsg(struct fid_ep *ep,
 	if (sock_drop_packet(ep_attr))
 		return 0;
 
-	ret = sock_ep_get_conn(ep_attr, tx_ctx, msg->addr, &conn);
-	if (ret)
-		return ret;
+	/* Datagram endpoints send directly over their UDP socket */
+	if (!ep_attr->dgram) {
+		ret = sock_ep_get_conn(ep_attr, tx_ctx, msg->addr, &conn);
+		if (ret)
+			return ret;
+	}
 
 	SOCK_EP_SET_TX_OP_FLAGS(flags);
 	if (flags & SOCK_USE_OP_FLAGS)
@@ -578,6 +591,11 @@ ssize_t sock_ep_tsendmsg(struct fid_ep *ep,
 			return ret;
 	}
 
+	if (ep_attr->dgram)
+		return sock_dgram_send(ep_attr, tx_ctx, msg->msg_iov,
+				       msg->iov_count, msg->addr, msg->context,
+				       msg->data, SOCK_OP_TSEND, msg->tag, flags);
+
 	memset(&tx_op, 0, sizeof(tx_op));
 	tx_op.op = SOCK_OP_TSEND;
 
@@ -625,7 +643,7 @@ ssize_t sock_ep_tsendmsg(struct fid_ep *ep,
 		}
 	}
 
-	sock_tx_ctx_commit(tx_ctx);
+	sock_tx_ctx_commit(tx_ctx, flags);
 	return 0;
 
 err:
@@ -64,9 +64,13 @@
 #define SOCK_LOG_ERROR(...) _SOCK_LOG_ERROR(FI_LOG_EP_DATA, __VA_ARGS__)
 
 #define PE_INDEX(_pe, _e) (_e - &_pe->pe_table[0])
-#define SOCK_GET_RX_ID(_addr, _bits) (((_bits) == 0) ? 0 : \
-		(((uint64_t)_addr) >> (64 - _bits)))
 
+static const struct ofi_stat_def sock_pe_stat_defs[SOCK_PE_STAT_MAX] = {
+	[SOCK_PE_STAT_BUSY]		= { "pe_busy", OFI_STAT_GAUGE },
+	[SOCK_PE_STAT_POOL_BUSY]	= { "pe_pool_busy", OFI_STAT_GAUGE },
+	[SOCK_PE_STAT_TABLE_FULL]	= { "pe_table_full", OFI_STAT_COUNTER },
+	[SOCK_PE_STAT_POOL_BUFS]	= { "pe_pool_bufs", OFI_STAT_GAUGE },
+};
 
 static int sock_pe_progress_buffered_rx(struct sock_rx_ctx *rx_ctx);
 
@@ -168,6 +172,7 @@ static void sock_pe_release_entry(struct sock_pe *pe,
 		ofi_rbfree(&pe_entry->comm_buf);
 		dlist_remove(&pe_entry->entry);
 		util_buf_release(pe->pe_rx_pool, pe_entry);
+		ofi_stats_dec(&pe->stats, SOCK_PE_STAT_POOL_BUSY);
 		return;
 	}
 
@@ -175,6 +180,7 @@ static void sock_pe_release_entry(struct sock_pe *pe,
 		ofi_rbreset(&pe_entry->comm_buf);
 
 	pe->num_free_entries++;
+	ofi_stats_dec(&pe->stats, SOCK_PE_STAT_BUSY);
 	pe_entry->conn = NULL;
 
 	memset(&pe_entry->pe.rx, 0, sizeof(pe_entry->pe.rx));
@@ -205,9 +211,11 @@ static struct sock_pe_entry *sock_pe_acquire_entry(struct sock_pe *pe)
 	struct sock_pe_entry *pe_entry;
 
 	if (dlist_empty(&pe->free_list)) {
+		ofi_stats_inc(&pe->stats, SOCK_PE_STAT_TABLE_FULL);
 		pe_entry = util_buf_alloc(pe->pe_rx_pool);
 		SOCK_LOG_DBG("Getting rx pool entry\n");
 		if (pe_entry) {
+			ofi_stats_inc(&pe->stats, SOCK_PE_STAT_POOL_BUSY);
 			memset(pe_entry, 0, sizeof(*pe_entry));
 			pe_entry->is_pool_entry = 1;
 			if (ofi_rbinit(&pe_entry->comm_buf, SOCK_PE_OVERFLOW_COMM_BUFF_SZ))
@@ -217,6 +225,7 @@ static struct sock_pe_entry *sock_pe_acquire_entry(struct sock_pe *pe)
 		}
 	} else {
 		pe->num_free_entries--;
+		ofi_stats_inc(&pe->stats, SOCK_PE_STAT_BUSY);
 		entry = pe->free_list.next;
 		pe_entry = container_of(entry, struct sock_pe_entry, entry);
 
@@ -1051,6 +1060,7 @@ sock_pe_process_rx_tatomic(struct sock_pe *pe, struct sock_rx_ctx *rx_ctx,
 
 	pe_entry->pe.rx.rx_entry = rx_entry;
 
+	rx_ctx->match_buffered = 1;
 	sock_pe_progress_buffered_rx(rx_ctx);
 	fastlock_release(&rx_ctx->lock);
 
@@ -1177,6 +1187,11 @@ static int sock_pe_progress_buffered_rx(struct sock_rx_ctx *rx_ctx)
 	size_t i, rem = 0, offset, len, used_len, dst_offset, datatype_sz;
 	char *src, *dst;
 
+	/* Nothing can match until a receive or buffered message shows up */
+	if (!rx_ctx->match_buffered)
+		return 0;
+	rx_ctx->match_buffered = 0;
+
 	if (dlist_empty(&rx_ctx->rx_entry_list) ||
 	    dlist_empty(&rx_ctx->rx_buffered_list))
 		return 0;
@@ -1399,10 +1414,14 @@ static int sock_pe_process_rx_send(struct sock_pe *pe,
 		if (sock_rx_avail_len(rx_entry) < rx_ctx->min_multi_recv) {
 			pe_entry->flags |= FI_MULTI_RECV;
 			dlist_remove(&rx_entry->entry);
+		} else {
+			rx_ctx->match_buffered = 1;
 		}
 	} else {
 		if (!rx_entry->is_buffered)
 			dlist_remove(&rx_entry->entry);
+		else
+			rx_ctx->match_buffered = 1;
 	}
 	rx_entry->is_busy = 0;
 	fastlock_release(&rx_ctx->lock);
@@ -1436,6 +1455,157 @@ out:
 	return ret;
 }
 
+void sock_pe_report_dgram_send(struct sock_dgram_tx_entry *tx, int err)
+{
+	struct sock_pe_entry pe_entry;
+
+	memset(&pe_entry, 0, sizeof(pe_entry));
+	pe_entry.type = SOCK_PE_TX;
+	pe_entry.comp = tx->comp;
+	pe_entry.context = tx->context;
+	pe_entry.addr = tx->fi_addr;
+	pe_entry.buf = tx->buf;
+	pe_entry.data_len = tx->len;
+	pe_entry.flags = tx->flags | FI_MSG | FI_SEND;
+	pe_entry.msg_hdr.flags = pe_entry.flags;
+	pe_entry.pe.tx.tx_iov[0].src.iov.addr = tx->buf;
+
+	if (err)
+		sock_pe_report_tx_error(&pe_entry, 0, err);
+	else
+		sock_pe_report_send_completion(&pe_entry);
+}
+
+/*
+ * Deliver a datagram received on a DGRAM endpoint.  The whole message is
+ * in hand, so it is matched and copied out in one step.  Unexpected
+ * datagrams are buffered while there is room and dropped otherwise.
+ */
+void sock_pe_recv_dgram(struct sock_ep_attr *ep_attr, struct sock_dgram_hdr *hdr,
+			struct sockaddr_in *addr, char *buf, size_t len)
+{
+	struct sock_pe_entry pe_entry;
+	struct sock_rx_ctx *rx_ctx;
+	struct sock_rx_entry *rx_entry;
+	uint64_t rem, used, data_len, flags;
+	uint16_t rx_id;
+	uint8_t is_tagged;
+	char *dst;
+	size_t i;
+	int index;
+
+	rx_id = ntohs(hdr->rx_id);
+	if (hdr->version != SOCK_WIRE_PROTO_VERSION ||
+	    (hdr->op_type != SOCK_OP_SEND && hdr->op_type != SOCK_OP_TSEND) ||
+	    rx_id >= ep_attr->ep_attr.rx_ctx_cnt || !ep_attr->rx_array[rx_id]) {
+		SOCK_LOG_DBG("Dropping invalid datagram\n");
+		return;
+	}
+
+	rx_ctx = ep_attr->rx_array[rx_id];
+	if (rx_ctx->use_shared)
+		rx_ctx = rx_ctx->srx_ctx;
+	if (!rx_ctx || !rx_ctx->enabled)
+		return;
+
+	index = ep_attr->av ? sock_av_get_addr_index(ep_attr->av, addr) : -1;
+	is_tagged = (hdr->op_type == SOCK_OP_TSEND);
+	flags = ntohll(hdr->flags) & FI_REMOTE_CQ_DATA;
+
+	memset(&pe_entry, 0, sizeof(pe_entry));
+	pe_entry.type = SOCK_PE_RX;
+	pe_entry.comp = &rx_ctx->comp;
+	pe_entry.addr = (index < 0) ? FI_ADDR_NOTAVAIL : (fi_addr_t) index;
+	pe_entry.tag = ntohll(hdr->tag);
+	pe_entry.data = ntohll(hdr->data);
+	pe_entry.data_len = len;
+
+	fastlock_acquire(&rx_ctx->lock);
+	sock_pe_progress_buffered_rx(rx_ctx);
+
+	rx_entry = sock_rx_get_entry(rx_ctx, pe_entry.addr, pe_entry.tag,
+				     is_tagged);
+	if (!rx_entry) {
+		if (rx_ctx->buffered_len + len >= rx_ctx->attr.total_buffered_recv)
+			goto drop;
+
+		rx_entry = sock_rx_new_buffered_entry(rx_ctx, len);
+		if (!rx_entry)
+			goto drop;
+
+		memcpy((char *) (uintptr_t) rx_entry->iov[0].iov.addr, buf, len);
+		rx_entry->addr = pe_entry.addr;
+		rx_entry->tag = pe_entry.tag;
+		rx_entry->data = pe_entry.data;
+		rx_entry->ignore = 0;
+		rx_entry->comp = pe_entry.comp;
+		rx_entry->flags |= flags;
+		rx_entry->is_tagged = is_tagged;
+		rx_entry->used = len;
+		rx_entry->is_complete = 1;
+		rx_entry->is_busy = 0;
+		rx_ctx->match_buffered = 1;
+		fastlock_release(&rx_ctx->lock);
+		return;
+	}
+
+	rem = len;
+	used = rx_entry->used;
+	for (i = 0; rem > 0 && i < rx_entry->rx_op.dest_iov_len; i++) {
+		if (used >= rx_entry->iov[i].iov.len) {
+			used -= rx_entry->iov[i].iov.len;
+			continue;
+		}
+
+		dst = (char *) (uintptr_t) rx_entry->iov[i].iov.addr + used;
+		data_len = MIN(rx_entry->iov[i].iov.len - used, rem);
+		memcpy(dst, buf + (len - rem), data_len);
+		if (!pe_entry.buf)
+			pe_entry.buf = (uintptr_t) dst;
+		rem -= data_len;
+		used = 0;
+		rx_entry->used += data_len;
+	}
+
+	pe_entry.context = rx_entry->context;
+	pe_entry.pe.rx.rx_iov[0].iov.addr = rx_entry->iov[0].iov.addr;
+	pe_entry.flags = rx_entry->flags | flags | FI_MSG | FI_RECV;
+	if (is_tagged)
+		pe_entry.flags |= FI_TAGGED;
+	pe_entry.flags &= ~FI_MULTI_RECV;
+
+	if (rx_entry->flags & FI_MULTI_RECV) {
+		if (sock_rx_avail_len(rx_entry) < rx_ctx->min_multi_recv) {
+			pe_entry.flags |= FI_MULTI_RECV;
+			dlist_remove(&rx_entry->entry);
+		} else {
+			rx_ctx->match_buffered = 1;
+		}
+	} else {
+		dlist_remove(&rx_entry->entry);
+	}
+	rx_entry->is_busy = 0;
+
+	if (rem) {
+		SOCK_LOG_DBG("Not enough space in posted recv buffer\n");
+		sock_pe_report_rx_error(&pe_entry, rem, FI_ETRUNC);
+	} else {
+		sock_pe_report_recv_completion(&pe_entry);
+	}
+
+	if (!(rx_entry->flags & FI_MULTI_RECV) ||
+	    (pe_entry.flags & FI_MULTI_RECV)) {
+		sock_rx_release_entry(rx_entry);
+		rx_ctx->num_left++;
+	}
+	fastlock_release(&rx_ctx->lock);
+	return;
+
+drop:
+	SOCK_LOG_DBG("No matching recv, dropping datagram (len = %zu)\n", len);
+	fastlock_release(&rx_ctx->lock);
+}
+
 static int sock_pe_process_rx_conn_msg(struct sock_pe *pe,
 					struct sock_rx_ctx *rx_ctx,
 					struct sock_pe_entry *pe_entry)
@@ -2349,6 +2519,9 @@ static int sock_pe_progress_rx_ep(struct sock_pe *pe,
 	struct sock_conn_map *map;
 	void *ep_contexts[SOCK_EPOLL_WAIT_EVENTS];
 
+	if (ep_attr->dgram)
+		sock_dgram_progress(ep_attr);
+
 	map = &ep_attr->cmap;
 
 	if (!map->used)
@@ -2704,6 +2877,12 @@ struct sock_pe *sock_pe_init(struct sock_domain *domain)
 	if (!pe)
 		return NULL;
 
+	if (ofi_stats_init(&sock_prov, &pe->stats, sock_pe_stat_defs,
+			   SOCK_PE_STAT_MAX, "pe")) {
+		free(pe);
+		return NULL;
+	}
+
 	sock_pe_init_table(pe);
 	dlist_init(&pe->tx_list);
 	dlist_init(&pe->rx_list);
@@ -2717,6 +2896,8 @@ struct sock_pe *sock_pe_init(struct sock_domain *domain)
 		SOCK_LOG_ERROR("failed to create buffer pool\n");
 		goto err1;
 	}
+	util_buf_pool_set_stats(pe->pe_rx_pool, &pe->stats,
+				SOCK_PE_STAT_POOL_BUFS);
 
 	pe->atomic_rx_pool = util_buf_pool_create(SOCK_EP_MAX_ATOMIC_SZ,
 						  16, 0, 32);
@@ -2760,6 +2941,7 @@ err2:
 	util_buf_pool_destroy(pe->pe_rx_pool);
 err1:
 	fastlock_destroy(&pe->lock);
+	ofi_stats_close(&pe->stats);
 	free(pe);
 	return NULL;
 }
@@ -2797,6 +2979,7 @@ void sock_pe_finalize(struct sock_pe *pe)
 	}
 
 	sock_pe_free_util_pool(pe);
+	ofi_stats_close(&pe->stats);
 	fastlock_destroy(&pe->lock);
 	fastlock_destroy(&pe->signal_lock);
 	pthread_mutex_destroy(&pe->list_lock);
@@ -95,23 +95,55 @@ void sock_rx_release_entry(struct sock_rx_entry *rx_entry)
 		rx_entry->rx_ctx =  rx_ctx;
 		rx_entry->is_pool_entry = 1;
 		slist_insert_head(&rx_entry->pool_entry, &rx_ctx->pool_list);
+	} else if (rx_entry->buf_pool) {
+		util_buf_release(rx_entry->buf_pool, rx_entry);
 	} else {
 		free(rx_entry);
 	}
 }
 
+static struct util_buf_pool *sock_rx_buf_pool(struct sock_rx_ctx *rx_ctx,
+					      size_t len)
+{
+	size_t i, size = SOCK_RX_BUF_CLASS_MIN;
+
+	for (i = 0; i < SOCK_RX_BUF_CLASS_CNT; i++, size <<= 2) {
+		if (len > size)
+			continue;
+
+		if (!rx_ctx->buf_pools[i]) {
+			rx_ctx->buf_pools[i] = util_buf_pool_create(
+				sizeof(struct sock_rx_entry) + size, 16, 0,
+				SOCK_RX_BUF_CHUNK_CNT);
+		}
+		return rx_ctx->buf_pools[i];
+	}
+	return NULL;
+}
+
 struct sock_rx_entry *sock_rx_new_buffered_entry(struct sock_rx_ctx *rx_ctx,
 						 size_t len)
 {
 	struct sock_rx_entry *rx_entry;
+	struct util_buf_pool *pool;
 
 	if (rx_ctx->buffered_len + len >= rx_ctx->attr.total_buffered_recv)
 		SOCK_LOG_ERROR("Exceeded buffered recv limit\n");
 
-	rx_entry = calloc(1, sizeof(*rx_entry) + len);
+	/* Messages too large for any size class fall back to the heap */
+	pool = sock_rx_buf_pool(rx_ctx, len);
+	if (pool) {
+		rx_entry = util_buf_alloc(pool);
+		if (rx_entry)
+			memset(rx_entry, 0, sizeof(*rx_entry));
+	} else {
+		rx_entry = calloc(1, sizeof(*rx_entry) + len);
+	}
 	if (!rx_entry)
 		return NULL;
 
+	rx_entry->buf_pool = pool;
+
 	SOCK_LOG_DBG("New buffered entry:%p len: %lu, ctx: %p\n",
 		       rx_entry, len, rx_ctx);
 
@@ -128,6 +160,26 @@ struct sock_rx_entry *sock_rx_new_buffered_entry(struct sock_rx_ctx *rx_ctx,
 	return rx_entry;
 }
 
+void sock_rx_release_buffered(struct sock_rx_ctx *rx_ctx)
+{
+	struct sock_rx_entry *rx_entry;
+	size_t i;
+
+	while (!dlist_empty(&rx_ctx->rx_buffered_list)) {
+		dlist_pop_front(&rx_ctx->rx_buffered_list, struct sock_rx_entry,
+				rx_entry, entry);
+		sock_rx_release_entry(rx_entry);
+	}
+	rx_ctx->buffered_len = 0;
+
+	for (i = 0; i < SOCK_RX_BUF_CLASS_CNT; i++) {
+		if (rx_ctx->buf_pools[i]) {
+			util_buf_pool_destroy(rx_ctx->buf_pools[i]);
+			rx_ctx->buf_pools[i] = NULL;
+		}
+	}
+}
+
 struct sock_rx_entry *sock_rx_get_entry(struct sock_rx_ctx *rx_ctx,
 					uint64_t addr, uint64_t tag,
 					uint8_t is_tagged)
@@ -43,6 +43,24 @@
 #define SOCK_LOG_DBG(...) _SOCK_LOG_DBG(FI_LOG_EP_DATA, __VA_ARGS__)
 #define SOCK_LOG_ERROR(...) _SOCK_LOG_ERROR(FI_LOG_EP_DATA, __VA_ARGS__)
 
+static ssize_t sock_queue_trigger(struct sock_cntr *cntr,
+				  struct sock_trigger *trigger, size_t threshold)
+{
+	int ret;
+
+	fastlock_acquire(&cntr->trigger_lock);
+	ret = ofi_trigger_insert(&cntr->trigger_queue, &trigger->trigger,
+				 sock_trigger_key((int) threshold));
+	fastlock_release(&cntr->trigger_lock);
+	if (ret) {
+		free(trigger);
+		return ret;
+	}
+
+	sock_cntr_check_trigger_list(cntr);
+	return 0;
+}
+
 ssize_t sock_queue_rma_op(struct fid_ep *ep, const struct fi_msg_rma *msg,
 			  uint64_t flags, enum fi_op_type op_type)
 {
@@ -67,7 +85,6 @@ ssize_t sock_queue_rma_op(struct fid_ep *ep, const struct fi_msg_rma *msg,
 		return -FI_ENOMEM;
 
 	trigger->context = trigger_context;
-	trigger->threshold = work->threshold;
 
 	memcpy(&trigger->op.rma.msg, msg, sizeof(*msg));
 	trigger->op.rma.msg.msg_iov = &trigger->op.rma.msg_iov[0];
@@ -82,11 +99,7 @@ ssize_t sock_queue_rma_op(struct fid_ep *ep, const struct fi_msg_rma *msg,
 	trigger->ep = ep;
 	trigger->flags = flags;
 
-	fastlock_acquire(&cntr->trigger_lock);
-	dlist_insert_tail(&trigger->entry, &cntr->trigger_list);
-	fastlock_release(&cntr->trigger_lock);
-	sock_cntr_check_trigger_list(cntr);
-	return 0;
+	return sock_queue_trigger(cntr, trigger, work->threshold);
 }
 
 ssize_t sock_queue_msg_op(struct fid_ep *ep, const struct fi_msg *msg,
@@ -113,7 +126,6 @@ ssize_t sock_queue_msg_op(struct fid_ep *ep, const struct fi_msg *msg,
 		return -FI_ENOMEM;
 
 	trigger->context = trigger_context;
-	trigger->threshold = work->threshold;
 
 	memcpy(&trigger->op.msg.msg, msg, sizeof(*msg));
 	trigger->op.msg.msg.msg_iov = &trigger->op.msg.msg_iov[0];
@@ -124,11 +136,7 @@ ssize_t sock_queue_msg_op(struct fid_ep *ep, const struct fi_msg *msg,
 	trigger->ep = ep;
 	trigger->flags = flags;
 
-	fastlock_acquire(&cntr->trigger_lock);
-	dlist_insert_tail(&trigger->entry, &cntr->trigger_list);
-	fastlock_release(&cntr->trigger_lock);
-	sock_cntr_check_trigger_list(cntr);
-	return 0;
+	return sock_queue_trigger(cntr, trigger, work->threshold);
 }
 
 ssize_t sock_queue_tmsg_op(struct fid_ep *ep, const struct fi_msg_tagged *msg,
@@ -155,7 +163,6 @@ ssize_t sock_queue_tmsg_op(struct fid_ep *ep, const struct fi_msg_tagged *msg,
 		return -FI_ENOMEM;
 
 	trigger->context = trigger_context;
-	trigger->threshold = work->threshold;
 
 	memcpy(&trigger->op.tmsg.msg, msg, sizeof(*msg));
 	trigger->op.tmsg.msg.msg_iov = &trigger->op.tmsg.msg_iov[0];
@@ -166,11 +173,7 @@ ssize_t sock_queue_tmsg_op(struct fid_ep *ep, const struct fi_msg_tagged *msg,
 	trigger->ep = ep;
 	trigger->flags = flags;
 
-	fastlock_acquire(&cntr->trigger_lock);
-	dlist_insert_tail(&trigger->entry, &cntr->trigger_list);
-	fastlock_release(&cntr->trigger_lock);
-	sock_cntr_check_trigger_list(cntr);
-	return 0;
+	return sock_queue_trigger(cntr, trigger, work->threshold);
 }
 
 ssize_t sock_queue_atomic_op(struct fid_ep *ep, const struct fi_msg_atomic *msg,
@@ -199,7 +202,6 @@ ssize_t sock_queue_atomic_op(struct fid_ep *ep, const struct fi_msg_atomic *msg,
 		return -FI_ENOMEM;
 
 	trigger->context = trigger_context;
-	trigger->threshold = work->threshold;
 
 	memcpy(&trigger->op.atomic.msg, msg, sizeof(*msg));
 	trigger->op.atomic.msg.msg_iov = &trigger->op.atomic.msg_iov[0];
@@ -226,11 +228,7 @@ ssize_t sock_queue_atomic_op(struct fid_ep *ep, const struct fi_msg_atomic *msg,
 	trigger->ep = ep;
 	trigger->flags = flags;
 
-	fastlock_acquire(&cntr->trigger_lock);
-	dlist_insert_tail(&trigger->entry, &cntr->trigger_list);
-	fastlock_release(&cntr->trigger_lock);
-	sock_cntr_check_trigger_list(cntr);
-	return 0;
+	return sock_queue_trigger(cntr, trigger, work->threshold);
 }
 
 ssize_t sock_queue_cntr_op(struct fi_deferred_work *work, uint64_t flags)
@@ -253,14 +251,9 @@ ssize_t sock_queue_cntr_op(struct fi_deferred_work *work, uint64_t flags)
 
 	trigger->context = (struct sock_triggered_context *) &work->context;
 	trigger->op_type = work->op_type;
-	trigger->threshold = work->threshold;
 	trigger->flags = flags;
 
-	fastlock_acquire(&cntr->trigger_lock);
-	dlist_insert_tail(&trigger->entry, &cntr->trigger_list);
-	fastlock_release(&cntr->trigger_lock);
-	sock_cntr_check_trigger_list(cntr);
-	return 0;
+	return sock_queue_trigger(cntr, trigger, work->threshold);
 }
 
 int sock_queue_work(struct sock_domain *dom, struct fi_deferred_work *work)
@@ -82,6 +82,7 @@ int udpx_eq_open(struct fid_fabric *fabric, struct fi_eq_attr *attr,
 
 
 #define UDPX_FLAG_MULTI_RECV	1
+#define UDPX_FLAG_COMPLETION	2
 #define UDPX_IOV_LIMIT		4
 
 struct udpx_ep_entry {
@@ -94,27 +95,73 @@ struct udpx_ep_entry {
 
 OFI_DECLARE_CIRQUE(struct udpx_ep_entry, udpx_rx_cirq);
 
+#define UDPX_TX_BATCH		16
+
+/* Sends posted with FI_MORE are queued and go out in one sendmmsg call */
+struct udpx_tx_entry {
+	struct sockaddr_in6	addr;
+	socklen_t		addrlen;
+	struct iovec		iov[UDPX_IOV_LIMIT];
+	size_t			iov_count;
+	void			*context;
+	uint64_t		flags;
+};
+
 struct udpx_ep;
 typedef void (*udpx_rx_comp_func)(struct udpx_ep *ep, void *context,
 		uint64_t flags, size_t len, void *buf, void *addr);
 typedef void (*udpx_tx_comp_func)(struct udpx_ep *ep, void *context);
 
+enum udpx_stat {
+	UDPX_STAT_TX_PKTS,
+	UDPX_STAT_TX_BYTES,
+	UDPX_STAT_TX_ERRORS,
+	UDPX_STAT_RX_PKTS,
+	UDPX_STAT_RX_BYTES,
+	UDPX_STAT_MAX,
+};
+
 struct udpx_ep {
 	struct util_ep		util_ep;
 	udpx_rx_comp_func	rx_comp;
 	udpx_tx_comp_func	tx_comp;
-	struct udpx_rx_cirq	*rxq;    /* protected by rx_cq lock */
+	struct udpx_rx_cirq	*rxq;    /* protected by rxq_lock */
+	ofi_lock_t		*rxq_lock; /* rx_cq lock, or ep lock if no CQ */
 	int			sock;
 	int			is_bound;
 	ofi_atomic32_t		ref;
+	struct ofi_stats	stats;
+
+	fastlock_t		tx_lock;
+	size_t			tx_cnt;  /* protected by tx_lock */
+	struct udpx_tx_entry	tx[UDPX_TX_BATCH];
 };
 
 int udpx_endpoint(struct fid_domain *domain, struct fi_info *info,
 		  struct fid_ep **ep, void *context);
+int udpx_scalable_ep(struct fid_domain *domain, struct fi_info *info,
+		     struct fid_ep **sep, void *context);
+
+
+struct udpx_cq {
+	struct util_cq		util_cq;
+	/* Send completions of batches being sent, protected by cq_lock */
+	size_t			tx_reserved;
+};
+
+/* Caller must hold cq_lock */
+static inline size_t udpx_cq_freecnt(struct util_cq *util_cq)
+{
+	struct udpx_cq *cq = container_of(util_cq, struct udpx_cq, util_cq);
+	size_t freecnt = ofi_cirque_freecnt(util_cq->cirq);
 
+	return freecnt > cq->tx_reserved ? freecnt - cq->tx_reserved : 0;
+}
 
 int udpx_cq_open(struct fid_domain *domain, struct fi_cq_attr *attr,
 		 struct fid_cq **cq, void *context);
+int udpx_cntr_open(struct fid_domain *domain, struct fi_cntr_attr *attr,
+		   struct fid_cntr **cntr, void *context);
 
 
 struct udpx_mc {
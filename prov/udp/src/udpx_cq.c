@@ -38,10 +38,10 @@
 static int udpx_cq_close(struct fid *fid)
 {
 	int ret;
-	struct util_cq *cq;
+	struct udpx_cq *cq;
 
-	cq = container_of(fid, struct util_cq, cq_fid.fid);
-	ret = ofi_cq_cleanup(cq);
+	cq = container_of(fid, struct udpx_cq, util_cq.cq_fid.fid);
+	ret = ofi_cq_cleanup(&cq->util_cq);
 	if (ret)
 		return ret;
 	free(cq);
@@ -60,20 +60,63 @@ int udpx_cq_open(struct fid_domain *domain, struct fi_cq_attr *attr,
 		 struct fid_cq **cq_fid, void *context)
 {
 	int ret;
-	struct util_cq *cq;
+	struct udpx_cq *cq;
 
 	cq = calloc(1, sizeof(*cq));
 	if (!cq)
 		return -FI_ENOMEM;
 
-	ret = ofi_cq_init(&udpx_prov, domain, attr, cq,
+	ret = ofi_cq_init(&udpx_prov, domain, attr, &cq->util_cq,
 			   &ofi_cq_progress, context);
 	if (ret) {
 		free(cq);
 		return ret;
 	}
 
-	*cq_fid = &cq->cq_fid;
+	*cq_fid = &cq->util_cq.cq_fid;
 	(*cq_fid)->fid.ops = &udpx_cq_fi_ops;
 	return 0;
 }
+
+static int udpx_cntr_close(struct fid *fid)
+{
+	struct util_cntr *cntr;
+	int ret;
+
+	cntr = container_of(fid, struct util_cntr, cntr_fid.fid);
+	ret = ofi_cntr_cleanup(cntr);
+	if (ret)
+		return ret;
+	free(cntr);
+	return 0;
+}
+
+static struct fi_ops udpx_cntr_fi_ops = {
+	.size = sizeof(struct fi_ops),
+	.close = udpx_cntr_close,
+	.bind = fi_no_bind,
+	.control = fi_no_control,
+	.ops_open = fi_no_ops_open,
+};
+
+int udpx_cntr_open(struct fid_domain *domain, struct fi_cntr_attr *attr,
+		   struct fid_cntr **cntr_fid, void *context)
+{
+	int ret;
+	struct util_cntr *cntr;
+
+	cntr = calloc(1, sizeof(*cntr));
+	if (!cntr)
+		return -FI_ENOMEM;
+
+	ret = ofi_cntr_init(&udpx_prov, domain, attr, cntr,
+			    &ofi_cntr_progress, context);
+	if (ret) {
+		free(cntr);
+		return ret;
+	}
+
+	*cntr_fid = &cntr->cntr_fid;
+	(*cntr_fid)->fid.ops = &udpx_cntr_fi_ops;
+	return 0;
+}
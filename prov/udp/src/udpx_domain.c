@@ -41,8 +41,8 @@ static struct fi_ops_domain udpx_domain_ops = {
 	.av_open = ip_av_create,
 	.cq_open = udpx_cq_open,
 	.endpoint = udpx_endpoint,
-	.scalable_ep = fi_no_scalable_ep,
-	.cntr_open = fi_no_cntr_open,
+	.scalable_ep = udpx_scalable_ep,
+	.cntr_open = udpx_cntr_open,
 	.poll_open = fi_poll_create,
 	.stx_ctx = fi_no_stx_context,
 	.srx_ctx = fi_no_srx_context,
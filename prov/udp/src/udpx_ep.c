@@ -36,6 +36,14 @@
 #include "udpx.h"
 
 
+static const struct ofi_stat_def udpx_ep_stat_defs[UDPX_STAT_MAX] = {
+	[UDPX_STAT_TX_PKTS]	= { "tx_pkts", OFI_STAT_COUNTER },
+	[UDPX_STAT_TX_BYTES]	= { "tx_bytes", OFI_STAT_COUNTER },
+	[UDPX_STAT_TX_ERRORS]	= { "tx_errors", OFI_STAT_COUNTER },
+	[UDPX_STAT_RX_PKTS]	= { "rx_pkts", OFI_STAT_COUNTER },
+	[UDPX_STAT_RX_BYTES]	= { "rx_bytes", OFI_STAT_COUNTER },
+};
+
 int udpx_setname(fid_t fid, void *addr, size_t addrlen)
 {
 	struct udpx_ep *ep;
@@ -227,6 +235,7 @@ static void udpx_tx_comp(struct udpx_ep *ep, void *context)
 	comp->buf = NULL;
 	comp->data = 0;
 	ofi_cirque_commit(ep->util_ep.tx_cq->cirq);
+	ofi_poll_notify(&ep->util_ep.tx_cq->poll_notify);
 }
 
 static void udpx_tx_comp_signal(struct udpx_ep *ep, void *context)
@@ -247,6 +256,7 @@ static void udpx_rx_comp(struct udpx_ep *ep, void *context, uint64_t flags,
 	comp->buf = buf;
 	comp->data = 0;
 	ofi_cirque_commit(ep->util_ep.rx_cq->cirq);
+	ofi_poll_notify(&ep->util_ep.rx_cq->poll_notify);
 }
 
 static void udpx_rx_src_comp(struct udpx_ep *ep, void *context, uint64_t flags,
@@ -271,6 +281,8 @@ static void udpx_rx_src_comp_signal(struct udpx_ep *ep, void *context,
 	ep->util_ep.rx_cq->wait->signal(ep->util_ep.rx_cq->wait);
 }
 
+static ssize_t udpx_tx_flush_queued(struct udpx_ep *ep);
+
 void udpx_ep_progress(struct util_ep *util_ep)
 {
 	struct udpx_ep *ep;
@@ -280,13 +292,15 @@ void udpx_ep_progress(struct util_ep *util_ep)
 	int ret;
 
 	ep = container_of(util_ep, struct udpx_ep, util_ep);
+	(void) udpx_tx_flush_queued(ep);
+
 	hdr.msg_name = &addr;
 	hdr.msg_namelen = sizeof(addr);
 	hdr.msg_control = NULL;
 	hdr.msg_controllen = 0;
 	hdr.msg_flags = 0;
 
-	fastlock_acquire(&ep->util_ep.rx_cq->cq_lock);
+	ofi_lock_acquire(ep->rxq_lock);
 	if (ofi_cirque_isempty(ep->rxq))
 		goto out;
 
@@ -296,11 +310,22 @@ void udpx_ep_progress(struct util_ep *util_ep)
 
 	ret = recvmsg(ep->sock, &hdr, 0);
 	if (ret >= 0) {
-		ep->rx_comp(ep, entry->context, 0, ret, NULL, &addr);
+		ofi_stats_inc(&ep->stats, UDPX_STAT_RX_PKTS);
+		ofi_stats_add(&ep->stats, UDPX_STAT_RX_BYTES, ret);
+		if (entry->flags & UDPX_FLAG_COMPLETION)
+			ep->rx_comp(ep, entry->context, 0, ret, NULL, &addr);
 		ofi_cirque_discard(ep->rxq);
+		if (ep->util_ep.rx_cntr)
+			ofi_cntr_inc(ep->util_ep.rx_cntr);
 	}
 out:
-	fastlock_release(&ep->util_ep.rx_cq->cq_lock);
+	ofi_lock_release(ep->rxq_lock);
+}
+
+static inline uint8_t udpx_rx_flags(struct udpx_ep *ep, uint64_t flags)
+{
+	return (ep->util_ep.rx_cq && (flags & FI_COMPLETION)) ?
+		UDPX_FLAG_COMPLETION : 0;
 }
 
 ssize_t udpx_recvmsg(struct fid_ep *ep_fid, const struct fi_msg *msg,
@@ -311,7 +336,7 @@ ssize_t udpx_recvmsg(struct fid_ep *ep_fid, const struct fi_msg *msg,
 	ssize_t ret;
 
 	ep = container_of(ep_fid, struct udpx_ep, util_ep.ep_fid.fid);
-	fastlock_acquire(&ep->util_ep.rx_cq->cq_lock);
+	ofi_lock_acquire(ep->rxq_lock);
 	if (ofi_cirque_isfull(ep->rxq)) {
 		ret = -FI_EAGAIN;
 		goto out;
@@ -323,12 +348,13 @@ ssize_t udpx_recvmsg(struct fid_ep *ep_fid, const struct fi_msg *msg,
 	     entry->iov_count++) {
 		entry->iov[entry->iov_count] = msg->msg_iov[entry->iov_count];
 	}
-	entry->flags = 0;
+	entry->flags = udpx_rx_flags(ep, flags |
+				     (ep->util_ep.rx_op_flags & FI_COMPLETION));
 
 	ofi_cirque_commit(ep->rxq);
 	ret = 0;
 out:
-	fastlock_release(&ep->util_ep.rx_cq->cq_lock);
+	ofi_lock_release(ep->rxq_lock);
 	return ret;
 }
 
@@ -351,7 +377,7 @@ ssize_t udpx_recv(struct fid_ep *ep_fid, void *buf, size_t len, void *desc,
 	ssize_t ret;
 
 	ep = container_of(ep_fid, struct udpx_ep, util_ep.ep_fid.fid);
-	fastlock_acquire(&ep->util_ep.rx_cq->cq_lock);
+	ofi_lock_acquire(ep->rxq_lock);
 	if (ofi_cirque_isfull(ep->rxq)) {
 		ret = -FI_EAGAIN;
 		goto out;
@@ -362,20 +388,21 @@ ssize_t udpx_recv(struct fid_ep *ep_fid, void *buf, size_t len, void *desc,
 	entry->iov_count = 1;
 	entry->iov[0].iov_base = buf;
 	entry->iov[0].iov_len = len;
-	entry->flags = 0;
+	entry->flags = udpx_rx_flags(ep, ep->util_ep.rx_op_flags);
 
 	ofi_cirque_commit(ep->rxq);
 	ret = 0;
 out:
-	fastlock_release(&ep->util_ep.rx_cq->cq_lock);
+	ofi_lock_release(ep->rxq_lock);
 	return ret;
 }
 
 static const void *
-udpx_dest_addr(struct udpx_ep *ep, fi_addr_t addr, uint64_t flags)
+udpx_dest_addr(struct udpx_ep *ep, fi_addr_t addr, uint64_t flags,
+	       struct sockaddr_storage *buf)
 {
 	return (flags & FI_MULTICAST) ? (const void *) (uintptr_t) addr :
-					ip_av_get_addr(ep->util_ep.av, addr);
+		ip_av_get_ctx_addr(ep->util_ep.av, addr, buf);
 }
 
 static size_t
@@ -386,26 +413,204 @@ udpx_dest_addrlen(struct udpx_ep *ep, fi_addr_t addr, uint64_t flags)
 		ep->util_ep.av->addrlen;
 }
 
+static inline void udpx_tx_stats(struct udpx_ep *ep, ssize_t ret)
+{
+	if (ret >= 0) {
+		ofi_stats_inc(&ep->stats, UDPX_STAT_TX_PKTS);
+		ofi_stats_add(&ep->stats, UDPX_STAT_TX_BYTES, ret);
+	} else {
+		ofi_stats_inc(&ep->stats, UDPX_STAT_TX_ERRORS);
+	}
+}
+
+static inline void udpx_tx_cntr_inc(struct udpx_ep *ep, ssize_t ret)
+{
+	if (!ep->util_ep.tx_cntr)
+		return;
+
+	if (ret >= 0)
+		ofi_cntr_inc(ep->util_ep.tx_cntr);
+	else
+		ofi_cntr_inc_err(ep->util_ep.tx_cntr);
+}
+
+/*
+ * Operations that do not generate a CQ entry skip the CQ lock and the
+ * completion cirque entirely; only the (lock-free) counter is updated.
+ */
+static inline int udpx_tx_needs_cq(struct udpx_ep *ep, uint64_t flags)
+{
+	return ep->util_ep.tx_cq && (flags & FI_COMPLETION);
+}
+
+#ifdef __linux__
+#define udpx_sendmmsg sendmmsg
+#else
+struct mmsghdr {
+	struct msghdr msg_hdr;
+	unsigned int msg_len;
+};
+
+static int udpx_sendmmsg(int sock, struct mmsghdr *msgs, unsigned int cnt,
+			 int flags)
+{
+	unsigned int i;
+	ssize_t ret;
+
+	for (i = 0; i < cnt; i++) {
+		ret = sendmsg(sock, &msgs[i].msg_hdr, flags);
+		if (ret < 0)
+			return i ? (int) i : -1;
+		msgs[i].msg_len = (unsigned int) ret;
+	}
+	return (int) i;
+}
+#endif
+
+static void udpx_tx_err(struct udpx_ep *ep, struct udpx_tx_entry *tx, int err)
+{
+	struct fi_cq_err_entry err_entry = {0};
+
+	udpx_tx_stats(ep, -err);
+	udpx_tx_cntr_inc(ep, -err);
+	if (!udpx_tx_needs_cq(ep, tx->flags))
+		return;
+
+	err_entry.op_context = tx->context;
+	err_entry.flags = FI_SEND;
+	err_entry.err = err;
+	err_entry.prov_errno = -err;
+	if (ofi_cq_write_error(ep->util_ep.tx_cq, &err_entry))
+		FI_WARN(&udpx_prov, FI_LOG_EP_DATA,
+			"unable to report send error\n");
+}
+
+/*
+ * Called with the tx_lock held.  Queued sends go out in order, in as few
+ * sendmmsg calls as possible, and only as long as the CQ has room for
+ * their completions.  The room is reserved under the CQ lock, which is
+ * not held across the system call.
+ */
+static ssize_t udpx_tx_flush(struct udpx_ep *ep)
+{
+	struct mmsghdr msgs[UDPX_TX_BATCH];
+	struct util_cq *cq = ep->util_ep.tx_cq;
+	struct udpx_cq *udpx_cq;
+	struct udpx_tx_entry *tx;
+	size_t i, cnt, comps, freecnt = 0, done;
+	int ret, err;
+
+	udpx_cq = cq ? container_of(cq, struct udpx_cq, util_cq) : NULL;
+	while (ep->tx_cnt) {
+		if (cq) {
+			ofi_lock_acquire(&cq->cq_lock);
+			freecnt = udpx_cq_freecnt(cq);
+		}
+
+		for (i = cnt = comps = 0; i < ep->tx_cnt; i++, cnt++) {
+			tx = &ep->tx[i];
+			if (udpx_tx_needs_cq(ep, tx->flags) && ++comps > freecnt) {
+				comps--;
+				break;
+			}
+
+			memset(&msgs[i], 0, sizeof(msgs[i]));
+			msgs[i].msg_hdr.msg_name = &tx->addr;
+			msgs[i].msg_hdr.msg_namelen = tx->addrlen;
+			msgs[i].msg_hdr.msg_iov = tx->iov;
+			msgs[i].msg_hdr.msg_iovlen = tx->iov_count;
+		}
+
+		if (cq) {
+			udpx_cq->tx_reserved += comps;
+			ofi_lock_release(&cq->cq_lock);
+		}
+		if (!cnt)
+			return -FI_EAGAIN;
+
+		ret = udpx_sendmmsg(ep->sock, msgs, (unsigned int) cnt, 0);
+		err = errno;
+		if (cq) {
+			ofi_lock_acquire(&cq->cq_lock);
+			udpx_cq->tx_reserved -= comps;
+		}
+		if (ret < 0) {
+			if (cq)
+				ofi_lock_release(&cq->cq_lock);
+			if (OFI_SOCK_TRY_SND_RCV_AGAIN(err))
+				return -FI_EAGAIN;
+			if (err == EINTR)
+				continue;
+
+			/* the first datagram could not be sent, fail it alone */
+			udpx_tx_err(ep, &ep->tx[0], err);
+			done = 1;
+		} else {
+			for (i = 0; i < (size_t) ret; i++) {
+				tx = &ep->tx[i];
+				udpx_tx_stats(ep, msgs[i].msg_len);
+				if (udpx_tx_needs_cq(ep, tx->flags))
+					ep->tx_comp(ep, tx->context);
+				udpx_tx_cntr_inc(ep, 0);
+			}
+			if (cq)
+				ofi_lock_release(&cq->cq_lock);
+			done = ret;
+		}
+
+		ep->tx_cnt -= done;
+		memmove(&ep->tx[0], &ep->tx[done], ep->tx_cnt * sizeof(ep->tx[0]));
+	}
+	return 0;
+}
+
+/* Sends that do not take part in batching must not pass queued ones */
+static ssize_t udpx_tx_flush_queued(struct udpx_ep *ep)
+{
+	ssize_t ret = 0;
+
+	fastlock_acquire(&ep->tx_lock);
+	if (ep->tx_cnt)
+		ret = udpx_tx_flush(ep);
+	fastlock_release(&ep->tx_lock);
+	return ret;
+}
+
 static ssize_t udpx_sendto(struct udpx_ep *ep, const void *buf, size_t len,
-			   const void *addr, size_t addrlen, void *context)
+			   const void *addr, size_t addrlen, void *context,
+			   uint64_t flags)
 {
 	ssize_t ret;
 
-	fastlock_acquire(&ep->util_ep.tx_cq->cq_lock);
-	if (ofi_cirque_isfull(ep->util_ep.tx_cq->cirq)) {
+	ret = udpx_tx_flush_queued(ep);
+	if (ret)
+		return ret;
+
+	if (!udpx_tx_needs_cq(ep, flags)) {
+		ret = sendto(ep->sock, buf, len, 0, addr, addrlen);
+		udpx_tx_stats(ep, ret);
+		ret = ret == len ? 0 : -errno;
+		udpx_tx_cntr_inc(ep, ret);
+		return ret;
+	}
+
+	ofi_lock_acquire(&ep->util_ep.tx_cq->cq_lock);
+	if (!udpx_cq_freecnt(ep->util_ep.tx_cq)) {
 		ret = -FI_EAGAIN;
 		goto out;
 	}
 
 	ret = sendto(ep->sock, buf, len, 0, addr, addrlen);
+	udpx_tx_stats(ep, ret);
 	if (ret == len) {
 		ep->tx_comp(ep, context);
 		ret = 0;
 	} else {
 		ret = -errno;
 	}
+	udpx_tx_cntr_inc(ep, ret);
 out:
-	fastlock_release(&ep->util_ep.tx_cq->cq_lock);
+	ofi_lock_release(&ep->util_ep.tx_cq->cq_lock);
 	return ret;
 }
 
@@ -413,10 +618,12 @@ static ssize_t udpx_send(struct fid_ep *ep_fid, const void *buf, size_t len,
 			 void *desc, fi_addr_t dest_addr, void *context)
 {
 	struct udpx_ep *ep;
+	struct sockaddr_storage addr;
 
 	ep = container_of(ep_fid, struct udpx_ep, util_ep.ep_fid.fid);
-	return udpx_sendto(ep, buf, len, ip_av_get_addr(ep->util_ep.av, dest_addr),
-			   ep->util_ep.av->addrlen, context);
+	return udpx_sendto(ep, buf, len,
+			   ip_av_get_ctx_addr(ep->util_ep.av, dest_addr, &addr),
+			   ep->util_ep.av->addrlen, context, ep->util_ep.tx_op_flags);
 }
 
 static ssize_t udpx_send_mc(struct fid_ep *ep_fid, const void *buf, size_t len,
@@ -427,18 +634,65 @@ static ssize_t udpx_send_mc(struct fid_ep *ep_fid, const void *buf, size_t len,
 	ep = container_of(ep_fid, struct udpx_ep, util_ep.ep_fid.fid);
 	return udpx_sendto(ep, buf, len, (const void *) (uintptr_t) dest_addr,
 			   ofi_sizeofaddr((const void *) (uintptr_t) dest_addr),
-			   context);
+			   context, ep->util_ep.tx_op_flags);
+}
+
+static ssize_t udpx_sendmsg_queue(struct udpx_ep *ep, const struct fi_msg *msg,
+				  uint64_t flags)
+{
+	struct udpx_tx_entry *tx;
+	struct sockaddr_storage addr;
+	ssize_t ret;
+
+	if (msg->iov_count > UDPX_IOV_LIMIT)
+		return -FI_EINVAL;
+
+	fastlock_acquire(&ep->tx_lock);
+	if (ep->tx_cnt == UDPX_TX_BATCH && udpx_tx_flush(ep)) {
+		fastlock_release(&ep->tx_lock);
+		return -FI_EAGAIN;
+	}
+
+	tx = &ep->tx[ep->tx_cnt];
+	tx->addrlen = (socklen_t) udpx_dest_addrlen(ep, msg->addr, flags);
+	memcpy(&tx->addr, udpx_dest_addr(ep, msg->addr, flags, &addr),
+	       MIN(tx->addrlen, sizeof(tx->addr)));
+	memcpy(tx->iov, msg->msg_iov, sizeof(*msg->msg_iov) * msg->iov_count);
+	tx->iov_count = msg->iov_count;
+	tx->context = msg->context;
+	tx->flags = flags | (ep->util_ep.tx_op_flags & FI_COMPLETION);
+	ep->tx_cnt++;
+
+	ret = 0;
+	if (!(flags & FI_MORE) || ep->tx_cnt == UDPX_TX_BATCH) {
+		ret = udpx_tx_flush(ep);
+		/* the new send is still last in the queue, hand it back */
+		if (ret)
+			ep->tx_cnt--;
+	}
+	fastlock_release(&ep->tx_lock);
+	return ret;
 }
 
 static ssize_t udpx_sendmsg(struct fid_ep *ep_fid, const struct fi_msg *msg,
 			    uint64_t flags)
 {
 	struct udpx_ep *ep;
+	struct sockaddr_storage addr;
 	struct msghdr hdr;
+	size_t queued = 0;
 	ssize_t ret;
 
 	ep = container_of(ep_fid, struct udpx_ep, util_ep.ep_fid.fid);
-	hdr.msg_name = (void *) udpx_dest_addr(ep, msg->addr, flags);
+	if (!(flags & FI_MORE)) {
+		fastlock_acquire(&ep->tx_lock);
+		queued = ep->tx_cnt;
+		fastlock_release(&ep->tx_lock);
+	}
+	if ((flags & FI_MORE) || queued)
+		return udpx_sendmsg_queue(ep, msg, flags);
+
+	hdr.msg_name = (void *) udpx_dest_addr(ep, msg->addr, flags, &addr);
 	hdr.msg_namelen = udpx_dest_addrlen(ep, msg->addr, flags);
 	hdr.msg_iov = (struct iovec *) msg->msg_iov;
 	hdr.msg_iovlen = msg->iov_count;
@@ -446,21 +700,32 @@ static ssize_t udpx_sendmsg(struct fid_ep *ep_fid, const struct fi_msg *msg,
 	hdr.msg_controllen = 0;
 	hdr.msg_flags = 0;
 
-	fastlock_acquire(&ep->util_ep.tx_cq->cq_lock);
-	if (ofi_cirque_isfull(ep->util_ep.tx_cq->cirq)) {
+	if (!udpx_tx_needs_cq(ep, flags |
+			      (ep->util_ep.tx_op_flags & FI_COMPLETION))) {
+		ret = sendmsg(ep->sock, &hdr, 0);
+		udpx_tx_stats(ep, ret);
+		ret = ret >= 0 ? 0 : -errno;
+		udpx_tx_cntr_inc(ep, ret);
+		return ret;
+	}
+
+	ofi_lock_acquire(&ep->util_ep.tx_cq->cq_lock);
+	if (!udpx_cq_freecnt(ep->util_ep.tx_cq)) {
 		ret = -FI_EAGAIN;
 		goto out;
 	}
 
 	ret = sendmsg(ep->sock, &hdr, 0);
+	udpx_tx_stats(ep, ret);
 	if (ret >= 0) {
 		ep->tx_comp(ep, msg->context);
 		ret = 0;
 	} else {
 		ret = -errno;
 	}
+	udpx_tx_cntr_inc(ep, ret);
 out:
-	fastlock_release(&ep->util_ep.tx_cq->cq_lock);
+	ofi_lock_release(&ep->util_ep.tx_cq->cq_lock);
 	return ret;
 }
 
@@ -495,13 +760,21 @@ static ssize_t udpx_inject(struct fid_ep *ep_fid, const void *buf, size_t len,
 			   fi_addr_t dest_addr)
 {
 	struct udpx_ep *ep;
+	struct sockaddr_storage addr;
 	ssize_t ret;
 
 	ep = container_of(ep_fid, struct udpx_ep, util_ep.ep_fid.fid);
+	ret = udpx_tx_flush_queued(ep);
+	if (ret)
+		return ret;
+
 	ret = sendto(ep->sock, buf, len, 0,
-		     ip_av_get_addr(ep->util_ep.av, dest_addr),
+		     ip_av_get_ctx_addr(ep->util_ep.av, dest_addr, &addr),
 		     ep->util_ep.av->addrlen);
-	return ret == len ? 0 : -errno;
+	udpx_tx_stats(ep, ret);
+	ret = ret == len ? 0 : -errno;
+	udpx_tx_cntr_inc(ep, ret);
+	return ret;
 }
 
 static ssize_t udpx_inject_mc(struct fid_ep *ep_fid, const void *buf,
@@ -511,9 +784,16 @@ static ssize_t udpx_inject_mc(struct fid_ep *ep_fid, const void *buf,
 	ssize_t ret;
 
 	ep = container_of(ep_fid, struct udpx_ep, util_ep.ep_fid.fid);
+	ret = udpx_tx_flush_queued(ep);
+	if (ret)
+		return ret;
+
 	ret = sendto(ep->sock, buf, len, 0, (const void *) (uintptr_t) dest_addr,
 		     ofi_sizeofaddr((const void *) (uintptr_t) dest_addr));
-	return ret == len ? 0 : -errno;
+	udpx_tx_stats(ep, ret);
+	ret = ret == len ? 0 : -errno;
+	udpx_tx_cntr_inc(ep, ret);
+	return ret;
 }
 
 static struct fi_ops_msg udpx_msg_ops = {
@@ -559,13 +839,20 @@ static int udpx_ep_close(struct fid *fid)
 					    struct util_wait_fd, util_wait);
 			fi_epoll_del(wait->epoll_fd, ep->sock);
 		}
-		fid_list_remove(&ep->util_ep.rx_cq->ep_list,
-				&ep->util_ep.rx_cq->ep_list_lock,
-				&ep->util_ep.ep_fid.fid);
+		ofi_fid_list_remove(&ep->util_ep.rx_cq->ep_list,
+				    &ep->util_ep.rx_cq->ep_list_lock,
+				    &ep->util_ep.ep_fid.fid);
 	}
 
+	if (ep->tx_cnt)
+		FI_WARN(&udpx_prov, FI_LOG_EP_CTRL,
+			"dropping %zu sends queued with FI_MORE\n", ep->tx_cnt);
+	fastlock_destroy(&ep->tx_lock);
 	udpx_rx_cirq_free(ep->rxq);
-	ofi_close_socket(ep->sock);
+	/* Sockets of scalable endpoint contexts belong to the SEP */
+	if (!ep->util_ep.sep)
+		ofi_close_socket(ep->sock);
+	ofi_stats_close(&ep->stats);
 	ofi_endpoint_close(&ep->util_ep);
 	free(ep);
 	return 0;
@@ -583,6 +870,8 @@ static int udpx_ep_bind_cq(struct udpx_ep *ep, struct util_cq *cq,
 
 	if (flags & FI_TRANSMIT) {
 		ep->util_ep.tx_cq = cq;
+		if (!(flags & FI_SELECTIVE_COMPLETION))
+			ep->util_ep.tx_op_flags |= FI_COMPLETION;
 		ofi_atomic_inc32(&cq->ref);
 		ep->tx_comp = cq->wait ? udpx_tx_comp_signal :
 					 udpx_tx_comp;
@@ -591,6 +880,9 @@ static int udpx_ep_bind_cq(struct udpx_ep *ep, struct util_cq *cq,
 	if (flags & FI_RECV) {
 		ep->util_ep.rx_cq = cq;
 		ofi_atomic_inc32(&cq->ref);
+		if (!(flags & FI_SELECTIVE_COMPLETION))
+			ep->util_ep.rx_op_flags |= FI_COMPLETION;
+		ep->rxq_lock = &cq->cq_lock;
 
 		if (cq->wait) {
 			ep->rx_comp =
@@ -610,9 +902,9 @@ static int udpx_ep_bind_cq(struct udpx_ep *ep, struct util_cq *cq,
 				udpx_rx_src_comp : udpx_rx_comp;
 		}
 
-		ret = fid_list_insert(&cq->ep_list,
-				      &cq->ep_list_lock,
-				      &ep->util_ep.ep_fid.fid);
+		ret = ofi_fid_list_insert(&cq->ep_list,
+					  &cq->ep_list_lock,
+					  &ep->util_ep.ep_fid.fid);
 		if (ret)
 			return ret;
 	}
@@ -645,6 +937,10 @@ static int udpx_ep_bind(struct fid *ep_fid, struct fid *bfid, uint64_t flags)
 		eq = container_of(bfid, struct util_eq, eq_fid.fid);
 		ret = ofi_ep_bind_eq(&ep->util_ep, eq);
 		break;
+	case FI_CLASS_CNTR:
+		ret = ofi_ep_bind_cntr(&ep->util_ep, container_of(bfid,
+				struct util_cntr, cntr_fid.fid), flags);
+		break;
 	default:
 		FI_WARN(&udpx_prov, FI_LOG_EP_CTRL,
 			"invalid fid class\n");
@@ -686,7 +982,10 @@ static int udpx_ep_ctrl(struct fid *fid, int command, void *arg)
 	ep = container_of(fid, struct udpx_ep, util_ep.ep_fid.fid);
 	switch (command) {
 	case FI_ENABLE:
-		if (!ep->util_ep.rx_cq || !ep->util_ep.tx_cq)
+		if ((fid->fclass != FI_CLASS_TX_CTX &&
+		     !ep->util_ep.rx_cq && !ep->util_ep.rx_cntr) ||
+		    (fid->fclass != FI_CLASS_RX_CTX &&
+		     !ep->util_ep.tx_cq && !ep->util_ep.tx_cntr))
 			return -FI_ENOCQ;
 		if (!ep->util_ep.av)
 			return -FI_ENOAV;
@@ -694,6 +993,8 @@ static int udpx_ep_ctrl(struct fid *fid, int command, void *arg)
 		if (!ep->is_bound)
 			udpx_bind_src_addr(ep);
 		break;
+	case FI_GET_STATS:
+		return ofi_stats_query(&ep->stats, arg);
 	default:
 		return -FI_ENOSYS;
 	}
@@ -708,16 +1009,29 @@ static struct fi_ops udpx_ep_fi_ops = {
 	.ops_open = fi_no_ops_open,
 };
 
-static int udpx_ep_init(struct udpx_ep *ep, struct fi_info *info)
+static int udpx_ep_init(struct udpx_ep *ep, struct fi_info *info, int sock)
 {
 	int family;
 	int ret;
 
 	ofi_atomic_initialize32(&ep->ref, 0);
+	ret = ofi_stats_init(&udpx_prov, &ep->stats, udpx_ep_stat_defs,
+			     UDPX_STAT_MAX, "ep");
+	if (ret)
+		return ret;
+
 	ep->rxq = udpx_rx_cirq_create(info->rx_attr->size);
 	if (!ep->rxq) {
 		ret = -FI_ENOMEM;
-		return ret;
+		goto err0;
+	}
+	ep->rxq_lock = &ep->util_ep.lock;
+	fastlock_init(&ep->tx_lock);
+
+	if (sock >= 0) {
+		ep->sock = sock;
+		ep->is_bound = 1;
+		return 0;
 	}
 
 	family = info->src_addr ?
@@ -743,12 +1057,15 @@ static int udpx_ep_init(struct udpx_ep *ep, struct fi_info *info)
 err2:
 	ofi_close_socket(ep->sock);
 err1:
+	fastlock_destroy(&ep->tx_lock);
 	udpx_rx_cirq_free(ep->rxq);
+err0:
+	ofi_stats_close(&ep->stats);
 	return ret;
 }
 
-int udpx_endpoint(struct fid_domain *domain, struct fi_info *info,
-		  struct fid_ep **ep_fid, void *context)
+static int udpx_ep_open(struct fid_domain *domain, struct fi_info *info,
+			int sock, struct fid_ep **ep_fid, void *context)
 {
 	struct udpx_ep *ep;
 	int ret;
@@ -762,7 +1079,7 @@ int udpx_endpoint(struct fid_domain *domain, struct fi_info *info,
 	if (ret)
 		goto err;
 
-	ret = udpx_ep_init(ep, info);
+	ret = udpx_ep_init(ep, info, sock);
 	if (ret) {
 		free(ep);
 		return ret;
@@ -780,3 +1097,64 @@ err:
 	free(ep);
 	return ret;
 }
+
+int udpx_endpoint(struct fid_domain *domain, struct fi_info *info,
+		  struct fid_ep **ep_fid, void *context)
+{
+	return udpx_ep_open(domain, info, -1, ep_fid, context);
+}
+
+/*
+ * Rx context i receives on the socket bound to port + i of the scalable
+ * endpoint.  Tx contexts send from the socket of rx context 0, so that
+ * peers see the scalable endpoint's address as the source.
+ */
+static int udpx_sep_tx_ctx(struct util_sep *sep, int index,
+			   struct fi_info *info, struct fid_ep **ctx,
+			   void *context)
+{
+	return udpx_ep_open(&sep->domain->domain_fid, info, sep->socks[0],
+			    ctx, context);
+}
+
+static int udpx_sep_rx_ctx(struct util_sep *sep, int index,
+			   struct fi_info *info, struct fid_ep **ctx,
+			   void *context)
+{
+	return udpx_ep_open(&sep->domain->domain_fid, info, sep->socks[index],
+			    ctx, context);
+}
+
+int udpx_scalable_ep(struct fid_domain *domain, struct fi_info *info,
+		     struct fid_ep **sep_fid, void *context)
+{
+	struct util_sep *sep;
+	size_t i;
+	int ret;
+
+	if (info && info->tx_attr && (info->tx_attr->op_flags & FI_MULTICAST)) {
+		FI_WARN(&udpx_prov, FI_LOG_EP_CTRL,
+			"multicast not supported on scalable endpoints\n");
+		return -FI_ENOSYS;
+	}
+
+	ret = ofi_scalable_ep(domain, &udpx_util_prov, info, sep_fid, context,
+			      udpx_sep_tx_ctx, udpx_sep_rx_ctx);
+	if (ret)
+		return ret;
+
+	sep = container_of(*sep_fid, struct util_sep, ep_fid);
+	ret = ofi_sep_bind_ports(sep, SOCK_DGRAM, sep->rx_ctx_cnt);
+	if (ret)
+		goto err;
+
+	for (i = 0; i < sep->sock_cnt; i++) {
+		ret = fi_fd_nonblock(sep->socks[i]);
+		if (ret)
+			goto err;
+	}
+	return 0;
+err:
+	fi_close(&(*sep_fid)->fid);
+	return ret;
+}
@@ -369,8 +369,13 @@ int ofi_av_remove_addr(struct util_av *av, int slot, int index)
 
 	dlist_foreach(&av->ep_list, av_entry) {
 		ep = container_of(av_entry, struct util_ep, av_entry);
-		if (ep->cmap && ep->cmap->handles_av[index])
-			ofi_cmap_del_handle(ep->cmap->handles_av[index]);
+		if (!ep->cmap)
+			continue;
+		for (i = index << av->rx_ctx_bits;
+		     i < (index + 1) << av->rx_ctx_bits; i++) {
+			if (ep->cmap->handles_av[i])
+				ofi_cmap_del_handle(ep->cmap->handles_av[i]);
+		}
 	}
 
 	fastlock_release(&av->lock);
@@ -472,6 +477,7 @@ static int util_av_init(struct util_av *av, const struct fi_av_attr *attr,
 	av->count = attr->count ? attr->count : UTIL_DEFAULT_AV_SIZE;
 	av->count = roundup_power_of_two(av->count);
 	av->addrlen = util_attr->addrlen;
+	av->rx_ctx_bits = attr->rx_ctx_bits;
 	av->flags = util_attr->flags | attr->flags;
 
 	FI_INFO(av->prov, FI_LOG_AV, "AV size %zu\n", av->count);
@@ -537,6 +543,11 @@ static int util_verify_av_attr(struct util_domain *domain,
 		return -FI_EINVAL;
 	}
 
+	if (attr->rx_ctx_bits < 0 || attr->rx_ctx_bits > OFI_MAX_RX_CTX_BITS) {
+		FI_WARN(domain->prov, FI_LOG_AV, "unsupported rx_ctx_bits\n");
+		return -FI_EINVAL;
+	}
+
 	if (util_attr->addrlen < sizeof(int)) {
 		FI_WARN(domain->prov, FI_LOG_AV, "unsupported address size\n");
 		return -FI_ENOSYS;
@@ -615,6 +626,23 @@ int ip_av_get_index(struct util_av *av, const void *addr)
 	return ofi_av_lookup_index(av, addr, ip_av_slot(av, addr));
 }
 
+const void *ip_av_get_ctx_addr(struct util_av *av, fi_addr_t fi_addr,
+			       struct sockaddr_storage *buf)
+{
+	const struct sockaddr *addr;
+	int rx_index;
+
+	addr = ip_av_get_addr(av, (int) ofi_av_addr_index(av, fi_addr));
+	rx_index = ofi_av_rx_index(av, fi_addr);
+	if (!rx_index)
+		return addr;
+
+	memcpy(buf, addr, av->addrlen);
+	ofi_addr_set_port((struct sockaddr *) buf,
+			  ofi_addr_get_port(addr) + rx_index);
+	return buf;
+}
+
 void ofi_av_write_event(struct util_av *av, uint64_t data,
 			int err, void *context)
 {
@@ -1052,7 +1080,7 @@ static void util_cmap_set_key(struct util_cmap_handle *handle)
 
 static void util_cmap_clear_key(struct util_cmap_handle *handle)
 {
-	int index = ofi_key2idx(&handle->cmap->key_idx, handle->key);
+	size_t index = ofi_key2idx(&handle->cmap->key_idx, handle->key);
 
 	if (!ofi_idx_is_valid(&handle->cmap->handles_idx, index))
 		FI_WARN(handle->cmap->av->prov, FI_LOG_AV, "Invalid key!\n");
@@ -1110,7 +1138,7 @@ static int util_cmap_del_handle(struct util_cmap_handle *handle)
 		free(handle->peer);
 		handle->peer = NULL;
 	} else {
-		cmap->handles_av[handle->fi_addr] = 0;
+		cmap->handles_av[ofi_av_ctx_index(cmap->av, handle->fi_addr)] = 0;
 	}
 	util_cmap_clear_key(handle);
 
@@ -1148,7 +1176,7 @@ static int util_cmap_alloc_handle(struct util_cmap *cmap, fi_addr_t fi_addr,
 	FI_DBG(cmap->av->prov, FI_LOG_EP_CTRL, "Allocated handle: %p for "
 	       "fi_addr: %" PRIu64 "\n", *handle, fi_addr);
 	ofi_cmap_init_handle(*handle, cmap, state, fi_addr, NULL);
-	cmap->handles_av[fi_addr] = *handle;
+	cmap->handles_av[ofi_av_ctx_index(cmap->av, fi_addr)] = *handle;
 	return 0;
 }
 
@@ -1203,7 +1231,8 @@ static void util_cmap_move_handle(struct util_cmap_handle *handle,
 	free(handle->peer);
 	handle->peer = NULL;
 	handle->fi_addr = fi_addr;
-	handle->cmap->handles_av[fi_addr] = handle;
+	handle->cmap->handles_av[ofi_av_ctx_index(handle->cmap->av, fi_addr)] =
+		handle;
 }
 
 void ofi_cmap_update(struct util_cmap *cmap, const void *addr, fi_addr_t fi_addr)
@@ -1223,11 +1252,13 @@ out:
 static struct util_cmap_handle *
 util_cmap_get_handle(struct util_cmap *cmap, fi_addr_t fi_addr)
 {
-	if (fi_addr > cmap->av->count) {
+	size_t index = ofi_av_ctx_index(cmap->av, fi_addr);
+
+	if (index >= cmap->av->count << cmap->av->rx_ctx_bits) {
 		FI_WARN(cmap->av->prov, FI_LOG_EP_CTRL, "Invalid fi_addr\n");
 		return NULL;
 	}
-	return cmap->handles_av[fi_addr];
+	return cmap->handles_av[index];
 }
 
 void ofi_cmap_process_shutdown(struct util_cmap *cmap,
@@ -1367,6 +1398,7 @@ int ofi_cmap_get_handle(struct util_cmap *cmap, fi_addr_t fi_addr,
 			struct util_cmap_handle **handle_ret)
 {
 	struct util_cmap_handle *handle;
+	struct sockaddr_storage addr;
 	int ret = 0;
 
 	fastlock_acquire(&cmap->lock);
@@ -1381,7 +1413,8 @@ int ofi_cmap_get_handle(struct util_cmap *cmap, fi_addr_t fi_addr,
 	switch (handle->state) {
 	case CMAP_IDLE:
 		ret = cmap->attr.connect(cmap->ep, handle,
-					 ofi_av_get_addr(cmap->av, fi_addr),
+					 ip_av_get_ctx_addr(cmap->av, fi_addr,
+							    &addr),
 					 cmap->av->addrlen);
 		if (ret) {
 			util_cmap_del_handle(handle);
@@ -1441,7 +1474,7 @@ void ofi_cmap_free(struct util_cmap *cmap)
 
 	fastlock_acquire(&cmap->lock);
 	FI_DBG(cmap->av->prov, FI_LOG_EP_CTRL, "Closing cmap\n");
-	for (i = 0; i < cmap->av->count; i++) {
+	for (i = 0; i < cmap->av->count << cmap->av->rx_ctx_bits; i++) {
 		if (cmap->handles_av[i])
 			util_cmap_del_handle(cmap->handles_av[i]);
 	}
@@ -1470,7 +1503,8 @@ struct util_cmap *ofi_cmap_alloc(struct util_ep *ep,
 	cmap->ep = ep;
 	cmap->av = ep->av;
 
-	cmap->handles_av = calloc(cmap->av->count, sizeof(*cmap->handles_av));
+	cmap->handles_av = calloc(cmap->av->count << cmap->av->rx_ctx_bits,
+				  sizeof(*cmap->handles_av));
 	if (!cmap->handles_av)
 		goto err1;
 
@@ -0,0 +1,300 @@
+/*
+ * Copyright (c) 2017 Intel Corporation. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/*
+ * Generalized from the gni buddy allocator.  A region of len bytes is
+ * split into blocks of min_size << order, order < nlists.  Free blocks
+ * are linked through their first bytes on the list of their order.
+ *
+ * The region bitmap has 2 * len / min_size bits: the first len / min_size
+ * flag the blocks of min_size, the next len / (2 * min_size) the blocks
+ * of twice that size, and so on.  A bit is set while its block is
+ * allocated or split, so a freed block may be merged with its buddy
+ * whenever the buddy's bit is clear.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <fi.h>
+#include <fi_mem.h>
+
+
+static inline int util_buddy_order(struct util_buddy_pool *pool,
+				   size_t block_size)
+{
+	size_t n = block_size / pool->min_size;
+	int order = 0;
+
+	while (n >>= 1)
+		order++;
+	return order;
+}
+
+static inline size_t util_buddy_bit(struct util_buddy_region *region,
+				    char *block, size_t block_size)
+{
+	struct util_buddy_pool *pool = region->pool;
+
+	return (block - region->base) / block_size +
+		pool->region_size / (pool->min_size / 2) -
+		pool->region_size / (block_size / 2);
+}
+
+static inline void util_buddy_set(struct util_buddy_region *region,
+				  char *block, size_t block_size)
+{
+	size_t bit = util_buddy_bit(region, block, block_size);
+
+	region->bitmap[bit / 64] |= 1ULL << (bit % 64);
+}
+
+static inline void util_buddy_clear(struct util_buddy_region *region,
+				    char *block, size_t block_size)
+{
+	size_t bit = util_buddy_bit(region, block, block_size);
+
+	region->bitmap[bit / 64] &= ~(1ULL << (bit % 64));
+}
+
+static inline int util_buddy_test(struct util_buddy_region *region,
+				  char *block, size_t block_size)
+{
+	size_t bit = util_buddy_bit(region, block, block_size);
+
+	return (region->bitmap[bit / 64] >> (bit % 64)) & 1;
+}
+
+/* Blocks at an even position pair with the block to their right */
+static inline char *util_buddy_of(struct util_buddy_region *region,
+				  char *block, size_t block_size)
+{
+	return ((block - region->base) / block_size) % 2 ?
+		block - block_size : block + block_size;
+}
+
+static int util_buddy_grow(struct util_buddy_pool *pool)
+{
+	struct util_buddy_region *region;
+	size_t offset;
+	int i, ret;
+
+	if (pool->max_regions && pool->num_regions >= pool->max_regions)
+		return -FI_ENOMEM;
+
+	region = calloc(1, sizeof(*region) +
+			sizeof(*region->lists) * pool->nlists);
+	if (!region)
+		return -FI_ENOMEM;
+
+	region->pool = pool;
+	region->bitmap = calloc(2 * pool->region_size / pool->min_size / 64 + 1,
+				sizeof(*region->bitmap));
+	if (!region->bitmap) {
+		ret = -FI_ENOMEM;
+		goto err1;
+	}
+
+	ret = ofi_mem_alloc((void **) &region->base, pool->min_size,
+			    pool->region_size, &region->mem_flags);
+	if (ret)
+		goto err2;
+
+	if (pool->alloc_hndlr) {
+		ret = pool->alloc_hndlr(pool->ctx, region->base,
+					pool->region_size, &region->context);
+		if (ret)
+			goto err3;
+	}
+
+	for (i = 0; i < pool->nlists; i++)
+		dlist_init(&region->lists[i]);
+
+	for (offset = 0; offset < pool->region_size; offset += pool->max_size)
+		dlist_insert_tail((struct dlist_entry *) (region->base + offset),
+				  &region->lists[pool->nlists - 1]);
+
+	dlist_insert_tail(&region->entry, &pool->region_list);
+	pool->num_regions++;
+	if (pool->stats)
+		ofi_stats_add(pool->stats, pool->stat_id, pool->region_size);
+	return 0;
+err3:
+	ofi_mem_free(region->base, pool->region_size, region->mem_flags);
+err2:
+	free(region->bitmap);
+err1:
+	free(region);
+	return ret;
+}
+
+struct util_buddy_pool *
+util_buddy_pool_create(size_t min_size, size_t max_size, size_t region_size,
+		       size_t max_regions,
+		       util_buf_region_alloc_hndlr alloc_hndlr,
+		       util_buf_region_free_hndlr free_hndlr, void *pool_ctx)
+{
+	struct util_buddy_pool *pool;
+
+	if (min_size < sizeof(struct dlist_entry) || max_size < min_size ||
+	    (min_size & (min_size - 1)) || (max_size & (max_size - 1)) ||
+	    !region_size || region_size % max_size)
+		return NULL;
+
+	pool = calloc(1, sizeof(*pool));
+	if (!pool)
+		return NULL;
+
+	pool->min_size = min_size;
+	pool->max_size = max_size;
+	pool->region_size = region_size;
+	pool->max_regions = max_regions;
+	pool->nlists = util_buddy_order(pool, max_size) + 1;
+	pool->alloc_hndlr = alloc_hndlr;
+	pool->free_hndlr = free_hndlr;
+	pool->ctx = pool_ctx;
+	dlist_init(&pool->region_list);
+
+	if (util_buddy_grow(pool)) {
+		free(pool);
+		return NULL;
+	}
+	return pool;
+}
+
+void util_buddy_pool_destroy(struct util_buddy_pool *pool)
+{
+	struct util_buddy_region *region;
+
+	while (!dlist_empty(&pool->region_list)) {
+		dlist_pop_front(&pool->region_list, struct util_buddy_region,
+				region, entry);
+		if (pool->free_hndlr)
+			pool->free_hndlr(pool->ctx, region->context);
+		ofi_mem_free(region->base, pool->region_size,
+			     region->mem_flags);
+		free(region->bitmap);
+		free(region);
+	}
+	free(pool);
+}
+
+/* Take the first free block of at least the given order, splitting it
+ * down and freeing the right halves on the way. */
+static char *util_buddy_take(struct util_buddy_region *region, int order)
+{
+	struct util_buddy_pool *pool = region->pool;
+	char *block;
+	int i;
+
+	for (i = order; i < pool->nlists; i++) {
+		if (!dlist_empty(&region->lists[i]))
+			break;
+	}
+	if (i == pool->nlists)
+		return NULL;
+
+	block = (char *) region->lists[i].next;
+	dlist_remove((struct dlist_entry *) block);
+
+	for (; i > order; i--) {
+		util_buddy_set(region, block, pool->min_size << i);
+		dlist_insert_tail((struct dlist_entry *)
+				  (block + (pool->min_size << (i - 1))),
+				  &region->lists[i - 1]);
+	}
+	return block;
+}
+
+void *util_buddy_alloc(struct util_buddy_pool *pool, size_t size,
+		       struct util_buddy_region **region)
+{
+	struct util_buddy_region *cur;
+	size_t block_size;
+	char *block;
+	int order;
+
+	if (size > pool->max_size)
+		return NULL;
+
+	block_size = util_buddy_block_size(pool, size);
+	order = util_buddy_order(pool, block_size);
+
+	dlist_foreach_container(&pool->region_list, struct util_buddy_region,
+				cur, entry) {
+		block = util_buddy_take(cur, order);
+		if (block)
+			goto found;
+	}
+
+	if (util_buddy_grow(pool))
+		return NULL;
+	cur = container_of(pool->region_list.prev, struct util_buddy_region,
+			   entry);
+	block = util_buddy_take(cur, order);
+	assert(block);
+found:
+	util_buddy_set(cur, block, block_size);
+	*region = cur;
+	return block;
+}
+
+void util_buddy_free(struct util_buddy_region *region, void *buf, size_t size)
+{
+	struct util_buddy_pool *pool = region->pool;
+	char *block = buf, *buddy;
+	size_t block_size;
+
+	assert(block >= region->base &&
+	       block < region->base + pool->region_size);
+
+	block_size = util_buddy_block_size(pool, size);
+	util_buddy_clear(region, block, block_size);
+
+	while (block_size < pool->max_size) {
+		buddy = util_buddy_of(region, block, block_size);
+		if (util_buddy_test(region, buddy, block_size))
+			break;
+
+		dlist_remove((struct dlist_entry *) buddy);
+		if (buddy < block)
+			block = buddy;
+		block_size <<= 1;
+		util_buddy_clear(region, block, block_size);
+	}
+
+	dlist_insert_tail((struct dlist_entry *) block,
+			  &region->lists[util_buddy_order(pool, block_size)]);
+}
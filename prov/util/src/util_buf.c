@@ -64,17 +64,18 @@ int util_buf_grow(struct util_buf_pool *pool)
 	if (!buf_region)
 		return -1;
 
-	ret = ofi_memalign((void **)&buf_region->mem_region, pool->alignment,
-			     pool->chunk_cnt * pool->entry_sz);
+	buf_region->mem_size = pool->chunk_cnt * pool->entry_sz;
+	ret = ofi_mem_alloc((void **)&buf_region->mem_region, pool->alignment,
+			    buf_region->mem_size, &buf_region->mem_flags);
 	if (ret)
-		goto err;
+		goto err1;
 
 	if (pool->alloc_hndlr) {
 		ret = pool->alloc_hndlr(pool->ctx, buf_region->mem_region,
-					pool->chunk_cnt * pool->entry_sz,
+					buf_region->mem_size,
 					&buf_region->context);
 		if (ret)
-			goto err;
+			goto err2;
 	}
 
 	for (i = 0; i < pool->chunk_cnt; i++) {
@@ -86,8 +87,13 @@ int util_buf_grow(struct util_buf_pool *pool)
 
 	slist_insert_tail(&buf_region->entry, &pool->region_list);
 	pool->num_allocated += pool->chunk_cnt;
+	if (pool->stats)
+		ofi_stats_add(pool->stats, pool->stat_id, pool->chunk_cnt);
 	return 0;
-err:
+err2:
+	ofi_mem_free(buf_region->mem_region, buf_region->mem_size,
+		     buf_region->mem_flags);
+err1:
 	free(buf_region);
 	return -1;
 }
@@ -163,7 +169,8 @@ void util_buf_pool_destroy(struct util_buf_pool *pool)
 #endif
 		if (pool->free_hndlr)
 			pool->free_hndlr(pool->ctx, buf_region->context);
-		ofi_freealign(buf_region->mem_region);
+		ofi_mem_free(buf_region->mem_region, buf_region->mem_size,
+			     buf_region->mem_flags);
 		free(buf_region);
 	}
 	free(pool);
@@ -31,6 +31,7 @@
  */
 
 #include <stdlib.h>
+#include <sched.h>
 #include <string.h>
 
 #include <fi_enosys.h>
@@ -87,15 +88,93 @@ static uint64_t ofi_cntr_readerr(struct fid_cntr *cntr_fid)
 	return ofi_atomic_get64(&cntr->err);
 }
 
+void ofi_cntr_wake(struct util_cntr *cntr)
+{
+	int64_t thresh;
+
+	if (!cntr->wait)
+		return;
+
+	/* Only the thread that disarms the threshold signals, unless other
+	 * objects share the wait set and rely on every update. */
+	if (!cntr->shared_wait) {
+		thresh = ofi_atomic_get64(&cntr->wake_thresh);
+		if (thresh == OFI_CNTR_NO_WAITER ||
+		    !ofi_atomic_cas_bool64(&cntr->wake_thresh, thresh,
+					   OFI_CNTR_NO_WAITER))
+			return;
+	}
+	cntr->wait->signal(cntr->wait);
+}
+
+static void ofi_cntr_arm(struct util_cntr *cntr, uint64_t threshold)
+{
+	int64_t thresh, new_thresh;
+
+	new_thresh = (int64_t) MIN(threshold, OFI_CNTR_NO_WAITER - 1);
+	do {
+		thresh = ofi_atomic_get64(&cntr->wake_thresh);
+		if (thresh <= new_thresh)
+			return;
+	} while (!ofi_atomic_cas_bool64(&cntr->wake_thresh, thresh,
+					new_thresh));
+}
+
+struct util_cntr_waiter {
+	struct dlist_entry	entry;
+	uint64_t		threshold;
+	uint64_t		err;
+};
+
+static int ofi_cntr_waiter_ready(struct util_cntr *cntr,
+				  struct util_cntr_waiter *waiter)
+{
+	return waiter->threshold <= (uint64_t) ofi_atomic_get64(&cntr->cnt) ||
+	       waiter->err != (uint64_t) ofi_atomic_get64(&cntr->err);
+}
+
+/*
+ * An update wakes a single thread blocked on the wait object and disarms the
+ * threshold.  Re-arm for the lowest threshold still pending and, if another
+ * waiter can already return, post a new event on its behalf.  Returns true
+ * if another waiter is ready.
+ */
+static int ofi_cntr_pass_wake(struct util_cntr *cntr,
+			       struct util_cntr_waiter *self)
+{
+	struct util_cntr_waiter *waiter;
+	uint64_t threshold = UINT64_MAX;
+	int ready = 0;
+
+	ofi_lock_acquire(&cntr->waiter_lock);
+	dlist_foreach_container(&cntr->waiter_list, struct util_cntr_waiter,
+				waiter, entry) {
+		if (waiter == self)
+			continue;
+		threshold = MIN(threshold, waiter->threshold);
+		ready |= ofi_cntr_waiter_ready(cntr, waiter);
+	}
+	ofi_lock_release(&cntr->waiter_lock);
+
+	if (threshold != UINT64_MAX)
+		ofi_cntr_arm(cntr, threshold);
+	if (ready) {
+		ofi_atomic_inc64(&cntr->wake_gen);
+		ofi_poll_notify(&cntr->poll_notify);
+		cntr->wait->signal(cntr->wait);
+	}
+	return ready;
+}
+
 static int ofi_cntr_add(struct fid_cntr *cntr_fid, uint64_t value)
 {
 	struct util_cntr *cntr = container_of(cntr_fid, struct util_cntr, cntr_fid);
 	assert(cntr->cntr_fid.fid.fclass == FI_CLASS_CNTR);
 
-	ofi_atomic_add64(&cntr->cnt, value);
-
-	if(cntr->wait)
-		cntr->wait->signal(cntr->wait);
+	if (ofi_atomic_add64(&cntr->cnt, value) >=
+	    ofi_atomic_get64(&cntr->wake_thresh))
+		ofi_cntr_wake(cntr);
+	ofi_poll_notify(&cntr->poll_notify);
 
 	return FI_SUCCESS;
 }
@@ -106,9 +185,8 @@ static int ofi_cntr_adderr(struct fid_cntr *cntr_fid, uint64_t value)
 	assert(cntr->cntr_fid.fid.fclass == FI_CLASS_CNTR);
 
 	ofi_atomic_add64(&cntr->err, value);
-
-	if(cntr->wait)
-		cntr->wait->signal(cntr->wait);
+	ofi_cntr_wake(cntr);
+	ofi_poll_notify(&cntr->poll_notify);
 
 	return FI_SUCCESS;
 }
@@ -118,10 +196,9 @@ static int ofi_cntr_set(struct fid_cntr *cntr_fid, uint64_t value)
 	struct util_cntr *cntr = container_of(cntr_fid, struct util_cntr, cntr_fid);
 	assert(cntr->cntr_fid.fid.fclass == FI_CLASS_CNTR);
 
-	ofi_atomic_initialize64(&cntr->cnt, value);
-
-	if(cntr->wait)
-		cntr->wait->signal(cntr->wait);
+	ofi_atomic_set64(&cntr->cnt, value);
+	ofi_cntr_wake(cntr);
+	ofi_poll_notify(&cntr->poll_notify);
 
 	return FI_SUCCESS;
 }
@@ -131,10 +208,9 @@ static int ofi_cntr_seterr(struct fid_cntr *cntr_fid, uint64_t value)
 	struct util_cntr *cntr = container_of(cntr_fid, struct util_cntr, cntr_fid);
 	assert(cntr->cntr_fid.fid.fclass == FI_CLASS_CNTR);
 
-	ofi_atomic_initialize64(&cntr->err, value);
-
-	if(cntr->wait)
-		cntr->wait->signal(cntr->wait);
+	ofi_atomic_set64(&cntr->err, value);
+	ofi_cntr_wake(cntr);
+	ofi_poll_notify(&cntr->poll_notify);
 
 	return FI_SUCCESS;
 }
@@ -142,9 +218,11 @@ static int ofi_cntr_seterr(struct fid_cntr *cntr_fid, uint64_t value)
 static int ofi_cntr_wait(struct fid_cntr *cntr_fid, uint64_t threshold, int timeout)
 {
 	struct util_cntr *cntr = container_of(cntr_fid, struct util_cntr, cntr_fid);
+	struct util_cntr_waiter waiter;
 	uint64_t current_ms;
 	uint64_t finish_ms;
 	uint64_t err = ofi_cntr_readerr(cntr_fid);
+	int ret = -FI_ETIMEDOUT;
 
 	assert(cntr->cntr_fid.fid.fclass == FI_CLASS_CNTR);
 
@@ -153,20 +231,47 @@ static int ofi_cntr_wait(struct fid_cntr *cntr_fid, uint64_t threshold, int time
 
 	assert(cntr->wait);
 
+	waiter.threshold = threshold;
+	waiter.err = err;
+	ofi_lock_acquire(&cntr->waiter_lock);
+	dlist_insert_tail(&waiter.entry, &cntr->waiter_list);
+	ofi_lock_release(&cntr->waiter_lock);
+
 	current_ms = fi_gettime_ms();
 	finish_ms = (timeout < 0) ? UINT64_MAX : current_ms + timeout;
 	for (; timeout < 0 || current_ms < finish_ms;
 	    current_ms = fi_gettime_ms()) {
+		/* Arm before re-checking so that an update racing with the
+		 * check still signals the wait object. */
+		ofi_cntr_arm(cntr, threshold);
+		if (ofi_cntr_waiter_ready(cntr, &waiter))
+			break;
+
 		timeout = timeout < 0 ? timeout : (int)(finish_ms - current_ms);
 		fi_wait(&cntr->wait->wait_fid, timeout);
 		cntr->progress(cntr);
-		if (threshold <= ofi_atomic_get64(&cntr->cnt))
-			return FI_SUCCESS;
-		else if (err != ofi_atomic_get64(&cntr->err))
-			return -FI_EAVAIL;
+		if (ofi_cntr_waiter_ready(cntr, &waiter))
+			break;
+
+		/* The wake-up was meant for another waiter.  Let it run
+		 * before blocking again, or our wait would consume the
+		 * signal that it needs. */
+		while (!ofi_cntr_waiter_ready(cntr, &waiter) &&
+		       ofi_cntr_pass_wake(cntr, &waiter))
+			sched_yield();
 	}
 
-	return -FI_ETIMEDOUT;
+	if (threshold <= (uint64_t) ofi_atomic_get64(&cntr->cnt))
+		ret = FI_SUCCESS;
+	else if (err != (uint64_t) ofi_atomic_get64(&cntr->err))
+		ret = -FI_EAVAIL;
+
+	ofi_lock_acquire(&cntr->waiter_lock);
+	dlist_remove(&waiter.entry);
+	ofi_lock_release(&cntr->waiter_lock);
+	ofi_cntr_pass_wake(cntr, NULL);
+
+	return ret;
 }
 
 static struct fi_ops_cntr util_cntr_ops = {
@@ -185,12 +290,14 @@ int ofi_cntr_cleanup(struct util_cntr *cntr)
 	if (ofi_atomic_get32(&cntr->ref))
 		return -FI_EBUSY;
 
-	fastlock_destroy(&cntr->ep_list_lock);
+	ofi_lock_destroy(&cntr->ep_list_lock);
+	ofi_lock_destroy(&cntr->waiter_lock);
 
 	if (cntr->wait) {
 		fi_poll_del(&cntr->wait->pollset->poll_fid,
 			    &cntr->cntr_fid.fid, 0);
 	}
+	ofi_poll_notify_cleanup(&cntr->poll_notify);
 
 	ofi_atomic_dec32(&cntr->domain->ref);
 	return 0;
@@ -243,8 +350,14 @@ static int fi_cntr_init(struct fid_domain *domain, struct fi_cntr_attr *attr,
 
 	cntr->domain = container_of(domain, struct util_domain, domain_fid);
 	ofi_atomic_initialize32(&cntr->ref, 0);
+	ofi_atomic_initialize64(&cntr->cnt, 0);
+	ofi_atomic_initialize64(&cntr->err, 0);
+	ofi_atomic_initialize64(&cntr->wake_thresh, OFI_CNTR_NO_WAITER);
+	ofi_atomic_initialize64(&cntr->wake_gen, 0);
 	dlist_init(&cntr->ep_list);
-	fastlock_init(&cntr->ep_list_lock);
+	ofi_lock_init(&cntr->ep_list_lock, ofi_comp_lock_type(cntr->domain));
+	dlist_init(&cntr->waiter_list);
+	ofi_lock_init(&cntr->waiter_lock, ofi_comp_lock_type(cntr->domain));
 
 	cntr->cntr_fid.fid.fclass = FI_CLASS_CNTR;
 	cntr->cntr_fid.fid.context = context;
@@ -265,6 +378,8 @@ static int fi_cntr_init(struct fid_domain *domain, struct fi_cntr_attr *attr,
 		break;
 	case FI_WAIT_SET:
 		wait = attr->wait_set;
+		cntr->shared_wait = 1;
+		ofi_atomic_set64(&cntr->wake_thresh, 0);
 		break;
 	default:
 		assert(0);
@@ -284,13 +399,13 @@ void ofi_cntr_progress(struct util_cntr *cntr)
 	struct fid_list_entry *fid_entry;
 	struct dlist_entry *item;
 
-	fastlock_acquire(&cntr->ep_list_lock);
+	ofi_lock_acquire(&cntr->ep_list_lock);
 	dlist_foreach(&cntr->ep_list, item) {
 		fid_entry = container_of(item, struct fid_list_entry, entry);
 		ep = container_of(fid_entry->fid, struct util_ep, ep_fid.fid);
 		ep->progress(ep);
 	}
-	fastlock_release(&cntr->ep_list_lock);
+	ofi_lock_release(&cntr->ep_list_lock);
 }
 
 static struct fi_ops util_cntr_fi_ops = {
@@ -320,6 +435,8 @@ int ofi_cntr_init(const struct fi_provider *prov, struct fid_domain *domain,
 	if (ret)
 		return ret;
 
+	ofi_poll_notify_init(&cntr->poll_notify, &cntr->cntr_fid.fid);
+
 	/* CNTR must be fully operational before adding to wait set */
 	if (cntr->wait) {
 		ret = fi_poll_add(&cntr->wait->pollset->poll_fid,
@@ -48,12 +48,13 @@ int ofi_cq_write_error(struct util_cq *cq,
 		return -FI_ENOMEM;
 
 	entry->err_entry = *err_entry;
-	fastlock_acquire(&cq->cq_lock);
+	ofi_lock_acquire(&cq->cq_lock);
 	slist_insert_tail(&entry->list_entry, &cq->err_list);
 	comp = ofi_cirque_tail(cq->cirq);
 	comp->flags = UTIL_FLAG_ERROR;
 	ofi_cirque_commit(cq->cirq);
-	fastlock_release(&cq->cq_lock);
+	ofi_lock_release(&cq->cq_lock);
+	ofi_poll_notify(&cq->poll_notify);
 	if (cq->wait)
 		cq->wait->signal(cq->wait);
 	return 0;
@@ -77,7 +78,7 @@ int ofi_cq_write(struct util_cq *cq, void *context, uint64_t flags, size_t len,
 	struct fi_cq_tagged_entry *comp;
 	int ret = 0;
 
-	fastlock_acquire(&cq->cq_lock);
+	ofi_lock_acquire(&cq->cq_lock);
 	if (ofi_cirque_isfull(cq->cirq)) {
 		FI_DBG(cq->domain->prov, FI_LOG_CQ, "util_cq cirq is full!\n");
 		ret = -FI_EAGAIN;
@@ -92,8 +93,11 @@ int ofi_cq_write(struct util_cq *cq, void *context, uint64_t flags, size_t len,
 	comp->data = data;
 	comp->tag = tag;
 	ofi_cirque_commit(cq->cirq);
+	ofi_lock_release(&cq->cq_lock);
+	ofi_poll_notify(&cq->poll_notify);
+	return 0;
 out:
-	fastlock_release(&cq->cq_lock);
+	ofi_lock_release(&cq->cq_lock);
 	return ret;
 }
 
@@ -180,11 +184,11 @@ ssize_t ofi_cq_read(struct fid_cq *cq_fid, void *buf, size_t count)
 	size_t i;
 
 	cq = container_of(cq_fid, struct util_cq, cq_fid);
-	fastlock_acquire(&cq->cq_lock);
+	ofi_lock_acquire(&cq->cq_lock);
 	if (ofi_cirque_isempty(cq->cirq)) {
-		fastlock_release(&cq->cq_lock);
+		ofi_lock_release(&cq->cq_lock);
 		cq->progress(cq);
-		fastlock_acquire(&cq->cq_lock);
+		ofi_lock_acquire(&cq->cq_lock);
 		if (ofi_cirque_isempty(cq->cirq)) {
 			i = -FI_EAGAIN;
 			goto out;
@@ -205,7 +209,7 @@ ssize_t ofi_cq_read(struct fid_cq *cq_fid, void *buf, size_t count)
 		ofi_cirque_discard(cq->cirq);
 	}
 out:
-	fastlock_release(&cq->cq_lock);
+	ofi_lock_release(&cq->cq_lock);
 	return i;
 }
 
@@ -226,11 +230,11 @@ ssize_t ofi_cq_readfrom(struct fid_cq *cq_fid, void *buf, size_t count,
 		return i;
 	}
 
-	fastlock_acquire(&cq->cq_lock);
+	ofi_lock_acquire(&cq->cq_lock);
 	if (ofi_cirque_isempty(cq->cirq)) {
-		fastlock_release(&cq->cq_lock);
+		ofi_lock_release(&cq->cq_lock);
 		cq->progress(cq);
-		fastlock_acquire(&cq->cq_lock);
+		ofi_lock_acquire(&cq->cq_lock);
 		if (ofi_cirque_isempty(cq->cirq)) {
 			i = -FI_EAGAIN;
 			goto out;
@@ -252,7 +256,7 @@ ssize_t ofi_cq_readfrom(struct fid_cq *cq_fid, void *buf, size_t count,
 		ofi_cirque_discard(cq->cirq);
 	}
 out:
-	fastlock_release(&cq->cq_lock);
+	ofi_lock_release(&cq->cq_lock);
 	return i;
 }
 
@@ -270,7 +274,7 @@ ssize_t ofi_cq_readerr(struct fid_cq *cq_fid, struct fi_cq_err_entry *buf,
 	cq = container_of(cq_fid, struct util_cq, cq_fid);
 	api_version = cq->domain->fabric->fabric_fid.api_version;
 
-	fastlock_acquire(&cq->cq_lock);
+	ofi_lock_acquire(&cq->cq_lock);
 	if (ofi_cirque_isempty(cq->cirq) ||
 	    !(ofi_cirque_head(cq->cirq)->flags & UTIL_FLAG_ERROR)) {
 		ret = -FI_EAGAIN;
@@ -293,7 +297,7 @@ ssize_t ofi_cq_readerr(struct fid_cq *cq_fid, struct fi_cq_err_entry *buf,
 	ret = 1;
 	free(err);
 unlock:
-	fastlock_release(&cq->cq_lock);
+	ofi_lock_release(&cq->cq_lock);
 	return ret;
 }
 
@@ -354,8 +358,8 @@ int ofi_cq_cleanup(struct util_cq *cq)
 	if (ofi_atomic_get32(&cq->ref))
 		return -FI_EBUSY;
 
-	fastlock_destroy(&cq->cq_lock);
-	fastlock_destroy(&cq->ep_list_lock);
+	ofi_lock_destroy(&cq->cq_lock);
+	ofi_lock_destroy(&cq->ep_list_lock);
 
 	while (!slist_empty(&cq->err_list)) {
 		entry = slist_remove_head(&cq->err_list);
@@ -369,6 +373,7 @@ int ofi_cq_cleanup(struct util_cq *cq)
 		if (cq->internal_wait)
 			fi_close(&cq->wait->wait_fid.fid);
 	}
+	ofi_poll_notify_cleanup(&cq->poll_notify);
 
 	ofi_atomic_dec32(&cq->domain->ref);
 	util_comp_cirq_free(cq->cirq);
@@ -407,8 +412,8 @@ static int fi_cq_init(struct fid_domain *domain, struct fi_cq_attr *attr,
 	cq->domain = container_of(domain, struct util_domain, domain_fid);
 	ofi_atomic_initialize32(&cq->ref, 0);
 	dlist_init(&cq->ep_list);
-	fastlock_init(&cq->ep_list_lock);
-	fastlock_init(&cq->cq_lock);
+	ofi_lock_init(&cq->ep_list_lock, ofi_comp_lock_type(cq->domain));
+	ofi_lock_init(&cq->cq_lock, ofi_comp_lock_type(cq->domain));
 	slist_init(&cq->err_list);
 	cq->read_entry = read_entry;
 
@@ -472,14 +477,14 @@ void ofi_cq_progress(struct util_cq *cq)
 	struct fid_list_entry *fid_entry;
 	struct dlist_entry *item;
 
-	fastlock_acquire(&cq->ep_list_lock);
+	ofi_lock_acquire(&cq->ep_list_lock);
 	dlist_foreach(&cq->ep_list, item) {
 		fid_entry = container_of(item, struct fid_list_entry, entry);
 		ep = container_of(fid_entry->fid, struct util_ep, ep_fid.fid);
 		ep->progress(ep);
 
 	}
-	fastlock_release(&cq->ep_list_lock);
+	ofi_lock_release(&cq->ep_list_lock);
 }
 
 int ofi_cq_init(const struct fi_provider *prov, struct fid_domain *domain,
@@ -521,34 +526,32 @@ int ofi_cq_init(const struct fi_provider *prov, struct fid_domain *domain,
 	if (ret)
 		return ret;
 
-	/* CQ must be fully operational before adding to wait set */
-	if (cq->wait) {
-		ret = fi_poll_add(&cq->wait->pollset->poll_fid,
-				  &cq->cq_fid.fid, 0);
-		if (ret) {
-			ofi_cq_cleanup(cq);
-			return ret;
-		}
-	}
+	ofi_poll_notify_init(&cq->poll_notify, &cq->cq_fid.fid);
 
 	cq->cirq = util_comp_cirq_create(attr->size == 0 ? UTIL_DEF_CQ_SIZE : attr->size);
 	if (!cq->cirq) {
 		ret = -FI_ENOMEM;
-		goto err1;
+		goto err;
 	}
 
 	if (cq->domain->info_domain_caps & FI_SOURCE) {
 		cq->src = calloc(cq->cirq->size, sizeof *cq->src);
 		if (!cq->src) {
 			ret = -FI_ENOMEM;
-			goto err2;
+			goto err;
 		}
 	}
+
+	/* CQ must be fully operational before adding to wait set */
+	if (cq->wait) {
+		ret = fi_poll_add(&cq->wait->pollset->poll_fid,
+				  &cq->cq_fid.fid, 0);
+		if (ret)
+			goto err;
+	}
 	return 0;
 
-err2:
-	util_comp_cirq_free(cq->cirq);
-err1:
+err:
 	ofi_cq_cleanup(cq);
 	return ret;
 }
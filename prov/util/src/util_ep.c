@@ -32,10 +32,16 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
+#include <netdb.h>
 
 #include <fi_enosys.h>
 #include <fi_util.h>
 
+#define OFI_SEP_BIND_RETRIES	16
+
+static void util_sep_ctx_release(struct util_ep *ep);
+
 int ofi_ep_bind_cq(struct util_ep *ep, struct util_cq *cq, uint64_t flags)
 {
 	int ret;
@@ -59,9 +65,9 @@ int ofi_ep_bind_cq(struct util_ep *ep, struct util_cq *cq, uint64_t flags)
 	}
 
 	if (flags & (FI_TRANSMIT | FI_RECV)) {
-		return fid_list_insert(&cq->ep_list,
-				       &cq->ep_list_lock,
-				       &ep->ep_fid.fid);
+		return ofi_fid_list_insert(&cq->ep_list,
+					   &cq->ep_list_lock,
+					   &ep->ep_fid.fid);
 	}
 
 	return FI_SUCCESS;
@@ -132,9 +138,9 @@ int ofi_ep_bind_cntr(struct util_ep *ep, struct util_cntr *cntr, uint64_t flags)
 		ofi_atomic_inc32(&cntr->ref);
 	}
 
-	return fid_list_insert(&cntr->ep_list,
-			       &cntr->ep_list_lock,
-			       &ep->ep_fid.fid);
+	return ofi_fid_list_insert(&cntr->ep_list,
+				   &cntr->ep_list_lock,
+				   &ep->ep_fid.fid);
 }
 
 int ofi_ep_bind(struct util_ep *util_ep, struct fid *fid, uint64_t flags)
@@ -195,67 +201,70 @@ int ofi_endpoint_init(struct fid_domain *domain, const struct util_prov *util_pr
 	ofi_atomic_inc32(&util_domain->ref);
 	if (util_domain->eq)
 		ofi_ep_bind_eq(ep, util_domain->eq);
-	fastlock_init(&ep->lock);
+	ofi_lock_init(&ep->lock, ofi_domain_lock_type(util_domain));
 	return 0;
 }
 
 int ofi_endpoint_close(struct util_ep *util_ep)
 {
-	fastlock_destroy(&util_ep->lock);
+	if (util_ep->sep)
+		util_sep_ctx_release(util_ep);
+
+	ofi_lock_destroy(&util_ep->lock);
 
 	if (util_ep->tx_cq) {
-		fid_list_remove(&util_ep->tx_cq->ep_list,
-				&util_ep->tx_cq->ep_list_lock,
-				&util_ep->ep_fid.fid);
+		ofi_fid_list_remove(&util_ep->tx_cq->ep_list,
+				    &util_ep->tx_cq->ep_list_lock,
+				    &util_ep->ep_fid.fid);
 		ofi_atomic_dec32(&util_ep->tx_cq->ref);
 	}
 
 	if (util_ep->rx_cq) {
-		fid_list_remove(&util_ep->rx_cq->ep_list,
-				&util_ep->rx_cq->ep_list_lock,
-				&util_ep->ep_fid.fid);
+		ofi_fid_list_remove(&util_ep->rx_cq->ep_list,
+				    &util_ep->rx_cq->ep_list_lock,
+				    &util_ep->ep_fid.fid);
 		ofi_atomic_dec32(&util_ep->rx_cq->ref);
 	}
 
 	if (util_ep->rx_cntr) {
-		fid_list_remove(&util_ep->rx_cntr->ep_list,
-				&util_ep->rx_cntr->ep_list_lock,
-				&util_ep->ep_fid.fid);
+		ofi_fid_list_remove(&util_ep->rx_cntr->ep_list,
+				    &util_ep->rx_cntr->ep_list_lock,
+				    &util_ep->ep_fid.fid);
 		ofi_atomic_dec32(&util_ep->rx_cntr->ref);
 	}
 
 	if (util_ep->tx_cntr) {
-		fid_list_remove(&util_ep->tx_cntr->ep_list,
-				&util_ep->tx_cntr->ep_list_lock,
-				&util_ep->ep_fid.fid);
+		ofi_fid_list_remove(&util_ep->tx_cntr->ep_list,
+				    &util_ep->tx_cntr->ep_list_lock,
+				    &util_ep->ep_fid.fid);
 		ofi_atomic_dec32(&util_ep->tx_cntr->ref);
 	}
 
 	if (util_ep->rd_cntr) {
-		fid_list_remove(&util_ep->rd_cntr->ep_list,
-				&util_ep->rd_cntr->ep_list_lock,
-				&util_ep->ep_fid.fid);
+		ofi_fid_list_remove(&util_ep->rd_cntr->ep_list,
+				    &util_ep->rd_cntr->ep_list_lock,
+				    &util_ep->ep_fid.fid);
 		ofi_atomic_dec32(&util_ep->rd_cntr->ref);
 	}
 
 	if (util_ep->wr_cntr) {
-		fid_list_remove(&util_ep->wr_cntr->ep_list,
-				&util_ep->wr_cntr->ep_list_lock,
-				&util_ep->ep_fid.fid);
+		ofi_fid_list_remove(&util_ep->wr_cntr->ep_list,
+				    &util_ep->wr_cntr->ep_list_lock,
+				    &util_ep->ep_fid.fid);
 		ofi_atomic_dec32(&util_ep->wr_cntr->ref);
 	}
 
 	if (util_ep->rem_rd_cntr) {
-		fid_list_remove(&util_ep->rem_rd_cntr->ep_list,
-				&util_ep->rem_rd_cntr->ep_list_lock,
-				&util_ep->ep_fid.fid);
+		ofi_fid_list_remove(&util_ep->rem_rd_cntr->ep_list,
+				    &util_ep->rem_rd_cntr->ep_list_lock,
+				    &util_ep->ep_fid.fid);
 		ofi_atomic_dec32(&util_ep->rem_rd_cntr->ref);
 	}
 
 	if (util_ep->rem_wr_cntr) {
-		fid_list_remove(&util_ep->rem_wr_cntr->ep_list,
-				&util_ep->rem_wr_cntr->ep_list_lock,
-				&util_ep->ep_fid.fid);
+		ofi_fid_list_remove(&util_ep->rem_wr_cntr->ep_list,
+				    &util_ep->rem_wr_cntr->ep_list_lock,
+				    &util_ep->ep_fid.fid);
 		ofi_atomic_dec32(&util_ep->rem_wr_cntr->ref);
 	}
 
@@ -272,3 +281,481 @@ int ofi_endpoint_close(struct util_ep *util_ep)
 	ofi_atomic_dec32(&util_ep->domain->ref);
 	return 0;
 }
+
+/*
+ * Scalable endpoint
+ */
+
+static int util_sep_host_addr(struct util_sep *sep)
+{
+	struct addrinfo ai, *rai = NULL;
+	char hostname[HOST_NAME_MAX];
+	int ret;
+
+	memset(&ai, 0, sizeof(ai));
+	ai.ai_family = AF_INET;
+
+	ofi_getnodename(hostname, sizeof(hostname));
+	ret = getaddrinfo(hostname, NULL, &ai, &rai);
+	if (ret) {
+		FI_WARN(sep->domain->prov, FI_LOG_EP_CTRL,
+			"getaddrinfo failed\n");
+		return -FI_ENODATA;
+	}
+
+	memcpy(&sep->addr, rai->ai_addr, rai->ai_addrlen);
+	sep->addrlen = rai->ai_addrlen;
+	ofi_addr_set_port((struct sockaddr *) &sep->addr, 0);
+	freeaddrinfo(rai);
+	return 0;
+}
+
+static void util_sep_close_socks(struct util_sep *sep)
+{
+	size_t i;
+
+	for (i = 0; i < sep->sock_cnt; i++) {
+		if (sep->socks[i] != INVALID_SOCKET) {
+			ofi_close_socket(sep->socks[i]);
+			sep->socks[i] = INVALID_SOCKET;
+		}
+	}
+}
+
+static int util_sep_try_bind(struct util_sep *sep, int type, uint16_t port)
+{
+	struct sockaddr_storage addr;
+	socklen_t len;
+	size_t i;
+
+	memcpy(&addr, &sep->addr, sep->addrlen);
+	for (i = 0; i < sep->sock_cnt; i++) {
+		if ((size_t) port + i > UINT16_MAX)
+			return -FI_EADDRINUSE;
+
+		sep->socks[i] = socket(addr.ss_family, type, 0);
+		if (sep->socks[i] == INVALID_SOCKET)
+			return -ofi_sockerr();
+
+		ofi_addr_set_port((struct sockaddr *) &addr, port + i);
+		if (bind(sep->socks[i], (struct sockaddr *) &addr,
+			 (socklen_t) sep->addrlen))
+			return -ofi_sockerr();
+
+		if (!port) {
+			len = sizeof addr;
+			if (getsockname(sep->socks[0], (struct sockaddr *) &addr,
+					&len))
+				return -ofi_sockerr();
+			port = ofi_addr_get_port((struct sockaddr *) &addr);
+		}
+	}
+
+	ofi_addr_set_port((struct sockaddr *) &sep->addr, port);
+	return 0;
+}
+
+/*
+ * Reserve cnt consecutive ports of the given socket type, starting at the
+ * port of the scalable endpoint's address.  If that port is 0, ranges
+ * starting at an ephemeral port are tried until a free one is found.
+ */
+int ofi_sep_bind_ports(struct util_sep *sep, int type, size_t cnt)
+{
+	uint16_t port;
+	int i, ret;
+
+	sep->socks = calloc(cnt, sizeof(*sep->socks));
+	if (!sep->socks)
+		return -FI_ENOMEM;
+
+	sep->sock_cnt = cnt;
+	for (i = 0; i < (int) cnt; i++)
+		sep->socks[i] = INVALID_SOCKET;
+
+	port = ofi_addr_get_port((struct sockaddr *) &sep->addr);
+	for (i = 0; i < OFI_SEP_BIND_RETRIES; i++) {
+		ret = util_sep_try_bind(sep, type, port);
+		if (!ret)
+			return 0;
+
+		util_sep_close_socks(sep);
+		if (port || ret != -FI_EADDRINUSE)
+			break;
+	}
+
+	FI_WARN(sep->domain->prov, FI_LOG_EP_CTRL,
+		"unable to bind %zu consecutive ports: %s\n", cnt,
+		fi_strerror(-ret));
+	return ret;
+}
+
+/*
+ * Set the source address of a context to the given port offset of the
+ * scalable endpoint's address.  The port stays reserved until the
+ * provider releases it with ofi_sep_release_port.
+ */
+int ofi_sep_ctx_info(struct util_sep *sep, size_t port, struct fi_info *info)
+{
+	struct sockaddr *addr;
+
+	addr = mem_dup(&sep->addr, sep->addrlen);
+	if (!addr)
+		return -FI_ENOMEM;
+
+	ofi_addr_set_port(addr, ofi_addr_get_port(addr) + port);
+	free(info->src_addr);
+	info->src_addr = addr;
+	info->src_addrlen = sep->addrlen;
+	return 0;
+}
+
+/*
+ * Drop the reservation of a context's port.  Providers call this right
+ * before opening the endpoint that binds to the port.  Called with
+ * sep->lock held from the context open path.
+ */
+void ofi_sep_release_port(struct util_sep *sep, size_t port)
+{
+	if (port < sep->sock_cnt && sep->socks[port] != INVALID_SOCKET) {
+		ofi_close_socket(sep->socks[port]);
+		sep->socks[port] = INVALID_SOCKET;
+	}
+}
+
+static void util_sep_ctx_release(struct util_ep *ep)
+{
+	struct util_sep *sep = ep->sep;
+	size_t i;
+
+	fastlock_acquire(&sep->lock);
+	for (i = 0; i < sep->tx_ctx_cnt; i++) {
+		if (sep->tx_ctx[i] == ep)
+			sep->tx_ctx[i] = NULL;
+	}
+	for (i = 0; i < sep->rx_ctx_cnt; i++) {
+		if (sep->rx_ctx[i] == ep)
+			sep->rx_ctx[i] = NULL;
+	}
+	ofi_atomic_dec32(&sep->ref);
+	fastlock_release(&sep->lock);
+	ep->sep = NULL;
+}
+
+static int util_sep_ctx_open(struct util_sep *sep, size_t fclass, int index,
+			     struct fi_info *info, struct fid_ep **ctx,
+			     void *context)
+{
+	struct util_ep **slot;
+	struct util_ep *ep;
+	ofi_sep_ctx_func ctx_open;
+	int ret;
+
+	if (fclass == FI_CLASS_TX_CTX) {
+		if (index < 0 || (size_t) index >= sep->tx_ctx_cnt)
+			return -FI_EINVAL;
+		slot = &sep->tx_ctx[index];
+		ctx_open = sep->tx_ctx_open;
+	} else {
+		if (index < 0 || (size_t) index >= sep->rx_ctx_cnt)
+			return -FI_EINVAL;
+		slot = &sep->rx_ctx[index];
+		ctx_open = sep->rx_ctx_open;
+	}
+
+	if (!sep->av) {
+		FI_WARN(sep->domain->prov, FI_LOG_EP_CTRL,
+			"AV must be bound before opening contexts\n");
+		return -FI_ENOAV;
+	}
+
+	info->ep_attr->tx_ctx_cnt = 1;
+	info->ep_attr->rx_ctx_cnt = 1;
+
+	fastlock_acquire(&sep->lock);
+	if (*slot) {
+		fastlock_release(&sep->lock);
+		return -FI_EBUSY;
+	}
+
+	ret = ctx_open(sep, index, info, ctx, context);
+	if (ret) {
+		fastlock_release(&sep->lock);
+		return ret;
+	}
+
+	ep = container_of(*ctx, struct util_ep, ep_fid);
+	ep->ep_fid.fid.fclass = fclass;
+	ep->sep = sep;
+	*slot = ep;
+	ofi_atomic_inc32(&sep->ref);
+	fastlock_release(&sep->lock);
+
+	ret = fi_ep_bind(*ctx, &sep->av->av_fid.fid, 0);
+	if (!ret && sep->eq && ep->eq != sep->eq)
+		ret = fi_ep_bind(*ctx, &sep->eq->eq_fid.fid, 0);
+	if (ret)
+		fi_close(&(*ctx)->fid);
+	return ret;
+}
+
+static int util_sep_tx_ctx(struct fid_ep *ep, int index,
+			   struct fi_tx_attr *attr, struct fid_ep **tx_ep,
+			   void *context)
+{
+	struct util_sep *sep;
+	struct fi_info *info;
+	int ret;
+
+	sep = container_of(ep, struct util_sep, ep_fid);
+	info = fi_dupinfo(sep->info);
+	if (!info)
+		return -FI_ENOMEM;
+
+	if (attr)
+		*info->tx_attr = *attr;
+	ret = util_sep_ctx_open(sep, FI_CLASS_TX_CTX, index, info,
+				tx_ep, context);
+	fi_freeinfo(info);
+	return ret;
+}
+
+static int util_sep_rx_ctx(struct fid_ep *ep, int index,
+			   struct fi_rx_attr *attr, struct fid_ep **rx_ep,
+			   void *context)
+{
+	struct util_sep *sep;
+	struct fi_info *info;
+	int ret;
+
+	sep = container_of(ep, struct util_sep, ep_fid);
+	info = fi_dupinfo(sep->info);
+	if (!info)
+		return -FI_ENOMEM;
+
+	if (attr)
+		*info->rx_attr = *attr;
+	ret = util_sep_ctx_open(sep, FI_CLASS_RX_CTX, index, info,
+				rx_ep, context);
+	fi_freeinfo(info);
+	return ret;
+}
+
+static int util_sep_bind(struct fid *fid, struct fid *bfid, uint64_t flags)
+{
+	struct util_sep *sep;
+	struct util_av *av;
+	struct util_eq *eq;
+
+	sep = container_of(fid, struct util_sep, ep_fid.fid);
+	switch (bfid->fclass) {
+	case FI_CLASS_AV:
+		av = container_of(bfid, struct util_av, av_fid.fid);
+		if (sep->av) {
+			FI_WARN(sep->domain->prov, FI_LOG_EP_CTRL,
+				"duplicate AV binding\n");
+			return -FI_EINVAL;
+		}
+		sep->av = av;
+		ofi_atomic_inc32(&av->ref);
+		return 0;
+	case FI_CLASS_EQ:
+		eq = container_of(bfid, struct util_eq, eq_fid.fid);
+		if (sep->eq)
+			ofi_atomic_dec32(&sep->eq->ref);
+		sep->eq = eq;
+		ofi_atomic_inc32(&eq->ref);
+		return 0;
+	default:
+		FI_WARN(sep->domain->prov, FI_LOG_EP_CTRL,
+			"CQs and counters are bound to the contexts\n");
+		return -FI_EINVAL;
+	}
+}
+
+static int util_sep_control(struct fid *fid, int command, void *arg)
+{
+	struct util_sep *sep;
+
+	sep = container_of(fid, struct util_sep, ep_fid.fid);
+	switch (command) {
+	case FI_ENABLE:
+		return sep->av ? 0 : -FI_ENOAV;
+	default:
+		return -FI_ENOSYS;
+	}
+}
+
+static int util_sep_getname(fid_t fid, void *addr, size_t *addrlen)
+{
+	struct util_sep *sep;
+	size_t len;
+
+	sep = container_of(fid, struct util_sep, ep_fid.fid);
+	len = MIN(*addrlen, sep->addrlen);
+	memcpy(addr, &sep->addr, len);
+	*addrlen = sep->addrlen;
+	return (len == sep->addrlen) ? 0 : -FI_ETOOSMALL;
+}
+
+static int util_sep_init(struct fid_domain *domain,
+			 const struct util_prov *util_prov,
+			 struct fi_info *info, struct util_sep *sep,
+			 void *context, ofi_sep_ctx_func tx_ctx_open,
+			 ofi_sep_ctx_func rx_ctx_open)
+{
+	struct util_domain *util_domain;
+	int ret;
+
+	util_domain = container_of(domain, struct util_domain, domain_fid);
+
+	if (!info || !info->ep_attr || !info->rx_attr || !info->tx_attr)
+		return -FI_EINVAL;
+
+	ret = ofi_prov_check_info(util_prov,
+				  util_domain->fabric->fabric_fid.api_version,
+				  info);
+	if (ret)
+		return ret;
+
+	if (info->ep_attr->tx_ctx_cnt == FI_SHARED_CONTEXT ||
+	    info->ep_attr->rx_ctx_cnt == FI_SHARED_CONTEXT)
+		return -FI_EINVAL;
+
+	sep->domain = util_domain;
+	if (info->src_addr) {
+		if (info->src_addrlen > sizeof(sep->addr) ||
+		    (ofi_sa_family(info->src_addr) != AF_INET &&
+		     ofi_sa_family(info->src_addr) != AF_INET6))
+			return -FI_ENOSYS;
+		memcpy(&sep->addr, info->src_addr, info->src_addrlen);
+		sep->addrlen = info->src_addrlen;
+	} else {
+		ret = util_sep_host_addr(sep);
+		if (ret)
+			return ret;
+	}
+
+	sep->tx_ctx_cnt = info->ep_attr->tx_ctx_cnt ?
+			  info->ep_attr->tx_ctx_cnt : 1;
+	sep->rx_ctx_cnt = info->ep_attr->rx_ctx_cnt ?
+			  info->ep_attr->rx_ctx_cnt : 1;
+	sep->tx_ctx = calloc(sep->tx_ctx_cnt, sizeof(*sep->tx_ctx));
+	sep->rx_ctx = calloc(sep->rx_ctx_cnt, sizeof(*sep->rx_ctx));
+	sep->info = fi_dupinfo(info);
+	if (!sep->tx_ctx || !sep->rx_ctx || !sep->info) {
+		ret = -FI_ENOMEM;
+		goto err;
+	}
+
+	sep->ep_fid.fid.fclass = FI_CLASS_SEP;
+	sep->ep_fid.fid.context = context;
+	sep->tx_ctx_open = tx_ctx_open;
+	sep->rx_ctx_open = rx_ctx_open;
+	ofi_atomic_initialize32(&sep->ref, 0);
+	fastlock_init(&sep->lock);
+	ofi_atomic_inc32(&util_domain->ref);
+	if (util_domain->eq) {
+		sep->eq = util_domain->eq;
+		ofi_atomic_inc32(&sep->eq->ref);
+	}
+	return 0;
+err:
+	fi_freeinfo(sep->info);
+	free(sep->tx_ctx);
+	free(sep->rx_ctx);
+	return ret;
+}
+
+static int util_sep_close(struct util_sep *sep)
+{
+	if (ofi_atomic_get32(&sep->ref)) {
+		FI_WARN(sep->domain->prov, FI_LOG_EP_CTRL,
+			"contexts are still open\n");
+		return -FI_EBUSY;
+	}
+
+	util_sep_close_socks(sep);
+	free(sep->socks);
+	if (sep->av)
+		ofi_atomic_dec32(&sep->av->ref);
+	if (sep->eq)
+		ofi_atomic_dec32(&sep->eq->ref);
+	fi_freeinfo(sep->info);
+	free(sep->tx_ctx);
+	free(sep->rx_ctx);
+	fastlock_destroy(&sep->lock);
+	ofi_atomic_dec32(&sep->domain->ref);
+	return 0;
+}
+
+static int util_sep_fi_close(struct fid *fid)
+{
+	struct util_sep *sep;
+	int ret;
+
+	sep = container_of(fid, struct util_sep, ep_fid.fid);
+	ret = util_sep_close(sep);
+	if (ret)
+		return ret;
+
+	free(sep);
+	return 0;
+}
+
+static struct fi_ops util_sep_fi_ops = {
+	.size = sizeof(struct fi_ops),
+	.close = util_sep_fi_close,
+	.bind = util_sep_bind,
+	.control = util_sep_control,
+	.ops_open = fi_no_ops_open,
+};
+
+static struct fi_ops_ep util_sep_ops = {
+	.size = sizeof(struct fi_ops_ep),
+	.cancel = fi_no_cancel,
+	.getopt = fi_no_getopt,
+	.setopt = fi_no_setopt,
+	.tx_ctx = util_sep_tx_ctx,
+	.rx_ctx = util_sep_rx_ctx,
+	.rx_size_left = fi_no_rx_size_left,
+	.tx_size_left = fi_no_tx_size_left,
+};
+
+static struct fi_ops_cm util_sep_cm_ops = {
+	.size = sizeof(struct fi_ops_cm),
+	.setname = fi_no_setname,
+	.getname = util_sep_getname,
+	.getpeer = fi_no_getpeer,
+	.connect = fi_no_connect,
+	.listen = fi_no_listen,
+	.accept = fi_no_accept,
+	.reject = fi_no_reject,
+	.shutdown = fi_no_shutdown,
+	.join = fi_no_join,
+};
+
+int ofi_scalable_ep(struct fid_domain *domain, const struct util_prov *util_prov,
+		    struct fi_info *info, struct fid_ep **sep_fid, void *context,
+		    ofi_sep_ctx_func tx_ctx_open, ofi_sep_ctx_func rx_ctx_open)
+{
+	struct util_sep *sep;
+	int ret;
+
+	sep = calloc(1, sizeof(*sep));
+	if (!sep)
+		return -FI_ENOMEM;
+
+	ret = util_sep_init(domain, util_prov, info, sep, context,
+			    tx_ctx_open, rx_ctx_open);
+	if (ret) {
+		free(sep);
+		return ret;
+	}
+
+	*sep_fid = &sep->ep_fid;
+	(*sep_fid)->fid.ops = &util_sep_fi_ops;
+	(*sep_fid)->ops = &util_sep_ops;
+	(*sep_fid)->cm = &util_sep_cm_ops;
+	return 0;
+}
@@ -106,6 +106,7 @@ static ssize_t util_eq_write(struct fid_eq *eq_fid, uint32_t event,
 	fastlock_acquire(&eq->lock);
 	slist_insert_tail(&entry->entry, &eq->list);
 	fastlock_release(&eq->lock);
+	ofi_poll_notify(&eq->poll_notify);
 
 	if (eq->wait)
 		eq->wait->signal(eq->wait);
@@ -177,6 +178,7 @@ static int util_eq_close(struct fid *fid)
 			fi_close(&eq->wait->wait_fid.fid);
 	}
 
+	ofi_poll_notify_cleanup(&eq->poll_notify);
 	fastlock_destroy(&eq->lock);
 	ofi_atomic_dec32(&eq->fabric->ref);
 	free(eq);
@@ -304,6 +306,7 @@ int ofi_eq_create(struct fid_fabric *fabric_fid, struct fi_eq_attr *attr,
 	eq->eq_fid.ops = &util_eq_ops;
 
 	ofi_atomic_inc32(&fabric->ref);
+	ofi_poll_notify_init(&eq->poll_notify, &eq->eq_fid.fid);
 
 	/* EQ must be fully operational before adding to wait set */
 	if (eq->wait) {
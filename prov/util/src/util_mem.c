@@ -0,0 +1,320 @@
+/*
+ * Copyright (c) 2017 Intel Corporation. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#include <fi.h>
+#include <fi_mem.h>
+
+
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED	1
+#endif
+
+#define OFI_MEM_DEF_HUGE_SIZE	(2 * 1024 * 1024)
+#define OFI_MEM_MAX_NODES	1024
+
+const struct ofi_stat_def ofi_mem_stat_defs[OFI_MEM_STAT_MAX] = {
+	[OFI_MEM_STAT_HUGETLB_BYTES]	= { "hugetlb_bytes", OFI_STAT_GAUGE },
+	[OFI_MEM_STAT_THP_BYTES]	= { "thp_bytes", OFI_STAT_GAUGE },
+	[OFI_MEM_STAT_NUMA_BYTES]	= { "numa_bytes", OFI_STAT_GAUGE },
+	[OFI_MEM_STAT_FALLBACKS]	= { "hugepage_fallbacks", OFI_STAT_COUNTER },
+	[OFI_MEM_STAT_NUMA_ERRORS]	= { "numa_bind_errors", OFI_STAT_COUNTER },
+};
+
+struct ofi_mem_policy ofi_mem_policy = {
+	.hugepages = OFI_MEM_HUGE_NONE,
+	.numa_node = OFI_MEM_NUMA_NONE,
+};
+
+static size_t ofi_mem_huge_page_size(void)
+{
+	size_t size = 0;
+	char line[128];
+	FILE *file;
+
+	file = fopen("/proc/meminfo", "r");
+	if (!file)
+		return OFI_MEM_DEF_HUGE_SIZE;
+
+	while (fgets(line, sizeof line, file)) {
+		if (sscanf(line, "Hugepagesize: %zu kB", &size) == 1) {
+			size *= 1024;
+			break;
+		}
+	}
+	fclose(file);
+	return size ? size : OFI_MEM_DEF_HUGE_SIZE;
+}
+
+void ofi_mem_policy_init(enum ofi_mem_hugepages hugepages, int numa_node)
+{
+	long page_size;
+
+	page_size = sysconf(_SC_PAGESIZE);
+	ofi_mem_policy.page_size = page_size > 0 ? page_size : 4096;
+	ofi_mem_policy.huge_page_size = ofi_mem_huge_page_size();
+	ofi_mem_policy.hugepages = hugepages;
+	ofi_mem_policy.numa_node = numa_node;
+}
+
+static inline size_t ofi_mem_map_len(size_t size, int flags)
+{
+	return fi_get_aligned_sz(size, (flags & (OFI_MEM_HUGETLB | OFI_MEM_THP)) ?
+				 ofi_mem_policy.huge_page_size :
+				 ofi_mem_policy.page_size);
+}
+
+static void ofi_mem_stat(int id, size_t len, int add)
+{
+	if (add)
+		ofi_stats_add(ofi_mem_policy.stats, id, len);
+	else
+		ofi_stats_sub(ofi_mem_policy.stats, id, len);
+}
+
+static void ofi_mem_stats_update(size_t len, int flags, int add)
+{
+	if (!ofi_mem_policy.stats)
+		return;
+
+	if (flags & OFI_MEM_HUGETLB)
+		ofi_mem_stat(OFI_MEM_STAT_HUGETLB_BYTES, len, add);
+	else if (flags & OFI_MEM_THP)
+		ofi_mem_stat(OFI_MEM_STAT_THP_BYTES, len, add);
+	if (flags & OFI_MEM_BOUND)
+		ofi_mem_stat(OFI_MEM_STAT_NUMA_BYTES, len, add);
+}
+
+#ifdef __linux__
+
+static int ofi_mem_use_map(size_t alignment, size_t size)
+{
+	if (size < ofi_mem_policy.page_size ||
+	    alignment > ofi_mem_policy.page_size)
+		return 0;
+
+	return ofi_mem_policy.numa_node != OFI_MEM_NUMA_NONE ||
+	       (ofi_mem_policy.hugepages != OFI_MEM_HUGE_NONE &&
+		size >= ofi_mem_policy.huge_page_size);
+}
+
+static void *ofi_mem_map_hugetlb(size_t len)
+{
+#ifdef MAP_HUGETLB
+	void *addr;
+
+	addr = mmap(NULL, len, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	return addr == MAP_FAILED ? NULL : addr;
+#else
+	OFI_UNUSED(len);
+	return NULL;
+#endif
+}
+
+/* Over-map by a huge page and trim, so that the region starts on a huge
+ * page boundary and can be backed by transparent hugepages throughout.
+ */
+static void *ofi_mem_map_thp(size_t len)
+{
+#ifdef MADV_HUGEPAGE
+	size_t huge = ofi_mem_policy.huge_page_size;
+	char *base, *addr;
+
+	base = mmap(NULL, len + huge, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (base == MAP_FAILED)
+		return NULL;
+
+	addr = (char *) fi_get_aligned_sz((uintptr_t) base, huge);
+	if (addr > base)
+		munmap(base, addr - base);
+	if (base + huge > addr)
+		munmap(addr + len, base + huge - addr);
+
+	if (madvise(addr, len, MADV_HUGEPAGE)) {
+		munmap(addr, len);
+		return NULL;
+	}
+	return addr;
+#else
+	OFI_UNUSED(len);
+	return NULL;
+#endif
+}
+
+static void *ofi_mem_map_pages(size_t len)
+{
+	void *addr;
+
+	addr = mmap(NULL, len, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	return addr == MAP_FAILED ? NULL : addr;
+}
+
+static int ofi_mem_bind(void *addr, size_t len)
+{
+#if defined(SYS_mbind) && defined(SYS_getcpu)
+	unsigned long mask[OFI_MEM_MAX_NODES / (8 * sizeof(unsigned long))];
+	size_t bits = 8 * sizeof(unsigned long);
+	unsigned int cpu, node;
+
+	if (ofi_mem_policy.numa_node == OFI_MEM_NUMA_LOCAL) {
+		if (syscall(SYS_getcpu, &cpu, &node, NULL))
+			return -FI_ENOSYS;
+	} else {
+		node = ofi_mem_policy.numa_node;
+	}
+
+	if (node >= OFI_MEM_MAX_NODES)
+		return -FI_EINVAL;
+
+	memset(mask, 0, sizeof mask);
+	mask[node / bits] = 1UL << (node % bits);
+	if (syscall(SYS_mbind, addr, len, MPOL_PREFERRED, mask,
+		    OFI_MEM_MAX_NODES, 0))
+		return -errno;
+	return 0;
+#else
+	OFI_UNUSED(addr);
+	OFI_UNUSED(len);
+	return -FI_ENOSYS;
+#endif
+}
+
+static int ofi_mem_map(void **addr, size_t size, int *flags)
+{
+	size_t len;
+
+	*addr = NULL;
+	if (ofi_mem_policy.hugepages != OFI_MEM_HUGE_NONE &&
+	    size >= ofi_mem_policy.huge_page_size) {
+		len = ofi_mem_map_len(size, OFI_MEM_HUGETLB);
+		if (ofi_mem_policy.hugepages == OFI_MEM_HUGE_TLB) {
+			*addr = ofi_mem_map_hugetlb(len);
+			if (*addr)
+				*flags = OFI_MEM_MAPPED | OFI_MEM_HUGETLB;
+		}
+		if (!*addr) {
+			*addr = ofi_mem_map_thp(len);
+			if (*addr)
+				*flags = OFI_MEM_MAPPED | OFI_MEM_THP;
+		}
+		if (!*addr && ofi_mem_policy.stats)
+			ofi_stats_inc(ofi_mem_policy.stats,
+				      OFI_MEM_STAT_FALLBACKS);
+	}
+
+	if (!*addr) {
+		len = ofi_mem_map_len(size, 0);
+		*addr = ofi_mem_map_pages(len);
+		if (!*addr)
+			return -FI_ENOMEM;
+		*flags = OFI_MEM_MAPPED;
+	}
+
+	if (ofi_mem_policy.numa_node != OFI_MEM_NUMA_NONE) {
+		if (!ofi_mem_bind(*addr, len))
+			*flags |= OFI_MEM_BOUND;
+		else if (ofi_mem_policy.stats)
+			ofi_stats_inc(ofi_mem_policy.stats,
+				      OFI_MEM_STAT_NUMA_ERRORS);
+	}
+
+	ofi_mem_stats_update(len, *flags, 1);
+	return 0;
+}
+
+static void ofi_mem_unmap(void *addr, size_t size, int flags)
+{
+	size_t len = ofi_mem_map_len(size, flags);
+
+	ofi_mem_stats_update(len, flags, 0);
+	munmap(addr, len);
+}
+
+#else /* __linux__ */
+
+static int ofi_mem_use_map(size_t alignment, size_t size)
+{
+	OFI_UNUSED(alignment);
+	OFI_UNUSED(size);
+	return 0;
+}
+
+static int ofi_mem_map(void **addr, size_t size, int *flags)
+{
+	OFI_UNUSED(addr);
+	OFI_UNUSED(size);
+	OFI_UNUSED(flags);
+	return -FI_ENOSYS;
+}
+
+static void ofi_mem_unmap(void *addr, size_t size, int flags)
+{
+	OFI_UNUSED(addr);
+	OFI_UNUSED(size);
+	OFI_UNUSED(flags);
+}
+
+#endif /* __linux__ */
+
+int ofi_mem_alloc(void **addr, size_t alignment, size_t size, int *flags)
+{
+	*flags = 0;
+	if (ofi_mem_use_map(alignment, size) && !ofi_mem_map(addr, size, flags))
+		return 0;
+
+	return ofi_memalign(addr, MAX(alignment, sizeof(void *)), size) ?
+		-FI_ENOMEM : 0;
+}
+
+void ofi_mem_free(void *addr, size_t size, int flags)
+{
+	if (flags & OFI_MEM_MAPPED)
+		ofi_mem_unmap(addr, size, flags);
+	else
+		ofi_freealign(addr);
+}
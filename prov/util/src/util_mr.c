@@ -34,125 +34,255 @@
 #include <fi_enosys.h>
 #include <fi_util.h>
 #include <assert.h>
-#include <rbtree.h>
 
+#define OFI_MR_MAP_INIT_SIZE	64
+#define OFI_MR_FREE_END		SIZE_MAX
+#define OFI_MR_DELETED		((void *) (uintptr_t) 1)
 
-static struct fi_mr_attr *
-dup_mr_attr(const struct fi_mr_attr *attr)
+#define ofi_mr_prov_key(map)	((map)->mode & FI_MR_PROV_KEY)
+#define ofi_mr_slot(key)	((size_t) ((key) & OFI_MR_SLOT_MASK))
+#define ofi_mr_live(entry)	((entry)->context && \
+				 (entry)->context != OFI_MR_DELETED)
+
+
+static inline size_t ofi_mr_hash(struct ofi_mr_map *map, uint64_t key)
+{
+	return (size_t) ((key * UINT64_C(0x9E3779B97F4A7C15)) >> 32) &
+	       (map->size - 1);
+}
+
+static uint64_t ofi_mr_next_key(uint64_t key)
+{
+	uint64_t gen;
+
+	gen = ((key >> OFI_MR_SLOT_BITS) + 1) & OFI_MR_GEN_MASK;
+	/* generation 0 is never handed out, so keys are never 0 */
+	if (!gen)
+		gen = 1;
+	return (gen << OFI_MR_SLOT_BITS) | ofi_mr_slot(key);
+}
+
+static int ofi_mr_grow_slots(struct ofi_mr_map *map)
+{
+	struct ofi_mr_entry *table;
+	size_t size;
+
+	if (map->size > OFI_MR_SLOT_MASK)
+		return -FI_ENOMEM;
+
+	size = map->size * 2;
+	table = realloc(map->table, sizeof(*table) * size);
+	if (!table)
+		return -FI_ENOMEM;
+
+	memset(&table[map->size], 0, sizeof(*table) * (size - map->size));
+	map->table = table;
+	map->size = size;
+	return 0;
+}
+
+static struct ofi_mr_entry *ofi_mr_alloc_slot(struct ofi_mr_map *map)
+{
+	struct ofi_mr_entry *entry;
+
+	if (map->free != OFI_MR_FREE_END) {
+		entry = &map->table[map->free];
+		map->free = entry->len;
+		return entry;
+	}
+
+	if (map->used == map->size && ofi_mr_grow_slots(map))
+		return NULL;
+
+	entry = &map->table[map->used];
+	entry->key = (UINT64_C(1) << OFI_MR_SLOT_BITS) | map->used++;
+	return entry;
+}
+
+static struct ofi_mr_entry *
+ofi_mr_find_slot(struct ofi_mr_map *map, uint64_t key)
 {
-	struct fi_mr_attr *dup_attr;
+	struct ofi_mr_entry *entry;
+	size_t slot = ofi_mr_slot(key);
 
-	dup_attr = calloc(1, sizeof(*attr) +
-			     sizeof(*attr->mr_iov) * attr->iov_count);
-	if (!dup_attr)
+	if (slot >= map->used)
 		return NULL;
 
-	*dup_attr = *attr;
-	dup_attr->mr_iov = (struct iovec *) (dup_attr + 1);
-	memcpy((void *) dup_attr->mr_iov, attr->mr_iov,
-		sizeof(*attr->mr_iov) * attr->iov_count);
+	entry = &map->table[slot];
+	return (entry->context && entry->key == key) ? entry : NULL;
+}
+
+static struct ofi_mr_entry *
+ofi_mr_find_hash(struct ofi_mr_map *map, uint64_t key)
+{
+	struct ofi_mr_entry *entry;
+	size_t i;
 
-	return dup_attr;
+	for (i = ofi_mr_hash(map, key); ; i = (i + 1) & (map->size - 1)) {
+		entry = &map->table[i];
+		if (!entry->context)
+			return NULL;
+		if (entry->key == key && entry->context != OFI_MR_DELETED)
+			return entry;
+	}
 }
 
-int ofi_mr_insert(struct ofi_mr_map *map, const struct fi_mr_attr *attr,
-		  uint64_t *key, void *context)
+static struct ofi_mr_entry *ofi_mr_find(struct ofi_mr_map *map, uint64_t key)
 {
-	struct fi_mr_attr *item;
+	return ofi_mr_prov_key(map) ? ofi_mr_find_slot(map, key) :
+				      ofi_mr_find_hash(map, key);
+}
+
+/* Rehash into a table that keeps the load at or below 1/4, dropping
+ * tombstones along the way. */
+static int ofi_mr_rehash(struct ofi_mr_map *map)
+{
+	struct ofi_mr_entry *old_table, *entry;
+	size_t old_size, size, i, j;
+
+	for (size = map->size; (map->used + 1) * 4 > size; size *= 2)
+		;
 
-	item = dup_mr_attr(attr);
-	if (!item)
+	old_table = map->table;
+	old_size = map->size;
+	map->table = calloc(size, sizeof(*map->table));
+	if (!map->table) {
+		map->table = old_table;
 		return -FI_ENOMEM;
+	}
+	map->size = size;
+	map->dead = 0;
+
+	for (i = 0; i < old_size; i++) {
+		if (!ofi_mr_live(&old_table[i]))
+			continue;
+		for (j = ofi_mr_hash(map, old_table[i].key); ;
+		     j = (j + 1) & (size - 1)) {
+			entry = &map->table[j];
+			if (!entry->context) {
+				*entry = old_table[i];
+				break;
+			}
+		}
+	}
+	free(old_table);
+	return 0;
+}
+
+static struct ofi_mr_entry *
+ofi_mr_alloc_hash(struct ofi_mr_map *map, uint64_t key)
+{
+	struct ofi_mr_entry *entry, *slot = NULL;
+	size_t i;
 
-	if (!(map->mode & FI_MR_VIRT_ADDR))
-		item->offset = (uintptr_t) attr->mr_iov[0].iov_base;
+	if ((map->used + map->dead + 1) * 2 > map->size && ofi_mr_rehash(map))
+		return NULL;
 
-	if (!(map->mode & FI_MR_PROV_KEY)) {
-		if (rbtFind(map->rbtree, &item->requested_key)) {
-			free(item);
-			return -FI_ENOKEY;
+	for (i = ofi_mr_hash(map, key); ; i = (i + 1) & (map->size - 1)) {
+		entry = &map->table[i];
+		if (!entry->context)
+			break;
+		if (entry->context == OFI_MR_DELETED) {
+			if (!slot)
+				slot = entry;
+		} else if (entry->key == key) {
+			return NULL;
 		}
+	}
+
+	if (slot)
+		map->dead--;
+	else
+		slot = entry;
+	slot->key = key;
+	map->used++;
+	return slot;
+}
+
+int ofi_mr_insert(struct ofi_mr_map *map, const struct fi_mr_attr *attr,
+		  uint64_t *key, void *context)
+{
+	struct ofi_mr_entry *entry;
+
+	assert(context && context != OFI_MR_DELETED);
+	if (ofi_mr_prov_key(map)) {
+		entry = ofi_mr_alloc_slot(map);
+		if (!entry)
+			return -FI_ENOMEM;
 	} else {
-		item->requested_key = map->key++;
+		entry = ofi_mr_alloc_hash(map, attr->requested_key);
+		if (!entry)
+			return ofi_mr_find_hash(map, attr->requested_key) ?
+			       -FI_ENOKEY : -FI_ENOMEM;
 	}
 
-	rbtInsert(map->rbtree, &item->requested_key, item);
-	*key = item->requested_key;
-	item->context = context;
+	entry->access = attr->access;
+	entry->base = (uintptr_t) attr->mr_iov[0].iov_base;
+	entry->len = attr->mr_iov[0].iov_len;
+	entry->offset = (map->mode & FI_MR_VIRT_ADDR) ?
+			attr->offset : (uint64_t) entry->base;
+	entry->context = context;
 
+	*key = entry->key;
 	return 0;
 }
 
 void *ofi_mr_get(struct ofi_mr_map *map, uint64_t key)
 {
-	struct fi_mr_attr *attr;
-	void *itr, *key_ptr;
-
-	itr = rbtFind(map->rbtree, &key);
-	if (!itr)
-		return NULL;
+	struct ofi_mr_entry *entry;
 
-	rbtKeyValue(map->rbtree, itr, &key_ptr, (void **) &attr);
-	return attr->context;
+	entry = ofi_mr_find(map, key);
+	return entry ? entry->context : NULL;
 }
 
 int ofi_mr_verify(struct ofi_mr_map *map, uintptr_t *io_addr,
 		  size_t len, uint64_t key, uint64_t access,
 		  void **context)
 {
-	struct fi_mr_attr *attr;
-	void *itr, *key_ptr, *addr;
+	struct ofi_mr_entry *entry;
+	uintptr_t addr;
 
-	itr = rbtFind(map->rbtree, &key);
-	if (!itr)
+	entry = ofi_mr_find(map, key);
+	if (!entry)
 		return -FI_EINVAL;
 
-	rbtKeyValue(map->rbtree, itr, &key_ptr, (void **) &attr);
-	assert(attr);
-
-	if ((access & attr->access) != access) {
+	if ((access & entry->access) != access) {
 		FI_DBG(map->prov, FI_LOG_MR, "verify_addr: invalid access\n");
 		return -FI_EACCES;
 	}
 
-	addr = (void *) (*io_addr + (uintptr_t) attr->offset);
-
-	if ((addr < attr->mr_iov[0].iov_base) ||
-	    (((char *) addr + len) > ((char *) attr->mr_iov[0].iov_base +
-			    	      attr->mr_iov[0].iov_len))) {
+	addr = *io_addr + (uintptr_t) entry->offset;
+	if ((addr < entry->base) || (len > entry->len) ||
+	    (addr - entry->base > entry->len - len))
 		return -FI_EACCES;
-	}
 
 	if (context)
-		*context = attr->context;
-	*io_addr = (uintptr_t) addr;
+		*context = entry->context;
+	*io_addr = addr;
 	return 0;
 }
 
 int ofi_mr_remove(struct ofi_mr_map *map, uint64_t key)
 {
-	struct fi_mr_attr *attr;
-	void *itr, *key_ptr;
+	struct ofi_mr_entry *entry;
 
-	itr = rbtFind(map->rbtree, &key);
-	if (!itr)
+	entry = ofi_mr_find(map, key);
+	if (!entry)
 		return -FI_ENOKEY;
 
-	rbtKeyValue(map->rbtree, itr, &key_ptr, (void **) &attr);
-	rbtErase(map->rbtree, itr);
-	free(attr);
-
+	if (ofi_mr_prov_key(map)) {
+		entry->key = ofi_mr_next_key(key);
+		entry->context = NULL;
+		entry->len = map->free;
+		map->free = ofi_mr_slot(key);
+	} else {
+		entry->context = OFI_MR_DELETED;
+		map->used--;
+		map->dead++;
+	}
 	return 0;
 }
 
-/* assumes uint64_t keys */
-static int compare_mr_keys(void *key1, void *key2)
-{
-	uint64_t k1 = *((uint64_t *) key1);
-	uint64_t k2 = *((uint64_t *) key2);
-	return (k1 < k2) ? -1 : (k1 > k2);
-}
-
 
 /*
  * If a provider or app whose version is < 1.5, calls this function and passes
@@ -161,8 +291,8 @@ static int compare_mr_keys(void *key1, void *key2)
 int ofi_mr_map_init(const struct fi_provider *prov, int mode,
 		    struct ofi_mr_map *map)
 {
-	map->rbtree = rbtNew(compare_mr_keys);
-	if (!map->rbtree)
+	map->table = calloc(OFI_MR_MAP_INIT_SIZE, sizeof(*map->table));
+	if (!map->table)
 		return -FI_ENOMEM;
 
 	switch (mode) {
@@ -176,12 +306,15 @@ int ofi_mr_map_init(const struct fi_provider *prov, int mode,
 		map->mode = mode;
 	}
 	map->prov = prov;
-	map->key = 1;
+	map->size = OFI_MR_MAP_INIT_SIZE;
+	map->used = 0;
+	map->dead = 0;
+	map->free = OFI_MR_FREE_END;
 
 	return 0;
 }
 
 void ofi_mr_map_close(struct ofi_mr_map *map)
 {
-	rbtDelete(map->rbtree);
+	free(map->table);
 }
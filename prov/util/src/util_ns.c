@@ -39,6 +39,17 @@
  * To resolve a "node:service" pair into an provider internal endpoint name
  * that can be used as the input of fi_av_insert, a process needs to make
  * a query to the name server residing on "node".
+ *
+ * Clients keep their connection to each server open and pipeline their
+ * requests over it: a request is a util_ns_cmd followed by the service
+ * (and for ADD/DEL, the name), and only QUERY is answered, with an ACK
+ * followed by the service and name when found.  Requests are sent in
+ * windows of OFI_NS_WINDOW bytes, so that the replies to a window always
+ * fit in the socket buffers.  The server multiplexes all connections over
+ * an epoll set.  Names resolved from a server are cached by the client
+ * for OFI_NS_CACHE_TTL ms, after which the server is asked again: a
+ * service may be re-registered with a new name, e.g. when a process
+ * restarts.
  */
 
 #include <sys/types.h>
@@ -46,29 +57,38 @@
 #include <netdb.h>
 
 #include <fi_util.h>
+#include <fi_signal.h>
 #include <rdma/providers/fi_log.h>
 #include <fi.h>
 
 #include "rbtree.h"
 
 #define OFI_NS_DEFAULT_HOSTNAME	"localhost"
+#define OFI_NS_WINDOW		16384
+#define OFI_NS_MAX_PEER_CONN	64
+#define OFI_NS_MAX_EVENTS	32
+#define OFI_NS_CACHE_TTL	1000
 
-#define OFI_NS_SOCKET_OP(op)							\
+#define OFI_NS_SOCKET_OP(op, sock_op, flags)					\
 static inline									\
 ssize_t util_ns_##op##_socket_op(SOCKET sock, void *buf, size_t len)		\
 {										\
-	ssize_t ret = 0, bytes = 0;						\
-	while (bytes != (len) && ret >= 0) {					\
-		ret = ofi_##op##_socket((sock),					\
-					(void *)((char *) (buf) + bytes),	\
-					(len) - bytes);				\
-		bytes = ((ret < 0) ? -1 : bytes + ret);				\
+	ssize_t ret;								\
+	size_t bytes = 0;							\
+	while (bytes < len) {							\
+		ret = ofi_##sock_op##_socket(sock, (char *) buf + bytes,	\
+					     len - bytes, flags);		\
+		if (ret < 0 && ofi_sockerr() == EINTR)				\
+			continue;						\
+		if (ret <= 0)							\
+			return -1;						\
+		bytes += ret;							\
 	}									\
 	return bytes;								\
 }
 
-OFI_NS_SOCKET_OP(write)
-OFI_NS_SOCKET_OP(read)
+OFI_NS_SOCKET_OP(write, send, MSG_NOSIGNAL)
+OFI_NS_SOCKET_OP(read, recv, 0)
 
 enum {
 	OFI_UTIL_NS_ADD,
@@ -84,19 +104,70 @@ struct util_ns_cmd {
 
 const size_t cmd_len = sizeof(struct util_ns_cmd);
 
+struct util_ns_conn {
+	struct dlist_entry	entry;
+	SOCKET			sock;
+	size_t			len;
+	char			buf[];
+};
+
+struct util_ns_server {
+	struct util_ns		*ns;
+	SOCKET			listenfd;
+	fi_epoll_t		epfd;
+	struct dlist_entry	conn_list;
+	size_t			buf_size;
+	void			*rec;
+	char			*reply;
+};
+
+struct util_ns_peer {
+	struct dlist_entry	entry;
+	char			*hostname;
+	SOCKET			sock;
+	RbtHandle		name_cache;
+};
+
+/* Value of a name_cache entry */
+struct util_ns_cache_entry {
+	uint64_t		expire_ms;
+	char			name[];
+};
+
+static size_t util_ns_cmd_size(struct util_ns *ns, int op)
+{
+	switch (op) {
+	case OFI_UTIL_NS_ADD:
+	case OFI_UTIL_NS_DEL:
+		return cmd_len + ns->service_len + ns->name_len;
+	case OFI_UTIL_NS_QUERY:
+		return cmd_len + ns->service_len;
+	default:
+		return 0;
+	}
+}
+
 static int util_ns_map_init(struct util_ns *ns)
 {
 	ns->ns_map = rbtNew(ns->service_cmp);
 	return ns->ns_map ? 0 : -FI_ENOMEM;
 }
 
-static void util_ns_map_fini(struct util_ns *ns)
+static void util_ns_map_fini(RbtHandle map)
 {
-	rbtDelete(ns->ns_map);
+	RbtIterator it;
+	void *service, *name;
+
+	for (it = rbtBegin(map); it != rbtEnd(map); it = rbtNext(map, it)) {
+		rbtKeyValue(map, it, &service, &name);
+		free(service);
+		free(name);
+	}
+	rbtDelete(map);
 }
 
-static int util_ns_map_add(struct util_ns *ns, void *service_in,
-			   void *name_in)
+static int util_ns_map_add(struct util_ns *ns, RbtHandle map,
+			   void *service_in, void *name_in)
 {
 	void *name, *service;
 	int ret;
@@ -115,12 +186,12 @@ static int util_ns_map_add(struct util_ns *ns, void *service_in,
 	}
 	memcpy(name, name_in, ns->name_len);
 
-	if (rbtFind(ns->ns_map, service)) {
+	if (rbtFind(map, service)) {
 		ret = -FI_EADDRINUSE;
 		goto err3;
 	}
 
-	if (rbtInsert(ns->ns_map, service, name)) {
+	if (rbtInsert(map, service, name)) {
 		ret = -FI_ENOMEM;
 		goto err3;
 	}
@@ -133,39 +204,40 @@ err2:
 err1:
 	return ret;
 }
- 
-static int util_ns_map_del(struct util_ns *ns, void *service_in,
-			   void *name_in)
+
+/* A NULL name_in removes the service whatever its name */
+static int util_ns_map_del(struct util_ns *ns, RbtHandle map,
+			   void *service_in, void *name_in)
 {
 	RbtIterator it;
 	int ret = -FI_ENOENT;
 	void *service, *name;
 
-        it = rbtFind(ns->ns_map, service_in);
-        if (it) {
-		rbtKeyValue(ns->ns_map, it, &service, &name);
-		if (memcmp(name, name_in, ns->name_len))
+	it = rbtFind(map, service_in);
+	if (it) {
+		rbtKeyValue(map, it, &service, &name);
+		if (name_in && memcmp(name, name_in, ns->name_len))
 			return ret;
 		free(service);
 		free(name);
-		rbtErase(ns->ns_map, it);
+		rbtErase(map, it);
 		ret = FI_SUCCESS;
 	}
 
 	return ret;
 }
 
-static int util_ns_map_lookup(struct util_ns *ns, void *service_in,
-			      void *name_out)
+static int util_ns_map_lookup(struct util_ns *ns, RbtHandle map,
+			      void *service_in, void *name_out)
 {
 	RbtIterator it;
 	void *key, *name;
 
-        it = rbtFind(ns->ns_map, service_in);
+	it = rbtFind(map, service_in);
 	if (!it)
 		return -FI_ENOENT;
 
-	rbtKeyValue(ns->ns_map, it, &key, (void **)&name);
+	rbtKeyValue(map, it, &key, (void **)&name);
 	memcpy(name_out, name, ns->name_len);
 
 	if (ns->is_service_wildcard && ns->is_service_wildcard(service_in))
@@ -174,108 +246,207 @@ static int util_ns_map_lookup(struct util_ns *ns, void *service_in,
 	return FI_SUCCESS;
 }
 
-static void util_ns_name_server_cleanup(void *args)
-{
-	void **cleanup_args = (void **)args;
-	ofi_close_socket((uintptr_t)cleanup_args[0]);
-	util_ns_map_fini((struct util_ns *)cleanup_args[1]);
-}
+/*
+ * Name server API: server side
+ */
 
-static int util_ns_op_dispatcher(struct util_ns *ns,
-				 struct util_ns_cmd *cmd,
-				 SOCKET sock)
+/*
+ * Executes the request held in rec.  Returns the length of the reply
+ * written to reply, or a negative error.
+ */
+static ssize_t util_ns_op_dispatcher(struct util_ns *ns, void *rec,
+				     void *reply)
 {
-	int ret = FI_SUCCESS;
-	size_t io_len = 0;
-	void *io_buf = NULL, *service, *name;
+	struct util_ns_cmd *cmd = rec;
+	void *service, *name;
+	size_t io_len;
+
+	service = (char *) rec + cmd_len;
+	name = (char *) service + ns->service_len;
 
 	switch (cmd->op) {
 	case OFI_UTIL_NS_ADD:
+		(void) util_ns_map_add(ns, ns->ns_map, service, name);
+		return 0;
 	case OFI_UTIL_NS_DEL:
-		io_len = ns->name_len + ns->service_len;
-		io_buf = calloc(io_len, 1);
-		if (!io_buf) {
-			ret = -FI_ENOMEM;
-			goto fn1;
-		}
+		(void) util_ns_map_del(ns, ns->ns_map, service, name);
+		return 0;
+	case OFI_UTIL_NS_QUERY:
+		cmd->op = OFI_UTIL_NS_ACK;
+		cmd->status = util_ns_map_lookup(ns, ns->ns_map, service, name);
+		io_len = cmd->status ? cmd_len :
+			 cmd_len + ns->service_len + ns->name_len;
+		memcpy(reply, rec, io_len);
+		return io_len;
+	default:
+		return -FI_EINVAL;
+	}
+}
 
-		ret = util_ns_read_socket_op(sock, io_buf, io_len);
-		if (ret == io_len) {
-			service = io_buf;
-			name = (void *)((char *)io_buf + ns->service_len);
-			ret = (cmd->op == OFI_UTIL_NS_ADD) ?
-			      util_ns_map_add(ns, service, name) :
-			      util_ns_map_del(ns, service, name);
-		} else {
-			ret = -FI_ENODATA;
-		}
-		goto fn2;
+static void util_ns_conn_close(struct util_ns_server *server,
+			       struct util_ns_conn *conn)
+{
+	(void) fi_epoll_del(server->epfd, conn->sock);
+	ofi_close_socket(conn->sock);
+	dlist_remove(&conn->entry);
+	free(conn);
+}
 
-	case OFI_UTIL_NS_QUERY:
-		io_len = ns->service_len;
-		/* allocate io_buf to be large enough */
-		io_buf = calloc(
-			cmd_len + ns->service_len + ns->name_len, 1
-		);
-		if (!io_buf) {
-			ret = -FI_ENOMEM;
-			goto fn1;
-		}
+static void util_ns_server_accept(struct util_ns_server *server)
+{
+	struct util_ns_conn *conn;
+	SOCKET connfd;
 
-		memcpy(io_buf, cmd, cmd_len);
-		cmd = io_buf;
-		service = (char *)io_buf + cmd_len;
-		name = (char *)service + ns->service_len;
-
-		ret = util_ns_read_socket_op(sock, service, io_len);
-		if (ret == io_len) {
-			cmd->op = OFI_UTIL_NS_ACK;
-			cmd->status = util_ns_map_lookup(
-				ns, service, name
-			);
-		} else {
-			ret = -FI_ENODATA;
-			goto fn2;
-		}
+	connfd = accept(server->listenfd, NULL, 0);
+	if (connfd == INVALID_SOCKET)
+		return;
 
-		if (!cmd->status)
-			io_len = cmd_len + ns->service_len + ns->name_len;
-		else
-			io_len = cmd_len;
-		ret = util_ns_write_socket_op(sock, io_buf, io_len);
-		ret = ((ret == cmd_len) ? FI_SUCCESS : -FI_ENODATA);
-		goto fn2;
+	conn = calloc(1, sizeof(*conn) + server->buf_size);
+	if (!conn)
+		goto err;
 
-	default:
-		ret = -FI_ENODATA;
-		assert(0);
-		goto fn1;
+	conn->sock = connfd;
+	if (fi_epoll_add(server->epfd, connfd, conn)) {
+		free(conn);
+		goto err;
 	}
+	dlist_insert_tail(&conn->entry, &server->conn_list);
+	return;
+err:
+	ofi_close_socket(connfd);
+}
 
-fn2:
-	free(io_buf);
-fn1:
+/*
+ * Executes all complete requests received on the connection, and sends
+ * back their replies at once.  Partial requests are kept for the next
+ * call.
+ */
+static int util_ns_conn_process(struct util_ns_server *server,
+				struct util_ns_conn *conn)
+{
+	struct util_ns *ns = server->ns;
+	struct util_ns_cmd cmd;
+	size_t off = 0, reply_len = 0, size;
+	ssize_t ret;
+
+	/* the connection is readable, this does not block */
+	ret = ofi_recv_socket(conn->sock, conn->buf + conn->len,
+			      server->buf_size - conn->len, 0);
+	if (ret < 0 && ofi_sockerr() == EINTR)
+		return 0;
+	if (ret <= 0)
+		return -FI_ENOTCONN;
+	conn->len += ret;
+
+	while (conn->len - off >= cmd_len) {
+		memcpy(&cmd, conn->buf + off, cmd_len);
+		size = util_ns_cmd_size(ns, cmd.op);
+		if (!size)
+			return -FI_EINVAL;
+		if (conn->len - off < size)
+			break;
+
+		memcpy(server->rec, conn->buf + off, size);
+		ret = util_ns_op_dispatcher(ns, server->rec,
+					    server->reply + reply_len);
+		if (ret < 0)
+			return ret;
+		reply_len += ret;
+		off += size;
+	}
+
+	conn->len -= off;
+	memmove(conn->buf, conn->buf + off, conn->len);
+
+	if (reply_len &&
+	    util_ns_write_socket_op(conn->sock, server->reply,
+				    reply_len) != reply_len)
+		return -FI_ENOTCONN;
+	return 0;
+}
+
+static void util_ns_name_server_cleanup(void *args)
+{
+	struct util_ns_server *server = args;
+	struct util_ns_conn *conn;
+
+	while (!dlist_empty(&server->conn_list)) {
+		dlist_pop_front(&server->conn_list, struct util_ns_conn,
+				conn, entry);
+		ofi_close_socket(conn->sock);
+		free(conn);
+	}
+	fi_epoll_close(server->epfd);
+	ofi_close_socket(server->listenfd);
+	free(server->reply);
+	free(server->rec);
+	util_ns_map_fini(server->ns->ns_map);
+}
+
+static int util_ns_server_init(struct util_ns_server *server)
+{
+	struct util_ns *ns = server->ns;
+	size_t rec_len, reply_size;
+	int ret;
+
+	dlist_init(&server->conn_list);
+
+	rec_len = cmd_len + ns->service_len + ns->name_len;
+	server->buf_size = MAX(rec_len, OFI_NS_WINDOW);
+	reply_size = server->buf_size / (cmd_len + ns->service_len) * rec_len;
+
+	server->rec = calloc(1, rec_len);
+	server->reply = calloc(1, reply_size);
+	if (!server->rec || !server->reply) {
+		ret = -FI_ENOMEM;
+		goto err1;
+	}
+
+	ret = util_ns_map_init(ns);
+	if (ret)
+		goto err1;
+
+	ret = fi_epoll_create(&server->epfd);
+	if (ret)
+		goto err2;
+
+	if (listen(server->listenfd, 256)) {
+		ret = -ofi_sockerr();
+		goto err3;
+	}
+
+	ret = fi_epoll_add(server->epfd, server->listenfd, server);
+	if (ret)
+		goto err3;
+	return 0;
+
+err3:
+	fi_epoll_close(server->epfd);
+err2:
+	util_ns_map_fini(ns->ns_map);
+err1:
+	free(server->reply);
+	free(server->rec);
 	return ret;
 }
 
 static void *util_ns_name_server_func(void *args)
 {
-	struct util_ns *ns;
+	struct util_ns_server server = {
+		.ns = args,
+		.listenfd = INVALID_SOCKET,
+	};
 	struct addrinfo hints = {
 		.ai_flags = AI_PASSIVE,
 		.ai_family = AF_UNSPEC,
 		.ai_socktype = SOCK_STREAM
 	};
 	struct addrinfo *res, *p;
-	void *cleanup_args[2];
+	void *contexts[OFI_NS_MAX_EVENTS];
 	char *service;
-	SOCKET listenfd = INVALID_SOCKET, connfd;
-	int n, ret;
-	struct util_ns_cmd cmd = (const struct util_ns_cmd){ 0 };
+	int n, i;
 
-	ns = (struct util_ns *)args;
-
-	if (asprintf(&service, "%d", ns->ns_port) < 0)
+	if (asprintf(&service, "%d", server.ns->ns_port) < 0)
 		return NULL;
 
 	n = getaddrinfo(NULL, service, &hints, &res);
@@ -285,54 +456,45 @@ static void *util_ns_name_server_func(void *args)
 	}
 
 	for (p = res; p; p = p->ai_next) {
-		listenfd = ofi_socket(p->ai_family, p->ai_socktype,
-				      p->ai_protocol);
-		if (listenfd != INVALID_SOCKET) {
+		server.listenfd = ofi_socket(p->ai_family, p->ai_socktype,
+					     p->ai_protocol);
+		if (server.listenfd != INVALID_SOCKET) {
 			n = 1;
-			(void) setsockopt(listenfd, SOL_SOCKET,
+			(void) setsockopt(server.listenfd, SOL_SOCKET,
 					  SO_REUSEADDR, &n, sizeof(n));
-			if (!bind(listenfd, p->ai_addr, p->ai_addrlen))
+			if (!bind(server.listenfd, p->ai_addr, p->ai_addrlen))
 				break;
-			ofi_close_socket(listenfd);
-			listenfd = INVALID_SOCKET;
+			ofi_close_socket(server.listenfd);
+			server.listenfd = INVALID_SOCKET;
 		}
 	}
 
 	freeaddrinfo(res);
 	free(service);
 
-	if (listenfd == INVALID_SOCKET)
+	if (server.listenfd == INVALID_SOCKET)
 		return NULL;
 
-	if (util_ns_map_init(ns))
-		goto done;
-
-	ret = listen(listenfd, 256);
-	if (ret)
-		goto done;
+	if (util_ns_server_init(&server)) {
+		ofi_close_socket(server.listenfd);
+		return NULL;
+	}
 
-	cleanup_args[0] = (void *)(uintptr_t)listenfd;
-	cleanup_args[1] = (void *)ns;
-	pthread_cleanup_push(util_ns_name_server_cleanup,
-			     (void *)cleanup_args);
+	pthread_cleanup_push(util_ns_name_server_cleanup, (void *)&server);
 
 	while (1) {
-		connfd = accept(listenfd, NULL, 0);
-		if (connfd != INVALID_SOCKET) {
-			/* Read service data */
-			ret = ofi_read_socket(connfd, &cmd, cmd_len);
-			if (ret == cmd_len) {
-				(void) util_ns_op_dispatcher(ns, &cmd,
-							     connfd);
+		n = fi_epoll_wait(server.epfd, contexts, OFI_NS_MAX_EVENTS, -1);
+		for (i = 0; i < n; i++) {
+			if (contexts[i] == &server) {
+				util_ns_server_accept(&server);
+				continue;
 			}
-			ofi_close_socket(connfd);
+			if (util_ns_conn_process(&server, contexts[i]))
+				util_ns_conn_close(&server, contexts[i]);
 		}
 	}
 
 	pthread_cleanup_pop(1);
-
-done:
-	ofi_close_socket(listenfd);
 	return NULL;
 }
 
@@ -341,7 +503,7 @@ done:
  * Name server API: client side
  */
 
-static int util_ns_connect_server(struct util_ns *ns, const char *server)
+static SOCKET util_ns_connect_server(struct util_ns *ns, const char *server)
 {
 	struct addrinfo hints = {
 		.ai_family   = AF_UNSPEC,
@@ -353,12 +515,12 @@ static int util_ns_connect_server(struct util_ns *ns, const char *server)
 	int n;
 
 	if (asprintf(&service, "%d", ns->ns_port) < 0)
-		return -1;
+		return INVALID_SOCKET;
 
 	n = getaddrinfo(server, service, &hints, &res);
 	if (n < 0) {
 		free(service);
-		return -1;
+		return INVALID_SOCKET;
 	}
 
 	for (p = res; p; p = p->ai_next) {
@@ -377,165 +539,395 @@ static int util_ns_connect_server(struct util_ns *ns, const char *server)
 	return sockfd;
 }
 
-int ofi_ns_add_local_name(struct util_ns *ns, void *service, void *name)
+static const char *util_ns_local_hostname(struct util_ns *ns)
 {
-	SOCKET sockfd;
-	int ret;
-	char *server = (ns->ns_hostname ?
-		ns->ns_hostname : OFI_NS_DEFAULT_HOSTNAME);
-	void *write_buf;
-	size_t write_len = 0;
-	struct util_ns_cmd cmd = {
-		.op = OFI_UTIL_NS_ADD,
-		.status = 0,
-	};
+	return ns->ns_hostname ? ns->ns_hostname : OFI_NS_DEFAULT_HOSTNAME;
+}
 
-	if (!ns->is_initialized)
-		return -FI_EINVAL;
+/* Number of requests of a window.  Replies are the largest messages. */
+static size_t util_ns_window(struct util_ns *ns)
+{
+	return MAX(1, OFI_NS_WINDOW /
+		      (cmd_len + ns->service_len + ns->name_len));
+}
 
-	write_buf = calloc(cmd_len + ns->service_len + ns->name_len, 1);
-	if (!write_buf) {
-		ret = -FI_ENOMEM;
-		goto err1;
+static int util_ns_match_peer(struct dlist_entry *item, const void *arg)
+{
+	struct util_ns_peer *peer;
+
+	peer = container_of(item, struct util_ns_peer, entry);
+	return !strcmp(peer->hostname, arg);
+}
+
+/* Peers are kept in least recently used order, the last one first */
+static struct util_ns_peer *
+util_ns_get_peer(struct util_ns *ns, const char *hostname)
+{
+	struct util_ns_peer *peer;
+	struct dlist_entry *item;
+
+	item = dlist_find_first_match(&ns->peer_list, util_ns_match_peer,
+				      hostname);
+	if (item) {
+		dlist_remove(item);
+		dlist_insert_head(item, &ns->peer_list);
+		return container_of(item, struct util_ns_peer, entry);
 	}
 
-	memcpy(write_buf, &cmd, cmd_len);
-	write_len += cmd_len;
-	memcpy((void *)((char *)write_buf + write_len), service,
-	       ns->service_len);
-	write_len += ns->service_len;
-	memcpy((void *)((char *)write_buf + write_len), name,
-	       ns->name_len);
-	write_len += ns->name_len;
+	peer = calloc(1, sizeof(*peer));
+	if (!peer)
+		return NULL;
 
-	sockfd = util_ns_connect_server(ns, server);
-	if (sockfd == INVALID_SOCKET) {
-		ret = -FI_ENODATA;
-		goto err2;
+	peer->hostname = strdup(hostname);
+	peer->name_cache = rbtNew(ns->service_cmp);
+	if (!peer->hostname || !peer->name_cache) {
+		if (peer->name_cache)
+			rbtDelete(peer->name_cache);
+		free(peer->hostname);
+		free(peer);
+		return NULL;
 	}
 
-	ret = util_ns_write_socket_op(sockfd, write_buf, write_len);
-	ret = ((ret == write_len) ? FI_SUCCESS : -FI_ENODATA);
+	peer->sock = INVALID_SOCKET;
+	dlist_insert_head(&peer->entry, &ns->peer_list);
+	return peer;
+}
 
-	ofi_close_socket(sockfd);
-err2:
-	free(write_buf);
-err1:
-	return ret;
+static void util_ns_peer_disconnect(struct util_ns *ns,
+				    struct util_ns_peer *peer)
+{
+	if (peer->sock == INVALID_SOCKET)
+		return;
+
+	ofi_close_socket(peer->sock);
+	peer->sock = INVALID_SOCKET;
+	ns->peer_conn_cnt--;
 }
 
-int ofi_ns_del_local_name(struct util_ns *ns, void *service, void *name)
+/*
+ * The server only writes replies to requests, so a connection that can
+ * be read between requests has been closed by the server.
+ */
+static int util_ns_peer_connected(struct util_ns_peer *peer)
 {
-	SOCKET sockfd;
-	int ret;
-	const char *server_hostname = (ns->ns_hostname ?
-		ns->ns_hostname : OFI_NS_DEFAULT_HOSTNAME);
-	void *write_buf;
-	size_t write_len = 0;
-	struct util_ns_cmd cmd = {
-		.op = OFI_UTIL_NS_DEL,
-		.status = 0,
-	};
+	return peer->sock != INVALID_SOCKET && !fi_poll_fd(peer->sock, 0);
+}
 
-	if (!ns->is_initialized)
-		return -FI_EINVAL;
+static int util_ns_peer_connect(struct util_ns *ns, struct util_ns_peer *peer)
+{
+	struct util_ns_peer *lru;
+	struct dlist_entry *item;
 
-	write_buf = calloc(cmd_len + ns->service_len + ns->name_len, 1);
-	if (!write_buf) {
-		ret = -FI_ENOMEM;
-		goto err1;
+	if (util_ns_peer_connected(peer))
+		return 0;
+
+	util_ns_peer_disconnect(ns, peer);
+
+	if (ns->peer_conn_cnt >= OFI_NS_MAX_PEER_CONN) {
+		for (item = ns->peer_list.prev; item != &ns->peer_list;
+		     item = item->prev) {
+			lru = container_of(item, struct util_ns_peer, entry);
+			if (lru->sock != INVALID_SOCKET) {
+				util_ns_peer_disconnect(ns, lru);
+				break;
+			}
+		}
 	}
 
-	memcpy(write_buf, &cmd, cmd_len);
-	write_len += cmd_len;
-	memcpy((void *)((char *)write_buf + write_len), service,
-	       ns->service_len);
-	write_len += ns->service_len;
-	memcpy((void *)((char *)write_buf + write_len), name,
-	       ns->name_len);
-	write_len += ns->name_len;
+	peer->sock = util_ns_connect_server(ns, peer->hostname);
+	if (peer->sock == INVALID_SOCKET)
+		return -FI_ENODATA;
 
-	sockfd = util_ns_connect_server(ns, server_hostname);
-	if (sockfd == INVALID_SOCKET) {
-		ret = -FI_ENODATA;
-		goto err2;
+	ns->peer_conn_cnt++;
+	return 0;
+}
+
+static int util_ns_peer_send(struct util_ns *ns, struct util_ns_peer *peer,
+			     void *buf, size_t len)
+{
+	if (util_ns_peer_connect(ns, peer))
+		return -FI_ENODATA;
+
+	if (util_ns_write_socket_op(peer->sock, buf, len) != len) {
+		util_ns_peer_disconnect(ns, peer);
+		return -FI_ENODATA;
 	}
+	return 0;
+}
 
-	ret = util_ns_write_socket_op(sockfd, write_buf, write_len);
-	ret = ((ret == write_len) ? FI_SUCCESS : -FI_ENODATA);
+static void util_ns_cache_add(struct util_ns *ns, struct util_ns_peer *peer,
+			      void *service_in, void *name_in)
+{
+	struct util_ns_cache_entry *entry;
+	void *service;
 
-	ofi_close_socket(sockfd);
-err2:
-	free(write_buf);
-err1:
-	return ret;
+	(void) util_ns_map_del(ns, peer->name_cache, service_in, NULL);
+
+	service = malloc(ns->service_len);
+	entry = malloc(sizeof(*entry) + ns->name_len);
+	if (!service || !entry)
+		goto err;
+
+	memcpy(service, service_in, ns->service_len);
+	memcpy(entry->name, name_in, ns->name_len);
+	entry->expire_ms = fi_gettime_ms() + OFI_NS_CACHE_TTL;
+	if (rbtInsert(peer->name_cache, service, entry))
+		goto err;
+	return;
+err:
+	free(entry);
+	free(service);
 }
 
-void *ofi_ns_resolve_name(struct util_ns *ns, const char *server_hostname,
-			  void *service)
+/* Expired entries are dropped, so that the server is asked again */
+static int util_ns_cache_lookup(struct util_ns *ns, struct util_ns_peer *peer,
+				void *service_in, void *name_out)
+{
+	struct util_ns_cache_entry *entry;
+	RbtIterator it;
+	void *service;
+
+	it = rbtFind(peer->name_cache, service_in);
+	if (!it)
+		return -FI_ENOENT;
+
+	rbtKeyValue(peer->name_cache, it, &service, (void **) &entry);
+	if (fi_gettime_ms() >= entry->expire_ms) {
+		free(service);
+		free(entry);
+		rbtErase(peer->name_cache, it);
+		return -FI_ENOENT;
+	}
+
+	memcpy(name_out, entry->name, ns->name_len);
+	return 0;
+}
+
+static int util_ns_peer_recv(struct util_ns *ns, struct util_ns_peer *peer,
+			     char *services, char *names, int *status,
+			     size_t *idx, size_t count, void *rec)
+{
+	struct util_ns_cmd cmd;
+	size_t i, rec_len = ns->service_len + ns->name_len;
+
+	for (i = 0; i < count; i++) {
+		if (util_ns_read_socket_op(peer->sock, &cmd, cmd_len) != cmd_len ||
+		    cmd.op != OFI_UTIL_NS_ACK)
+			return -FI_ENODATA;
+
+		status[idx[i]] = cmd.status;
+		if (cmd.status)
+			continue;
+
+		if (util_ns_read_socket_op(peer->sock, rec, rec_len) != rec_len)
+			return -FI_ENODATA;
+
+		memcpy(services + idx[i] * ns->service_len, rec,
+		       ns->service_len);
+		memcpy(names + idx[i] * ns->name_len,
+		       (char *) rec + ns->service_len, ns->name_len);
+		util_ns_cache_add(ns, peer, rec, (char *) rec + ns->service_len);
+	}
+	return 0;
+}
+
+/* Resolves the services listed in idx, a window at a time */
+static int util_ns_peer_query(struct util_ns *ns, struct util_ns_peer *peer,
+			      char *services, char *names, int *status,
+			      size_t *idx, size_t count)
 {
-	void *dest_addr = NULL, *io_buf;
-	size_t io_len = 0;
-	SOCKET sockfd;
-	ssize_t ret = 0;
 	struct util_ns_cmd cmd = {
 		.op = OFI_UTIL_NS_QUERY,
 		.status = 0,
 	};
+	size_t i, n, win, io_len;
+	char *io_buf, *rec;
+	int ret = 0;
+
+	win = util_ns_window(ns);
+	io_buf = calloc(MIN(count, win), cmd_len + ns->service_len);
+	rec = calloc(1, ns->service_len + ns->name_len);
+	if (!io_buf || !rec) {
+		ret = -FI_ENOMEM;
+		goto out;
+	}
 
-	if (!ns->is_initialized)
-		return NULL;
+	for (; count && !ret; idx += n, count -= n) {
+		n = MIN(count, win);
+		for (i = 0, io_len = 0; i < n; i++) {
+			memcpy(io_buf + io_len, &cmd, cmd_len);
+			io_len += cmd_len;
+			memcpy(io_buf + io_len,
+			       services + idx[i] * ns->service_len,
+			       ns->service_len);
+			io_len += ns->service_len;
+		}
 
-	sockfd = util_ns_connect_server(ns, server_hostname);
-	if (sockfd == INVALID_SOCKET)
-		goto err1;
+		ret = util_ns_peer_send(ns, peer, io_buf, io_len);
+		if (!ret)
+			ret = util_ns_peer_recv(ns, peer, services, names,
+						status, idx, n, rec);
+		if (ret)
+			util_ns_peer_disconnect(ns, peer);
+	}
+out:
+	free(rec);
+	free(io_buf);
+	return ret;
+}
 
-	io_buf = calloc(cmd_len + ns->service_len, 1);
-	if (!io_buf)
-		goto err2;
+static int util_ns_update(struct util_ns *ns, int op, char *services,
+			  char *names, size_t count)
+{
+	struct util_ns_peer *peer;
+	struct util_ns_cmd cmd = {
+		.op = op,
+		.status = 0,
+	};
+	size_t i, n, win, rec_len, io_len;
+	char *io_buf;
+	int ret = 0;
 
-	memcpy(io_buf, &cmd, cmd_len);
-	io_len += cmd_len;
-	memcpy((void *)((char *)io_buf + io_len), service,
-	       ns->service_len);
-	io_len += ns->service_len;
+	if (!ns->is_initialized)
+		return -FI_EINVAL;
 
-	ret = util_ns_write_socket_op(sockfd, io_buf, io_len);
-	if (ret < 0)
-		goto err3;
+	rec_len = util_ns_cmd_size(ns, op);
+	win = util_ns_window(ns);
+	io_buf = calloc(MIN(count, win), rec_len);
+	if (!io_buf)
+		return -FI_ENOMEM;
 
+	fastlock_acquire(&ns->lock);
+	peer = util_ns_get_peer(ns, util_ns_local_hostname(ns));
+	if (!peer) {
+		ret = -FI_ENOMEM;
+		goto out;
+	}
+
+	for (; count && !ret; services += n * ns->service_len,
+			      names += n * ns->name_len, count -= n) {
+		n = MIN(count, win);
+		for (i = 0, io_len = 0; i < n; i++) {
+			memcpy(io_buf + io_len, &cmd, cmd_len);
+			io_len += cmd_len;
+			memcpy(io_buf + io_len, services + i * ns->service_len,
+			       ns->service_len);
+			io_len += ns->service_len;
+			memcpy(io_buf + io_len, names + i * ns->name_len,
+			       ns->name_len);
+			io_len += ns->name_len;
+
+			(void) util_ns_map_del(ns, peer->name_cache,
+					       services + i * ns->service_len,
+					       NULL);
+		}
+		ret = util_ns_peer_send(ns, peer, io_buf, io_len);
+	}
+out:
+	fastlock_release(&ns->lock);
 	free(io_buf);
+	return ret;
+}
 
-	io_len = ns->service_len + ns->name_len;
-	io_buf = calloc(io_len, 1);
-	if (!io_buf)
-		goto err2;
+int ofi_ns_add_local_names(struct util_ns *ns, void *services, void *names,
+			   size_t count)
+{
+	return util_ns_update(ns, OFI_UTIL_NS_ADD, services, names, count);
+}
 
-	ret = util_ns_read_socket_op(sockfd, &cmd, cmd_len);
-	if (ret < 0 || cmd.status)
-		goto err3;
+int ofi_ns_add_local_name(struct util_ns *ns, void *service, void *name)
+{
+	return util_ns_update(ns, OFI_UTIL_NS_ADD, service, name, 1);
+}
 
-	ret = util_ns_read_socket_op(sockfd, io_buf, io_len);
-	if (ret == io_len) {
-		dest_addr = calloc(ns->name_len, 1);
-		if (!dest_addr)
-			goto err3;
-		io_len = 0;
-		memcpy(service, (void *)((char *)io_buf + io_len),
-		       ns->service_len);
-		io_len += ns->service_len;
-		memcpy(dest_addr, (void *)((char *)io_buf + io_len),
-		       ns->name_len);
+int ofi_ns_del_local_name(struct util_ns *ns, void *service, void *name)
+{
+	return util_ns_update(ns, OFI_UTIL_NS_DEL, service, name, 1);
+}
+
+/*
+ * Resolves count services from server.  Wildcard services are replaced
+ * by the service found.  status[i] is set to 0 if services[i] was
+ * resolved into names[i], or to -FI_ENOENT.  Names resolved less than
+ * OFI_NS_CACHE_TTL ms earlier are returned from the cache, except for
+ * wildcard services.
+ */
+int ofi_ns_resolve_names(struct util_ns *ns, const char *server,
+			 void *services, void *names, int *status,
+			 size_t count)
+{
+	struct util_ns_peer *peer;
+	char *service, *name;
+	size_t i, *idx, n = 0;
+	int ret;
+
+	if (!ns->is_initialized)
+		return -FI_EINVAL;
+
+	idx = calloc(count, sizeof(*idx));
+	if (!idx)
+		return -FI_ENOMEM;
+
+	fastlock_acquire(&ns->lock);
+	peer = util_ns_get_peer(ns, server);
+	if (!peer) {
+		ret = -FI_ENOMEM;
+		goto out;
 	}
 
-err3:
-	free(io_buf);
-err2:
-	ofi_close_socket(sockfd);
-err1:
+	for (i = 0; i < count; i++) {
+		service = (char *) services + i * ns->service_len;
+		name = (char *) names + i * ns->name_len;
+		if ((ns->is_service_wildcard &&
+		     ns->is_service_wildcard(service)) ||
+		    util_ns_cache_lookup(ns, peer, service, name))
+			idx[n++] = i;
+		else
+			status[i] = 0;
+	}
+
+	ret = util_ns_peer_query(ns, peer, services, names, status, idx, n);
+out:
+	fastlock_release(&ns->lock);
+	free(idx);
+	return ret;
+}
+
+void *ofi_ns_resolve_name(struct util_ns *ns, const char *server_hostname,
+			  void *service)
+{
+	void *dest_addr;
+	int status;
+
+	dest_addr = calloc(1, ns->name_len);
+	if (!dest_addr)
+		return NULL;
+
+	if (ofi_ns_resolve_names(ns, server_hostname, service, dest_addr,
+				 &status, 1) || status) {
+		free(dest_addr);
+		return NULL;
+	}
 	return dest_addr;
 }
 
+static void util_ns_client_fini(struct util_ns *ns)
+{
+	struct util_ns_peer *peer;
+
+	while (!dlist_empty(&ns->peer_list)) {
+		dlist_pop_front(&ns->peer_list, struct util_ns_peer,
+				peer, entry);
+		util_ns_peer_disconnect(ns, peer);
+		util_ns_map_fini(peer->name_cache);
+		free(peer->hostname);
+		free(peer);
+	}
+	fastlock_destroy(&ns->lock);
+	free(ns->ns_hostname);
+	ns->ns_hostname = NULL;
+}
+
 /*
  * Name server API: server side
  */
@@ -545,8 +937,7 @@ void ofi_ns_start_server(struct util_ns *ns)
 	int ret;
 	SOCKET sockfd;
 	int sleep_usec = 1000;
-	char *server_hostname = (ns->ns_hostname ?
-		ns->ns_hostname : OFI_NS_DEFAULT_HOSTNAME);
+	const char *server_hostname = util_ns_local_hostname(ns);
 
 	if ((!ns->is_initialized) || (ofi_atomic_inc32(&ns->ref) > 1))
 		return;
@@ -586,14 +977,24 @@ void ofi_ns_stop_server(struct util_ns *ns)
 		ns->is_initialized = 0;
 		ofi_osd_fini();
 
-		if (pthread_equal(ns->ns_thread, pthread_self()))
-			return;
-
-		(void) pthread_cancel(ns->ns_thread);
-		(void) pthread_join(ns->ns_thread, NULL);
+		if (!pthread_equal(ns->ns_thread, pthread_self())) {
+			(void) pthread_cancel(ns->ns_thread);
+			(void) pthread_join(ns->ns_thread, NULL);
+		}
+		util_ns_client_fini(ns);
 	}
 }
 
+/* Releases a name server object whose server was never started */
+void ofi_ns_fini(struct util_ns *ns)
+{
+	if (!ns->is_initialized || ofi_atomic_get32(&ns->ref))
+		return;
+
+	ns->is_initialized = 0;
+	util_ns_client_fini(ns);
+}
+
 int ofi_ns_init(struct util_ns_attr *attr, struct util_ns *ns)
 {
 	if (!ns || !attr || !attr->name_len ||
@@ -615,5 +1016,9 @@ int ofi_ns_init(struct util_ns_attr *attr, struct util_ns *ns)
 	if (attr->ns_hostname)
 		ns->ns_hostname = strdup(attr->ns_hostname);
 
+	fastlock_init(&ns->lock);
+	dlist_init(&ns->peer_list);
+	ns->peer_conn_cnt = 0;
+
 	return FI_SUCCESS;
 }
@@ -37,10 +37,125 @@
 #include <fi_util.h>
 
 
+struct util_poll_entry {
+	struct dlist_entry	entry;
+	struct dlist_entry	notify_entry;
+	struct dlist_entry	ready_entry;
+	ofi_atomic32_t		ready;
+	struct util_poll	*pollset;
+	struct util_poll_notify	*notify;
+	struct fid		*fid;
+	uint64_t		checkpoint_cnt;
+	uint64_t		checkpoint_err;
+	uint64_t		checkpoint_gen;
+};
+
+/* Notify objects of all open CQs, counters and EQs, looked up by poll_add */
+static DEFINE_LIST(util_poll_notify_list);
+static pthread_mutex_t util_poll_notify_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Moves all entries of src to the tail of dst */
+static void util_poll_splice_tail(struct dlist_entry *dst,
+				  struct dlist_entry *src)
+{
+	if (dlist_empty(src))
+		return;
+
+	src->next->prev = dst->prev;
+	dst->prev->next = src->next;
+	src->prev->next = dst;
+	dst->prev = src->prev;
+	dlist_init(src);
+}
+
+static void util_poll_entry_ready(struct util_poll_entry *poll_entry)
+{
+	struct util_poll *pollset = poll_entry->pollset;
+
+	if (ofi_atomic_get32(&poll_entry->ready) ||
+	    !ofi_atomic_cas_bool32(&poll_entry->ready, 0, 1))
+		return;
+
+	fastlock_acquire(&pollset->ready_lock);
+	dlist_insert_tail(&poll_entry->ready_entry, &pollset->ready_list);
+	fastlock_release(&pollset->ready_lock);
+}
+
+void ofi_poll_notify_init(struct util_poll_notify *notify, struct fid *fid)
+{
+	notify->fid = fid;
+	dlist_init(&notify->poll_list);
+	fastlock_init(&notify->lock);
+
+	pthread_mutex_lock(&util_poll_notify_lock);
+	dlist_insert_tail(&notify->entry, &util_poll_notify_list);
+	pthread_mutex_unlock(&util_poll_notify_lock);
+}
+
+void ofi_poll_notify_cleanup(struct util_poll_notify *notify)
+{
+	struct util_poll_entry *poll_entry;
+
+	pthread_mutex_lock(&util_poll_notify_lock);
+	dlist_remove(&notify->entry);
+
+	/* Members left in a poll set fall back to being checked each run */
+	fastlock_acquire(&notify->lock);
+	while (!dlist_empty(&notify->poll_list)) {
+		dlist_pop_front(&notify->poll_list, struct util_poll_entry,
+				poll_entry, notify_entry);
+		poll_entry->notify = NULL;
+		util_poll_entry_ready(poll_entry);
+	}
+	fastlock_release(&notify->lock);
+	pthread_mutex_unlock(&util_poll_notify_lock);
+
+	fastlock_destroy(&notify->lock);
+}
+
+void ofi_poll_notify_ready(struct util_poll_notify *notify)
+{
+	struct util_poll_entry *poll_entry;
+
+	fastlock_acquire(&notify->lock);
+	dlist_foreach_container(&notify->poll_list, struct util_poll_entry,
+				poll_entry, notify_entry)
+		util_poll_entry_ready(poll_entry);
+	fastlock_release(&notify->lock);
+}
+
+static struct util_poll_notify *util_poll_find_notify(struct fid *fid)
+{
+	struct util_poll_notify *notify;
+
+	dlist_foreach_container(&util_poll_notify_list, struct util_poll_notify,
+				notify, entry) {
+		if (notify->fid == fid)
+			return notify;
+	}
+	return NULL;
+}
+
+static struct util_poll_entry *
+util_poll_find_entry(struct util_poll *pollset, struct fid *fid)
+{
+	struct util_poll_entry *poll_entry;
+
+	dlist_foreach_container(&pollset->fid_list, struct util_poll_entry,
+				poll_entry, entry) {
+		if (poll_entry->fid == fid)
+			return poll_entry;
+	}
+	return NULL;
+}
+
 static int util_poll_add(struct fid_poll *poll_fid, struct fid *event_fid,
 			 uint64_t flags)
 {
 	struct util_poll *pollset;
+	struct util_poll_entry *poll_entry;
+	struct util_poll_notify *notify;
+	int ret = 0;
 
 	pollset = container_of(poll_fid, struct util_poll, poll_fid);
 	switch (event_fid->fclass) {
@@ -58,72 +173,245 @@ static int util_poll_add(struct fid_poll *poll_fid, struct fid *event_fid,
 		return -FI_EINVAL;
 	}
 
-	return fid_list_insert(&pollset->fid_list, &pollset->lock, event_fid);
+	fastlock_acquire(&pollset->lock);
+	if (util_poll_find_entry(pollset, event_fid))
+		goto out;
+
+	poll_entry = calloc(1, sizeof(*poll_entry));
+	if (!poll_entry) {
+		ret = -FI_ENOMEM;
+		goto out;
+	}
+
+	poll_entry->pollset = pollset;
+	poll_entry->fid = event_fid;
+	ofi_atomic_initialize32(&poll_entry->ready, 0);
+	dlist_insert_tail(&poll_entry->entry, &pollset->fid_list);
+
+	pthread_mutex_lock(&util_poll_notify_lock);
+	notify = util_poll_find_notify(event_fid);
+	if (notify) {
+		poll_entry->notify = notify;
+		fastlock_acquire(&notify->lock);
+		dlist_insert_tail(&poll_entry->notify_entry,
+				  &notify->poll_list);
+		fastlock_release(&notify->lock);
+	}
+	pthread_mutex_unlock(&util_poll_notify_lock);
+
+	/* Events may have been generated before the member was added */
+	util_poll_entry_ready(poll_entry);
+out:
+	fastlock_release(&pollset->lock);
+	return ret;
+}
+
+/* Caller must hold pollset->lock */
+static void util_poll_remove_entry(struct util_poll *pollset,
+				   struct util_poll_entry *poll_entry)
+{
+	dlist_remove(&poll_entry->entry);
+
+	if (poll_entry->notify) {
+		fastlock_acquire(&poll_entry->notify->lock);
+		dlist_remove(&poll_entry->notify_entry);
+		fastlock_release(&poll_entry->notify->lock);
+	}
+
+	fastlock_acquire(&pollset->ready_lock);
+	if (ofi_atomic_get32(&poll_entry->ready))
+		dlist_remove(&poll_entry->ready_entry);
+	fastlock_release(&pollset->ready_lock);
+	free(poll_entry);
 }
 
 static int util_poll_del(struct fid_poll *poll_fid, struct fid *event_fid,
 			 uint64_t flags)
 {
 	struct util_poll *pollset;
+	struct util_poll_entry *poll_entry;
 
 	pollset = container_of(poll_fid, struct util_poll, poll_fid);
-	fid_list_remove(&pollset->fid_list, &pollset->lock, event_fid);
+	fastlock_acquire(&pollset->lock);
+	poll_entry = util_poll_find_entry(pollset, event_fid);
+	if (poll_entry)
+		util_poll_remove_entry(pollset, poll_entry);
+	fastlock_release(&pollset->lock);
 	return 0;
 }
 
-static int util_poll_run(struct fid_poll *poll_fid, void **context, int count)
+/*
+ * Progress the endpoints bound to a member, skipping any endpoint that was
+ * already progressed through another member during this run.
+ */
+static void util_poll_progress_eps(struct util_poll *pollset,
+				   struct dlist_entry *ep_list,
+				   ofi_lock_t *ep_list_lock)
+{
+	struct fid_list_entry *fid_entry;
+	struct util_ep *ep;
+
+	ofi_lock_acquire(ep_list_lock);
+	dlist_foreach_container(ep_list, struct fid_list_entry,
+				fid_entry, entry) {
+		ep = container_of(fid_entry->fid, struct util_ep, ep_fid.fid);
+		if (ep->progress_poll == pollset &&
+		    ep->progress_gen == pollset->progress_gen)
+			continue;
+
+		ep->progress_poll = pollset;
+		ep->progress_gen = pollset->progress_gen;
+		ep->progress(ep);
+	}
+	ofi_lock_release(ep_list_lock);
+}
+
+static void util_poll_progress(struct util_poll *pollset,
+			       struct util_poll_entry *poll_entry)
 {
-	struct util_poll *pollset;
-	struct util_eq *eq;
 	struct util_cq *cq;
 	struct util_cntr *cntr;
-	struct fid_list_entry *fid_entry;
-	struct dlist_entry *item;
+
+	switch (poll_entry->fid->fclass) {
+	case FI_CLASS_CQ:
+		cq = container_of(poll_entry->fid, struct util_cq, cq_fid.fid);
+		if (cq->progress == ofi_cq_progress)
+			util_poll_progress_eps(pollset, &cq->ep_list,
+					       &cq->ep_list_lock);
+		else
+			cq->progress(cq);
+		break;
+	case FI_CLASS_CNTR:
+		cntr = container_of(poll_entry->fid, struct util_cntr,
+				    cntr_fid.fid);
+		if (cntr->progress == ofi_cntr_progress)
+			util_poll_progress_eps(pollset, &cntr->ep_list,
+					       &cntr->ep_list_lock);
+		else
+			cntr->progress(cntr);
+		break;
+	default:
+		break;
+	}
+}
+
+static int util_poll_check_cntr(struct util_poll_entry *poll_entry,
+				uint64_t cnt, uint64_t err, uint64_t gen)
+{
+	int ret;
+
+	ret = cnt != poll_entry->checkpoint_cnt ||
+	      err != poll_entry->checkpoint_err ||
+	      gen != poll_entry->checkpoint_gen;
+	poll_entry->checkpoint_cnt = cnt;
+	poll_entry->checkpoint_err = err;
+	poll_entry->checkpoint_gen = gen;
+	return ret;
+}
+
+/* Members with a notify object, checked without driving progress */
+static int util_poll_check(struct util_poll_entry *poll_entry)
+{
+	struct util_cq *cq;
+	struct util_cntr *cntr;
+	struct util_eq *eq;
+
+	switch (poll_entry->fid->fclass) {
+	case FI_CLASS_CQ:
+		cq = container_of(poll_entry->fid, struct util_cq, cq_fid.fid);
+		return !ofi_cirque_isempty(cq->cirq) ||
+		       !slist_empty(&cq->err_list);
+	case FI_CLASS_CNTR:
+		cntr = container_of(poll_entry->fid, struct util_cntr,
+				    cntr_fid.fid);
+		return util_poll_check_cntr(poll_entry,
+					    ofi_atomic_get64(&cntr->cnt),
+					    ofi_atomic_get64(&cntr->err),
+					    ofi_atomic_get64(&cntr->wake_gen));
+	case FI_CLASS_EQ:
+		eq = container_of(poll_entry->fid, struct util_eq, eq_fid.fid);
+		return !slist_empty(&eq->list);
+	default:
+		return -FI_EINVAL;
+	}
+}
+
+/* Members without a notify object, checked through their interfaces */
+static int util_poll_check_fid(struct util_poll_entry *poll_entry)
+{
+	struct fid_cntr *cntr_fid;
+	int ret;
+
+	switch (poll_entry->fid->fclass) {
+	case FI_CLASS_CQ:
+		ret = fi_cq_read(container_of(poll_entry->fid, struct fid_cq,
+					      fid), NULL, 0);
+		return (ret == 0 || ret == -FI_EAVAIL) ? 1 : ret;
+	case FI_CLASS_CNTR:
+		cntr_fid = container_of(poll_entry->fid, struct fid_cntr, fid);
+		return util_poll_check_cntr(poll_entry, fi_cntr_read(cntr_fid),
+					    fi_cntr_readerr(cntr_fid),
+					    poll_entry->checkpoint_gen);
+	case FI_CLASS_EQ:
+		ret = fi_eq_read(container_of(poll_entry->fid, struct fid_eq,
+					      fid), NULL, NULL, 0, FI_PEEK);
+		return (ret == 0 || ret == -FI_EAVAIL) ? 1 : ret;
+	default:
+		return -FI_EINVAL;
+	}
+}
+
+static int util_poll_run(struct fid_poll *poll_fid, void **context, int count)
+{
+	struct util_poll *pollset;
+	struct util_poll_entry *poll_entry;
+	struct dlist_entry ready_list, requeue_list;
 	int ret, i = 0, err = 0;
-	uint64_t val;
 
 	pollset = container_of(poll_fid, struct util_poll, poll_fid.fid);
+	dlist_init(&ready_list);
+	dlist_init(&requeue_list);
 
 	fastlock_acquire(&pollset->lock);
-	dlist_foreach(&pollset->fid_list, item) {
-		fid_entry = container_of(item, struct fid_list_entry, entry);
-		switch (fid_entry->fid->fclass) {
-		case FI_CLASS_CQ:
-			cq = container_of(fid_entry->fid, struct util_cq,
-					  cq_fid.fid);
-			ret = fi_cq_read(&cq->cq_fid, NULL, 0);
-			if (ret == 0 || ret == -FI_EAVAIL)
-				ret = 1;
-			break;
-		case FI_CLASS_CNTR:
-			cntr = container_of(fid_entry->fid, struct util_cntr,
-					    cntr_fid.fid);
-			val = fi_cntr_read(&cntr->cntr_fid);
-			if ((ret = (val != cntr->checkpoint_cnt))) {
-				cntr->checkpoint_cnt = val;
-			} else {
-				val = fi_cntr_readerr(&cntr->cntr_fid);
-				if ((ret = (val != cntr->checkpoint_err)))
-					cntr->checkpoint_err = val;
-			}
-			break;
-		case FI_CLASS_EQ:
-			eq = container_of(fid_entry->fid, struct util_eq,
-					  eq_fid.fid);
-			ret = fi_eq_read(&eq->eq_fid, NULL, NULL, 0, FI_PEEK);
-			if (ret == 0 || ret == -FI_EAVAIL)
-				ret = 1;
-			break;
-		default:
-			ret = -FI_EINVAL;
-			break;
+	pollset->progress_gen++;
+	dlist_foreach_container(&pollset->fid_list, struct util_poll_entry,
+				poll_entry, entry) {
+		if (poll_entry->notify)
+			util_poll_progress(pollset, poll_entry);
+	}
+
+	fastlock_acquire(&pollset->ready_lock);
+	util_poll_splice_tail(&ready_list, &pollset->ready_list);
+	fastlock_release(&pollset->ready_lock);
+
+	while (!dlist_empty(&ready_list) && i < count) {
+		dlist_pop_front(&ready_list, struct util_poll_entry,
+				poll_entry, ready_entry);
+		if (poll_entry->notify) {
+			/* Clear before checking so that new events requeue */
+			ofi_atomic_cas_bool32(&poll_entry->ready, 1, 0);
+			ret = util_poll_check(poll_entry);
+			/* CQs and EQs remain ready until they are drained */
+			if (ret > 0 && poll_entry->fid->fclass != FI_CLASS_CNTR)
+				util_poll_entry_ready(poll_entry);
+		} else {
+			ret = util_poll_check_fid(poll_entry);
+			dlist_insert_tail(&poll_entry->ready_entry,
+					  &requeue_list);
 		}
 
-		if (ret > 0 && i < count)
-			context[i++] = fid_entry->fid->context;
+		if (ret > 0)
+			context[i++] = poll_entry->fid->context;
 		else if (ret < 0 && ret != -FI_EAGAIN)
 			err = ret;
 	}
+
+	/* Unchecked entries go first, then new events, then polled members */
+	fastlock_acquire(&pollset->ready_lock);
+	util_poll_splice_tail(&ready_list, &pollset->ready_list);
+	util_poll_splice_tail(&ready_list, &requeue_list);
+	util_poll_splice_tail(&pollset->ready_list, &ready_list);
+	fastlock_release(&pollset->ready_lock);
 	fastlock_release(&pollset->lock);
 	return i ? i : err;
 }
@@ -136,6 +424,17 @@ static int util_poll_close(struct fid *fid)
 	if (ofi_atomic_get32(&pollset->ref))
 		return -FI_EBUSY;
 
+	fastlock_acquire(&pollset->lock);
+	while (!dlist_empty(&pollset->fid_list)) {
+		util_poll_remove_entry(pollset, container_of(
+				pollset->fid_list.next, struct util_poll_entry,
+				entry));
+	}
+	fastlock_release(&pollset->lock);
+
+	fastlock_destroy(&pollset->ready_lock);
+	fastlock_destroy(&pollset->lock);
+
 	if (pollset->domain)
 		ofi_atomic_dec32(&pollset->domain->ref);
 	free(pollset);
@@ -186,6 +485,8 @@ int fi_poll_create_(const struct fi_provider *prov, struct fid_domain *domain,
 	ofi_atomic_initialize32(&pollset->ref, 0);
 	dlist_init(&pollset->fid_list);
 	fastlock_init(&pollset->lock);
+	dlist_init(&pollset->ready_list);
+	fastlock_init(&pollset->ready_lock);
 
 	pollset->poll_fid.fid.fclass = FI_CLASS_POLL;
 	pollset->poll_fid.fid.ops = &util_poll_fi_ops;
@@ -0,0 +1,177 @@
+/*
+ * Copyright (c) 2017 Intel Corporation. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include <fi.h>
+#include <fi_util.h>
+
+
+static size_t ofi_stats_slots(const struct ofi_stat_def *defs, size_t def_cnt)
+{
+	size_t i, count = 0;
+
+	for (i = 0; i < def_cnt; i++)
+		count += (defs[i].type == OFI_STAT_HIST) ? OFI_STAT_HIST_BUCKETS : 1;
+	return count;
+}
+
+static void ofi_stats_set_names(struct ofi_stats *stats,
+				const struct ofi_stat_def *defs, size_t def_cnt)
+{
+	size_t i, j, slot;
+
+	for (i = 0, slot = 0; i < def_cnt; i++) {
+		stats->slot[i] = slot;
+		if (defs[i].type != OFI_STAT_HIST) {
+			snprintf(stats->names[slot++], OFI_STAT_NAME_MAX, "%s",
+				 defs[i].name);
+			continue;
+		}
+
+		snprintf(stats->names[slot++], OFI_STAT_NAME_MAX, "%s_lt_1",
+			 defs[i].name);
+		for (j = 1; j < OFI_STAT_HIST_BUCKETS - 1; j++) {
+			snprintf(stats->names[slot++], OFI_STAT_NAME_MAX,
+				 "%s_lt_%" PRIu64, defs[i].name, (uint64_t) 1 << j);
+		}
+		snprintf(stats->names[slot++], OFI_STAT_NAME_MAX,
+			 "%s_ge_%" PRIu64, defs[i].name,
+			 (uint64_t) 1 << (OFI_STAT_HIST_BUCKETS - 2));
+	}
+}
+
+static int ofi_stats_publish(struct ofi_stats *stats, const char *object,
+			     size_t size)
+{
+	char name[FI_NAME_MAX];
+	void *mapped;
+	int ret;
+
+	snprintf(name, sizeof(name), "ofi_stats.%d.%s.%s.%" PRIxPTR,
+		 (int) getpid(), stats->prov->name, object, (uintptr_t) stats);
+
+	ret = ofi_shm_map(&stats->shm, name, size, 0, &mapped);
+	if (ret) {
+		FI_WARN(stats->prov, FI_LOG_CORE,
+			"unable to publish stats to %s\n", name);
+		return ret;
+	}
+
+	memset(mapped, 0, size);
+	stats->hdr = mapped;
+	stats->published = 1;
+	FI_INFO(stats->prov, FI_LOG_CORE, "publishing stats to %s\n", name);
+	return 0;
+}
+
+int ofi_stats_init(const struct fi_provider *prov, struct ofi_stats *stats,
+		   const struct ofi_stat_def *defs, size_t def_cnt,
+		   const char *object)
+{
+	size_t size;
+	int publish = 0;
+
+	memset(stats, 0, sizeof(*stats));
+	stats->prov = prov;
+	stats->count = ofi_stats_slots(defs, def_cnt);
+
+	stats->slot = calloc(def_cnt, sizeof(*stats->slot));
+	if (!stats->slot)
+		return -FI_ENOMEM;
+
+	size = sizeof(*stats->hdr) + stats->count * OFI_STAT_NAME_MAX;
+	size = fi_get_aligned_sz(size, sizeof(uint64_t));
+	size += stats->count * sizeof(*stats->values);
+
+	fi_param_get_bool(NULL, "stats_shm", &publish);
+	if (!publish || ofi_stats_publish(stats, object, size)) {
+		stats->hdr = calloc(1, size);
+		if (!stats->hdr) {
+			free(stats->slot);
+			return -FI_ENOMEM;
+		}
+	}
+
+	stats->names = (void *) (stats->hdr + 1);
+	stats->values = (ofi_stat_t *) ((char *) stats->hdr +
+			 fi_get_aligned_sz(sizeof(*stats->hdr) +
+					   stats->count * OFI_STAT_NAME_MAX,
+					   sizeof(uint64_t)));
+	ofi_stats_set_names(stats, defs, def_cnt);
+
+	snprintf(stats->hdr->prov, OFI_STAT_NAME_MAX, "%s", prov->name);
+	snprintf(stats->hdr->object, OFI_STAT_NAME_MAX, "%s", object);
+	stats->hdr->pid = (uint64_t) getpid();
+	stats->hdr->count = (uint32_t) stats->count;
+	stats->hdr->name_len = OFI_STAT_NAME_MAX;
+	stats->hdr->version = OFI_STATS_SHM_VERSION;
+	stats->hdr->magic = OFI_STATS_SHM_MAGIC;
+	return 0;
+}
+
+void ofi_stats_close(struct ofi_stats *stats)
+{
+	if (!stats->hdr)
+		return;
+
+	if (stats->published)
+		ofi_shm_unmap(&stats->shm);
+	else
+		free(stats->hdr);
+	free(stats->slot);
+	stats->hdr = NULL;
+}
+
+int ofi_stats_query(struct ofi_stats *stats, struct fi_stats *query)
+{
+	size_t i;
+
+	if (!query)
+		return -FI_EINVAL;
+
+	if (query->count < stats->count || !query->stats) {
+		query->count = stats->count;
+		return -FI_ETOOSMALL;
+	}
+
+	for (i = 0; i < stats->count; i++) {
+		query->stats[i].name = stats->names[i];
+		query->stats[i].value = ofi_stat_get_(&stats->values[i]);
+	}
+	query->count = stats->count;
+	return 0;
+}
@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2017 Intel Corporation. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Queue of triggered operations, see struct ofi_trigger_queue.  Kept
+ * apart from the counters so that it can be tested on its own.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdlib.h>
+
+#include <fi_util.h>
+
+static inline int ofi_trigger_before(struct ofi_trigger *a,
+				     struct ofi_trigger *b)
+{
+	return (a->threshold < b->threshold) ||
+	       (a->threshold == b->threshold && a->seq < b->seq);
+}
+
+void ofi_trigger_queue_init(struct ofi_trigger_queue *queue)
+{
+	queue->heap = NULL;
+	queue->count = 0;
+	queue->size = 0;
+	queue->seq = 0;
+}
+
+void ofi_trigger_queue_cleanup(struct ofi_trigger_queue *queue)
+{
+	free(queue->heap);
+	ofi_trigger_queue_init(queue);
+}
+
+int ofi_trigger_insert(struct ofi_trigger_queue *queue,
+		       struct ofi_trigger *trigger, uint64_t threshold)
+{
+	struct ofi_trigger **heap;
+	size_t i, parent;
+
+	if (queue->count == queue->size) {
+		heap = realloc(queue->heap, sizeof(*heap) *
+			       (queue->size ? queue->size * 2 : 64));
+		if (!heap)
+			return -FI_ENOMEM;
+		queue->heap = heap;
+		queue->size = queue->size ? queue->size * 2 : 64;
+	}
+
+	trigger->threshold = threshold;
+	trigger->seq = queue->seq++;
+
+	for (i = queue->count++; i; i = parent) {
+		parent = (i - 1) / 2;
+		if (!ofi_trigger_before(trigger, queue->heap[parent]))
+			break;
+		queue->heap[i] = queue->heap[parent];
+	}
+	queue->heap[i] = trigger;
+	return 0;
+}
+
+void ofi_trigger_pop(struct ofi_trigger_queue *queue)
+{
+	struct ofi_trigger *last;
+	size_t i, child;
+
+	assert(queue->count);
+	last = queue->heap[--queue->count];
+
+	for (i = 0; (child = 2 * i + 1) < queue->count; i = child) {
+		if (child + 1 < queue->count &&
+		    ofi_trigger_before(queue->heap[child + 1],
+				       queue->heap[child]))
+			child++;
+		if (!ofi_trigger_before(queue->heap[child], last))
+			break;
+		queue->heap[i] = queue->heap[child];
+	}
+	if (queue->count)
+		queue->heap[i] = last;
+}
@@ -38,6 +38,20 @@
 #include <fi_util.h>
 
 
+struct fi_wait_spin ofi_wait_spin_default = {
+	.max_usec = 50,
+	.adaptive = 1,
+};
+
+static const struct ofi_stat_def util_wait_stat_defs[OFI_WAIT_STAT_MAX] = {
+	[OFI_WAIT_STAT_SPIN_HITS] = {"spin_hits", OFI_STAT_COUNTER},
+	[OFI_WAIT_STAT_SPIN_MISSES] = {"spin_misses", OFI_STAT_COUNTER},
+	[OFI_WAIT_STAT_SLEEPS] = {"sleeps", OFI_STAT_COUNTER},
+	[OFI_WAIT_STAT_SPIN_NS] = {"spin_ns", OFI_STAT_COUNTER},
+	[OFI_WAIT_STAT_SLEEP_NS] = {"sleep_ns", OFI_STAT_COUNTER},
+	[OFI_WAIT_STAT_SPIN_INTERVAL] = {"spin_interval_ns", OFI_STAT_GAUGE},
+};
+
 int ofi_trywait(struct fid_fabric *fabric, struct fid **fids, int count)
 {
 	struct util_cq *cq;
@@ -103,6 +117,7 @@ int fi_wait_cleanup(struct util_wait *wait)
 	if (ret)
 		return ret;
 
+	ofi_stats_close(&wait->stats);
 	ofi_atomic_dec32(&wait->fabric->ref);
 	return 0;
 }
@@ -131,11 +146,20 @@ int fi_wait_init(struct util_fabric *fabric, struct fi_wait_attr *attr,
 		return -FI_EINVAL;
 	}
 
+	ret = ofi_stats_init(fabric->prov, &wait->stats, util_wait_stat_defs,
+			     OFI_WAIT_STAT_MAX, "wait");
+	if (ret)
+		return ret;
+
 	memset(&poll_attr, 0, sizeof poll_attr);
 	ret = fi_poll_create_(fabric->prov, NULL, &poll_attr, &poll_fid);
-	if (ret)
+	if (ret) {
+		ofi_stats_close(&wait->stats);
 		return ret;
+	}
 
+	wait->spin = ofi_wait_spin_default;
+	wait->wait_avg_ns = wait->spin.max_usec * 1000 / 2;
 	wait->pollset = container_of(poll_fid, struct util_poll, poll_fid);
 	wait->fabric = fabric;
 	ofi_atomic_inc32(&fabric->ref);
@@ -239,29 +263,111 @@ static int util_wait_fd_try(struct util_wait *wait)
 	return (ret > 0) ? -FI_EAGAIN : ret;
 }
 
+static uint64_t util_wait_spin_interval(struct util_wait *wait)
+{
+	uint64_t max_ns = wait->spin.max_usec * 1000;
+
+	if (!wait->spin.adaptive || !max_ns)
+		return max_ns;
+
+	if (wait->wait_avg_ns > max_ns)
+		return 0;
+	return MIN(max_ns, MAX(2 * wait->wait_avg_ns, max_ns / 8));
+}
+
+/*
+ * Poll the wait set until it is signaled or the spin interval expires.
+ * Returns the result of the last try, which is 0 if nothing was found.
+ */
+static int util_wait_spin(struct util_wait *wait, uint64_t start, int timeout)
+{
+	uint64_t interval, now;
+	int ret;
+
+	interval = util_wait_spin_interval(wait);
+	if (!interval)
+		return 0;
+
+	if (timeout >= 0)
+		interval = MIN(interval, (uint64_t) timeout * 1000000);
+
+	do {
+		ret = wait->try(wait);
+		now = fi_gettime_ns();
+		if (ret)
+			break;
+	} while (now - start < interval);
+
+	ofi_stats_inc(&wait->stats, ret ? OFI_WAIT_STAT_SPIN_HITS :
+					  OFI_WAIT_STAT_SPIN_MISSES);
+	ofi_stats_add(&wait->stats, OFI_WAIT_STAT_SPIN_NS, now - start);
+	return ret;
+}
+
+/* Learn from the time taken by this wait, including any sleep */
+static void util_wait_update(struct util_wait *wait, uint64_t start,
+			     uint64_t sleep_start)
+{
+	uint64_t now = fi_gettime_ns();
+	int64_t delta;
+
+	if (sleep_start) {
+		ofi_stats_inc(&wait->stats, OFI_WAIT_STAT_SLEEPS);
+		ofi_stats_add(&wait->stats, OFI_WAIT_STAT_SLEEP_NS,
+			      now - sleep_start);
+	}
+
+	delta = (int64_t) (now - start) - (int64_t) wait->wait_avg_ns;
+	wait->wait_avg_ns += delta / 8;
+	ofi_stats_set(&wait->stats, OFI_WAIT_STAT_SPIN_INTERVAL,
+		      util_wait_spin_interval(wait));
+}
+
 static int util_wait_fd_run(struct fid_wait *wait_fid, int timeout)
 {
 	struct util_wait_fd *wait;
-	uint64_t start;
+	uint64_t start, sleep_start = 0;
 	void *ep_context[1];
-	int ret;
+	int ret, remaining = -1;
 
 	wait = container_of(wait_fid, struct util_wait_fd, util_wait.wait_fid);
-	start = (timeout >= 0) ? fi_gettime_ms() : 0;
+	start = fi_gettime_ns();
 
-	while (1) {
+	ret = util_wait_spin(&wait->util_wait, start, timeout);
+	while (!ret) {
 		ret = wait->util_wait.try(&wait->util_wait);
 		if (ret)
-			return ret == -FI_EAGAIN ? 0 : ret;
+			break;
 
 		if (timeout >= 0) {
-			timeout -= (int) (fi_gettime_ms() - start);
-			if (timeout <= 0)
-				return -FI_ETIMEDOUT;
+			remaining = timeout - (int) ((fi_gettime_ns() - start) /
+						     1000000);
+			if (remaining <= 0) {
+				ret = -FI_ETIMEDOUT;
+				break;
+			}
 		}
 
-		fi_epoll_wait(wait->epoll_fd, ep_context, 1, timeout);
+		if (!sleep_start)
+			sleep_start = fi_gettime_ns();
+		fi_epoll_wait(wait->epoll_fd, ep_context, 1, remaining);
 	}
+
+	util_wait_update(&wait->util_wait, start, sleep_start);
+	return ret == -FI_EAGAIN ? 0 : ret;
+}
+
+static int util_wait_set_spin(struct util_wait *wait,
+			      const struct fi_wait_spin *spin)
+{
+	if (spin->adaptive != 0 && spin->adaptive != 1) {
+		FI_WARN(wait->prov, FI_LOG_FABRIC, "invalid spin setting\n");
+		return -FI_EINVAL;
+	}
+
+	wait->spin = *spin;
+	wait->wait_avg_ns = spin->max_usec * 1000 / 2;
+	return 0;
 }
 
 static int util_wait_fd_control(struct fid *fid, int command, void *arg)
@@ -279,6 +385,16 @@ static int util_wait_fd_control(struct fid *fid, int command, void *arg)
 		ret = -FI_ENOSYS;
 #endif
 		break;
+	case FI_GET_WAIT_SPIN:
+		*(struct fi_wait_spin *) arg = wait->util_wait.spin;
+		ret = 0;
+		break;
+	case FI_SET_WAIT_SPIN:
+		ret = util_wait_set_spin(&wait->util_wait, arg);
+		break;
+	case FI_GET_STATS:
+		ret = ofi_stats_query(&wait->util_wait.stats, arg);
+		break;
 	default:
 		FI_INFO(wait->util_wait.prov, FI_LOG_FABRIC,
 			"unsupported command\n");
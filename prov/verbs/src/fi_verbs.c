@@ -760,13 +760,18 @@ static int fi_ibv_read_params(void)
 
 static void fi_ibv_fini(void)
 {
+	fi_ibv_fini_ns();
 	fi_freeinfo((void *)fi_ibv_util_prov.info);
 	fi_ibv_util_prov.info = NULL;
 }
 
 VERBS_INI
 {
-	if (fi_ibv_read_params()|| fi_ibv_init_info(&fi_ibv_util_prov.info))
+	if (fi_ibv_read_params() || fi_ibv_init_ns())
 		return NULL;
+	if (fi_ibv_init_info(&fi_ibv_util_prov.info)) {
+		fi_ibv_fini_ns();
+		return NULL;
+	}
 	return &fi_ibv_prov;
 }
@@ -434,6 +434,8 @@ int fi_ibv_sockaddr_len(struct sockaddr *addr);
 
 
 int fi_ibv_init_info(const struct fi_info **all_infos);
+int fi_ibv_init_ns(void);
+void fi_ibv_fini_ns(void);
 int fi_ibv_getinfo(uint32_t version, const char *node, const char *service,
 		   uint64_t flags, const struct fi_info *hints,
 		   struct fi_info **info);
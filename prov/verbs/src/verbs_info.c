@@ -1223,30 +1223,40 @@ static int fi_ibv_del_info_not_belong_to_dev(const char *dev_name, struct fi_inf
 	return FI_SUCCESS;
 }
 
-static int fi_ibv_resolve_ib_ud_dest_addr(const char *node, const char *service,
-					  struct ofi_ib_ud_ep_name **dest_addr)
+/*
+ * Name server client used by fi_getinfo to resolve node:service into
+ * an IB UD address.  It lives as long as the provider, so connections
+ * to remote name servers and the names resolved are reused across calls.
+ */
+static struct util_ns fi_ibv_ns;
+
+int fi_ibv_init_ns(void)
 {
-	int ret, svc = VERBS_IB_UD_NS_ANY_SERVICE;
-	struct util_ns ns = { 0 };
 	struct util_ns_attr ns_attr = {
 		.ns_port = fi_ibv_gl_data.dgram.name_server_port,
-		.name_len = sizeof(**dest_addr),
-		.service_len = sizeof(svc),
+		.name_len = sizeof(struct ofi_ib_ud_ep_name),
+		.service_len = sizeof(int),
 		.service_cmp = fi_ibv_dgram_ns_service_cmp,
 		.is_service_wildcard = fi_ibv_dgram_ns_is_service_wildcard,
 	};
 
-	ret = ofi_ns_init(&ns_attr, &ns);
-	if (ret) {
-		VERBS_INFO(FI_LOG_CORE,
-			   "ofi_ns_init returns %d\n", ret);
-		return -FI_ENODATA;
-	}
+	return ofi_ns_init(&ns_attr, &fi_ibv_ns);
+}
+
+void fi_ibv_fini_ns(void)
+{
+	ofi_ns_fini(&fi_ibv_ns);
+}
+
+static int fi_ibv_resolve_ib_ud_dest_addr(const char *node, const char *service,
+					  struct ofi_ib_ud_ep_name **dest_addr)
+{
+	int svc = VERBS_IB_UD_NS_ANY_SERVICE;
 
 	if (service)
 		svc = atoi(service);
 	*dest_addr = (struct ofi_ib_ud_ep_name *)
-		ofi_ns_resolve_name(&ns, node, &svc);
+		ofi_ns_resolve_name(&fi_ibv_ns, node, &svc);
 	if (*dest_addr) {
 		VERBS_INFO_NODE_2_UD_ADDR(FI_LOG_CORE, node, svc, *dest_addr);
 	} else {
@@ -1255,7 +1265,7 @@ static int fi_ibv_resolve_ib_ud_dest_addr(const char *node, const char *service,
 		return -FI_ENODATA;
 	}
 
-	return ret;
+	return 0;
 }
 
 static int fi_ibv_handle_ib_ud_addr(const char *node, const char *service,
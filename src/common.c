@@ -45,6 +45,7 @@
 #include <poll.h>
 #include <pthread.h>
 #include <sys/time.h>
+#include <time.h>
 
 #include <inttypes.h>
 #include <netinet/in.h>
@@ -196,6 +197,14 @@ uint64_t fi_gettime_us(void)
 	return now.tv_sec * 1000000 + now.tv_usec;
 }
 
+uint64_t fi_gettime_ns(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
 const char *ofi_straddr(char *buf, size_t *len,
 			uint32_t addr_format, const void *addr)
 {
@@ -592,6 +601,7 @@ int fi_epoll_del(struct fi_epoll *ep, int fd)
 	for (i = 0; i < ep->nfds; i++) {
 		if (ep->fds[i].fd == fd) {
 			ep->fds[i].fd = ep->fds[ep->nfds - 1].fd;
+			ep->fds[i].events = ep->fds[ep->nfds - 1].events;
 			ep->context[i] = ep->context[--ep->nfds];
       			return 0;
 		}
@@ -599,6 +609,20 @@ int fi_epoll_del(struct fi_epoll *ep, int fd)
 	return -FI_EINVAL;
 }
 
+int fi_epoll_mod(struct fi_epoll *ep, int fd, uint32_t events, void *context)
+{
+	int i;
+
+	for (i = 0; i < ep->nfds; i++) {
+		if (ep->fds[i].fd == fd) {
+			ep->fds[i].events = events;
+			ep->context[i] = context;
+			return 0;
+		}
+	}
+	return -FI_EINVAL;
+}
+
 int fi_epoll_wait(struct fi_epoll *ep, void **contexts, int max_contexts,
                   int timeout)
 {
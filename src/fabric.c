@@ -35,6 +35,7 @@
 #include "config.h"
 
 #include <assert.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -43,6 +44,7 @@
 #include <rdma/fi_errno.h>
 #include "fi_util.h"
 #include "fi.h"
+#include "fi_trace.h"
 #include "prov.h"
 
 #ifdef HAVE_LIBDL
@@ -57,6 +59,7 @@ struct ofi_prov {
 };
 
 static struct ofi_prov *prov_head, *prov_tail;
+static struct ofi_stats ofi_mem_stats;
 int ofi_init = 0;
 pthread_mutex_t ofi_ini_lock = PTHREAD_MUTEX_INITIALIZER;
 
@@ -117,8 +120,11 @@ static void cleanup_provider(struct fi_provider *provider, void *dlhandle)
 	}
 
 #ifdef HAVE_LIBDL
-	if (dlhandle)
+	if (dlhandle) {
+		/* Trace records may point into the library */
+		ofi_trace_dump();
 		dlclose(dlhandle);
+	}
 #endif
 }
 
@@ -424,6 +430,113 @@ libdl_done:
 }
 #endif
 
+static void ofi_mem_param_init(void)
+{
+	enum ofi_mem_hugepages hugepages = OFI_MEM_HUGE_NONE;
+	int numa_node = OFI_MEM_NUMA_NONE;
+	char *param_val = NULL;
+	char *end;
+
+	fi_param_define(NULL, "mem_hugepages", FI_PARAM_STRING,
+			"Back buffer pools and rings of 2MB or more with"
+			" hugepages: 'no' (default), 'thp' for transparent"
+			" hugepages, or 'yes' for reserved hugetlb pages,"
+			" falling back to transparent hugepages");
+	fi_param_define(NULL, "mem_numa_node", FI_PARAM_STRING,
+			"Prefer this NUMA node for buffer pools and rings of"
+			" a page or more: a node number, or 'local' for the"
+			" node of the thread that allocates them (default:"
+			" kernel policy)");
+
+	fi_param_get_str(NULL, "mem_hugepages", &param_val);
+	if (param_val) {
+		if (!strcasecmp(param_val, "thp"))
+			hugepages = OFI_MEM_HUGE_THP;
+		else if (!strcasecmp(param_val, "yes") ||
+			 !strcasecmp(param_val, "hugetlb") ||
+			 !strcmp(param_val, "1"))
+			hugepages = OFI_MEM_HUGE_TLB;
+		else if (strcasecmp(param_val, "no") && strcmp(param_val, "0"))
+			FI_WARN(&core_prov, FI_LOG_CORE,
+				"invalid FI_MEM_HUGEPAGES value: %s\n",
+				param_val);
+	}
+
+	param_val = NULL;
+	fi_param_get_str(NULL, "mem_numa_node", &param_val);
+	if (param_val) {
+		if (!strcasecmp(param_val, "local")) {
+			numa_node = OFI_MEM_NUMA_LOCAL;
+		} else {
+			numa_node = (int) strtol(param_val, &end, 10);
+			if (*end || numa_node < 0) {
+				FI_WARN(&core_prov, FI_LOG_CORE,
+					"invalid FI_MEM_NUMA_NODE value: %s\n",
+					param_val);
+				numa_node = OFI_MEM_NUMA_NONE;
+			}
+		}
+	}
+
+	ofi_mem_policy_init(hugepages, numa_node);
+	if (hugepages == OFI_MEM_HUGE_NONE && numa_node == OFI_MEM_NUMA_NONE)
+		return;
+
+	FI_INFO(&core_prov, FI_LOG_CORE,
+		"memory placement: hugepages %s (%zu bytes), numa node %d\n",
+		hugepages == OFI_MEM_HUGE_TLB ? "hugetlb" :
+		hugepages == OFI_MEM_HUGE_THP ? "thp" : "no",
+		ofi_mem_policy.huge_page_size, numa_node);
+
+	if (!ofi_stats_init(&core_prov, &ofi_mem_stats, ofi_mem_stat_defs,
+			    OFI_MEM_STAT_MAX, "mem"))
+		ofi_mem_policy.stats = &ofi_mem_stats;
+}
+
+static void ofi_wait_param_init(void)
+{
+	int val;
+
+	fi_param_define(NULL, "wait_spin", FI_PARAM_INT,
+			"Maximum time in microseconds that blocking waits on"
+			" completion queues, counters and wait sets poll for"
+			" events before sleeping; 0 disables polling"
+			" (default: 50, or 0 on single processor systems)");
+	fi_param_define(NULL, "wait_spin_adaptive", FI_PARAM_BOOL,
+			"Learn the polling time of blocking waits from how"
+			" long recent waits took, up to FI_WAIT_SPIN; when"
+			" disabled, waits always poll for FI_WAIT_SPIN"
+			" (default: yes)");
+
+	/* Spinning only delays the thread that would generate the event */
+	if (ofi_sysconf(_SC_NPROCESSORS_ONLN) == 1)
+		ofi_wait_spin_default.max_usec = 0;
+
+	if (!fi_param_get_int(NULL, "wait_spin", &val)) {
+		if (val >= 0)
+			ofi_wait_spin_default.max_usec = val;
+		else
+			FI_WARN(&core_prov, FI_LOG_CORE,
+				"invalid FI_WAIT_SPIN value: %d\n", val);
+	}
+	if (!fi_param_get_bool(NULL, "wait_spin_adaptive", &val))
+		ofi_wait_spin_default.adaptive = !!val;
+}
+
+static void ofi_mem_param_fini(void)
+{
+	if (!ofi_mem_policy.stats)
+		return;
+
+	FI_INFO(&core_prov, FI_LOG_CORE,
+		"memory placement: %" PRIu64 " hugepage fallbacks, %" PRIu64
+		" numa bind errors\n",
+		ofi_stats_get(&ofi_mem_stats, OFI_MEM_STAT_FALLBACKS),
+		ofi_stats_get(&ofi_mem_stats, OFI_MEM_STAT_NUMA_ERRORS));
+	ofi_mem_policy.stats = NULL;
+	ofi_stats_close(&ofi_mem_stats);
+}
+
 void fi_ini(void)
 {
 	char *param_val = NULL;
@@ -445,8 +558,14 @@ void fi_ini(void)
 			" (default: no). Setting this to yes could improve"
 			" performance at the expense of making fork() potentially"
 			" unsafe");
+	fi_param_define(NULL, "stats_shm", FI_PARAM_BOOL,
+			"Publish provider statistics to a shared memory"
+			" segment per object so that they can be sampled by an"
+			" external tool (default: no)");
 	fi_param_get_str(NULL, "provider", &param_val);
 	ofi_create_filter(&prov_filter, param_val);
+	ofi_mem_param_init();
+	ofi_wait_param_init();
 
 #ifdef HAVE_LIBDL
 	int n = 0;
@@ -512,6 +631,7 @@ FI_DESTRUCTOR(fi_fini(void))
 {
 	struct ofi_prov *prov;
 
+	ofi_trace_fini();
 	if (!ofi_init)
 		return;
 
@@ -523,6 +643,7 @@ FI_DESTRUCTOR(fi_fini(void))
 	}
 
 	ofi_free_filter(&prov_filter);
+	ofi_mem_param_fini();
 	fi_log_fini();
 	fi_param_fini();
 	ofi_osd_fini();
@@ -36,7 +36,9 @@
 #include <errno.h>
 #include <sys/types.h>
 #include <stdlib.h>
+#include <assert.h>
 
+#include <fi_osd.h>
 #include <fi_indexer.h>
 
 /*
@@ -44,38 +46,45 @@
  *
  * We store pointers using a double lookup and return an index to the
  * user which is then used to retrieve the pointer.  The upper bits of
- * the index are itself an index into an array of memory allocations.
- * The lower bits specify the offset into the allocated memory where
- * the pointer is stored.
+ * the index select a chunk, and the remaining bits give the offset of
+ * the pointer within that chunk.  Each new chunk is twice the size of the
+ * previous one, so a fixed table of chunks covers the entire index space.
  *
  * This allows us to adjust the number of pointers stored by the index
  * list without taking a lock during data lookups.
  */
 
-static int ofi_idx_grow(struct indexer *idx)
+static ofi_idx_entry_t *ofi_idx_alloc_chunk(size_t chunk)
 {
-	union ofi_idx_entry *entry;
-	int i, start_index;
+	if (chunk >= OFI_IDX_MAX_CHUNKS)
+		return NULL;
+	return calloc(ofi_idx_chunk_size(chunk), sizeof(ofi_idx_entry_t));
+}
 
-	if (idx->size >= OFI_IDX_ARRAY_SIZE)
-		goto nomem;
+static ssize_t ofi_idx_grow(struct indexer *idx)
+{
+	ofi_idx_entry_t *entry;
+	size_t i, size, start_index;
 
-	idx->array[idx->size] = calloc(OFI_IDX_ENTRY_SIZE, sizeof(union ofi_idx_entry));
-	if (!idx->array[idx->size])
+	entry = ofi_idx_alloc_chunk(idx->chunk_cnt);
+	if (!entry)
 		goto nomem;
 
-	entry = idx->array[idx->size];
-	start_index = idx->size << OFI_IDX_ENTRY_BITS;
-	entry[OFI_IDX_ENTRY_SIZE - 1].next = idx->free_list;
+	size = ofi_idx_chunk_size(idx->chunk_cnt);
+	start_index = ofi_idx_chunk_start(idx->chunk_cnt);
+	entry[size - 1] = ofi_idx_free_entry(idx->free_list);
 
-	for (i = OFI_IDX_ENTRY_SIZE - 2; i >= 0; i--)
-		entry[i].next = start_index + i + 1;
+	for (i = 0; i < size - 1; i++)
+		entry[i] = ofi_idx_free_entry(start_index + i + 1);
 
 	/* Index 0 is reserved */
 	if (start_index == 0)
 		start_index++;
+
+	/* Readers may see the chunk as soon as it is in the table */
+	ofi_wmb();
+	idx->chunk[idx->chunk_cnt++] = entry;
 	idx->free_list = start_index;
-	idx->size++;
 	return start_index;
 
 nomem:
@@ -83,58 +92,73 @@ nomem:
 	return -1;
 }
 
-int ofi_idx_insert(struct indexer *idx, void *item)
+ssize_t ofi_idx_insert(struct indexer *idx, void *item)
 {
-	union ofi_idx_entry *entry;
-	int index;
+	ofi_idx_entry_t *entry;
+	ssize_t index;
 
+	assert(!ofi_idx_entry_is_free(item));
 	if ((index = idx->free_list) == 0) {
 		if ((index = ofi_idx_grow(idx)) <= 0)
 			return index;
 	}
 
-	entry = idx->array[ofi_idx_array_index(index)];
-	idx->free_list = entry[ofi_idx_entry_index(index)].next;
-	entry[ofi_idx_entry_index(index)].item = item;
+	entry = ofi_idx_entry(idx, index);
+	idx->free_list = ofi_idx_free_next(*entry);
+	/* Publish the item only after the caller has initialized it */
+	ofi_wmb();
+	*entry = item;
 	return index;
 }
 
-void *ofi_idx_remove(struct indexer *idx, int index)
+void *ofi_idx_remove(struct indexer *idx, size_t index)
 {
-	union ofi_idx_entry *entry;
+	ofi_idx_entry_t *entry;
 	void *item;
 
-	entry = idx->array[ofi_idx_array_index(index)];
-	item = entry[ofi_idx_entry_index(index)].item;
-	entry[ofi_idx_entry_index(index)].next = idx->free_list;
+	entry = ofi_idx_entry(idx, index);
+	item = *entry;
+	*entry = ofi_idx_free_entry(idx->free_list);
 	idx->free_list = index;
 	return item;
 }
 
-void ofi_idx_replace(struct indexer *idx, int index, void *item)
+void ofi_idx_replace(struct indexer *idx, size_t index, void *item)
 {
-	union ofi_idx_entry *entry;
-
-	entry = idx->array[ofi_idx_array_index(index)];
-	entry[ofi_idx_entry_index(index)].item = item;
+	assert(!ofi_idx_entry_is_free(item));
+	ofi_wmb();
+	*ofi_idx_entry(idx, index) = item;
 }
 
 void ofi_idx_reset(struct indexer *idx)
 {
-	while (idx->size) {
-		free(idx->array[idx->size - 1]);
-		idx->array[idx->size - 1] = NULL;
-		idx->size--;
+	while (idx->chunk_cnt) {
+		free((void *) idx->chunk[idx->chunk_cnt - 1]);
+		idx->chunk[idx->chunk_cnt - 1] = NULL;
+		idx->chunk_cnt--;
 	}
 	idx->free_list = 0;
 }
 
-static int ofi_idm_grow(struct index_map *idm, int index)
+ssize_t ofi_idm_set(struct index_map *idm, size_t index, void *item)
 {
-	idm->array[ofi_idx_array_index(index)] = calloc(OFI_IDX_ENTRY_SIZE, sizeof(void *));
-	if (!idm->array[ofi_idx_array_index(index)])
+	ofi_idx_entry_t *entry;
+	size_t chunk;
+
+	if (index > OFI_IDX_MAX_INDEX)
 		goto nomem;
 
+	chunk = ofi_idx_chunk(index);
+	if (!idm->chunk[chunk]) {
+		entry = ofi_idx_alloc_chunk(chunk);
+		if (!entry)
+			goto nomem;
+		ofi_wmb();
+		idm->chunk[chunk] = entry;
+	}
+
+	ofi_wmb();
+	idm->chunk[chunk][ofi_idx_chunk_offset(index, chunk)] = item;
 	return index;
 
 nomem:
@@ -142,51 +166,27 @@ nomem:
 	return -1;
 }
 
-int ofi_idm_set(struct index_map *idm, int index, void *item)
+void *ofi_idm_clear(struct index_map *idm, size_t index)
 {
-	void **entry;
-
-	if (index > OFI_IDX_MAX_INDEX) {
-		errno = ENOMEM;
-		return -1;
-	}
-
-	if (!idm->array[ofi_idx_array_index(index)]) {
-		if (ofi_idm_grow(idm, index) < 0)
-			return -1;
-	}
-
-	entry = idm->array[ofi_idx_array_index(index)];
-	entry[ofi_idx_entry_index(index)] = item;
-	idm->count[ofi_idx_array_index(index)]++;
-	return index;
-}
-
-void *ofi_idm_clear(struct index_map *idm, int index)
-{
-	void **entry;
+	ofi_idx_entry_t *entry;
 	void *item;
+	size_t chunk;
 
-	entry = idm->array[ofi_idx_array_index(index)];
-	item = entry[ofi_idx_entry_index(index)];
-	entry[ofi_idx_entry_index(index)] = NULL;
-	if (--idm->count[ofi_idx_array_index(index)] == 0) {
-		free(idm->array[ofi_idx_array_index(index)]);
-		idm->array[ofi_idx_array_index(index)] = NULL;
-	}
+	chunk = ofi_idx_chunk(index);
+	entry = &idm->chunk[chunk][ofi_idx_chunk_offset(index, chunk)];
+	item = *entry;
+	*entry = NULL;
 	return item;
 }
 
 void ofi_idm_reset(struct index_map *idm)
 {
-	int i;
+	size_t i;
 
-	for (i=0; i<OFI_IDX_ARRAY_SIZE; i++) {
-		if (idm->array[i]) {
-			free(idm->array[i]);
-			idm->array[i] = NULL;
-			idm->count[i] = 0;
+	for (i = 0; i < OFI_IDX_MAX_CHUNKS; i++) {
+		if (idm->chunk[i]) {
+			free((void *) idm->chunk[i]);
+			idm->chunk[i] = NULL;
 		}
 	}
 }
-
@@ -123,6 +123,17 @@ void fi_log_init(void)
 			log_mask |= (1 << (i + FI_LOG_SUBSYS_OFFSET));
 	}
 	ofi_free_filter(&subsys_filter);
+
+	fi_param_define(NULL, "trace_level", FI_PARAM_STRING,
+			"Record hot-path messages up to this level into "
+			"per-thread binary trace rings instead of logging "
+			"them: warn, trace, info, debug (default: disabled)");
+	fi_param_define(NULL, "trace_size", FI_PARAM_INT,
+			"Number of records kept per thread trace ring "
+			"(default: 4096)");
+	fi_param_define(NULL, "trace_signal", FI_PARAM_INT,
+			"Dump trace rings when this signal is received "
+			"(default: 0, dump at exit only)");
 }
 
 void fi_log_fini(void)
@@ -0,0 +1,509 @@
+/*
+ * Copyright (c) 2017 Intel Corporation. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#include <inttypes.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fi.h>
+#include <fi_list.h>
+#include <fi_trace.h>
+
+
+enum {
+	OFI_TRACE_ARG_INT,
+	OFI_TRACE_ARG_LONG,
+	OFI_TRACE_ARG_LLONG,
+	OFI_TRACE_ARG_SIZE,
+	OFI_TRACE_ARG_INTMAX,
+	OFI_TRACE_ARG_PTRDIFF,
+	OFI_TRACE_ARG_DOUBLE,
+	OFI_TRACE_ARG_PTR,
+	OFI_TRACE_ARG_STR,
+	OFI_TRACE_ARG_NONE,
+	OFI_TRACE_ARG_INVALID,
+};
+
+#define OFI_TRACE_DEF_SIZE	4096
+#define OFI_TRACE_SPEC_LEN	32
+
+struct ofi_trace_ring {
+	struct dlist_entry	entry;
+	int			id;
+	ofi_atomic64_t		head;
+	uint64_t		dumped;
+	uint64_t		mask;
+	struct ofi_trace_rec	rec[];
+};
+
+static const char * const trace_levels[] = {
+	[FI_LOG_WARN] = "warn",
+	[FI_LOG_TRACE] = "trace",
+	[FI_LOG_INFO] = "info",
+	[FI_LOG_DEBUG] = "debug",
+	[FI_LOG_MAX] = NULL
+};
+
+int ofi_trace_level = OFI_TRACE_UNINIT;
+
+static OFI_THREAD_LOCAL struct ofi_trace_ring *trace_ring;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static DEFINE_LIST(trace_ring_list);
+static size_t trace_size = OFI_TRACE_DEF_SIZE;
+static int trace_ring_cnt;
+static uint64_t trace_start;
+static volatile sig_atomic_t trace_dump_pending;
+
+
+static void ofi_trace_dump_locked(void);
+
+#ifndef _WIN32
+/*
+ * Formatting and logging are not async-signal-safe: the dump is left to
+ * the next thread that records a message.
+ */
+static void ofi_trace_signal_handler(int signum)
+{
+	trace_dump_pending = 1;
+}
+
+static void ofi_trace_signal_init(int signum)
+{
+	struct sigaction action;
+
+	memset(&action, 0, sizeof action);
+	action.sa_handler = ofi_trace_signal_handler;
+	action.sa_flags = SA_RESTART;
+	sigemptyset(&action.sa_mask);
+	sigaction(signum, &action, NULL);
+}
+#else
+static void ofi_trace_signal_init(int signum)
+{
+	OFI_UNUSED(signum);
+}
+#endif
+
+void ofi_trace_init(void)
+{
+	char *levelstr = NULL;
+	int size = 0, signum = 0, level = OFI_TRACE_DISABLED, i;
+
+	pthread_mutex_lock(&trace_lock);
+	if (ofi_trace_level != OFI_TRACE_UNINIT)
+		goto unlock;
+
+	fi_param_get_str(NULL, "trace_level", &levelstr);
+	for (i = 0; levelstr && trace_levels[i]; i++) {
+		if (!strcasecmp(levelstr, trace_levels[i])) {
+			level = i;
+			break;
+		}
+	}
+
+	if (!fi_param_get_int(NULL, "trace_size", &size) && size > 0)
+		trace_size = roundup_power_of_two(size);
+
+	if (level != OFI_TRACE_DISABLED &&
+	    !fi_param_get_int(NULL, "trace_signal", &signum) && signum > 0)
+		ofi_trace_signal_init(signum);
+
+	trace_start = fi_gettime_ns();
+	ofi_trace_level = level;
+unlock:
+	pthread_mutex_unlock(&trace_lock);
+}
+
+static struct ofi_trace_ring *ofi_trace_ring_alloc(void)
+{
+	struct ofi_trace_ring *ring;
+
+	ring = calloc(1, sizeof(*ring) + sizeof(ring->rec[0]) * trace_size);
+	if (!ring)
+		return NULL;
+
+	ring->mask = trace_size - 1;
+	ofi_atomic_initialize64(&ring->head, 0);
+
+	pthread_mutex_lock(&trace_lock);
+	ring->id = trace_ring_cnt++;
+	dlist_insert_tail(&ring->entry, &trace_ring_list);
+	pthread_mutex_unlock(&trace_lock);
+
+	trace_ring = ring;
+	return ring;
+}
+
+/*
+ * Parses one conversion specification starting at fmt[0] == '%'.  Returns
+ * the length of the specification and the argument type it consumes.
+ */
+static size_t ofi_trace_parse_spec(const char *fmt, int *type)
+{
+	const char *s = fmt + 1;
+	int len_mod = 0;
+
+	if (*s == '%') {
+		*type = OFI_TRACE_ARG_NONE;
+		return 2;
+	}
+
+	s += strspn(s, "-+ #0");
+	s += strspn(s, "0123456789");
+	if (*s == '.') {
+		s++;
+		s += strspn(s, "0123456789");
+	}
+
+	switch (*s) {
+	case 'h':
+		s += (s[1] == 'h') ? 2 : 1;
+		break;
+	case 'l':
+		if (s[1] == 'l') {
+			len_mod = OFI_TRACE_ARG_LLONG;
+			s += 2;
+		} else {
+			len_mod = OFI_TRACE_ARG_LONG;
+			s++;
+		}
+		break;
+	case 'z':
+		len_mod = OFI_TRACE_ARG_SIZE;
+		s++;
+		break;
+	case 'j':
+		len_mod = OFI_TRACE_ARG_INTMAX;
+		s++;
+		break;
+	case 't':
+		len_mod = OFI_TRACE_ARG_PTRDIFF;
+		s++;
+		break;
+	default:
+		break;
+	}
+
+	switch (*s) {
+	case 'd': case 'i': case 'u': case 'x': case 'X': case 'o':
+		*type = len_mod ? len_mod : OFI_TRACE_ARG_INT;
+		break;
+	case 'c':
+		*type = len_mod ? OFI_TRACE_ARG_INVALID : OFI_TRACE_ARG_INT;
+		break;
+	case 'e': case 'E': case 'f': case 'F': case 'g': case 'G':
+		*type = OFI_TRACE_ARG_DOUBLE;
+		break;
+	case 'p':
+		*type = OFI_TRACE_ARG_PTR;
+		break;
+	case 's':
+		*type = len_mod ? OFI_TRACE_ARG_INVALID : OFI_TRACE_ARG_STR;
+		break;
+	default:
+		/* '*' width/precision, %n, long double, wide chars */
+		*type = OFI_TRACE_ARG_INVALID;
+		return s - fmt;
+	}
+	return s - fmt + 1;
+}
+
+static void ofi_trace_parse(struct ofi_trace_fmt *fmt)
+{
+	const char *s;
+	int type, nargs = 0;
+
+	for (s = strchr(fmt->fmt, '%'); s; s = strchr(s, '%')) {
+		s += ofi_trace_parse_spec(s, &type);
+		if (type == OFI_TRACE_ARG_NONE)
+			continue;
+
+		if (type == OFI_TRACE_ARG_INVALID || nargs == OFI_TRACE_MAX_ARGS) {
+			nargs = -1;
+			break;
+		}
+		fmt->type[nargs++] = (uint8_t) type;
+	}
+	fmt->nargs = nargs;
+	fmt->parsed = 1;
+}
+
+static void ofi_trace_log(const struct ofi_trace_fmt *fmt,
+			  const struct fi_provider *prov,
+			  const char *str, va_list vargs)
+{
+	char buf[1024];
+
+	vsnprintf(buf, sizeof(buf), str, vargs);
+	fi_log(prov, fmt->level, fmt->subsys, fmt->func, fmt->line, "%s", buf);
+}
+
+void ofi_trace_rec(struct ofi_trace_fmt *fmt, const struct fi_provider *prov,
+		   const char *str, ...)
+{
+	struct fi_prov_context ctx;
+	struct ofi_trace_ring *ring;
+	struct ofi_trace_rec *rec;
+	va_list vargs;
+	uint64_t head;
+	double dval;
+	int i;
+
+	memcpy(&ctx, &prov->context, sizeof ctx);
+	if (ctx.disable_logging)
+		return;
+
+	if (trace_dump_pending) {
+		trace_dump_pending = 0;
+		ofi_trace_dump();
+	}
+
+	if (!fmt->parsed)
+		ofi_trace_parse(fmt);
+
+	va_start(vargs, str);
+	if (fmt->nargs < 0) {
+		ofi_trace_log(fmt, prov, str, vargs);
+		goto out;
+	}
+
+	ring = trace_ring ? trace_ring : ofi_trace_ring_alloc();
+	if (!ring)
+		goto out;
+
+	/* Only this thread writes head */
+	head = ofi_atomic_get64(&ring->head);
+	rec = &ring->rec[head & ring->mask];
+	rec->ts = fi_gettime_ns();
+	rec->fmt = fmt;
+	rec->prov = prov;
+
+	for (i = 0; i < fmt->nargs; i++) {
+		switch (fmt->type[i]) {
+		case OFI_TRACE_ARG_INT:
+			rec->arg[i] = (uint64_t) va_arg(vargs, int);
+			break;
+		case OFI_TRACE_ARG_LONG:
+			rec->arg[i] = (uint64_t) va_arg(vargs, long);
+			break;
+		case OFI_TRACE_ARG_LLONG:
+			rec->arg[i] = (uint64_t) va_arg(vargs, long long);
+			break;
+		case OFI_TRACE_ARG_SIZE:
+			rec->arg[i] = (uint64_t) va_arg(vargs, size_t);
+			break;
+		case OFI_TRACE_ARG_INTMAX:
+			rec->arg[i] = (uint64_t) va_arg(vargs, intmax_t);
+			break;
+		case OFI_TRACE_ARG_PTRDIFF:
+			rec->arg[i] = (uint64_t) va_arg(vargs, ptrdiff_t);
+			break;
+		case OFI_TRACE_ARG_DOUBLE:
+			dval = va_arg(vargs, double);
+			memcpy(&rec->arg[i], &dval, sizeof dval);
+			break;
+		case OFI_TRACE_ARG_PTR:
+		case OFI_TRACE_ARG_STR:
+			rec->arg[i] = (uint64_t) (uintptr_t) va_arg(vargs, void *);
+			break;
+		}
+	}
+	ofi_atomic_set64(&ring->head, head + 1);
+out:
+	va_end(vargs);
+}
+
+static int ofi_trace_format_arg(char *buf, size_t len, const char *spec,
+				int type, uint64_t arg)
+{
+	double dval;
+
+	switch (type) {
+	case OFI_TRACE_ARG_INT:
+		return snprintf(buf, len, spec, (int) arg);
+	case OFI_TRACE_ARG_LONG:
+		return snprintf(buf, len, spec, (long) arg);
+	case OFI_TRACE_ARG_LLONG:
+		return snprintf(buf, len, spec, (long long) arg);
+	case OFI_TRACE_ARG_SIZE:
+		return snprintf(buf, len, spec, (size_t) arg);
+	case OFI_TRACE_ARG_INTMAX:
+		return snprintf(buf, len, spec, (intmax_t) arg);
+	case OFI_TRACE_ARG_PTRDIFF:
+		return snprintf(buf, len, spec, (ptrdiff_t) arg);
+	case OFI_TRACE_ARG_DOUBLE:
+		memcpy(&dval, &arg, sizeof dval);
+		return snprintf(buf, len, spec, dval);
+	case OFI_TRACE_ARG_PTR:
+		return snprintf(buf, len, spec, (void *) (uintptr_t) arg);
+	case OFI_TRACE_ARG_STR:
+		return snprintf(buf, len, spec, arg ?
+				(const char *) (uintptr_t) arg : "(null)");
+	default:
+		return snprintf(buf, len, "%s", spec);
+	}
+}
+
+static void ofi_trace_format(const struct ofi_trace_rec *rec, char *buf,
+			     size_t len)
+{
+	const char *s = rec->fmt->fmt;
+	char spec[OFI_TRACE_SPEC_LEN];
+	size_t spec_len;
+	int type, i = 0, ret;
+
+	while (*s && len > 1) {
+		if (*s != '%') {
+			*buf++ = *s++;
+			len--;
+			continue;
+		}
+
+		spec_len = ofi_trace_parse_spec(s, &type);
+		if (type == OFI_TRACE_ARG_NONE) {
+			*buf++ = '%';
+			len--;
+			s += spec_len;
+			continue;
+		}
+
+		spec_len = MIN(spec_len, sizeof(spec) - 1);
+		memcpy(spec, s, spec_len);
+		spec[spec_len] = '\0';
+		s += spec_len;
+
+		ret = ofi_trace_format_arg(buf, len, spec, type, rec->arg[i++]);
+		if (ret < 0)
+			break;
+		ret = MIN((size_t) ret, len - 1);
+		buf += ret;
+		len -= ret;
+	}
+	*buf = '\0';
+}
+
+static void ofi_trace_dump_rec(const struct ofi_trace_ring *ring,
+			       const struct ofi_trace_rec *rec)
+{
+	char buf[1024];
+	uint64_t ts;
+
+	ofi_trace_format(rec, buf, sizeof(buf));
+	ts = rec->ts - trace_start;
+	fi_log(rec->prov, rec->fmt->level, rec->fmt->subsys, rec->fmt->func,
+	       rec->fmt->line, "[%" PRIu64 ".%09" PRIu64 " T%d] %s",
+	       ts / 1000000000, ts % 1000000000, ring->id, buf);
+}
+
+/*
+ * Merges all per-thread rings in timestamp order, starting after the last
+ * dump.  Records overwritten while dumping are skipped, since the owning
+ * threads are not stopped.
+ */
+static void ofi_trace_dump_locked(void)
+{
+	struct ofi_trace_ring *ring, *next_ring;
+	struct dlist_entry *item;
+	uint64_t *tail, oldest, head;
+	int i;
+
+	if (!trace_ring_cnt)
+		return;
+
+	tail = calloc(trace_ring_cnt, sizeof(*tail));
+	if (!tail)
+		return;
+
+	dlist_foreach(&trace_ring_list, item) {
+		ring = container_of(item, struct ofi_trace_ring, entry);
+		tail[ring->id] = ring->dumped;
+	}
+
+	for (;;) {
+		next_ring = NULL;
+		dlist_foreach(&trace_ring_list, item) {
+			ring = container_of(item, struct ofi_trace_ring, entry);
+			i = ring->id;
+			head = ofi_atomic_get64(&ring->head);
+			oldest = (head > ring->mask) ? head - ring->mask : 0;
+			if (tail[i] < oldest)
+				tail[i] = oldest;
+			if (tail[i] >= head)
+				continue;
+			if (!next_ring || ring->rec[tail[i] & ring->mask].ts <
+			    next_ring->rec[tail[next_ring->id] &
+					   next_ring->mask].ts)
+				next_ring = ring;
+		}
+		if (!next_ring)
+			break;
+
+		ofi_trace_dump_rec(next_ring, &next_ring->rec[
+				   tail[next_ring->id]++ & next_ring->mask]);
+	}
+
+	dlist_foreach(&trace_ring_list, item) {
+		ring = container_of(item, struct ofi_trace_ring, entry);
+		ring->dumped = tail[ring->id];
+	}
+	free(tail);
+}
+
+void ofi_trace_dump(void)
+{
+	pthread_mutex_lock(&trace_lock);
+	ofi_trace_dump_locked();
+	pthread_mutex_unlock(&trace_lock);
+}
+
+/*
+ * Called from fi_fini before the providers are unloaded, as records point
+ * to format strings and providers inside their libraries.  Rings are not
+ * freed: threads other than the exiting one may still hold a reference to
+ * their ring.
+ */
+void ofi_trace_fini(void)
+{
+	if (ofi_trace_level < 0)
+		return;
+
+	ofi_trace_dump();
+	ofi_trace_level = OFI_TRACE_DISABLED;
+}
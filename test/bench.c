@@ -0,0 +1,530 @@
+/*
+ * Copyright (c) 2017 Intel Corporation. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#include <getopt.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <fi.h>
+#include <fi_mem.h>
+#include <fi_rbuf.h>
+#include <fi_indexer.h>
+#include <fi_iov.h>
+#include <ofi_atomic.h>
+#include <rbtree.h>
+#include <fasthash.h>
+
+/*
+ * Micro-benchmarks for the data structures on the providers' data paths.
+ * Each benchmark runs a fixed number of operations per thread on state
+ * private to that thread, so results across thread counts show how an
+ * operation scales once the threads compete for caches and the allocator.
+ */
+
+#define BN_QUEUE_SIZE	1024
+#define BN_BATCH	64
+#define BN_MAP_SIZE	4096
+#define BN_MSG_SIZE	64
+#define BN_IOV_CNT	4
+
+struct bn_test {
+	const char *name;
+	void *(*setup)(void);
+	void (*run)(void *state, size_t iters, uint64_t *sink);
+	void (*teardown)(void *state);
+};
+
+OFI_DECLARE_CIRQUE(uint64_t, bn_cirq);
+
+struct bn_fs_entry {
+	void *next;
+	uint64_t val;
+};
+DECLARE_FREESTACK(struct bn_fs_entry, bn_fs);
+
+static void *bn_cirque_setup(void)
+{
+	return bn_cirq_create(BN_QUEUE_SIZE);
+}
+
+static void bn_cirque_run(void *state, size_t iters, uint64_t *sink)
+{
+	struct bn_cirq *cq = state;
+	size_t i, j;
+
+	for (i = 0; i < iters; i += BN_BATCH) {
+		for (j = 0; j < BN_BATCH; j++)
+			ofi_cirque_insert(cq, j);
+		for (j = 0; j < BN_BATCH; j++)
+			*sink += *ofi_cirque_remove(cq);
+	}
+}
+
+static void bn_cirque_teardown(void *state)
+{
+	bn_cirq_free(state);
+}
+
+static void *bn_freestack_setup(void)
+{
+	return bn_fs_create(BN_QUEUE_SIZE);
+}
+
+static void bn_freestack_run(void *state, size_t iters, uint64_t *sink)
+{
+	struct bn_fs *fs = state;
+	struct bn_fs_entry *entry[BN_BATCH];
+	size_t i, j;
+
+	for (i = 0; i < iters; i += BN_BATCH) {
+		for (j = 0; j < BN_BATCH; j++)
+			entry[j] = freestack_pop(fs);
+		for (j = 0; j < BN_BATCH; j++) {
+			*sink += (uintptr_t) entry[j];
+			freestack_push(fs, entry[j]);
+		}
+	}
+}
+
+static void bn_freestack_teardown(void *state)
+{
+	bn_fs_free(state);
+}
+
+static void *bn_buf_pool_setup(void)
+{
+	return util_buf_pool_create(BN_MSG_SIZE, 16, 0, BN_QUEUE_SIZE);
+}
+
+static void bn_buf_pool_run(void *state, size_t iters, uint64_t *sink)
+{
+	struct util_buf_pool *pool = state;
+	void *buf[BN_BATCH];
+	size_t i, j;
+
+	for (i = 0; i < iters; i += BN_BATCH) {
+		for (j = 0; j < BN_BATCH; j++)
+			buf[j] = util_buf_alloc(pool);
+		for (j = 0; j < BN_BATCH; j++) {
+			*sink += (uintptr_t) buf[j];
+			util_buf_release(pool, buf[j]);
+		}
+	}
+}
+
+static void bn_buf_pool_teardown(void *state)
+{
+	util_buf_pool_destroy(state);
+}
+
+static void *bn_ringbuf_setup(void)
+{
+	struct ofi_ringbuf *rb;
+
+	rb = calloc(1, sizeof(*rb));
+	if (rb && ofi_rbinit(rb, BN_QUEUE_SIZE * BN_MSG_SIZE)) {
+		free(rb);
+		return NULL;
+	}
+	return rb;
+}
+
+static void bn_ringbuf_run(void *state, size_t iters, uint64_t *sink)
+{
+	struct ofi_ringbuf *rb = state;
+	uint64_t msg[BN_MSG_SIZE / sizeof(uint64_t)] = { 0 };
+	size_t i;
+
+	for (i = 0; i < iters; i++) {
+		msg[0] = i;
+		ofi_rbwrite(rb, msg, sizeof msg);
+		ofi_rbcommit(rb);
+		ofi_rbread(rb, msg, sizeof msg);
+		*sink += msg[0];
+	}
+}
+
+static void bn_ringbuf_teardown(void *state)
+{
+	ofi_rbfree(state);
+	free(state);
+}
+
+static void *bn_indexer_setup(void)
+{
+	struct indexer *idx;
+	size_t i;
+
+	idx = calloc(1, sizeof(*idx));
+	if (!idx)
+		return NULL;
+
+	for (i = 0; i < BN_MAP_SIZE; i++) {
+		if (ofi_idx_insert(idx, (void *) ((i + 1) << 1)) <= 0) {
+			ofi_idx_reset(idx);
+			free(idx);
+			return NULL;
+		}
+	}
+	return idx;
+}
+
+static void bn_indexer_insert_run(void *state, size_t iters, uint64_t *sink)
+{
+	struct indexer *idx = state;
+	ssize_t index[BN_BATCH];
+	size_t i, j;
+
+	for (i = 0; i < iters; i += BN_BATCH) {
+		for (j = 0; j < BN_BATCH; j++)
+			index[j] = ofi_idx_insert(idx, sink);
+		for (j = 0; j < BN_BATCH; j++)
+			*sink += (uintptr_t) ofi_idx_remove(idx, index[j]);
+	}
+}
+
+static void bn_indexer_lookup_run(void *state, size_t iters, uint64_t *sink)
+{
+	struct indexer *idx = state;
+	size_t i;
+
+	for (i = 0; i < iters; i++) {
+		*sink += (uintptr_t) ofi_idx_lookup(idx,
+				((i * 2654435761U) & (BN_MAP_SIZE - 1)) + 1);
+	}
+}
+
+static void bn_indexer_teardown(void *state)
+{
+	ofi_idx_reset(state);
+	free(state);
+}
+
+static int bn_rbt_compare(void *a, void *b)
+{
+	uintptr_t x = (uintptr_t) a, y = (uintptr_t) b;
+
+	return (x < y) ? -1 : (x > y);
+}
+
+static void *bn_rbtree_setup(void)
+{
+	RbtHandle rbt;
+	uintptr_t i;
+
+	rbt = rbtNew(bn_rbt_compare);
+	if (!rbt)
+		return NULL;
+
+	/* even keys only, so that odd keys are free for inserts */
+	for (i = 0; i < BN_MAP_SIZE; i++) {
+		if (rbtInsert(rbt, (void *) (i << 1), NULL)) {
+			rbtDelete(rbt);
+			return NULL;
+		}
+	}
+	return rbt;
+}
+
+static void bn_rbtree_find_run(void *state, size_t iters, uint64_t *sink)
+{
+	size_t i;
+
+	for (i = 0; i < iters; i++) {
+		*sink += (uintptr_t) rbtFind(state, (void *) (uintptr_t)
+				(((i * 2654435761U) & (BN_MAP_SIZE - 1)) << 1));
+	}
+}
+
+static void bn_rbtree_insert_run(void *state, size_t iters, uint64_t *sink)
+{
+	uintptr_t key;
+	size_t i;
+
+	for (i = 0; i < iters; i++) {
+		key = (((i * 2654435761U) & (BN_MAP_SIZE - 1)) << 1) | 1;
+		*sink += rbtInsert(state, (void *) key, NULL);
+		rbtErase(state, rbtFind(state, (void *) key));
+	}
+}
+
+static void bn_rbtree_teardown(void *state)
+{
+	rbtDelete(state);
+}
+
+static void *bn_msg_setup(void)
+{
+	return calloc(BN_IOV_CNT * 2, BN_MSG_SIZE);
+}
+
+static void bn_fasthash_run(void *state, size_t iters, uint64_t *sink)
+{
+	uint64_t *msg = state;
+	size_t i;
+
+	for (i = 0; i < iters; i++) {
+		msg[0] = i;
+		*sink += fasthash64(msg, BN_MSG_SIZE, 0);
+	}
+}
+
+static void bn_copy_iov_run(void *state, size_t iters, uint64_t *sink)
+{
+	struct iovec iov[BN_IOV_CNT];
+	char *buf = state;
+	size_t i;
+
+	for (i = 0; i < BN_IOV_CNT; i++) {
+		iov[i].iov_base = buf + BN_MSG_SIZE * (BN_IOV_CNT + i);
+		iov[i].iov_len = BN_MSG_SIZE;
+	}
+
+	for (i = 0; i < iters; i++) {
+		*sink += ofi_copy_to_iov(iov, BN_IOV_CNT, i & (BN_MSG_SIZE - 1),
+					 buf, BN_MSG_SIZE * BN_IOV_CNT);
+	}
+}
+
+static void bn_atomic_sum_run(void *state, size_t iters, uint64_t *sink)
+{
+	uint64_t *buf = state, src[BN_MSG_SIZE / sizeof(uint64_t)];
+	size_t i, cnt = BN_MSG_SIZE / sizeof(uint64_t);
+
+	for (i = 0; i < cnt; i++)
+		src[i] = i;
+
+	for (i = 0; i < iters; i++)
+		ofi_atomic_write_handlers[FI_SUM][FI_UINT64](buf, src, cnt);
+	*sink += buf[1];
+}
+
+static void bn_atomic_cswap_run(void *state, size_t iters, uint64_t *sink)
+{
+	uint64_t *buf = state, src = 1, cmp = 0, res = 0;
+	size_t i;
+
+	for (i = 0; i < iters; i++) {
+		ofi_atomic_swap_handlers[FI_CSWAP - OFI_SWAP_OP_START]
+			[FI_UINT64](buf, &src, &cmp, &res, 1);
+		cmp = res;
+		src = res + 1;
+	}
+	*sink += res;
+}
+
+static void bn_msg_teardown(void *state)
+{
+	free(state);
+}
+
+static struct bn_test bn_tests[] = {
+	{ "cirque", bn_cirque_setup, bn_cirque_run, bn_cirque_teardown },
+	{ "freestack", bn_freestack_setup, bn_freestack_run,
+	  bn_freestack_teardown },
+	{ "buf_pool", bn_buf_pool_setup, bn_buf_pool_run,
+	  bn_buf_pool_teardown },
+	{ "ringbuf", bn_ringbuf_setup, bn_ringbuf_run, bn_ringbuf_teardown },
+	{ "indexer_insert", bn_indexer_setup, bn_indexer_insert_run,
+	  bn_indexer_teardown },
+	{ "indexer_lookup", bn_indexer_setup, bn_indexer_lookup_run,
+	  bn_indexer_teardown },
+	{ "rbtree_find", bn_rbtree_setup, bn_rbtree_find_run,
+	  bn_rbtree_teardown },
+	{ "rbtree_insert", bn_rbtree_setup, bn_rbtree_insert_run,
+	  bn_rbtree_teardown },
+	{ "fasthash64", bn_msg_setup, bn_fasthash_run, bn_msg_teardown },
+	{ "copy_iov", bn_msg_setup, bn_copy_iov_run, bn_msg_teardown },
+	{ "atomic_sum", bn_msg_setup, bn_atomic_sum_run, bn_msg_teardown },
+	{ "atomic_cswap", bn_msg_setup, bn_atomic_cswap_run, bn_msg_teardown },
+};
+
+struct bn_thread {
+	pthread_t thread;
+	struct bn_test *test;
+	pthread_barrier_t *barrier;
+	size_t iters;
+	uint64_t elapsed;
+	uint64_t sink;
+	int ret;
+};
+
+static uint64_t bn_gettime_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void *bn_thread_main(void *arg)
+{
+	struct bn_thread *thread = arg;
+	void *state;
+	uint64_t start;
+
+	state = thread->test->setup();
+	thread->ret = state ? 0 : -1;
+	pthread_barrier_wait(thread->barrier);
+	if (!state)
+		return NULL;
+
+	/* warm up caches and any lazily grown state */
+	thread->test->run(state, BN_QUEUE_SIZE, &thread->sink);
+
+	start = bn_gettime_ns();
+	thread->test->run(state, thread->iters, &thread->sink);
+	thread->elapsed = bn_gettime_ns() - start;
+
+	thread->test->teardown(state);
+	return NULL;
+}
+
+static int bn_run(struct bn_test *test, int thread_cnt, size_t iters,
+		  int csv)
+{
+	struct bn_thread *thread;
+	pthread_barrier_t barrier;
+	uint64_t elapsed = 0, total = 0;
+	double ns_per_op, mops;
+	int i, ret = 0;
+
+	thread = calloc(thread_cnt, sizeof(*thread));
+	if (!thread)
+		return -1;
+
+	pthread_barrier_init(&barrier, NULL, thread_cnt);
+	for (i = 0; i < thread_cnt; i++) {
+		thread[i].test = test;
+		thread[i].barrier = &barrier;
+		thread[i].iters = iters;
+		if (pthread_create(&thread[i].thread, NULL, bn_thread_main,
+				   &thread[i])) {
+			fprintf(stderr, "pthread_create failed\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	for (i = 0; i < thread_cnt; i++) {
+		pthread_join(thread[i].thread, NULL);
+		ret |= thread[i].ret;
+		total += thread[i].elapsed;
+		elapsed = MAX(elapsed, thread[i].elapsed);
+	}
+	pthread_barrier_destroy(&barrier);
+	free(thread);
+
+	if (ret) {
+		fprintf(stderr, "%s: setup failed\n", test->name);
+		return ret;
+	}
+
+	/* per-operation latency seen by a thread, and aggregate throughput */
+	ns_per_op = (double) total / ((double) iters * thread_cnt);
+	mops = elapsed ? (double) iters * thread_cnt * 1000 / elapsed : 0;
+
+	if (csv)
+		printf("%s,%d,%zu,%.2f,%.2f\n", test->name, thread_cnt,
+		       iters * thread_cnt, ns_per_op, mops);
+	else
+		printf("%-16s %8d %12zu %10.2f %10.2f\n", test->name,
+		       thread_cnt, iters * thread_cnt, ns_per_op, mops);
+	return 0;
+}
+
+static void bn_usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-n iterations] [-t max threads] [-c] "
+		"[name]\n", name);
+	fprintf(stderr, "\t-n\toperations per thread (default 1000000)\n");
+	fprintf(stderr, "\t-t\trun with 1, 2, 4, ... up to this many "
+		"threads (default 1)\n");
+	fprintf(stderr, "\t-c\tprint comma separated values\n");
+	fprintf(stderr, "\tname\trun only benchmarks with this prefix\n");
+}
+
+int main(int argc, char **argv)
+{
+	size_t i, iters = 1000000;
+	int op, t, max_threads = 1, csv = 0, ret = 0;
+
+	while ((op = getopt(argc, argv, "n:t:ch")) != -1) {
+		switch (op) {
+		case 'n':
+			iters = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			max_threads = atoi(optarg);
+			break;
+		case 'c':
+			csv = 1;
+			break;
+		default:
+			bn_usage(argv[0]);
+			return op == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+
+	if (!iters || max_threads < 1) {
+		bn_usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	/* operations run in whole batches */
+	iters = (iters + BN_BATCH - 1) & ~((size_t) BN_BATCH - 1);
+
+	if (csv)
+		printf("name,threads,ops,ns_per_op,mops\n");
+	else
+		printf("%-16s %8s %12s %10s %10s\n", "name", "threads", "ops",
+		       "ns/op", "Mops/s");
+
+	for (i = 0; i < sizeof(bn_tests) / sizeof(bn_tests[0]); i++) {
+		if (optind < argc && strncmp(bn_tests[i].name, argv[optind],
+					     strlen(argv[optind])))
+			continue;
+
+		for (t = 1; ; t = MIN(t * 2, max_threads)) {
+			ret |= bn_run(&bn_tests[i], t, iters, csv);
+			if (t == max_threads)
+				break;
+		}
+	}
+
+	return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2017 Intel Corporation. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "unit.h"
+
+static struct ut_test *ut_suites[] = {
+	ut_queue_tests,
+	ut_buf_tests,
+	ut_map_tests,
+	ut_data_tests,
+	ut_av_tests,
+};
+
+int main(int argc, char **argv)
+{
+	struct ut_test *test;
+	int run = 0, failed = 0;
+	size_t i;
+
+	for (i = 0; i < sizeof(ut_suites) / sizeof(ut_suites[0]); i++) {
+		for (test = ut_suites[i]; test->name; test++) {
+			/* optional arguments select tests by name prefix */
+			if (argc > 1 && strncmp(test->name, argv[1],
+						strlen(argv[1])))
+				continue;
+
+			run++;
+			if (test->run()) {
+				printf("FAIL: %s\n", test->name);
+				failed++;
+			} else {
+				printf("PASS: %s\n", test->name);
+			}
+		}
+	}
+
+	printf("%d of %d tests passed\n", run - failed, run);
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
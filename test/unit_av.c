@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2017 Intel Corporation. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+
+#include "config.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <netinet/in.h>
+
+#include <fi.h>
+#include <fi_util.h>
+
+#include "unit.h"
+
+static int ut_rx_addr_bits(int bits)
+{
+	struct util_av av;
+	fi_addr_t addr, fi_addr;
+	int rx_cnt, i;
+
+	memset(&av, 0, sizeof av);
+	av.rx_ctx_bits = bits;
+	rx_cnt = 1 << bits;
+
+	/* fi_rx_addr() round trips through the AV helpers */
+	for (addr = 0; addr < 4; addr++) {
+		for (i = 0; i < rx_cnt; i++) {
+			fi_addr = bits ? fi_rx_addr(addr, i, bits) : addr;
+			ut_assert(ofi_av_addr_index(&av, fi_addr) == addr);
+			ut_assert(ofi_av_rx_index(&av, fi_addr) == i);
+			ut_assert(ofi_av_ctx_index(&av, fi_addr) ==
+				  (size_t) (addr * rx_cnt + i));
+		}
+	}
+
+	/* the largest AV index left by the rx bits is kept intact */
+	addr = ~0ULL >> bits;
+	fi_addr = bits ? fi_rx_addr(addr, rx_cnt - 1, bits) : addr;
+	ut_assert(ofi_av_addr_index(&av, fi_addr) == addr);
+	ut_assert(ofi_av_rx_index(&av, fi_addr) == rx_cnt - 1);
+	return 0;
+}
+
+static int ut_rx_addr(void)
+{
+	int bits;
+
+	for (bits = 0; bits <= OFI_MAX_RX_CTX_BITS; bits++) {
+		if (ut_rx_addr_bits(bits))
+			return -1;
+	}
+	return 0;
+}
+
+/* Rx context i of a peer listens at the port of its AV entry + i */
+static int ut_rx_ctx_port(void)
+{
+	struct sockaddr_in sin;
+	struct util_av av;
+	fi_addr_t fi_addr;
+
+	memset(&av, 0, sizeof av);
+	av.rx_ctx_bits = 2;
+
+	memset(&sin, 0, sizeof sin);
+	sin.sin_family = AF_INET;
+	ofi_addr_set_port((struct sockaddr *) &sin, 5000);
+
+	fi_addr = fi_rx_addr(7, 3, av.rx_ctx_bits);
+	ofi_addr_set_port((struct sockaddr *) &sin,
+			  ofi_addr_get_port((struct sockaddr *) &sin) +
+			  ofi_av_rx_index(&av, fi_addr));
+	ut_assert(ofi_addr_get_port((struct sockaddr *) &sin) == 5003);
+	ut_assert(sin.sin_port == htons(5003));
+	return 0;
+}
+
+struct ut_test ut_av_tests[] = {
+	{ "av_rx_addr", ut_rx_addr },
+	{ "av_rx_ctx_port", ut_rx_ctx_port },
+	{ NULL, NULL },
+};
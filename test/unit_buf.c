@@ -0,0 +1,287 @@
+/*
+ * Copyright (c) 2017 Intel Corporation. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fi.h>
+#include <fi_mem.h>
+
+#include "unit.h"
+
+#define UT_BUF_SIZE	40
+#define UT_BUF_ALIGN	64
+#define UT_BUF_CHUNK	16
+#define UT_BUF_MAX	64
+
+static int ut_buf_pool_alloc(void)
+{
+	struct util_buf_pool *pool;
+	void *buf[UT_BUF_MAX];
+	int i, j;
+
+	pool = util_buf_pool_create(UT_BUF_SIZE, UT_BUF_ALIGN, UT_BUF_MAX,
+				    UT_BUF_CHUNK);
+	ut_assert(pool);
+	ut_assert(pool->num_allocated == UT_BUF_CHUNK);
+
+	/* the pool grows a chunk at a time, up to its limit */
+	for (i = 0; i < UT_BUF_MAX; i++) {
+		buf[i] = util_buf_alloc(pool);
+		ut_assert(buf[i]);
+		ut_assert(!((uintptr_t) buf[i] % UT_BUF_ALIGN));
+		memset(buf[i], i, UT_BUF_SIZE);
+	}
+	ut_assert(pool->num_allocated == UT_BUF_MAX);
+	ut_assert(!util_buf_alloc(pool));
+
+	for (i = 0; i < UT_BUF_MAX; i++) {
+		for (j = 0; j < UT_BUF_SIZE; j++)
+			ut_assert(((uint8_t *) buf[i])[j] == i);
+	}
+
+	/* released buffers are reused first */
+	util_buf_release(pool, buf[3]);
+	util_buf_release(pool, buf[7]);
+	ut_assert(util_buf_alloc(pool) == buf[7]);
+	ut_assert(util_buf_alloc(pool) == buf[3]);
+
+	for (i = 0; i < UT_BUF_MAX; i++)
+		util_buf_release(pool, buf[i]);
+	util_buf_pool_destroy(pool);
+	return 0;
+}
+
+struct ut_buf_ctx {
+	int regions;
+};
+
+static int ut_buf_region_alloc(void *pool_ctx, void *addr, size_t len,
+			       void **context)
+{
+	struct ut_buf_ctx *ctx = pool_ctx;
+
+	*context = (void *) (uintptr_t) ++ctx->regions;
+	return 0;
+}
+
+static void ut_buf_region_free(void *pool_ctx, void *context)
+{
+	struct ut_buf_ctx *ctx = pool_ctx;
+
+	ctx->regions--;
+}
+
+static int ut_buf_pool_hndlr(void)
+{
+	struct util_buf_pool *pool;
+	struct ut_buf_ctx ctx = { 0 };
+	void *buf[UT_BUF_CHUNK * 2], *context;
+	int i;
+
+	pool = util_buf_pool_create_ex(UT_BUF_SIZE, UT_BUF_ALIGN, 0,
+				       UT_BUF_CHUNK, ut_buf_region_alloc,
+				       ut_buf_region_free, &ctx);
+	ut_assert(pool);
+	ut_assert(ctx.regions == 1);
+
+	/* each buffer reports the context of the region holding it */
+	for (i = 0; i < UT_BUF_CHUNK * 2; i++) {
+		buf[i] = util_buf_alloc_ex(pool, &context);
+		ut_assert(buf[i]);
+		ut_assert(context == (void *) (uintptr_t) (i / UT_BUF_CHUNK + 1));
+		ut_assert(util_buf_get_ctx(pool, buf[i]) == context);
+	}
+	ut_assert(ctx.regions == 2);
+
+	for (i = 0; i < UT_BUF_CHUNK * 2; i++)
+		util_buf_release(pool, buf[i]);
+	util_buf_pool_destroy(pool);
+	ut_assert(ctx.regions == 0);
+	return 0;
+}
+
+#define UT_BUDDY_MIN	64
+#define UT_BUDDY_MAX	1024
+#define UT_BUDDY_REGION	4096
+
+static int ut_buddy_alloc(void)
+{
+	struct util_buddy_pool *pool;
+	struct util_buddy_region *region, *first = NULL;
+	void *buf[UT_BUDDY_REGION / UT_BUDDY_MIN];
+	uint8_t *big;
+	int i, j, n = UT_BUDDY_REGION / UT_BUDDY_MIN;
+
+	pool = util_buddy_pool_create(UT_BUDDY_MIN, UT_BUDDY_MAX,
+				      UT_BUDDY_REGION, 2, NULL, NULL, NULL);
+	ut_assert(pool);
+	ut_assert(util_buddy_block_size(pool, 1) == UT_BUDDY_MIN);
+	ut_assert(util_buddy_block_size(pool, UT_BUDDY_MIN + 1) ==
+		  2 * UT_BUDDY_MIN);
+	ut_assert(!util_buddy_alloc(pool, UT_BUDDY_MAX + 1, &region));
+
+	/* the region splits into distinct, aligned minimum blocks */
+	for (i = 0; i < n; i++) {
+		buf[i] = util_buddy_alloc(pool, UT_BUDDY_MIN - 8, &region);
+		ut_assert(buf[i]);
+		ut_assert(!((uintptr_t) buf[i] % UT_BUDDY_MIN));
+		if (!i)
+			first = region;
+		ut_assert(region == first);
+		memset(buf[i], i, UT_BUDDY_MIN);
+	}
+	ut_assert(pool->num_regions == 1);
+	for (i = 0; i < n; i++) {
+		for (j = 0; j < UT_BUDDY_MIN; j++)
+			ut_assert(((uint8_t *) buf[i])[j] == (uint8_t) i);
+	}
+
+	/* a full region makes the pool grow, up to its limit */
+	big = util_buddy_alloc(pool, UT_BUDDY_MAX, &region);
+	ut_assert(big && region != first);
+	ut_assert(pool->num_regions == 2);
+	for (i = 1; i < UT_BUDDY_REGION / UT_BUDDY_MAX; i++)
+		ut_assert(util_buddy_alloc(pool, UT_BUDDY_MAX, &region));
+	ut_assert(!util_buddy_alloc(pool, UT_BUDDY_MIN, &region));
+
+	/* freed buddies coalesce back into maximum blocks */
+	for (i = 0; i < n; i++)
+		util_buddy_free(first, buf[i], UT_BUDDY_MIN - 8);
+	for (i = 0; i < UT_BUDDY_REGION / UT_BUDDY_MAX; i++) {
+		buf[i] = util_buddy_alloc(pool, UT_BUDDY_MAX / 2 + 1, &region);
+		ut_assert(buf[i] && region == first);
+	}
+	ut_assert(!util_buddy_alloc(pool, UT_BUDDY_MIN, &region));
+	ut_assert(pool->num_regions == 2);
+
+	util_buddy_pool_destroy(pool);
+	return 0;
+}
+
+static int ut_buddy_hndlr(void)
+{
+	struct util_buddy_pool *pool;
+	struct util_buddy_region *region;
+	struct ut_buf_ctx ctx = { 0 };
+	void *buf, *small;
+
+	pool = util_buddy_pool_create(UT_BUDDY_MIN, UT_BUDDY_MAX,
+				      UT_BUDDY_MAX, 0, ut_buf_region_alloc,
+				      ut_buf_region_free, &ctx);
+	ut_assert(pool);
+	ut_assert(ctx.regions == 1);
+
+	/* each block reports the region, and context, holding it */
+	small = util_buddy_alloc(pool, UT_BUDDY_MIN, &region);
+	ut_assert(small && region->context == (void *) (uintptr_t) 1);
+	buf = util_buddy_alloc(pool, UT_BUDDY_MAX, &region);
+	ut_assert(buf && region->context == (void *) (uintptr_t) 2);
+	ut_assert(ctx.regions == 2);
+
+	util_buddy_free(region, buf, UT_BUDDY_MAX);
+	ut_assert(util_buddy_alloc(pool, UT_BUDDY_MAX, &region) == buf);
+	ut_assert(ctx.regions == 2);
+
+	util_buddy_pool_destroy(pool);
+	ut_assert(ctx.regions == 0);
+	return 0;
+}
+
+static int ut_mem_check(void)
+{
+	struct util_buf_pool *pool;
+	struct util_buf_region *region;
+	size_t huge = ofi_mem_policy.huge_page_size;
+	size_t page = ofi_mem_policy.page_size;
+	uint8_t *mem;
+	void *buf;
+	int flags;
+
+	/* regions of a huge page or more are mapped, and zeroed */
+	ut_assert(!ofi_mem_alloc((void **) &mem, UT_BUF_ALIGN, huge + page,
+				 &flags));
+	ut_assert(flags & OFI_MEM_MAPPED);
+	if (flags & OFI_MEM_THP)
+		ut_assert(!((uintptr_t) mem % huge));
+	ut_assert(!mem[0] && !mem[huge + page - 1]);
+	memset(mem, 0xa5, huge + page);
+	ofi_mem_free(mem, huge + page, flags);
+
+	/* small or over-aligned requests stay on the heap */
+	ut_assert(!ofi_mem_alloc((void **) &mem, UT_BUF_ALIGN, UT_BUF_SIZE,
+				 &flags));
+	ut_assert(!flags);
+	ut_assert(!((uintptr_t) mem % UT_BUF_ALIGN));
+	ofi_mem_free(mem, UT_BUF_SIZE, flags);
+
+	ut_assert(!ofi_mem_alloc((void **) &mem, page * 2, huge, &flags));
+	ut_assert(!flags);
+	ut_assert(!((uintptr_t) mem % (page * 2)));
+	ofi_mem_free(mem, huge, flags);
+
+	/* pool regions go through the same path */
+	pool = util_buf_pool_create(page, UT_BUF_ALIGN, 0, huge / page);
+	ut_assert(pool);
+	region = container_of(pool->region_list.head, struct util_buf_region,
+			      entry);
+	ut_assert(region->mem_flags & OFI_MEM_MAPPED);
+	buf = util_buf_alloc(pool);
+	ut_assert(buf);
+	memset(buf, 0, page);
+	util_buf_release(pool, buf);
+	util_buf_pool_destroy(pool);
+	return 0;
+}
+
+static int ut_mem_alloc(void)
+{
+	int ret;
+
+	ofi_mem_policy_init(OFI_MEM_HUGE_THP, OFI_MEM_NUMA_LOCAL);
+	ret = ut_mem_check();
+	ofi_mem_policy_init(OFI_MEM_HUGE_NONE, OFI_MEM_NUMA_NONE);
+	return ret;
+}
+
+struct ut_test ut_buf_tests[] = {
+	{ "buf_pool_alloc", ut_buf_pool_alloc },
+	{ "buf_pool_hndlr", ut_buf_pool_hndlr },
+	{ "buddy_alloc", ut_buddy_alloc },
+	{ "buddy_hndlr", ut_buddy_hndlr },
+	{ "mem_alloc", ut_mem_alloc },
+	{ NULL, NULL },
+};
@@ -0,0 +1,162 @@
+/*
+ * Copyright (c) 2017 Intel Corporation. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include <fi.h>
+#include <fi_iov.h>
+#include <ofi_atomic.h>
+
+#include "unit.h"
+
+static int ut_copy_iov(void)
+{
+	char a[5], b[3], c[8], src[16], dst[16];
+	struct iovec iov[3] = {
+		{ .iov_base = a, .iov_len = sizeof a },
+		{ .iov_base = b, .iov_len = sizeof b },
+		{ .iov_base = c, .iov_len = sizeof c },
+	};
+	uint64_t i, off, len;
+
+	for (i = 0; i < sizeof src; i++)
+		src[i] = (char) ('a' + i);
+
+	ut_assert(ofi_copy_to_iov(iov, 3, 0, src, sizeof src) == 16);
+	ut_assert(!memcmp(a, src, 5) && !memcmp(b, src + 5, 3) &&
+		  !memcmp(c, src + 8, 8));
+
+	/* every offset and length, in both directions */
+	for (off = 0; off <= sizeof src; off++) {
+		for (len = 0; len <= sizeof src; len++) {
+			memset(dst, 0, sizeof dst);
+			ut_assert(ofi_copy_from_iov(dst, len, iov, 3, off) ==
+				  MIN(len, sizeof src - off));
+			ut_assert(!memcmp(dst, src + off,
+					  MIN(len, sizeof src - off)));
+		}
+	}
+
+	memset(dst, '#', sizeof dst);
+	ut_assert(ofi_copy_to_iov(iov, 3, 4, dst, 2) == 2);
+	ut_assert(a[3] == 'd' && a[4] == '#' && b[0] == '#' && b[1] == 'g');
+
+	/* an offset past the end copies nothing */
+	ut_assert(!ofi_copy_from_iov(dst, sizeof dst, iov, 3, 17));
+	return 0;
+}
+
+static int ut_atomic_write(void)
+{
+	uint32_t u32[4] = { 1, 2, 3, 0xF0 };
+	uint32_t s32[4] = { 10, 20, 30, 0x0F };
+	double d[2] = { 1.5, -2.0 }, ds[2] = { 2.0, 3.0 };
+
+	ut_assert(ofi_datatype_size(FI_UINT32) == sizeof(uint32_t));
+	ut_assert(ofi_datatype_size(FI_DOUBLE) == sizeof(double));
+	ut_assert(ofi_datatype_size(FI_LONG_DOUBLE_COMPLEX) ==
+		  sizeof(long double) * 2);
+
+	ofi_atomic_write_handlers[FI_SUM][FI_UINT32](u32, s32, 3);
+	ut_assert(u32[0] == 11 && u32[1] == 22 && u32[2] == 33);
+	ut_assert(u32[3] == 0xF0);
+
+	ofi_atomic_write_handlers[FI_BOR][FI_UINT32](u32 + 3, s32 + 3, 1);
+	ut_assert(u32[3] == 0xFF);
+
+	ofi_atomic_write_handlers[FI_MIN][FI_UINT32](u32, s32, 2);
+	ut_assert(u32[0] == 10 && u32[1] == 20);
+
+	ofi_atomic_write_handlers[FI_PROD][FI_DOUBLE](d, ds, 2);
+	ut_assert(d[0] == 3.0 && d[1] == -6.0);
+
+	/* bitwise operations are not defined for floating point */
+	ut_assert(!ofi_atomic_write_handlers[FI_BAND][FI_DOUBLE]);
+	return 0;
+}
+
+static int ut_atomic_fetch(void)
+{
+	int64_t dst[2] = { 5, -7 }, src[2] = { 2, 3 }, cmp[2] = { 5, 0 };
+	int64_t res[2];
+
+	ofi_atomic_readwrite_handlers[FI_SUM][FI_INT64](dst, src, res, 2);
+	ut_assert(res[0] == 5 && res[1] == -7);
+	ut_assert(dst[0] == 7 && dst[1] == -4);
+
+	ofi_atomic_readwrite_handlers[FI_ATOMIC_READ][FI_INT64](dst, NULL,
+								res, 2);
+	ut_assert(res[0] == 7 && res[1] == -4);
+	ut_assert(dst[0] == 7 && dst[1] == -4);
+
+	/* compare-swap only updates the matching element */
+	cmp[0] = 7;
+	ofi_atomic_swap_handlers[FI_CSWAP - OFI_SWAP_OP_START][FI_INT64]
+		(dst, src, cmp, res, 2);
+	ut_assert(res[0] == 7 && res[1] == -4);
+	ut_assert(dst[0] == 2 && dst[1] == -4);
+
+	cmp[1] = -5;
+	ofi_atomic_swap_handlers[FI_CSWAP_GT - OFI_SWAP_OP_START][FI_INT64]
+		(dst, src, cmp, res, 2);
+	ut_assert(res[0] == 2 && res[1] == -4);
+	ut_assert(dst[0] == 2 && dst[1] == 3);
+	return 0;
+}
+
+static int ut_atomic_valid(void)
+{
+	static struct fi_provider prov = { .name = "unit" };
+
+	ut_assert(!ofi_atomic_valid(&prov, FI_UINT64, FI_SUM, 0));
+	ut_assert(!ofi_atomic_valid(&prov, FI_UINT64, FI_SUM,
+				    FI_FETCH_ATOMIC));
+	ut_assert(!ofi_atomic_valid(&prov, FI_UINT64, FI_MSWAP,
+				    FI_COMPARE_ATOMIC));
+	ut_assert(ofi_atomic_valid(&prov, FI_FLOAT, FI_BXOR, 0));
+	ut_assert(ofi_atomic_valid(&prov, FI_UINT64, FI_SUM,
+				   FI_FETCH_ATOMIC | FI_COMPARE_ATOMIC));
+	ut_assert(ofi_atomic_valid(&prov, FI_DATATYPE_LAST, FI_SUM, 0));
+	return 0;
+}
+
+struct ut_test ut_data_tests[] = {
+	{ "data_copy_iov", ut_copy_iov },
+	{ "data_atomic_write", ut_atomic_write },
+	{ "data_atomic_fetch", ut_atomic_fetch },
+	{ "data_atomic_valid", ut_atomic_valid },
+	{ NULL, NULL },
+};
@@ -0,0 +1,199 @@
+/*
+ * Copyright (c) 2017 Intel Corporation. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fi_indexer.h>
+#include <rbtree.h>
+#include <fasthash.h>
+
+#include "unit.h"
+
+#define UT_MAP_CNT	(OFI_IDX_CHUNK_SIZE * 3)
+
+/* Items must be at least 2-byte aligned; use even, non-zero values */
+#define ut_item(i)	((void *) (uintptr_t) (((i) + 1) << 1))
+
+static int ut_indexer(void)
+{
+	struct indexer idx;
+	ssize_t index[UT_MAP_CNT];
+	size_t i;
+
+	memset(&idx, 0, sizeof idx);
+	ut_assert(!ofi_idx_lookup(&idx, 1));
+
+	/* spans several chunks; index 0 is never handed out */
+	for (i = 0; i < UT_MAP_CNT; i++) {
+		index[i] = ofi_idx_insert(&idx, ut_item(i));
+		ut_assert(index[i] > 0);
+	}
+	ut_assert(idx.chunk_cnt == ofi_idx_chunk(UT_MAP_CNT) + 1);
+
+	for (i = 0; i < UT_MAP_CNT; i++) {
+		ut_assert(ofi_idx_is_valid(&idx, index[i]));
+		ut_assert(ofi_idx_lookup(&idx, index[i]) == ut_item(i));
+		ut_assert(ofi_idx_at(&idx, index[i]) == ut_item(i));
+	}
+
+	/* removed indexes read as empty and are reused, last freed first */
+	ut_assert(ofi_idx_remove(&idx, index[5]) == ut_item(5));
+	ut_assert(ofi_idx_remove(&idx, index[2000]) == ut_item(2000));
+	ut_assert(!ofi_idx_lookup(&idx, index[5]));
+	ut_assert(!ofi_idx_lookup(&idx, index[2000]));
+	ut_assert(ofi_idx_insert(&idx, ut_item(0)) == index[2000]);
+	ut_assert(ofi_idx_insert(&idx, ut_item(0)) == index[5]);
+
+	ofi_idx_replace(&idx, index[5], ut_item(5));
+	ut_assert(ofi_idx_lookup(&idx, index[5]) == ut_item(5));
+
+	ofi_idx_reset(&idx);
+	ut_assert(!idx.chunk_cnt);
+	ut_assert(!ofi_idx_lookup(&idx, index[5]));
+	return 0;
+}
+
+static int ut_index_map(void)
+{
+	struct index_map idm;
+	size_t i;
+
+	memset(&idm, 0, sizeof idm);
+	ut_assert(!ofi_idm_lookup(&idm, 7));
+
+	for (i = 0; i < UT_MAP_CNT; i += 3)
+		ut_assert(ofi_idm_set(&idm, i, ut_item(i)) == (ssize_t) i);
+
+	for (i = 0; i < UT_MAP_CNT; i++) {
+		if (i % 3)
+			ut_assert(!ofi_idm_lookup(&idm, i));
+		else
+			ut_assert(ofi_idm_lookup(&idm, i) == ut_item(i));
+	}
+
+	ut_assert(ofi_idm_clear(&idm, 3) == ut_item(3));
+	ut_assert(!ofi_idm_lookup(&idm, 3));
+	ut_assert(ofi_idm_at(&idm, 6) == ut_item(6));
+
+	ofi_idm_reset(&idm);
+	ut_assert(!ofi_idm_lookup(&idm, 6));
+	return 0;
+}
+
+static int ut_rbt_compare(void *a, void *b)
+{
+	uintptr_t x = (uintptr_t) a, y = (uintptr_t) b;
+
+	return (x < y) ? -1 : (x > y);
+}
+
+static int ut_rbtree(void)
+{
+	RbtHandle rbt;
+	RbtIterator it;
+	void *key, *value;
+	uintptr_t i, prev;
+
+	rbt = rbtNew(ut_rbt_compare);
+	ut_assert(rbt);
+
+	/* insert keys out of order */
+	for (i = 0; i < UT_MAP_CNT; i++) {
+		key = (void *) ((i * 7919) % UT_MAP_CNT + 1);
+		ut_assert(rbtInsert(rbt, key, key) == RBT_STATUS_OK);
+	}
+	ut_assert(rbtInsert(rbt, (void *) 1, NULL) ==
+		  RBT_STATUS_DUPLICATE_KEY);
+
+	for (i = 1; i <= UT_MAP_CNT; i++) {
+		it = rbtFind(rbt, (void *) i);
+		ut_assert(it);
+		rbtKeyValue(rbt, it, &key, &value);
+		ut_assert(key == (void *) i && value == (void *) i);
+	}
+	ut_assert(!rbtFind(rbt, (void *) (UT_MAP_CNT + 1)));
+
+	/* erase the odd keys, then walk the rest in order */
+	for (i = 1; i <= UT_MAP_CNT; i += 2)
+		ut_assert(rbtErase(rbt, rbtFind(rbt, (void *) i)) ==
+			  RBT_STATUS_OK);
+
+	prev = 0;
+	for (it = rbtBegin(rbt); it != rbtEnd(rbt); it = rbtNext(rbt, it)) {
+		rbtKeyValue(rbt, it, &key, &value);
+		ut_assert((uintptr_t) key == prev + 2);
+		prev = (uintptr_t) key;
+	}
+	ut_assert(prev == UT_MAP_CNT);
+
+	rbtDelete(rbt);
+	return 0;
+}
+
+static int ut_fasthash(void)
+{
+	uint8_t buf[64];
+	size_t i;
+
+	for (i = 0; i < sizeof buf; i++)
+		buf[i] = (uint8_t) i;
+
+	/* deterministic, and sensitive to seed, length and content */
+	ut_assert(fasthash64(buf, sizeof buf, 0) ==
+		  fasthash64(buf, sizeof buf, 0));
+	ut_assert(fasthash64(buf, sizeof buf, 0) !=
+		  fasthash64(buf, sizeof buf, 1));
+	ut_assert(fasthash32(buf, sizeof buf, 0) ==
+		  fasthash32(buf, sizeof buf, 0));
+	ut_assert(fasthash32(buf, sizeof buf, 0) !=
+		  fasthash32(buf, sizeof buf, 1));
+
+	/* cover every tail length */
+	for (i = 1; i < sizeof buf; i++) {
+		ut_assert(fasthash64(buf, i, 0) != fasthash64(buf, i - 1, 0));
+		ut_assert(fasthash64(buf + 1, i, 0) != fasthash64(buf, i, 0));
+	}
+	return 0;
+}
+
+struct ut_test ut_map_tests[] = {
+	{ "map_indexer", ut_indexer },
+	{ "map_index_map", ut_index_map },
+	{ "map_rbtree", ut_rbtree },
+	{ "map_fasthash", ut_fasthash },
+	{ NULL, NULL },
+};
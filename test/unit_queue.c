@@ -0,0 +1,313 @@
+/*
+ * Copyright (c) 2017 Intel Corporation. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <fi.h>
+#include <fi_mem.h>
+#include <fi_rbuf.h>
+#include <fi_util.h>
+
+#include "unit.h"
+
+OFI_DECLARE_CIRQUE(uint64_t, ut_cirq);
+
+struct ut_fs_entry {
+	void *next;
+	uint64_t val;
+};
+DECLARE_FREESTACK(struct ut_fs_entry, ut_fs);
+
+static int ut_cirque_basic(void)
+{
+	struct ut_cirq *cq;
+	uint64_t i;
+
+	/* sizes are rounded up to a power of two */
+	cq = ut_cirq_create(100);
+	ut_assert(cq);
+	ut_assert(cq->size == 128);
+	ut_assert(ofi_cirque_isempty(cq));
+	ut_assert(ofi_cirque_freecnt(cq) == 128);
+
+	for (i = 0; i < 128; i++) {
+		ut_assert(!ofi_cirque_isfull(cq));
+		ofi_cirque_insert(cq, i);
+	}
+	ut_assert(ofi_cirque_isfull(cq));
+	ut_assert(ofi_cirque_usedcnt(cq) == 128);
+
+	for (i = 0; i < 128; i++)
+		ut_assert(*ofi_cirque_remove(cq) == i);
+	ut_assert(ofi_cirque_isempty(cq));
+
+	ut_cirq_free(cq);
+	return 0;
+}
+
+static int ut_cirque_wrap(void)
+{
+	struct ut_cirq *cq;
+	uint64_t i, w = 0, r = 0;
+
+	cq = ut_cirq_create(8);
+	ut_assert(cq);
+
+	/* keep the queue partially full while the counters wrap the array */
+	for (i = 0; i < 1000; i++) {
+		*ofi_cirque_tail(cq) = w++;
+		ofi_cirque_commit(cq);
+		ofi_cirque_insert(cq, w++);
+		ut_assert(*ofi_cirque_head(cq) == r);
+		ut_assert(*ofi_cirque_remove(cq) == r++);
+		if (i % 2) {
+			ofi_cirque_discard(cq);
+			r++;
+		}
+		ut_assert(ofi_cirque_usedcnt(cq) == w - r);
+		ut_assert(ofi_cirque_usedcnt(cq) <= cq->size);
+		while (ofi_cirque_usedcnt(cq) > 4)
+			ut_assert(*ofi_cirque_remove(cq) == r++);
+	}
+
+	ut_cirq_free(cq);
+	return 0;
+}
+
+static int ut_freestack_basic(void)
+{
+	struct ut_fs *fs;
+	struct ut_fs_entry *entry[64];
+	int i;
+
+	fs = ut_fs_create(64);
+	ut_assert(fs);
+
+	/* entries are handed out in array order */
+	for (i = 0; i < 64; i++) {
+		ut_assert(!freestack_isempty(fs));
+		entry[i] = freestack_pop(fs);
+		ut_assert(ut_fs_index(fs, entry[i]) == i);
+		entry[i]->val = i;
+	}
+	ut_assert(freestack_isempty(fs));
+
+	/* and reused last in, first out */
+	for (i = 0; i < 64; i += 2)
+		freestack_push(fs, entry[i]);
+	for (i = 62; i >= 0; i -= 2)
+		ut_assert(freestack_pop(fs) == entry[i]);
+	ut_assert(freestack_isempty(fs));
+
+	for (i = 1; i < 64; i += 2)
+		ut_assert(entry[i]->val == i);
+
+	ut_fs_free(fs);
+	return 0;
+}
+
+static int ut_ringbuf_basic(void)
+{
+	struct ofi_ringbuf rb;
+	char in[64], out[64];
+	int i;
+
+	ut_assert(!ofi_rbinit(&rb, 100));
+	ut_assert(rb.size == 128);
+	ut_assert(ofi_rbempty(&rb));
+	ut_assert(ofi_rbavail(&rb) == 128);
+
+	for (i = 0; i < sizeof(in); i++)
+		in[i] = (char) i;
+
+	/* writes are invisible until committed */
+	ofi_rbwrite(&rb, in, sizeof(in));
+	ut_assert(ofi_rbempty(&rb));
+	ofi_rbabort(&rb);
+	ofi_rbwrite(&rb, in, sizeof(in));
+	ofi_rbcommit(&rb);
+	ut_assert(ofi_rbused(&rb) == sizeof(in));
+
+	ofi_rbpeek(&rb, out, 8);
+	ut_assert(!memcmp(in, out, 8));
+	ut_assert(ofi_rbused(&rb) == sizeof(in));
+	ut_assert(ofi_rbdiscard(&rb, 8) == 8);
+	ofi_rbread(&rb, out, sizeof(in) - 8);
+	ut_assert(!memcmp(in + 8, out, sizeof(in) - 8));
+	ut_assert(ofi_rbempty(&rb));
+	ut_assert(ofi_rbdiscard(&rb, 8) == 0);
+
+	ofi_rbfree(&rb);
+	return 0;
+}
+
+static int ut_ringbuf_wrap(void)
+{
+	struct ofi_ringbuf rb;
+	char in[48], out[48];
+	int i, j;
+
+	ut_assert(!ofi_rbinit(&rb, 128));
+
+	/* odd sized records split across the end of the buffer */
+	for (i = 0; i < 1000; i++) {
+		for (j = 0; j < sizeof(in); j++)
+			in[j] = (char) (i + j);
+		ut_assert(ofi_rbavail(&rb) >= sizeof(in));
+		ofi_rbwrite(&rb, in, sizeof(in) - i % 7);
+		ofi_rbcommit(&rb);
+		ofi_rbread(&rb, out, sizeof(in) - i % 7);
+		ut_assert(!memcmp(in, out, sizeof(in) - i % 7));
+	}
+
+	/* fill to capacity */
+	for (i = 0; i < rb.size / 16; i++) {
+		ut_assert(!ofi_rbfull(&rb));
+		ofi_rbwrite(&rb, in, 16);
+		ofi_rbcommit(&rb);
+	}
+	ut_assert(ofi_rbfull(&rb));
+	ut_assert(ofi_rbavail(&rb) == 0);
+
+	ofi_rbfree(&rb);
+	return 0;
+}
+
+#define UT_TRIGGER_CNT	200
+
+static int ut_trigger_order(void)
+{
+	struct ofi_trigger_queue queue;
+	struct ofi_trigger trig[UT_TRIGGER_CNT], *t, *prev = NULL;
+	size_t i;
+
+	/* more ops than the initial heap size, with repeated thresholds */
+	ofi_trigger_queue_init(&queue);
+	for (i = 0; i < UT_TRIGGER_CNT; i++)
+		ut_assert(!ofi_trigger_insert(&queue, &trig[i],
+					      (i * 37) % 17));
+	ut_assert(queue.count == UT_TRIGGER_CNT);
+
+	/* lowest threshold first, queuing order among equal thresholds */
+	for (i = 0; i < UT_TRIGGER_CNT; i++) {
+		t = ofi_trigger_peek(&queue);
+		ut_assert(t);
+		if (prev) {
+			ut_assert(prev->threshold <= t->threshold);
+			if (prev->threshold == t->threshold)
+				ut_assert(prev < t);
+		}
+		prev = t;
+		ofi_trigger_pop(&queue);
+	}
+	ut_assert(!ofi_trigger_peek(&queue));
+
+	ofi_trigger_queue_cleanup(&queue);
+	return 0;
+}
+
+static int ut_trigger_threshold(void)
+{
+	struct ofi_trigger_queue queue;
+	struct ofi_trigger trig[4];
+
+	ofi_trigger_queue_init(&queue);
+	ut_assert(!ofi_trigger_ready(&queue, UINT64_MAX));
+
+	ut_assert(!ofi_trigger_insert(&queue, &trig[0], 20));
+	ut_assert(!ofi_trigger_insert(&queue, &trig[1], 10));
+	ut_assert(!ofi_trigger_insert(&queue, &trig[2], 5));
+	ut_assert(!ofi_trigger_insert(&queue, &trig[3], 10));
+
+	/* only ops whose threshold was reached are returned */
+	ut_assert(!ofi_trigger_ready(&queue, 4));
+	ut_assert(ofi_trigger_ready(&queue, 5) == &trig[2]);
+	ut_assert(ofi_trigger_ready(&queue, 5) == &trig[2]);
+	ofi_trigger_pop(&queue);
+	ut_assert(!ofi_trigger_ready(&queue, 9));
+	ut_assert(ofi_trigger_ready(&queue, 12) == &trig[1]);
+	ofi_trigger_pop(&queue);
+	ut_assert(ofi_trigger_ready(&queue, 12) == &trig[3]);
+	ofi_trigger_pop(&queue);
+	ut_assert(!ofi_trigger_ready(&queue, 12));
+	ut_assert(ofi_trigger_peek(&queue) == &trig[0]);
+
+	ofi_trigger_queue_cleanup(&queue);
+	return 0;
+}
+
+static int ut_trigger_pop(void)
+{
+	struct ofi_trigger_queue queue;
+	struct ofi_trigger trig[3];
+
+	ofi_trigger_queue_init(&queue);
+	ut_assert(!ofi_trigger_insert(&queue, &trig[0], 1));
+	ofi_trigger_pop(&queue);
+	ut_assert(!queue.count);
+	ut_assert(!ofi_trigger_peek(&queue));
+
+	/* the queue is reusable once drained, and ops may be requeued */
+	ut_assert(!ofi_trigger_insert(&queue, &trig[1], 3));
+	ut_assert(!ofi_trigger_insert(&queue, &trig[0], 2));
+	ut_assert(!ofi_trigger_insert(&queue, &trig[2], 1));
+	ofi_trigger_pop(&queue);
+	ut_assert(ofi_trigger_peek(&queue) == &trig[0]);
+	ut_assert(!ofi_trigger_insert(&queue, &trig[2], 2));
+	ut_assert(ofi_trigger_peek(&queue) == &trig[0]);
+	ofi_trigger_pop(&queue);
+	ut_assert(ofi_trigger_peek(&queue) == &trig[2]);
+	ofi_trigger_pop(&queue);
+	ut_assert(ofi_trigger_peek(&queue) == &trig[1]);
+	ofi_trigger_pop(&queue);
+	ut_assert(!ofi_trigger_peek(&queue));
+
+	ofi_trigger_queue_cleanup(&queue);
+	ut_assert(!queue.heap && !queue.size);
+	return 0;
+}
+
+struct ut_test ut_queue_tests[] = {
+	{ "cirque_basic", ut_cirque_basic },
+	{ "cirque_wrap", ut_cirque_wrap },
+	{ "freestack_basic", ut_freestack_basic },
+	{ "ringbuf_basic", ut_ringbuf_basic },
+	{ "ringbuf_wrap", ut_ringbuf_wrap },
+	{ "trigger_order", ut_trigger_order },
+	{ "trigger_threshold", ut_trigger_threshold },
+	{ "trigger_pop", ut_trigger_pop },
+	{ NULL, NULL },
+};
@@ -41,6 +41,7 @@
 #include <netdb.h>
 #include <poll.h>
 #include <limits.h>
+#include <pthread.h>
 
 #include <stdbool.h>
 #include <stdio.h>
@@ -60,6 +61,8 @@
 #include <rdma/fi_eq.h>
 #include <rdma/fi_errno.h>
 #include <rdma/fi_tagged.h>
+#include <rdma/fi_rma.h>
+#include <rdma/fi_atomic.h>
 
 #ifndef OFI_MR_BASIC_MAP
 #define OFI_MR_BASIC_MAP (FI_MR_ALLOCATED | FI_MR_PROV_KEY | FI_MR_VIRT_ADDR)
@@ -82,6 +85,32 @@ enum {
 	PP_OPT_ITER = 1 << 1,
 	PP_OPT_SIZE = 1 << 2,
 	PP_OPT_VERIFY_DATA = 1 << 3,
+	PP_OPT_JSON = 1 << 4,
+};
+
+enum pp_test {
+	PP_TEST_PINGPONG,
+	PP_TEST_BW,
+	PP_TEST_BIBW,
+	PP_TEST_RATE,
+	PP_TEST_TAGGED,
+	PP_TEST_WRITE,
+	PP_TEST_READ,
+	PP_TEST_ATOMIC,
+	PP_TEST_ATOMIC_RATE,
+	PP_TEST_MAX,
+};
+
+static const char *pp_test_names[PP_TEST_MAX] = {
+	[PP_TEST_PINGPONG] = "pingpong",
+	[PP_TEST_BW] = "bw",
+	[PP_TEST_BIBW] = "bibw",
+	[PP_TEST_RATE] = "rate",
+	[PP_TEST_TAGGED] = "tagged",
+	[PP_TEST_WRITE] = "write",
+	[PP_TEST_READ] = "read",
+	[PP_TEST_ATOMIC] = "atomic",
+	[PP_TEST_ATOMIC_RATE] = "atomic_rate",
 };
 
 struct pp_opts {
@@ -92,6 +121,38 @@ struct pp_opts {
 	int transfer_size;
 	int sizes_enabled;
 	int options;
+	enum pp_test test;
+	int window;
+	int tags;
+	int threads;
+};
+
+enum {
+	PP_LAT_P50,
+	PP_LAT_P99,
+	PP_LAT_P999,
+	PP_LAT_CNT,
+};
+
+static const double pp_lat_pct[PP_LAT_CNT] = {0.50, 0.99, 0.999};
+static const char *pp_lat_names[PP_LAT_CNT] = {"p50", "p99", "p999"};
+
+struct pp_result {
+	int size;
+	int sent;
+	long acked;
+	uint64_t bytes;
+	uint64_t elapsed;
+	double mb_per_sec;
+	double usec_per_xfer;
+	double mxfers_per_sec;
+	/* -1 when the side did not time individual iterations */
+	double lat_usec[PP_LAT_CNT];
+};
+
+struct pp_rma_info {
+	uint64_t addr;
+	uint64_t key;
 };
 
 #define PP_SIZE_MAX_POWER_TWO 22
@@ -113,6 +174,10 @@ struct pp_opts {
 #define PP_MSG_LEN_CNT 10
 #define PP_MSG_SYNC_Q "q"
 #define PP_MSG_SYNC_A "a"
+#define PP_MSG_LEN_RMA 32
+
+#define PP_ACK_SIZE 4
+#define PP_DEFAULT_WINDOW 64
 
 #define PP_PRINTERR(call, retv)                                                \
 	fprintf(stderr, "%s(): %s:%-4d, ret=%d (%s)\n", call, __FILE__,        \
@@ -175,9 +240,16 @@ struct ct_pingpong {
 
 	struct fid_mr no_mr;
 	struct fi_context tx_ctx, rx_ctx;
+	/* tx window, rx window, then one per pre-posted tag */
+	struct fi_context *ctx_arr;
 	uint64_t remote_cq_data;
 
 	uint64_t tx_seq, rx_seq, tx_cq_cntr, rx_cq_cntr;
+	/* rx_seq once every receive of a windowed test is posted */
+	uint64_t rx_seq_max;
+	unsigned int fill_iter, check_iter;
+
+	struct pp_rma_info local_rma, remote_rma;
 
 	fi_addr_t remote_fi_addr;
 	void *buf, *tx_buf, *rx_buf;
@@ -185,6 +257,15 @@ struct ct_pingpong {
 
 	int timeout_sec;
 	uint64_t start, end;
+	uint64_t *lat;
+	int lat_cnt;
+
+	int thread_id;
+	pthread_t thread;
+	struct pp_result *results;
+	int result_cnt;
+	char prov_name[PP_MAX_CTRL_MSG];
+	enum fi_ep_type ep_type;
 
 	struct fi_av_attr av_attr;
 	struct fi_eq_attr eq_attr;
@@ -216,6 +297,14 @@ uint64_t pp_gettime_us(void)
 	return now.tv_sec * 1000000 + now.tv_usec;
 }
 
+uint64_t pp_gettime_ns(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
 long parse_ulong(char *str, long max)
 {
 	long ret;
@@ -316,6 +405,10 @@ void pp_banner_options(struct ct_pingpong *ct)
 	PP_DEBUG("  - %-20s: [%" PRIu16 "]\n", "dst_port", opts.dst_port);
 	PP_DEBUG("  - %-20s: %s\n", "sizes_enabled", size_msg);
 	PP_DEBUG("  - %-20s: %s\n", "iterations", iter_msg);
+	PP_DEBUG("  - %-20s: %s\n", "test", pp_test_names[opts.test]);
+	PP_DEBUG("  - %-20s: %d\n", "window", opts.window);
+	PP_DEBUG("  - %-20s: %d\n", "tags", opts.tags);
+	PP_DEBUG("  - %-20s: %d\n", "threads", opts.threads);
 	if (ct->hints->fabric_attr->prov_name)
 		PP_DEBUG("  - %-20s: %s\n", "provider",
 			  ct->hints->fabric_attr->prov_name);
@@ -495,13 +588,18 @@ int pp_ctrl_init(struct ct_pingpong *ct)
 
 	PP_DEBUG("Initializing control messages\n");
 
+	/* Each thread runs its own control connection on consecutive ports */
 	if (ct->opts.dst_addr) {
 		if (ct->opts.dst_port == 0)
 			ct->opts.dst_port = default_ctrl;
+		ct->opts.dst_port += ct->thread_id;
+		if (ct->opts.src_port != 0)
+			ct->opts.src_port += ct->thread_id;
 		ret = pp_ctrl_init_client(ct);
 	} else {
 		if (ct->opts.src_port == 0)
 			ct->opts.src_port = default_ctrl;
+		ct->opts.src_port += ct->thread_id;
 		ret = pp_ctrl_init_server(ct);
 	}
 
@@ -791,6 +889,40 @@ int pp_ctrl_txrx_msg_count(struct ct_pingpong *ct)
 	return 0;
 }
 
+int pp_ctrl_txrx_rma_info(struct ct_pingpong *ct)
+{
+	char buf[PP_MSG_LEN_RMA + 1];
+	int ret;
+
+	PP_DEBUG("Exchanging RMA buffer information\n");
+
+	snprintf(buf, sizeof(buf), "%016" PRIx64 "%016" PRIx64,
+		 ct->local_rma.addr, ct->local_rma.key);
+	ret = pp_ctrl_send(ct, buf, PP_MSG_LEN_RMA);
+	if (ret < 0)
+		return ret;
+	if (ret < PP_MSG_LEN_RMA) {
+		PP_ERR("bad length of sent data (len=%d/%d)", ret,
+		       PP_MSG_LEN_RMA);
+		return -EBADMSG;
+	}
+
+	memset(buf, '\0', sizeof(buf));
+	ret = pp_ctrl_recv(ct, buf, PP_MSG_LEN_RMA);
+	if (ret < 0)
+		return ret;
+	if (ret < PP_MSG_LEN_RMA ||
+	    sscanf(buf, "%16" SCNx64 "%16" SCNx64, &ct->remote_rma.addr,
+		   &ct->remote_rma.key) != 2) {
+		PP_ERR("bad RMA information received: <%s>", buf);
+		return -EBADMSG;
+	}
+
+	PP_DEBUG("RMA buffer information exchanged\n");
+
+	return 0;
+}
+
 /*******************************************************************************
  *                                         Options
  ******************************************************************************/
@@ -814,18 +946,24 @@ static inline int pp_check_opts(struct ct_pingpong *ct, uint64_t flags)
 	return (ct->opts.options & flags) == flags;
 }
 
+static inline int pp_test_rma(struct ct_pingpong *ct)
+{
+	return ct->opts.test == PP_TEST_WRITE || ct->opts.test == PP_TEST_READ ||
+	       ct->opts.test == PP_TEST_ATOMIC ||
+	       ct->opts.test == PP_TEST_ATOMIC_RATE;
+}
+
 /*******************************************************************************
  *                                         Data Verification
  ******************************************************************************/
 
-void pp_fill_buf(void *buf, int size)
+void pp_fill_buf(struct ct_pingpong *ct, void *buf, int size)
 {
 	char *msg_buf;
 	int msg_index;
-	static unsigned int iter;
 	int i;
 
-	msg_index = ((iter++) * INTEG_SEED) % integ_alphabet_length;
+	msg_index = ((ct->fill_iter++) * INTEG_SEED) % integ_alphabet_length;
 	msg_buf = (char *)buf;
 	for (i = 0; i < size; i++) {
 		PP_DEBUG("index=%d msg_index=%d\n", i, msg_index);
@@ -835,17 +973,16 @@ void pp_fill_buf(void *buf, int size)
 	}
 }
 
-int pp_check_buf(void *buf, int size)
+int pp_check_buf(struct ct_pingpong *ct, void *buf, int size)
 {
 	char *recv_data;
 	char c;
-	static unsigned int iter;
 	int msg_index;
 	int i;
 
 	PP_DEBUG("Verifying buffer content\n");
 
-	msg_index = ((iter++) * INTEG_SEED) % integ_alphabet_length;
+	msg_index = ((ct->check_iter++) * INTEG_SEED) % integ_alphabet_length;
 	recv_data = (char *)buf;
 
 	for (i = 0; i < size; i++) {
@@ -860,8 +997,8 @@ int pp_check_buf(void *buf, int size)
 	}
 	if (i != size) {
 		PP_DEBUG("Finished veryfing buffer: content is corrupted\n");
-		printf("Error at iteration=%d size=%d byte=%d\n", iter, size,
-		       i);
+		printf("Error at iteration=%u size=%d byte=%d\n",
+		       ct->check_iter, size, i);
 		return 1;
 	}
 
@@ -1010,51 +1147,225 @@ char *cnt_str(char *str, size_t size, uint64_t cnt)
 	return str;
 }
 
-void show_perf(char *name, int tsize, int sent, int acked,
-	       uint64_t start, uint64_t end, int xfers_per_iter)
+static int pp_cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* The samples must be sorted */
+static double pp_percentile_usec(uint64_t *lat, int cnt, double pct)
+{
+	int index;
+
+	index = (int)(pct * cnt + 0.999999) - 1;
+	index = MAX(0, MIN(index, cnt - 1));
+	return lat[index] / 1000.0;
+}
+
+void show_perf(char *name, struct pp_result *res)
 {
 	static int header = 1;
 	char str[PP_STR_LEN];
-	int64_t elapsed = end - start;
-	uint64_t bytes = (uint64_t)sent * tsize * xfers_per_iter;
-	float usec_per_xfer;
+	int i;
 
-	if (sent == 0)
+	if (res->sent == 0)
 		return;
 
 	if (name) {
 		if (header) {
-			printf("%-50s%-8s%-8s%-9s%-8s%8s %10s%13s%13s\n",
+			printf("%-50s%-8s%-8s%-9s%-8s%8s %10s%13s%13s%10s%10s%10s\n",
 			       "name", "bytes", "#sent", "#ack", "total",
-			       "time", "MB/sec", "usec/xfer", "Mxfers/sec");
+			       "time", "MB/sec", "usec/xfer", "Mxfers/sec",
+			       pp_lat_names[PP_LAT_P50], pp_lat_names[PP_LAT_P99],
+			       pp_lat_names[PP_LAT_P999]);
 			header = 0;
 		}
 
 		printf("%-50s", name);
 	} else {
 		if (header) {
-			printf("%-8s%-8s%-9s%-8s%8s %10s%13s%13s\n", "bytes",
-			       "#sent", "#ack", "total", "time", "MB/sec",
-			       "usec/xfer", "Mxfers/sec");
+			printf("%-8s%-8s%-9s%-8s%8s %10s%13s%13s%10s%10s%10s\n",
+			       "bytes", "#sent", "#ack", "total", "time",
+			       "MB/sec", "usec/xfer", "Mxfers/sec",
+			       pp_lat_names[PP_LAT_P50], pp_lat_names[PP_LAT_P99],
+			       pp_lat_names[PP_LAT_P999]);
 			header = 0;
 		}
 	}
 
-	printf("%-8s", size_str(str, tsize));
-	printf("%-8s", cnt_str(str, sizeof(str), sent));
+	printf("%-8s", size_str(str, res->size));
+	printf("%-8s", cnt_str(str, sizeof(str), res->sent));
 
-	if (sent == acked)
-		printf("=%-8s", cnt_str(str, sizeof(str), acked));
-	else if (sent < acked)
-		printf("-%-8s", cnt_str(str, sizeof(str), acked - sent));
+	if (res->sent == res->acked)
+		printf("=%-8s", cnt_str(str, sizeof(str), res->acked));
+	else if (res->sent < res->acked)
+		printf("-%-8s", cnt_str(str, sizeof(str), res->acked - res->sent));
 	else
-		printf("+%-8s", cnt_str(str, sizeof(str), sent - acked));
+		printf("+%-8s", cnt_str(str, sizeof(str), res->sent - res->acked));
 
-	printf("%-8s", size_str(str, bytes));
+	printf("%-8s", size_str(str, res->bytes));
 
-	usec_per_xfer = ((float)elapsed / sent / xfers_per_iter);
-	printf("%8.2fs%10.2f%11.2f%11.2f\n", elapsed / 1000000.0,
-	       bytes / (1.0 * elapsed), usec_per_xfer, 1.0 / usec_per_xfer);
+	printf("%8.2fs%10.2f%11.2f%11.2f", res->elapsed / 1000000.0,
+	       res->mb_per_sec, res->usec_per_xfer, res->mxfers_per_sec);
+	for (i = 0; i < PP_LAT_CNT; i++) {
+		if (res->lat_usec[i] < 0)
+			printf("%10s", "-");
+		else
+			printf("%10.2f", res->lat_usec[i]);
+	}
+	printf("\n");
+}
+
+/* Latency samples are per-iteration times divided by the transfers of that
+ * iteration: the one-way latency for pingpong, the time per message for the
+ * streaming patterns.
+ */
+int pp_record_result(struct ct_pingpong *ct, int xfer_size,
+		     int xfers_per_iter)
+{
+	struct pp_result *res;
+	int64_t elapsed = ct->end - ct->start;
+	int i;
+
+	res = realloc(ct->results, (ct->result_cnt + 1) * sizeof(*res));
+	if (!res)
+		return -ENOMEM;
+	ct->results = res;
+	res = &ct->results[ct->result_cnt++];
+
+	res->size = xfer_size;
+	res->sent = ct->opts.iterations;
+	res->acked = ct->cnt_ack_msg;
+	res->bytes = (uint64_t)res->sent * xfer_size * xfers_per_iter;
+	res->elapsed = elapsed;
+	res->mb_per_sec = elapsed ? res->bytes / (1.0 * elapsed) : 0;
+	res->usec_per_xfer = res->sent ?
+		(double)elapsed / res->sent / xfers_per_iter : 0;
+	res->mxfers_per_sec = res->usec_per_xfer ? 1.0 / res->usec_per_xfer : 0;
+
+	if (ct->lat_cnt)
+		qsort(ct->lat, ct->lat_cnt, sizeof(*ct->lat), pp_cmp_u64);
+	for (i = 0; i < PP_LAT_CNT; i++) {
+		res->lat_usec[i] = ct->lat_cnt ?
+			pp_percentile_usec(ct->lat, ct->lat_cnt, pp_lat_pct[i]) /
+			xfers_per_iter : -1;
+	}
+
+	if (ct->opts.threads == 1 && !(ct->opts.options & PP_OPT_JSON))
+		show_perf(NULL, res);
+
+	return 0;
+}
+
+/* Sums the rates of all threads for one size; latencies are the worst seen */
+void pp_sum_results(struct pp_result *sum, struct ct_pingpong *cts,
+		    int thread_cnt, int index)
+{
+	struct pp_result *res;
+	int i, j;
+
+	memset(sum, 0, sizeof(*sum));
+	for (i = 0; i < PP_LAT_CNT; i++)
+		sum->lat_usec[i] = -1;
+
+	for (i = 0; i < thread_cnt; i++) {
+		if (index >= cts[i].result_cnt)
+			continue;
+		res = &cts[i].results[index];
+		sum->size = res->size;
+		sum->sent += res->sent;
+		sum->acked += res->acked;
+		sum->bytes += res->bytes;
+		sum->elapsed = MAX(sum->elapsed, res->elapsed);
+		sum->mb_per_sec += res->mb_per_sec;
+		sum->mxfers_per_sec += res->mxfers_per_sec;
+		for (j = 0; j < PP_LAT_CNT; j++)
+			sum->lat_usec[j] = MAX(sum->lat_usec[j], res->lat_usec[j]);
+	}
+	sum->usec_per_xfer = sum->mxfers_per_sec ? 1.0 / sum->mxfers_per_sec : 0;
+}
+
+static void pp_json_result(struct pp_result *res, const char *thread, int last)
+{
+	int i;
+
+	printf("    {\"thread\": %s, \"size\": %d, \"iterations\": %d, "
+	       "\"acked\": %ld, \"bytes\": %" PRIu64 ", "
+	       "\"time_usec\": %" PRIu64 ", \"mb_per_sec\": %.2f, "
+	       "\"usec_per_xfer\": %.3f, \"mxfers_per_sec\": %.3f",
+	       thread, res->size, res->sent, res->acked, res->bytes,
+	       res->elapsed, res->mb_per_sec, res->usec_per_xfer,
+	       res->mxfers_per_sec);
+	for (i = 0; i < PP_LAT_CNT; i++) {
+		if (res->lat_usec[i] < 0)
+			printf(", \"lat_%s_usec\": null", pp_lat_names[i]);
+		else
+			printf(", \"lat_%s_usec\": %.3f", pp_lat_names[i],
+			       res->lat_usec[i]);
+	}
+	printf("}%s\n", last ? "" : ",");
+}
+
+void pp_show_results(struct ct_pingpong *cts, int thread_cnt)
+{
+	struct pp_result sum;
+	char name[PP_STR_LEN];
+	int i, j, result_cnt = 0;
+	int json = cts[0].opts.options & PP_OPT_JSON;
+
+	for (i = 0; i < thread_cnt; i++)
+		result_cnt = MAX(result_cnt, cts[i].result_cnt);
+
+	if (!json) {
+		if (thread_cnt == 1)
+			return;
+
+		for (j = 0; j < result_cnt; j++) {
+			for (i = 0; i < thread_cnt; i++) {
+				if (j >= cts[i].result_cnt)
+					continue;
+				snprintf(name, sizeof(name), "%s/%d",
+					 pp_test_names[cts[i].opts.test], i);
+				show_perf(name, &cts[i].results[j]);
+			}
+			pp_sum_results(&sum, cts, thread_cnt, j);
+			snprintf(name, sizeof(name), "%s/all",
+				 pp_test_names[cts[0].opts.test]);
+			show_perf(name, &sum);
+		}
+		return;
+	}
+
+	printf("{\n");
+	printf("  \"test\": \"%s\",\n", pp_test_names[cts[0].opts.test]);
+	printf("  \"provider\": \"%s\",\n", cts[0].prov_name);
+	printf("  \"endpoint\": \"%s\",\n",
+	       fi_tostr(&cts[0].ep_type, FI_TYPE_EP_TYPE));
+	printf("  \"role\": \"%s\",\n",
+	       cts[0].opts.dst_addr ? "client" : "server");
+	printf("  \"window\": %d,\n", cts[0].opts.window);
+	printf("  \"tags\": %d,\n", cts[0].opts.tags);
+	printf("  \"threads\": %d,\n", thread_cnt);
+	printf("  \"results\": [\n");
+	for (i = 0; i < thread_cnt; i++) {
+		snprintf(name, sizeof(name), "%d", i);
+		for (j = 0; j < cts[i].result_cnt; j++)
+			pp_json_result(&cts[i].results[j], name,
+				       i == thread_cnt - 1 &&
+				       j == cts[i].result_cnt - 1);
+	}
+	printf("  ]");
+	if (thread_cnt > 1) {
+		printf(",\n  \"total\": [\n");
+		for (j = 0; j < result_cnt; j++) {
+			pp_sum_results(&sum, cts, thread_cnt, j);
+			pp_json_result(&sum, "\"all\"", j == result_cnt - 1);
+		}
+		printf("  ]");
+	}
+	printf("\n}\n");
 }
 
 /*******************************************************************************
@@ -1085,6 +1396,14 @@ static int pp_get_cq_comp(struct fid_cq *cq, uint64_t *cur, uint64_t total,
 	uint64_t a = 0, b = 0;
 	int ret = 0;
 
+	/* Nothing outstanding, but a retried post still needs progress */
+	if (total == *cur) {
+		ret = fi_cq_read(cq, &comp, 1);
+		if (ret == -FI_EAVAIL)
+			return pp_cq_readerr(cq);
+		return (ret < 0 && ret != -FI_EAGAIN) ? ret : 0;
+	}
+
 	if (timeout_sec >= 0)
 		a = pp_gettime_us();
 
@@ -1192,7 +1511,7 @@ ssize_t pp_tx(struct ct_pingpong *ct, struct fid_ep *ep, size_t size)
 	ssize_t ret;
 
 	if (pp_check_opts(ct, PP_OPT_VERIFY_DATA | PP_OPT_ACTIVE))
-		pp_fill_buf((char *)ct->tx_buf, size);
+		pp_fill_buf(ct, (char *)ct->tx_buf, size);
 
 	ret = pp_post_tx(ct, ep, size, &(ct->tx_ctx));
 	if (ret)
@@ -1203,13 +1522,34 @@ ssize_t pp_tx(struct ct_pingpong *ct, struct fid_ep *ep, size_t size)
 	return ret;
 }
 
+/* Injects do not generate completions, but reading the CQ still drives
+ * progress for providers that need it to release inject resources.
+ */
+int pp_progress_tx(struct ct_pingpong *ct, uint64_t total)
+{
+	struct fi_cq_err_entry comp;
+	int ret;
+
+	ret = fi_cq_read(ct->txcq, &comp, 1);
+	if (ret > 0) {
+		ct->tx_cq_cntr++;
+		return 0;
+	} else if (ret == -FI_EAVAIL) {
+		ret = pp_cq_readerr(ct->txcq);
+		ct->tx_cq_cntr++;
+		return ret;
+	}
+
+	return ret == -FI_EAGAIN ? 0 : ret;
+}
+
 ssize_t pp_post_inject(struct ct_pingpong *ct, struct fid_ep *ep, size_t size)
 {
 	if (!(ct->fi->caps & FI_TAGGED))
-		PP_POST(fi_inject, pp_get_tx_comp, ct->tx_seq, "inject", ep,
+		PP_POST(fi_inject, pp_progress_tx, ct->tx_seq, "inject", ep,
 			ct->tx_buf, size, ct->remote_fi_addr);
 	else
-		PP_POST(fi_tinject, pp_get_tx_comp, ct->tx_seq, "tinject", ep,
+		PP_POST(fi_tinject, pp_progress_tx, ct->tx_seq, "tinject", ep,
 			ct->tx_buf, size, ct->remote_fi_addr, TAG);
 	ct->tx_cq_cntr++;
 	return 0;
@@ -1220,7 +1560,7 @@ ssize_t pp_inject(struct ct_pingpong *ct, struct fid_ep *ep, size_t size)
 	ssize_t ret;
 
 	if (pp_check_opts(ct, PP_OPT_VERIFY_DATA | PP_OPT_ACTIVE))
-		pp_fill_buf((char *)ct->tx_buf, size);
+		pp_fill_buf(ct, (char *)ct->tx_buf, size);
 
 	ret = pp_post_inject(ct, ep, size);
 	if (ret)
@@ -1252,7 +1592,7 @@ ssize_t pp_rx(struct ct_pingpong *ct, struct fid_ep *ep, size_t size)
 		return ret;
 
 	if (pp_check_opts(ct, PP_OPT_VERIFY_DATA | PP_OPT_ACTIVE)) {
-		ret = pp_check_buf((char *)ct->rx_buf, size);
+		ret = pp_check_buf(ct, (char *)ct->rx_buf, size);
 		if (ret)
 			return ret;
 	}
@@ -1270,19 +1610,165 @@ ssize_t pp_rx(struct ct_pingpong *ct, struct fid_ep *ep, size_t size)
 	return ret;
 }
 
+/*******************************************************************************
+ *                                   Windowed Messaging
+ ******************************************************************************/
+
+static inline struct fi_context *pp_tx_ctx(struct ct_pingpong *ct,
+					   uint64_t seq)
+{
+	return &ct->ctx_arr[seq % ct->opts.window];
+}
+
+static inline struct fi_context *pp_rx_ctx(struct ct_pingpong *ct,
+					   uint64_t seq)
+{
+	return &ct->ctx_arr[ct->opts.window + seq % ct->opts.window];
+}
+
+static inline struct fi_context *pp_tag_ctx(struct ct_pingpong *ct, int index)
+{
+	return &ct->ctx_arr[2 * ct->opts.window + index];
+}
+
+ssize_t pp_post_rma(struct ct_pingpong *ct, size_t size, struct fi_context *ctx)
+{
+	switch (ct->opts.test) {
+	case PP_TEST_WRITE:
+		PP_POST(fi_write, pp_get_tx_comp, ct->tx_seq, "fi_write", ct->ep,
+			ct->tx_buf, size, fi_mr_desc(ct->mr),
+			ct->remote_fi_addr, ct->remote_rma.addr,
+			ct->remote_rma.key, ctx);
+		break;
+	case PP_TEST_READ:
+		PP_POST(fi_read, pp_get_tx_comp, ct->tx_seq, "fi_read", ct->ep,
+			ct->rx_buf, size, fi_mr_desc(ct->mr),
+			ct->remote_fi_addr, ct->remote_rma.addr,
+			ct->remote_rma.key, ctx);
+		break;
+	case PP_TEST_ATOMIC_RATE:
+		PP_POST(fi_inject_atomic, pp_progress_tx, ct->tx_seq,
+			"fi_inject_atomic", ct->ep, ct->tx_buf,
+			size / sizeof(uint64_t), ct->remote_fi_addr,
+			ct->remote_rma.addr, ct->remote_rma.key, FI_UINT64,
+			FI_SUM);
+		ct->tx_cq_cntr++;
+		break;
+	default:
+		PP_POST(fi_atomic, pp_get_tx_comp, ct->tx_seq, "fi_atomic",
+			ct->ep, ct->tx_buf, size / sizeof(uint64_t),
+			fi_mr_desc(ct->mr), ct->remote_fi_addr,
+			ct->remote_rma.addr, ct->remote_rma.key, FI_UINT64,
+			FI_SUM, ctx);
+		break;
+	}
+	return 0;
+}
+
+/* Keeps up to a window of receives posted, until all the receives expected by
+ * the current test (rx_seq_max) are posted.
+ */
+ssize_t pp_post_rx_window(struct ct_pingpong *ct)
+{
+	ssize_t ret;
+
+	while (ct->rx_seq < ct->rx_seq_max &&
+	       ct->rx_seq - ct->rx_cq_cntr < ct->opts.window) {
+		ret = pp_post_rx(ct, ct->ep, ct->rx_size,
+				 pp_rx_ctx(ct, ct->rx_seq));
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+ssize_t pp_rx_window(struct ct_pingpong *ct, int count)
+{
+	ssize_t ret;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		ret = pp_get_rx_comp(ct, ct->rx_cq_cntr + 1);
+		if (ret)
+			return ret;
+
+		ret = pp_post_rx_window(ct);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+ssize_t pp_tx_window(struct ct_pingpong *ct, size_t size, int count)
+{
+	ssize_t ret;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		if (ct->opts.test == PP_TEST_RATE)
+			ret = pp_post_inject(ct, ct->ep, size);
+		else if (pp_test_rma(ct))
+			ret = pp_post_rma(ct, size, pp_tx_ctx(ct, ct->tx_seq));
+		else
+			ret = pp_post_tx(ct, ct->ep, size,
+					 pp_tx_ctx(ct, ct->tx_seq));
+		if (ret)
+			return ret;
+	}
+	return pp_get_tx_comp(ct, ct->tx_seq);
+}
+
+ssize_t pp_tx_ack(struct ct_pingpong *ct)
+{
+	ssize_t ret;
+
+	ret = pp_post_tx(ct, ct->ep, PP_ACK_SIZE, &(ct->tx_ctx));
+	if (ret)
+		return ret;
+
+	return pp_get_tx_comp(ct, ct->tx_seq);
+}
+
+/* Pre-posted tagged receives that never match, making every match walk past
+ * them.  They stay posted until the endpoint is closed.
+ */
+int pp_post_tags(struct ct_pingpong *ct)
+{
+	int i, ret;
+
+	for (i = 0; i < ct->opts.tags; i++) {
+		ret = fi_trecv(ct->ep, ct->rx_buf, ct->rx_size,
+			       fi_mr_desc(ct->mr), 0, TAG + 1 + i, 0,
+			       pp_tag_ctx(ct, i));
+		if (ret) {
+			PP_PRINTERR("fi_trecv", ret);
+			return ret;
+		}
+	}
+	return 0;
+}
+
 /*******************************************************************************
  *                                Initialization and allocations
  ******************************************************************************/
 
-void init_test(struct ct_pingpong *ct, struct pp_opts *opts)
+int init_test(struct ct_pingpong *ct, struct pp_opts *opts)
 {
 	char sstr[PP_STR_LEN];
+	uint64_t *lat;
 
 	size_str(sstr, opts->transfer_size);
 	if (!(opts->options & PP_OPT_ITER))
 		opts->iterations = size_to_count(opts->transfer_size);
 
+	lat = realloc(ct->lat, MAX(opts->iterations, 1) * sizeof(*lat));
+	if (!lat)
+		return -ENOMEM;
+	ct->lat = lat;
+	ct->lat_cnt = 0;
+
 	ct->cnt_ack_msg = 0;
+	return 0;
 }
 
 uint64_t pp_init_cq_data(struct fi_info *info)
@@ -1297,6 +1783,8 @@ uint64_t pp_init_cq_data(struct fi_info *info)
 
 int pp_alloc_msgs(struct ct_pingpong *ct)
 {
+	uint64_t access = FI_SEND | FI_RECV;
+	size_t rx_depth;
 	int ret;
 	long alignment = 1;
 
@@ -1330,10 +1818,28 @@ int pp_alloc_msgs(struct ct_pingpong *ct)
 
 	ct->remote_cq_data = pp_init_cq_data(ct->fi);
 
-	if (ct->fi->domain_attr->mr_mode & FI_MR_LOCAL) {
-		ret = fi_mr_reg(ct->domain, ct->buf, ct->buf_size,
-				FI_SEND | FI_RECV, 0, PP_MR_KEY, 0, &(ct->mr),
-				NULL);
+	/* Windowed receives, pre-posted tags and the receive left posted
+	 * between tests must all fit in the receive queue.
+	 */
+	rx_depth = ct->opts.window + ct->opts.tags + 1;
+	if (rx_depth > ct->fi->rx_attr->size) {
+		PP_ERR("window (%d) and tags (%d) exceed the receive queue "
+		       "size (%zu)", ct->opts.window, ct->opts.tags,
+		       ct->fi->rx_attr->size);
+		return -EINVAL;
+	}
+
+	ct->ctx_arr = calloc(2 * ct->opts.window + ct->opts.tags,
+			     sizeof(*ct->ctx_arr));
+	if (!ct->ctx_arr)
+		return -ENOMEM;
+
+	if (pp_test_rma(ct))
+		access |= FI_READ | FI_WRITE | FI_REMOTE_READ | FI_REMOTE_WRITE;
+
+	if ((ct->fi->domain_attr->mr_mode & FI_MR_LOCAL) || pp_test_rma(ct)) {
+		ret = fi_mr_reg(ct->domain, ct->buf, ct->buf_size, access, 0,
+				PP_MR_KEY, 0, &(ct->mr), NULL);
 		if (ret) {
 			PP_PRINTERR("fi_mr_reg", ret);
 			return ret;
@@ -1342,6 +1848,11 @@ int pp_alloc_msgs(struct ct_pingpong *ct)
 		ct->mr = &(ct->no_mr);
 	}
 
+	/* RMA targets the receive buffer, which starts the registration */
+	ct->local_rma.addr = ct->fi->domain_attr->mr_mode & FI_MR_VIRT_ADDR ?
+			     (uintptr_t)ct->rx_buf : 0;
+	ct->local_rma.key = pp_test_rma(ct) ? fi_mr_key(ct->mr) : 0;
+
 	return 0;
 }
 
@@ -1469,6 +1980,10 @@ int pp_init_ep(struct ct_pingpong *ct)
 		return ret;
 	}
 
+	ret = pp_post_tags(ct);
+	if (ret)
+		return ret;
+
 	ret = pp_post_rx(ct, ct->ep, MAX(ct->rx_size, PP_MAX_CTRL_MSG),
 			 &(ct->rx_ctx));
 	if (ret)
@@ -1810,6 +2325,13 @@ void pp_free_res(struct ct_pingpong *ct)
 		ct->buf = ct->rx_buf = ct->tx_buf = NULL;
 		ct->buf_size = ct->rx_size = ct->tx_size = 0;
 	}
+	free(ct->ctx_arr);
+	ct->ctx_arr = NULL;
+	free(ct->lat);
+	ct->lat = NULL;
+	free(ct->results);
+	ct->results = NULL;
+	ct->result_cnt = 0;
 	if (ct->fi_pep) {
 		fi_freeinfo(ct->fi_pep);
 		ct->fi_pep = NULL;
@@ -1826,13 +2348,61 @@ void pp_free_res(struct ct_pingpong *ct)
 	PP_DEBUG("Resources of test suite freed\n");
 }
 
+/* Reads the completions available on cq, without waiting for more */
+static int pp_poll_cq(struct fid_cq *cq, uint64_t *cur, uint64_t total)
+{
+	struct fi_cq_err_entry comp;
+	int ret;
+
+	do {
+		ret = fi_cq_read(cq, &comp, 1);
+		if (ret == -FI_EAGAIN)
+			return 0;
+		if (ret == -FI_EAVAIL)
+			return pp_cq_readerr(cq);
+		if (ret < 0)
+			return ret;
+		/* a retried post still needs progress with nothing pending */
+		if (*cur == total)
+			return 0;
+		(*cur)++;
+	} while (*cur < total);
+
+	return 0;
+}
+
+static ssize_t pp_post_fin(struct ct_pingpong *ct, struct iovec *iov,
+			   struct fi_context *ctx)
+{
+	struct fi_msg msg;
+	struct fi_msg_tagged tmsg;
+
+	if (!(ct->fi->caps & FI_TAGGED)) {
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.iov_count = 1;
+		msg.addr = ct->remote_fi_addr;
+		msg.context = ctx;
+
+		return fi_sendmsg(ct->ep, &msg,
+				  FI_INJECT | FI_TRANSMIT_COMPLETE);
+	}
+
+	memset(&tmsg, 0, sizeof(tmsg));
+	tmsg.msg_iov = iov;
+	tmsg.iov_count = 1;
+	tmsg.addr = ct->remote_fi_addr;
+	tmsg.context = ctx;
+	tmsg.tag = TAG;
+
+	return fi_tsendmsg(ct->ep, &tmsg, FI_INJECT | FI_TRANSMIT_COMPLETE);
+}
+
 int pp_finalize(struct ct_pingpong *ct)
 {
 	struct iovec iov;
 	int ret;
 	struct fi_context ctx;
-	struct fi_msg msg;
-	struct fi_msg_tagged tmsg;
 
 	PP_DEBUG("Terminating test\n");
 
@@ -1840,31 +2410,18 @@ int pp_finalize(struct ct_pingpong *ct)
 	iov.iov_base = ct->tx_buf;
 	iov.iov_len = 4;
 
-	if (!(ct->fi->caps & FI_TAGGED)) {
-		memset(&msg, 0, sizeof(msg));
-		msg.msg_iov = &iov;
-		msg.iov_count = 1;
-		msg.addr = ct->remote_fi_addr;
-		msg.context = &ctx;
-
-		ret = fi_sendmsg(ct->ep, &msg, FI_INJECT | FI_TRANSMIT_COMPLETE);
-		if (ret) {
-			PP_PRINTERR("transmit", ret);
+	while ((ret = pp_post_fin(ct, &iov, &ctx)) == -FI_EAGAIN) {
+		ret = pp_poll_cq(ct->txcq, &ct->tx_cq_cntr, ct->tx_seq);
+		if (ret)
 			return ret;
-		}
-	} else {
-		memset(&tmsg, 0, sizeof(tmsg));
-		tmsg.msg_iov = &iov;
-		tmsg.iov_count = 1;
-		tmsg.addr = ct->remote_fi_addr;
-		tmsg.context = &ctx;
-		tmsg.tag = TAG;
-
-		ret = fi_tsendmsg(ct->ep, &tmsg, FI_INJECT | FI_TRANSMIT_COMPLETE);
-		if (ret) {
-			PP_PRINTERR("t-transmit", ret);
+		ret = pp_poll_cq(ct->rxcq, &ct->rx_cq_cntr, ct->rx_seq);
+		if (ret)
 			return ret;
-		}
+	}
+	if (ret) {
+		PP_PRINTERR((ct->fi->caps & FI_TAGGED) ?
+			    "t-transmit" : "transmit", ret);
+		return ret;
 	}
 
 	ret = pp_get_tx_comp(ct, ++ct->tx_seq);
@@ -1875,6 +2432,11 @@ int pp_finalize(struct ct_pingpong *ct)
 	if (ret)
 		return ret;
 
+	/* Keep the endpoint open until the peer has its "fin" as well */
+	ret = pp_ctrl_sync(ct);
+	if (ret)
+		return ret;
+
 	ret = pp_ctrl_finish(ct);
 	if (ret)
 		return ret;
@@ -1920,12 +2482,25 @@ void pp_pingpong_usage(char *name, char *desc)
 	fprintf(stderr, " %-20s %s\n", "-m <transmit mode>",
 		"transmit mode type: msg|tagged (msg)");
 
+	fprintf(stderr, " %-20s %s\n", "-T <test>",
+		"test pattern: pingpong|bw|bibw|rate|tagged|write|read|atomic|"
+		"atomic_rate (pingpong)");
+	fprintf(stderr, " %-20s %s\n", "-W <window>",
+		"transfers in flight for streaming patterns (64)");
+	fprintf(stderr, " %-20s %s\n", "-N <tags>",
+		"non-matching tagged receives to pre-post (0)");
+	fprintf(stderr, " %-20s %s\n", "-n <threads>",
+		"threads, each with its own endpoint (1)");
+	fprintf(stderr, " %-20s %s\n", "-j", "print the results as JSON");
+
 	fprintf(stderr, " %-20s %s\n", "-h", "display this help output");
 	fprintf(stderr, " %-20s %s\n", "-v", "enable debugging output");
 }
 
 void pp_parse_opts(struct ct_pingpong *ct, int op, char *optarg)
 {
+	int i;
+
 	switch (op) {
 
 	/* Domain */
@@ -1998,6 +2573,45 @@ void pp_parse_opts(struct ct_pingpong *ct, int op, char *optarg)
 		}
 		break;
 
+	/* Test pattern */
+	case 'T':
+		for (i = 0; i < PP_TEST_MAX; i++) {
+			if (!strcasecmp(pp_test_names[i], optarg))
+				break;
+		}
+		if (i == PP_TEST_MAX) {
+			fprintf(stderr, "Unknown test : %s\n", optarg);
+			exit(EXIT_FAILURE);
+		}
+		ct->opts.test = i;
+		break;
+
+	/* Window */
+	case 'W':
+		ct->opts.window = (int)parse_ulong(optarg, INT_MAX);
+		if (ct->opts.window < 1)
+			ct->opts.window = 1;
+		break;
+
+	/* Pre-posted non-matching tags */
+	case 'N':
+		ct->opts.tags = (int)parse_ulong(optarg, INT_MAX);
+		if (ct->opts.tags < 0)
+			ct->opts.tags = 0;
+		break;
+
+	/* Threads */
+	case 'n':
+		ct->opts.threads = (int)parse_ulong(optarg, UINT16_MAX);
+		if (ct->opts.threads < 1)
+			ct->opts.threads = 1;
+		break;
+
+	/* JSON output */
+	case 'j':
+		ct->opts.options |= PP_OPT_JSON;
+		break;
+
 	/* Debug */
 	case 'v':
 		pp_debug = 1;
@@ -2015,6 +2629,7 @@ void pp_parse_opts(struct ct_pingpong *ct, int op, char *optarg)
 int pingpong(struct ct_pingpong *ct)
 {
 	int ret, i;
+	uint64_t t;
 
 	ret = pp_ctrl_sync(ct);
 	if (ret)
@@ -2023,6 +2638,7 @@ int pingpong(struct ct_pingpong *ct)
 	pp_start(ct);
 	if (ct->opts.dst_addr) {
 		for (i = 0; i < ct->opts.iterations; i++) {
+			t = pp_gettime_ns();
 
 			if (ct->opts.transfer_size <
 			    ct->fi->tx_attr->inject_size)
@@ -2036,9 +2652,12 @@ int pingpong(struct ct_pingpong *ct)
 			ret = pp_rx(ct, ct->ep, ct->opts.transfer_size);
 			if (ret)
 				return ret;
+
+			ct->lat[ct->lat_cnt++] = pp_gettime_ns() - t;
 		}
 	} else {
 		for (i = 0; i < ct->opts.iterations; i++) {
+			t = pp_gettime_ns();
 
 			ret = pp_rx(ct, ct->ep, ct->opts.transfer_size);
 			if (ret)
@@ -2052,6 +2671,8 @@ int pingpong(struct ct_pingpong *ct)
 				ret = pp_tx(ct, ct->ep, ct->opts.transfer_size);
 			if (ret)
 				return ret;
+
+			ct->lat[ct->lat_cnt++] = pp_gettime_ns() - t;
 		}
 	}
 	pp_stop(ct);
@@ -2061,10 +2682,120 @@ int pingpong(struct ct_pingpong *ct)
 		return ret;
 
 	PP_DEBUG("Results:\n");
-	show_perf(NULL, ct->opts.transfer_size, ct->opts.iterations,
-		  ct->cnt_ack_msg, ct->start, ct->end, 2);
+	return pp_record_result(ct, ct->opts.transfer_size, 2);
+}
 
-	return 0;
+/* Streaming patterns: every iteration moves a window of transfers.
+ *
+ * bw/rate: the client sends a window, the server acks it.
+ * bibw: both sides send a window and receive the peer's.
+ * write/read/atomic/atomic_rate: the client issues a window of operations
+ * against the server's buffer, which only progresses until the client
+ * reports done.
+ */
+int pp_stream(struct ct_pingpong *ct)
+{
+	int client = ct->opts.dst_addr != NULL;
+	int size = ct->opts.transfer_size;
+	int window = ct->opts.window;
+	int xfers = window;
+	uint64_t rx_cnt, t;
+	int ret, i;
+
+	switch (ct->opts.test) {
+	case PP_TEST_BW:
+	case PP_TEST_RATE:
+		rx_cnt = client ? ct->opts.iterations :
+			 (uint64_t)ct->opts.iterations * window;
+		break;
+	case PP_TEST_BIBW:
+		rx_cnt = (uint64_t)ct->opts.iterations * window;
+		xfers = 2 * window;
+		break;
+	default:
+		rx_cnt = client ? 0 : 1;
+		break;
+	}
+
+	ct->rx_seq_max = ct->rx_seq + rx_cnt;
+	ret = pp_post_rx_window(ct);
+	if (ret)
+		return ret;
+
+	ret = pp_ctrl_sync(ct);
+	if (ret)
+		return ret;
+
+	pp_start(ct);
+	if (pp_test_rma(ct) && !client) {
+		ret = pp_rx_window(ct, 1);
+		if (ret)
+			return ret;
+	} else {
+		for (i = 0; i < ct->opts.iterations; i++) {
+			t = pp_gettime_ns();
+
+			if (client || ct->opts.test == PP_TEST_BIBW) {
+				ret = pp_tx_window(ct, size, window);
+				if (ret)
+					return ret;
+			}
+
+			if (ct->opts.test == PP_TEST_BIBW || !client)
+				ret = pp_rx_window(ct, window);
+			else if (!pp_test_rma(ct))
+				ret = pp_rx_window(ct, 1);
+			if (ret)
+				return ret;
+
+			if (!client && ct->opts.test != PP_TEST_BIBW) {
+				ret = pp_tx_ack(ct);
+				if (ret)
+					return ret;
+			}
+
+			ct->lat[ct->lat_cnt++] = pp_gettime_ns() - t;
+			ct->cnt_ack_msg++;
+		}
+	}
+	pp_stop(ct);
+
+	if (pp_test_rma(ct) && client) {
+		ret = pp_tx_ack(ct);
+		if (ret)
+			return ret;
+	}
+
+	ret = pp_ctrl_txrx_msg_count(ct);
+	if (ret)
+		return ret;
+
+	PP_DEBUG("Results:\n");
+	return pp_record_result(ct, size, xfers);
+}
+
+/* Sizes a pattern cannot carry are skipped */
+static int pp_test_size(struct ct_pingpong *ct, int size)
+{
+	size_t count;
+	int ret;
+
+	switch (ct->opts.test) {
+	case PP_TEST_RATE:
+		return size <= ct->fi->tx_attr->inject_size;
+	case PP_TEST_ATOMIC:
+	case PP_TEST_ATOMIC_RATE:
+		ret = fi_atomicvalid(ct->ep, FI_UINT64, FI_SUM, &count);
+		if (ret) {
+			PP_PRINTERR("fi_atomicvalid", ret);
+			return 0;
+		}
+		return size >= sizeof(uint64_t) &&
+		       !(size % sizeof(uint64_t)) &&
+		       size / sizeof(uint64_t) <= count;
+	default:
+		return 1;
+	}
 }
 
 int run_suite_pingpong(struct ct_pingpong *ct)
@@ -2075,14 +2806,37 @@ int run_suite_pingpong(struct ct_pingpong *ct)
 
 	pp_banner_fabric_info(ct);
 
+	snprintf(ct->prov_name, sizeof(ct->prov_name), "%s",
+		 ct->fi->fabric_attr->prov_name);
+	ct->ep_type = ct->fi->ep_attr->type;
+
+	if (pp_test_rma(ct)) {
+		ret = pp_ctrl_txrx_rma_info(ct);
+		if (ret)
+			return ret;
+	}
+
 	sizes_cnt = generate_test_sizes(&ct->opts, ct->tx_size, &sizes);
 
 	PP_DEBUG("Count of sizes to test: %d\n", sizes_cnt);
 
 	for (i = 0; i < sizes_cnt; i++) {
+		if (!pp_test_size(ct, sizes[i])) {
+			PP_DEBUG("Skipping size %d for test %s\n", sizes[i],
+				 pp_test_names[ct->opts.test]);
+			continue;
+		}
+
 		ct->opts.transfer_size = sizes[i];
-		init_test(ct, &(ct->opts));
-		ret = pingpong(ct);
+		ret = init_test(ct, &(ct->opts));
+		if (ret)
+			goto out;
+
+		if (ct->opts.test == PP_TEST_PINGPONG ||
+		    ct->opts.test == PP_TEST_TAGGED)
+			ret = pingpong(ct);
+		else
+			ret = pp_stream(ct);
 		if (ret)
 			goto out;
 	}
@@ -2169,16 +2923,46 @@ out:
 	return ret;
 }
 
+static int pp_run(struct ct_pingpong *ct)
+{
+	switch (ct->hints->ep_attr->type) {
+	case FI_EP_DGRAM:
+		if (ct->opts.options & PP_OPT_SIZE)
+			ct->hints->ep_attr->max_msg_size = ct->opts.transfer_size;
+		return run_pingpong_dgram(ct);
+	case FI_EP_RDM:
+		return run_pingpong_rdm(ct);
+	case FI_EP_MSG:
+		return run_pingpong_msg(ct);
+	default:
+		fprintf(stderr, "Endpoint unsupported: %d\n",
+			ct->hints->ep_attr->type);
+		return EXIT_FAILURE;
+	}
+}
+
+static void *pp_run_thread(void *arg)
+{
+	struct ct_pingpong *ct = arg;
+
+	return (void *)(intptr_t)pp_run(ct);
+}
+
 int main(int argc, char **argv)
 {
-	int op, ret = EXIT_SUCCESS;
+	int op, i, ret = EXIT_SUCCESS;
+	struct ct_pingpong *cts;
+	void *thread_ret;
 	struct ct_pingpong ct = {
 		.timeout_sec = -1,
 		.ctrl_connfd = -1,
 		.opts = {
 			.iterations = 1000,
 			.transfer_size = 1024,
-			.sizes_enabled = PP_DEFAULT_SIZE
+			.sizes_enabled = PP_DEFAULT_SIZE,
+			.test = PP_TEST_PINGPONG,
+			.window = PP_DEFAULT_WINDOW,
+			.threads = 1,
 		},
 		.eq_attr.wait_obj = FI_WAIT_UNSPEC,
 	};
@@ -2190,10 +2974,11 @@ int main(int argc, char **argv)
 	ct.hints->caps = FI_MSG;
 	ct.hints->mode = FI_CONTEXT;
 	ct.hints->domain_attr->mr_mode = FI_MR_LOCAL | OFI_MR_BASIC_MAP;
+	ct.hints->domain_attr->threading = FI_THREAD_DOMAIN;
 
 	ofi_osd_init();
 
-	while ((op = getopt(argc, argv, "hvd:p:e:I:S:B:P:cm:")) != -1) {
+	while ((op = getopt(argc, argv, "hvd:p:e:I:S:B:P:cm:T:W:N:n:j")) != -1) {
 		switch (op) {
 		default:
 			pp_parse_opts(&ct, op, optarg);
@@ -2209,26 +2994,74 @@ int main(int argc, char **argv)
 	if (optind < argc)
 		ct.opts.dst_addr = argv[optind];
 
-	pp_banner_options(&ct);
-
-	switch (ct.hints->ep_attr->type) {
-	case FI_EP_DGRAM:
-		if (ct.opts.options & PP_OPT_SIZE)
-			ct.hints->ep_attr->max_msg_size = ct.opts.transfer_size;
-		ret = run_pingpong_dgram(&ct);
+	switch (ct.opts.test) {
+	case PP_TEST_PINGPONG:
+		ct.opts.window = 1;
 		break;
-	case FI_EP_RDM:
-		ret = run_pingpong_rdm(&ct);
+	case PP_TEST_TAGGED:
+		ct.opts.window = 1;
+		ct.hints->caps &= ~FI_MSG;
+		ct.hints->caps |= FI_TAGGED;
 		break;
-	case FI_EP_MSG:
-		ret = run_pingpong_msg(&ct);
+	case PP_TEST_WRITE:
+	case PP_TEST_READ:
+		ct.hints->caps |= FI_RMA;
+		break;
+	case PP_TEST_ATOMIC:
+	case PP_TEST_ATOMIC_RATE:
+		ct.hints->caps |= FI_ATOMIC;
 		break;
 	default:
-		fprintf(stderr, "Endpoint unsupported: %d\n",
-			ct.hints->ep_attr->type);
-		ret = EXIT_FAILURE;
+		break;
+	}
+
+	if (ct.opts.tags && !(ct.hints->caps & FI_TAGGED)) {
+		fprintf(stderr, "Pre-posted tags require tagged transfers\n");
+		return EXIT_FAILURE;
+	}
+
+	pp_banner_options(&ct);
+
+	cts = calloc(ct.opts.threads, sizeof(*cts));
+	if (!cts)
+		return EXIT_FAILURE;
+
+	for (i = 0; i < ct.opts.threads; i++) {
+		cts[i] = ct;
+		cts[i].thread_id = i;
+		cts[i].hints = fi_dupinfo(ct.hints);
+		if (!cts[i].hints) {
+			ret = -FI_ENOMEM;
+			goto out;
+		}
 	}
 
-	pp_free_res(&ct);
+	if (ct.opts.threads == 1) {
+		ret = pp_run(&cts[0]);
+	} else {
+		for (i = 0; i < ct.opts.threads; i++) {
+			ret = pthread_create(&cts[i].thread, NULL,
+					     pp_run_thread, &cts[i]);
+			if (ret) {
+				PP_PRINTERR("pthread_create", -ret);
+				ret = -ret;
+				break;
+			}
+		}
+		while (i--) {
+			pthread_join(cts[i].thread, &thread_ret);
+			if (!ret)
+				ret = (int)(intptr_t)thread_ret;
+		}
+	}
+
+	if (!ret)
+		pp_show_results(cts, ct.opts.threads);
+
+out:
+	for (i = 0; i < ct.opts.threads; i++)
+		pp_free_res(&cts[i]);
+	free(cts);
+	fi_freeinfo(ct.hints);
 	return -ret;
 }